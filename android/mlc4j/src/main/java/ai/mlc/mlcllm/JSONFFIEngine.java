@@ -12,6 +12,7 @@ public class JSONFFIEngine {
     private Function reloadFunc;
     private Function unloadFunc;
     private Function resetFunc;
+    private Function setDevicePowerStateFunc;
     private Function chatCompletionFunc;
     private Function abortFunc;
     private Function getLastErrorFunc;
@@ -28,6 +29,7 @@ public class JSONFFIEngine {
         reloadFunc = jsonFFIEngine.getFunction("reload");
         unloadFunc = jsonFFIEngine.getFunction("unload");
         resetFunc = jsonFFIEngine.getFunction("reset");
+        setDevicePowerStateFunc = jsonFFIEngine.getFunction("set_device_power_state");
         chatCompletionFunc = jsonFFIEngine.getFunction("chat_completion");
         abortFunc = jsonFFIEngine.getFunction("abort");
         getLastErrorFunc = jsonFFIEngine.getFunction("get_last_error");
@@ -56,6 +58,10 @@ public class JSONFFIEngine {
         reloadFunc.pushArg(engineConfigJSONStr).invoke();
     }
 
+    public void setDevicePowerState(String devicePowerState) {
+        setDevicePowerStateFunc.pushArg(devicePowerState).invoke();
+    }
+
     public void chatCompletion(String requestJSONStr, String requestId) {
         chatCompletionFunc.pushArg(requestJSONStr).pushArg(requestId).invoke();
     }
@@ -2,6 +2,8 @@
 
 #include <tvm/runtime/registry.h>
 
+#include <algorithm>
+
 #include "../support/json_parser.h"
 #include "image_utils.h"
 
@@ -217,8 +219,19 @@ Result<std::optional<std::string>> TryGetFunctionCallingString(
 
 Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
                                        const ChatCompletionRequest& request,
-                                       const ModelConfig& config, DLDevice device) {
+                                       const ModelConfig& config, DLDevice device,
+                                       std::vector<size_t>* message_ends) {
   using TResult = Result<std::vector<Data>>;
+  if (message_ends != nullptr) {
+    message_ends->clear();
+  }
+  // The message ends are the offsets in the pending text, which are valid when no image
+  // commits the pending text.
+  auto f_record_message_end = [&](const std::string& text) {
+    if (message_ends != nullptr) {
+      message_ends->push_back(text.size());
+    }
+  };
 
   Result<std::optional<std::string>> fn_call_str_tmp = TryGetFunctionCallingString(conv, request);
   if (fn_call_str_tmp.IsErr()) {
@@ -253,12 +266,31 @@ Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
   // the seperator after system message.
   if (!pending_text.empty()) {
     pending_text += conv.seps[0];
+    f_record_message_end(pending_text);
   }
 
   // Get the message strings
   std::vector<Data> message_list;
   size_t non_system_msg_count = 0;
 
+  // pending images records the consecutive images without text in between,
+  // which are preprocessed and embedded together as one ImageData
+  // with the content hash chained over the base64 strings of the images
+  std::vector<NDArray> pending_images;
+  int pending_embed_size = 0;
+  uint64_t pending_content_hash = 0;
+  auto f_commit_pending_images = [&]() {
+    if (pending_images.empty()) {
+      return;
+    }
+    int image_size = config.vision_config.value().image_size;
+    NDArray image_ndarray = ClipPreprocessor(pending_images, image_size, device);
+    message_list.push_back(ImageData(image_ndarray, pending_embed_size, pending_content_hash));
+    pending_images.clear();
+    pending_embed_size = 0;
+    pending_content_hash = 0;
+  };
+
   // returns error if error happens
   auto f_process_messages =
       [&](const std::vector<ChatCompletionMessage>& msg_vec) -> std::optional<TResult> {
@@ -275,6 +307,7 @@ Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
       // skip when content is empty
       if (msg.content.IsNull()) {
         pending_text += role_name + conv.role_empty_sep;
+        f_record_message_end(pending_text);
         continue;
       }
       ++non_system_msg_count;
@@ -325,13 +358,19 @@ Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
 
             int embed_size = (image_size * image_size) / (patch_size * patch_size);
 
-            auto image_ndarray = ClipPreprocessor(image_data_res.Unwrap(), image_size, device);
-            // lazily commit text data
+            // lazily commit the pending images and text data
             if (pending_text.length() != 0) {
+              f_commit_pending_images();
               message_list.push_back(TextData(pending_text));
               pending_text = "";
             }
-            message_list.push_back(ImageData(image_ndarray, embed_size));
+            pending_images.push_back(image_data_res.Unwrap());
+            pending_embed_size += embed_size;
+            pending_content_hash =
+                pending_content_hash == 0
+                    ? ImageData::HashContent(base64_image.data(), base64_image.size())
+                    : ImageData::HashContent(base64_image.data(), base64_image.size(),
+                                             pending_content_hash);
           } else {
             return TResult::Error("Unsupported content type: " + it_type->second);
           }
@@ -341,6 +380,7 @@ Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
         pending_text += conv.GetRoleText(msg.role, msg.content.Text(), fn_call_string);
       }
       pending_text += seperator;
+      f_record_message_end(pending_text);
     }
     return std::nullopt;
   };
@@ -358,12 +398,78 @@ Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
   if (auto err = f_process_messages({last_assistant_begin})) {
     return err.value();
   }
+  f_commit_pending_images();
   if (pending_text.length() != 0) {
     message_list.push_back(TextData(pending_text));
   }
+  if (message_ends != nullptr &&
+      (message_list.size() != 1 || !message_list[0]->IsInstance<TextDataNode>())) {
+    message_ends->clear();
+  }
   return TResult::Ok(message_list);
 }
 
+/****************** Prompt token cache ******************/
+
+std::vector<int32_t> PromptTokenCache::Encode(const Tokenizer& tokenizer, const std::string& text,
+                                              const std::vector<size_t>& message_ends) {
+  // The prompt is cut at the last message end before the trailing assistant prefix, where the
+  // prompt of the next turn diverges.
+  auto it_cut = std::lower_bound(message_ends.begin(), message_ends.end(), text.size());
+  if (disabled_ || it_cut == message_ends.begin() || *(it_cut - 1) == 0) {
+    return tokenizer->Encode(text);
+  }
+  size_t cut = *(it_cut - 1);
+
+  // - Find the longest cached prefix that ends at a message end no later than the cut.
+  auto it_match = entries_.end();
+  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+    const std::string& prefix = it->first;
+    bool longer = it_match == entries_.end() || prefix.size() > it_match->first.size();
+    if (prefix.size() <= cut && longer &&
+        std::binary_search(message_ends.begin(), message_ends.end(), prefix.size()) &&
+        text.compare(0, prefix.size(), prefix) == 0) {
+      it_match = it;
+    }
+  }
+  std::vector<int32_t> token_ids;
+  size_t begin = 0;
+  if (it_match != entries_.end()) {
+    token_ids = it_match->second;
+    begin = it_match->first.size();
+  }
+
+  // - Tokenize the text up to the cut, and cache the ids of the prefix.
+  if (begin < cut) {
+    std::vector<int32_t> piece_ids = tokenizer->Encode(text.substr(begin, cut - begin));
+    token_ids.insert(token_ids.end(), piece_ids.begin(), piece_ids.end());
+  }
+  if (it_match != entries_.end() && it_match->first.size() == cut) {
+    entries_.splice(entries_.begin(), entries_, it_match);
+  } else {
+    entries_.emplace_front(text.substr(0, cut), token_ids);
+    if (static_cast<int>(entries_.size()) > kCapacity) {
+      entries_.pop_back();
+    }
+  }
+  std::vector<int32_t> suffix_ids = tokenizer->Encode(text.substr(cut));
+  token_ids.insert(token_ids.end(), suffix_ids.begin(), suffix_ids.end());
+
+  if (!checked_) {
+    // Check once that tokenizing in pieces matches tokenizing the whole prompt.
+    checked_ = true;
+    std::vector<int32_t> whole_ids = tokenizer->Encode(text);
+    if (whole_ids != token_ids) {
+      LOG(WARNING) << "Tokenizing the prompt at message boundaries differs from tokenizing it "
+                      "as a whole. The prompt token cache is disabled.";
+      disabled_ = true;
+      entries_.clear();
+      return whole_ids;
+    }
+  }
+  return token_ids;
+}
+
 Result<Conversation> Conversation::FromJSON(const picojson::object& json_obj) {
   using TResult = Result<Conversation>;
   Conversation conv;
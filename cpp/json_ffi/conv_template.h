@@ -2,6 +2,7 @@
 #define MLC_LLM_JSON_FFI_CONV_TEMPLATE_H
 
 #include <iostream>
+#include <list>
 #include <map>
 #include <optional>
 #include <string>
@@ -11,6 +12,7 @@
 
 #include "../serve/data.h"
 #include "../support/result.h"
+#include "../tokenizers.h"
 #include "openai_api_protocol.h"
 #include "picojson.h"
 
@@ -141,10 +143,56 @@ struct Conversation {
   static Result<Conversation> FromJSON(const std::string& json_str);
 };
 
-/*! \brief Create the list of prompts from the messages based on the conversation template. */
+/*!
+ * \brief Create the list of prompts from the messages based on the conversation template.
+ * \param message_ends If given, set to the offsets in the prompt text where each message ends,
+ * when the prompt is a single TextData. It is cleared for the prompts with images.
+ */
 Result<std::vector<Data>> CreatePrompt(const Conversation& conv,
                                        const ChatCompletionRequest& request,
-                                       const ModelConfig& config, DLDevice device);
+                                       const ModelConfig& config, DLDevice device,
+                                       std::vector<size_t>* message_ends = nullptr);
+
+/****************** Prompt token cache ******************/
+
+/*!
+ * \brief The cache of the token ids of recent prompts, cut at a message boundary. A chat request
+ * resends the history of the conversation, whose rendered text starts with the prompt of the
+ * previous turn, so that only the text after the longest cached prefix is tokenized.
+ * \note Tokenizing the prompt in pieces cut at message boundaries matches tokenizing it as a
+ * whole for the usual chat templates, whose separators are special tokens or new lines. This is
+ * checked against the whole prompt once, and the cache is disabled for good on a mismatch.
+ */
+class PromptTokenCache {
+ public:
+  /*!
+   * \brief Tokenize the given prompt text, reusing the ids of its longest cached prefix.
+   * \param tokenizer The tokenizer to encode the text with.
+   * \param text The prompt text.
+   * \param message_ends The offsets in the text where each message ends, in ascending order.
+   * \return The token ids of the prompt.
+   */
+  std::vector<int32_t> Encode(const Tokenizer& tokenizer, const std::string& text,
+                              const std::vector<size_t>& message_ends);
+
+  /*! \brief Clear the cache and the check, as when the tokenizer changes. */
+  void Clear() {
+    entries_.clear();
+    checked_ = false;
+    disabled_ = false;
+  }
+
+ private:
+  /*! \brief The max number of cached prompts, at most one for each recent conversation. */
+  static constexpr int kCapacity = 64;
+
+  /*! \brief The cached prompt prefixes and ids, from the most recently used to the least. */
+  std::list<std::pair<std::string, std::vector<int32_t>>> entries_;
+  /*! \brief Whether the pieced tokenization has been checked against the whole prompt. */
+  bool checked_ = false;
+  /*! \brief Whether the cache is disabled, as the pieced tokenization mismatches. */
+  bool disabled_ = false;
+};
 
 }  // namespace json_ffi
 }  // namespace llm
@@ -1,8 +1,9 @@
 #include "image_utils.h"
 
-#include <dmlc/io.h>
+#include <array>
+#include <cstdint>
+#include <vector>
 
-#include "../../3rdparty/tvm/src/support/base64.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -12,56 +13,72 @@ namespace json_ffi {
 
 using namespace tvm::runtime;
 
-class MemoryBufferStream : public dmlc::Stream {
- public:
-  MemoryBufferStream(const char* data, size_t size) : data_(data), size_(size), pos_(0) {}
+/*! \brief Return the table from base64 characters to their 6-bit values, or -1 if invalid. */
+const std::array<int8_t, 256>& Base64DecodeTable() {
+  static const std::array<int8_t, 256> table = []() {
+    const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::array<int8_t, 256> table;
+    table.fill(-1);
+    for (int i = 0; i < 64; ++i) {
+      table[static_cast<unsigned char>(alphabet[i])] = i;
+    }
+    return table;
+  }();
+  return table;
+}
 
-  size_t Read(void* ptr, size_t size) override {
-    size_t remaining = size_ - pos_;
-    if (size > remaining) {
-      size = remaining;
+/*!
+ * \brief Decode the base64 string into the buffer. The buffer is reused across calls, so
+ * that decoding does not allocate once the buffer has grown to the largest image.
+ * \return Whether the string is valid base64.
+ */
+bool DecodeBase64(const std::string& base64_str, std::vector<unsigned char>* buffer) {
+  const std::array<int8_t, 256>& table = Base64DecodeTable();
+  buffer->resize((base64_str.size() + 3) / 4 * 3);
+  unsigned char* out = buffer->data();
+  uint32_t bits = 0;
+  int num_sextets = 0;
+  for (char ch : base64_str) {
+    if (ch == '=') {
+      break;
     }
-    if (size == 0) {
-      return 0;
+    if (ch == '\n' || ch == '\r' || ch == ' ') {
+      continue;
+    }
+    int8_t value = table[static_cast<unsigned char>(ch)];
+    if (value < 0) {
+      return false;
+    }
+    bits = (bits << 6) | value;
+    if (++num_sextets == 4) {
+      *out++ = static_cast<unsigned char>(bits >> 16);
+      *out++ = static_cast<unsigned char>(bits >> 8);
+      *out++ = static_cast<unsigned char>(bits);
+      bits = 0;
+      num_sextets = 0;
     }
-    std::memcpy(ptr, data_ + pos_, size);
-    pos_ += size;
-    return size;
-  }
-
-  void Write(const void* ptr, size_t size) override {
-    LOG(FATAL) << "MemoryBufferStream does not support write";
-  }
-
- private:
-  const char* data_;
-  size_t size_;
-  size_t pos_;
-};
-
-size_t Base64DecodedSize(const std::string& base64_str) {
-  size_t len = base64_str.size();
-  size_t padding = 0;
-  if (base64_str[len - 1] == '=') {
-    padding++;
   }
-  if (base64_str[len - 2] == '=') {
-    padding++;
+  if (num_sextets == 1) {
+    return false;
+  } else if (num_sextets == 2) {
+    *out++ = static_cast<unsigned char>(bits >> 4);
+  } else if (num_sextets == 3) {
+    *out++ = static_cast<unsigned char>(bits >> 10);
+    *out++ = static_cast<unsigned char>(bits >> 2);
   }
-  return 3 * len / 4 - padding;
+  buffer->resize(out - buffer->data());
+  return true;
 }
 
 Result<NDArray> LoadImageFromBase64(const std::string& base64_str) {
   using TResult = Result<NDArray>;
-  MemoryBufferStream stream(base64_str.c_str(), base64_str.size());
-  tvm::support::Base64InStream base64_stream(&stream);
-  size_t decoded_size = Base64DecodedSize(base64_str);
-  std::vector<unsigned char> decoded(decoded_size);
-  base64_stream.InitPosition();
-  base64_stream.Read((void*)decoded.data(), decoded_size);
+  thread_local std::vector<unsigned char> decoded;
+  if (!DecodeBase64(base64_str, &decoded)) {
+    return TResult::Error("The image is not a valid base64 string");
+  }
   int width, height, num_channels;
   unsigned char* image_data =
-      stbi_load_from_memory(decoded.data(), decoded_size, &width, &height, &num_channels, 3);
+      stbi_load_from_memory(decoded.data(), decoded.size(), &width, &height, &num_channels, 3);
   if (!image_data) {
     return TResult::Error(stbi_failure_reason());
   }
@@ -71,9 +88,17 @@ Result<NDArray> LoadImageFromBase64(const std::string& base64_str) {
   return TResult::Ok(image_ndarray);
 }
 
-NDArray ClipPreprocessor(NDArray image_data, int target_size, DLDevice device) {
-  int height = image_data->shape[0];
-  int width = image_data->shape[1];
+/*!
+ * \brief Resize the image with bilinear interpolation so that the short side is the target
+ * size, center crop it to the target size, and rescale and normalize it into the
+ * channel-first output. Only the pixels in the crop are interpolated. The source columns and
+ * weights are computed once per column, so that the loop over a row of a channel is free of
+ * index math and vectorizes.
+ */
+void ResizeCropNormalize(const NDArray& image_data, int target_size, float* output) {
+  const int height = image_data->shape[0];
+  const int width = image_data->shape[1];
+  const uint8_t* pixels = static_cast<const uint8_t*>(image_data->data) + image_data->byte_offset;
   // Resize
   const int short_side = width < height ? width : height;
   const int long_side = width > height ? width : height;
@@ -81,76 +106,87 @@ NDArray ClipPreprocessor(NDArray image_data, int target_size, DLDevice device) {
   const int new_long_side = (int)(new_short_side * (long_side / (float)short_side));
   const int new_width = width < height ? new_short_side : new_long_side;
   const int new_height = width > height ? new_short_side : new_long_side;
-
-  std::vector<float> processed_image_data(new_width * new_height * 3);
-
-  // Bilinear Interpolation
-  for (int y = 0; y < new_height; y++) {
-    for (int x = 0; x < new_width; x++) {
-      const float x_ratio = float(width - 1) / new_width;
-      const float y_ratio = float(height - 1) / new_height;
-      const int x1 = int(x_ratio * x);
-      const int y1 = int(y_ratio * y);
-      const int x2 = x1 + 1;
-      const int y2 = y1 + 1;
-      const float x_diff = x_ratio * x - x1;
-      const float y_diff = y_ratio * y - y1;
-      for (int c = 0; c < 3; c++) {
-        const uint8_t top_left = ((uint8_t*)image_data->data)[(y1 * width + x1) * 3 + c];
-        const uint8_t top_right = ((uint8_t*)image_data->data)[(y1 * width + x2) * 3 + c];
-        const uint8_t bottom_left = ((uint8_t*)image_data->data)[(y2 * width + x1) * 3 + c];
-        const uint8_t bottom_right = ((uint8_t*)image_data->data)[(y2 * width + x2) * 3 + c];
-        processed_image_data[(y * new_width + x) * 3 + c] =
-            (float)(int(top_left * (1 - x_diff) * (1 - y_diff) + top_right * x_diff * (1 - y_diff) +
-                        bottom_left * y_diff * (1 - x_diff) + bottom_right * x_diff * y_diff));
-      }
-    }
-  }
-
+  const float x_ratio = float(width - 1) / new_width;
+  const float y_ratio = float(height - 1) / new_height;
   // Center crop
   const int crop_x = (new_width - target_size) / 2;
   const int crop_y = (new_height - target_size) / 2;
-  std::vector<float> cropped_image_data(target_size * target_size * 3);
-  for (int y = 0; y < target_size; y++) {
-    for (int x = 0; x < target_size; x++) {
-      for (int c = 0; c < 3; c++) {
-        cropped_image_data[(y * target_size + x) * 3 + c] =
-            processed_image_data[((y + crop_y) * new_width + x + crop_x) * 3 + c];
-      }
-    }
-  }
 
-  // Rescale
-  for (int i = 0; i < target_size * target_size * 3; i++) {
-    cropped_image_data[i] = cropped_image_data[i] / 255.0f;
+  thread_local std::vector<int> left_offsets;
+  thread_local std::vector<float> x_diffs;
+  left_offsets.resize(target_size);
+  x_diffs.resize(target_size);
+  for (int x = 0; x < target_size; ++x) {
+    const int x1 = int(x_ratio * (x + crop_x));
+    left_offsets[x] = x1 * 3;
+    x_diffs[x] = x_ratio * (x + crop_x) - x1;
   }
 
   // Normalize
   const float IMAGE_MEAN[] = {0.48145466f, 0.4578275f, 0.40821073f};
   const float IMAGE_STD[] = {0.26862954f, 0.26130258f, 0.27577711f};
-  for (int i = 0; i < target_size * target_size * 3; i++) {
-    const int c = i % 3;
-    cropped_image_data[i] = (cropped_image_data[i] - IMAGE_MEAN[c]) / IMAGE_STD[c];
-  }
-
-  std::vector<float> image_data_channel_first(target_size * target_size * 3);
-  for (int y = 0; y < target_size; y++) {
-    for (int x = 0; x < target_size; x++) {
-      for (int c = 0; c < 3; c++) {
-        image_data_channel_first[c * target_size * target_size + y * target_size + x] =
-            cropped_image_data[(y * target_size + x) * 3 + c];
+  const int channel_size = target_size * target_size;
+  for (int y = 0; y < target_size; ++y) {
+    const int y1 = int(y_ratio * (y + crop_y));
+    const float y_diff = y_ratio * (y + crop_y) - y1;
+    const uint8_t* top_row = pixels + y1 * width * 3;
+    const uint8_t* bottom_row = top_row + width * 3;
+    for (int c = 0; c < 3; ++c) {
+      const uint8_t* top = top_row + c;
+      const uint8_t* bottom = bottom_row + c;
+      const float mean = IMAGE_MEAN[c];
+      const float stddev = IMAGE_STD[c];
+      float* out_row = output + c * channel_size + y * target_size;
+      for (int x = 0; x < target_size; ++x) {
+        const int left = left_offsets[x];
+        const float x_diff = x_diffs[x];
+        // Bilinear interpolation, truncated to integer as the resized image is 8-bit.
+        const float value = (float)(int(top[left] * (1 - x_diff) * (1 - y_diff) +
+                                        top[left + 3] * x_diff * (1 - y_diff) +
+                                        bottom[left] * y_diff * (1 - x_diff) +
+                                        bottom[left + 3] * x_diff * y_diff));
+        // Rescale and normalize
+        out_row[x] = (value / 255.0f - mean) / stddev;
       }
     }
   }
+}
 
-  // Create NDArray
-  auto image_ndarray = NDArray::Empty({1, 3, target_size, target_size}, {kDLFloat, 32, 1}, device);
-  image_ndarray.CopyFromBytes((void*)image_data_channel_first.data(),
-                              target_size * target_size * 3 * sizeof(float));
-
+NDArray ClipPreprocessor(const std::vector<NDArray>& images, int target_size, DLDevice device) {
+  const int num_images = images.size();
+  ShapeTuple shape{num_images, 3, target_size, target_size};
+  DLDataType dtype{kDLFloat, 32, 1};
+  NDArray image_ndarray = NDArray::Empty(shape, dtype, device);
+  // Preprocess into the output directly on CPU, and otherwise into the pooled host buffer
+  // that the output is uploaded from, which is page-locked on CUDA/ROCm.
+  NDArray host_ndarray = image_ndarray;
+  if (device.device_type != kDLCPU) {
+    Device host_device{kDLCPU, 0};
+    if (device.device_type == kDLCUDA || device.device_type == kDLROCM) {
+      host_device.device_type = device.device_type == kDLCUDA ? kDLCUDAHost : kDLROCMHost;
+    }
+    thread_local NDArray upload_buffer{nullptr};
+    int64_t num_elements = num_images * 3 * target_size * target_size;
+    if (!upload_buffer.defined() || upload_buffer->device.device_type != host_device.device_type ||
+        upload_buffer->shape[0] < num_elements) {
+      upload_buffer = NDArray::Empty({num_elements}, dtype, host_device);
+    }
+    host_ndarray = upload_buffer.CreateView(shape, dtype);
+  }
+  float* output = static_cast<float*>(host_ndarray->data) + host_ndarray->byte_offset / 4;
+  for (int i = 0; i < num_images; ++i) {
+    ResizeCropNormalize(images[i], target_size, output + i * 3 * target_size * target_size);
+  }
+  if (!host_ndarray.same_as(image_ndarray)) {
+    image_ndarray.CopyFrom(host_ndarray);
+  }
   return image_ndarray;
 }
 
+NDArray ClipPreprocessor(NDArray image_data, int target_size, DLDevice device) {
+  return ClipPreprocessor(std::vector<NDArray>{image_data}, target_size, device);
+}
+
 }  // namespace json_ffi
 }  // namespace llm
 }  // namespace mlc
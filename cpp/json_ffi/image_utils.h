@@ -10,6 +10,7 @@
 
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "../support/result.h"
 
@@ -24,6 +25,13 @@ Result<tvm::runtime::NDArray> LoadImageFromBase64(const std::string& base64_str)
 tvm::runtime::NDArray ClipPreprocessor(tvm::runtime::NDArray image_data, int target_size,
                                        DLDevice device);
 
+/*!
+ * \brief Preprocess the CPU images for CLIP encoder and return them batched in one NDArray of
+ * shape {num_images, 3, target_size, target_size} on the given device.
+ */
+tvm::runtime::NDArray ClipPreprocessor(const std::vector<tvm::runtime::NDArray>& images,
+                                       int target_size, DLDevice device);
+
 }  // namespace json_ffi
 }  // namespace llm
 }  // namespace mlc
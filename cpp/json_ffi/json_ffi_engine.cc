@@ -9,6 +9,7 @@
 
 #include "../serve/model.h"
 #include "../support/json_parser.h"
+#include "../support/json_writer.h"
 #include "../support/result.h"
 
 namespace mlc {
@@ -44,9 +45,11 @@ void JSONFFIEngine::StreamBackError(std::string request_id) {
   response.model = "json_ffi";  // TODO: Return model name from engine (or from args)
   response.system_fingerprint = "";
 
-  picojson::array response_arr;
-  response_arr.push_back(picojson::value(response.AsJSON()));
-  std::string stream_back_json = picojson::value(response_arr).serialize();
+  std::string stream_back_json;
+  json::JSONWriter writer(&stream_back_json);
+  writer.BeginArray();
+  response.WriteJSON(&writer);
+  writer.EndArray();
   this->request_stream_callback_(stream_back_json);
 }
 
@@ -58,13 +61,20 @@ bool JSONFFIEngine::AddRequest(std::string request_json_str, std::string request
   }
   ChatCompletionRequest request = request_res.Unwrap();
   // get prompt: note, assistant was appended in the end.
-  Result<std::vector<Data>> inputs_obj =
-      CreatePrompt(this->conv_template_, request, this->model_config_, this->device_);
+  std::vector<size_t> message_ends;
+  Result<std::vector<Data>> inputs_obj = CreatePrompt(
+      this->conv_template_, request, this->model_config_, this->device_, &message_ends);
   if (inputs_obj.IsErr()) {
     err_ = inputs_obj.UnwrapErr();
     return false;
   }
   Array<Data> inputs = inputs_obj.Unwrap();
+  if (!message_ends.empty()) {
+    // Tokenize the text prompt with the cached ids of the conversation history, so that the
+    // request carries the token ids and the engine does not tokenize the history again.
+    std::string text = Downcast<TextData>(inputs[0])->text;
+    inputs = {TokenData(this->prompt_token_cache_.Encode(this->tokenizer_, text, message_ends))};
+  }
 
   // generation_cfg
   Array<String> stop_strs;
@@ -111,6 +121,7 @@ class JSONFFIEngineImpl : public JSONFFIEngine, public ModuleNode {
   TVM_MODULE_VTABLE_ENTRY("reload", &JSONFFIEngineImpl::Reload);
   TVM_MODULE_VTABLE_ENTRY("unload", &JSONFFIEngineImpl::Unload);
   TVM_MODULE_VTABLE_ENTRY("reset", &JSONFFIEngineImpl::Reset);
+  TVM_MODULE_VTABLE_ENTRY("set_device_power_state", &JSONFFIEngineImpl::SetDevicePowerState);
   TVM_MODULE_VTABLE_ENTRY("chat_completion", &JSONFFIEngineImpl::ChatCompletion);
   TVM_MODULE_VTABLE_ENTRY("abort", &JSONFFIEngineImpl::Abort);
   TVM_MODULE_VTABLE_ENTRY("get_last_error", &JSONFFIEngineImpl::GetLastError);
@@ -131,8 +142,8 @@ class JSONFFIEngineImpl : public JSONFFIEngine, public ModuleNode {
     auto frequest_stream_callback_wrapper = [this](TVMArgs args, TVMRetValue* ret) {
       ICHECK_EQ(args.size(), 1);
       Array<RequestStreamOutput> delta_outputs = args[0];
-      std::string responses = this->GetResponseFromStreamOutput(delta_outputs);
-      this->request_stream_callback_(responses);
+      this->WriteResponseFromStreamOutput(delta_outputs, &this->response_buffer_);
+      this->request_stream_callback_(this->response_buffer_);
     };
 
     request_stream_callback = PackedFunc(frequest_stream_callback_wrapper);
@@ -158,72 +169,99 @@ class JSONFFIEngineImpl : public JSONFFIEngine, public ModuleNode {
     this->model_config_ = ModelConfig::FromJSON(
         json::Lookup<picojson::object>(model_config_json_unwrapped, "model_config"));
 
-    // Create streamer.
-    // Todo(mlc-team): Create one streamer for each request, instead of a global one.
-    this->streamer_ =
-        TextStreamer(Tokenizer::FromPath(json::Lookup<std::string>(engine_config_json, "model")));
+    // Load the tokenizer of the streamers, which are created for each request.
+    this->tokenizer_ = Tokenizer::FromPath(json::Lookup<std::string>(engine_config_json, "model"));
+    this->streamers_.clear();
+    this->prompt_token_cache_.Clear();
   }
 
   void Unload() { this->engine_->Unload(); }
 
   void Reset() { this->engine_->Reset(); }
 
+  /*!
+   * \brief Set the thermal and battery state of the device, which is one of "nominal", "fair",
+   * "serious" and "critical". The engine scales its batch size, prefill chunk size and step
+   * pacing by the state, without dropping the running requests.
+   */
+  void SetDevicePowerState(String device_power_state) {
+    // Validate the state on the caller thread, before it reaches the engine loop.
+    DevicePowerStateFromString(device_power_state);
+    picojson::object config;
+    config["device_power_state"] = picojson::value(std::string(device_power_state));
+    this->engine_->Reconfigure(picojson::value(config).serialize());
+  }
+
   void RunBackgroundLoop() { this->engine_->RunBackgroundLoop(); }
 
   void RunBackgroundStreamBackLoop() { this->engine_->RunBackgroundStreamBackLoop(); }
 
-  String GetResponseFromStreamOutput(Array<RequestStreamOutput> delta_outputs) {
-    std::unordered_map<std::string, std::vector<ChatCompletionStreamResponseChoice>> response_map;
-    for (const auto& delta_output : delta_outputs) {
+  /*!
+   * \brief Write the chat completion stream responses of the delta outputs into the buffer,
+   * as a JSON array with one response for each delta output. The delta tokens of each choice
+   * are detokenized by the text streamer of the choice, so that the incomplete UTF-8
+   * characters of concurrent requests do not interleave.
+   */
+  void WriteResponseFromStreamOutput(const Array<RequestStreamOutput>& delta_outputs,
+                                     std::string* buffer) {
+    buffer->clear();
+    json::JSONWriter writer(buffer);
+    writer.BeginArray();
+    for (const RequestStreamOutput& delta_output : delta_outputs) {
       std::string request_id = delta_output->request_id;
-      if (response_map.find(request_id) == response_map.end()) {
-        response_map[request_id] = std::vector<ChatCompletionStreamResponseChoice>();
-      }
-      ChatCompletionStreamResponseChoice choice;
-
-      if (delta_output->group_finish_reason.size() != 1) {
-        // Only support n = 1 in ChatCompletionStreamResponse for now
-        this->err_ += "Group finish reason should have exactly one element";
-      }
-      Optional<String> finish_reason = delta_output->group_finish_reason[0];
-      if (finish_reason.defined()) {
-        if (finish_reason.value() == "stop") {
-          choice.finish_reason = FinishReason::stop;
-        } else if (finish_reason.value() == "length") {
-          choice.finish_reason = FinishReason::length;
-        } else if (finish_reason.value() == "tool_calls") {
-          choice.finish_reason = FinishReason::tool_calls;
-        } else if (finish_reason.value() == "error") {
-          choice.finish_reason = FinishReason::error;
+      int num_choices = delta_output->group_delta_token_ids.size();
+      std::vector<TextStreamer>& streamers = this->streamers_[request_id];
+      if (streamers.empty()) {
+        streamers.reserve(num_choices);
+        for (int i = 0; i < num_choices; ++i) {
+          streamers.push_back(TextStreamer(this->tokenizer_));
         }
-      } else {
-        choice.finish_reason = std::nullopt;
       }
+      ICHECK_EQ(static_cast<int>(streamers.size()), num_choices);
+      ICHECK_EQ(static_cast<int>(delta_output->group_finish_reason.size()), num_choices);
 
-      choice.index = response_map[request_id].size();
-
-      ChatCompletionMessage delta;
-      // Size of delta_output->group_delta_token_ids Array should be 1
-      IntTuple delta_token_ids = delta_output->group_delta_token_ids[0];
-      std::vector<int32_t> delta_token_ids_vec(delta_token_ids.begin(), delta_token_ids.end());
-      delta.content = this->streamer_->Put(delta_token_ids_vec);
-      delta.role = "assistant";
-
-      choice.delta = delta;
-
-      response_map[request_id].push_back(choice);
-    }
-
-    picojson::array response_arr;
-    for (const auto& [request_id, choices] : response_map) {
       ChatCompletionStreamResponse response;
       response.id = request_id;
-      response.choices = choices;
       response.model = "json_ffi";  // TODO: Return model name from engine (or from args)
       response.system_fingerprint = "";
-      response_arr.push_back(picojson::value(response.AsJSON()));
+      response.choices.reserve(num_choices);
+      bool all_finished = true;
+      for (int i = 0; i < num_choices; ++i) {
+        ChatCompletionStreamResponseChoice choice;
+        Optional<String> finish_reason = delta_output->group_finish_reason[i];
+        if (finish_reason.defined()) {
+          if (finish_reason.value() == "stop") {
+            choice.finish_reason = FinishReason::stop;
+          } else if (finish_reason.value() == "length") {
+            choice.finish_reason = FinishReason::length;
+          } else if (finish_reason.value() == "tool_calls") {
+            choice.finish_reason = FinishReason::tool_calls;
+          } else if (finish_reason.value() == "error") {
+            choice.finish_reason = FinishReason::error;
+          }
+        } else {
+          choice.finish_reason = std::nullopt;
+          all_finished = false;
+        }
+        choice.index = i;
+
+        IntTuple delta_token_ids = delta_output->group_delta_token_ids[i];
+        std::vector<int32_t> delta_token_ids_vec(delta_token_ids.begin(), delta_token_ids.end());
+        std::string content = streamers[i]->Put(delta_token_ids_vec);
+        if (finish_reason.defined()) {
+          content += streamers[i]->Finish();
+        }
+        choice.delta.content = std::move(content);
+        choice.delta.role = "assistant";
+        response.choices.push_back(std::move(choice));
+      }
+      response.WriteJSON(&writer);
+      // - Release the streamers of the finished request.
+      if (all_finished) {
+        this->streamers_.erase(request_id);
+      }
     }
-    return picojson::value(response_arr).serialize();
+    writer.EndArray();
   }
 };
 
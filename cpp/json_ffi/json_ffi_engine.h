@@ -9,6 +9,8 @@
 #include <tvm/runtime/packed_func.h>
 
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "../serve/threaded_engine.h"
 #include "../streamer.h"
@@ -47,8 +49,17 @@ class JSONFFIEngine {
   std::unique_ptr<ThreadedEngine> engine_;
   std::string err_;
   PackedFunc request_stream_callback_;
-  TextStreamer streamer_;  // TODO: Support "n", and support different streamers for each request
+  Tokenizer tokenizer_;
+  /*!
+   * \brief The text streamers of the unfinished requests, one for each choice of a request.
+   * They are only accessed on the thread that streams back the outputs.
+   */
+  std::unordered_map<std::string, std::vector<TextStreamer>> streamers_;
+  /*! \brief The buffer of the response JSON string, reused across stream back callbacks. */
+  std::string response_buffer_;
   Conversation conv_template_;
+  /*! \brief The token ids of recent prompts, reused by the later turns of the conversations. */
+  PromptTokenCache prompt_token_cache_;
   String default_generation_cfg_json_str_;
   ModelConfig model_config_;
   DLDevice device_;
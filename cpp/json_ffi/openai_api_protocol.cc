@@ -129,6 +129,22 @@ picojson::object ChatFunctionCall::AsJSON() const {
   return obj;
 }
 
+void ChatFunctionCall::WriteJSON(json::JSONWriter* writer) const {
+  writer->BeginObject();
+  if (this->arguments.has_value()) {
+    writer->WriteKey("arguments");
+    writer->BeginObject();
+    for (const auto& pair : this->arguments.value()) {
+      writer->WriteKey(pair.first);
+      writer->WriteString(pair.second);
+    }
+    writer->EndObject();
+  }
+  writer->WriteKey("name");
+  writer->WriteString(this->name);
+  writer->EndObject();
+}
+
 Result<ChatToolCall> ChatToolCall::FromJSON(const picojson::object& json_obj) {
   using TResult = Result<ChatToolCall>;
   ChatToolCall chat_tool_call;
@@ -167,6 +183,17 @@ picojson::object ChatToolCall::AsJSON() const {
   return obj;
 }
 
+void ChatToolCall::WriteJSON(json::JSONWriter* writer) const {
+  writer->BeginObject();
+  writer->WriteKey("id");
+  writer->WriteString(this->id);
+  writer->WriteKey("function");
+  this->function.WriteJSON(writer);
+  writer->WriteKey("type");
+  writer->WriteString("function");
+  writer->EndObject();
+}
+
 Result<ChatCompletionMessage> ChatCompletionMessage::FromJSON(const picojson::object& json_obj) {
   using TResult = Result<ChatCompletionMessage>;
   ChatCompletionMessage message;
@@ -183,26 +210,25 @@ Result<ChatCompletionMessage> ChatCompletionMessage::FromJSON(const picojson::ob
     // skip
   } else {
     // most complicated case
-    std::vector<std::unordered_map<std::string, std::string>> parts;
-    Result<picojson::array> content_arr_res =
-        json::LookupWithResultReturn<picojson::array>(json_obj, "content");
-    if (content_arr_res.IsErr()) {
-      return TResult::Error(content_arr_res.UnwrapErr());
+    if (!it->second.is<picojson::array>()) {
+      return TResult::Error("ValueError: key \"content\" has unexpected value type.");
     }
-    for (const auto& item : content_arr_res.Unwrap()) {
+    std::vector<std::unordered_map<std::string, std::string>> parts;
+    const picojson::array& content_arr = it->second.get<picojson::array>();
+    parts.reserve(content_arr.size());
+    for (const auto& item : content_arr) {
       if (!item.is<picojson::object>()) {
         return TResult::Error("The content of chat completion message is not an object");
       }
-      picojson::object item_obj = item.get<picojson::object>();
       std::unordered_map<std::string, std::string> item_map;
-      for (const auto& [key, value] : item_obj) {
+      for (const auto& [key, value] : item.get<picojson::object>()) {
         item_map[key] = value.to_str();
       }
       parts.push_back(std::move(item_map));
     }
-    content = parts;
+    content = std::move(parts);
   }
-  message.content = content;
+  message.content = std::move(content);
 
   // role
   Result<std::string> role_str_res = json::LookupWithResultReturn<std::string>(json_obj, "role");
@@ -255,7 +281,27 @@ Result<ChatCompletionMessage> ChatCompletionMessage::FromJSON(const picojson::ob
   }
   message.tool_call_id = tool_call_id_res.Unwrap();
 
-  return TResult::Ok(message);
+  return TResult::Ok(std::move(message));
+}
+
+Result<ChatCompletionMessage> ChatCompletionMessage::FromJSON(picojson::object&& json_obj) {
+  using TResult = Result<ChatCompletionMessage>;
+  // Take the text content out of the object, which is left null, so that the long prompts are
+  // not copied.
+  std::optional<std::string> text;
+  auto it = json_obj.find("content");
+  if (it != json_obj.end() && it->second.is<std::string>()) {
+    text = std::move(it->second.get<std::string>());
+    it->second = picojson::value();
+  }
+  Result<ChatCompletionMessage> message_res =
+      FromJSON(static_cast<const picojson::object&>(json_obj));
+  if (message_res.IsErr() || !text.has_value()) {
+    return message_res;
+  }
+  ChatCompletionMessage message = message_res.Unwrap();
+  message.content = std::move(text.value());
+  return TResult::Ok(std::move(message));
 }
 
 Result<ChatCompletionRequest> ChatCompletionRequest::FromJSON(const std::string& json_str) {
@@ -268,24 +314,29 @@ Result<ChatCompletionRequest> ChatCompletionRequest::FromJSON(const std::string&
   ChatCompletionRequest request;
 
   // messages
-  Result<picojson::array> messages_arr_res =
-      json::LookupWithResultReturn<picojson::array>(json_obj, "messages");
-  if (messages_arr_res.IsErr()) {
-    return TResult::Error(messages_arr_res.UnwrapErr());
+  // The messages are moved out of the parsed object, as they hold the long prompt contents.
+  auto it_messages = json_obj.find("messages");
+  if (it_messages == json_obj.end()) {
+    return TResult::Error("ValueError: key \"messages\" not found in the JSON object");
   }
+  if (!it_messages->second.is<picojson::array>()) {
+    return TResult::Error("ValueError: key \"messages\" has unexpected value type.");
+  }
+  picojson::array& messages_arr = it_messages->second.get<picojson::array>();
   std::vector<ChatCompletionMessage> messages;
-  for (const auto& item : messages_arr_res.Unwrap()) {
+  messages.reserve(messages_arr.size());
+  for (auto& item : messages_arr) {
     if (!item.is<picojson::object>()) {
       return TResult::Error("A message in chat completion request is not object");
     }
-    picojson::object item_obj = item.get<picojson::object>();
-    Result<ChatCompletionMessage> message = ChatCompletionMessage::FromJSON(item_obj);
+    Result<ChatCompletionMessage> message =
+        ChatCompletionMessage::FromJSON(std::move(item.get<picojson::object>()));
     if (message.IsErr()) {
       return TResult::Error(message.UnwrapErr());
     }
     messages.push_back(message.Unwrap());
   }
-  request.messages = messages;
+  request.messages = std::move(messages);
 
   // model
   Result<std::optional<std::string>> model_res =
@@ -303,6 +354,16 @@ Result<ChatCompletionRequest> ChatCompletionRequest::FromJSON(const std::string&
   }
   request.max_tokens = max_tokens_res.Unwrap();
 
+  // n
+  Result<int64_t> n_res = json::LookupOrDefaultWithResultReturn<int64_t>(json_obj, "n", 1);
+  if (n_res.IsErr()) {
+    return TResult::Error(n_res.UnwrapErr());
+  }
+  if (n_res.Unwrap() < 1) {
+    return TResult::Error("\"n\" in chat completion request should be at least 1");
+  }
+  request.n = n_res.Unwrap();
+
   // frequency_penalty
   Result<std::optional<double>> frequency_penalty_res =
       json::LookupOptionalWithResultReturn<double>(json_obj, "frequency_penalty");
@@ -347,11 +408,11 @@ Result<ChatCompletionRequest> ChatCompletionRequest::FromJSON(const std::string&
       }
       tools.push_back(tool.Unwrap());
     }
-    request.tools = tools;
+    request.tools = std::move(tools);
   }
 
   // TODO: Other parameters
-  return TResult::Ok(request);
+  return TResult::Ok(std::move(request));
 }
 
 picojson::object ChatCompletionMessage::AsJSON() const {
@@ -389,6 +450,47 @@ picojson::object ChatCompletionMessage::AsJSON() const {
   return obj;
 }
 
+void ChatCompletionMessage::WriteJSON(json::JSONWriter* writer) const {
+  writer->BeginObject();
+  if (this->content.IsText()) {
+    writer->WriteKey("content");
+    writer->WriteString(this->content.Text());
+  } else if (this->content.IsParts()) {
+    writer->WriteKey("content");
+    writer->BeginArray();
+    for (const auto& item : this->content.Parts()) {
+      writer->BeginObject();
+      for (const auto& pair : item) {
+        writer->WriteKey(pair.first);
+        writer->WriteString(pair.second);
+      }
+      writer->EndObject();
+    }
+    writer->EndArray();
+  }
+
+  writer->WriteKey("role");
+  writer->WriteString(this->role);
+
+  if (this->name.has_value()) {
+    writer->WriteKey("name");
+    writer->WriteString(this->name.value());
+  }
+  if (this->tool_call_id.has_value()) {
+    writer->WriteKey("tool_call_id");
+    writer->WriteString(this->tool_call_id.value());
+  }
+  if (this->tool_calls.has_value()) {
+    writer->WriteKey("tool_calls");
+    writer->BeginArray();
+    for (const auto& tool_call : this->tool_calls.value()) {
+      tool_call.WriteJSON(writer);
+    }
+    writer->EndArray();
+  }
+  writer->EndObject();
+}
+
 picojson::object ChatCompletionResponseChoice::AsJSON() const {
   picojson::object obj;
   if (!this->finish_reason.has_value()) {
@@ -430,6 +532,28 @@ picojson::object ChatCompletionStreamResponseChoice::AsJSON() const {
   return obj;
 }
 
+void ChatCompletionStreamResponseChoice::WriteJSON(json::JSONWriter* writer) const {
+  writer->BeginObject();
+  writer->WriteKey("finish_reason");
+  if (!this->finish_reason.has_value()) {
+    writer->WriteNull();
+  } else if (this->finish_reason.value() == FinishReason::stop) {
+    writer->WriteString("stop");
+  } else if (this->finish_reason.value() == FinishReason::length) {
+    writer->WriteString("length");
+  } else if (this->finish_reason.value() == FinishReason::tool_calls) {
+    writer->WriteString("tool_calls");
+  } else {
+    ICHECK(this->finish_reason.value() == FinishReason::error);
+    writer->WriteString("error");
+  }
+  writer->WriteKey("index");
+  writer->WriteInt(this->index);
+  writer->WriteKey("delta");
+  this->delta.WriteJSON(writer);
+  writer->EndObject();
+}
+
 picojson::object ChatCompletionResponse::AsJSON() const {
   picojson::object obj;
   obj["id"] = picojson::value(this->id);
@@ -460,6 +584,27 @@ picojson::object ChatCompletionStreamResponse::AsJSON() const {
   return obj;
 }
 
+void ChatCompletionStreamResponse::WriteJSON(json::JSONWriter* writer) const {
+  writer->BeginObject();
+  writer->WriteKey("id");
+  writer->WriteString(this->id);
+  writer->WriteKey("choices");
+  writer->BeginArray();
+  for (const auto& choice : this->choices) {
+    choice.WriteJSON(writer);
+  }
+  writer->EndArray();
+  writer->WriteKey("created");
+  writer->WriteInt(this->created);
+  writer->WriteKey("model");
+  writer->WriteString(this->model);
+  writer->WriteKey("system_fingerprint");
+  writer->WriteString(this->system_fingerprint);
+  writer->WriteKey("object");
+  writer->WriteString(this->object);
+  writer->EndObject();
+}
+
 }  // namespace json_ffi
 }  // namespace llm
 }  // namespace mlc
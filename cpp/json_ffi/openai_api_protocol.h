@@ -14,6 +14,7 @@
 #include <vector>
 
 #include "../serve/config.h"
+#include "../support/json_writer.h"
 #include "../support/result.h"
 #include "picojson.h"
 
@@ -67,6 +68,8 @@ class ChatFunctionCall {
 
   static Result<ChatFunctionCall> FromJSON(const picojson::object& json);
   picojson::object AsJSON() const;
+  /*! \brief Write the JSON of AsJSON with the writer, without building a JSON object. */
+  void WriteJSON(json::JSONWriter* writer) const;
 };
 
 class ChatToolCall {
@@ -77,6 +80,8 @@ class ChatToolCall {
 
   static Result<ChatToolCall> FromJSON(const picojson::object& json);
   picojson::object AsJSON() const;
+  /*! \brief Write the JSON of AsJSON with the writer, without building a JSON object. */
+  void WriteJSON(json::JSONWriter* writer) const;
 };
 
 class ChatCompletionMessageContent {
@@ -119,7 +124,14 @@ class ChatCompletionMessage {
   std::optional<std::string> tool_call_id = std::nullopt;
 
   static Result<ChatCompletionMessage> FromJSON(const picojson::object& json);
+  /*!
+   * \brief Create a ChatCompletionMessage from the given JSON object, moving the text content
+   * out of the object rather than copying it.
+   */
+  static Result<ChatCompletionMessage> FromJSON(picojson::object&& json);
   picojson::object AsJSON() const;
+  /*! \brief Write the JSON of AsJSON with the writer, without building a JSON object. */
+  void WriteJSON(json::JSONWriter* writer) const;
 };
 
 class RequestResponseFormat {
@@ -177,6 +189,8 @@ class ChatCompletionStreamResponseChoice {
   // TODO: logprobs
 
   picojson::object AsJSON() const;
+  /*! \brief Write the JSON of AsJSON with the writer, without building a JSON object. */
+  void WriteJSON(json::JSONWriter* writer) const;
 };
 
 class ChatCompletionResponse {
@@ -202,6 +216,8 @@ class ChatCompletionStreamResponse {
   std::string object = "chat.completion.chunk";
 
   picojson::object AsJSON() const;
+  /*! \brief Write the JSON of AsJSON with the writer, without building a JSON object. */
+  void WriteJSON(json::JSONWriter* writer) const;
 };
 
 }  // namespace json_ffi
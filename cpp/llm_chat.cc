@@ -536,6 +536,12 @@ class LLMChat {
       CHECK(config["attention_sink_size"].is<int64_t>());
       this->attention_sink_size_ = config["attention_sink_size"].get<int64_t>();
     }
+    if (config.count("reuse_kv_cache")) {
+      CHECK(config["reuse_kv_cache"].is<bool>());
+      this->reuse_kv_cache_ = config["reuse_kv_cache"].get<bool>();
+    } else if (!partial_update) {
+      this->reuse_kv_cache_ = false;
+    }
     if (config.count("top_p")) {
       CHECK(config["top_p"].is<double>());
       this->top_p_ = config["top_p"].get<double>();
@@ -684,6 +690,12 @@ class LLMChat {
     } else {
       this->kv_cache_ = ft_.create_kv_cache_func_();
     }
+    // The KV cache can be reused across prefills only when its tokens can be popped, and are
+    // not evicted by the sliding window.
+    this->reuse_kv_cache_ = this->reuse_kv_cache_ &&
+                            ft_.use_kv_state == FunctionTable::KVStateKind::kAttention &&
+                            this->sliding_window_size_ == -1;
+    this->kv_token_ids_.clear();
     // Step 7. Pre-allocate fixed size ndarray
     this->temperature_arr_ = NDArray::Empty({1}, DataType::Float(32), device_);
     float temperature = static_cast<float>(this->temperature_);
@@ -703,7 +715,7 @@ class LLMChat {
     // this->conversation_ = Conversation::Create(this->conversation_.conv_template);
     this->conversation_.Reset();
     this->ResetRuntimeStats();
-    this->ResetKVCache();
+    this->ResetKVCacheForReuse();
     this->total_seq_len_ = 0;
   }
 
@@ -772,7 +784,7 @@ class LLMChat {
     }
     // need shift window and re-encode
     this->total_seq_len_ = 0;
-    this->ResetKVCache();
+    this->ResetKVCacheForReuse();
     tokens.clear();
     if (this->conversation_.add_bos) {
       tokens.insert(tokens.begin(), bos_token_id_);
@@ -972,6 +984,9 @@ class LLMChat {
 
     std::vector<int32_t> prompt_tokens =
         this->PrepareBeforeEmbedding(inp, append_conversation, place_in_prompt, generation_config);
+    if (this->total_seq_len_ == 0) {
+      this->ReuseKVCachePrefix(&prompt_tokens);
+    }
     int64_t token_len = static_cast<int64_t>(prompt_tokens.size());
     if (token_len == 0) return;
     if (ft_.use_disco) {
@@ -1223,16 +1238,14 @@ class LLMChat {
     if (gen_presence_penalty != 0.0f || gen_frequency_penalty != 0.0f) {
       this->UpdateLogitsOrProbOnCPUSync(logits_on_device);
       this->ApplyPresenceAndFrequencyPenaltyOnCPU(gen_presence_penalty, gen_frequency_penalty);
-      this->UpdateLogitsOrProbOnGPUSync(logits_on_device);
       if (gen_temperature >= 1e-6f) {
-        this->UpdateLogitsOrProbOnCPUSync(this->Softmax(logits_on_device, this->temperature_arr_));
+        this->ApplySoftmaxWithTemperatureOnCPU(gen_temperature);
       }
     } else if (gen_repetition_penalty != 1.0f) {
       this->UpdateLogitsOrProbOnCPUSync(logits_on_device);
       this->ApplyRepetitionPenaltyOnCPU(gen_repetition_penalty);
-      this->UpdateLogitsOrProbOnGPUSync(logits_on_device);
       if (gen_temperature >= 1e-6f) {
-        this->UpdateLogitsOrProbOnCPUSync(this->Softmax(logits_on_device, this->temperature_arr_));
+        this->ApplySoftmaxWithTemperatureOnCPU(gen_temperature);
       }
     } else {
       if (gen_temperature < 1e-6f) {
@@ -1332,6 +1345,7 @@ class LLMChat {
           ft_.fkvcache_array_popn_(kv_cache_, backoff);
         }
         total_seq_len_ -= backoff;
+        kv_token_ids_.resize(kv_token_ids_.size() - std::min(backoff, kv_token_ids_.size()));
       }
     }
 
@@ -1352,6 +1366,9 @@ class LLMChat {
 
   // run forward compute
   NDArray ForwardTokens(std::vector<int32_t> input_tokens, int64_t cur_pos) {
+    if (reuse_kv_cache_) {
+      kv_token_ids_.insert(kv_token_ids_.end(), input_tokens.begin(), input_tokens.end());
+    }
     ObjectRef ret{nullptr};
     if (input_tokens.size() > 1 && ft_.prefill_func_.defined()) {
       ObjectRef input_data = ft_.CopyToWorker0(this->GetInputTokenNDArray(input_tokens));
@@ -1515,6 +1532,7 @@ class LLMChat {
 
   // Clear kv cache
   void ResetKVCache() {
+    kv_token_ids_.clear();
     ft_.reset_kv_cache_func_(kv_cache_);
     if (ft_.use_kv_state) {
       ft_.kv_cache_add_sequence_func_(kv_cache_, 0);
@@ -1526,6 +1544,50 @@ class LLMChat {
     }
   }
 
+  /*!
+   * \brief Reset the KV cache before the conversation is prefilled from the start. When KV cache
+   * reuse is enabled, the cached tokens are kept for the next prefill to reuse their common
+   * prefix with the new prompt, e.g., the system prompt, instead of being cleared.
+   */
+  void ResetKVCacheForReuse() {
+    if (!reuse_kv_cache_) {
+      this->ResetKVCache();
+    }
+  }
+
+  /*!
+   * \brief Pop the cached tokens after the longest common prefix of the KV cache and the prompt
+   * prefilled from the start, and remove the prefix from the prompt. The last prompt token is
+   * always recomputed for the logits of the next token.
+   * \param prompt_tokens The prompt tokens, which are updated to the tokens to prefill.
+   */
+  void ReuseKVCachePrefix(std::vector<int32_t>* prompt_tokens) {
+    if (!reuse_kv_cache_ || prompt_tokens->empty()) {
+      return;
+    }
+    if (kv_token_ids_.empty()) {
+      this->ResetKVCache();
+      return;
+    }
+    size_t max_prefix_len = std::min(kv_token_ids_.size(), prompt_tokens->size() - 1);
+    size_t prefix_len = 0;
+    while (prefix_len < max_prefix_len &&
+           kv_token_ids_[prefix_len] == (*prompt_tokens)[prefix_len]) {
+      ++prefix_len;
+    }
+    if (prefix_len == 0) {
+      this->ResetKVCache();
+      return;
+    }
+    int64_t num_popped = kv_token_ids_.size() - prefix_len;
+    if (num_popped > 0) {
+      ft_.fkvcache_array_popn_(kv_cache_, /*seq_id=*/0, num_popped);
+      kv_token_ids_.resize(prefix_len);
+    }
+    prompt_tokens->erase(prompt_tokens->begin(), prompt_tokens->begin() + prefix_len);
+    this->total_seq_len_ = prefix_len;
+  }
+
   void ProcessSystemPrompts() {
     this->PrefillStep(/*inp=*/"", /*append_conversation=*/false, /*decode_next_token=*/false);
   }
@@ -1572,6 +1634,10 @@ class LLMChat {
   int64_t vocab_size_;
   // Load weights that were saved in sharded form
   bool use_presharded_weights_;
+  // Whether to reuse the common prefix of the KV cache when the conversation is prefilled again
+  bool reuse_kv_cache_{false};
+  // The tokens in the KV cache, tracked when KV cache reuse is enabled
+  std::vector<int32_t> kv_token_ids_;
   // shift window fill factor
   double shift_fill_factor_{0.3};
   // temperature
@@ -0,0 +1,165 @@
+/*!
+ * \file mmap_loader.cc
+ * \brief Implementation of a single-device loader that memory-maps the parameter shards.
+ */
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tvm/runtime/device_api.h>
+#include <tvm/runtime/ndarray.h>
+#include <tvm/runtime/packed_func.h>
+#include <tvm/runtime/registry.h>
+#include <tvm/runtime/relax_vm/ndarray_cache_support.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace loader {
+
+using tvm::Device;
+using tvm::runtime::relax_vm::NDArrayCacheMetadata;
+using namespace tvm::runtime;
+
+/*! \brief The read-only memory mapping of a parameter shard file. */
+class MappedShardFile {
+ public:
+  explicit MappedShardFile(const std::string& path, int64_t nbytes) : size_(nbytes) {
+    int fd = open(path.c_str(), O_RDONLY);
+    CHECK_GE(fd, 0) << "Cannot open " << path;
+    struct stat file_stat;
+    CHECK(fstat(fd, &file_stat) == 0 && file_stat.st_size >= nbytes)
+        << "ValueError: Encountered a corrupted parameter shard " << path
+        << ". It means it is not downloaded completely or downloading is interrupted. "
+           "Please try to download again.";
+    void* data = mmap(nullptr, nbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    CHECK(data != MAP_FAILED) << "Cannot memory-map " << path;
+    data_ = static_cast<const char*>(data);
+  }
+
+  ~MappedShardFile() { munmap(const_cast<char*>(data_), size_); }
+
+  MappedShardFile(const MappedShardFile&) = delete;
+  MappedShardFile& operator=(const MappedShardFile&) = delete;
+
+  const char* data() const { return data_; }
+  int64_t size() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  int64_t size_;
+};
+
+/*!
+ * \brief The DLPack context of a parameter that aliases the mapped shard file.
+ * It keeps the mapping alive until the parameter is released.
+ */
+struct MappedParamContext {
+  std::shared_ptr<MappedShardFile> file;
+  std::vector<int64_t> shape;
+  DLManagedTensor tensor;
+};
+
+/*!
+ * \brief Wrap the mapped bytes of a parameter as an NDArray on the given host-visible device
+ * without copying. Return a null NDArray if the bytes are not aligned as NDArray requires.
+ */
+NDArray WrapMappedParam(const std::shared_ptr<MappedShardFile>& file,
+                        const NDArrayCacheMetadata::FileRecord::ParamRecord& param_record,
+                        Device device) {
+  const char* data = file->data() + param_record.byte_offset;
+  if (reinterpret_cast<uintptr_t>(data) % kAllocAlignment != 0) {
+    return NDArray();
+  }
+  MappedParamContext* ctx = new MappedParamContext();
+  ctx->file = file;
+  ctx->shape.assign(param_record.shape.begin(), param_record.shape.end());
+  DLTensor& dl_tensor = ctx->tensor.dl_tensor;
+  dl_tensor.data = const_cast<char*>(data);
+  dl_tensor.device = device;
+  dl_tensor.ndim = static_cast<int32_t>(ctx->shape.size());
+  dl_tensor.dtype = param_record.dtype;
+  dl_tensor.shape = ctx->shape.data();
+  dl_tensor.strides = nullptr;
+  dl_tensor.byte_offset = 0;
+  ctx->tensor.manager_ctx = ctx;
+  ctx->tensor.deleter = [](DLManagedTensor* self) {
+    delete static_cast<MappedParamContext*>(self->manager_ctx);
+  };
+  return NDArray::FromDLPack(&ctx->tensor);
+}
+
+/*!
+ * \brief Load the given parameters to a single device, with the shard files memory-mapped
+ * instead of read into staging buffers.
+ * - When the device is host memory, the raw parameters alias the read-only mappings, so that
+ * loading takes no memory beyond the page cache of the shard files.
+ * - Otherwise, each parameter is copied to the device right from the mapped pages.
+ * The parameters in other formats (e.g., "f32-to-bf16") are decoded by the parameter record.
+ */
+Array<NDArray> LoadParamsMMap(const std::string& model_path, Device device,
+                              Array<String> param_names) {
+  NDArrayCacheMetadata ndarray_cache_metadata = NDArrayCacheMetadata::Load(model_path);
+  std::unordered_map<std::string, std::pair<int, int>> param_name2index;
+  for (int i = 0; i < static_cast<int>(ndarray_cache_metadata.records.size()); ++i) {
+    const NDArrayCacheMetadata::FileRecord& file_record = ndarray_cache_metadata.records[i];
+    for (int j = 0; j < static_cast<int>(file_record.records.size()); ++j) {
+      param_name2index[file_record.records[j].name] = {i, j};
+    }
+  }
+  bool zero_copy = device.device_type == kDLCPU;
+
+  std::vector<std::shared_ptr<MappedShardFile>> mapped_files(
+      ndarray_cache_metadata.records.size());
+  std::vector<std::string> raw_data(ndarray_cache_metadata.records.size());
+  Array<NDArray> params;
+  params.reserve(param_names.size());
+  for (const String& param_name : param_names) {
+    auto it = param_name2index.find(param_name);
+    CHECK(it != param_name2index.end()) << "Cannot find parameter " << param_name;
+    auto [file_index, param_index] = it->second;
+    const NDArrayCacheMetadata::FileRecord& file_record =
+        ndarray_cache_metadata.records[file_index];
+    const NDArrayCacheMetadata::FileRecord::ParamRecord& param_record =
+        file_record.records[param_index];
+    if (mapped_files[file_index] == nullptr) {
+      mapped_files[file_index] = std::make_shared<MappedShardFile>(
+          model_path + "/" + file_record.data_path, file_record.nbytes);
+    }
+    const std::shared_ptr<MappedShardFile>& file = mapped_files[file_index];
+
+    if (param_record.format != "raw") {
+      if (raw_data[file_index].empty()) {
+        raw_data[file_index].assign(file->data(), file->size());
+      }
+      params.push_back(param_record.Load(device, &raw_data[file_index]));
+      continue;
+    }
+    NDArray param;
+    if (zero_copy) {
+      param = WrapMappedParam(file, param_record, device);
+    }
+    if (!param.defined()) {
+      param = NDArray::Empty(param_record.shape, param_record.dtype, device);
+      param.CopyFromBytes(file->data() + param_record.byte_offset, param_record.nbytes);
+    }
+    params.push_back(param);
+  }
+  // The mappings not aliased by any parameter are unmapped here.
+  return params;
+}
+
+TVM_REGISTER_GLOBAL("mlc.loader.LoadParamsMMap").set_body_typed(LoadParamsMMap);
+
+}  // namespace loader
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // _WIN32
@@ -9,11 +9,17 @@
 #include <tvm/runtime/packed_func.h>
 #include <tvm/runtime/relax_vm/ndarray_cache_support.h>
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <exception>
 #include <filesystem>
 #include <fstream>
 #include <functional>
+#include <iomanip>
+#include <mutex>
 #include <numeric>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -83,6 +89,157 @@ class PreprocessorPool {
   std::unordered_map<std::string, TypedPackedFunc<void(DLTensor*, DLTensor*)>> preproc_funcs;
 };
 
+/*!
+ * \brief The prefetcher that reads shard files ahead of their use with parallel reader threads,
+ * so that the disk reads overlap with uploading, preprocessing and sharding the parameters of
+ * the earlier files. At most `max_num_prefetched` files are held in memory at a time. The files
+ * are read into page-locked host memory when the device has it, which speeds up the upload of
+ * the parameters to the device.
+ */
+class ShardFilePrefetcher {
+ public:
+  explicit ShardFilePrefetcher(std::string model_path,
+                               std::vector<const NDArrayCacheMetadata::FileRecord*> records,
+                               Device device, int num_threads, int max_num_prefetched)
+      : model_path_(std::move(model_path)),
+        records_(std::move(records)),
+        host_device_(GetHostDevice(device)),
+        max_num_prefetched_(max_num_prefetched) {
+    num_threads = std::max(1, std::min(num_threads, static_cast<int>(records_.size())));
+    readers_.reserve(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+      readers_.emplace_back(&ShardFilePrefetcher::ReaderLoop, this);
+    }
+  }
+
+  ~ShardFilePrefetcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    cv_.notify_all();
+    for (std::thread& reader : readers_) {
+      reader.join();
+    }
+  }
+
+  /*! \brief Get the content of the next shard file in order, waiting until it is read. */
+  NDArray Next() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ICHECK_LT(next_to_return_, static_cast<int>(records_.size()));
+    cv_.wait(lock, [this]() { return ready_files_.count(next_to_return_) || error_ != nullptr; });
+    if (error_ != nullptr) {
+      std::rethrow_exception(error_);
+    }
+    auto it = ready_files_.find(next_to_return_);
+    NDArray data = std::move(it->second);
+    ready_files_.erase(it);
+    ++next_to_return_;
+    lock.unlock();
+    // Wake up the readers waiting for a free prefetch slot.
+    cv_.notify_all();
+    return data;
+  }
+
+ private:
+  static Device GetHostDevice(Device device) {
+    if (device.device_type == kDLCUDA) {
+      return Device{kDLCUDAHost, 0};
+    } else if (device.device_type == kDLROCM) {
+      return Device{kDLROCMHost, 0};
+    }
+    return Device{kDLCPU, 0};
+  }
+
+  void ReaderLoop() {
+    int num_files = records_.size();
+    while (true) {
+      int index;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() {
+          return stopped_ || next_to_read_ == num_files ||
+                 next_to_read_ < next_to_return_ + max_num_prefetched_;
+        });
+        if (stopped_ || next_to_read_ == num_files) {
+          return;
+        }
+        index = next_to_read_++;
+      }
+      NDArray data;
+      std::exception_ptr error = nullptr;
+      try {
+        data = ReadFile(*records_[index]);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (error != nullptr) {
+          error_ = error;
+        } else {
+          ready_files_[index] = std::move(data);
+        }
+      }
+      cv_.notify_all();
+    }
+  }
+
+  NDArray ReadFile(const NDArrayCacheMetadata::FileRecord& record) const {
+    std::string path = model_path_ + "/" + record.data_path;
+    std::ifstream fs(path, std::ios::in | std::ios::binary);
+    CHECK(!fs.fail()) << "Cannot open " << path;
+    NDArray data = NDArray::Empty({record.nbytes}, DataType::UInt(8), host_device_);
+    fs.read(static_cast<char*>(data->data), record.nbytes);
+    CHECK_EQ(fs.gcount(), record.nbytes)
+        << "ValueError: Encountered a corrupted parameter shard. It means it is not downloaded "
+           "completely or downloading is interrupted. Please try to download again.";
+    return data;
+  }
+
+  std::string model_path_;
+  std::vector<const NDArrayCacheMetadata::FileRecord*> records_;
+  Device host_device_;
+  int max_num_prefetched_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  /*! \brief The index of the next file for the readers to read. */
+  int next_to_read_ = 0;
+  /*! \brief The index of the next file to return from `Next`. */
+  int next_to_return_ = 0;
+  /*! \brief The files read but not returned yet, keyed by file index. */
+  std::unordered_map<int, NDArray> ready_files_;
+  /*! \brief The first error raised by the readers. */
+  std::exception_ptr error_ = nullptr;
+  bool stopped_ = false;
+  std::vector<std::thread> readers_;
+};
+
+/*! \brief The maximum number of threads reading the shard files in parallel. */
+constexpr const int kMaxNumShardReaderThreads = 4;
+/*! \brief The maximum number of shard files held in host memory ahead of their use. */
+constexpr const int kMaxNumPrefetchedShardFiles = 8;
+
+/*!
+ * \brief Load a parameter to device from the content of its shard file. Raw parameters are
+ * uploaded directly from the file content. The other formats (e.g., "f32-to-bf16") are
+ * decoded by the parameter record, from `raw_data` created from the file content on demand.
+ */
+NDArray LoadParamFromFileData(const NDArrayCacheMetadata::FileRecord::ParamRecord& param_record,
+                              const NDArray& file_data, Device device, std::string* raw_data) {
+  if (param_record.format == "raw") {
+    NDArray param = NDArray::Empty(param_record.shape, param_record.dtype, device);
+    param.CopyFromBytes(static_cast<const char*>(file_data->data) + param_record.byte_offset,
+                        param_record.nbytes);
+    return param;
+  }
+  if (raw_data->empty()) {
+    raw_data->assign(static_cast<const char*>(file_data->data), file_data->shape[0]);
+  }
+  return param_record.Load(device, raw_data);
+}
+
 struct ParamInfo {
   const NDArrayCacheMetadata::FileRecord* file;
   const NDArrayCacheMetadata::FileRecord::ParamRecord* param;
@@ -150,6 +307,11 @@ Array<NDArray> LoadMultiGPU(const std::string& model_path, Module relax_vm_modul
       << num_shards << " GPUs. "
       << "Please use `ChatConfig(tensor_parallel_shards=" << model_metadata.tensor_parallel_shards
       << ", ...)` to initialize ChatModule.";
+  // The shards are all local workers of one session, which runs every layer on every shard.
+  CHECK_EQ(model_metadata.pipeline_parallel_stages, 1)
+      << "ValueError: The model is compiled with `pipeline_parallel_stages="
+      << model_metadata.pipeline_parallel_stages << "`, but pipeline parallelism is not "
+      << "supported by the runtime. Please compile the model with tensor parallelism only.";
   // Step 1. Extract auxiliary information
   PreprocessorPool preprocs(model_metadata, relax_vm_module);
   std::unordered_map<std::string, ModelMetadata::Param> param_name2info;
@@ -163,12 +325,23 @@ Array<NDArray> LoadMultiGPU(const std::string& model_path, Module relax_vm_modul
     DurationType time_preproc(0);
     ProgressBar progress_bar(model_metadata.params.size());
     LOG(INFO) << "Loading parameters...";
+    std::vector<const NDArrayCacheMetadata::FileRecord*> file_records;
     for (const NDArrayCacheMetadata::FileRecord& record : ndarray_cache_metadata.records) {
-      Array<NDArray> loaded_params;
+      file_records.push_back(&record);
+    }
+    ShardFilePrefetcher prefetcher(model_path, std::move(file_records), device,
+                                   kMaxNumShardReaderThreads, kMaxNumPrefetchedShardFiles);
+    for (const NDArrayCacheMetadata::FileRecord& record : ndarray_cache_metadata.records) {
+      std::vector<NDArray> loaded_params;
       {
         RangeTimer _(&time_loading);
-        std::string raw_data_buffer;
-        loaded_params = record.Load(device, model_path, &raw_data_buffer);
+        NDArray file_data = prefetcher.Next();
+        std::string raw_data;
+        loaded_params.reserve(record.records.size());
+        for (const NDArrayCacheMetadata::FileRecord::ParamRecord& param_record : record.records) {
+          loaded_params.push_back(
+              LoadParamFromFileData(param_record, file_data, device, &raw_data));
+        }
         TVMSynchronize(device.device_type, device.device_id, nullptr);
       }
       // For each parameter in the shard file, preprocess and shard it
@@ -228,13 +401,13 @@ Array<NDArray> LoadMultiGPUPresharded(const std::string& model_path, Module rela
     }
   }
 
-  Array<NDArray> params;
-  const NDArrayCacheMetadata::FileRecord* current_file_;
-  std::string current_file_stream_;
-  params.reserve(model_metadata.params.size());
-  DurationType time_loading(0);
+  // Collect the parameters of this worker grouped by their shard files, with the files in the
+  // order they are first visited, so that every file is read once and can be prefetched.
+  std::vector<const NDArrayCacheMetadata::FileRecord*> file_records;
+  std::unordered_map<const NDArrayCacheMetadata::FileRecord*, std::vector<int>> file_param_indices;
+  std::vector<const ParamInfo*> worker_param_infos;
+  worker_param_infos.reserve(model_metadata.params.size());
   for (const ModelMetadata::Param& param : model_metadata.params) {
-    RangeTimer _(&time_loading);
     bool needs_sharding = !param.preprocs.empty();
     std::string param_name = needs_sharding
                                  ? static_cast<const std::stringstream&>(
@@ -242,16 +415,28 @@ Array<NDArray> LoadMultiGPUPresharded(const std::string& model_path, Module rela
                                        .str()
                                  : std::string(param.name);
     const ParamInfo& param_info = param_info_map.at(param_name);
-    const NDArrayCacheMetadata::FileRecord::ParamRecord* param_record = param_info.param;
-    const NDArrayCacheMetadata::FileRecord* file_record = param_info.file;
-
-    if (file_record != current_file_) {
-      current_file_ = file_record;
-      file_record->Load(device, model_path, &current_file_stream_);
+    std::vector<int>& param_indices = file_param_indices[param_info.file];
+    if (param_indices.empty()) {
+      file_records.push_back(param_info.file);
     }
+    param_indices.push_back(worker_param_infos.size());
+    worker_param_infos.push_back(&param_info);
+  }
 
-    params.push_back(param_record->Load(device, &current_file_stream_));
+  std::vector<NDArray> loaded_params(worker_param_infos.size());
+  DurationType time_loading(0);
+  ShardFilePrefetcher prefetcher(model_path, file_records, device, kMaxNumShardReaderThreads,
+                                 kMaxNumPrefetchedShardFiles);
+  for (const NDArrayCacheMetadata::FileRecord* file_record : file_records) {
+    RangeTimer _(&time_loading);
+    NDArray file_data = prefetcher.Next();
+    std::string raw_data;
+    for (int param_index : file_param_indices.at(file_record)) {
+      loaded_params[param_index] = LoadParamFromFileData(*worker_param_infos[param_index]->param,
+                                                         file_data, device, &raw_data);
+    }
   }
+  Array<NDArray> params(loaded_params.begin(), loaded_params.end());
   SyncWorker();
   if (worker_id == 0) {
     LOG(INFO) << "Loading done. Time used: " << FormatDuration(time_loading) << ".";
@@ -259,8 +444,184 @@ Array<NDArray> LoadMultiGPUPresharded(const std::string& model_path, Module rela
   return params;
 }
 
+/*! \brief The size of the shard files written to the weight shard cache. */
+constexpr const int64_t kShardCacheFileBytes = 32LL * 1024 * 1024;
+
+/*!
+ * \brief Write a file to a temporary path and rename it, so that readers never see a partial
+ * file. The workers may run in different processes that write to the same directory.
+ * \return Whether the file is written.
+ */
+bool WriteFileAtomically(const std::string& path, const char* data, size_t size) {
+  std::ostringstream tmp_path;
+  tmp_path << path << ".tmp" << std::hex
+           << std::chrono::steady_clock::now().time_since_epoch().count()
+           << reinterpret_cast<uintptr_t>(data);
+  std::error_code error;
+  {
+    std::ofstream fout(tmp_path.str(), std::ios::binary);
+    fout.write(data, size);
+    if (!fout.good()) {
+      fout.close();
+      std::filesystem::remove(tmp_path.str(), error);
+      return false;
+    }
+  }
+  std::filesystem::rename(tmp_path.str(), path, error);
+  if (error) {
+    std::filesystem::remove(tmp_path.str(), error);
+    return false;
+  }
+  return true;
+}
+
+/*!
+ * \brief Save the parameters of this worker to the weight shard cache in the layout read by
+ * LoadMultiGPUPresharded, i.e. the sharded parameters named "<name>_shard-<worker_id>" and the
+ * others saved by worker 0 only. The file records of the worker are written to a partial
+ * metadata file, which worker 0 merges into "ndarray-cache.json" after all workers finish.
+ * \return Whether the parameters are saved.
+ */
+bool SaveWorkerShards(const Array<NDArray>& params, const ModelMetadata& model_metadata,
+                      int worker_id, const std::string& cache_path) {
+  std::error_code error;
+  std::filesystem::create_directories(cache_path, error);
+  picojson::array file_records;
+  std::string file_data;
+  picojson::array param_records;
+  auto f_flush = [&]() {
+    if (param_records.empty()) {
+      return true;
+    }
+    std::string data_path = "params_worker" + std::to_string(worker_id) + "_shard_" +
+                            std::to_string(file_records.size()) + ".bin";
+    if (!WriteFileAtomically(cache_path + "/" + data_path, file_data.data(), file_data.size())) {
+      return false;
+    }
+    picojson::object file_record;
+    file_record["dataPath"] = picojson::value(data_path);
+    file_record["format"] = picojson::value("raw-shard");
+    file_record["nbytes"] = picojson::value(static_cast<int64_t>(file_data.size()));
+    file_record["records"] = picojson::value(param_records);
+    file_records.push_back(picojson::value(file_record));
+    file_data.clear();
+    param_records.clear();
+    return true;
+  };
+  for (int i = 0; i < static_cast<int>(model_metadata.params.size()); ++i) {
+    const ModelMetadata::Param& param_info = model_metadata.params[i];
+    bool needs_sharding = !param_info.preprocs.empty();
+    if (!needs_sharding && worker_id != 0) {
+      continue;
+    }
+    const NDArray& param = params[i];
+    size_t nbytes = GetDataSize(*param.operator->());
+    picojson::array shape;
+    for (int64_t dim : param.Shape()) {
+      shape.push_back(picojson::value(dim));
+    }
+    picojson::object param_record;
+    param_record["name"] = picojson::value(
+        needs_sharding ? std::string(param_info.name) + "_shard-" + std::to_string(worker_id)
+                       : std::string(param_info.name));
+    param_record["shape"] = picojson::value(shape);
+    param_record["dtype"] = picojson::value(DLDataType2String(param->dtype));
+    param_record["format"] = picojson::value("raw");
+    param_record["nbytes"] = picojson::value(static_cast<int64_t>(nbytes));
+    param_record["byteOffset"] = picojson::value(static_cast<int64_t>(file_data.size()));
+    param_records.push_back(picojson::value(param_record));
+    size_t offset = file_data.size();
+    file_data.resize(offset + nbytes);
+    param.CopyToBytes(file_data.data() + offset, nbytes);
+    if (static_cast<int64_t>(file_data.size()) >= kShardCacheFileBytes && !f_flush()) {
+      return false;
+    }
+  }
+  if (!f_flush()) {
+    return false;
+  }
+  picojson::object partial_metadata;
+  partial_metadata["records"] = picojson::value(file_records);
+  std::string partial_metadata_str = picojson::value(partial_metadata).serialize();
+  return WriteFileAtomically(
+      cache_path + "/ndarray-cache-worker" + std::to_string(worker_id) + ".json",
+      partial_metadata_str.data(), partial_metadata_str.size());
+}
+
+/*!
+ * \brief Merge the partial metadata files of all the workers into "ndarray-cache.json", which
+ * marks the cache as complete. It runs on worker 0 after all the workers save their shards.
+ */
+void MergeWorkerShardRecords(int num_workers, const std::string& cache_path) {
+  picojson::array file_records;
+  std::vector<std::string> partial_paths;
+  for (int i = 0; i < num_workers; ++i) {
+    partial_paths.push_back(cache_path + "/ndarray-cache-worker" + std::to_string(i) + ".json");
+    std::ifstream fin(partial_paths.back());
+    picojson::value partial_metadata;
+    if (!fin.good() || !picojson::parse(partial_metadata, fin).empty() ||
+        !partial_metadata.is<picojson::object>() ||
+        !partial_metadata.get("records").is<picojson::array>()) {
+      LOG(WARNING) << "Worker " << i << " failed to save its weight shards to \"" << cache_path
+                   << "\". The weight shards are not cached.";
+      return;
+    }
+    const picojson::array& records = partial_metadata.get("records").get<picojson::array>();
+    file_records.insert(file_records.end(), records.begin(), records.end());
+  }
+  picojson::object metadata;
+  metadata["metadata"] = picojson::value(picojson::object());
+  metadata["records"] = picojson::value(file_records);
+  std::string metadata_str = picojson::value(metadata).serialize();
+  if (!WriteFileAtomically(cache_path + "/ndarray-cache.json", metadata_str.data(),
+                           metadata_str.size())) {
+    LOG(WARNING) << "Failed to write the weight shard cache \"" << cache_path << "\".";
+    return;
+  }
+  std::error_code error;
+  for (const std::string& partial_path : partial_paths) {
+    std::filesystem::remove(partial_path, error);
+  }
+  LOG(INFO) << "Saved the preprocessed weight shards to \"" << cache_path
+            << "\". The later starts load them without preprocessing.";
+}
+
+/*!
+ * \brief Load the parameters with loading-time sharding as LoadMultiGPU, and then save the
+ * shards of every worker to the weight shard cache at `cache_path`, from which the later starts
+ * load the shards with LoadMultiGPUPresharded. Failing to save the cache is not an error.
+ */
+Array<NDArray> LoadMultiGPUAndSaveShards(const std::string& model_path, Module relax_vm_module,
+                                         const std::string& model_config_str,
+                                         const std::string& cache_path) {
+  Array<NDArray> params = LoadMultiGPU(model_path, relax_vm_module, model_config_str);
+  DiscoWorker* worker = DiscoWorker::ThreadLocal();
+  picojson::value model_config;
+  picojson::parse(model_config, model_config_str);
+  ModelMetadata model_metadata =
+      ModelMetadata::FromModule(relax_vm_module, model_config.get<picojson::object>());
+  bool saved = false;
+  try {
+    saved = SaveWorkerShards(params, model_metadata, worker->worker_id, cache_path);
+  } catch (const std::exception& e) {
+    LOG(WARNING) << "Failed to save the weight shards: " << e.what();
+  }
+  if (!saved) {
+    LOG(WARNING) << "Worker " << worker->worker_id << " failed to save its weight shards to \""
+                 << cache_path << "\".";
+  }
+  // All the workers reach the barrier whether or not they saved their shards.
+  SyncWorker();
+  if (worker->worker_id == 0) {
+    MergeWorkerShardRecords(worker->num_workers, cache_path);
+  }
+  return params;
+}
+
 TVM_REGISTER_GLOBAL("mlc.loader.LoadMultiGPU").set_body_typed(LoadMultiGPU);
 TVM_REGISTER_GLOBAL("mlc.loader.LoadMultiGPUPresharded").set_body_typed(LoadMultiGPUPresharded);
+TVM_REGISTER_GLOBAL("mlc.loader.LoadMultiGPUAndSaveShards")
+    .set_body_typed(LoadMultiGPUAndSaveShards);
 
 }  // namespace loader
 }  // namespace llm
@@ -63,8 +63,11 @@ ModelMetadata ModelMetadata::FromJSON(const picojson::object& metadata,
   if (metadata.count("attention_sink_size"))  // remove after sink is decoupled from model lib
     result.attention_sink_size = json::Lookup<int64_t>(metadata, "attention_sink_size");
   result.tensor_parallel_shards = json::Lookup<int64_t>(metadata, "tensor_parallel_shards");
+  result.pipeline_parallel_stages =
+      json::LookupOrDefault<int64_t>(metadata, "pipeline_parallel_stages", 1);
   result.kv_state_kind = KVStateKindFromString(
       json::LookupOrDefault<std::string>(metadata, "kv_state_kind", "kv_cache"));
+  result.batched_image_embed = json::LookupOrDefault<bool>(metadata, "batched_image_embed", false);
   if (result.kv_state_kind != KVStateKind::kNone) {
     result.kv_cache_metadata =
         KVCacheMetadata::FromJSON(json::Lookup<picojson::object>(metadata, "kv_cache"));
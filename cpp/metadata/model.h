@@ -76,11 +76,15 @@ struct ModelMetadata {
   int64_t prefill_chunk_size;
   int64_t sliding_window_size;
   int64_t tensor_parallel_shards;
+  /*! \brief The number of pipeline stages the layers are partitioned over. */
+  int64_t pipeline_parallel_stages;
   int64_t attention_sink_size;
   std::vector<Param> params;
   std::unordered_map<std::string, int64_t> memory_usage;
   KVStateKind kv_state_kind;
   KVCacheMetadata kv_cache_metadata;
+  /*! \brief Whether the image embedding function takes a batch of images in one call. */
+  bool batched_image_embed;
 
   static ModelMetadata FromJSON(const picojson::object& json_str,
                                 const picojson::object& model_config);
@@ -8,12 +8,15 @@
 #include <tvm/runtime/device_api.h>
 #include <tvm/runtime/registry.h>
 
+#include <algorithm>
+#include <exception>
 #include <limits>
 #include <random>
 
 #include "../json_ffi/openai_api_protocol.h"
 #include "../support/json_parser.h"
 #include "data.h"
+#include "memory_accounting.h"
 
 namespace mlc {
 namespace llm {
@@ -25,6 +28,7 @@ TVM_REGISTER_OBJECT_TYPE(GenerationConfigNode);
 
 GenerationConfig::GenerationConfig(
     std::optional<int> n, std::optional<double> temperature, std::optional<double> top_p,
+    std::optional<int> top_k, std::optional<double> min_p,
     std::optional<double> frequency_penalty, std::optional<double> presense_penalty,
     std::optional<double> repetition_penalty, std::optional<bool> logprobs,
     std::optional<int> top_logprobs, std::optional<std::vector<std::pair<int, float>>> logit_bias,
@@ -46,6 +50,9 @@ GenerationConfig::GenerationConfig(
   CHECK_GE(obj->temperature, 0) << "\"temperature\" should be non-negative";
   obj->top_p = top_p.value_or(default_config->top_p);
   CHECK(obj->top_p >= 0 && obj->top_p <= 1) << "\"top_p\" should be in range [0, 1]";
+  obj->top_k = top_k.value_or(default_config->top_k);
+  obj->min_p = min_p.value_or(default_config->min_p);
+  CHECK(obj->min_p >= 0 && obj->min_p <= 1) << "\"min_p\" should be in range [0, 1]";
   obj->frequency_penalty = frequency_penalty.value_or(default_config->frequency_penalty);
   CHECK(std::fabs(obj->frequency_penalty) <= 2.0) << "Frequency penalty must be in [-2, 2]!";
   obj->presence_penalty = presense_penalty.value_or(default_config->presence_penalty);
@@ -65,6 +72,7 @@ GenerationConfig::GenerationConfig(
   }
 
   obj->seed = seed.value_or(std::random_device{}());
+  obj->fixed_seed = seed.has_value();
   // "ignore_eos" is for benchmarking. Not the part of OpenAI API spec.
   obj->ignore_eos = ignore_eos.value_or(default_config->ignore_eos);
   // "-1" means the generation will not stop until exceeding
@@ -98,6 +106,9 @@ GenerationConfig::GenerationConfig(String config_json_str,
   CHECK_GE(n->temperature, 0) << "\"temperature\" should be non-negative";
   n->top_p = json::LookupOrDefault<double>(config, "top_p", default_config->top_p);
   CHECK(n->top_p >= 0 && n->top_p <= 1) << "\"top_p\" should be in range [0, 1]";
+  n->top_k = json::LookupOrDefault<int64_t>(config, "top_k", default_config->top_k);
+  n->min_p = json::LookupOrDefault<double>(config, "min_p", default_config->min_p);
+  CHECK(n->min_p >= 0 && n->min_p <= 1) << "\"min_p\" should be in range [0, 1]";
   n->frequency_penalty =
       json::LookupOrDefault<double>(config, "frequency_penalty", default_config->frequency_penalty);
   CHECK(std::fabs(n->frequency_penalty) <= 2.0) << "Frequency penalty must be in [-2, 2]!";
@@ -114,6 +125,10 @@ GenerationConfig::GenerationConfig(String config_json_str,
       << "At most 5 top logprob tokens are supported";
   CHECK(n->top_logprobs == 0 || n->logprobs)
       << "\"logprobs\" must be true to support \"top_logprobs\"";
+  n->logprob_format = json::LookupOrDefault<std::string>(config, "logprob_format",
+                                                         default_config->logprob_format);
+  CHECK(n->logprob_format == "json" || n->logprob_format == "array")
+      << "\"logprob_format\" should be either \"json\" or \"array\"";
 
   std::optional<picojson::object> logit_bias_obj =
       json::LookupOptional<picojson::object>(config, "logit_bias");
@@ -132,6 +147,7 @@ GenerationConfig::GenerationConfig(String config_json_str,
   }
 
   n->seed = json::LookupOrDefault<int64_t>(config, "seed", std::random_device{}());
+  n->fixed_seed = config.count("seed") && !config.at("seed").is<picojson::null>();
   // "ignore_eos" is for benchmarking. Not the part of OpenAI API spec.
   n->ignore_eos = json::LookupOrDefault<bool>(config, "ignore_eos", default_config->ignore_eos);
   // "-1" means the generation will not stop until exceeding
@@ -193,6 +209,48 @@ GenerationConfig::GenerationConfig(String config_json_str,
     }
   }
 
+  // Scheduling hints. Not the part of OpenAI API spec.
+  n->priority = json::LookupOrDefault<int64_t>(config, "priority", default_config->priority);
+  n->ttft_slo_ms =
+      json::LookupOrDefault<double>(config, "ttft_slo_ms", default_config->ttft_slo_ms);
+  CHECK(n->ttft_slo_ms == -1 || n->ttft_slo_ms > 0)
+      << "\"ttft_slo_ms\" should be either -1 (which means no deadline) or positive";
+  n->tpot_slo_ms =
+      json::LookupOrDefault<double>(config, "tpot_slo_ms", default_config->tpot_slo_ms);
+  CHECK(n->tpot_slo_ms == -1 || n->tpot_slo_ms > 0)
+      << "\"tpot_slo_ms\" should be either -1 (which means no deadline) or positive";
+  n->tenant_id =
+      json::LookupOrDefault<std::string>(config, "tenant_id", default_config->tenant_id);
+  n->lora_adapter = json::LookupOrDefault<std::string>(config, "lora_adapter",
+                                                       default_config->lora_adapter);
+  n->prefill_only_output = json::LookupOrDefault<std::string>(
+      config, "prefill_only_output", default_config->prefill_only_output);
+  CHECK(n->prefill_only_output.empty() || n->prefill_only_output == "last_hidden_state" ||
+        n->prefill_only_output == "prompt_logprobs")
+      << "\"prefill_only_output\" should be either \"last_hidden_state\" or \"prompt_logprobs\"";
+
+  // Beam search. Not the part of OpenAI API spec.
+  n->num_beams = json::LookupOrDefault<int64_t>(config, "num_beams", default_config->num_beams);
+  CHECK(n->num_beams >= 1 && n->num_beams <= GenerationConfigNode::kMaxNumBeams)
+      << "\"num_beams\" should be in range [1, " << GenerationConfigNode::kMaxNumBeams << "]";
+  n->length_penalty =
+      json::LookupOrDefault<double>(config, "length_penalty", default_config->length_penalty);
+  if (n->num_beams > 1) {
+    CHECK_LE(n->n, n->num_beams) << "\"n\" should not exceed \"num_beams\" in beam search";
+    CHECK(n->response_format.type == "text")
+        << "Beam search does not support the response format of type \""
+        << n->response_format.type << "\"";
+    // Beam search ranks the beams by the model distribution, which is not reshaped.
+    n->temperature = 1.0;
+    n->top_p = 1.0;
+    n->top_k = 0;
+    n->min_p = 0.0;
+  }
+  if (!n->prefill_only_output.empty()) {
+    CHECK(n->n == 1 && n->num_beams == 1)
+        << "Prefill-only requests do not support parallel generation or beam search";
+  }
+
   data_ = std::move(n);
 }
 
@@ -201,6 +259,8 @@ GenerationConfig GenerationConfig::GetDefaultFromModelConfig(
   ObjectPtr<GenerationConfigNode> n = make_object<GenerationConfigNode>();
   n->temperature = json::LookupOrDefault<double>(model_config_json, "temperature", n->temperature);
   n->top_p = json::LookupOrDefault<double>(model_config_json, "top_p", n->top_p);
+  n->top_k = json::LookupOrDefault<int64_t>(model_config_json, "top_k", n->top_k);
+  n->min_p = json::LookupOrDefault<double>(model_config_json, "min_p", n->min_p);
   n->frequency_penalty =
       json::LookupOrDefault<double>(model_config_json, "frequency_penalty", n->frequency_penalty);
   n->presence_penalty =
@@ -213,11 +273,14 @@ String GenerationConfigNode::AsJSONString() const {
   config["n"] = picojson::value(static_cast<int64_t>(this->n));
   config["temperature"] = picojson::value(this->temperature);
   config["top_p"] = picojson::value(this->top_p);
+  config["top_k"] = picojson::value(static_cast<int64_t>(this->top_k));
+  config["min_p"] = picojson::value(this->min_p);
   config["frequency_penalty"] = picojson::value(this->frequency_penalty);
   config["presence_penalty"] = picojson::value(this->presence_penalty);
   config["repetition_penalty"] = picojson::value(this->repetition_penalty);
   config["logprobs"] = picojson::value(this->logprobs);
   config["top_logprobs"] = picojson::value(static_cast<int64_t>(this->top_logprobs));
+  config["logprob_format"] = picojson::value(this->logprob_format);
   config["max_tokens"] = picojson::value(static_cast<int64_t>(this->max_tokens));
   config["seed"] = picojson::value(static_cast<int64_t>(this->seed));
 
@@ -257,6 +320,18 @@ String GenerationConfigNode::AsJSONString() const {
     config["debug_config"] = picojson::value(debug_config_obj);
   }
 
+  // Scheduling hints. Not the part of OpenAI API spec.
+  config["priority"] = picojson::value(static_cast<int64_t>(this->priority));
+  config["ttft_slo_ms"] = picojson::value(this->ttft_slo_ms);
+  config["tpot_slo_ms"] = picojson::value(this->tpot_slo_ms);
+  config["tenant_id"] = picojson::value(this->tenant_id);
+  config["lora_adapter"] = picojson::value(this->lora_adapter);
+  config["prefill_only_output"] = picojson::value(this->prefill_only_output);
+
+  // Beam search. Not the part of OpenAI API spec.
+  config["num_beams"] = picojson::value(static_cast<int64_t>(this->num_beams));
+  config["length_penalty"] = picojson::value(this->length_penalty);
+
   return picojson::value(config).serialize(true);
 }
 
@@ -293,6 +368,16 @@ EngineConfig EngineConfig::FromJSONAndInferredConfig(
   }
   n->additional_models = additional_models;
   n->additional_model_libs = additional_model_libs;
+  n->lazy_load_params =
+      json::LookupOrDefault<bool>(json, "lazy_load_params", n->lazy_load_params);
+  n->param_offload_mb =
+      json::LookupOrDefault<int64_t>(json, "param_offload_mb", n->param_offload_mb);
+  CHECK_GE(n->param_offload_mb, 0) << "\"param_offload_mb\" should not be negative";
+  n->weight_shard_cache_dir =
+      json::LookupOrDefault<std::string>(json, "weight_shard_cache_dir", n->weight_shard_cache_dir);
+  n->max_num_lora_adapters =
+      json::LookupOrDefault<int64_t>(json, "max_num_lora_adapters", n->max_num_lora_adapters);
+  CHECK_GE(n->max_num_lora_adapters, 0) << "\"max_num_lora_adapters\" should be non-negative";
   n->mode = EngineModeFromString(json::Lookup<std::string>(json, "mode"));
 
   // - Other fields with default value.
@@ -300,11 +385,69 @@ EngineConfig EngineConfig::FromJSONAndInferredConfig(
       json::LookupOrDefault<double>(json, "gpu_memory_utilization", n->gpu_memory_utilization);
   n->kv_cache_page_size =
       json::LookupOrDefault<int64_t>(json, "kv_cache_page_size", n->kv_cache_page_size);
+  n->kv_cache_dtype = KVCacheDTypeFromString(json::LookupOrDefault<std::string>(
+      json, "kv_cache_dtype", KVCacheDTypeToString(n->kv_cache_dtype)));
+  n->kv_eviction_window_size =
+      json::LookupOrDefault<int64_t>(json, "kv_eviction_window_size", n->kv_eviction_window_size);
+  CHECK(n->kv_eviction_window_size == -1 || n->kv_eviction_window_size > 0)
+      << "\"kv_eviction_window_size\" should be either -1 (which means no eviction) or positive";
+  n->kv_eviction_sink_size =
+      json::LookupOrDefault<int64_t>(json, "kv_eviction_sink_size", n->kv_eviction_sink_size);
+  CHECK_GE(n->kv_eviction_sink_size, 0) << "\"kv_eviction_sink_size\" should not be negative";
   n->speculative_mode = SpeculativeModeFromString(json::LookupOrDefault<std::string>(
       json, "speculative_mode", SpeculativeModeToString(n->speculative_mode)));
   n->spec_draft_length =
       json::LookupOrDefault<int64_t>(json, "spec_draft_length", n->spec_draft_length);
+  n->spec_tree_width = json::LookupOrDefault<int64_t>(json, "spec_tree_width", n->spec_tree_width);
+  CHECK_GE(n->spec_tree_width, 1) << "\"spec_tree_width\" should be at least 1";
+  n->adaptive_spec_draft_length = json::LookupOrDefault<bool>(json, "adaptive_spec_draft_length",
+                                                              n->adaptive_spec_draft_length);
+  n->spec_max_batch_size =
+      json::LookupOrDefault<int64_t>(json, "spec_max_batch_size", n->spec_max_batch_size);
+  CHECK(n->spec_max_batch_size == -1 || n->spec_max_batch_size > 0)
+      << "\"spec_max_batch_size\" should be either -1 or positive";
+  n->spec_ngram_max_size =
+      json::LookupOrDefault<int64_t>(json, "spec_ngram_max_size", n->spec_ngram_max_size);
+  CHECK_GE(n->spec_ngram_max_size, 1) << "\"spec_ngram_max_size\" should be at least 1";
+  n->concurrent_draft_prefill = json::LookupOrDefault<bool>(json, "concurrent_draft_prefill",
+                                                            n->concurrent_draft_prefill);
+  n->draft_device = json::LookupOrDefault<std::string>(json, "draft_device", n->draft_device);
+  n->grammar_cache_dir =
+      json::LookupOrDefault<std::string>(json, "grammar_cache_dir", n->grammar_cache_dir);
+  n->grammar_cache_max_num_schemas = json::LookupOrDefault<int64_t>(
+      json, "grammar_cache_max_num_schemas", n->grammar_cache_max_num_schemas);
+  CHECK_GT(n->grammar_cache_max_num_schemas, 0)
+      << "\"grammar_cache_max_num_schemas\" should be positive";
+  n->grammar_precompiled_path = json::LookupOrDefault<std::string>(
+      json, "grammar_precompiled_path", n->grammar_precompiled_path);
+  n->grammar_jump_forward_max_tokens = json::LookupOrDefault<int64_t>(
+      json, "grammar_jump_forward_max_tokens", n->grammar_jump_forward_max_tokens);
+  CHECK_GE(n->grammar_jump_forward_max_tokens, 0)
+      << "\"grammar_jump_forward_max_tokens\" should be non-negative";
+  n->stream_back_max_pending_outputs = json::LookupOrDefault<int64_t>(
+      json, "stream_back_max_pending_outputs", n->stream_back_max_pending_outputs);
+  CHECK(n->stream_back_max_pending_outputs == -1 || n->stream_back_max_pending_outputs > 0)
+      << "\"stream_back_max_pending_outputs\" should be either -1 or positive";
+  n->stream_back_max_batch_size = json::LookupOrDefault<int64_t>(
+      json, "stream_back_max_batch_size", n->stream_back_max_batch_size);
+  CHECK(n->stream_back_max_batch_size == -1 || n->stream_back_max_batch_size > 0)
+      << "\"stream_back_max_batch_size\" should be either -1 or positive";
+  n->stream_back_flush_interval_ms = json::LookupOrDefault<double>(
+      json, "stream_back_flush_interval_ms", n->stream_back_flush_interval_ms);
+  CHECK_GE(n->stream_back_flush_interval_ms, 0)
+      << "\"stream_back_flush_interval_ms\" should be non-negative";
+  n->stream_back_shm_path =
+      json::LookupOrDefault<std::string>(json, "stream_back_shm_path", n->stream_back_shm_path);
+  n->stream_back_shm_capacity = json::LookupOrDefault<int64_t>(json, "stream_back_shm_capacity",
+                                                               n->stream_back_shm_capacity);
+  CHECK_GT(n->stream_back_shm_capacity, 0) << "\"stream_back_shm_capacity\" should be positive";
+  n->host_numa_node = json::LookupOrDefault<int64_t>(json, "host_numa_node", n->host_numa_node);
+  CHECK_GE(n->host_numa_node, -1) << "\"host_numa_node\" should be either -1 or non-negative";
   n->verbose = json::LookupOrDefault<bool>(json, "verbose", n->verbose);
+  n->device_phase_timing =
+      json::LookupOrDefault<bool>(json, "device_phase_timing", n->device_phase_timing);
+  n->traffic_capture_path =
+      json::LookupOrDefault<std::string>(json, "traffic_capture_path", n->traffic_capture_path);
 
   // - Fields from the inferred engine config.
   n->max_num_sequence = inferred_config.max_num_sequence.value();
@@ -312,11 +455,107 @@ EngineConfig EngineConfig::FromJSONAndInferredConfig(
   n->max_single_sequence_length = inferred_config.max_single_sequence_length.value();
   n->prefill_chunk_size = inferred_config.prefill_chunk_size.value();
   n->max_history_size = inferred_config.max_history_size.value();
+  n->startup_autotune = json::LookupOrDefault<bool>(json, "startup_autotune", n->startup_autotune);
+  n->autotune_cache_dir =
+      json::LookupOrDefault<std::string>(json, "autotune_cache_dir", n->autotune_cache_dir);
 
   n->prefix_cache_mode = PrefixCacheModeFromString(json::LookupOrDefault<std::string>(
       json, "prefix_cache_mode", PrefixCacheModeToString(n->prefix_cache_mode)));
   n->prefix_cache_max_num_recycling_seqs =
       json::LookupOrDefault<int64_t>(json, "prefix_cache_max_recycling_seqs", n->max_num_sequence);
+  n->prefix_cache_eviction_policy =
+      PrefixCacheEvictionPolicyFromString(json::LookupOrDefault<std::string>(
+          json, "prefix_cache_eviction_policy",
+          PrefixCacheEvictionPolicyToString(n->prefix_cache_eviction_policy)));
+  n->prefix_cache_host_memory_mb = json::LookupOrDefault<int64_t>(
+      json, "prefix_cache_host_memory_mb", n->prefix_cache_host_memory_mb);
+  CHECK_GE(n->prefix_cache_host_memory_mb, 0)
+      << "\"prefix_cache_host_memory_mb\" should not be negative";
+  n->response_cache_memory_mb = json::LookupOrDefault<int64_t>(json, "response_cache_memory_mb",
+                                                               n->response_cache_memory_mb);
+  CHECK_GE(n->response_cache_memory_mb, 0)
+      << "\"response_cache_memory_mb\" should not be negative";
+  n->rnn_state_checkpoint_interval = json::LookupOrDefault<int64_t>(
+      json, "rnn_state_checkpoint_interval", n->rnn_state_checkpoint_interval);
+  CHECK_GE(n->rnn_state_checkpoint_interval, 0)
+      << "\"rnn_state_checkpoint_interval\" should not be negative";
+  n->prefix_cache_snapshot_path = json::LookupOrDefault<std::string>(
+      json, "prefix_cache_snapshot_path", n->prefix_cache_snapshot_path);
+  n->kv_cache_idle_compaction = json::LookupOrDefault<bool>(json, "kv_cache_idle_compaction",
+                                                            n->kv_cache_idle_compaction);
+  n->image_embedding_cache_size = json::LookupOrDefault<int64_t>(
+      json, "image_embedding_cache_size", n->image_embedding_cache_size);
+  CHECK_GE(n->image_embedding_cache_size, 0)
+      << "\"image_embedding_cache_size\" should not be negative";
+  n->prefix_share_min_length =
+      json::LookupOrDefault<int64_t>(json, "prefix_share_min_length", n->prefix_share_min_length);
+  CHECK_GE(n->prefix_share_min_length, 0) << "\"prefix_share_min_length\" should not be negative";
+  n->preemption_mode = PreemptionModeFromString(json::LookupOrDefault<std::string>(
+      json, "preemption_mode", PreemptionModeToString(n->preemption_mode)));
+  n->swap_space_mb = json::LookupOrDefault<int64_t>(json, "swap_space_mb", n->swap_space_mb);
+  CHECK_GE(n->swap_space_mb, 0) << "\"swap_space_mb\" should not be negative";
+  n->engine_role = EngineRoleFromString(
+      json::LookupOrDefault<std::string>(json, "engine_role", EngineRoleToString(n->engine_role)));
+  n->scheduler_mode = SchedulerModeFromString(json::LookupOrDefault<std::string>(
+      json, "scheduler_mode", SchedulerModeToString(n->scheduler_mode)));
+  picojson::object tenant_weights_obj =
+      json::LookupOrDefault<picojson::object>(json, "tenant_weights", picojson::object());
+  n->tenant_weights.clear();
+  for (const auto& [tenant_id, weight] : tenant_weights_obj) {
+    CHECK(weight.is<double>() && weight.get<double>() > 0)
+        << "Invalid weight of tenant \"" << tenant_id << "\" in \"tenant_weights\"";
+    n->tenant_weights[tenant_id] = weight.get<double>();
+  }
+  n->tenant_max_kv_tokens =
+      json::LookupOrDefault<int64_t>(json, "tenant_max_kv_tokens", n->tenant_max_kv_tokens);
+  CHECK(n->tenant_max_kv_tokens == -1 || n->tenant_max_kv_tokens > 0)
+      << "\"tenant_max_kv_tokens\" should be either -1 (which means no cap) or positive";
+  n->prefill_mode = PrefillModeFromString(json::LookupOrDefault<std::string>(
+      json, "prefill_mode", PrefillModeToString(n->prefill_mode)));
+  n->adaptive_prefill_target_itl_ms = json::LookupOrDefault<double>(
+      json, "adaptive_prefill_target_itl_ms", n->adaptive_prefill_target_itl_ms);
+  CHECK_GE(n->adaptive_prefill_target_itl_ms, 0)
+      << "\"adaptive_prefill_target_itl_ms\" should not be negative";
+  n->step_token_budget =
+      json::LookupOrDefault<int64_t>(json, "step_token_budget", n->step_token_budget);
+  CHECK_GE(n->step_token_budget, 0) << "\"step_token_budget\" should not be negative";
+  n->admission_kv_headroom =
+      json::LookupOrDefault<double>(json, "admission_kv_headroom", n->admission_kv_headroom);
+  CHECK(n->admission_kv_headroom >= 0 && n->admission_kv_headroom < 1)
+      << "\"admission_kv_headroom\" should be in range [0, 1)";
+  n->admission_preemption_target = json::LookupOrDefault<double>(
+      json, "admission_preemption_target", n->admission_preemption_target);
+  CHECK(n->admission_preemption_target > 0 && n->admission_preemption_target <= 1)
+      << "\"admission_preemption_target\" should be in range (0, 1]";
+  n->load_shedding = json::LookupOrDefault<bool>(json, "load_shedding", n->load_shedding);
+  n->load_shedding_max_queue_time_ms = json::LookupOrDefault<double>(
+      json, "load_shedding_max_queue_time_ms", n->load_shedding_max_queue_time_ms);
+  CHECK_GE(n->load_shedding_max_queue_time_ms, 0)
+      << "\"load_shedding_max_queue_time_ms\" should not be negative";
+  picojson::array decode_batch_size_buckets_arr = json::LookupOrDefault<picojson::array>(
+      json, "decode_batch_size_buckets", picojson::array());
+  n->decode_batch_size_buckets.clear();
+  for (const picojson::value& v : decode_batch_size_buckets_arr) {
+    CHECK(v.is<int64_t>() && v.get<int64_t>() > 0)
+        << "Invalid batch size in \"decode_batch_size_buckets\"";
+    n->decode_batch_size_buckets.push_back(v.get<int64_t>());
+  }
+  n->overlap_scheduling =
+      json::LookupOrDefault<bool>(json, "overlap_scheduling", n->overlap_scheduling);
+  n->num_decode_steps_per_step = json::LookupOrDefault<int64_t>(json, "num_decode_steps_per_step",
+                                                                n->num_decode_steps_per_step);
+  CHECK_GE(n->num_decode_steps_per_step, 1)
+      << "\"num_decode_steps_per_step\" should be at least 1";
+  n->restricted_vocab_max_tokens = json::LookupOrDefault<int64_t>(
+      json, "restricted_vocab_max_tokens", n->restricted_vocab_max_tokens);
+  CHECK_GE(n->restricted_vocab_max_tokens, 0)
+      << "\"restricted_vocab_max_tokens\" should not be negative";
+  n->device_power_state = DevicePowerStateFromString(json::LookupOrDefault<std::string>(
+      json, "device_power_state", DevicePowerStateToString(n->device_power_state)));
+  std::sort(n->decode_batch_size_buckets.begin(), n->decode_batch_size_buckets.end());
+  n->decode_batch_size_buckets.erase(
+      std::unique(n->decode_batch_size_buckets.begin(), n->decode_batch_size_buckets.end()),
+      n->decode_batch_size_buckets.end());
 
   return EngineConfig(n);
 }
@@ -354,6 +593,86 @@ EngineConfig::GetModelsAndModelLibsFromJSONString(const std::string& json_str) {
   return TResult::Ok(models_and_model_libs);
 }
 
+Result<bool> EngineConfig::ApplyKVEvictionToModelConfigs(
+    const std::string& json_str, std::vector<picojson::object>* model_configs) {
+  using TResult = Result<bool>;
+  picojson::value config_json;
+  std::string err = picojson::parse(config_json, json_str);
+  if (!err.empty()) {
+    return TResult::Error(err);
+  }
+  picojson::object config = config_json.get<picojson::object>();
+  int64_t window_size = json::LookupOrDefault<int64_t>(config, "kv_eviction_window_size", -1);
+  int64_t sink_size = json::LookupOrDefault<int64_t>(config, "kv_eviction_sink_size", 4);
+  if (window_size == -1) {
+    return TResult::Ok(false);
+  }
+  if (window_size <= 0 || sink_size < 0) {
+    return TResult::Error(
+        "\"kv_eviction_window_size\" should be positive and \"kv_eviction_sink_size\" should "
+        "not be negative.");
+  }
+  Result<bool> use_kv_cache = ModelsUseKVCache(*model_configs);
+  if (use_kv_cache.IsErr()) {
+    return use_kv_cache;
+  }
+  if (!use_kv_cache.Unwrap()) {
+    return TResult::Error("KV token eviction is not supported for RNN models.");
+  }
+  for (picojson::object& model_config : *model_configs) {
+    // The models with native sliding window keep their own window.
+    if (json::LookupOrDefault<int64_t>(model_config, "sliding_window_size", -1) != -1) {
+      continue;
+    }
+    model_config["sliding_window_size"] = picojson::value(window_size);
+    model_config["attention_sink_size"] = picojson::value(sink_size);
+    model_config["kv_eviction"] = picojson::value(true);
+  }
+  return TResult::Ok(true);
+}
+
+Result<DLDevice> EngineConfig::GetDraftDeviceFromJSONString(const std::string& json_str,
+                                                            DLDevice device) {
+  using TResult = Result<DLDevice>;
+  picojson::value config_json;
+  std::string err = picojson::parse(config_json, json_str);
+  if (!err.empty()) {
+    return TResult::Error(err);
+  }
+  picojson::object config = config_json.get<picojson::object>();
+  std::string draft_device = json::LookupOrDefault<std::string>(config, "draft_device", "");
+  if (draft_device.empty()) {
+    return TResult::Ok(device);
+  }
+  if (SpeculativeModeFromString(json::LookupOrDefault<std::string>(
+          config, "speculative_mode", "disable")) != SpeculativeMode::kSmallDraft) {
+    return TResult::Error("\"draft_device\" is only supported in the \"small_draft\" mode.");
+  }
+  // - Parse the device in the form of "<device type>[:<device id>]".
+  size_t colon_pos = draft_device.find(':');
+  std::string device_type = draft_device.substr(0, colon_pos);
+  int device_id = 0;
+  if (colon_pos != std::string::npos) {
+    try {
+      device_id = std::stoi(draft_device.substr(colon_pos + 1));
+    } catch (const std::exception&) {
+      device_id = -1;
+    }
+    if (device_id < 0) {
+      return TResult::Error("Invalid device id in \"draft_device\": \"" + draft_device + "\"");
+    }
+  }
+  static const std::unordered_map<std::string, DLDeviceType> device_types = {
+      {"cpu", kDLCPU},       {"cuda", kDLCUDA},     {"rocm", kDLROCM},
+      {"metal", kDLMetal},   {"vulkan", kDLVulkan}, {"opencl", kDLOpenCL}};
+  auto it = device_types.find(device_type);
+  if (it == device_types.end()) {
+    return TResult::Error("Unsupported device type in \"draft_device\": \"" + draft_device +
+                          "\"");
+  }
+  return TResult::Ok(DLDevice{it->second, device_id});
+}
+
 String EngineConfigNode::AsJSONString() const {
   picojson::object config;
 
@@ -370,11 +689,19 @@ String EngineConfigNode::AsJSONString() const {
   }
   config["additional_models"] = picojson::value(additional_models_arr);
   config["additional_model_libs"] = picojson::value(additional_model_libs_arr);
+  config["lazy_load_params"] = picojson::value(this->lazy_load_params);
+  config["param_offload_mb"] = picojson::value(this->param_offload_mb);
+  config["weight_shard_cache_dir"] = picojson::value(this->weight_shard_cache_dir);
+  config["max_num_lora_adapters"] =
+      picojson::value(static_cast<int64_t>(this->max_num_lora_adapters));
 
   // - Other fields
   config["mode"] = picojson::value(EngineModeToString(this->mode));
   config["gpu_memory_utilization"] = picojson::value(this->gpu_memory_utilization);
   config["kv_cache_page_size"] = picojson::value(static_cast<int64_t>(this->kv_cache_page_size));
+  config["kv_cache_dtype"] = picojson::value(KVCacheDTypeToString(this->kv_cache_dtype));
+  config["kv_eviction_window_size"] = picojson::value(this->kv_eviction_window_size);
+  config["kv_eviction_sink_size"] = picojson::value(this->kv_eviction_sink_size);
   config["max_num_sequence"] = picojson::value(static_cast<int64_t>(this->max_num_sequence));
   config["max_total_sequence_length"] =
       picojson::value(static_cast<int64_t>(this->max_total_sequence_length));
@@ -382,12 +709,79 @@ String EngineConfigNode::AsJSONString() const {
       picojson::value(static_cast<int64_t>(this->max_single_sequence_length));
   config["prefill_chunk_size"] = picojson::value(static_cast<int64_t>(this->prefill_chunk_size));
   config["max_history_size"] = picojson::value(static_cast<int64_t>(this->max_history_size));
+  config["startup_autotune"] = picojson::value(this->startup_autotune);
+  config["autotune_cache_dir"] = picojson::value(this->autotune_cache_dir);
   config["prefix_cache_mode"] = picojson::value(PrefixCacheModeToString(this->prefix_cache_mode));
   config["prefix_cache_max_num_recycling_seqs"] =
       picojson::value(static_cast<int64_t>(this->prefix_cache_max_num_recycling_seqs));
+  config["prefix_cache_eviction_policy"] =
+      picojson::value(PrefixCacheEvictionPolicyToString(this->prefix_cache_eviction_policy));
+  config["prefix_cache_host_memory_mb"] = picojson::value(this->prefix_cache_host_memory_mb);
+  config["response_cache_memory_mb"] = picojson::value(this->response_cache_memory_mb);
+  config["rnn_state_checkpoint_interval"] =
+      picojson::value(static_cast<int64_t>(this->rnn_state_checkpoint_interval));
+  config["prefix_cache_snapshot_path"] = picojson::value(this->prefix_cache_snapshot_path);
+  config["kv_cache_idle_compaction"] = picojson::value(this->kv_cache_idle_compaction);
+  config["image_embedding_cache_size"] =
+      picojson::value(static_cast<int64_t>(this->image_embedding_cache_size));
+  config["prefix_share_min_length"] =
+      picojson::value(static_cast<int64_t>(this->prefix_share_min_length));
+  config["preemption_mode"] = picojson::value(PreemptionModeToString(this->preemption_mode));
+  config["swap_space_mb"] = picojson::value(this->swap_space_mb);
+  config["engine_role"] = picojson::value(EngineRoleToString(this->engine_role));
+  config["scheduler_mode"] = picojson::value(SchedulerModeToString(this->scheduler_mode));
+  picojson::object tenant_weights_obj;
+  for (const auto& [tenant_id, weight] : this->tenant_weights) {
+    tenant_weights_obj[tenant_id] = picojson::value(weight);
+  }
+  config["tenant_weights"] = picojson::value(tenant_weights_obj);
+  config["tenant_max_kv_tokens"] = picojson::value(this->tenant_max_kv_tokens);
+  config["prefill_mode"] = picojson::value(PrefillModeToString(this->prefill_mode));
+  config["adaptive_prefill_target_itl_ms"] = picojson::value(this->adaptive_prefill_target_itl_ms);
+  config["step_token_budget"] = picojson::value(this->step_token_budget);
+  config["admission_kv_headroom"] = picojson::value(this->admission_kv_headroom);
+  config["admission_preemption_target"] = picojson::value(this->admission_preemption_target);
+  config["load_shedding"] = picojson::value(this->load_shedding);
+  config["load_shedding_max_queue_time_ms"] =
+      picojson::value(this->load_shedding_max_queue_time_ms);
+  picojson::array decode_batch_size_buckets_arr;
+  for (int batch_size : this->decode_batch_size_buckets) {
+    decode_batch_size_buckets_arr.push_back(picojson::value(static_cast<int64_t>(batch_size)));
+  }
+  config["decode_batch_size_buckets"] = picojson::value(decode_batch_size_buckets_arr);
+  config["overlap_scheduling"] = picojson::value(this->overlap_scheduling);
+  config["num_decode_steps_per_step"] =
+      picojson::value(static_cast<int64_t>(this->num_decode_steps_per_step));
+  config["restricted_vocab_max_tokens"] =
+      picojson::value(static_cast<int64_t>(this->restricted_vocab_max_tokens));
+  config["device_power_state"] =
+      picojson::value(DevicePowerStateToString(this->device_power_state));
   config["speculative_mode"] = picojson::value(SpeculativeModeToString(this->speculative_mode));
   config["spec_draft_length"] = picojson::value(static_cast<int64_t>(this->spec_draft_length));
+  config["spec_tree_width"] = picojson::value(static_cast<int64_t>(this->spec_tree_width));
+  config["adaptive_spec_draft_length"] = picojson::value(this->adaptive_spec_draft_length);
+  config["spec_max_batch_size"] = picojson::value(static_cast<int64_t>(this->spec_max_batch_size));
+  config["spec_ngram_max_size"] = picojson::value(static_cast<int64_t>(this->spec_ngram_max_size));
+  config["concurrent_draft_prefill"] = picojson::value(this->concurrent_draft_prefill);
+  config["draft_device"] = picojson::value(this->draft_device);
+  config["grammar_cache_dir"] = picojson::value(this->grammar_cache_dir);
+  config["grammar_cache_max_num_schemas"] =
+      picojson::value(static_cast<int64_t>(this->grammar_cache_max_num_schemas));
+  config["grammar_precompiled_path"] = picojson::value(this->grammar_precompiled_path);
+  config["grammar_jump_forward_max_tokens"] =
+      picojson::value(static_cast<int64_t>(this->grammar_jump_forward_max_tokens));
+  config["stream_back_max_pending_outputs"] =
+      picojson::value(static_cast<int64_t>(this->stream_back_max_pending_outputs));
+  config["stream_back_max_batch_size"] =
+      picojson::value(static_cast<int64_t>(this->stream_back_max_batch_size));
+  config["stream_back_flush_interval_ms"] = picojson::value(this->stream_back_flush_interval_ms);
+  config["stream_back_shm_path"] = picojson::value(this->stream_back_shm_path);
+  config["stream_back_shm_capacity"] =
+      picojson::value(static_cast<int64_t>(this->stream_back_shm_capacity));
+  config["host_numa_node"] = picojson::value(static_cast<int64_t>(this->host_numa_node));
   config["verbose"] = picojson::value(static_cast<bool>(this->verbose));
+  config["device_phase_timing"] = picojson::value(this->device_phase_timing);
+  config["traffic_capture_path"] = picojson::value(this->traffic_capture_path);
 
   return picojson::value(config).serialize(true);
 }
@@ -436,6 +830,12 @@ Result<ModelConfigLimits> GetModelConfigLimits(const std::vector<picojson::objec
       }
     }
 
+    // The KV footprint of a sequence under KV token eviction is bounded by the window, and
+    // the sequence length is no longer bounded by the context window.
+    if (json::LookupOrDefault<bool>(model_configs[i], "kv_eviction", false)) {
+      runtime_context_window_size = std::numeric_limits<int>::max();
+    }
+
     if (runtime_context_window_size != -1) {
       model_max_single_sequence_length =
           std::min(model_max_single_sequence_length, runtime_context_window_size);
@@ -489,8 +889,8 @@ struct MemUsageEstimationResult {
 };
 
 Result<MemUsageEstimationResult> EstimateMemoryUsageOnMode(
-    EngineMode mode, Device device, double gpu_memory_utilization, int64_t params_bytes,
-    int64_t temp_buffer_bytes,
+    EngineMode mode, Device device, double gpu_memory_utilization, KVCacheDType kv_cache_dtype,
+    int kv_cache_page_size, int64_t params_bytes, int64_t temp_buffer_bytes,
     const std::vector<picojson::object>& model_configs,  //
     const std::vector<ModelMetadata>& model_metadata,    //
     ModelConfigLimits model_config_limits,               //
@@ -502,7 +902,7 @@ Result<MemUsageEstimationResult> EstimateMemoryUsageOnMode(
     if (mode == EngineMode::kLocal) {
       inferred_config.max_num_sequence =
           std::min(static_cast<int64_t>(4), model_config_limits.model_max_batch_size);
-    } else if (mode == EngineMode::kInteractive) {
+    } else if (mode == EngineMode::kInteractive || mode == EngineMode::kLowMemory) {
       inferred_config.max_num_sequence = 1;
     } else {
       inferred_config.max_num_sequence = model_config_limits.model_max_batch_size;
@@ -537,12 +937,12 @@ Result<MemUsageEstimationResult> EstimateMemoryUsageOnMode(
     int64_t prefill_chunk_size =
         json::Lookup<int64_t>(compile_time_model_config, "prefill_chunk_size");
     // - Calculate KV cache memory usage.
-    int64_t num_layers = model_metadata[i].kv_cache_metadata.num_hidden_layers;
     int64_t head_dim = model_metadata[i].kv_cache_metadata.head_dim;
     int64_t num_qo_heads = model_metadata[i].kv_cache_metadata.num_attention_heads;
     int64_t num_kv_heads = model_metadata[i].kv_cache_metadata.num_key_value_heads;
     int64_t hidden_size = head_dim * num_qo_heads;
-    kv_bytes_per_token += head_dim * num_kv_heads * num_layers * 4 + 1.25;
+    kv_bytes_per_token +=
+        GetKVCacheBytesPerToken(model_metadata[i], kv_cache_dtype, kv_cache_page_size);
     kv_aux_workspace_bytes +=
         (max_num_sequence + 1) * 88 + prefill_chunk_size * (num_qo_heads + 1) * 8 +
         prefill_chunk_size * head_dim * (num_qo_heads + num_kv_heads) * 4 + 48 * 1024 * 1024;
@@ -609,6 +1009,10 @@ Result<MemUsageEstimationResult> EstimateMemoryUsageOnMode(
       inferred_config.max_total_sequence_length = std::min(
           {model_max_total_sequence_length, model_config_limits.model_max_single_sequence_length,
            model_config_limits.model_max_sliding_window_size});
+    } else if (mode == EngineMode::kLowMemory) {
+      inferred_config.max_total_sequence_length = std::min(
+          {model_max_total_sequence_length, model_config_limits.model_max_single_sequence_length,
+           model_config_limits.model_max_sliding_window_size, static_cast<int64_t>(4096)});
     } else {
       inferred_config.max_total_sequence_length =
           std::min(model_max_total_sequence_length,
@@ -627,6 +1031,12 @@ Result<MemUsageEstimationResult> EstimateMemoryUsageOnMode(
           std::min({model_config_limits.model_max_prefill_chunk_size,
                     inferred_config.max_total_sequence_length.value(),
                     model_config_limits.model_max_single_sequence_length});
+    } else if (mode == EngineMode::kLowMemory) {
+      // Small prefill chunks keep the attention workspace of the KV cache small.
+      inferred_config.prefill_chunk_size =
+          std::min({model_config_limits.model_max_prefill_chunk_size,
+                    inferred_config.max_total_sequence_length.value(),
+                    static_cast<int64_t>(512)});
     } else {
       inferred_config.prefill_chunk_size = model_config_limits.model_max_prefill_chunk_size;
     }
@@ -652,7 +1062,8 @@ Result<MemUsageEstimationResult> EstimateMemoryUsageOnMode(
 }
 
 Result<InferrableEngineConfig> InferrableEngineConfig::InferForKVCache(
-    EngineMode mode, Device device, double gpu_memory_utilization,
+    EngineMode mode, Device device, double gpu_memory_utilization, KVCacheDType kv_cache_dtype,
+    int kv_cache_page_size,
     const std::vector<picojson::object>& model_configs,
     const std::vector<ModelMetadata>& model_metadata, InferrableEngineConfig init_config,
     bool verbose) {
@@ -676,14 +1087,7 @@ Result<InferrableEngineConfig> InferrableEngineConfig::InferForKVCache(
   int64_t params_bytes = 0;
   int64_t temp_buffer_bytes = 0;
   for (const ModelMetadata& metadata : model_metadata) {
-    for (const ModelMetadata::Param& param : metadata.params) {
-      int64_t param_size = param.dtype.bytes();
-      for (int64_t v : param.shape) {
-        ICHECK_GE(v, 0);
-        param_size *= v;
-      }
-      params_bytes += param_size;
-    }
+    params_bytes += GetModelParamsBytes(metadata);
     for (const auto& [func_name, temp_buffer_size] : metadata.memory_usage) {
       temp_buffer_bytes = std::max(temp_buffer_bytes, temp_buffer_size);
     }
@@ -693,14 +1097,19 @@ Result<InferrableEngineConfig> InferrableEngineConfig::InferForKVCache(
 
   // - Infer the engine config and estimate memory usage for each mode.
   Result<MemUsageEstimationResult> local_mode_estimation_result = EstimateMemoryUsageOnMode(
-      EngineMode::kLocal, device, gpu_memory_utilization, params_bytes, temp_buffer_bytes,
-      model_configs, model_metadata, model_config_limits, init_config, verbose);
+      EngineMode::kLocal, device, gpu_memory_utilization, kv_cache_dtype, kv_cache_page_size,
+      params_bytes, temp_buffer_bytes, model_configs, model_metadata, model_config_limits,
+      init_config, verbose);
   Result<MemUsageEstimationResult> interactive_mode_estimation_result = EstimateMemoryUsageOnMode(
-      EngineMode::kInteractive, device, gpu_memory_utilization, params_bytes, temp_buffer_bytes,
-      model_configs, model_metadata, model_config_limits, init_config, verbose);
+      EngineMode::kInteractive, device, gpu_memory_utilization, kv_cache_dtype, kv_cache_page_size,
+      params_bytes, temp_buffer_bytes, model_configs, model_metadata, model_config_limits,
+      init_config, verbose);
+  // Mode "batch" infers the capacities in the same way as mode "server", and mode "low_memory"
+  // takes the place of mode "server" since it is never compared against other modes.
   Result<MemUsageEstimationResult> server_mode_estimation_result = EstimateMemoryUsageOnMode(
-      EngineMode::kServer, device, gpu_memory_utilization, params_bytes, temp_buffer_bytes,
-      model_configs, model_metadata, model_config_limits, init_config, verbose);
+      mode == EngineMode::kBatch || mode == EngineMode::kLowMemory ? mode : EngineMode::kServer,
+      device, gpu_memory_utilization, kv_cache_dtype, kv_cache_page_size, params_bytes,
+      temp_buffer_bytes, model_configs, model_metadata, model_config_limits, init_config, verbose);
   // - Pick the estimation result according to the mode.
   std::string mode_name;
   Result<MemUsageEstimationResult> final_estimation_result;
@@ -773,7 +1182,7 @@ Result<InferrableEngineConfig> InferrableEngineConfig::InferForRNNState(
   // - 2. max_batch_size
   if (!init_config.max_num_sequence.has_value()) {
     inferred_config.max_num_sequence =
-        mode == EngineMode::kInteractive
+        mode == EngineMode::kInteractive || mode == EngineMode::kLowMemory
             ? 1
             : std::min(static_cast<int64_t>(4), model_config_limits.model_max_batch_size);
     os << "max batch size will be set to " << inferred_config.max_num_sequence.value() << ", ";
@@ -797,6 +1206,8 @@ Result<InferrableEngineConfig> InferrableEngineConfig::InferForRNNState(
     os << "We choose small max batch size and RNN state capacity to use less GPU memory.";
   } else if (mode == EngineMode::kInteractive) {
     os << "We fix max batch size to 1 for interactive single sequence use.";
+  } else if (mode == EngineMode::kLowMemory) {
+    os << "We fix max batch size to 1 and use small RNN state capacity to save device memory.";
   } else {
     os << "We use as much GPU memory as possible (within the limit of gpu_memory_utilization).";
   }
@@ -809,14 +1220,7 @@ Result<InferrableEngineConfig> InferrableEngineConfig::InferForRNNState(
   int64_t params_bytes = 0;
   int64_t temp_buffer_bytes = 0;
   for (const ModelMetadata& metadata : model_metadata) {
-    for (const ModelMetadata::Param& param : metadata.params) {
-      int64_t param_size = param.dtype.bytes();
-      for (int64_t v : param.shape) {
-        ICHECK_GE(v, 0);
-        param_size *= v;
-      }
-      params_bytes += param_size;
-    }
+    params_bytes += GetModelParamsBytes(metadata);
     for (const auto& [func_name, temp_buffer_size] : metadata.memory_usage) {
       temp_buffer_bytes += temp_buffer_size;
     }
@@ -11,6 +11,9 @@
 #include <tvm/runtime/object.h>
 
 #include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "../metadata/model.h"
 #include "../support/result.h"
@@ -44,13 +47,24 @@ class GenerationConfigNode : public Object {
   int n = 1;
   double temperature = 0.8;
   double top_p = 0.95;
+  /*! \brief The number of most probable tokens kept for sampling. Non-positive means no limit. */
+  int top_k = 0;
+  /*! \brief The minimal probability, relative to the most probable token, of kept tokens. */
+  double min_p = 0.0;
   double frequency_penalty = 0.0;
   double presence_penalty = 0.0;
   double repetition_penalty = 1.0;
   bool logprobs = false;
   int top_logprobs = 0;
+  /*!
+   * \brief The format of the streamed logprobs, "json" for the JSON string of each token, or
+   * "array" for the arrays of the token ids and the logprobs of each output.
+   */
+  String logprob_format = "json";
   std::vector<std::pair<int, float>> logit_bias;
   int seed;
+  /*! \brief Whether the seed is given by the request, rather than drawn at random. */
+  bool fixed_seed = false;
   bool ignore_eos = false;
 
   int max_tokens = 128;
@@ -60,11 +74,54 @@ class GenerationConfigNode : public Object {
   ResponseFormat response_format;
   std::optional<DebugConfig> debug_config = std::nullopt;
 
+  /*!
+   * \brief The scheduling priority of the request. Requests with larger
+   * priority are prefilled earlier and preempted later.
+   */
+  int priority = 0;
+  /*! \brief The time-to-first-token deadline in milliseconds. "-1" means no deadline. */
+  double ttft_slo_ms = -1;
+  /*! \brief The time-per-output-token deadline in milliseconds. "-1" means no deadline. */
+  double tpot_slo_ms = -1;
+  /*!
+   * \brief The tenant that the request is accounted to under the fair-share scheduler.
+   * Empty means the default tenant.
+   */
+  String tenant_id = "";
+
+  /*!
+   * \brief The number of beams of beam search. "1" means the request is generated by sampling.
+   * Under beam search, the `n` best finished beams are returned.
+   */
+  int num_beams = 1;
+  /*!
+   * \brief The exponent of the generated length that beam search divides the log probability
+   * of a finished beam by. Values larger than 0 favor longer outputs.
+   */
+  double length_penalty = 1.0;
+
+  /*!
+   * \brief The path to the LoRA adapter applied to the request. Empty means the request runs
+   * with the base model only.
+   */
+  String lora_adapter = "";
+
+  /*!
+   * \brief The output of the prefill-only request, which runs only the prefill of its prompt
+   * and generates no token. "last_hidden_state" returns the hidden states of the last prompt
+   * token, and "prompt_logprobs" returns the logprob of each prompt token after the first.
+   * Empty means the request generates tokens as usual.
+   */
+  String prefill_only_output = "";
+
   String AsJSONString() const;
 
   static constexpr const char* _type_key = "mlc.serve.GenerationConfig";
   static constexpr const bool _type_has_method_sequal_reduce = false;
   static constexpr const bool _type_has_method_shash_reduce = false;
+  /*! \brief The maximum number of beams of beam search. */
+  static constexpr int kMaxNumBeams = 8;
+
   TVM_DECLARE_BASE_OBJECT_INFO(GenerationConfigNode, Object);
 };
 
@@ -72,6 +129,7 @@ class GenerationConfig : public ObjectRef {
  public:
   TVM_DLL explicit GenerationConfig(
       std::optional<int> n, std::optional<double> temperature, std::optional<double> top_p,
+      std::optional<int> top_k, std::optional<double> min_p,
       std::optional<double> frequency_penalty, std::optional<double> presense_penalty,
       std::optional<double> repetition_penalty, std::optional<bool> logprobs,
       std::optional<int> top_logprobs, std::optional<std::vector<std::pair<int, float>>> logit_bias,
@@ -93,7 +151,7 @@ class GenerationConfig : public ObjectRef {
 
 /*!
  * \brief The engine mode in MLC LLM.
- * We provide three preset modes: "local", "interactive" and "server".
+ * We provide four preset modes: "local", "interactive", "server" and "batch".
  * The default mode is "local".
  * The choice of mode decides the values of "max_batch_size", "max_total_sequence_length"
  * and "prefill_chunk_size" when they are not explicitly specified.
@@ -109,11 +167,32 @@ class GenerationConfig : public ObjectRef {
  * many concurrent request and want to use GPU memory as much as possible.
  * In this mode, we will automatically infer the largest possible max batch
  * size and max total sequence length.
+ * 4. Mode "batch" refers to the offline batch inference, which has no latency
+ * targets and only cares about the throughput. The capacities are inferred in
+ * the same way as mode "server", and the requests are scheduled first come first
+ * served, so that the order the requests are added in decides the batching.
  */
 enum class EngineMode : int {
   kLocal = 0,
   kInteractive = 1,
   kServer = 2,
+  kBatch = 3,
+  kLowMemory = 4,
+};
+
+/*!
+ * \brief The storage data type of the paged KV cache. The quantized data types keep a scale
+ * for the K data and the V data of each layer and KV head in every page.
+ */
+enum class KVCacheDType : int {
+  /*! \brief Store the KV cache in the activation data type of the model. */
+  kAuto = 0,
+  /*! \brief Store the KV cache in float8 (e4m3). */
+  kFloat8E4M3 = 1,
+  /*! \brief Store the KV cache in int8. */
+  kInt8 = 2,
+  /*! \brief Store the KV cache in int4. */
+  kInt4 = 3,
 };
 
 /*! \brief The prefix cache mode. */
@@ -124,6 +203,93 @@ enum class PrefixCacheMode : int {
   kRadix = 1,
 };
 
+/*! \brief The policy to select the recycling sequence to evict from prefix cache. */
+enum class PrefixCacheEvictionPolicy : int {
+  /*! \brief Evict the least recently used sequence. */
+  kLRU = 0,
+  /*! \brief Evict the least frequently used sequence. */
+  kLFU = 1,
+  /*!
+   * \brief Evict the sequence that saves the least prefill work per exclusively held
+   * KV cache slot, weighted by its length and hit count.
+   */
+  kCostAware = 2,
+};
+
+/*! \brief The preemption mode, which decides what happens to the KV cache of preempted requests. */
+enum class PreemptionMode : int {
+  /*! \brief Drop the KV cache, and re-prefill the request when it resumes. */
+  kRecompute = 0,
+  /*! \brief Copy the KV cache to host memory, and copy it back when the request resumes. */
+  kSwap = 1,
+};
+
+/*! \brief The role of the engine under prefill/decode disaggregation. */
+enum class EngineRole : int {
+  /*! \brief The engine both prefills and decodes requests. */
+  kMixed = 0,
+  /*!
+   * \brief The engine only prefills requests. The prefilled requests are exported with
+   * their KV cache and handed over to decode engines.
+   */
+  kPrefill = 1,
+  /*!
+   * \brief The engine decodes the requests imported from prefill engines, and restores
+   * their KV cache from the imported KV data. It can still prefill new requests.
+   */
+  kDecode = 2,
+};
+
+/*! \brief The request scheduler mode. */
+enum class SchedulerMode : int {
+  /*!
+   * \brief First-come-first-serve. Requests are prefilled in arrival order,
+   * and the most recently started request is preempted first.
+   */
+  kFCFS = 0,
+  /*!
+   * \brief Requests are prefilled and preempted according to their priority
+   * and the slack towards their TTFT/TPOT deadlines.
+   */
+  kSLOAware = 1,
+  /*!
+   * \brief Requests of different tenants are prefilled in the weighted fair-share order of
+   * the prefill and decode tokens served to each tenant, and the requests of the most served
+   * tenant are preempted first. Requests of the same tenant are first-come-first-serve.
+   */
+  kFairShare = 2,
+};
+
+/*! \brief The prefill mode, which decides how prefill is scheduled with decode. */
+enum class PrefillMode : int {
+  /*!
+   * \brief Prefill runs in its own engine steps with chunking, and decode of running requests
+   * waits until the prefill step finishes.
+   */
+  kChunked = 0,
+  /*!
+   * \brief The decode tokens of running requests are packed with a prefill chunk into a single
+   * forward pass, so that both prefill and decode make progress in each step.
+   */
+  kHybrid = 1,
+};
+
+/*!
+ * \brief The thermal and battery state of the device hinted by the app, which follows the
+ * thermal states of mobile platforms. The app maps the low-battery and power-saving modes to
+ * the serious state.
+ */
+enum class DevicePowerState : int {
+  /*! \brief The engine runs at full capacity. */
+  kNominal = 0,
+  /*! \brief The device is slightly warm. The batch size and the prefill chunk are reduced. */
+  kFair = 1,
+  /*! \brief The device is hot, or on low battery. The engine steps are also paced. */
+  kSerious = 2,
+  /*! \brief The device is throttled. The engine runs at the lowest capacity. */
+  kCritical = 3,
+};
+
 /*! \brief The speculative mode. */
 enum class SpeculativeMode : int {
   /*! \brief Disable speculative decoding. */
@@ -134,6 +300,17 @@ enum class SpeculativeMode : int {
   kEagle = 2,
   /*! \brief The Medusa-style speculative decoding. */
   kMedusa = 3,
+  /*!
+   * \brief The draft-free speculative decoding, which proposes the tokens following the
+   * latest n-gram match of the generated tokens in the prompt and history of each request.
+   */
+  kNGram = 4,
+  /*!
+   * \brief The self-speculative decoding, where the model proposes the drafts by decoding
+   * through an early-exit subset of its own layers, which read the KV cache of the full
+   * model for those layers.
+   */
+  kLayerSkip = 5,
 };
 
 class InferrableEngineConfig;
@@ -151,6 +328,33 @@ class EngineConfigNode : public Object {
   Array<String> additional_models;
   /*! \brief The path to the additional models' libraries. */
   Array<String> additional_model_libs;
+  /*!
+   * \brief Whether to load the model weights in the background. The engine is created without
+   * waiting for the weights, which are waited for when the models first run.
+   * It does not take effect under tensor parallelism.
+   */
+  bool lazy_load_params = false;
+  /*!
+   * \brief The size (in MB) of the model weights kept in page-locked host memory instead of
+   * the device memory, which the device kernels read in place. The embedding table goes first
+   * when it is not shared with the LM head, and then the decoder layers from the last one, in
+   * whole layers. It only takes effect on CUDA and ROCm without tensor parallelism.
+   * Set 0 to keep all the weights on device.
+   */
+  int64_t param_offload_mb = 0;
+  /*!
+   * \brief The directory of the cache of the preprocessed weight shards under tensor
+   * parallelism. The first start of a model whose weights are sharded at loading time saves
+   * the shards of every worker in the cache, keyed by the model weights and the number of
+   * shards, and the later starts load the saved shards directly without preprocessing.
+   * Empty means the cache is disabled.
+   */
+  std::string weight_shard_cache_dir = "";
+  /*!
+   * \brief The maximum number of LoRA adapters resident on device at the same time, which
+   * the requests of a batch can apply independently. Set 0 to disable LoRA adapters.
+   */
+  int max_num_lora_adapters = 0;
 
   /*************** KV cache config and engine capacities ***************/
 
@@ -170,6 +374,19 @@ class EngineConfigNode : public Object {
   float gpu_memory_utilization = 0.85;
   /*! \brief The number of consecutive tokens handled in each page in paged KV cache. */
   int kv_cache_page_size = 16;
+  /*! \brief The storage data type of the paged KV cache. */
+  KVCacheDType kv_cache_dtype = KVCacheDType::kAuto;
+  /*!
+   * \brief The number of the most recent tokens that each sequence keeps in KV cache when KV
+   * tokens are evicted, in addition to the "kv_eviction_sink_size" attention sink tokens at the
+   * start of the sequence. The other tokens are evicted as the sequence grows, so that the
+   * sequence length is no longer bounded by the context window. It applies to the models
+   * without native sliding window, whose KV cache applies the rotary embedding. "-1" means no
+   * eviction.
+   */
+  int64_t kv_eviction_window_size = -1;
+  /*! \brief The number of attention sink tokens kept in KV cache under KV token eviction. */
+  int64_t kv_eviction_sink_size = 4;
   /*!
    * \brief The maximum number of sequences that are allowed to be
    * processed by the KV cache at any time.
@@ -186,6 +403,20 @@ class EngineConfigNode : public Object {
   int64_t prefill_chunk_size = 1024;
   /*! \brief The maximum history size for RNN state. KV cache does not need this. */
   int max_history_size = 0;
+  /*!
+   * \brief A boolean indicating whether to autotune the batch size and the prefill chunk size
+   * at startup. The engine runs synthetic prefill and decode steps over the candidates up to
+   * "max_num_sequence" and "prefill_chunk_size", and picks the smallest ones reaching nearly
+   * the best measured throughput. The steps also warm up the kernels and allocators before the
+   * first request.
+   */
+  bool startup_autotune = false;
+  /*!
+   * \brief The directory where the autotuned capacities are saved, keyed by the models, the
+   * device and the capacity upper bounds, so that restarts skip the measurement and only warm
+   * up. Set empty to measure at every startup.
+   */
+  String autotune_cache_dir = "";
 
   /*************** Prefix cache ***************/
 
@@ -194,6 +425,170 @@ class EngineConfigNode : public Object {
   /*! \brief The maximum number of recycling sequences in prefix cache, default as max_num_sequence.
    * And set 0 to disable prefix cache, set -1 to have infinite capacity prefix cache. */
   int prefix_cache_max_num_recycling_seqs = -1;
+  /*! \brief The policy to select the recycling sequence to evict from prefix cache. */
+  PrefixCacheEvictionPolicy prefix_cache_eviction_policy = PrefixCacheEvictionPolicy::kLRU;
+  /*!
+   * \brief The capacity of the host memory tier (in MB) of prefix cache. Recycling sequences
+   * evicted from the KV cache are offloaded to the host tier and restored on a prefix match.
+   * Set 0 to disable the host tier.
+   */
+  int64_t prefix_cache_host_memory_mb = 0;
+  /*!
+   * \brief The capacity (in MB) of the exact-match response cache. The responses of greedy
+   * requests and of requests with a fixed seed are cached, keyed by the prompt tokens, the
+   * generation config and the model, and the same requests later are answered from the cache
+   * without running the model. Set 0 to disable the response cache.
+   */
+  int64_t response_cache_memory_mb = 0;
+  /*!
+   * \brief The interval in tokens of the RNN state checkpoints taken in prefill. The
+   * checkpoints are kept as recycling sequences of prefix cache, so that a new request resumes
+   * from the nearest checkpoint at or below its matched prefix. RNN state can only be forked at
+   * the end of sequences, which without checkpoints matches only the sequences ending where the
+   * match ends. Set 0 to disable the checkpoints. Only applies to RNN models.
+   */
+  int rnn_state_checkpoint_interval = 0;
+  /*!
+   * \brief The path of the on-disk prefix cache snapshot. The cached sequences and their KV
+   * data are saved to it when the engine is unloaded, and loaded from it when the engine is
+   * created, if the snapshot was saved with the same model and tokenizer.
+   * Set empty to disable the snapshot.
+   */
+  String prefix_cache_snapshot_path = "";
+  /*!
+   * \brief A boolean indicating whether to compact the KV cache when the engine becomes idle.
+   * The recycling sequences of prefix cache drop the trailing tokens that partially fill their
+   * last pages, so that the pages are freed for new sequences.
+   */
+  bool kv_cache_idle_compaction = false;
+  /*!
+   * \brief The maximum number of image embeddings cached on device, keyed by the image
+   * content hash, so that the images repeated across turns and requests are not encoded again.
+   * The image positions are also matched in prefix cache. Set 0 to disable the cache.
+   */
+  int image_embedding_cache_size = 8;
+  /*!
+   * \brief The minimum length of an uncached prefix shared with an earlier waiting request,
+   * at which a new request waits for the earlier request to prefill the prefix, and then forks
+   * it from prefix cache instead of prefilling it again. Set 0 to disable the waiting.
+   */
+  int prefix_share_min_length = 256;
+
+  /*************** Preemption ***************/
+
+  /*! \brief The preemption mode. */
+  PreemptionMode preemption_mode = PreemptionMode::kRecompute;
+  /*!
+   * \brief The capacity of the host memory pool (in MB) holding the swapped-out KV cache.
+   * Only effective when the preemption mode is "swap".
+   */
+  int64_t swap_space_mb = 4096;
+
+  /*************** Disaggregation ***************/
+
+  /*!
+   * \brief The role of the engine under prefill/decode disaggregation. A "decode" engine
+   * holds the imported KV data in a host memory pool of `swap_space_mb` MB.
+   */
+  EngineRole engine_role = EngineRole::kMixed;
+
+  /*************** Scheduling ***************/
+
+  /*! \brief The request scheduler mode. */
+  SchedulerMode scheduler_mode = SchedulerMode::kFCFS;
+  /*!
+   * \brief The share weight of each tenant under the fair-share scheduler. Tenants not listed
+   * have weight 1.
+   */
+  std::unordered_map<std::string, double> tenant_weights;
+  /*!
+   * \brief The maximum number of KV cache tokens that the running requests of a tenant can
+   * hold. A waiting request is not admitted into prefill while it would take its tenant over
+   * the cap. "-1" means no cap.
+   */
+  int64_t tenant_max_kv_tokens = -1;
+  /*!
+   * \brief The prefill mode. The hybrid mode only takes effect when speculative decoding
+   * is disabled.
+   */
+  PrefillMode prefill_mode = PrefillMode::kChunked;
+  /*!
+   * \brief The target decode inter-token latency (in ms). When positive, the prefill chunk
+   * size is adapted every step from the measured prefill and decode latency to hold the
+   * target, and "prefill_chunk_size" becomes the upper bound. Set 0 to keep the prefill
+   * chunk size static.
+   */
+  double adaptive_prefill_target_itl_ms = 0;
+  /*!
+   * \brief The number of tokens each engine step processes across prefill, decode and the
+   * draft tokens under verification. The budget is further bounded by the adaptive prefill
+   * chunk size. Decode takes one token per running request, the draft tokens take the rest
+   * evenly, and the prefill chunk takes the budget left by the packed decode tokens.
+   * Set 0 to bound each kind of step by its own limits.
+   */
+  int64_t step_token_budget = 0;
+  /*!
+   * \brief The fraction of the KV cache pages kept free when admitting new requests into
+   * prefill, as the headroom for the decode of running requests.
+   */
+  double admission_kv_headroom = 0;
+  /*!
+   * \brief The target probability that an admitted request outgrows the KV pages forecast for
+   * it, which bounds the expected preemptions. When below 1, the pages each request is expected
+   * to decode are forecast from `max_tokens` and the output lengths of the finished requests,
+   * and new requests are admitted only while the forecast demand fits the KV cache.
+   * Set 1 to admit by the input pages only.
+   */
+  double admission_preemption_target = 1;
+  /*!
+   * \brief A boolean indicating whether to reject new requests whose predicted queue time
+   * exceeds their deadline, i.e. their "ttft_slo_ms" or `load_shedding_max_queue_time_ms`,
+   * whichever is tighter. The queue time is predicted from the uncached input tokens of the
+   * waiting requests scheduled before the request and the rate at which the engine drains its
+   * waiting queue. Rejected requests finish with the "rejected" finish reason without prefill.
+   */
+  bool load_shedding = false;
+  /*!
+   * \brief The queue time deadline in milliseconds of all the requests under load shedding.
+   * Set 0 to bound the requests by their "ttft_slo_ms" only.
+   */
+  double load_shedding_max_queue_time_ms = 0;
+  /*!
+   * \brief The bucketed batch sizes of decode, in ascending order. When not empty, each decode
+   * batch is padded to the next bucket size, so that the device graphs captured by models
+   * compiled with CUDA graph are replayed for a small set of batch sizes. The graphs of all
+   * the buckets are captured when the engine is created.
+   */
+  std::vector<int> decode_batch_size_buckets;
+  /*!
+   * \brief A boolean indicating whether to overlap the post-processing of a decode step
+   * (detokenization, stream callback and finished request handling) with the device
+   * execution of the next decode step. Requests that finish in a step run one extra decode
+   * whose tokens are discarded. It only takes effect when speculative decoding is disabled.
+   */
+  bool overlap_scheduling = false;
+  /*!
+   * \brief The number of decode iterations that a decode step runs back-to-back before the
+   * host post-processing, for throughput serving. The stop conditions are checked after the
+   * iterations, and the tokens beyond a stop are discarded. The iterations never exceed the
+   * max tokens of a request. Requests with beam search or grammar decode one token a step.
+   */
+  int num_decode_steps_per_step = 1;
+  /*!
+   * \brief The maximum number of tokens in the restricted vocabulary of a decode step. When
+   * every request in a decode batch is constrained by a grammar, and the union of the tokens
+   * their grammars allow next has no more than this many tokens, only the lm_head rows of
+   * these tokens are computed. It requires the model to be compiled with the
+   * "get_logits_for_tokens" function. Set 0 to always compute the full vocabulary.
+   */
+  int restricted_vocab_max_tokens = 0;
+  /*!
+   * \brief The thermal and battery state of the device. Above the nominal state, the engine
+   * admits fewer running requests, prefills smaller chunks, idles between steps for a fraction
+   * of the step time, and releases the transient device buffers when it has no request.
+   * It can be changed at runtime with `Engine::Reconfigure`.
+   */
+  DevicePowerState device_power_state = DevicePowerState::kNominal;
 
   /*************** Speculative decoding ***************/
 
@@ -201,9 +596,126 @@ class EngineConfigNode : public Object {
   SpeculativeMode speculative_mode = SpeculativeMode::kDisable;
   /*! \brief The number of tokens to generate in speculative proposal (draft). */
   int spec_draft_length = 4;
+  /*!
+   * \brief The maximum number of draft tokens at each level of the draft token tree in the
+   * small draft and Medusa modes. A draft token may have multiple candidate children, which
+   * are verified together in one step. "1" means the draft tokens form a chain.
+   */
+  int spec_tree_width = 1;
+  /*!
+   * \brief Whether to adapt the draft length of each request to its running acceptance rate,
+   * with `spec_draft_length` as the upper bound.
+   */
+  bool adaptive_spec_draft_length = false;
+  /*!
+   * \brief The largest number of running requests to draft for. Beyond it, draft proposal
+   * is skipped and the requests are decoded without speculation, as verification is no
+   * longer cheaper than decode for large batches. "-1" means no limit.
+   */
+  int spec_max_batch_size = -1;
+  /*!
+   * \brief The largest n-gram to match in the "ngram" mode. The proposals match the
+   * largest n-gram first, down to single tokens.
+   */
+  int spec_ngram_max_size = 3;
+  /*!
+   * \brief A boolean indicating whether to run the prefill of the small draft model on a
+   * side stream, concurrently with the prefill of the target model. It only takes effect on
+   * single-GPU CUDA/ROCm in the "small_draft" mode, as the draft prefill of Eagle and Medusa
+   * depends on the hidden states of the target model.
+   */
+  bool concurrent_draft_prefill = false;
+  /*!
+   * \brief The device to run the draft models on in the "small_draft" mode, in the form of
+   * "cuda:1" or "cpu". The draft models then take no memory or compute of the engine device,
+   * and their draft probabilities are copied to the engine device for verification. The draft
+   * models run on the engine device when it is empty.
+   */
+  std::string draft_device = "";
+
+  /*************** Grammar ***************/
+
+  /*!
+   * \brief The directory of the on-disk cache of grammar init contexts. The preprocessing
+   * result of each JSON schema is saved to the directory, keyed by the hash of the schema and
+   * the token table, so that engine restarts and other engines sharing the directory skip the
+   * preprocessing. Set empty to disable the on-disk cache.
+   */
+  String grammar_cache_dir = "";
+  /*!
+   * \brief The maximum number of JSON schemas whose init contexts are kept in memory. The least
+   * recently used one is evicted beyond it.
+   */
+  int grammar_cache_max_num_schemas = 64;
+  /*!
+   * \brief A compiled grammar file, or a directory of .json or .bin compiled grammar files,
+   * loaded at startup. The JSON schemas of the compiled grammars have no conversion or
+   * preprocessing latency at their first requests, which suits tool-calling APIs with fixed
+   * schemas. A compiled grammar of the empty schema replaces the preprocessing of the built-in
+   * JSON grammar. Compiled grammars of another tokenizer are skipped. Set empty to load none.
+   */
+  String grammar_precompiled_path = "";
+  /*!
+   * \brief The maximum number of tokens to jump forward in one step. When the grammar forces
+   * a unique continuation string (e.g., JSON keys and punctuation), the tokens of the string
+   * are appended to the request in one prefill-style forward pass instead of being decoded
+   * one by one. It only takes effect when speculative decoding is disabled. Set 0 to disable
+   * jump-forward decoding.
+   */
+  int grammar_jump_forward_max_tokens = 0;
+
+  /*************** Stream back ***************/
+
+  /*!
+   * \brief The maximum number of request delta outputs pending to be passed to the stream
+   * callback of the threaded engine. When the callback falls behind and the number is reached,
+   * the engine loop waits for the callback to catch up, which bounds the memory of pending
+   * outputs. "-1" means no limit.
+   */
+  int stream_back_max_pending_outputs = -1;
+  /*!
+   * \brief The maximum number of request outputs passed to one invocation of the stream
+   * callback of the threaded engine. "-1" means no limit.
+   */
+  int stream_back_max_batch_size = -1;
+  /*!
+   * \brief The time in milliseconds that the threaded engine waits for more outputs to batch
+   * before invoking the stream callback. The delta outputs of the same request pending in the
+   * meantime are merged. Set 0 to invoke the callback as soon as there are outputs.
+   */
+  double stream_back_flush_interval_ms = 0;
+  /*!
+   * \brief The path of the shared-memory output ring file (e.g., under "/dev/shm"). When set,
+   * the threaded engine writes the delta tokens and finish reasons of requests to the ring,
+   * which a frontend process polls, instead of invoking the stream callback. The outputs with
+   * logprobs or prefill-only outputs are still passed through the callback. Set empty to pass
+   * all outputs through the callback.
+   */
+  String stream_back_shm_path = "";
+  /*! \brief The number of records in the shared-memory output ring. */
+  int stream_back_shm_capacity = 65536;
+  /*!
+   * \brief The NUMA node whose cores the host threads are pinned to, which should be the node
+   * of the GPU. It pins the engine loop, the stream-back loop and the threading backend pool
+   * that tokenizes and samples. "-1" means the threads are not pinned.
+   */
+  int host_numa_node = -1;
 
   /*************** Debug ***************/
   bool verbose = false;
+  /*!
+   * \brief Whether to time the embedding, forward, logits, logit processing and sampling
+   * phases of each engine step on the device with device events, so that the statistics tell
+   * the device time apart from the host time. It adds a synchronization at the end of steps.
+   */
+  bool device_phase_timing = false;
+  /*!
+   * \brief The path of the file to capture the served traffic to, which records the arrival
+   * time, the input length and prefix hashes, the generation config and the output length of
+   * each request, for the traffic to be replayed (see TrafficCapture). The file of each engine
+   * replica is suffixed by ".replica" and the replica index. Set empty to disable the capture.
+   */
+  String traffic_capture_path = "";
 
   TVM_DLL String AsJSONString() const;
 
@@ -226,6 +738,24 @@ class EngineConfig : public ObjectRef {
   TVM_DLL static Result<std::vector<std::pair<std::string, std::string>>>
   GetModelsAndModelLibsFromJSONString(const std::string& json_str);
 
+  /*!
+   * \brief Apply the KV token eviction of the JSON string to the model configs. The models
+   * without native sliding window then keep the attention sink and the recent tokens in KV
+   * cache as a sliding window, which the page accounting and the prefix cache follow.
+   * \return Whether the KV token eviction is enabled, or the error message.
+   */
+  TVM_DLL static Result<bool> ApplyKVEvictionToModelConfigs(
+      const std::string& json_str, std::vector<picojson::object>* model_configs);
+
+  /*!
+   * \brief Get the device of the draft models from the JSON string for engine initialization.
+   * \param json_str The engine config JSON string.
+   * \param device The engine device, which the draft models run on by default.
+   * \return The device of the draft models, or the error message.
+   */
+  TVM_DLL static Result<DLDevice> GetDraftDeviceFromJSONString(const std::string& json_str,
+                                                               DLDevice device);
+
   TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(EngineConfig, ObjectRef, EngineConfigNode);
 };
 
@@ -237,9 +767,13 @@ struct InferrableEngineConfig {
   std::optional<int64_t> prefill_chunk_size;
   std::optional<int64_t> max_history_size;
 
-  /*! \brief Infer the config for KV cache from a given initial config. */
+  /*!
+   * \brief Infer the config for KV cache from a given initial config.
+   * The KV cache capacity is inferred with the footprint of the given KV cache data type.
+   */
   TVM_DLL static Result<InferrableEngineConfig> InferForKVCache(
-      EngineMode mode, Device device, double gpu_memory_utilization,
+      EngineMode mode, Device device, double gpu_memory_utilization, KVCacheDType kv_cache_dtype,
+      int kv_cache_page_size,
       const std::vector<picojson::object>& model_configs,
       const std::vector<ModelMetadata>& model_metadata, InferrableEngineConfig init_config,
       bool verbose);
@@ -263,6 +797,10 @@ inline std::string EngineModeToString(EngineMode mode) {
     return "interactive";
   } else if (mode == EngineMode::kServer) {
     return "server";
+  } else if (mode == EngineMode::kBatch) {
+    return "batch";
+  } else if (mode == EngineMode::kLowMemory) {
+    return "low_memory";
   } else {
     LOG(FATAL) << "Invalid engine mode: " << static_cast<int>(mode);
     throw;
@@ -276,12 +814,60 @@ inline EngineMode EngineModeFromString(const std::string& mode) {
     return EngineMode::kInteractive;
   } else if (mode == "server") {
     return EngineMode::kServer;
+  } else if (mode == "batch") {
+    return EngineMode::kBatch;
+  } else if (mode == "low_memory") {
+    return EngineMode::kLowMemory;
   } else {
     LOG(FATAL) << "Invalid engine mode string: " << mode;
     throw;
   }
 }
 
+inline std::string KVCacheDTypeToString(KVCacheDType kv_cache_dtype) {
+  if (kv_cache_dtype == KVCacheDType::kAuto) {
+    return "auto";
+  } else if (kv_cache_dtype == KVCacheDType::kFloat8E4M3) {
+    return "e4m3_float8";
+  } else if (kv_cache_dtype == KVCacheDType::kInt8) {
+    return "int8";
+  } else if (kv_cache_dtype == KVCacheDType::kInt4) {
+    return "int4";
+  } else {
+    LOG(FATAL) << "Invalid KV cache dtype: " << static_cast<int>(kv_cache_dtype);
+    throw;
+  }
+}
+
+inline KVCacheDType KVCacheDTypeFromString(const std::string& kv_cache_dtype) {
+  if (kv_cache_dtype == "auto") {
+    return KVCacheDType::kAuto;
+  } else if (kv_cache_dtype == "e4m3_float8") {
+    return KVCacheDType::kFloat8E4M3;
+  } else if (kv_cache_dtype == "int8") {
+    return KVCacheDType::kInt8;
+  } else if (kv_cache_dtype == "int4") {
+    return KVCacheDType::kInt4;
+  } else {
+    LOG(FATAL) << "Invalid KV cache dtype string: " << kv_cache_dtype;
+    throw;
+  }
+}
+
+/*!
+ * \brief Get the number of bits of each KV cache element stored in the given data type.
+ * The activation data type is assumed to be 16-bit for "auto".
+ */
+inline int KVCacheDTypeBits(KVCacheDType kv_cache_dtype) {
+  if (kv_cache_dtype == KVCacheDType::kAuto) {
+    return 16;
+  } else if (kv_cache_dtype == KVCacheDType::kInt4) {
+    return 4;
+  } else {
+    return 8;
+  }
+}
+
 inline std::string PrefixCacheModeToString(PrefixCacheMode prefix_cache_mode) {
   if (prefix_cache_mode == PrefixCacheMode::kDisable) {
     return "disable";
@@ -303,6 +889,158 @@ inline PrefixCacheMode PrefixCacheModeFromString(const std::string& prefix_cache
   }
 }
 
+inline std::string PrefixCacheEvictionPolicyToString(PrefixCacheEvictionPolicy policy) {
+  if (policy == PrefixCacheEvictionPolicy::kLRU) {
+    return "lru";
+  } else if (policy == PrefixCacheEvictionPolicy::kLFU) {
+    return "lfu";
+  } else if (policy == PrefixCacheEvictionPolicy::kCostAware) {
+    return "cost_aware";
+  } else {
+    LOG(FATAL) << "Invalid prefix cache eviction policy: " << static_cast<int>(policy);
+    throw;
+  }
+}
+
+inline PrefixCacheEvictionPolicy PrefixCacheEvictionPolicyFromString(const std::string& policy) {
+  if (policy == "lru") {
+    return PrefixCacheEvictionPolicy::kLRU;
+  } else if (policy == "lfu") {
+    return PrefixCacheEvictionPolicy::kLFU;
+  } else if (policy == "cost_aware") {
+    return PrefixCacheEvictionPolicy::kCostAware;
+  } else {
+    LOG(FATAL) << "Invalid prefix cache eviction policy string: " << policy;
+    throw;
+  }
+}
+
+inline std::string PreemptionModeToString(PreemptionMode preemption_mode) {
+  if (preemption_mode == PreemptionMode::kRecompute) {
+    return "recompute";
+  } else if (preemption_mode == PreemptionMode::kSwap) {
+    return "swap";
+  } else {
+    LOG(FATAL) << "Invalid preemption mode: " << static_cast<int>(preemption_mode);
+    throw;
+  }
+}
+
+inline PreemptionMode PreemptionModeFromString(const std::string& preemption_mode) {
+  if (preemption_mode == "recompute") {
+    return PreemptionMode::kRecompute;
+  } else if (preemption_mode == "swap") {
+    return PreemptionMode::kSwap;
+  } else {
+    LOG(FATAL) << "Invalid preemption mode string: " << preemption_mode;
+    throw;
+  }
+}
+
+inline std::string EngineRoleToString(EngineRole engine_role) {
+  if (engine_role == EngineRole::kMixed) {
+    return "mixed";
+  } else if (engine_role == EngineRole::kPrefill) {
+    return "prefill";
+  } else if (engine_role == EngineRole::kDecode) {
+    return "decode";
+  } else {
+    LOG(FATAL) << "Invalid engine role: " << static_cast<int>(engine_role);
+    throw;
+  }
+}
+
+inline EngineRole EngineRoleFromString(const std::string& engine_role) {
+  if (engine_role == "mixed") {
+    return EngineRole::kMixed;
+  } else if (engine_role == "prefill") {
+    return EngineRole::kPrefill;
+  } else if (engine_role == "decode") {
+    return EngineRole::kDecode;
+  } else {
+    LOG(FATAL) << "Invalid engine role string: " << engine_role;
+    throw;
+  }
+}
+
+inline std::string SchedulerModeToString(SchedulerMode scheduler_mode) {
+  if (scheduler_mode == SchedulerMode::kFCFS) {
+    return "fcfs";
+  } else if (scheduler_mode == SchedulerMode::kSLOAware) {
+    return "slo_aware";
+  } else if (scheduler_mode == SchedulerMode::kFairShare) {
+    return "fair_share";
+  } else {
+    LOG(FATAL) << "Invalid scheduler mode: " << static_cast<int>(scheduler_mode);
+    throw;
+  }
+}
+
+inline SchedulerMode SchedulerModeFromString(const std::string& scheduler_mode) {
+  if (scheduler_mode == "fcfs") {
+    return SchedulerMode::kFCFS;
+  } else if (scheduler_mode == "slo_aware") {
+    return SchedulerMode::kSLOAware;
+  } else if (scheduler_mode == "fair_share") {
+    return SchedulerMode::kFairShare;
+  } else {
+    LOG(FATAL) << "Invalid scheduler mode string: " << scheduler_mode;
+    throw;
+  }
+}
+
+inline std::string PrefillModeToString(PrefillMode prefill_mode) {
+  if (prefill_mode == PrefillMode::kChunked) {
+    return "chunked";
+  } else if (prefill_mode == PrefillMode::kHybrid) {
+    return "hybrid";
+  } else {
+    LOG(FATAL) << "Invalid prefill mode: " << static_cast<int>(prefill_mode);
+    throw;
+  }
+}
+
+inline PrefillMode PrefillModeFromString(const std::string& prefill_mode) {
+  if (prefill_mode == "chunked") {
+    return PrefillMode::kChunked;
+  } else if (prefill_mode == "hybrid") {
+    return PrefillMode::kHybrid;
+  } else {
+    LOG(FATAL) << "Invalid prefill mode string: " << prefill_mode;
+    throw;
+  }
+}
+
+inline std::string DevicePowerStateToString(DevicePowerState device_power_state) {
+  if (device_power_state == DevicePowerState::kNominal) {
+    return "nominal";
+  } else if (device_power_state == DevicePowerState::kFair) {
+    return "fair";
+  } else if (device_power_state == DevicePowerState::kSerious) {
+    return "serious";
+  } else if (device_power_state == DevicePowerState::kCritical) {
+    return "critical";
+  } else {
+    LOG(FATAL) << "Invalid device power state: " << static_cast<int>(device_power_state);
+    throw;
+  }
+}
+
+inline DevicePowerState DevicePowerStateFromString(const std::string& device_power_state) {
+  if (device_power_state == "nominal") {
+    return DevicePowerState::kNominal;
+  } else if (device_power_state == "fair") {
+    return DevicePowerState::kFair;
+  } else if (device_power_state == "serious") {
+    return DevicePowerState::kSerious;
+  } else if (device_power_state == "critical") {
+    return DevicePowerState::kCritical;
+  } else {
+    LOG(FATAL) << "Invalid device power state string: " << device_power_state;
+    throw;
+  }
+}
+
 inline std::string SpeculativeModeToString(SpeculativeMode speculative_mode) {
   if (speculative_mode == SpeculativeMode::kDisable) {
     return "disable";
@@ -312,6 +1050,10 @@ inline std::string SpeculativeModeToString(SpeculativeMode speculative_mode) {
     return "eagle";
   } else if (speculative_mode == SpeculativeMode::kMedusa) {
     return "medusa";
+  } else if (speculative_mode == SpeculativeMode::kNGram) {
+    return "ngram";
+  } else if (speculative_mode == SpeculativeMode::kLayerSkip) {
+    return "layer_skip";
   } else {
     LOG(FATAL) << "Invalid speculative mode: " << static_cast<int>(speculative_mode);
   }
@@ -326,6 +1068,10 @@ inline SpeculativeMode SpeculativeModeFromString(const std::string& speculative_
     return SpeculativeMode::kEagle;
   } else if (speculative_mode == "medusa") {
     return SpeculativeMode::kMedusa;
+  } else if (speculative_mode == "ngram") {
+    return SpeculativeMode::kNGram;
+  } else if (speculative_mode == "layer_skip") {
+    return SpeculativeMode::kLayerSkip;
   } else {
     LOG(FATAL) << "Invalid speculative mode string: " << speculative_mode;
     throw;
@@ -6,6 +6,8 @@
 
 #include <tvm/runtime/registry.h>
 
+#include <cstring>
+
 #include "model.h"
 
 namespace mlc {
@@ -48,6 +50,23 @@ TVM_REGISTER_GLOBAL("mlc.serve.TextDataGetTextString").set_body_typed([](TextDat
 
 TVM_REGISTER_OBJECT_TYPE(TokenDataNode);
 
+/*!
+ * \brief The token ids viewing into the memory of the source object, which is kept alive by the
+ * view. Like ShapeTupleObj::FromStd, it is a ShapeTupleObj to all the users of the token ids.
+ */
+class TokenIdsViewObj : public ShapeTupleObj {
+ public:
+  TokenIdsViewObj(const int64_t* data, uint64_t size, ObjectRef source)
+      : source_(std::move(source)) {
+    this->data = data;
+    this->size = size;
+  }
+
+ private:
+  /*! \brief The object owning the memory of the token ids. */
+  ObjectRef source_;
+};
+
 TokenData::TokenData(IntTuple token_ids) {
   ObjectPtr<TokenDataNode> n = make_object<TokenDataNode>();
   n->token_ids = std::move(token_ids);
@@ -60,6 +79,38 @@ TokenData::TokenData(std::vector<int32_t> token_ids) {
   data_ = std::move(n);
 }
 
+TokenData::TokenData(NDArray token_ids) {
+  CHECK_EQ(token_ids->ndim, 1) << "The token id array is expected to be 1-D.";
+  CHECK_EQ(token_ids->device.device_type, kDLCPU) << "The token id array is expected on CPU.";
+  CHECK(token_ids.IsContiguous()) << "The token id array is expected to be contiguous.";
+  ObjectPtr<TokenDataNode> n = make_object<TokenDataNode>();
+  int64_t num_tokens = token_ids->shape[0];
+  const char* data = static_cast<const char*>(token_ids->data) + token_ids->byte_offset;
+  if (token_ids.DataType() == DataType::Int(64)) {
+    const int64_t* p_token_ids = reinterpret_cast<const int64_t*>(data);
+    n->token_ids = IntTuple(make_object<TokenIdsViewObj>(p_token_ids, num_tokens, token_ids));
+  } else {
+    CHECK(token_ids.DataType() == DataType::Int(32))
+        << "The token id array is expected to be int32 or int64, but got "
+        << token_ids.DataType();
+    const int32_t* p_token_ids = reinterpret_cast<const int32_t*>(data);
+    n->token_ids = IntTuple(p_token_ids, p_token_ids + num_tokens);
+  }
+  data_ = std::move(n);
+}
+
+TokenData TokenData::Slice(int64_t begin, int64_t end) const {
+  const IntTuple& token_ids = get()->token_ids;
+  CHECK(0 <= begin && begin <= end && end <= static_cast<int64_t>(token_ids.size()))
+      << "The slice [" << begin << ", " << end << ") is out of the " << token_ids.size()
+      << " token ids.";
+  if (begin == 0 && end == static_cast<int64_t>(token_ids.size())) {
+    return *this;
+  }
+  return TokenData(
+      IntTuple(make_object<TokenIdsViewObj>(token_ids->data + begin, end - begin, token_ids)));
+}
+
 int TokenDataNode::GetLength() const { return token_ids.size(); }
 
 ObjectRef TokenDataNode::GetEmbedding(Model model, ObjectRef* dst, int offset) const {
@@ -75,6 +126,10 @@ TVM_REGISTER_GLOBAL("mlc.serve.TokenData").set_body([](TVMArgs args, TVMRetValue
   *rv = TokenData(std::move(token_ids));
 });
 
+TVM_REGISTER_GLOBAL("mlc.serve.TokenDataFromNDArray").set_body_typed([](NDArray token_ids) {
+  return TokenData(std::move(token_ids));
+});
+
 TVM_REGISTER_GLOBAL("mlc.serve.TokenDataGetTokenIds").set_body_typed([](TokenData data) {
   return data->token_ids;
 });
@@ -83,17 +138,68 @@ TVM_REGISTER_GLOBAL("mlc.serve.TokenDataGetTokenIds").set_body_typed([](TokenDat
 
 TVM_REGISTER_OBJECT_TYPE(ImageDataNode);
 
-ImageData::ImageData(NDArray image, int embed_size) {
+ImageData::ImageData(NDArray image, int embed_size, uint64_t content_hash) {
   ObjectPtr<ImageDataNode> n = make_object<ImageDataNode>();
+  if (content_hash == 0 && image->device.device_type == kDLCPU && image.IsContiguous()) {
+    content_hash = HashContent(static_cast<const char*>(image->data) + image->byte_offset,
+                               GetDataSize(*image.operator->()));
+  }
   n->image = std::move(image);
   n->embed_size = embed_size;
+  n->content_hash = content_hash;
   data_ = std::move(n);
 }
 
+uint64_t ImageData::HashContent(const void* data, size_t num_bytes, uint64_t seed) {
+  // FNV-1a over 8-byte words, with the trailing bytes hashed one by one.
+  constexpr uint64_t kPrime = 1099511628211ULL;
+  const char* bytes = static_cast<const char*>(data);
+  uint64_t hash = seed;
+  size_t i = 0;
+  for (; i + 8 <= num_bytes; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, 8);
+    hash = (hash ^ word) * kPrime;
+  }
+  for (; i < num_bytes; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(bytes[i])) * kPrime;
+  }
+  // Reserve 0 for the unknown hash.
+  return hash != 0 ? hash : 1;
+}
+
 int ImageDataNode::GetLength() const { return embed_size; }
 
 ObjectRef ImageDataNode::GetEmbedding(Model model, ObjectRef* dst, int offset) const {
-  return model->ImageEmbed(image, dst, offset);
+  int64_t num_images = image->shape[0];
+  if (num_images == 1 || model->SupportBatchedImageEmbed()) {
+    return model->ImageEmbed(image, dst, offset, content_hash);
+  }
+  // The model embeds one image per call. Embed the images one by one into the destination,
+  // which is allocated when this is the only input.
+  ObjectRef embeddings = dst != nullptr ? *dst : model->AllocEmbeddingTensor();
+  CHECK(embeddings.defined()) << "The model cannot embed multiple images in one input.";
+  ICHECK_EQ(embed_size % num_images, 0);
+  ShapeTuple image_shape{1, image->shape[1], image->shape[2], image->shape[3]};
+  int64_t image_bytes = GetDataSize(*image.operator->()) / num_images;
+  for (int64_t i = 0; i < num_images; ++i) {
+    NDArray single_image = image.CreateView(image_shape, image->dtype, i * image_bytes);
+    embeddings = model->ImageEmbed(single_image, &embeddings, offset + i * embed_size / num_images);
+  }
+  return embeddings;
+}
+
+std::vector<int64_t> ImageDataNode::GetPrefixCacheTokens() const {
+  ICHECK_NE(content_hash, 0);
+  std::vector<int64_t> tokens;
+  tokens.reserve(embed_size);
+  for (int i = 0; i < embed_size; ++i) {
+    // Mix the position into the hash, so that a match never skips positions of an image.
+    // The tokens are kept in the negative int32 range, as prefix cache stores int32 tokens.
+    uint64_t mixed = content_hash ^ (static_cast<uint64_t>(i) * 0x9e3779b97f4a7c15ULL);
+    tokens.push_back(-1 - static_cast<int64_t>(mixed >> 33));
+  }
+  return tokens;
 }
 
 TVM_REGISTER_GLOBAL("mlc.serve.ImageData").set_body_typed([](NDArray image, int embed_size) {
@@ -164,6 +270,32 @@ std::string SampleResult::GetLogProbJSON(const Tokenizer& tokenizer, bool logpro
   return os.str();
 }
 
+std::pair<NDArray, NDArray> PackLogProbArrays(const std::vector<SampleResult>& sample_results,
+                                              int top_logprobs) {
+  int64_t num_results = sample_results.size();
+  int64_t num_columns = 1 + top_logprobs;
+  NDArray token_ids = NDArray::Empty({num_results, num_columns}, DataType::Int(32), {kDLCPU, 0});
+  NDArray logprobs = NDArray::Empty({num_results, num_columns}, DataType::Float(32), {kDLCPU, 0});
+  int32_t* p_token_ids = static_cast<int32_t*>(token_ids->data);
+  float* p_logprobs = static_cast<float*>(logprobs->data);
+  auto f_put = [&p_token_ids, &p_logprobs](const TokenProbPair& token_prob) {
+    *p_token_ids++ = token_prob.first;
+    *p_logprobs++ = std::log(std::max(token_prob.second, 1e-10f));
+  };
+  for (const SampleResult& result : sample_results) {
+    ICHECK_LE(static_cast<int>(result.top_prob_tokens.size()), top_logprobs);
+    f_put(result.sampled_token_id);
+    for (const TokenProbPair& token_prob : result.top_prob_tokens) {
+      f_put(token_prob);
+    }
+    // Pad the columns of the missing top tokens with token id -1.
+    for (int i = static_cast<int>(result.top_prob_tokens.size()); i < top_logprobs; ++i) {
+      f_put({-1, 0.0f});
+    }
+  }
+  return {token_ids, logprobs};
+}
+
 /****************** RequestStreamOutput ******************/
 
 TVM_REGISTER_OBJECT_TYPE(RequestStreamOutputObj);
@@ -171,21 +303,35 @@ TVM_REGISTER_OBJECT_TYPE(RequestStreamOutputObj);
 RequestStreamOutput::RequestStreamOutput(
     String request_id, Array<IntTuple> group_delta_token_ids,
     Optional<Array<Array<String>>> group_delta_logprob_json_strs,
-    Array<Optional<String>> group_finish_reason) {
+    Array<Optional<String>> group_finish_reason, Optional<String> metrics_json_str,
+    Optional<Array<NDArray>> group_delta_logprob_token_ids,
+    Optional<Array<NDArray>> group_delta_logprobs, Optional<NDArray> prefill_only_output) {
   ObjectPtr<RequestStreamOutputObj> n = make_object<RequestStreamOutputObj>();
   n->request_id = std::move(request_id);
   n->group_delta_token_ids = std::move(group_delta_token_ids);
   n->group_delta_logprob_json_strs = std::move(group_delta_logprob_json_strs);
   n->group_finish_reason = std::move(group_finish_reason);
+  n->metrics_json_str = std::move(metrics_json_str);
+  n->group_delta_logprob_token_ids = std::move(group_delta_logprob_token_ids);
+  n->group_delta_logprobs = std::move(group_delta_logprobs);
+  n->prefill_only_output = std::move(prefill_only_output);
   data_ = std::move(n);
 }
 
 TVM_REGISTER_GLOBAL("mlc.serve.RequestStreamOutputUnpack")
     .set_body_typed([](RequestStreamOutput output) {
-      return Array<ObjectRef>{output->request_id, output->group_delta_token_ids,
-                              output->group_delta_logprob_json_strs, output->group_finish_reason};
+      return Array<ObjectRef>{output->request_id,
+                              output->group_delta_token_ids,
+                              output->group_delta_logprob_json_strs,
+                              output->group_finish_reason,
+                              output->group_delta_logprob_token_ids,
+                              output->group_delta_logprobs,
+                              output->prefill_only_output};
     });
 
+TVM_REGISTER_GLOBAL("mlc.serve.RequestStreamOutputGetMetrics")
+    .set_body_typed([](RequestStreamOutput output) { return output->metrics_json_str; });
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
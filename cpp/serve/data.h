@@ -11,6 +11,10 @@
 #include <tvm/runtime/ndarray.h>
 #include <tvm/runtime/object.h>
 
+#include <cstdint>
+#include <utility>
+#include <vector>
+
 #include "../tokenizers.h"
 
 namespace mlc {
@@ -81,7 +85,10 @@ class TextData : public Data {
 /*! \brief The class of token data, containing a list of token ids. */
 class TokenDataNode : public DataNode {
  public:
-  /*! \brief The token ids. */
+  /*!
+   * \brief The token ids. They may view into the memory of an NDArray or of another token data,
+   * which the token ids keep alive. See TokenData::Slice.
+   */
   IntTuple token_ids;
 
   int GetLength() const final;
@@ -97,28 +104,61 @@ class TokenData : public Data {
 
   explicit TokenData(std::vector<int32_t> token_ids);
 
+  /*!
+   * \brief Create the token data from a 1-D contiguous NDArray on CPU, e.g. a view of a numpy
+   * array or of a shared memory buffer. The token ids of an int64 array view into the array
+   * without copying, and the token ids of an int32 array are widened in one pass.
+   */
+  explicit TokenData(NDArray token_ids);
+
+  /*! \brief Get the token data of the token ids in [begin, end), viewing into this data. */
+  TokenData Slice(int64_t begin, int64_t end) const;
+
   TVM_DEFINE_OBJECT_REF_METHODS(TokenData, Data, TokenDataNode);
 };
 
 /****************** ImageDataNode ******************/
 
-/*! \brief The class of image data, containing a 3D array of pixel values. */
+/*!
+ * \brief The class of image data, containing the pixel values of one or more consecutive
+ * images, which are embedded in one ImageEmbed call when the model supports it.
+ */
 class ImageDataNode : public DataNode {
  public:
-  /*! \brief The pixel values. */
+  /*! \brief The pixel values, of shape (num_images, 3, height, width). */
   NDArray image;
+  /*! \brief The total embedding length of the images. */
   int embed_size;
+  /*!
+   * \brief The hash of the image content, or 0 if unknown. The image data of the same hash
+   * share the cached embeddings on device and the KV data in prefix cache.
+   */
+  uint64_t content_hash = 0;
 
   int GetLength() const final;
   ObjectRef GetEmbedding(Model model, ObjectRef* dst = nullptr, int offset = 0) const final;
 
+  /*!
+   * \brief Get the tokens that stand for the image positions in prefix cache. They are
+   * negative, so that they never collide with token ids. Requires a known content hash.
+   */
+  std::vector<int64_t> GetPrefixCacheTokens() const;
+
   static constexpr const char* _type_key = "mlc.serve.ImageData";
   TVM_DECLARE_BASE_OBJECT_INFO(ImageDataNode, DataNode);
 };
 
 class ImageData : public Data {
  public:
-  explicit ImageData(NDArray image, int embed_size);
+  /*!
+   * \brief Create the image data. The content hash is computed from the pixel values when
+   * it is not given and the image is on CPU.
+   */
+  explicit ImageData(NDArray image, int embed_size, uint64_t content_hash = 0);
+
+  /*! \brief Hash the content bytes, chaining from the hash of the preceding content. */
+  static uint64_t HashContent(const void* data, size_t num_bytes,
+                              uint64_t seed = 14695981039346656037ULL);
 
   TVM_DEFINE_OBJECT_REF_METHODS(ImageData, Data, ImageDataNode);
 };
@@ -148,6 +188,17 @@ struct SampleResult {
   std::string GetLogProbJSON(const Tokenizer& tokenizer, bool logprob) const;
 };
 
+/*!
+ * \brief Pack the logprobs of the given sample results into a token id array (int32) and a
+ * logprob array (float32) on CPU, both in shape (num_results, 1 + top_logprobs). The first
+ * column is the sampled token, and the other columns are the tokens with top probabilities.
+ * \param sample_results The sample results to pack.
+ * \param top_logprobs The number of tokens with top probabilities of each result.
+ * \return The token id array and the logprob array.
+ */
+std::pair<NDArray, NDArray> PackLogProbArrays(const std::vector<SampleResult>& sample_results,
+                                              int top_logprobs);
+
 /****************** RequestStreamOutput ******************/
 
 /*!
@@ -165,11 +216,28 @@ class RequestStreamOutputObj : public Object {
   Array<IntTuple> group_delta_token_ids;
   /*! \brief The logprobs JSON strings of the new generated tokens since last invocation. */
   Optional<Array<Array<String>>> group_delta_logprob_json_strs;
+  /*!
+   * \brief The token id arrays and the logprob arrays (see `PackLogProbArrays`) of the new
+   * generated tokens since last invocation, which are defined in place of the logprob JSON
+   * strings when the logprob format of the request is "array".
+   */
+  Optional<Array<NDArray>> group_delta_logprob_token_ids;
+  Optional<Array<NDArray>> group_delta_logprobs;
+  /*!
+   * \brief The output of the prefill-only request on CPU (see `prefill_only_output` in
+   * GenerationConfig), which is only defined in the final output of the request.
+   */
+  Optional<NDArray> prefill_only_output;
   /*!
    * \brief The finish reason of the request when it is finished,
    * of None if the request has not finished yet.
    */
   Array<Optional<String>> group_finish_reason;
+  /*!
+   * \brief The timing metrics JSON string of the request (see RequestMetrics), which is only
+   * defined in the final output of a finished request.
+   */
+  Optional<String> metrics_json_str;
 
   static constexpr const char* _type_key = "mlc.serve.RequestStreamOutput";
   static constexpr const bool _type_has_method_sequal_reduce = false;
@@ -185,7 +253,11 @@ class RequestStreamOutput : public ObjectRef {
  public:
   explicit RequestStreamOutput(String request_id, Array<IntTuple> group_delta_token_ids,
                                Optional<Array<Array<String>>> group_delta_logprob_json_strs,
-                               Array<Optional<String>> finish_reason);
+                               Array<Optional<String>> finish_reason,
+                               Optional<String> metrics_json_str = NullOpt,
+                               Optional<Array<NDArray>> group_delta_logprob_token_ids = NullOpt,
+                               Optional<Array<NDArray>> group_delta_logprobs = NullOpt,
+                               Optional<NDArray> prefill_only_output = NullOpt);
 
   TVM_DEFINE_OBJECT_REF_METHODS(RequestStreamOutput, ObjectRef, RequestStreamOutputObj);
 };
@@ -0,0 +1,629 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/data_parallel_engine.cc
+ * \brief The implementation for the data-parallel threaded engine in MLC LLM, which routes
+ * requests to multiple engine replicas.
+ */
+#include <tvm/runtime/module.h>
+#include <tvm/runtime/packed_func.h>
+#include <tvm/runtime/registry.h>
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../support/json_parser.h"
+#include "data.h"
+#include "request.h"
+#include "threaded_engine.h"
+#include "traffic_capture.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using tvm::Device;
+using namespace tvm::runtime;
+
+/*! \brief The number of leading tokens whose hash decides the prefix cache affinity. */
+constexpr int kAffinityPrefixLength = 256;
+/*! \brief The shortest leading input, in tokens, for which the prefix cache affinity applies. */
+constexpr int kMinAffinityPrefixLength = 32;
+/*! \brief The estimated number of bytes per token, for the inputs that are not tokenized. */
+constexpr int kEstimatedBytesPerToken = 4;
+/*! \brief The maximum number of leading inputs whose replicas are remembered. */
+constexpr int kMaxNumAffinityEntries = 65536;
+/*!
+ * \brief The minimum number of tokens by which a peer replica must hold a longer cached prefix
+ * than the routed replica for the routed replica to pull the prefix KV data from the peer.
+ * Copying a shorter prefix between devices saves little over prefilling it.
+ */
+constexpr size_t kMinPullPrefixLength = 256;
+
+/*! \brief The implementation of the data-parallel ThreadedEngine. */
+class DataParallelThreadedEngineImpl : public ThreadedEngine {
+ public:
+  explicit DataParallelThreadedEngineImpl(int num_replicas, int num_devices_per_replica)
+      : num_devices_per_replica_(num_devices_per_replica), num_queued_pages_(num_replicas, 0) {
+    CHECK_GT(num_replicas, 0) << "The number of engine replicas should be positive.";
+    CHECK_GT(num_devices_per_replica, 0) << "The number of devices per replica should be positive.";
+    replicas_.reserve(num_replicas);
+    for (int i = 0; i < num_replicas; ++i) {
+      replicas_.push_back(ThreadedEngine::Create());
+    }
+  }
+
+  void InitThreadedEngine(Device device, Optional<PackedFunc> request_stream_callback,
+                          Optional<EventTraceRecorder> trace_recorder) final {
+    CHECK(request_stream_callback.defined())
+        << "ThreadedEngine requires request stream callback function, but it is not given.";
+    request_stream_callback_ = request_stream_callback.value();
+    replica_devices_.clear();
+    for (int i = 0; i < static_cast<int>(replicas_.size()); ++i) {
+      Device replica_device{device.device_type, device.device_id + i * num_devices_per_replica_};
+      replica_devices_.push_back(replica_device);
+      // Track the progress of requests, and serialize the callback across the replicas.
+      PackedFunc replica_callback([this, i](TVMArgs args, TVMRetValue* ret) {
+        ICHECK_EQ(args.size(), 1);
+        Array<RequestStreamOutput> delta_outputs = args[0];
+        UpdateRequestRecords(i, delta_outputs);
+        std::lock_guard<std::mutex> lock(request_stream_callback_mutex_);
+        request_stream_callback_(std::move(delta_outputs));
+      });
+      replicas_[i]->InitThreadedEngine(replica_device, replica_callback, trace_recorder);
+    }
+  }
+
+  void Reload(String engine_config_json_str) final {
+    picojson::object config = json::ParseToJSONObject(engine_config_json_str);
+    std::string snapshot_path =
+        json::LookupOrDefault<std::string>(config, "prefix_cache_snapshot_path", "");
+    std::string capture_path =
+        json::LookupOrDefault<std::string>(config, "traffic_capture_path", "");
+    std::vector<std::string> replica_config_json_strs;
+    for (int i = 0; i < static_cast<int>(replicas_.size()); ++i) {
+      picojson::object replica_config = config;
+      if (!snapshot_path.empty() && replicas_.size() > 1) {
+        // Each replica persists its own prefix cache.
+        replica_config["prefix_cache_snapshot_path"] =
+            picojson::value(snapshot_path + ".replica" + std::to_string(i));
+      }
+      if (!capture_path.empty() && replicas_.size() > 1) {
+        // Each replica captures the requests routed to it.
+        replica_config["traffic_capture_path"] =
+            picojson::value(capture_path + ".replica" + std::to_string(i));
+      }
+      replica_config_json_strs.push_back(picojson::value(replica_config).serialize());
+    }
+    RunOnReplicas([&](int i) { replicas_[i]->Reload(replica_config_json_strs[i]); });
+
+    picojson::object complete_config =
+        json::ParseToJSONObject(replicas_[0]->GetCompleteEngineConfigJSONString());
+    std::lock_guard<std::mutex> lock(route_mutex_);
+    kv_cache_page_size_ = json::Lookup<int64_t>(complete_config, "kv_cache_page_size");
+    ClearRouteStates();
+  }
+
+  void Unload() final {
+    RunOnReplicas([&](int i) { replicas_[i]->Unload(); });
+    std::lock_guard<std::mutex> lock(route_mutex_);
+    ClearRouteStates();
+  }
+
+  /*! \brief Reconfigure all the replicas with the same KV cache capacities. */
+  String Reconfigure(String reconfig_json_str) final {
+    std::vector<String> complete_config_json_strs(replicas_.size());
+    RunOnReplicas([&](int i) {
+      complete_config_json_strs[i] = replicas_[i]->Reconfigure(reconfig_json_str);
+    });
+    return complete_config_json_strs[0];
+  }
+
+  void Reset() final {
+    for (const auto& replica : replicas_) {
+      replica->Reset();
+    }
+  }
+
+  void RunBackgroundLoop() final {
+    RunOnReplicas([&](int i) { replicas_[i]->RunBackgroundLoop(); });
+  }
+
+  void RunBackgroundStreamBackLoop() final {
+    RunOnReplicas([&](int i) { replicas_[i]->RunBackgroundStreamBackLoop(); });
+  }
+
+  void ExitBackgroundLoop() final {
+    for (const auto& replica : replicas_) {
+      replica->ExitBackgroundLoop();
+    }
+  }
+
+  void AddRequest(Request request) final {
+    int replica_id = -1;
+    int pull_replica_id = -1;
+    std::vector<int64_t> pull_prefix;
+    {
+      std::lock_guard<std::mutex> lock(route_mutex_);
+      replica_id = Route(request, &pull_replica_id, &pull_prefix);
+      if (pull_replica_id != -1) {
+        request_records_.at(request->id).pulling_prefix = true;
+      }
+    }
+    if (pull_replica_id == -1) {
+      replicas_[replica_id]->AddRequest(std::move(request));
+      return;
+    }
+    // Pull the prefix KV data from the peer replica into the routed replica, and add the
+    // request after the import, so that the request finds the prefix in prefix cache. The
+    // request is added as is when the peer no longer holds the prefix.
+    num_prefix_kv_pulls_.fetch_add(1, std::memory_order_relaxed);
+    ThreadedEngine* replica = replicas_[replica_id].get();
+    replicas_[pull_replica_id]->ExportPrefixKV(
+        IntTuple(std::move(pull_prefix)), replica_devices_[replica_id],
+        [this, replica, request](Optional<PrefixKVHandoff> handoff) {
+          if (handoff.defined()) {
+            replica->ImportPrefixKV(handoff.value());
+          }
+          bool aborted = false;
+          {
+            std::lock_guard<std::mutex> lock(route_mutex_);
+            auto it = request_records_.find(request->id);
+            if (it != request_records_.end()) {
+              it->second.pulling_prefix = false;
+              aborted = it->second.aborted;
+            }
+          }
+          replica->AddRequest(request);
+          // Forward the abort that arrived during the pull after the request.
+          if (aborted) {
+            replica->AbortRequest(request->id);
+          }
+        });
+  }
+
+  void AbortRequest(const String& request_id) final {
+    int replica_id = -1;
+    {
+      std::lock_guard<std::mutex> lock(route_mutex_);
+      auto it = request_records_.find(request_id);
+      if (it == request_records_.end()) {
+        // The request has finished or does not exist.
+        return;
+      }
+      if (it->second.pulling_prefix) {
+        // The request is not added to the replica yet.
+        it->second.aborted = true;
+        return;
+      }
+      replica_id = it->second.replica_id;
+    }
+    replicas_[replica_id]->AbortRequest(request_id);
+  }
+
+  /*! \brief Export the prefix from the replica holding the longest cached prefix. */
+  void ExportPrefixKV(IntTuple tokens, Device device,
+                      std::function<void(Optional<PrefixKVHandoff>)> callback) final {
+    std::vector<size_t> matched_lengths = MatchPrefixLengths(
+        std::vector<int64_t>(tokens.begin(), tokens.end()));
+    int replica_id = std::max_element(matched_lengths.begin(), matched_lengths.end()) -
+                     matched_lengths.begin();
+    replicas_[replica_id]->ExportPrefixKV(std::move(tokens), device, std::move(callback));
+  }
+
+  /*! \brief Import the prefix into the replica with the most available KV cache pages. */
+  void ImportPrefixKV(PrefixKVHandoff handoff) final {
+    int replica_id = 0;
+    for (int i = 1; i < static_cast<int>(replicas_.size()); ++i) {
+      if (replicas_[i]->GetNumAvailablePages() > replicas_[replica_id]->GetNumAvailablePages()) {
+        replica_id = i;
+      }
+    }
+    replicas_[replica_id]->ImportPrefixKV(std::move(handoff));
+  }
+
+  /************** Query/Profile/Debug **************/
+
+  String GetDefaultGenerationConfigJSONString() const final {
+    return replicas_[0]->GetDefaultGenerationConfigJSONString();
+  }
+
+  String GetCompleteEngineConfigJSONString() const final {
+    return replicas_[0]->GetCompleteEngineConfigJSONString();
+  }
+
+  /*!
+   * \brief Return the statistics summed over the replicas, where the latencies and the draft
+   * workspace fragmentation are averaged instead, together with the statistics of each replica
+   * under "replicas".
+   */
+  String Stats() final {
+    picojson::object stats;
+    picojson::array replica_stats;
+    int num_replicas = replicas_.size();
+    for (int i = 0; i < num_replicas; ++i) {
+      picojson::object replica_stat = json::ParseToJSONObject(replicas_[i]->Stats());
+      for (const auto& [key, value] : replica_stat) {
+        bool is_average = key.find("latency") != std::string::npos ||
+                          key.find("fragmentation") != std::string::npos;
+        if (i == 0) {
+          stats[key] = value;
+        } else if (value.is<int64_t>()) {
+          stats[key] = picojson::value(stats[key].get<int64_t>() + value.get<int64_t>());
+        } else if (value.is<double>()) {
+          stats[key] = picojson::value(stats[key].get<double>() + value.get<double>());
+        } else if (value.is<picojson::array>()) {
+          // Sum the counts elementwise.
+          picojson::array& sum = stats[key].get<picojson::array>();
+          const picojson::array& counts = value.get<picojson::array>();
+          sum.resize(std::max(sum.size(), counts.size()), picojson::value(int64_t(0)));
+          for (int j = 0; j < static_cast<int>(counts.size()); ++j) {
+            sum[j] = picojson::value(sum[j].get<int64_t>() + counts[j].get<int64_t>());
+          }
+        }
+        if (is_average && i == num_replicas - 1 && stats[key].is<double>()) {
+          stats[key] = picojson::value(stats[key].get<double>() / num_replicas);
+        }
+      }
+      replica_stats.push_back(picojson::value(std::move(replica_stat)));
+    }
+    stats["replicas"] = picojson::value(std::move(replica_stats));
+    stats["num_prefix_kv_pulls"] =
+        picojson::value(num_prefix_kv_pulls_.load(std::memory_order_relaxed));
+    return picojson::value(stats).serialize(true);
+  }
+
+  int64_t GetNumAvailablePages() const final {
+    int64_t num_available_pages = 0;
+    for (const auto& replica : replicas_) {
+      int64_t replica_num_available_pages = replica->GetNumAvailablePages();
+      if (replica_num_available_pages == -1) {
+        return -1;
+      }
+      num_available_pages += replica_num_available_pages;
+    }
+    return num_available_pages;
+  }
+
+  /*! \brief Return nullptr, since each replica has its own prefix cache. */
+  std::shared_ptr<const PrefixMatchIndex> GetPrefixMatchIndex() const final { return nullptr; }
+
+  /*! \brief Return the metrics registries of all the replicas, labeled by the replica id. */
+  std::vector<std::pair<std::string, MetricsRegistry>> GetMetricsRegistries() const final {
+    std::vector<std::pair<std::string, MetricsRegistry>> registries;
+    for (int i = 0; i < static_cast<int>(replicas_.size()); ++i) {
+      std::string replica_label = "replica=\"" + std::to_string(i) + "\"";
+      for (const auto& [labels, registry] : replicas_[i]->GetMetricsRegistries()) {
+        registries.emplace_back(labels.empty() ? replica_label : replica_label + "," + labels,
+                                registry);
+      }
+    }
+    return registries;
+  }
+
+  String GetMetricsText() const final {
+    return MetricsRegistry::RenderOpenMetrics(GetMetricsRegistries());
+  }
+
+  void DebugCallFuncOnAllAllWorker(const String& func_name) final {
+    for (const auto& replica : replicas_) {
+      replica->DebugCallFuncOnAllAllWorker(func_name);
+    }
+  }
+
+ private:
+  /*! \brief The routing record of a request that has not finished. */
+  struct RequestRecord {
+    /*! \brief The replica that the request is routed to. */
+    int replica_id;
+    /*! \brief The estimated number of KV cache pages of the request input. */
+    int64_t num_input_pages;
+    /*! \brief Whether the replica has returned outputs of the request, i.e., prefilled it. */
+    bool started = false;
+    /*! \brief Whether each generation of the request has finished. */
+    std::vector<bool> finished;
+    /*! \brief The number of unfinished generations. */
+    int num_unfinished;
+    /*! \brief Whether the prefix of the request is being pulled before the request is added. */
+    bool pulling_prefix = false;
+    /*! \brief Whether the request is aborted while its prefix is being pulled. */
+    bool aborted = false;
+  };
+
+  /*! \brief Run the function on each replica in parallel, and wait for all of them. */
+  template <typename FRun>
+  void RunOnReplicas(const FRun& f_run) {
+    std::vector<std::thread> threads;
+    threads.reserve(replicas_.size() - 1);
+    for (int i = 1; i < static_cast<int>(replicas_.size()); ++i) {
+      threads.emplace_back([&f_run, i]() { f_run(i); });
+    }
+    f_run(0);
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+  /*!
+   * \brief Choose the replica for the request and record the routing. A tokenized request goes
+   * to the replica whose prefix cache holds the longest prefix of the request when it has room
+   * for the request. Other requests go to the replica that served the same leading input when
+   * it has room, for prefix cache hits. Otherwise the request goes to the replica with the most
+   * available KV cache pages, less the pages of the requests routed to the replica but not
+   * prefilled yet. When a peer replica holds a much longer prefix than the chosen replica, the
+   * chosen replica pulls the prefix KV data from the peer instead of recomputing it.
+   * \param pull_replica_id The peer replica to pull the prefix from, or -1, as the output.
+   * \param pull_prefix The prefix to pull, as the output.
+   * \note The function is called with `route_mutex_` held.
+   */
+  int Route(const Request& request, int* pull_replica_id, std::vector<int64_t>* pull_prefix) {
+    int num_replicas = replicas_.size();
+    int64_t num_input_pages =
+        (EstimateInputLength(request) + kv_cache_page_size_ - 1) / kv_cache_page_size_;
+    std::vector<int64_t> num_free_pages(num_replicas);
+    for (int i = 0; i < num_replicas; ++i) {
+      num_free_pages[i] = replicas_[i]->GetNumAvailablePages() - num_queued_pages_[i];
+    }
+    int replica_id = std::max_element(num_free_pages.begin(), num_free_pages.end()) -
+                     num_free_pages.begin();
+
+    std::optional<std::string> prefix_key = GetAffinityPrefixKey(request);
+    if (prefix_key.has_value()) {
+      auto it = affinity_index_.find(prefix_key.value());
+      if (it != affinity_index_.end()) {
+        int affinity_replica_id = it->second->second;
+        if (num_free_pages[affinity_replica_id] >= num_input_pages) {
+          replica_id = affinity_replica_id;
+        }
+        affinity_lru_.erase(it->second);
+        affinity_index_.erase(it);
+      }
+    }
+
+    // The prefix cache contents of the replicas decide over the leading input affinity.
+    *pull_replica_id = -1;
+    std::vector<int64_t> leading_tokens = GetLeadingTokens(request);
+    if (static_cast<int>(leading_tokens.size()) >= kMinAffinityPrefixLength) {
+      std::vector<size_t> matched_lengths = MatchPrefixLengths(leading_tokens);
+      int matched_replica_id = std::max_element(matched_lengths.begin(), matched_lengths.end()) -
+                               matched_lengths.begin();
+      size_t matched_length = matched_lengths[matched_replica_id];
+      if (matched_length > matched_lengths[replica_id] &&
+          num_free_pages[matched_replica_id] >= num_input_pages) {
+        replica_id = matched_replica_id;
+      } else if (matched_length >= matched_lengths[replica_id] + kMinPullPrefixLength &&
+                 num_devices_per_replica_ == 1) {
+        // The KV data of tensor parallel replicas cannot be exported.
+        *pull_replica_id = matched_replica_id;
+        leading_tokens.resize(matched_length);
+        *pull_prefix = std::move(leading_tokens);
+      }
+    }
+
+    if (prefix_key.has_value()) {
+      affinity_lru_.emplace_front(std::move(prefix_key.value()), replica_id);
+      affinity_index_.emplace(affinity_lru_.front().first, affinity_lru_.begin());
+      if (static_cast<int>(affinity_lru_.size()) > kMaxNumAffinityEntries) {
+        affinity_index_.erase(affinity_lru_.back().first);
+        affinity_lru_.pop_back();
+      }
+    }
+
+    int n = request->generation_cfg->n;
+    request_records_[request->id] =
+        RequestRecord{replica_id, num_input_pages, false, std::vector<bool>(n, false), n};
+    num_queued_pages_[replica_id] += num_input_pages;
+    return replica_id;
+  }
+
+  /*!
+   * \brief Get the length of the longest cached prefix of the tokens in each replica, from
+   * the prefix cache indices of the replicas without waiting for their steps.
+   */
+  std::vector<size_t> MatchPrefixLengths(const std::vector<int64_t>& tokens) const {
+    std::vector<size_t> matched_lengths(replicas_.size(), 0);
+    for (int i = 0; i < static_cast<int>(replicas_.size()); ++i) {
+      if (std::shared_ptr<const PrefixMatchIndex> match_index =
+              replicas_[i]->GetPrefixMatchIndex()) {
+        matched_lengths[i] = match_index->MatchPrefixLength(tokens.data(), tokens.size());
+      }
+    }
+    return matched_lengths;
+  }
+
+  /*! \brief Update the records of the requests with the delta outputs of the replica. */
+  void UpdateRequestRecords(int replica_id, const Array<RequestStreamOutput>& delta_outputs) {
+    std::lock_guard<std::mutex> lock(route_mutex_);
+    for (const RequestStreamOutput& delta_output : delta_outputs) {
+      auto it = request_records_.find(delta_output->request_id);
+      if (it == request_records_.end() || it->second.replica_id != replica_id) {
+        continue;
+      }
+      RequestRecord& record = it->second;
+      if (!record.started) {
+        record.started = true;
+        num_queued_pages_[replica_id] -= record.num_input_pages;
+      }
+      for (int i = 0; i < static_cast<int>(delta_output->group_finish_reason.size()); ++i) {
+        if (delta_output->group_finish_reason[i].defined() && !record.finished[i]) {
+          record.finished[i] = true;
+          --record.num_unfinished;
+        }
+      }
+      if (record.num_unfinished == 0) {
+        request_records_.erase(it);
+      }
+    }
+  }
+
+  /*! \brief Clear the routing states, as the replicas are reloaded or unloaded. */
+  void ClearRouteStates() {
+    request_records_.clear();
+    std::fill(num_queued_pages_.begin(), num_queued_pages_.end(), 0);
+    affinity_lru_.clear();
+    affinity_index_.clear();
+  }
+
+  /*!
+   * \brief Get the tokens of the leading token inputs of the request, which prefix cache can
+   * match before the request is added. The last input token is left out, since it is always
+   * prefilled.
+   */
+  static std::vector<int64_t> GetLeadingTokens(const Request& request) {
+    std::vector<int64_t> tokens;
+    bool all_tokens = true;
+    for (const Data& input : request->inputs) {
+      const auto* token_data = input.as<TokenDataNode>();
+      if (token_data == nullptr) {
+        all_tokens = false;
+        break;
+      }
+      tokens.insert(tokens.end(), token_data->token_ids.begin(), token_data->token_ids.end());
+    }
+    if (all_tokens && !tokens.empty()) {
+      tokens.pop_back();
+    }
+    return tokens;
+  }
+
+  /*! \brief Estimate the input length of the request in tokens. */
+  static int64_t EstimateInputLength(const Request& request) {
+    if (request->input_total_length != -1) {
+      return request->input_total_length;
+    }
+    int64_t length = 0;
+    for (const Data& input : request->inputs) {
+      if (const auto* text_data = input.as<TextDataNode>()) {
+        length += text_data->text.size() / kEstimatedBytesPerToken;
+      } else {
+        length += input->GetLength();
+      }
+    }
+    return length;
+  }
+
+  /*!
+   * \brief Get the key of the leading input of the request for the prefix cache affinity, which
+   * is made of the first tokens or text bytes up to the affinity prefix length.
+   * \return The key, or std::nullopt if the leading input is too short.
+   */
+  static std::optional<std::string> GetAffinityPrefixKey(const Request& request) {
+    std::string key;
+    int length = 0;
+    for (const Data& input : request->inputs) {
+      if (length >= kAffinityPrefixLength) {
+        break;
+      }
+      if (const auto* text_data = input.as<TextDataNode>()) {
+        int num_bytes = std::min<int64_t>(
+            text_data->text.size(), (kAffinityPrefixLength - length) * kEstimatedBytesPerToken);
+        key.push_back('t');
+        key.append(text_data->text.data(), num_bytes);
+        length += num_bytes / kEstimatedBytesPerToken;
+      } else if (const auto* token_data = input.as<TokenDataNode>()) {
+        int num_tokens =
+            std::min<int64_t>(token_data->token_ids.size(), kAffinityPrefixLength - length);
+        key.push_back('i');
+        key.append(reinterpret_cast<const char*>(token_data->token_ids->data),
+                   num_tokens * sizeof(int64_t));
+        length += num_tokens;
+      } else {
+        // Stop at the other inputs, e.g., images.
+        break;
+      }
+    }
+    if (length < kMinAffinityPrefixLength) {
+      return std::nullopt;
+    }
+    return key;
+  }
+
+  /*! \brief The engine replicas. */
+  std::vector<std::unique_ptr<ThreadedEngine>> replicas_;
+  /*! \brief The number of devices of each replica. */
+  int num_devices_per_replica_;
+  /*! \brief The first device of each replica. */
+  std::vector<Device> replica_devices_;
+  /*! \brief The number of prefixes pulled between the replicas. */
+  std::atomic<int64_t> num_prefix_kv_pulls_ = 0;
+  /*! \brief The request stream callback. */
+  PackedFunc request_stream_callback_;
+  /*! \brief The mutex serializing the request stream callback across replicas. */
+  std::mutex request_stream_callback_mutex_;
+
+  /************** Routing states, guarded by `route_mutex_` **************/
+  std::mutex route_mutex_;
+  /*! \brief The KV cache page size of the replicas. */
+  int64_t kv_cache_page_size_ = 16;
+  /*! \brief The routing records of the unfinished requests. */
+  std::unordered_map<String, RequestRecord> request_records_;
+  /*! \brief The KV cache pages of the requests routed to each replica but not prefilled yet. */
+  std::vector<int64_t> num_queued_pages_;
+  /*! \brief The leading input keys and their replicas, from the most recently used. */
+  std::list<std::pair<std::string, int>> affinity_lru_;
+  /*! \brief The position of each leading input key in `affinity_lru_`. */
+  std::unordered_map<std::string, std::list<std::pair<std::string, int>>::iterator>
+      affinity_index_;
+};
+
+/*! \brief The module of the data-parallel ThreadedEngine. */
+class DataParallelThreadedEngineModule : public DataParallelThreadedEngineImpl,
+                                         public ModuleNode {
+ public:
+  using DataParallelThreadedEngineImpl::DataParallelThreadedEngineImpl;
+
+  /*! \brief Replay a traffic capture through `AddRequest`. See ReplayTrafficCapture. */
+  int64_t ReplayTrafficCapture(const String& path, double time_scale) {
+    return serve::ReplayTrafficCapture(path, time_scale,
+                                       [this](Request request) { AddRequest(request); });
+  }
+
+  TVM_MODULE_VTABLE_BEGIN("mlc.serve.data_parallel_threaded_engine");
+  TVM_MODULE_VTABLE_ENTRY("init_threaded_engine",
+                          &DataParallelThreadedEngineImpl::InitThreadedEngine);
+  TVM_MODULE_VTABLE_ENTRY("reload", &DataParallelThreadedEngineImpl::Reload);
+  TVM_MODULE_VTABLE_ENTRY("reconfigure", &DataParallelThreadedEngineImpl::Reconfigure);
+  TVM_MODULE_VTABLE_ENTRY("add_request", &DataParallelThreadedEngineImpl::AddRequest);
+  TVM_MODULE_VTABLE_ENTRY("abort_request", &DataParallelThreadedEngineImpl::AbortRequest);
+  TVM_MODULE_VTABLE_ENTRY("run_background_loop",
+                          &DataParallelThreadedEngineImpl::RunBackgroundLoop);
+  TVM_MODULE_VTABLE_ENTRY("run_background_stream_back_loop",
+                          &DataParallelThreadedEngineImpl::RunBackgroundStreamBackLoop);
+  TVM_MODULE_VTABLE_ENTRY("exit_background_loop",
+                          &DataParallelThreadedEngineImpl::ExitBackgroundLoop);
+  TVM_MODULE_VTABLE_ENTRY("get_default_generation_config",
+                          &DataParallelThreadedEngineImpl::GetDefaultGenerationConfigJSONString);
+  TVM_MODULE_VTABLE_ENTRY("get_complete_engine_config",
+                          &DataParallelThreadedEngineImpl::GetCompleteEngineConfigJSONString);
+  TVM_MODULE_VTABLE_ENTRY("stats", &DataParallelThreadedEngineImpl::Stats);
+  TVM_MODULE_VTABLE_ENTRY("get_num_available_pages",
+                          &DataParallelThreadedEngineImpl::GetNumAvailablePages);
+  TVM_MODULE_VTABLE_ENTRY("get_metrics", &DataParallelThreadedEngineImpl::GetMetricsText);
+  TVM_MODULE_VTABLE_ENTRY("reset", &DataParallelThreadedEngineImpl::Reset);
+  TVM_MODULE_VTABLE_ENTRY("replay_traffic_capture",
+                          &DataParallelThreadedEngineModule::ReplayTrafficCapture);
+  TVM_MODULE_VTABLE_ENTRY("debug_call_func_on_all_worker",
+                          &DataParallelThreadedEngineImpl::DebugCallFuncOnAllAllWorker);
+  TVM_MODULE_VTABLE_END();
+};
+
+TVM_REGISTER_GLOBAL("mlc.serve.create_data_parallel_threaded_engine")
+    .set_body_typed([](int num_replicas, int num_devices_per_replica) {
+      return Module(
+          make_object<DataParallelThreadedEngineModule>(num_replicas, num_devices_per_replica));
+    });
+
+std::unique_ptr<ThreadedEngine> ThreadedEngine::CreateDataParallel(int num_replicas,
+                                                                   int num_devices_per_replica) {
+  return std::make_unique<DataParallelThreadedEngineImpl>(num_replicas, num_devices_per_replica);
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
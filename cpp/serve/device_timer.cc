@@ -0,0 +1,81 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/device_timer.cc
+ */
+#include "device_timer.h"
+
+#include <tvm/runtime/logging.h>
+
+#include <string>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+const char* StepPhaseToString(StepPhase phase) {
+  if (phase == StepPhase::kEmbed) {
+    return "embed";
+  } else if (phase == StepPhase::kForward) {
+    return "forward";
+  } else if (phase == StepPhase::kLogits) {
+    return "logits";
+  } else if (phase == StepPhase::kLogitProcess) {
+    return "logit_process";
+  } else if (phase == StepPhase::kSample) {
+    return "sample";
+  } else {
+    LOG(FATAL) << "Invalid step phase: " << static_cast<int>(phase);
+  }
+}
+
+/****************** DeviceStepTimer ******************/
+
+void DeviceStepTimer::StartPhase(StepPhase phase) {
+  if (depth_++ > 0) {
+    return;
+  }
+  records_.push_back(PhaseRecord{phase, Timer::Start(device_), EventTraceRecorderObj::NowNanos()});
+}
+
+void DeviceStepTimer::StopPhase() {
+  ICHECK_GT(depth_, 0);
+  if (--depth_ > 0) {
+    return;
+  }
+  records_.back().timer->Stop();
+}
+
+std::array<double, kNumStepPhases> DeviceStepTimer::Collect(
+    EventTraceRecorderObj* trace_recorder) {
+  ICHECK_EQ(depth_, 0) << "Cannot collect the device timers inside a step phase.";
+  std::array<double, kNumStepPhases> phase_times{};
+  for (const PhaseRecord& record : records_) {
+    int64_t elapsed_ns = record.timer->SyncAndGetElapsedNanos();
+    phase_times[static_cast<int>(record.phase)] += elapsed_ns / 1e9;
+    if (trace_recorder != nullptr) {
+      trace_recorder->AddSpan(std::string(StepPhaseToString(record.phase)) + " (device)",
+                              record.host_start_ns, record.host_start_ns + elapsed_ns);
+    }
+  }
+  records_.clear();
+  return phase_times;
+}
+
+/****************** DeviceTimerThreadScope ******************/
+
+thread_local DeviceStepTimer* current_thread_device_step_timer = nullptr;
+
+DeviceTimerThreadScope::DeviceTimerThreadScope(DeviceStepTimer* timer)
+    : prev_timer_(current_thread_device_step_timer) {
+  current_thread_device_step_timer = timer;
+}
+
+DeviceTimerThreadScope::~DeviceTimerThreadScope() {
+  current_thread_device_step_timer = prev_timer_;
+}
+
+DeviceStepTimer* DeviceTimerThreadScope::Current() { return current_thread_device_step_timer; }
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,118 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/device_timer.h
+ * \brief The device event timer of the phases of engine steps.
+ */
+#ifndef MLC_LLM_SERVE_DEVICE_TIMER_H_
+#define MLC_LLM_SERVE_DEVICE_TIMER_H_
+
+#include <tvm/runtime/profiling.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "event_trace_recorder.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*! \brief The phases of an engine step that are timed on the device. */
+enum class StepPhase : int {
+  kEmbed = 0,
+  kForward = 1,
+  kLogits = 2,
+  kLogitProcess = 3,
+  kSample = 4,
+};
+
+constexpr int kNumStepPhases = 5;
+
+/*! \brief Return the name of the step phase. */
+const char* StepPhaseToString(StepPhase phase);
+
+/*!
+ * \brief The timer that records device events around the phases of engine steps.
+ * The timers are started and stopped on the device stream without synchronization, and
+ * are only synchronized when the step collects them, so that the timing does not change
+ * the overlap of host and device work within the step.
+ */
+class DeviceStepTimer {
+ public:
+  explicit DeviceStepTimer(Device device) : device_(device) {}
+
+  /*! \brief Start timing the phase. The phases nested in a timed phase are not timed. */
+  void StartPhase(StepPhase phase);
+  /*! \brief Stop timing the phase started by the matching StartPhase. */
+  void StopPhase();
+
+  /*!
+   * \brief Synchronize the timers of the phases since the last collection and return the
+   * device time (sec) of each phase. The phases are also recorded as spans into the given
+   * trace recorder, starting at the host time when the phase started.
+   */
+  std::array<double, kNumStepPhases> Collect(EventTraceRecorderObj* trace_recorder);
+
+ private:
+  /*! \brief A timed phase. */
+  struct PhaseRecord {
+    StepPhase phase;
+    Timer timer;
+    int64_t host_start_ns;
+  };
+
+  Device device_;
+  std::vector<PhaseRecord> records_;
+  /*! \brief The nesting depth of the current phases. */
+  int depth_ = 0;
+};
+
+/*!
+ * \brief The scope in which the given device step timer is bound to the current thread, so
+ * that the StepPhaseScopes on the thread are timed by it. The timer can be nullptr.
+ */
+class DeviceTimerThreadScope {
+ public:
+  explicit DeviceTimerThreadScope(DeviceStepTimer* timer);
+  ~DeviceTimerThreadScope();
+
+  DeviceTimerThreadScope(const DeviceTimerThreadScope&) = delete;
+  DeviceTimerThreadScope& operator=(const DeviceTimerThreadScope&) = delete;
+
+  /*! \brief Return the device step timer bound to the current thread, or nullptr. */
+  static DeviceStepTimer* Current();
+
+ private:
+  DeviceStepTimer* prev_timer_;
+};
+
+/*! \brief The scope of a step phase, timed by the device step timer of the current thread. */
+class StepPhaseScope {
+ public:
+  explicit StepPhaseScope(StepPhase phase) : timer_(DeviceTimerThreadScope::Current()) {
+    if (timer_ != nullptr) {
+      timer_->StartPhase(phase);
+    }
+  }
+
+  ~StepPhaseScope() {
+    if (timer_ != nullptr) {
+      timer_->StopPhase();
+    }
+  }
+
+  StepPhaseScope(const StepPhaseScope&) = delete;
+  StepPhaseScope& operator=(const StepPhaseScope&) = delete;
+
+ private:
+  DeviceStepTimer* timer_;
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_DEVICE_TIMER_H_
@@ -5,48 +5,196 @@
 
 #include "draft_token_workspace_manager.h"
 
+#include <algorithm>
+
+#include "memory_accounting.h"
 #include "model.h"
 
 namespace mlc {
 namespace llm {
 namespace serve {
 
+/*! \brief The number of slabs that the maximum number of draft tokens is split into. */
+constexpr int kNumDraftTokenWorkspaceSlabs = 16;
+
 DraftTokenWorkspaceManagerObj::DraftTokenWorkspaceManagerObj(int max_num_tokens, int vocab_size,
                                                              int hidden_size,
                                                              DLDataType hidden_states_dtype,
-                                                             DLDevice device,
-                                                             const FunctionTable& ft)
+                                                             DLDevice device, FunctionTable& ft)
     : max_num_tokens_(max_num_tokens),
       vocab_size_(vocab_size),
       hidden_size_(hidden_size),
       hidden_states_dtype_(hidden_states_dtype),
       device_(device),
       ft_(ft) {
-  free_slots_.resize(max_num_tokens);
-  std::iota(free_slots_.begin(), free_slots_.end(), 0);
+  slab_size_ = (max_num_tokens + kNumDraftTokenWorkspaceSlabs - 1) / kNumDraftTokenWorkspaceSlabs;
+  slot_indices_host_ = NDArray::Empty({max_num_tokens}, DataType::Int(32), Device{kDLCPU, 0});
 }
 
 void DraftTokenWorkspaceManagerObj::AllocSlots(int num_slots, std::vector<int>* result) {
+  if (num_slots > static_cast<int>(free_slots_.size())) {
+    // Grow the storage by slabs, keeping the slots in use where they are.
+    int num_used_slots = capacity_ - free_slots_.size();
+    int capacity = (num_used_slots + num_slots + slab_size_ - 1) / slab_size_ * slab_size_;
+    capacity = std::min(capacity, max_num_tokens_);
+    ICHECK_LE(num_used_slots + num_slots, capacity)
+        << "The draft token workspace runs out of slots.";
+    std::vector<int> slots(capacity_);
+    std::iota(slots.begin(), slots.end(), 0);
+    int old_capacity = capacity_;
+    ResizeStorage(slots, capacity);
+    for (int slot = capacity - 1; slot >= old_capacity; --slot) {
+      free_slots_.push_back(slot);
+    }
+    ++stats_.num_grows;
+  }
   ICHECK_LE(num_slots, free_slots_.size());
   result->assign(free_slots_.rbegin(), free_slots_.rbegin() + num_slots);
-  std::vector<int> allocated(free_slots_.begin(), free_slots_.begin() + num_slots);
   free_slots_.resize(free_slots_.size() - num_slots);
+  stats_.peak_used_slots =
+      std::max(stats_.peak_used_slots, static_cast<int64_t>(capacity_ - free_slots_.size()));
 }
 
 void DraftTokenWorkspaceManagerObj::FreeSlots(const std::vector<int>& slots) {
   std::copy(slots.begin(), slots.end(), std::back_inserter(free_slots_));
 }
 
-void DraftTokenWorkspaceManagerObj::AllocWorkspace(ModelWorkspace* workspace,
-                                                   bool require_hidden_states) {
-  workspace->draft_probs =
-      NDArray::Empty({max_num_tokens_, vocab_size_}, DataType::Float(32), device_);
-  workspace->draft_probs_storage =
-      NDArray::Empty({max_num_tokens_, vocab_size_}, DataType::Float(32), device_);
-  if (require_hidden_states) {
-    workspace->draft_hidden_states_storage =
-        ft_.Empty({max_num_tokens_, hidden_size_}, hidden_states_dtype_, device_);
+std::vector<int> DraftTokenWorkspaceManagerObj::CompactSlots(const std::vector<int>& live_slots) {
+  std::vector<bool> is_live(capacity_, false);
+  for (int slot : live_slots) {
+    ICHECK(slot >= 0 && slot < capacity_ && !is_live[slot]) << "Invalid draft token slot " << slot;
+    is_live[slot] = true;
+  }
+  int num_live_slots = live_slots.size();
+  // Keep one slab of headroom, so that the storage does not shrink and grow back every step.
+  int capacity = (num_live_slots + 2 * slab_size_ - 1) / slab_size_ * slab_size_;
+  capacity = std::min(capacity, max_num_tokens_);
+  std::vector<int> new_slots;
+  if (capacity < capacity_) {
+    std::vector<int> slots;
+    slots.reserve(num_live_slots);
+    new_slots.assign(capacity_, -1);
+    for (int slot = 0; slot < capacity_; ++slot) {
+      if (is_live[slot]) {
+        new_slots[slot] = slots.size();
+        slots.push_back(slot);
+      }
+    }
+    ResizeStorage(slots, capacity);
+    is_live.assign(capacity_, false);
+    std::fill(is_live.begin(), is_live.begin() + num_live_slots, true);
+    ++stats_.num_compactions;
+  }
+  // Rebuild the free slots, which also reclaims the slots that are no longer held by any
+  // draft token.
+  free_slots_.clear();
+  for (int slot = capacity_ - 1; slot >= 0; --slot) {
+    if (!is_live[slot]) {
+      free_slots_.push_back(slot);
+    }
+  }
+  return new_slots;
+}
+
+NDArray DraftTokenWorkspaceManagerObj::GetDraftProbsBuffer(int num_rows) {
+  ICHECK_LE(num_rows, max_num_tokens_);
+  if (!draft_probs_buffer_.defined() || draft_probs_buffer_->shape[0] < num_rows) {
+    int num_buffer_rows = std::min((num_rows + slab_size_ - 1) / slab_size_ * slab_size_,
+                                   max_num_tokens_);
+    draft_probs_buffer_ =
+        NDArray::Empty({num_buffer_rows, vocab_size_}, DataType::Float(32), device_);
+  }
+  return draft_probs_buffer_;
+}
+
+NDArray DraftTokenWorkspaceManagerObj::CopyDraftProbsToDevice(const NDArray& draft_probs,
+                                                              DLDevice device) {
+  int64_t num_rows = draft_probs->shape[0];
+  ICHECK_LE(num_rows, max_num_tokens_);
+  if (!peer_draft_probs_buffer_.defined() || peer_draft_probs_buffer_->shape[0] < num_rows ||
+      peer_draft_probs_buffer_->device.device_type != device.device_type ||
+      peer_draft_probs_buffer_->device.device_id != device.device_id) {
+    int64_t num_buffer_rows = std::min<int64_t>(
+        (num_rows + slab_size_ - 1) / slab_size_ * slab_size_, max_num_tokens_);
+    peer_draft_probs_buffer_ =
+        NDArray::Empty({num_buffer_rows, vocab_size_}, DataType::Float(32), device);
+  }
+  NDArray dst = peer_draft_probs_buffer_.CreateView({num_rows, vocab_size_}, DataType::Float(32));
+  dst.CopyFrom(draft_probs);
+  // The copy runs on the stream of the draft device, which the kernels of the verify device
+  // do not wait for.
+  TVMSynchronize(draft_probs->device.device_type, draft_probs->device.device_id, nullptr);
+  return dst;
+}
+
+DraftTokenWorkspaceStats DraftTokenWorkspaceManagerObj::GetStats() const {
+  DraftTokenWorkspaceStats stats = stats_;
+  stats.capacity_slots = capacity_;
+  stats.used_slots = capacity_ - free_slots_.size();
+  // The free slots below the highest slot in use are holes.
+  std::vector<bool> is_free(capacity_, false);
+  for (int slot : free_slots_) {
+    is_free[slot] = true;
+  }
+  int end = capacity_;
+  while (end > 0 && is_free[end - 1]) {
+    --end;
+  }
+  int num_holes = std::count(is_free.begin(), is_free.begin() + end, true);
+  stats.fragmentation = end > 0 ? static_cast<double>(num_holes) / end : 0.0;
+  stats.device_bytes = GetNDArrayBytes(draft_probs_storage_) + GetNDArrayBytes(draft_probs_buffer_);
+  stats.peer_buffer_bytes = GetNDArrayBytes(peer_draft_probs_buffer_);
+  if (require_hidden_states_) {
+    stats.device_bytes +=
+        static_cast<int64_t>(capacity_) * hidden_size_ * hidden_states_dtype_.bytes();
+  }
+  return stats;
+}
+
+void DraftTokenWorkspaceManagerObj::AllocWorkspace(bool require_hidden_states) {
+  require_hidden_states_ = require_hidden_states;
+  ResizeStorage(/*slots=*/{}, std::min(slab_size_, max_num_tokens_));
+  for (int slot = capacity_ - 1; slot >= 0; --slot) {
+    free_slots_.push_back(slot);
+  }
+}
+
+void DraftTokenWorkspaceManagerObj::ResizeStorage(const std::vector<int>& slots, int capacity) {
+  ICHECK_LE(slots.size(), capacity);
+  NDArray draft_probs_storage =
+      NDArray::Empty({capacity, vocab_size_}, DataType::Float(32), device_);
+  ObjectRef draft_hidden_states_storage{nullptr};
+  if (require_hidden_states_) {
+    draft_hidden_states_storage =
+        ft_.Empty({capacity, hidden_size_}, hidden_states_dtype_, device_);
+  }
+  if (!slots.empty()) {
+    // Gather the states of the kept slots to the front of the new storage.
+    int64_t num_slots = slots.size();
+    NDArray indices_nd = slot_indices_host_.CreateView({num_slots}, DataType::Int(32));
+    indices_nd.CopyFromBytes(slots.data(), num_slots * sizeof(int));
+    ObjectRef indices_local = ft_.CopyToWorker0(indices_nd, "draft_slot_indices_local",
+                                                {max_num_tokens_}, /*local_only=*/true);
+    ft_.gather_probs_func_(draft_probs_storage_, indices_local,
+                           draft_probs_storage.CreateView({num_slots, vocab_size_},
+                                                          DataType::Float(32)));
+    if (require_hidden_states_) {
+      ObjectRef indices_device =
+          ft_.CopyToWorker0(indices_nd, "draft_slot_indices", {max_num_tokens_});
+      ObjectRef dst_view{nullptr};
+      if (draft_hidden_states_storage->IsInstance<DRefObj>()) {
+        dst_view = ft_.nd_view_func_(draft_hidden_states_storage,
+                                     ShapeTuple{num_slots, hidden_size_});
+      } else {
+        dst_view = Downcast<NDArray>(draft_hidden_states_storage)
+                       .CreateView({num_slots, hidden_size_}, hidden_states_dtype_);
+      }
+      ft_.gather_hidden_states_func_(draft_hidden_states_storage_, indices_device, dst_view);
+    }
   }
+  draft_probs_storage_ = draft_probs_storage;
+  draft_hidden_states_storage_ = draft_hidden_states_storage;
+  capacity_ = capacity;
 }
 
 }  // namespace serve
@@ -20,7 +20,31 @@ namespace serve {
 using tvm::Device;
 using namespace tvm::runtime;
 
-struct ModelWorkspace;
+/*! \brief The statistics of the draft token workspace. */
+struct DraftTokenWorkspaceStats {
+  /*! \brief The number of slots that the storage currently holds. */
+  int64_t capacity_slots = 0;
+  /*! \brief The number of slots in use. */
+  int64_t used_slots = 0;
+  /*! \brief The largest number of slots in use at the same time. */
+  int64_t peak_used_slots = 0;
+  /*!
+   * \brief The fraction of free slots below the highest slot in use, which are the holes
+   * removed by compaction.
+   */
+  double fragmentation = 0.0;
+  /*! \brief The number of times the storage grows. */
+  int64_t num_grows = 0;
+  /*! \brief The number of times the storage is compacted. */
+  int64_t num_compactions = 0;
+  /*! \brief The bytes of the storage and the gather buffer on device. */
+  int64_t device_bytes = 0;
+  /*!
+   * \brief The bytes of the buffer on the verify device that the draft probabilities are
+   * copied into, when the draft models run on another device.
+   */
+  int64_t peer_buffer_bytes = 0;
+};
 
 /*!
  * \brief Managing the workspace for draft token generation.
@@ -28,6 +52,11 @@ struct ModelWorkspace;
  * The workspace is used to store the associated states for each draft token, including the
  * probability distribution of the draft token, the hidden states, etc. The workspace manager
  * maintains a pool of slots for the draft tokens to store the states.
+ *
+ * The storage is allocated in slabs of slots. It starts from one slab and grows by slabs when
+ * the live batch needs more slots, up to the maximum number of draft tokens. When the live
+ * batch shrinks, `CompactSlots` packs the slots in use to the front of a smaller storage with
+ * the gather functions, so that large-vocabulary models do not keep the worst-case workspace.
  */
 class DraftTokenWorkspaceManagerObj : public Object {
  public:
@@ -42,17 +71,17 @@ class DraftTokenWorkspaceManagerObj : public Object {
    */
   DraftTokenWorkspaceManagerObj(int max_num_tokens, int vocab_size, int hidden_size,
                                 DLDataType hidden_states_dtype, DLDevice device,
-                                const FunctionTable& ft);
+                                FunctionTable& ft);
 
   /*!
-   * \brief Allocate the workspace for draft tokens and update `ModelWorkspace` data structure.
-   * \param workspace The object to stored the allocated draft token workspace.
+   * \brief Allocate the first slab of the workspace for draft tokens.
    * \param require_hidden_states Whether to allocate workspace for the hidden states.
    */
-  void AllocWorkspace(ModelWorkspace* workspace, bool require_hidden_states);
+  void AllocWorkspace(bool require_hidden_states);
 
   /*!
-   * \brief Allocate slots for the draft tokens.
+   * \brief Allocate slots for the draft tokens. The storage grows when there are not enough
+   * free slots, so the storage arrays must be obtained after the allocation.
    * \param num_slots The number of slots to allocate.
    * \param result The vector to store the allocated slots.
    */
@@ -64,23 +93,76 @@ class DraftTokenWorkspaceManagerObj : public Object {
    */
   void FreeSlots(const std::vector<int>& slots);
 
+  /*!
+   * \brief Rebuild the free slots from the slots in use, and compact the storage when the
+   * slots in use fit in fewer slabs with one slab of headroom.
+   * \param live_slots All the slots held by draft tokens.
+   * \return The new slot of each old slot after compaction, or -1 for the slots not in use.
+   * It is empty when the slots are not moved.
+   */
+  std::vector<int> CompactSlots(const std::vector<int>& live_slots);
+
+  /*! \brief Get the probabilities of draft tokens, indexed by the slots. */
+  NDArray GetDraftProbsStorage() const { return draft_probs_storage_; }
+
+  /*! \brief Get the hidden states of draft tokens, indexed by the slots. */
+  ObjectRef GetDraftHiddenStatesStorage() const { return draft_hidden_states_storage_; }
+
+  /*!
+   * \brief Get the buffer to gather the probabilities of a batch of draft tokens into,
+   * which grows by slabs to hold at least the given number of rows.
+   */
+  NDArray GetDraftProbsBuffer(int num_rows);
+
+  /*!
+   * \brief Copy the gathered probabilities of draft tokens to the given device, where the
+   * target model verifies them, when the draft models run on another device.
+   * \param draft_probs The gathered probabilities, in shape (num_rows, vocab_size).
+   * \param device The device to copy the probabilities to.
+   * \return The probabilities on the given device, which are valid until the next copy.
+   */
+  NDArray CopyDraftProbsToDevice(const NDArray& draft_probs, DLDevice device);
+
+  /*! \brief Get the statistics of the workspace. */
+  DraftTokenWorkspaceStats GetStats() const;
+
   static constexpr const char* _type_key = "mlc.serve.DraftTokenWorkspaceManager";
 
  private:
+  /*!
+   * \brief Move the given slots to the front of a new storage with the given capacity.
+   * \param slots The slots to keep, in their new order.
+   * \param capacity The number of slots of the new storage.
+   */
+  void ResizeStorage(const std::vector<int>& slots, int capacity);
+
   std::vector<int> free_slots_;
   int max_num_tokens_;
   int vocab_size_;
   int hidden_size_;
   DataType hidden_states_dtype_;
   DLDevice device_;
-  const FunctionTable& ft_;
+  FunctionTable& ft_;
+  /*! \brief The number of slots in each slab. */
+  int slab_size_;
+  /*! \brief The number of slots that the storage holds. */
+  int capacity_ = 0;
+  bool require_hidden_states_ = false;
+  NDArray draft_probs_storage_{nullptr};
+  ObjectRef draft_hidden_states_storage_{nullptr};
+  NDArray draft_probs_buffer_{nullptr};
+  /*! \brief The buffer on the verify device for the draft probabilities, if it is another one. */
+  NDArray peer_draft_probs_buffer_{nullptr};
+  /*! \brief The host array of slot indices for the gather functions. */
+  NDArray slot_indices_host_{nullptr};
+  DraftTokenWorkspaceStats stats_;
 };
 
 class DraftTokenWorkspaceManager : public ObjectRef {
  public:
   DraftTokenWorkspaceManager(int max_num_tokens, int vocab_size, int hidden_size,
                              DLDataType hidden_states_dtype, DLDevice device,
-                             const FunctionTable& ft) {
+                             FunctionTable& ft) {
     data_ = make_object<DraftTokenWorkspaceManagerObj>(max_num_tokens, vocab_size, hidden_size,
                                                        hidden_states_dtype, device, ft);
   }
@@ -6,28 +6,43 @@
 #include "engine.h"
 
 #include <dlpack/dlpack.h>
+#include <tvm/runtime/device_api.h>
 #include <tvm/runtime/logging.h>
+#include <tvm/runtime/memory/memory_manager.h>
 #include <tvm/runtime/module.h>
 #include <tvm/runtime/packed_func.h>
 #include <tvm/runtime/registry.h>
 #include <tvm/runtime/threading_backend.h>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <functional>
+#include <limits>
+#include <memory>
 #include <numeric>
 #include <optional>
+#include <thread>
 #include <tuple>
 #include <unordered_set>
 
+#include "../support/cpu_affinity.h"
 #include "../support/json_parser.h"
 #include "../support/result.h"
+#include "../token_table.h"
 #include "../tokenizers.h"
+#include "device_timer.h"
+#include "engine_autotune.h"
 #include "engine_actions/action.h"
 #include "engine_actions/action_commons.h"
 #include "engine_state.h"
 #include "event_trace_recorder.h"
 #include "grammar/grammar_state_matcher.h"
 #include "logit_processor.h"
+#include "memory_accounting.h"
+#include "metrics.h"
 #include "model.h"
+#include "prefix_cache_snapshot.h"
 #include "request.h"
 #include "request_state.h"
 #include "sampler/sampler.h"
@@ -81,15 +96,37 @@ class EngineImpl : public Engine {
       }
       model_configs.push_back(model_config_res.Unwrap());
     }
+    // - Keep only the attention sink and the recent tokens of each sequence in KV cache when
+    // KV token eviction is enabled.
+    Result<bool> kv_eviction_res =
+        EngineConfig::ApplyKVEvictionToModelConfigs(engine_config_json_str, &model_configs);
+    if (kv_eviction_res.IsErr()) {
+      return TResult::Error(kv_eviction_res.UnwrapErr());
+    }
     Optional<Session> session = n->CreateDiscoSession(model_configs, device);
+    // - Get the device of the draft models, which is the engine device by default.
+    Result<DLDevice> draft_device_res =
+        EngineConfig::GetDraftDeviceFromJSONString(engine_config_json_str, device);
+    if (draft_device_res.IsErr()) {
+      return TResult::Error(draft_device_res.UnwrapErr());
+    }
+    n->draft_device_ = draft_device_res.Unwrap();
     // - Initialize each model independently.
     n->models_.clear();
     for (int i = 0; i < static_cast<int>(models_and_model_libs.size()); ++i) {
       const auto& [model_str, model_lib] = models_and_model_libs[i];
-      Model model = Model::Create(model_lib, model_str, model_configs[i], device, session,
+      if (!n->IsOnEngineDevice(i) &&
+          json::LookupOrDefault<int64_t>(model_configs[i], "tensor_parallel_shards", 1) > 1) {
+        return TResult::Error("The draft models on \"draft_device\" cannot be sharded.");
+      }
+      Model model = Model::Create(model_lib, model_str, model_configs[i],
+                                  n->IsOnEngineDevice(i) ? device : n->draft_device_, session,
                                   /*trace_enabled=*/trace_recorder.defined());
       n->models_.push_back(model);
     }
+    if (n->HasSeparateDraftDevice()) {
+      LOG(INFO) << "The draft models run on device " << n->draft_device_ << ".";
+    }
     // - Automatically infer the missing fields in EngineConfig JSON strings
     // and get the final EngineConfig.
     Result<EngineConfig> engine_config_res =
@@ -98,16 +135,78 @@ class EngineImpl : public Engine {
       return TResult::Error(engine_config_res.UnwrapErr());
     }
     EngineConfig engine_config = engine_config_res.Unwrap();
+    if (engine_config->speculative_mode == SpeculativeMode::kNGram &&
+        n->models_.size() != 1) {
+      return TResult::Error(
+          "The \"ngram\" speculative mode proposes drafts without draft models, and requires "
+          "no additional models.");
+    }
+    if (engine_config->speculative_mode == SpeculativeMode::kLayerSkip &&
+        (n->models_.size() != 1 || !n->models_[0]->CanDecodeEarlyExit())) {
+      return TResult::Error(
+          "The \"layer_skip\" speculative mode proposes drafts from the early-exit layers of "
+          "the model itself. It requires no additional models, and the model to be compiled "
+          "with a positive \"self_spec_num_layers\".");
+    }
     {
       EngineState estate = n->estate_;
       Array<Model> models = n->models_;
       if (engine_config->prefix_cache_mode == PrefixCacheMode::kRadix) {
+        PrefixCacheHostTierCallbacks host_tier_callbacks;
+        if (engine_config->prefix_cache_host_memory_mb > 0) {
+          // The quantized KV cache cannot be read and written in the activation data type.
+          bool support_kv_swap = engine_config->kv_cache_dtype == KVCacheDType::kAuto;
+          for (const Model& model : models) {
+            support_kv_swap &= model->SupportKVSwap();
+          }
+          if (support_kv_swap) {
+            KVSwapPool host_tier(engine_config->prefix_cache_host_memory_mb * 1024 * 1024);
+            n->estate_->prefix_cache_host_tier = host_tier;
+            int page_size = engine_config->kv_cache_page_size;
+            host_tier_callbacks.offload = [estate, models, host_tier](int64_t seq_id,
+                                                                      size_t length) {
+              if (!host_tier->SwapOut(seq_id, length, models)) {
+                return false;
+              }
+              RemoveRequestFromModel(estate, seq_id, models);
+              return true;
+            };
+            host_tier_callbacks.restore = [models, host_tier, page_size](int64_t seq_id,
+                                                                         size_t length) {
+              int num_required_pages = (length + page_size - 1) / page_size;
+              for (const Model& model : models) {
+                if (model->GetNumAvailablePages() < num_required_pages) {
+                  return false;
+                }
+              }
+              host_tier->SwapIn(seq_id, models);
+              return true;
+            };
+            host_tier_callbacks.drop = [estate, host_tier](int64_t seq_id) {
+              host_tier->Discard(seq_id);
+              estate->id_manager.RecycleId(seq_id);
+            };
+          } else {
+            LOG(WARNING) << "The host memory tier of prefix cache is not supported by the current "
+                            "model. Only the KV cache tier is enabled.";
+          }
+        }
+        // RNN state can only be forked at the end of sequences, and holds the recycling
+        // sequences in the extra slots it is created with.
+        bool use_rnn_state = models[0]->GetMetadata().kv_state_kind == KVStateKind::kRNNState;
+        size_t max_num_recycling_seqs =
+            use_rnn_state
+                ? static_cast<size_t>(GetNumRecyclingRNNStateSlots(engine_config))
+                : static_cast<size_t>(engine_config->prefix_cache_max_num_recycling_seqs);
         n->estate_->prefix_cache = PrefixCache::CreateRadixPrefixCache(
-            static_cast<size_t>(engine_config->prefix_cache_max_num_recycling_seqs),
+            max_num_recycling_seqs,
             std::function<void(int64_t)>([estate, models](int64_t seq_id) {
               RemoveRequestFromModel(estate, seq_id, models);
               estate->id_manager.RecycleId(seq_id);
-            }));
+            }),
+            std::move(host_tier_callbacks), engine_config->prefix_cache_eviction_policy,
+            engine_config->kv_cache_page_size,
+            use_rnn_state ? engine_config->rnn_state_checkpoint_interval : -1);
       } else if (engine_config->prefix_cache_mode == PrefixCacheMode::kDisable) {
         n->estate_->prefix_cache = PrefixCache::CreateNoPrefixCache();
       } else {
@@ -115,18 +214,87 @@ class EngineImpl : public Engine {
                    << static_cast<int>(engine_config->prefix_cache_mode);
       }
     }
+    CHECK(engine_config->mode != EngineMode::kBatch ||
+          engine_config->scheduler_mode != SchedulerMode::kSLOAware)
+        << "Mode \"batch\" has no latency targets, and does not support scheduler mode "
+           "\"slo_aware\"";
+    n->estate_->scheduler_policy = SchedulerPolicy::Create(engine_config);
+    n->ApplyDevicePowerState(engine_config);
+    n->estate_->output_length_forecaster.Init(engine_config->admission_preemption_target);
+    // Speculative decoding keeps extra per-model states (e.g., draft tokens and hidden
+    // states) alongside the KV cache, which are not covered by KV swapping. The quantized
+    // KV cache cannot be copied out and in with the activation data type.
+    bool support_kv_swap = engine_config->speculative_mode == SpeculativeMode::kDisable &&
+                           engine_config->kv_cache_dtype == KVCacheDType::kAuto;
+    for (const Model& model : n->models_) {
+      support_kv_swap &= model->SupportKVSwap();
+    }
+    if (engine_config->engine_role != EngineRole::kMixed) {
+      CHECK(support_kv_swap) << "The \"" << EngineRoleToString(engine_config->engine_role)
+                             << "\" engine role requires speculative decoding to be disabled, "
+                                "and a model whose KV cache supports copying out and in.";
+    }
+    if (engine_config->preemption_mode == PreemptionMode::kSwap ||
+        engine_config->engine_role == EngineRole::kDecode) {
+      // The decode engine holds the imported KV data in the pool until the requests resume.
+      if (support_kv_swap) {
+        n->estate_->kv_swap_pool = KVSwapPool(engine_config->swap_space_mb * 1024 * 1024);
+      } else {
+        LOG(WARNING) << "The \"swap\" preemption mode is not supported by the current model "
+                        "or engine config. Falling back to the \"recompute\" preemption mode.";
+      }
+    }
+    if (engine_config->max_num_lora_adapters > 0) {
+      CHECK(engine_config->speculative_mode == SpeculativeMode::kDisable)
+          << "LoRA adapters require speculative decoding to be disabled.";
+      CHECK(n->models_[0]->SupportLoRA())
+          << "LoRA adapters require a model library compiled with the \"batch_prefill_lora\" "
+             "and \"batch_decode_lora\" functions.";
+      n->estate_->lora_adapter_pool = LoRAAdapterPool(engine_config->max_num_lora_adapters);
+    }
+    if (engine_config->response_cache_memory_mb > 0) {
+      n->estate_->response_cache =
+          ResponseCache(engine_config->response_cache_memory_mb * 1024 * 1024);
+    }
+    if (!engine_config->traffic_capture_path.empty()) {
+      n->estate_->traffic_capture = TrafficCapture::Open(engine_config->traffic_capture_path);
+      if (n->estate_->traffic_capture == nullptr) {
+        LOG(WARNING) << "Cannot open the traffic capture file ""
+                     << engine_config->traffic_capture_path << "". The traffic is not captured.";
+      }
+    }
+    // - Decide the width of draft token trees. Token trees are drafted by the small draft
+    // model or the Medusa heads, and are verified with tree attention in the KV cache of the
+    // target model.
+    int spec_tree_width = GetSpecTreeWidth(engine_config, n->models_[0]);
+    if (spec_tree_width < engine_config->spec_tree_width) {
+      LOG(WARNING) << "Draft token trees are only supported in the \"small_draft\" and "
+                      "\"medusa\" speculative modes with a model that supports token tree "
+                      "verification. Falling back to draft token chains.";
+    }
+    if (engine_config->concurrent_draft_prefill) {
+      bool support_side_stream = engine_config->speculative_mode == SpeculativeMode::kSmallDraft &&
+                                 !n->HasSeparateDraftDevice();
+      for (const Model& model : n->models_) {
+        support_side_stream &= model->SupportSideStream();
+      }
+      if (!support_side_stream) {
+        LOG(WARNING) << "Concurrent draft prefill is only supported in the \"small_draft\" "
+                        "speculative mode on a single CUDA/ROCm device. The draft models "
+                        "prefill after the target model.";
+      }
+    }
     // - Load model weights, create KV cache and workspace.
-    n->model_workspaces_.clear();
     for (const Model& model : n->models_) {
-      model->LoadParams();
-      model->SetMaxNumSequence(engine_config->max_num_sequence);
-      model->SetPrefillChunkSize(engine_config->prefill_chunk_size);
-      model->CreateKVCache(engine_config->kv_cache_page_size, engine_config->max_num_sequence,
-                           engine_config->max_total_sequence_length,
-                           engine_config->prefill_chunk_size, engine_config->max_history_size);
-      n->model_workspaces_.push_back(
-          ModelWorkspace{model->AllocEmbeddingTensor(), model->AllocHiddenStatesTensor()});
+      model->SetWeightShardCacheDir(engine_config->weight_shard_cache_dir);
+      model->LoadParams(/*in_background=*/engine_config->lazy_load_params);
+    }
+    n->spec_tree_width_ = spec_tree_width;
+    if (engine_config->device_phase_timing) {
+      n->device_step_timer_ = std::make_unique<DeviceStepTimer>(device);
     }
+    n->RegisterMetrics();
+    n->CreateKVCacheAndWorkspaces(engine_config);
     // - Initialize tokenizer and grammar
     n->tokenizer_ = Tokenizer::FromPath(engine_config->model);
     std::string token_table_postproc_method;
@@ -137,91 +305,65 @@ class EngineImpl : public Engine {
       token_table_postproc_method =
           model_configs[0].at("token_table_postproc_method").get<std::string>();
     }
-    n->token_table_ =
-        Tokenizer::PostProcessTokenTable(n->tokenizer_->TokenTable(), token_table_postproc_method);
-    n->grammar_init_context_cache_ = GrammarInitContextCache(n->token_table_);
-    // - Create the logit processor and sampler, and
-    // the DraftTokenWorkspaceManager for speculative decoding.
-    int max_num_tokens = engine_config->max_num_sequence;
-    DraftTokenWorkspaceManager draft_token_workspace_manager{nullptr};
-    if (engine_config->speculative_mode != SpeculativeMode::kDisable) {
-      max_num_tokens *= engine_config->spec_draft_length + 1;
-      // multiply max num_tokens by two so we can do ping-pong swaping during draft/verify process
-      draft_token_workspace_manager =
-          n->models_[0]->CreateDraftTokenWorkspaceManager(max_num_tokens * 2);
-      draft_token_workspace_manager->AllocWorkspace(
-          &n->model_workspaces_[0],
-          /*require_hidden_states=*/engine_config->speculative_mode == SpeculativeMode::kEagle);
-    }
-    LogitProcessor logit_processor =
-        n->models_[0]->CreateLogitProcessor(max_num_tokens, trace_recorder);
-    Sampler sampler = n->models_[0]->CreateSampler(
-        max_num_tokens, static_cast<int>(n->models_.size()), trace_recorder);
-    // - Initialize engine actions that represent state transitions.
-    if (engine_config->speculative_mode != SpeculativeMode::kDisable) {
-      // Speculative decoding is only possible for more than one model.
-      ICHECK_GT(n->models_.size(), 1U);
-      switch (engine_config->speculative_mode) {
-        case SpeculativeMode::kEagle:
-          n->actions_ = {
-              EngineAction::EagleNewRequestPrefill(n->models_,                     //
-                                                   logit_processor,                //
-                                                   sampler,                        //
-                                                   n->model_workspaces_,           //
-                                                   draft_token_workspace_manager,  //
-                                                   engine_config,                  //
-                                                   model_configs,                  //
-                                                   n->trace_recorder_),
-              EngineAction::EagleBatchDraft(n->models_, logit_processor, sampler,
-                                            n->model_workspaces_, draft_token_workspace_manager,
-                                            n->trace_recorder_, engine_config->spec_draft_length),
-              EngineAction::EagleBatchVerify(n->models_, logit_processor, sampler,
-                                             n->model_workspaces_, draft_token_workspace_manager,
-                                             engine_config, n->trace_recorder_)};
-          break;
-        case SpeculativeMode::kMedusa:
-          n->actions_ = {EngineAction::EagleNewRequestPrefill(n->models_,                     //
-                                                              logit_processor,                //
-                                                              sampler,                        //
-                                                              n->model_workspaces_,           //
-                                                              draft_token_workspace_manager,  //
-                                                              engine_config,                  //
-                                                              model_configs,                  //
-                                                              n->trace_recorder_),
-                         EngineAction::EagleBatchVerify(
-                             n->models_, logit_processor, sampler, n->model_workspaces_,
-                             draft_token_workspace_manager, engine_config, n->trace_recorder_)};
-          break;
-        default:
-          n->actions_ = {
-              EngineAction::NewRequestPrefill(n->models_,            //
-                                              logit_processor,       //
-                                              sampler,               //
-                                              n->model_workspaces_,  //
-                                              engine_config,         //
-                                              model_configs,         //
-                                              n->trace_recorder_),
-              EngineAction::BatchDraft(n->models_, logit_processor, sampler, n->model_workspaces_,
-                                       draft_token_workspace_manager, n->trace_recorder_,
-                                       engine_config->spec_draft_length),
-              EngineAction::BatchVerify(n->models_, logit_processor, sampler, n->model_workspaces_,
-                                        draft_token_workspace_manager, engine_config,
-                                        n->trace_recorder_)};
-      }
-    } else {
-      n->actions_ = {
-          EngineAction::NewRequestPrefill(n->models_,            //
-                                          logit_processor,       //
-                                          sampler,               //
-                                          n->model_workspaces_,  //
-                                          engine_config,         //
-                                          model_configs,         //
-                                          n->trace_recorder_),
-          EngineAction::BatchDecode(n->models_, logit_processor, sampler, n->trace_recorder_)};
-    }
+    // The post-processed token table is shared by the grammar, the stop string handlers and the
+    // other engines serving the model, and is cached in the model directory.
+    n->token_table_ = TokenTable::LoadOrCreate(
+        engine_config->model, token_table_postproc_method, [&]() {
+          return Tokenizer::PostProcessTokenTable(n->tokenizer_->TokenTable(),
+                                                  token_table_postproc_method);
+        });
+    n->grammar_init_context_cache_ =
+        GrammarInitContextCache(n->token_table_, engine_config->grammar_cache_dir,
+                                engine_config->grammar_cache_max_num_schemas,
+                                engine_config->grammar_precompiled_path);
+    n->model_configs_ = model_configs;
+    n->CreateActions(engine_config);
     // - Automatically set the threading backend max concurrency.
     n->engine_config_ = engine_config;
+    n->overlap_scheduling_ = engine_config->overlap_scheduling &&
+                             engine_config->speculative_mode == SpeculativeMode::kDisable;
     n->SetThreadMaxConcurrency();
+    std::vector<std::string> model_paths;
+    for (const auto& [model_str, model_lib] : models_and_model_libs) {
+      model_paths.push_back(model_str);
+    }
+    // - Autotune the engine capacities and warm up the engine before loading the snapshot,
+    // since the engine is reset after the synthetic requests.
+    if (engine_config->startup_autotune) {
+      if (engine_config->engine_role == EngineRole::kMixed) {
+        n->RunStartupAutotune(
+            ComputeEngineAutotuneKey(model_paths, model_configs, device, engine_config));
+        engine_config = n->engine_config_;
+      } else {
+        LOG(WARNING) << "Startup autotuning is only supported by the \"mixed\" engine role. "
+                        "Autotuning is disabled.";
+      }
+    }
+    // - Warm up the prefix cache from the on-disk snapshot.
+    if (!engine_config->prefix_cache_snapshot_path.empty()) {
+      bool support_snapshot = engine_config->prefix_cache_mode == PrefixCacheMode::kRadix;
+      for (const Model& model : n->models_) {
+        support_snapshot &= model->SupportKVSwap();
+      }
+      if (support_snapshot) {
+        n->prefix_cache_snapshot_key_ =
+            ComputePrefixCacheSnapshotKey(model_paths, model_configs, *n->token_table_);
+        int max_num_seqs = engine_config->prefix_cache_max_num_recycling_seqs == -1
+                               ? std::numeric_limits<int>::max()
+                               : engine_config->prefix_cache_max_num_recycling_seqs;
+        int num_restored = LoadPrefixCacheSnapshot(
+            engine_config->prefix_cache_snapshot_path, n->prefix_cache_snapshot_key_, n->estate_,
+            n->models_, engine_config->kv_cache_page_size, max_num_seqs);
+        if (num_restored > 0) {
+          LOG(INFO) << "Restored " << num_restored
+                    << " prefix cache sequences from the snapshot \""
+                    << engine_config->prefix_cache_snapshot_path << "\".";
+        }
+      } else {
+        LOG(WARNING) << "The prefix cache snapshot is not supported by the current model or "
+                        "engine config. The snapshot is disabled.";
+      }
+    }
     // - Get the default generation config from the first model.
     GenerationConfig default_generation_cfg =
         GenerationConfig::GetDefaultFromModelConfig(model_configs[0]);
@@ -236,9 +378,126 @@ class EngineImpl : public Engine {
     }
   }
 
-  bool Empty() final { return estate_->request_states.empty(); }
+  Result<EngineConfig> Reconfigure(const std::string& reconfig_json_str) final {
+    using TResult = Result<EngineConfig>;
+    picojson::value config_json;
+    std::string err = picojson::parse(config_json, reconfig_json_str);
+    if (!err.empty()) {
+      return TResult::Error(err);
+    }
+    if (!config_json.is<picojson::object>()) {
+      return TResult::Error("The reconfiguration is not a JSON object.");
+    }
+    const picojson::object& config = config_json.get<picojson::object>();
+    ObjectPtr<EngineConfigNode> n = make_object<EngineConfigNode>(*engine_config_.get());
+    n->max_num_sequence =
+        json::LookupOrDefault<int64_t>(config, "max_num_sequence", n->max_num_sequence);
+    n->max_total_sequence_length = json::LookupOrDefault<int64_t>(
+        config, "max_total_sequence_length", n->max_total_sequence_length);
+    n->prefill_chunk_size =
+        json::LookupOrDefault<int64_t>(config, "prefill_chunk_size", n->prefill_chunk_size);
+    if (n->max_num_sequence <= 0 || n->max_total_sequence_length <= 0 ||
+        n->prefill_chunk_size <= 0) {
+      return TResult::Error(
+          "\"max_num_sequence\", \"max_total_sequence_length\" and \"prefill_chunk_size\" "
+          "should be positive.");
+    }
+    n->max_single_sequence_length =
+        std::min(engine_config_->max_single_sequence_length, n->max_total_sequence_length);
+    n->device_power_state = DevicePowerStateFromString(json::LookupOrDefault<std::string>(
+        config, "device_power_state", DevicePowerStateToString(n->device_power_state)));
 
-  String Stats() final { return estate_->stats.AsJSON(); }
+    // - Only apply the device power state when the capacities are unchanged, which needs no
+    // recreation of the KV cache.
+    if (n->max_num_sequence == engine_config_->max_num_sequence &&
+        n->max_total_sequence_length == engine_config_->max_total_sequence_length &&
+        n->prefill_chunk_size == engine_config_->prefill_chunk_size) {
+      EngineConfig engine_config(n);
+      ApplyDevicePowerState(engine_config);
+      engine_config_ = engine_config;
+      return TResult::Ok(engine_config);
+    }
+
+    // - Check the new capacities against the GPU memory budget, with the largest KV cache
+    // capacity inferred for the new batch size and prefill chunk size.
+    Result<bool> use_kv_cache = ModelsUseKVCache(model_configs_);
+    if (use_kv_cache.IsErr()) {
+      return TResult::Error(use_kv_cache.UnwrapErr());
+    }
+    if (use_kv_cache.Unwrap()) {
+      std::vector<ModelMetadata> model_metadata;
+      for (int i = 0; i < static_cast<int>(models_.size()); ++i) {
+        model_metadata.push_back(GetEngineDeviceMetadata(i));
+      }
+      InferrableEngineConfig init_config{n->max_num_sequence, std::nullopt,
+                                         n->max_single_sequence_length, n->prefill_chunk_size,
+                                         std::nullopt};
+      Result<InferrableEngineConfig> inferred_config_res = InferrableEngineConfig::InferForKVCache(
+          EngineMode::kServer, device_, n->gpu_memory_utilization, n->kv_cache_dtype,
+          n->kv_cache_page_size, model_configs_, model_metadata, init_config, /*verbose=*/false);
+      if (inferred_config_res.IsErr()) {
+        return TResult::Error(inferred_config_res.UnwrapErr());
+      }
+      int64_t max_total_sequence_length =
+          inferred_config_res.Unwrap().max_total_sequence_length.value();
+      if (n->max_total_sequence_length > max_total_sequence_length) {
+        return TResult::Error("The KV cache capacity " +
+                              std::to_string(n->max_total_sequence_length) +
+                              " exceeds the capacity " + std::to_string(max_total_sequence_length) +
+                              " that fits the GPU memory budget under the new batch size.");
+      }
+    }
+    EngineConfig engine_config(n);
+
+    // - Preempt all the running requests, and evict the prefix cache sequences on device.
+    // The KV data swapped out to host memory stays valid across the KV cache recreation.
+    estate_->FlushDeferredPostProcess();
+    while (!estate_->running_queue.empty()) {
+      PreemptLastRunningRequestStateEntry(estate_, models_, draft_token_workspace_manager_,
+                                          trace_recorder_);
+    }
+    while (estate_->prefix_cache->TryFreeMemory()) {
+    }
+
+    // - Recreate the KV cache, the workspaces and the actions with the new capacities.
+    CreateKVCacheAndWorkspaces(engine_config);
+    CreateActions(engine_config);
+    ApplyDevicePowerState(engine_config);
+    engine_config_ = engine_config;
+    SetThreadMaxConcurrency();
+    LOG(INFO) << "Reconfigured the engine with max batch size " << engine_config->max_num_sequence
+              << ", max KV cache token capacity " << engine_config->max_total_sequence_length
+              << " and prefill chunk size " << engine_config->prefill_chunk_size << ".";
+    return TResult::Ok(engine_config);
+  }
+
+  bool Empty() final {
+    return estate_->request_states.empty() && estate_->prefill_only_queue.empty();
+  }
+
+  String Stats() final {
+    estate_->stats.prefix_cache_stats = estate_->prefix_cache->GetStats();
+    if (draft_token_workspace_manager_.defined()) {
+      estate_->stats.draft_token_workspace_stats = draft_token_workspace_manager_->GetStats();
+    }
+    UpdateMemoryAccounting();
+    estate_->stats.device_memory_stats = memory_accountant_.GetStats();
+    return estate_->stats.AsJSON();
+  }
+
+  int64_t GetNumAvailablePages() final { return models_[0]->GetNumAvailablePages(); }
+
+  MetricsRegistry GetMetricsRegistry() final { return metrics_; }
+
+  std::shared_ptr<const PrefixMatchIndex> GetPrefixMatchIndex() final {
+    return estate_->prefix_cache->GetMatchIndex();
+  }
+
+  std::shared_ptr<CancelledRequestSet> GetCancelledRequestSet() final {
+    return estate_->cancelled_requests;
+  }
+
+  std::shared_ptr<TrafficCapture> GetTrafficCapture() final { return estate_->traffic_capture; }
 
   Optional<PackedFunc> GetRequestStreamCallback() final { return request_stream_callback_; }
 
@@ -253,6 +512,14 @@ class EngineImpl : public Engine {
     // Get a request copy where all text inputs are tokenized.
     request = Request::FromUntokenized(request, tokenizer_);
     ICHECK_NE(request->input_total_length, -1);
+    if (std::shared_ptr<const PrefixMatchIndex> match_index =
+            estate_->prefix_cache->GetMatchIndex()) {
+      // The requests tokenized in the engine have no estimate from the caller thread yet.
+      request = match_index->AttachCachedPrefixEstimate(request);
+    }
+    if (estate_->traffic_capture != nullptr) {
+      estate_->traffic_capture->RecordRequest(request);
+    }
 
     if (request->input_total_length >= engine_config_->max_single_sequence_length &&
         request_stream_callback_.defined()) {
@@ -265,11 +532,71 @@ class EngineImpl : public Engine {
       request_stream_callback_.value()(std::move(output));
       return;
     }
+    if (request->generation_cfg->num_beams > 1 && !SupportBeamSearch()) {
+      LOG(WARNING) << "Request " << request->id
+                   << " is aborted since beam search is not supported by the engine under "
+                      "speculative decoding, sliding window attention or prefill role.";
+      if (request_stream_callback_.defined()) {
+        Array<RequestStreamOutput> output{RequestStreamOutput(
+            request->id, std::vector<IntTuple>(request->generation_cfg->n),
+            Optional<Array<Array<String>>>(),
+            std::vector<Optional<String>>(request->generation_cfg->n, String("abort")))};
+        request_stream_callback_.value()(std::move(output));
+      }
+      return;
+    }
+    if (!request->generation_cfg->prefill_only_output.empty()) {
+      AddPrefillOnlyRequest(request);
+      return;
+    }
+    std::string response_cache_key;
+    std::vector<int32_t> prompt_token_ids;
+    if (estate_->response_cache.defined()) {
+      response_cache_key =
+          ResponseCacheObj::GetKey(request, engine_config_->model, &prompt_token_ids);
+      if (!response_cache_key.empty() && request_stream_callback_.defined()) {
+        if (const CachedResponse* response =
+                estate_->response_cache->Lookup(response_cache_key, prompt_token_ids)) {
+          ++estate_->stats.response_cache_hits;
+          StreamCachedResponse(request, *response);
+          return;
+        }
+        ++estate_->stats.response_cache_misses;
+      }
+    }
+    if (engine_config_->load_shedding && ShouldShedRequest(request)) {
+      RECORD_EVENT(trace_recorder_, request->id, "request rejected by load shedding");
+      ++estate_->stats.num_rejected_requests;
+      if (request_stream_callback_.defined()) {
+        Array<RequestStreamOutput> output{RequestStreamOutput(
+            request->id, std::vector<IntTuple>(request->generation_cfg->n),
+            Optional<Array<Array<String>>>(),
+            std::vector<Optional<String>>(request->generation_cfg->n, String("rejected")))};
+        request_stream_callback_.value()(std::move(output));
+      }
+      return;
+    }
+    int lora_adapter_slot = AcquireLoRAAdapter(request);
+    if (lora_adapter_slot == -1 && !request->generation_cfg->lora_adapter.empty()) {
+      // All the adapter slots are applied by running requests, in which case the request is
+      // aborted rather than waiting for the slots indefinitely.
+      LOG(WARNING) << "Cannot load the LoRA adapter of request " << request->id
+                   << " since all the adapter slots are in use.";
+      if (request_stream_callback_.defined()) {
+        Array<RequestStreamOutput> output{RequestStreamOutput(
+            request->id, std::vector<IntTuple>(request->generation_cfg->n),
+            Optional<Array<Array<String>>>(),
+            std::vector<Optional<String>>(request->generation_cfg->n, String("abort")))};
+        request_stream_callback_.value()(std::move(output));
+      }
+      return;
+    }
 
     // Append to the waiting queue and create the request state.
     estate_->waiting_queue.push_back(request);
 
     int n = request->generation_cfg->n;
+    int num_beams = request->generation_cfg->num_beams;
     int rng_seed = request->generation_cfg->seed;
     auto grammar_state_init_ctx =
         ResponseFormatToGrammarInitContext(request->generation_cfg->response_format);
@@ -278,7 +605,20 @@ class EngineImpl : public Engine {
     // Create the request state entry for the input.
     rsentries.emplace_back(request, models_.size(), estate_->id_manager.GetNewId(), rng_seed,
                            token_table_, grammar_state_init_ctx);
-    if (n > 1) {
+    if (num_beams > 1) {
+      // Then create a request state entry for each beam of beam search. The beams start
+      // from the same prompt, so only the first beam is expanded in the first step.
+      rsentries.reserve(num_beams + 1);
+      rsentries[0]->child_indices.reserve(num_beams);
+      for (int i = 0; i < num_beams; ++i) {
+        rsentries[0]->child_indices.push_back(rsentries.size());
+        rsentries.emplace_back(request, models_.size(), estate_->id_manager.GetNewId(),
+                               rng_seed, token_table_, grammar_state_init_ctx,
+                               /*parent_idx=*/0);
+        rsentries.back()->hold_output = true;
+        rsentries.back()->beam_logprob = i == 0 ? 0.0 : -std::numeric_limits<double>::infinity();
+      }
+    } else if (n > 1) {
       // Then create a request state entry for each parallel generation branch.
       // We add a offset to the rng seed so that to make generations different.
       rsentries.reserve(n + 1);
@@ -290,48 +630,148 @@ class EngineImpl : public Engine {
                                /*parent_idx=*/0);
       }
     }
-    estate_->request_states.emplace(request->id, RequestState(std::move(rsentries)));
+    if (engine_config_->speculative_mode == SpeculativeMode::kNGram) {
+      // The leaf entries propose their drafts from the n-grams of the prompt and the tokens
+      // they generate.
+      std::vector<int32_t> prompt_tokens = GetNGramIndexPromptTokens(request);
+      for (const RequestStateEntry& rsentry : rsentries) {
+        if (rsentry->child_indices.empty()) {
+          rsentry->mstates[0]->ngram_index.Init(prompt_tokens,
+                                                engine_config_->spec_ngram_max_size);
+        }
+      }
+    }
+    RequestState rstate(std::move(rsentries));
+    rstate->lora_adapter_slot = lora_adapter_slot;
+    if (!response_cache_key.empty()) {
+      rstate->response_cache_key = std::move(response_cache_key);
+      rstate->cached_response.group_token_ids.resize(request->generation_cfg->n);
+      rstate->cached_response.group_finish_reason.resize(request->generation_cfg->n);
+      rstate->cached_response.prompt_token_ids = std::move(prompt_token_ids);
+    }
+    estate_->request_states.emplace(request->id, rstate);
+  }
+
+  /*!
+   * \brief Check whether load shedding rejects the request, which is when its predicted queue
+   * time exceeds its deadline. The queue time is predicted as the uncached input tokens of the
+   * request and of the waiting requests scheduled before it, at the engine time per prefilled
+   * token measured while requests wait. Under the SLO-aware scheduler, the waiting requests of
+   * lower priority are scheduled after the request. Nothing is rejected before the drain rate
+   * is measured.
+   */
+  bool ShouldShedRequest(const Request& request) const {
+    double deadline_ms = engine_config_->load_shedding_max_queue_time_ms;
+    double ttft_slo_ms = request->generation_cfg->ttft_slo_ms;
+    if (ttft_slo_ms > 0 && (deadline_ms <= 0 || ttft_slo_ms < deadline_ms)) {
+      deadline_ms = ttft_slo_ms;
+    }
+    double seconds_per_token = estate_->queue_drain_estimator.GetSecondsPerToken();
+    if (deadline_ms <= 0 || seconds_per_token < 0) {
+      return false;
+    }
+    auto f_uncached_length = [](const Request& queued_request) {
+      return std::max<int64_t>(
+          queued_request->input_total_length -
+              std::max<int64_t>(queued_request->estimated_cached_prefix_length, 0),
+          1);
+    };
+    bool by_priority = engine_config_->scheduler_mode == SchedulerMode::kSLOAware;
+    int64_t num_queued_tokens = f_uncached_length(request);
+    for (const Request& waiting_request : estate_->waiting_queue) {
+      if (!by_priority ||
+          waiting_request->generation_cfg->priority >= request->generation_cfg->priority) {
+        num_queued_tokens += f_uncached_length(waiting_request);
+      }
+    }
+    return num_queued_tokens * seconds_per_token * 1e3 > deadline_ms;
+  }
+
+  /*! \brief Stream back the cached response of a request as its only output. */
+  void StreamCachedResponse(const Request& request, const CachedResponse& response) {
+    RECORD_EVENT(trace_recorder_, request->id, "response cache hit");
+    RequestMetrics metrics;
+    metrics.tarrival = std::chrono::high_resolution_clock::now();
+    metrics.tfirst_scheduled = metrics.tarrival;
+    metrics.tfirst_token = metrics.tarrival;
+    metrics.tfinish = metrics.tarrival;
+    Array<IntTuple> group_delta_token_ids;
+    Array<Optional<String>> group_finish_reason;
+    for (int i = 0; i < static_cast<int>(response.group_token_ids.size()); ++i) {
+      const std::vector<int32_t>& token_ids = response.group_token_ids[i];
+      group_delta_token_ids.push_back(IntTuple{token_ids.begin(), token_ids.end()});
+      group_finish_reason.push_back(response.group_finish_reason[i]);
+      metrics.num_output_tokens =
+          std::max(metrics.num_output_tokens, static_cast<int64_t>(token_ids.size()));
+    }
+    Array<RequestStreamOutput> output{RequestStreamOutput(
+        request->id, std::move(group_delta_token_ids), Optional<Array<Array<String>>>(),
+        std::move(group_finish_reason), String(metrics.AsJSONString()))};
+    request_stream_callback_.value()(std::move(output));
+  }
+
+  /*!
+   * \brief Add a prefill-only request to the prefill-only queue, or abort it when the engine
+   * cannot prefill it in one prefill chunk with a single model.
+   */
+  void AddPrefillOnlyRequest(const Request& request) {
+    const GenerationConfig& generation_cfg = request->generation_cfg;
+    bool supported =
+        models_.size() == 1 &&
+        models_[0]->GetMetadata().kv_state_kind == KVStateKind::kKVCache &&
+        models_[0]->CanPrefillToLastHidden() && models_[0]->GetSlidingWindowSize() == -1 &&
+        (generation_cfg->prefill_only_output != "prompt_logprobs" ||
+         models_[0]->CanGetLogits()) &&
+        generation_cfg->lora_adapter.empty() &&
+        request->input_total_length <= engine_config_->prefill_chunk_size &&
+        std::all_of(request->inputs.begin(), request->inputs.end(),
+                    [](const Data& input) { return input->IsInstance<TokenDataNode>(); });
+    if (supported) {
+      estate_->prefill_only_queue.push_back(request);
+      return;
+    }
+    LOG(WARNING) << "Request " << request->id
+                 << " is aborted since the prefill-only request is not supported by the engine, "
+                    "or its prompt does not fit in one prefill chunk.";
+    if (request_stream_callback_.defined()) {
+      Array<RequestStreamOutput> output{RequestStreamOutput(request->id, {IntTuple{}},
+                                                            Optional<Array<Array<String>>>(),
+                                                            {String("abort")})};
+      request_stream_callback_.value()(std::move(output));
+    }
+  }
+
+  void AddRequests(Array<Request> requests) final {
+    for (const Request& request : Request::FromUntokenized(requests, tokenizer_)) {
+      AddRequest(request);
+    }
   }
 
   void AbortRequest(const String& request_id) final {
+    estate_->cancelled_requests->Remove(request_id);
+    estate_->FlushDeferredPostProcess();
     auto it_rstate = estate_->request_states.find(request_id);
     if (it_rstate == estate_->request_states.end()) {
-      // The request to abort does not exist.
+      // The request to abort is either a prefill-only request that has not been prefilled,
+      // which has no request state, or does not exist.
+      auto it_request = std::find_if(
+          estate_->prefill_only_queue.begin(), estate_->prefill_only_queue.end(),
+          [&request_id](const Request& request) { return request->id == request_id; });
+      if (it_request == estate_->prefill_only_queue.end()) {
+        return;
+      }
+      estate_->prefill_only_queue.erase(it_request);
+      if (request_stream_callback_.defined()) {
+        Array<RequestStreamOutput> output{RequestStreamOutput(
+            request_id, {IntTuple{}}, Optional<Array<Array<String>>>(), {String("abort")})};
+        request_stream_callback_.value()(std::move(output));
+      }
       return;
     }
 
     RequestState rstate = it_rstate->second;
     Request request = rstate->entries[0]->request;
-
-    // - Check if the request is running or pending.
-    auto it_running =
-        std::find(estate_->running_queue.begin(), estate_->running_queue.end(), request);
-    auto it_waiting =
-        std::find(estate_->waiting_queue.begin(), estate_->waiting_queue.end(), request);
-
-    estate_->request_states.erase(request->id);
-    if (it_running != estate_->running_queue.end()) {
-      // The request to abort is in running queue
-      estate_->running_queue.erase(it_running);
-
-      for (int i = static_cast<int>(rstate->entries.size()) - 1; i >= 0; --i) {
-        if (estate_->prefix_cache->HasSequence(rstate->entries[i]->mstates[0]->internal_id)) {
-          estate_->prefix_cache->RecycleSequence(rstate->entries[i]->mstates[0]->internal_id,
-                                                 /*lazy=*/false);
-        } else {
-          if (rstate->entries[i]->status != RequestStateStatus::kAlive) {
-            estate_->id_manager.RecycleId(rstate->entries[i]->mstates[0]->internal_id);
-            continue;
-          }
-          RemoveRequestFromModel(estate_, rstate->entries[i]->mstates[0]->internal_id, models_);
-          estate_->id_manager.RecycleId(rstate->entries[i]->mstates[0]->internal_id);
-        }
-      }
-    }
-    if (it_waiting != estate_->waiting_queue.end()) {
-      // The request to abort is in waiting queue
-      estate_->waiting_queue.erase(it_waiting);
-    }
+    RemoveRequestState(rstate);
 
     // Send a callback to notice the abortion.
     if (request_stream_callback_.defined()) {
@@ -350,32 +790,539 @@ class EngineImpl : public Engine {
     for (const auto& kv : estate_->request_states) {
       request_ids.push_back(kv.first);
     }
+    for (const Request& request : estate_->prefill_only_queue) {
+      request_ids.push_back(request->id);
+    }
     // - Abort all the requests.
     for (const String& request_id : request_ids) {
       AbortRequest(request_id);
     }
   }
 
+  RequestHandoff ExportRequest(const String& request_id, Device device) final {
+    estate_->FlushDeferredPostProcess();
+    auto it_rstate = estate_->request_states.find(request_id);
+    CHECK(it_rstate != estate_->request_states.end())
+        << "The request " << request_id << " to export does not exist.";
+    RequestState rstate = it_rstate->second;
+    CHECK_EQ(rstate->entries.size(), 1)
+        << "Exporting requests with multiple parallel generations is not supported.";
+    RequestStateEntry rsentry = rstate->entries[0];
+    Request request = rsentry->request;
+    const RequestModelState& mstate = rsentry->mstates[0];
+    CHECK(rsentry->status == RequestStateStatus::kAlive && mstate->inputs.empty() &&
+          !mstate->committed_tokens.empty())
+        << "The request " << request_id << " to export has not finished prefill.";
+
+    // The KV data of the last committed token has not been computed yet.
+    int64_t kv_length =
+        request->input_total_length + static_cast<int64_t>(mstate->committed_tokens.size()) - 1;
+    std::vector<Array<NDArray>> kv_data;
+    kv_data.reserve(models_.size());
+    for (const Model& model : models_) {
+      kv_data.push_back(model->ExportSequenceKV(mstate->internal_id, kv_length, device));
+    }
+    RECORD_EVENT(trace_recorder_, request_id, "export");
+    RequestHandoff handoff(request, mstate->committed_tokens, rsentry->next_callback_token_pos,
+                           std::move(kv_data), kv_length);
+    RemoveRequestState(rstate);
+    return handoff;
+  }
+
+  void ImportRequest(RequestHandoff handoff) final {
+    Request request = handoff->request;
+    CHECK(!estate_->request_states.count(request->id))
+        << "The request " << request->id << " to import already exists.";
+    CHECK_EQ(request->generation_cfg->n, 1)
+        << "Importing requests with multiple parallel generations is not supported.";
+    CHECK_EQ(handoff->kv_data.size(), models_.size())
+        << "The imported KV data does not match the number of models.";
+    ICHECK_NE(request->input_total_length, -1);
+    RECORD_EVENT(trace_recorder_, request->id, "request imported to engine");
+
+    auto grammar_state_init_ctx =
+        ResponseFormatToGrammarInitContext(request->generation_cfg->response_format);
+    RequestStateEntry rsentry(request, models_.size(), estate_->id_manager.GetNewId(),
+                              request->generation_cfg->seed, token_table_,
+                              grammar_state_init_ctx);
+    rsentry->next_callback_token_pos = handoff->next_callback_token_pos;
+    // Replay the committed tokens, which also advances the grammar state. Like for preempted
+    // requests, the committed tokens are appended to the inputs for prefill.
+    std::vector<int32_t> committed_token_ids;
+    committed_token_ids.reserve(handoff->committed_tokens.size());
+    for (const SampleResult& committed_token : handoff->committed_tokens) {
+      committed_token_ids.push_back(committed_token.sampled_token_id.first);
+    }
+    for (RequestModelState mstate : rsentry->mstates) {
+      for (const SampleResult& committed_token : handoff->committed_tokens) {
+        mstate->CommitToken(committed_token);
+      }
+      Array<Data> inputs = mstate->inputs;
+      if (const auto* token_input = inputs.back().as<TokenDataNode>()) {
+        // Merge the TokenData so that a single time TokenEmbed is needed.
+        std::vector<int> token_ids{token_input->token_ids->data,
+                                   token_input->token_ids->data + token_input->token_ids.size()};
+        token_ids.insert(token_ids.end(), committed_token_ids.begin(), committed_token_ids.end());
+        inputs.Set(static_cast<int64_t>(inputs.size()) - 1, TokenData(token_ids));
+      } else if (!committed_token_ids.empty()) {
+        inputs.push_back(TokenData(committed_token_ids));
+      }
+      mstate->inputs = std::move(inputs);
+    }
+
+    int64_t seq_id = rsentry->mstates[0]->internal_id;
+    if (!estate_->kv_swap_pool.defined() ||
+        !estate_->kv_swap_pool->Import(seq_id, handoff->kv_data, handoff->kv_length)) {
+      LOG(WARNING) << "The KV data of the imported request " << request->id
+                   << " cannot be held. The request will be prefilled again.";
+    }
+    RequestState rstate({rsentry});
+    rstate->lora_adapter_slot = AcquireLoRAAdapter(request);
+    CHECK(rstate->lora_adapter_slot != -1 || request->generation_cfg->lora_adapter.empty())
+        << "Cannot load the LoRA adapter of the imported request " << request->id
+        << " since all the adapter slots are in use.";
+    // The request has already started, and thus goes to the front of the waiting queue.
+    estate_->waiting_queue.insert(estate_->waiting_queue.begin(), request);
+    estate_->request_states.emplace(request->id, rstate);
+  }
+
+  Optional<PrefixKVHandoff> ExportPrefixKV(const IntTuple& tokens, Device device) final {
+    if (!SupportPrefixKVHandoff()) {
+      return NullOpt;
+    }
+    estate_->FlushDeferredPostProcess();
+    // Find the cached sequence sharing the longest prefix with the tokens. The tokens of the
+    // sequences in prefix cache always have their KV data in the KV cache.
+    int64_t matched_seq_id = -1;
+    size_t matched_length = 0;
+    for (const auto& [seq_id, seq_tokens] : estate_->prefix_cache->GetPersistableSequences()) {
+      size_t max_length = std::min(seq_tokens.size(), tokens.size());
+      size_t length = 0;
+      // The image positions are keyed by the negative tokens, whose embeddings peers may lack.
+      while (length < max_length && seq_tokens[length] == tokens[length] && tokens[length] >= 0) {
+        ++length;
+      }
+      if (length > matched_length) {
+        matched_seq_id = seq_id;
+        matched_length = length;
+      }
+    }
+    if (matched_length < static_cast<size_t>(PrefixMatchIndex::kBlockSize)) {
+      return NullOpt;
+    }
+    std::vector<Array<NDArray>> kv_data;
+    kv_data.reserve(models_.size());
+    for (const Model& model : models_) {
+      kv_data.push_back(model->ExportSequenceKV(matched_seq_id, matched_length, device));
+    }
+    return PrefixKVHandoff(IntTuple(tokens.begin(), tokens.begin() + matched_length),
+                           std::move(kv_data));
+  }
+
+  int64_t ImportPrefixKV(PrefixKVHandoff handoff) final {
+    const IntTuple& tokens = handoff->tokens;
+    if (!SupportPrefixKVHandoff() || tokens.empty() || handoff->kv_data.size() != models_.size()) {
+      return 0;
+    }
+    for (const Array<NDArray>& kv_data : handoff->kv_data) {
+      if (kv_data.size() != 2 || kv_data[0]->ndim < 2 ||
+          kv_data[0]->shape[1] != static_cast<int64_t>(tokens.size())) {
+        LOG(WARNING) << "The imported prefix KV data does not match its tokens. Skip importing.";
+        return 0;
+      }
+    }
+    // Skip the prefix that prefix cache already holds up to its last full block.
+    std::shared_ptr<const PrefixMatchIndex> match_index = estate_->prefix_cache->GetMatchIndex();
+    size_t num_full_block_tokens =
+        tokens.size() / PrefixMatchIndex::kBlockSize * PrefixMatchIndex::kBlockSize;
+    if (match_index->MatchPrefixLength(tokens.data(), tokens.size()) >= num_full_block_tokens) {
+      return 0;
+    }
+    int page_size = engine_config_->kv_cache_page_size;
+    int64_t num_required_pages = (tokens.size() + page_size - 1) / page_size;
+    for (const Model& model : models_) {
+      if (model->GetNumAvailablePages() < num_required_pages) {
+        return 0;
+      }
+    }
+    int64_t seq_id = estate_->id_manager.GetNewId();
+    for (int model_id = 0; model_id < static_cast<int>(models_.size()); ++model_id) {
+      models_[model_id]->ImportSequenceKV(seq_id, handoff->kv_data[model_id]);
+    }
+    estate_->prefix_cache->AddRecyclingSequence(seq_id, tokens);
+    return tokens.size();
+  }
+
+  void SavePrefixCacheSnapshot() final {
+    if (prefix_cache_snapshot_key_.empty()) {
+      return;
+    }
+    int num_saved =
+        serve::SavePrefixCacheSnapshot(engine_config_->prefix_cache_snapshot_path,
+                                       prefix_cache_snapshot_key_, estate_->prefix_cache, models_);
+    if (num_saved > 0) {
+      LOG(INFO) << "Saved " << num_saved << " prefix cache sequences to the snapshot \""
+                << engine_config_->prefix_cache_snapshot_path << "\".";
+    }
+  }
+
   /*********************** Engine Action ***********************/
 
   void Step() final {
     CHECK(request_stream_callback_.defined())
         << "The request stream callback is not set. Engine cannot execute.";
-    for (EngineAction action : actions_) {
-      Array<Request> processed_requests = action->Step(estate_);
+    // - The deferred post-processing overlaps only with the next decode. Flush it when
+    // there are new requests to schedule.
+    // - Record the model function ranges of this step into the trace recorder of the engine.
+    TraceRecorderThreadScope trace_recorder_scope(trace_recorder_);
+    // - Time the phases of this step on the device when device phase timing is enabled.
+    DeviceTimerThreadScope device_timer_scope(device_step_timer_.get());
+    auto step_start = std::chrono::high_resolution_clock::now();
+    if (!estate_->waiting_queue.empty() || !estate_->prefill_only_queue.empty()) {
+      estate_->FlushDeferredPostProcess();
+    }
+    // - Abort the requests cancelled since the last step before the actions gather their inputs.
+    ApplyRequestCancellations();
+    // - The steps taken while requests are waiting measure the drain rate of the waiting queue.
+    bool queue_backlogged = !estate_->waiting_queue.empty();
+    // - Plan the token budget of this step among prefill, decode and speculation.
+    estate_->step_planner.Plan(static_cast<int>(GetRunningRequestStateEntries(estate_).size()),
+                               estate_->prefill_chunk_controller.prefill_chunk_size);
+    for (int i = 0; i < static_cast<int>(actions_.size()); ++i) {
+      const EngineAction& action = actions_[i];
+      double prefill_time_before = estate_->stats.engine_total_prefill_time;
+      double decode_time_before = estate_->stats.engine_total_decode_time;
+      int64_t prefill_length_before = estate_->stats.total_prefill_length;
+      Array<Request> processed_requests;
+      {
+        TraceScopedRange trace_scope(action->Name());
+        auto tstart = std::chrono::high_resolution_clock::now();
+        processed_requests = action->Step(estate_);
+        auto tend = std::chrono::high_resolution_clock::now();
+        action_step_seconds_[i]->Observe(static_cast<double>((tend - tstart).count()) / 1e9);
+      }
+      if (!estate_->prefill_only_outputs.empty()) {
+        // - The prefill-only requests finish in the action, without post-processing.
+        Array<RequestStreamOutput> outputs = std::move(estate_->prefill_only_outputs);
+        estate_->prefill_only_outputs = {};
+        request_stream_callback_.value()(std::move(outputs));
+      }
       if (!processed_requests.empty()) {
-        ActionStepPostProcess(processed_requests, estate_, models_, tokenizer_,
-                              request_stream_callback_.value(),
-                              engine_config_->max_single_sequence_length, trace_recorder_);
+        if (overlap_scheduling_ && action.same_as(actions_.back())) {
+          // - Defer the post-processing of decode to the next decode step.
+          estate_->FlushDeferredPostProcess();
+          estate_->deferred_postproc = [this, processed_requests]() {
+            ActionStepPostProcess(processed_requests, estate_, models_, tokenizer_,
+                                  request_stream_callback_.value(),
+                                  engine_config_->max_single_sequence_length, trace_recorder_);
+          };
+        } else {
+          estate_->FlushDeferredPostProcess();
+          ActionStepPostProcess(processed_requests, estate_, models_, tokenizer_,
+                                request_stream_callback_.value(),
+                                engine_config_->max_single_sequence_length, trace_recorder_);
+        }
+        // - Reclaim the draft token slots that are no longer held and shrink the workspace.
+        if (draft_token_workspace_manager_.defined()) {
+          CompactDraftTokenWorkspace(estate_, draft_token_workspace_manager_);
+        }
+        // - Adapt the prefill chunk size with the timings of this step.
+        estate_->prefill_chunk_controller.Update(
+            estate_->stats.engine_total_prefill_time - prefill_time_before,
+            estate_->stats.total_prefill_length - prefill_length_before,
+            estate_->stats.engine_total_decode_time - decode_time_before);
+        if (queue_backlogged) {
+          estate_->queue_drain_estimator.Record(
+              estate_->stats.engine_total_prefill_time - prefill_time_before +
+                  estate_->stats.engine_total_decode_time - decode_time_before,
+              estate_->stats.total_prefill_length - prefill_length_before);
+        }
+        // - Abort the requests cancelled during the action, which releases their KV cache in
+        // this step.
+        ApplyRequestCancellations();
+        CompactKVCacheIfIdle();
+        ReleaseTransientBuffersIfIdle();
+        CollectDeviceStepTimes();
+        UpdateMemoryAccounting();
+        UpdateMetrics();
+        PaceStep(step_start);
         return;
       }
     }
+    estate_->FlushDeferredPostProcess();
+    // - The actions leave the cancelled requests out, which may be all the running requests.
+    ApplyRequestCancellations();
+    CompactKVCacheIfIdle();
+    ReleaseTransientBuffersIfIdle();
+    CollectDeviceStepTimes();
+    UpdateMemoryAccounting();
+    UpdateMetrics();
     ICHECK(estate_->running_queue.empty())
         << "Internal assumption violated: It is expected that an engine step takes at least one "
            "action (e.g. prefill, decode, etc.) but it does not.";
   }
 
   /************** Utility Functions **************/
+  /*! \brief Abort the requests that other threads have marked as cancelled. */
+  void ApplyRequestCancellations() {
+    if (estate_->cancelled_requests->Empty()) {
+      return;
+    }
+    for (const std::string& request_id : estate_->cancelled_requests->GetAll()) {
+      AbortRequest(request_id);
+    }
+  }
+
+  /*! \brief Report the device memory that each owner holds to the memory accountant. */
+  void UpdateMemoryAccounting() {
+    int64_t model_workspace_bytes = 0;
+    int64_t input_buffer_bytes = 0;
+    for (int i = 0; i < static_cast<int>(models_.size()); ++i) {
+      if (!IsOnEngineDevice(i)) {
+        continue;
+      }
+      model_workspace_bytes += GetNDArrayBytes(model_workspaces_[i].embeddings);
+      if (!model_workspaces_[i].hidden_states.same_as(model_workspaces_[i].embeddings)) {
+        model_workspace_bytes += GetNDArrayBytes(model_workspaces_[i].hidden_states);
+      }
+      input_buffer_bytes += models_[i]->GetCachedInputBufferBytes();
+    }
+    memory_accountant_.Update("params", params_bytes_);
+    memory_accountant_.Update("kv_cache", kv_cache_bytes_);
+    memory_accountant_.Update("model_workspace", model_workspace_bytes);
+    memory_accountant_.Update("input_buffers", input_buffer_bytes);
+    memory_accountant_.Update("logit_processor", logit_processor_->GetDeviceMemoryBytes());
+    memory_accountant_.Update("sampler", sampler_->GetDeviceMemoryBytes());
+    int64_t draft_token_workspace_bytes = 0;
+    if (draft_token_workspace_manager_.defined()) {
+      DraftTokenWorkspaceStats workspace_stats = draft_token_workspace_manager_->GetStats();
+      // The workspace lives on the draft device, except for the buffer the draft probabilities
+      // are copied into for verification.
+      draft_token_workspace_bytes = workspace_stats.peer_buffer_bytes +
+                                    (HasSeparateDraftDevice() ? 0 : workspace_stats.device_bytes);
+    }
+    memory_accountant_.Update("draft_token_workspace", draft_token_workspace_bytes);
+    // The temporary buffers of the model functions are allocated from the pooled allocator.
+    memory_accountant_.Update("function_temp_buffers",
+                              memory::MemoryManager::GetOrCreateAllocator(
+                                  device_, memory::AllocatorType::kPooled)
+                                  ->UsedMemory());
+    // - The empty token slots in the used pages, which are mostly in the last page of each
+    // sequence. Forked sequences share pages, which can make the fraction negative.
+    int64_t num_used_pages = kv_cache_bytes_ > 0
+                                 ? kv_cache_total_pages_ - models_[0]->GetNumAvailablePages()
+                                 : 0;
+    double fragmentation = 0.0;
+    if (num_used_pages > 0) {
+      fragmentation = 1.0 - static_cast<double>(models_[0]->GetCurrentTotalSequenceLength()) /
+                                (num_used_pages * engine_config_->kv_cache_page_size);
+    }
+    memory_accountant_.SetKVCachePageFragmentation(std::max(fragmentation, 0.0));
+    const DeviceMemoryStats& stats = memory_accountant_.GetStats();
+    if (!memory_budget_exceeded_ && stats.current_bytes > stats.budget_bytes) {
+      memory_budget_exceeded_ = true;
+      LOG(WARNING) << "The accounted device memory " << (stats.current_bytes >> 20)
+                   << " MB exceeds the budget " << (stats.budget_bytes >> 20)
+                   << " MB set by \"gpu_memory_utilization\". See \"device_memory\" in the engine "
+                      "stats for the breakdown.";
+    }
+  }
+
+  /*!
+   * \brief Set the device power state of the engine config to the power controller, and
+   * initialize the prefill chunk size controller with the scaled prefill chunk size.
+   */
+  void ApplyDevicePowerState(const EngineConfig& engine_config) {
+    DevicePowerController& power_controller = estate_->power_controller;
+    if (power_controller.state != engine_config->device_power_state) {
+      LOG(INFO) << "The device power state changes to \""
+                << DevicePowerStateToString(engine_config->device_power_state) << "\".";
+    }
+    power_controller.SetState(engine_config->device_power_state);
+    estate_->prefill_chunk_controller.Init(
+        power_controller.ScaleCapacity(engine_config->prefill_chunk_size),
+        engine_config->adaptive_prefill_target_itl_ms,
+        /*hybrid_prefill=*/engine_config->prefill_mode == PrefillMode::kHybrid &&
+            models_.size() == 1);
+    estate_->step_planner.Init(
+        engine_config->step_token_budget > 0
+            ? static_cast<int>(power_controller.ScaleCapacity(engine_config->step_token_budget))
+            : 0);
+  }
+
+  /*!
+   * \brief Idle after a step for the fraction of the step time given by the device power
+   * state, so that the device cools down between the steps of running requests.
+   * \param step_start The start time of the step.
+   */
+  void PaceStep(std::chrono::high_resolution_clock::time_point step_start) {
+    double idle_fraction = estate_->power_controller.idle_fraction;
+    if (idle_fraction <= 0 || estate_->running_queue.empty()) {
+      return;
+    }
+    auto step_time = std::chrono::high_resolution_clock::now() - step_start;
+    std::this_thread::sleep_for(step_time * idle_fraction);
+  }
+
+  /*!
+   * \brief Release the free blocks cached by the pooled allocator, which hold the transient
+   * buffers of the model, logit processor and sampler functions, when the engine has no
+   * request and either runs in the low-memory mode or the device power state is above nominal.
+   */
+  void ReleaseTransientBuffersIfIdle() {
+    if ((engine_config_->mode == EngineMode::kLowMemory ||
+         engine_config_->device_power_state != DevicePowerState::kNominal) &&
+        estate_->running_queue.empty() && estate_->waiting_queue.empty() &&
+        estate_->prefill_only_queue.empty()) {
+      memory::MemoryManager::GetOrCreateAllocator(device_, memory::AllocatorType::kPooled)
+          ->Clear();
+    }
+  }
+
+  /*! \brief Compact the KV cache when the engine has no request left to run. */
+  void CompactKVCacheIfIdle() {
+    if (engine_config_->kv_cache_idle_compaction && estate_->running_queue.empty() &&
+        estate_->waiting_queue.empty() && estate_->prefill_only_queue.empty()) {
+      CompactKVCache(estate_, models_);
+    }
+  }
+
+  /*!
+   * \brief Pick the max batch size and the prefill chunk size from the throughputs measured
+   * with synthetic requests, or load them from the autotune cache. The engine is reconfigured
+   * with them and warmed up with synthetic requests, and is reset afterwards.
+   * \param key The autotune key.
+   */
+  void RunStartupAutotune(const std::string& key) {
+    // The smallest capacity reaching the ratio of the best throughput is picked.
+    constexpr double kThroughputRatio = 0.9;
+    constexpr int64_t kMinPrefillChunkSize = 128;
+    constexpr int kDecodePromptLength = 16;
+    constexpr int kNumDecodeTokens = 16;
+    // The outputs of the synthetic requests are not streamed back.
+    Optional<PackedFunc> request_stream_callback = request_stream_callback_;
+    request_stream_callback_ = PackedFunc([](TVMArgs args, TVMRetValue* rv) {});
+    int max_num_sequence = engine_config_->max_num_sequence;
+    int64_t prefill_chunk_size = engine_config_->prefill_chunk_size;
+    int64_t max_total_sequence_length = engine_config_->max_total_sequence_length;
+    int64_t max_prompt_length = engine_config_->max_single_sequence_length - 1;
+    int64_t vocab_size = token_table_->size();
+    int64_t num_synthetic_requests = 0;
+
+    // Run synthetic requests to completion, and return the prefill and decode throughputs.
+    auto f_run = [&](int num_requests, int64_t prompt_length, int max_tokens) {
+      EngineStats& stats = estate_->stats;
+      double prefill_time = stats.engine_total_prefill_time;
+      double decode_time = stats.engine_total_decode_time;
+      int64_t prefill_length = stats.total_prefill_length;
+      int64_t decode_length = stats.total_decode_length;
+      picojson::object generation_cfg_json;
+      generation_cfg_json["max_tokens"] = picojson::value(static_cast<int64_t>(max_tokens));
+      generation_cfg_json["ignore_eos"] = picojson::value(true);
+      generation_cfg_json["temperature"] = picojson::value(0.0);
+      GenerationConfig generation_cfg(picojson::value(generation_cfg_json).serialize(), NullOpt);
+      for (int i = 0; i < num_requests; ++i, ++num_synthetic_requests) {
+        // Distinct first tokens keep the synthetic prompts from matching in prefix cache.
+        std::vector<int32_t> token_ids(prompt_length);
+        for (int64_t j = 0; j < prompt_length; ++j) {
+          token_ids[j] = (num_synthetic_requests + j) % vocab_size;
+        }
+        AddRequest(Request("autotune-" + std::to_string(num_synthetic_requests),
+                           {TokenData(token_ids)}, generation_cfg));
+      }
+      while (!Empty()) {
+        Step();
+      }
+      prefill_time = stats.engine_total_prefill_time - prefill_time;
+      decode_time = stats.engine_total_decode_time - decode_time;
+      return std::make_pair(
+          prefill_time > 0 ? (stats.total_prefill_length - prefill_length) / prefill_time : 0.0,
+          decode_time > 0 ? (stats.total_decode_length - decode_length) / decode_time : 0.0);
+    };
+    auto f_reconfigure = [&](int num_sequence, int64_t chunk_size) {
+      if (num_sequence == engine_config_->max_num_sequence &&
+          chunk_size == engine_config_->prefill_chunk_size) {
+        return true;
+      }
+      picojson::object config;
+      config["max_num_sequence"] = picojson::value(static_cast<int64_t>(num_sequence));
+      config["prefill_chunk_size"] = picojson::value(chunk_size);
+      Result<EngineConfig> res = Reconfigure(picojson::value(config).serialize());
+      if (res.IsErr()) {
+        LOG(WARNING) << "Autotuning cannot reconfigure the engine: " << res.UnwrapErr();
+        return false;
+      }
+      return true;
+    };
+    // The largest batch whose synthetic requests fit the KV cache.
+    auto f_max_decode_batch = [&](int num_sequence) {
+      return static_cast<int>(std::min<int64_t>(
+          num_sequence,
+          std::max<int64_t>(max_total_sequence_length / (kDecodePromptLength + kNumDecodeTokens),
+                            1)));
+    };
+
+    std::string cache_dir = engine_config_->autotune_cache_dir;
+    std::optional<EngineAutotuneResult> result;
+    if (!cache_dir.empty()) {
+      result = LoadEngineAutotuneResult(cache_dir, key, max_num_sequence, prefill_chunk_size);
+    }
+    if (!result.has_value()) {
+      // - Measure the prefill throughput of each chunk size with one prompt filling the chunk.
+      std::vector<std::pair<int64_t, double>> prefill_throughputs;
+      for (int64_t chunk_size :
+           GetEngineAutotuneCandidates(prefill_chunk_size, kMinPrefillChunkSize)) {
+        if (!f_reconfigure(max_num_sequence, chunk_size)) {
+          continue;
+        }
+        int64_t prompt_length = std::min(chunk_size, max_prompt_length);
+        f_run(/*num_requests=*/1, prompt_length, /*max_tokens=*/1);
+        prefill_throughputs.emplace_back(
+            chunk_size, f_run(/*num_requests=*/1, prompt_length, /*max_tokens=*/1).first);
+      }
+      int64_t chosen_chunk_size =
+          prefill_throughputs.empty()
+              ? prefill_chunk_size
+              : SelectEngineAutotuneCandidate(prefill_throughputs, kThroughputRatio);
+      // - Measure the decode throughput of each batch size, after warming up at the largest.
+      std::vector<std::pair<int64_t, double>> decode_throughputs;
+      if (f_reconfigure(max_num_sequence, chosen_chunk_size)) {
+        int max_decode_batch = f_max_decode_batch(max_num_sequence);
+        f_run(max_decode_batch, kDecodePromptLength, kNumDecodeTokens);
+        for (int64_t batch_size : GetEngineAutotuneCandidates(max_decode_batch, 1)) {
+          decode_throughputs.emplace_back(
+              batch_size, f_run(batch_size, kDecodePromptLength, kNumDecodeTokens).second);
+        }
+      }
+      int chosen_batch_size = max_num_sequence;
+      if (!decode_throughputs.empty()) {
+        chosen_batch_size = static_cast<int>(
+            SelectEngineAutotuneCandidate(decode_throughputs, kThroughputRatio));
+        // The batch size limited by the synthetic requests does not bound the real ones.
+        if (chosen_batch_size == decode_throughputs.back().first) {
+          chosen_batch_size = max_num_sequence;
+        }
+      }
+      result = EngineAutotuneResult{chosen_batch_size, chosen_chunk_size};
+      if (!cache_dir.empty()) {
+        SaveEngineAutotuneResult(cache_dir, key, result.value());
+      }
+    }
+
+    // - Apply the result, and warm up the kernels and allocators at the chosen capacities.
+    if (!f_reconfigure(result->max_num_sequence, result->prefill_chunk_size)) {
+      f_reconfigure(max_num_sequence, prefill_chunk_size);
+    }
+    f_run(/*num_requests=*/1,
+          std::min(engine_config_->prefill_chunk_size, max_prompt_length), /*max_tokens=*/1);
+    f_run(f_max_decode_batch(engine_config_->max_num_sequence), kDecodePromptLength,
+          kNumDecodeTokens);
+    Reset();
+    request_stream_callback_ = std::move(request_stream_callback);
+    LOG(INFO) << "Autotuned the engine with max batch size " << engine_config_->max_num_sequence
+              << " and prefill chunk size " << engine_config_->prefill_chunk_size << ".";
+  }
+
   Optional<Session> CreateDiscoSession(const std::vector<picojson::object>& model_configs,
                                        Device device) {
     const auto& base_model_config = model_configs[0];
@@ -411,9 +1358,11 @@ class EngineImpl : public Engine {
         LOG(FATAL) << "ValueError: Multi-GPU on device " << DLDeviceType2Str(device.device_type)
                    << " is not supported. Currently, only NCCL and RCCL are integrated.";
       }
+      // The shards run on the consecutive devices starting from the given device, so that
+      // data-parallel replicas can run on disjoint device groups.
       std::vector<int64_t> device_ids(num_shards);
       for (int i = 0; i < num_shards; ++i) {
-        device_ids[i] = i;
+        device_ids[i] = device.device_id + i;
       }
       session = Session::ProcessSession(num_shards, f_create_process_pool, "mlc_llm.cli.worker");
       session.value()->InitCCL(ccl, ShapeTuple(device_ids));
@@ -429,6 +1378,437 @@ class EngineImpl : public Engine {
   }
 
  private:
+  /*!
+   * \brief Get the number of the extra RNN state slots holding the recycling sequences and the
+   * state checkpoints of prefix cache, which are not counted in the max batch size.
+   */
+  static int GetNumRecyclingRNNStateSlots(const EngineConfig& engine_config) {
+    if (engine_config->prefix_cache_mode != PrefixCacheMode::kRadix) {
+      return 0;
+    }
+    // The RNN state has a fixed number of slots, so that the capacity cannot be infinite.
+    return engine_config->prefix_cache_max_num_recycling_seqs == -1
+               ? engine_config->max_num_sequence
+               : engine_config->prefix_cache_max_num_recycling_seqs;
+  }
+
+  /*!
+   * \brief Set the capacities of the models in the engine config, create their KV cache and
+   * allocate their workspaces.
+   */
+  void CreateKVCacheAndWorkspaces(const EngineConfig& engine_config) {
+    model_workspaces_.clear();
+    for (int model_id = 0; model_id < static_cast<int>(models_.size()); ++model_id) {
+      const Model& model = models_[model_id];
+      // The small draft model holds a forked sequence for each branch of draft token trees.
+      bool fork_draft_branches =
+          model_id > 0 && engine_config->speculative_mode == SpeculativeMode::kSmallDraft;
+      int max_num_sequence =
+          engine_config->max_num_sequence * (fork_draft_branches ? spec_tree_width_ : 1);
+      model->SetMaxNumSequence(max_num_sequence);
+      model->SetPrefillChunkSize(engine_config->prefill_chunk_size);
+      model->SetImageEmbeddingCacheSize(engine_config->image_embedding_cache_size);
+      int max_num_state_seqs = max_num_sequence;
+      if (model->GetMetadata().kv_state_kind == KVStateKind::kRNNState) {
+        max_num_state_seqs += GetNumRecyclingRNNStateSlots(engine_config);
+      }
+      model->CreateKVCache(engine_config->kv_cache_page_size, max_num_state_seqs,
+                           engine_config->max_total_sequence_length,
+                           engine_config->prefill_chunk_size, engine_config->max_history_size,
+                           engine_config->kv_cache_dtype);
+      if (engine_config->mode == EngineMode::kLowMemory &&
+          engine_config->speculative_mode == SpeculativeMode::kDisable) {
+        // Without speculative decoding, the hidden states are only gathered by prefill-only
+        // requests after their embeddings are consumed, so both share one buffer. The two
+        // tensors come from the same allocation function and have the same shape.
+        ObjectRef hidden_states = model->AllocHiddenStatesTensor();
+        model_workspaces_.push_back(ModelWorkspace{hidden_states, hidden_states});
+      } else {
+        model_workspaces_.push_back(
+            ModelWorkspace{model->AllocEmbeddingTensor(), model->AllocHiddenStatesTensor()});
+      }
+    }
+    // The KV cache is empty right after creation, so all its pages are available.
+    kv_cache_total_pages_ = models_[0]->GetNumAvailablePages();
+    // - Account the memory that stays fixed until the next KV cache creation.
+    params_bytes_ = 0;
+    kv_cache_bytes_ = 0;
+    for (int model_id = 0; model_id < static_cast<int>(models_.size()); ++model_id) {
+      if (!IsOnEngineDevice(model_id)) {
+        continue;
+      }
+      ModelMetadata metadata = GetDeviceParamsMetadata(models_[model_id]);
+      params_bytes_ += GetModelParamsBytes(metadata);
+      if (metadata.kv_state_kind == KVStateKind::kKVCache) {
+        kv_cache_bytes_ += static_cast<int64_t>(
+            kv_cache_total_pages_ * engine_config->kv_cache_page_size *
+            GetKVCacheBytesPerToken(metadata, engine_config->kv_cache_dtype,
+                                    engine_config->kv_cache_page_size));
+      }
+    }
+    TVMRetValue rv;
+    DeviceAPI::Get(device_)->GetAttr(device_, DeviceAttrKind::kTotalGlobalMemory, &rv);
+    int64_t device_total_bytes = rv;
+    memory_accountant_.SetDeviceBudget(
+        device_total_bytes,
+        static_cast<int64_t>(device_total_bytes * engine_config->gpu_memory_utilization));
+  }
+
+  /*! \brief Register the engine-wide metric series, which live as long as the engine. */
+  void RegisterMetrics() {
+    kv_cache_free_pages_ = metrics_->GetOrAddSeries(
+        "mlc_kv_cache_free_pages", "The number of free KV cache pages.", MetricType::kGauge);
+    kv_cache_used_pages_ = metrics_->GetOrAddSeries(
+        "mlc_kv_cache_used_pages", "The number of used KV cache pages.", MetricType::kGauge);
+    running_requests_ = metrics_->GetOrAddSeries(
+        "mlc_running_requests", "The number of requests in the running queue.",
+        MetricType::kGauge);
+    waiting_requests_ = metrics_->GetOrAddSeries(
+        "mlc_waiting_requests", "The number of requests in the waiting queue.",
+        MetricType::kGauge);
+    prefix_cache_hit_tokens_ = metrics_->GetOrAddSeries(
+        "mlc_prefix_cache_hit_tokens", "The number of prompt tokens served by the prefix cache.",
+        MetricType::kCounter);
+    spec_draft_tokens_ = metrics_->GetOrAddSeries(
+        "mlc_spec_draft_tokens", "The number of draft tokens proposed in speculative decoding.",
+        MetricType::kCounter);
+    spec_accepted_tokens_ = metrics_->GetOrAddSeries(
+        "mlc_spec_accepted_tokens", "The number of draft tokens accepted in speculative decoding.",
+        MetricType::kCounter);
+    rejected_requests_ = metrics_->GetOrAddSeries(
+        "mlc_rejected_requests", "The number of requests rejected by load shedding.",
+        MetricType::kCounter);
+  }
+
+  /*! \brief Register the step latency histogram of each engine action. */
+  void RegisterActionMetrics() {
+    // Exponential buckets from 1ms to about 8s.
+    std::vector<double> bucket_bounds;
+    for (double bound = 1e-3; bound < 10; bound *= 2) {
+      bucket_bounds.push_back(bound);
+    }
+    action_step_seconds_.clear();
+    for (const EngineAction& action : actions_) {
+      action_step_seconds_.push_back(metrics_->GetOrAddSeries(
+          "mlc_engine_action_step_seconds", "The latency of engine action steps in seconds.",
+          MetricType::kHistogram, "action=\"" + std::string(action->Name()) + "\"",
+          bucket_bounds));
+    }
+  }
+
+  /*!
+   * \brief Collect the device time of the phases of the step into the engine statistics.
+   * This synchronizes with the device, and is only done under device phase timing.
+   */
+  void CollectDeviceStepTimes() {
+    if (device_step_timer_ == nullptr) {
+      return;
+    }
+    std::array<double, kNumStepPhases> phase_time =
+        device_step_timer_->Collect(TraceRecorderThreadScope::Current());
+    bool timed = false;
+    for (int i = 0; i < kNumStepPhases; ++i) {
+      estate_->stats.device_phase_time[i] += phase_time[i];
+      timed |= phase_time[i] > 0;
+    }
+    if (timed) {
+      ++estate_->stats.num_device_timed_steps;
+    }
+  }
+
+  /*! \brief Update the gauges and counters from the engine state after a step. */
+  void UpdateMetrics() {
+    int64_t num_free_pages = models_[0]->GetNumAvailablePages();
+    kv_cache_free_pages_->Set(num_free_pages);
+    kv_cache_used_pages_->Set(std::max<int64_t>(kv_cache_total_pages_ - num_free_pages, 0));
+    running_requests_->Set(estate_->running_queue.size());
+    waiting_requests_->Set(estate_->waiting_queue.size());
+    prefix_cache_hit_tokens_->Set(estate_->prefix_cache->GetStats().num_hit_tokens);
+    spec_draft_tokens_->Set(estate_->stats.total_draft_length);
+    spec_accepted_tokens_->Set(estate_->stats.total_accepted_length);
+    rejected_requests_->Set(estate_->stats.num_rejected_requests);
+  }
+
+  /*!
+   * \brief Create the logit processor, the sampler and the engine actions, which are sized
+   * by the capacities in the engine config.
+   */
+  void CreateActions(const EngineConfig& engine_config) {
+    // - Create the logit processor and sampler, and
+    // the DraftTokenWorkspaceManager for speculative decoding.
+    int max_num_tokens = engine_config->max_num_sequence;
+    DraftTokenWorkspaceManager draft_token_workspace_manager{nullptr};
+    if (engine_config->speculative_mode != SpeculativeMode::kDisable) {
+      max_num_tokens *= engine_config->spec_draft_length * spec_tree_width_ + 1;
+    }
+    if (engine_config->speculative_mode != SpeculativeMode::kDisable &&
+        engine_config->speculative_mode != SpeculativeMode::kNGram &&
+        engine_config->speculative_mode != SpeculativeMode::kLayerSkip) {
+      // multiply max num_tokens by two so we can do ping-pong swaping during draft/verify process
+      // The workspace is on the device of the draft models.
+      draft_token_workspace_manager =
+          models_[HasSeparateDraftDevice() ? 1 : 0]->CreateDraftTokenWorkspaceManager(
+              max_num_tokens * 2);
+      draft_token_workspace_manager->AllocWorkspace(
+          /*require_hidden_states=*/engine_config->speculative_mode == SpeculativeMode::kEagle);
+    }
+    LogitProcessor logit_processor =
+        models_[0]->CreateLogitProcessor(max_num_tokens, trace_recorder_);
+    Sampler sampler = models_[0]->CreateSampler(max_num_tokens, static_cast<int>(models_.size()),
+                                                trace_recorder_);
+    draft_token_workspace_manager_ = draft_token_workspace_manager;
+    logit_processor_ = logit_processor;
+    sampler_ = sampler;
+    // The draft models on the draft device process and sample their logits there.
+    LogitProcessor draft_logit_processor = logit_processor;
+    Sampler draft_sampler = sampler;
+    if (HasSeparateDraftDevice()) {
+      draft_logit_processor = models_[1]->CreateLogitProcessor(max_num_tokens, trace_recorder_);
+      draft_sampler = models_[1]->CreateSampler(
+          max_num_tokens, static_cast<int>(models_.size()), trace_recorder_);
+    }
+    // - Initialize engine actions that represent state transitions.
+    if (engine_config->speculative_mode == SpeculativeMode::kNGram ||
+        engine_config->speculative_mode == SpeculativeMode::kLayerSkip) {
+      // The n-gram and early-exit drafts are proposed in the verify steps, which need no draft
+      // models.
+      actions_ = {EngineAction::NewRequestPrefill(models_,            //
+                                                  logit_processor,    //
+                                                  sampler,            //
+                                                  model_workspaces_,  //
+                                                  engine_config,      //
+                                                  model_configs_,     //
+                                                  trace_recorder_),
+                  EngineAction::BatchVerify(models_, logit_processor, sampler, model_workspaces_,
+                                            draft_token_workspace_manager, engine_config,
+                                            trace_recorder_)};
+    } else if (engine_config->speculative_mode != SpeculativeMode::kDisable) {
+      // Speculative decoding is only possible for more than one model.
+      ICHECK_GT(models_.size(), 1U);
+      switch (engine_config->speculative_mode) {
+        case SpeculativeMode::kEagle:
+          actions_ = {
+              EngineAction::EagleNewRequestPrefill(models_,                        //
+                                                   logit_processor,                //
+                                                   sampler,                        //
+                                                   model_workspaces_,              //
+                                                   draft_token_workspace_manager,  //
+                                                   engine_config,                  //
+                                                   model_configs_,                 //
+                                                   trace_recorder_),
+              EngineAction::EagleBatchDraft(models_, logit_processor, sampler, model_workspaces_,
+                                            draft_token_workspace_manager, trace_recorder_,
+                                            engine_config->spec_draft_length,
+                                            engine_config->adaptive_spec_draft_length,
+                                            engine_config->spec_max_batch_size),
+              EngineAction::EagleBatchVerify(models_, logit_processor, sampler, model_workspaces_,
+                                             draft_token_workspace_manager, engine_config,
+                                             trace_recorder_)};
+          break;
+        case SpeculativeMode::kMedusa:
+          actions_ = {EngineAction::EagleNewRequestPrefill(models_,                        //
+                                                           logit_processor,                //
+                                                           sampler,                        //
+                                                           model_workspaces_,              //
+                                                           draft_token_workspace_manager,  //
+                                                           engine_config,                  //
+                                                           model_configs_,                 //
+                                                           trace_recorder_),
+                      EngineAction::EagleBatchVerify(
+                          models_, logit_processor, sampler, model_workspaces_,
+                          draft_token_workspace_manager, engine_config, trace_recorder_)};
+          break;
+        default:
+          actions_ = {
+              EngineAction::NewRequestPrefill(models_,            //
+                                              logit_processor,    //
+                                              sampler,            //
+                                              model_workspaces_,  //
+                                              engine_config,      //
+                                              model_configs_,     //
+                                              trace_recorder_),
+              EngineAction::BatchDraft(models_, draft_logit_processor, draft_sampler,
+                                       model_workspaces_, draft_token_workspace_manager,
+                                       trace_recorder_, engine_config->spec_draft_length,
+                                       spec_tree_width_, engine_config->adaptive_spec_draft_length,
+                                       engine_config->spec_max_batch_size),
+              EngineAction::BatchVerify(models_, logit_processor, sampler, model_workspaces_,
+                                        draft_token_workspace_manager, engine_config,
+                                        trace_recorder_)};
+      }
+    } else {
+      actions_ = {
+          EngineAction::NewRequestPrefill(models_,            //
+                                          logit_processor,    //
+                                          sampler,            //
+                                          model_workspaces_,  //
+                                          engine_config,      //
+                                          model_configs_,     //
+                                          trace_recorder_),
+          EngineAction::BatchDecode(models_, logit_processor, sampler, engine_config,
+                                    trace_recorder_)};
+      if (engine_config->grammar_jump_forward_max_tokens > 0) {
+        // Jump-forward decoding takes over the decode steps where some running request has
+        // tokens forced by its grammar.
+        actions_ = {actions_[0],
+                    EngineAction::BatchJumpForward(models_, logit_processor, sampler,
+                                                   model_workspaces_, engine_config,
+                                                   trace_recorder_),
+                    actions_[1]};
+      }
+      if (engine_config->engine_role == EngineRole::kPrefill) {
+        // The prefilled requests are exported to decode engines instead of being decoded here.
+        actions_ = {actions_[0]};
+      }
+    }
+    if (models_.size() == 1) {
+      // The prefill-only requests are prefilled ahead of the other actions in each step.
+      actions_.insert(actions_.begin(), EngineAction::BatchPrefillOnly(
+                                            models_, model_workspaces_, engine_config,
+                                            trace_recorder_));
+    }
+    RegisterActionMetrics();
+  }
+
+  /*!
+   * \brief Get the prompt tokens of a request to initialize the n-gram index with, where each
+   * non-token input is replaced by a negative token.
+   */
+  static std::vector<int32_t> GetNGramIndexPromptTokens(const Request& request) {
+    std::vector<int32_t> tokens;
+    tokens.reserve(request->input_total_length);
+    for (const Data& input : request->inputs) {
+      if (const auto* token_data = input.as<TokenDataNode>()) {
+        tokens.insert(tokens.end(), token_data->token_ids.begin(), token_data->token_ids.end());
+      } else {
+        tokens.push_back(-1);
+      }
+    }
+    return tokens;
+  }
+
+  /*!
+   * \brief Check whether the engine runs beam search. Beam search expands the beams in the
+   * decode steps of the single model, and forks the KV cache of the beams.
+   */
+  bool SupportBeamSearch() const {
+    return engine_config_->speculative_mode == SpeculativeMode::kDisable &&
+           engine_config_->engine_role != EngineRole::kPrefill &&
+           models_[0]->GetSlidingWindowSize() == -1;
+  }
+
+  /*!
+   * \brief Acquire the slot of the LoRA adapter the given request applies.
+   * \return The adapter slot, or -1 if the request applies no adapter or all the adapter
+   * slots are in use.
+   */
+  int AcquireLoRAAdapter(const Request& request) {
+    const String& lora_adapter = request->generation_cfg->lora_adapter;
+    if (lora_adapter.empty()) {
+      return -1;
+    }
+    CHECK(estate_->lora_adapter_pool.defined())
+        << "The request " << request->id << " applies a LoRA adapter, which requires the engine "
+        << "to be created with positive \"max_num_lora_adapters\".";
+    return estate_->lora_adapter_pool->Acquire(lora_adapter, models_[0]);
+  }
+
+  /*!
+   * \brief Check if the prefixes in prefix cache can be exported to and imported from peer
+   * engines, which needs the radix prefix cache and the KV cache data to be copied out and in.
+   */
+  bool SupportPrefixKVHandoff() const {
+    // The quantized KV cache cannot be read and written in the activation data type.
+    bool support = engine_config_->prefix_cache_mode == PrefixCacheMode::kRadix &&
+                   engine_config_->kv_cache_dtype == KVCacheDType::kAuto;
+    for (const Model& model : models_) {
+      support &= model->SupportKVSwap();
+    }
+    return support;
+  }
+
+  /*!
+   * \brief Remove the given request from the engine state and the models, without invoking
+   * the request stream callback.
+   */
+  void RemoveRequestState(const RequestState& rstate) {
+    Request request = rstate->entries[0]->request;
+
+    // - Check if the request is running or pending.
+    auto it_running =
+        std::find(estate_->running_queue.begin(), estate_->running_queue.end(), request);
+    auto it_waiting =
+        std::find(estate_->waiting_queue.begin(), estate_->waiting_queue.end(), request);
+
+    estate_->request_states.erase(request->id);
+    if (rstate->lora_adapter_slot != -1) {
+      estate_->lora_adapter_pool->Release(rstate->lora_adapter_slot);
+    }
+    if (it_running != estate_->running_queue.end()) {
+      // The request to remove is in running queue
+      estate_->running_queue.erase(it_running);
+
+      for (int i = static_cast<int>(rstate->entries.size()) - 1; i >= 0; --i) {
+        if (estate_->prefix_cache->HasSequence(rstate->entries[i]->mstates[0]->internal_id)) {
+          estate_->prefix_cache->RecycleSequence(rstate->entries[i]->mstates[0]->internal_id,
+                                                 /*lazy=*/false);
+        } else {
+          if (rstate->entries[i]->status != RequestStateStatus::kAlive) {
+            estate_->id_manager.RecycleId(rstate->entries[i]->mstates[0]->internal_id);
+            continue;
+          }
+          RemoveRequestFromModel(estate_, rstate->entries[i]->mstates[0]->internal_id, models_);
+          estate_->id_manager.RecycleId(rstate->entries[i]->mstates[0]->internal_id);
+        }
+      }
+    }
+    if (it_waiting != estate_->waiting_queue.end()) {
+      // The request to remove is in waiting queue
+      estate_->waiting_queue.erase(it_waiting);
+      if (estate_->kv_swap_pool.defined()) {
+        // Drop the KV data swapped out when the request was preempted.
+        for (const RequestStateEntry& rsentry : rstate->entries) {
+          estate_->kv_swap_pool->Discard(rsentry->mstates[0]->internal_id);
+        }
+      }
+    }
+  }
+
+  /*! \brief Get the metadata of a model without the parameters offloaded to host memory. */
+  static ModelMetadata GetDeviceParamsMetadata(const Model& model) {
+    ModelMetadata metadata = model->GetMetadata();
+    const std::unordered_set<std::string>& offloaded_params = model->GetOffloadedParams();
+    metadata.params.erase(std::remove_if(metadata.params.begin(), metadata.params.end(),
+                                         [&offloaded_params](const ModelMetadata::Param& param) {
+                                           return offloaded_params.count(param.name) > 0;
+                                         }),
+                          metadata.params.end());
+    return metadata;
+  }
+
+  /*! \brief Whether the draft models run on another device than the engine device. */
+  bool HasSeparateDraftDevice() const {
+    return draft_device_.device_type != device_.device_type ||
+           draft_device_.device_id != device_.device_id;
+  }
+
+  /*! \brief Whether the model runs on the engine device, where the memory budget applies. */
+  bool IsOnEngineDevice(int model_id) const { return model_id == 0 || !HasSeparateDraftDevice(); }
+
+  /*!
+   * \brief Get the metadata of a model for the memory budget of the engine device. The models
+   * on the draft device take no parameter, KV cache or temporary buffer memory there.
+   */
+  ModelMetadata GetEngineDeviceMetadata(int model_id) const {
+    ModelMetadata metadata = GetDeviceParamsMetadata(models_[model_id]);
+    if (!IsOnEngineDevice(model_id)) {
+      metadata.params.clear();
+      metadata.memory_usage.clear();
+      metadata.kv_cache_metadata.num_hidden_layers = 0;
+    }
+    return metadata;
+  }
+
   Result<EngineConfig> AutoDecideEngineConfig(const std::string& engine_config_json_str,
                                               const std::vector<picojson::object>& model_configs) {
     using TResult = Result<EngineConfig>;
@@ -445,6 +1825,10 @@ class EngineImpl : public Engine {
     double gpu_memory_utilization =
         json::LookupOrDefault<double>(config, "gpu_memory_utilization", n->gpu_memory_utilization);
     bool verbose = json::LookupOrDefault<bool>(config, "verbose", n->verbose);
+    KVCacheDType kv_cache_dtype = KVCacheDTypeFromString(json::LookupOrDefault<std::string>(
+        config, "kv_cache_dtype", KVCacheDTypeToString(n->kv_cache_dtype)));
+    int kv_cache_page_size =
+        json::LookupOrDefault<int64_t>(config, "kv_cache_page_size", n->kv_cache_page_size);
 
     // - Get the config fields that can be automatically inferred.
     std::optional<int64_t> max_num_sequence =
@@ -463,10 +1847,28 @@ class EngineImpl : public Engine {
                                           max_single_sequence_length, prefill_chunk_size,
                                           max_history_size};
 
+    // - Select the parameters offloaded to host memory, which take no device memory.
+    int64_t param_offload_bytes =
+        json::LookupOrDefault<int64_t>(config, "param_offload_mb", n->param_offload_mb) * 1024 *
+        1024;
+    for (const Model& model : models_) {
+      std::unordered_set<std::string> offloaded_params;
+      if (param_offload_bytes > 0) {
+        offloaded_params = SelectOffloadedParams(model->GetMetadata(), param_offload_bytes);
+      }
+      model->SetOffloadedParams(std::move(offloaded_params));
+      int64_t offloaded_bytes = GetModelParamsBytes(model->GetMetadata()) -
+                                GetModelParamsBytes(GetDeviceParamsMetadata(model));
+      if (offloaded_bytes > 0) {
+        LOG(INFO) << "Offloading " << model->GetOffloadedParams().size() << " parameters ("
+                  << offloaded_bytes / 1024 / 1024 << " MB) to page-locked host memory.";
+      }
+      param_offload_bytes -= offloaded_bytes;
+    }
     // - Get the model metadata.
     std::vector<ModelMetadata> model_metadata;
-    for (const Model& model : models_) {
-      model_metadata.push_back(model->GetMetadata());
+    for (int i = 0; i < static_cast<int>(models_.size()); ++i) {
+      model_metadata.push_back(GetEngineDeviceMetadata(i));
     }
     // - Select from kv cache or RNN state.
     Result<bool> use_kv_cache = ModelsUseKVCache(model_configs);
@@ -477,8 +1879,8 @@ class EngineImpl : public Engine {
     if (use_kv_cache.Unwrap()) {
       // - Infer configuration.
       inferrable_cfg_res = InferrableEngineConfig::InferForKVCache(
-          mode, device_, gpu_memory_utilization, model_configs, model_metadata, inferrable_cfg,
-          verbose);
+          mode, device_, gpu_memory_utilization, kv_cache_dtype, kv_cache_page_size,
+          model_configs, model_metadata, inferrable_cfg, verbose);
     } else {
       // - Infer configuration.
       inferrable_cfg_res = InferrableEngineConfig::InferForRNNState(
@@ -498,12 +1900,29 @@ class EngineImpl : public Engine {
     return TResult::Ok(EngineConfig::FromJSONAndInferredConfig(config, inferrable_cfg));
   }
 
-  /*! \brief Set the maximum threading backend concurrency. */
+  /*!
+   * \brief Set the maximum threading backend concurrency, and pin the engine loop and the
+   * threading backend pool to the configured NUMA node.
+   */
   void SetThreadMaxConcurrency() {
     int host_cpu_usage = 1;
     for (Model model : models_) {
       host_cpu_usage += model->EstimateHostCPURequirement();
     }
+    if (engine_config_->host_numa_node >= 0) {
+      std::vector<unsigned int> cpus = GetNUMANodeCPUs(engine_config_->host_numa_node);
+      if (!cpus.empty() && SetCurrentThreadCPUAffinity(cpus)) {
+        // The engine loop runs on the calling thread. The pool threads share the cores of the
+        // node, less the cores estimated for the host threads.
+        int num_threads = std::min(std::max(static_cast<int>(cpus.size()) - host_cpu_usage, 1),
+                                   static_cast<int>(engine_config_->max_num_sequence));
+        tvm::runtime::threading::Configure(
+            tvm::runtime::threading::ThreadGroup::kSpecifyThreadShareAllCore, num_threads, cpus);
+        return;
+      }
+      LOG(WARNING) << "Cannot pin the host threads to the cores of NUMA node "
+                   << engine_config_->host_numa_node << ". The threads are not pinned.";
+    }
     int max_concurrency = tvm::runtime::threading::MaxConcurrency();
     tvm::runtime::threading::SetMaxConcurrency(
         std::min(std::max(max_concurrency - host_cpu_usage, 1), engine_config_->max_num_sequence));
@@ -527,22 +1946,58 @@ class EngineImpl : public Engine {
   EngineState estate_;
   // Configurations and singletons
   EngineConfig engine_config_;
+  // A boolean indicating whether the post-processing of decode is overlapped with the next decode.
+  bool overlap_scheduling_ = false;
   Tokenizer tokenizer_;
-  std::vector<std::string> token_table_;
+  std::shared_ptr<const TokenTable> token_table_;
   // Helper to get the grammar init context for requests.
   GrammarInitContextCache grammar_init_context_cache_;
   // Models
   Array<Model> models_;
   // Device that the models run on.
   Device device_;
+  // Device that the draft models run on, which is the engine device by default.
+  Device draft_device_;
+  // The config of each model.
+  std::vector<picojson::object> model_configs_;
+  // The width of draft token trees under speculative decoding.
+  int spec_tree_width_ = 1;
   // Workspace of each model.
   std::vector<ModelWorkspace> model_workspaces_;
+  // The draft token workspace manager for speculative decoding, or nullptr if disabled.
+  DraftTokenWorkspaceManager draft_token_workspace_manager_{nullptr};
+  // The logit processor and sampler shared by the engine actions.
+  LogitProcessor logit_processor_{nullptr};
+  Sampler sampler_{nullptr};
   // Request stream callback function
   Optional<PackedFunc> request_stream_callback_;
   // Engine actions.
   Array<EngineAction> actions_;
   // Event trace recorder.
   Optional<EventTraceRecorder> trace_recorder_;
+  // The device step timer under device phase timing, or nullptr if disabled.
+  std::unique_ptr<DeviceStepTimer> device_step_timer_ = nullptr;
+  // The key of the prefix cache snapshot, or empty if the snapshot is disabled.
+  std::string prefix_cache_snapshot_key_;
+  // The accountant of device memory, and the bytes of model parameters and KV cache.
+  DeviceMemoryAccountant memory_accountant_;
+  int64_t params_bytes_ = 0;
+  int64_t kv_cache_bytes_ = 0;
+  // Whether the accounted device memory has exceeded the budget, which is warned once.
+  bool memory_budget_exceeded_ = false;
+  // The metrics registry and the series updated by the engine.
+  MetricsRegistry metrics_ = MetricsRegistry::Create();
+  int64_t kv_cache_total_pages_ = 0;
+  MetricSeries* kv_cache_free_pages_ = nullptr;
+  MetricSeries* kv_cache_used_pages_ = nullptr;
+  MetricSeries* running_requests_ = nullptr;
+  MetricSeries* waiting_requests_ = nullptr;
+  MetricSeries* prefix_cache_hit_tokens_ = nullptr;
+  MetricSeries* spec_draft_tokens_ = nullptr;
+  MetricSeries* spec_accepted_tokens_ = nullptr;
+  MetricSeries* rejected_requests_ = nullptr;
+  // The step latency histogram of each engine action, aligned with actions_.
+  std::vector<MetricSeries*> action_step_seconds_;
 };
 
 Result<EngineCreationOutput> Engine::Create(const std::string& engine_config_json_str,
@@ -567,6 +2022,12 @@ class EngineModule : public ModuleNode {
   TVM_MODULE_VTABLE_ENTRY("init", &EngineModule::Init);
   TVM_MODULE_VTABLE_ENTRY("add_request", &EngineModule::AddRequest);
   TVM_MODULE_VTABLE_ENTRY("abort_request", &EngineModule::Abort);
+  TVM_MODULE_VTABLE_ENTRY("export_request", &EngineModule::ExportRequest);
+  TVM_MODULE_VTABLE_ENTRY("import_request", &EngineModule::ImportRequest);
+  TVM_MODULE_VTABLE_ENTRY_PACKED("get_prefix_cache_summary",
+                                 &EngineModule::GetPrefixCacheSummary);
+  TVM_MODULE_VTABLE_ENTRY("export_prefix_kv", &EngineModule::ExportPrefixKV);
+  TVM_MODULE_VTABLE_ENTRY("import_prefix_kv", &EngineModule::ImportPrefixKV);
   TVM_MODULE_VTABLE_ENTRY("step", &EngineModule::Step);
   TVM_MODULE_VTABLE_ENTRY("stats", &EngineModule::Stats);
   TVM_MODULE_VTABLE_ENTRY("reset", &EngineModule::Reset);
@@ -594,6 +2055,31 @@ class EngineModule : public ModuleNode {
   void AddRequest(Request request) { return GetEngine()->AddRequest(std::move(request)); }
   /*! \brief Redirection to `Engine::AbortRequest`. */
   void Abort(const String& request_id) { return GetEngine()->AbortRequest(request_id); }
+  /*! \brief Redirection to `Engine::ExportRequest`. */
+  RequestHandoff ExportRequest(const String& request_id, Device device) {
+    return GetEngine()->ExportRequest(request_id, device);
+  }
+  /*! \brief Redirection to `Engine::ImportRequest`. */
+  void ImportRequest(RequestHandoff handoff) {
+    return GetEngine()->ImportRequest(std::move(handoff));
+  }
+  /*!
+   * \brief Return the serialized summary of the prefix cache as bytes, or empty bytes if prefix
+   * cache is disabled. See PrefixCacheSummary.
+   */
+  void GetPrefixCacheSummary(TVMArgs args, TVMRetValue* rv) {
+    std::shared_ptr<const PrefixMatchIndex> match_index = GetEngine()->GetPrefixMatchIndex();
+    std::string summary = match_index != nullptr ? match_index->ExportSummary().Serialize() : "";
+    *rv = TVMByteArray{summary.data(), summary.size()};
+  }
+  /*! \brief Redirection to `Engine::ExportPrefixKV`. */
+  Optional<PrefixKVHandoff> ExportPrefixKV(IntTuple tokens, Device device) {
+    return GetEngine()->ExportPrefixKV(tokens, device);
+  }
+  /*! \brief Redirection to `Engine::ImportPrefixKV`. */
+  int64_t ImportPrefixKV(PrefixKVHandoff handoff) {
+    return GetEngine()->ImportPrefixKV(std::move(handoff));
+  }
   /*! \brief Redirection to `Engine::Step`. */
   void Step() { return GetEngine()->Step(); }
   /*! \brief Redirection to `Engine::GetRequestStreamCallback`. */
@@ -10,6 +10,8 @@
 
 #include "data.h"
 #include "event_trace_recorder.h"
+#include "metrics.h"
+#include "prefix_match_index.h"
 #include "request.h"
 #include "request_state.h"
 
@@ -22,6 +24,8 @@ using namespace tvm::runtime;
 typedef TypedPackedFunc<void(Array<RequestStreamOutput>)> FRequestStreamCallback;
 
 class Engine;
+class CancelledRequestSet;
+class TrafficCapture;
 
 /*!
  * \brief The output of engine creation, including the created engine and
@@ -76,12 +80,59 @@ class Engine {
   /*! \brief Reset the engine, clean up all running data and statistics. */
   virtual void Reset() = 0;
 
+  /*!
+   * \brief Change the KV cache capacities of the engine without reloading the models, so that
+   * the batch size can be traded against the context length at runtime. The KV cache and the
+   * workspaces are recreated with the new capacities. The running requests are preempted and
+   * resume afterwards, and the prefix cache sequences on device are evicted.
+   * When the capacities are unchanged, only the "device_power_state" is applied, which keeps
+   * the KV cache and the running requests.
+   * \param reconfig_json_str The JSON string with the new "max_num_sequence",
+   * "max_total_sequence_length", "prefill_chunk_size" and "device_power_state". The absent
+   * fields are kept.
+   * \return The engine config after the change, or an error when the new capacities do not
+   * fit the GPU memory budget, in which case the engine is left unchanged.
+   */
+  virtual Result<EngineConfig> Reconfigure(const std::string& reconfig_json_str) = 0;
+
   /*! \brief Check if the engine has no request to process. */
   virtual bool Empty() = 0;
 
   /*! \brief Get the statistics of the Engine in JSON string. */
   virtual String Stats() = 0;
 
+  /*! \brief Get the number of available KV cache pages of the model. */
+  virtual int64_t GetNumAvailablePages() = 0;
+
+  /*!
+   * \brief Get the metrics registry of the engine. The registry is updated by the engine
+   * thread at each step and can be rendered from other threads.
+   */
+  virtual MetricsRegistry GetMetricsRegistry() = 0;
+
+  /*!
+   * \brief Get the index of the prefix cache of the engine, which other threads can query
+   * without locking to estimate the cached prefix length of the requests they add.
+   * \return The index, or nullptr if prefix cache is disabled.
+   */
+  virtual std::shared_ptr<const PrefixMatchIndex> GetPrefixMatchIndex() = 0;
+
+  /*!
+   * \brief Get the set of cancelled requests of the engine. Other threads mark the requests
+   * in it when they submit the aborts, and the engine aborts the marked requests within the
+   * running step, so that their batch slots and KV cache are released without waiting for the
+   * abort to be processed between steps.
+   * \return The set of cancelled requests.
+   */
+  virtual std::shared_ptr<CancelledRequestSet> GetCancelledRequestSet() = 0;
+
+  /*!
+   * \brief Get the traffic capture of the engine, in which the threaded engine stamps the
+   * arrivals of the requests it adds, and records the outputs of the requests.
+   * \return The traffic capture, or nullptr if the capture is disabled.
+   */
+  virtual std::shared_ptr<TrafficCapture> GetTrafficCapture() = 0;
+
   /*! \brief Get the request stream callback function of the engine. */
   virtual Optional<PackedFunc> GetRequestStreamCallback() = 0;
 
@@ -93,12 +144,66 @@ class Engine {
   /*! \brief Add a new request to the engine. */
   virtual void AddRequest(Request request) = 0;
 
+  /*!
+   * \brief Add new requests to the engine in order. The text inputs of the requests are
+   * tokenized together in parallel before the requests are added.
+   */
+  virtual void AddRequests(Array<Request> requests) = 0;
+
   /*! \brief Abort the input request (specified by id string) from engine. */
   virtual void AbortRequest(const String& request_id) = 0;
 
   /*! \brief Abort all requests from the engine. */
   virtual void AbortAllRequests() = 0;
 
+  /*!
+   * \brief Export a prefilled request under prefill/decode disaggregation. The KV data of the
+   * request is copied to the given device, and the request is removed from the engine
+   * without invoking the request stream callback.
+   * \param request_id The id of the request, which must be running with a single generation
+   * and have its inputs all prefilled.
+   * \param device The device to copy the KV data to. It is the device of the decode engine,
+   * or the host when the KV data is further transferred across nodes by the caller.
+   * \return The handoff of the request, to be passed to `ImportRequest` of the decode engine.
+   */
+  virtual RequestHandoff ExportRequest(const String& request_id, Device device) = 0;
+
+  /*!
+   * \brief Import a request exported by another engine, and continue decoding it. The imported
+   * KV data is restored into the KV cache when the request is scheduled, after which only the
+   * last generated token needs to be prefilled. The request is prefilled from scratch instead
+   * when the KV data cannot be held.
+   */
+  virtual void ImportRequest(RequestHandoff handoff) = 0;
+
+  /*!
+   * \brief Export the KV data of the longest prefix of the given tokens in prefix cache, for
+   * a peer engine that misses the prefix to pull it instead of recomputing it. The prefix
+   * cache is left unchanged.
+   * \param tokens The tokens whose prefix to export.
+   * \param device The device to copy the KV data to. It is the device of the peer engine, or
+   * the host when the KV data is further transferred across nodes by the caller.
+   * \return The handoff of the prefix, or NullOpt when prefix cache holds no block of
+   * PrefixMatchIndex::kBlockSize tokens of the prefix, or cannot export the KV data.
+   */
+  virtual Optional<PrefixKVHandoff> ExportPrefixKV(const IntTuple& tokens, Device device) = 0;
+
+  /*!
+   * \brief Import the KV data of a prefix exported by a peer engine into the KV cache, and add
+   * the prefix to prefix cache as a recycling sequence, which the next requests with the
+   * prefix reuse or fork from.
+   * \return The number of imported tokens, which is 0 when prefix cache already holds the
+   * prefix, or when the KV cache has no room for it.
+   */
+  virtual int64_t ImportPrefixKV(PrefixKVHandoff handoff) = 0;
+
+  /*!
+   * \brief Save the cached sequences in prefix cache and their KV data to the prefix cache
+   * snapshot file, so that the next engine created with the same model and tokenizer starts
+   * with a warm prefix cache. Do nothing when the snapshot is disabled.
+   */
+  virtual void SavePrefixCacheSnapshot() = 0;
+
   /*********************** Engine Action ***********************/
 
   /*!
@@ -37,6 +37,9 @@ class EngineActionObj : public Object {
    */
   virtual Array<Request> Step(EngineState estate) = 0;
 
+  /*! \brief The name of the action, which names its step spans in the event trace. */
+  virtual const char* Name() const = 0;
+
   static constexpr const char* _type_key = "mlc.serve.EngineAction";
   static constexpr const bool _type_has_method_sequal_reduce = false;
   static constexpr const bool _type_has_method_shash_reduce = false;
@@ -86,6 +89,19 @@ class EngineAction : public ObjectRef {
       std::vector<ModelWorkspace> model_workspaces,
       DraftTokenWorkspaceManager draft_token_workspace_manager, EngineConfig engine_config,
       std::vector<picojson::object> model_configs, Optional<EventTraceRecorder> trace_recorder);
+  /*!
+   * \brief Create the action that prefills the prefill-only requests in the
+   * `prefill_only_queue` of the engine state, and finishes them in the same step.
+   * \param models The models to run prefill in. Only the first model is used.
+   * \param model_workspaces The workspace of each model.
+   * \param engine_config The engine config.
+   * \param trace_recorder The event trace recorder for requests.
+   * \return The created action object.
+   */
+  static EngineAction BatchPrefillOnly(Array<Model> models,
+                                       std::vector<ModelWorkspace> model_workspaces,
+                                       EngineConfig engine_config,
+                                       Optional<EventTraceRecorder> trace_recorder);
   /*!
    * \brief Create the action that runs one-step decode for requests in the
    * `running_queue` of engine state. Preempt low-priority requests
@@ -96,11 +112,35 @@ class EngineAction : public ObjectRef {
    * \param models The model to run decode in. When there are multiple
    * models, the `Step` function of the created action will not take effect.
    * \param sampler The sampler to sample new tokens.
+   * \param engine_config The engine config.
    * \param trace_recorder The event trace recorder for requests.
    * \return The created action object.
    */
   static EngineAction BatchDecode(Array<Model> models, LogitProcessor logit_processor,
-                                  Sampler sampler, Optional<EventTraceRecorder> trace_recorder);
+                                  Sampler sampler, EngineConfig engine_config,
+                                  Optional<EventTraceRecorder> trace_recorder);
+
+  /*!
+   * \brief Create the action that decodes the requests in the `running_queue`
+   * of engine state with jump-forward decoding. The tokens forced by the grammar
+   * of each request are appended in one prefill-style forward pass together with
+   * the last committed token, after which one new token is sampled. The action
+   * does not take effect when no running request has forced tokens, in which
+   * case the requests are decoded by the BatchDecode action.
+   * \param models The model to run decode in. When there are multiple
+   * models, the `Step` function of the created action will not take effect.
+   * \param logit_processor The logit processor.
+   * \param sampler The sampler to sample new tokens.
+   * \param model_workspaces The workspace of each model.
+   * \param engine_config The engine config.
+   * \param trace_recorder The event trace recorder for requests.
+   * \return The created action object.
+   */
+  static EngineAction BatchJumpForward(Array<Model> models, LogitProcessor logit_processor,
+                                       Sampler sampler,
+                                       std::vector<ModelWorkspace> model_workspaces,
+                                       EngineConfig engine_config,
+                                       Optional<EventTraceRecorder> trace_recorder);
 
   /*!
    * \brief Create the action that runs one-step speculative draft proposal for
@@ -113,12 +153,20 @@ class EngineAction : public ObjectRef {
    * \param draft_token_workspace_manager The draft token workspace manager.
    * \param trace_recorder The event trace recorder for requests.
    * \param draft_length The number of draft proposal rounds.
+   * \param tree_width The maximum number of draft tokens at each level of the draft token
+   * tree of a request. The draft tokens form a chain when it is 1.
+   * \param adaptive_draft_length Whether to adapt the draft length of each request to its
+   * acceptance rate, with `draft_length` as the upper bound.
+   * \param max_batch_size The largest number of running requests to draft for, beyond which
+   * the requests are decoded without draft tokens. "-1" means no limit.
    * \return The created action object.
    */
   static EngineAction BatchDraft(Array<Model> models, LogitProcessor logit_processor,
                                  Sampler sampler, std::vector<ModelWorkspace> model_workspaces,
                                  DraftTokenWorkspaceManager draft_token_workspace_manager,
-                                 Optional<EventTraceRecorder> trace_recorder, int draft_length);
+                                 Optional<EventTraceRecorder> trace_recorder, int draft_length,
+                                 int tree_width = 1, bool adaptive_draft_length = false,
+                                 int max_batch_size = -1);
 
   /*!
    * \brief Create the action that runs one-step speculative draft proposal for
@@ -131,13 +179,18 @@ class EngineAction : public ObjectRef {
    * \param draft_token_workspace_manager The draft token workspace manager.
    * \param trace_recorder The event trace recorder for requests.
    * \param draft_length The number of draft proposal rounds.
+   * \param adaptive_draft_length Whether to adapt the draft length of each request to its
+   * acceptance rate, with `draft_length` as the upper bound.
+   * \param max_batch_size The largest number of running requests to draft for, beyond which
+   * the requests only verify the draft token proposed in verification. "-1" means no limit.
    * \return The created action object.
    */
   static EngineAction EagleBatchDraft(Array<Model> models, LogitProcessor logit_processor,
                                       Sampler sampler, std::vector<ModelWorkspace> model_workspaces,
                                       DraftTokenWorkspaceManager draft_token_workspace_manager,
                                       Optional<EventTraceRecorder> trace_recorder,
-                                      int draft_length = 4);
+                                      int draft_length = 4, bool adaptive_draft_length = false,
+                                      int max_batch_size = -1);
 
   /*!
    * \brief Create the action that runs one-step speculative verification for requests in the
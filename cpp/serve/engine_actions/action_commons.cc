@@ -7,6 +7,13 @@
 
 #include <tvm/runtime/nvtx.h>
 
+#include <algorithm>
+#include <numeric>
+#include <unordered_set>
+#include <utility>
+
+#include "beam_search.h"
+
 namespace mlc {
 namespace llm {
 namespace serve {
@@ -25,18 +32,37 @@ void RemoveRequestFromModel(EngineState estate, int64_t req_internal_id, Array<M
  * \param rsentry The request state entry to remove.
  */
 void RemoveRequestStateEntry(EngineState estate, Array<Model> models, RequestStateEntry rsentry) {
-  if (estate->prefix_cache->HasSequence(rsentry->mstates[0]->internal_id)) {
+  int64_t seq_id = rsentry->mstates[0]->internal_id;
+  if (estate->prefix_cache->HasSequence(seq_id)) {
     // If the sequence is stored in prefix cache, call prefix cache to remove.
-    if (!(rsentry->request->generation_cfg->debug_config.has_value() &&
-          rsentry->request->generation_cfg->debug_config.value().pinned_system_prompt)) {
+    bool pinned = rsentry->request->generation_cfg->debug_config.has_value() &&
+                  rsentry->request->generation_cfg->debug_config.value().pinned_system_prompt;
+    // The overlapped decode has appended the last committed token to the KV cache, which
+    // prefix cache does not record. Pop the token so that the KV cache matches prefix cache.
+    // The RNN states and the sliding window KV cache cannot pop, and the sequence is dropped
+    // from prefix cache instead.
+    bool keep_kv = true;
+    if (estate->overlapped_decode_seq_ids.count(seq_id)) {
+      if (models[0]->GetMetadata().kv_state_kind == KVStateKind::kKVCache &&
+          models[0]->GetSlidingWindowSize() == -1) {
+        for (Model model : models) {
+          model->PopNFromKVCache(seq_id, 1);
+        }
+      } else {
+        keep_kv = false;
+      }
+    }
+    if (!keep_kv) {
+      estate->prefix_cache->RecycleSequence(seq_id, /*lazy=*/false);
+    } else if (!pinned) {
       // If the request is not pinned, recycle the request.
-      estate->prefix_cache->RecycleSequence(rsentry->mstates[0]->internal_id, /*lazy=*/true);
+      estate->prefix_cache->RecycleSequence(seq_id, /*lazy=*/true);
     }
     // If the request is pinned, do nothing over the prefix cache and KVCache.
   } else {
     // If the sequence is not stored in prefix cache, remove it directly.
-    RemoveRequestFromModel(estate, rsentry->mstates[0]->internal_id, models);
-    estate->id_manager.RecycleId(rsentry->mstates[0]->internal_id);
+    RemoveRequestFromModel(estate, seq_id, models);
+    estate->id_manager.RecycleId(seq_id);
   }
 }
 
@@ -50,6 +76,7 @@ void ProcessFinishedRequestStateEntries(std::vector<RequestStateEntry> finished_
     ICHECK(rsentry->child_indices.empty());
     // Mark the status of this entry as finished.
     rsentry->status = RequestStateStatus::kFinished;
+    estate->output_length_forecaster.Record(rsentry->mstates[0]->committed_tokens.size());
     // Remove the request state entry from all the models.
     RemoveRequestStateEntry(estate, models, rsentry);
 
@@ -84,6 +111,9 @@ void ProcessFinishedRequestStateEntries(std::vector<RequestStateEntry> finished_
       ICHECK(it != estate->running_queue.end());
       estate->running_queue.erase(it);
       estate->request_states.erase(rsentry->request->id);
+      if (rstate->lora_adapter_slot != -1) {
+        estate->lora_adapter_pool->Release(rstate->lora_adapter_slot);
+      }
 
       // Update engine statistics.
       const RequestStateEntry& root_rsentry = rstate->entries[0];
@@ -110,6 +140,11 @@ void UpdatePrefixCache(Array<Request> requests, EngineState estate) {
         if (!rsentry->mstates[0]->prefilled_inputs.empty()) {
           // Notify the prefix cache of the newly prefilled data.
           for (Data data : rsentry->mstates[0]->prefilled_inputs) {
+            if (const auto* image_data = data.as<ImageDataNode>()) {
+              estate->prefix_cache->ExtendSequence(rsentry->mstates[0]->internal_id,
+                                                   IntTuple(image_data->GetPrefixCacheTokens()));
+              continue;
+            }
             const TokenDataNode* token_data = data.as<TokenDataNode>();
             estate->prefix_cache->ExtendSequence(rsentry->mstates[0]->internal_id,
                                                  token_data->token_ids);
@@ -125,7 +160,7 @@ void UpdatePrefixCache(Array<Request> requests, EngineState estate) {
                           rsentry->mstates[0]->cached_committed_tokens));
           for (int i = rsentry->mstates[0]->cached_committed_tokens;
                i < static_cast<int64_t>(rsentry->mstates[0]->committed_tokens.size()) - 1; ++i) {
-            tokens.push_back(rsentry->mstates[0]->committed_tokens[i].sampled_token_id.first);
+            tokens.push_back(rsentry->mstates[0]->committed_token_ids[i]);
           }
           estate->prefix_cache->ExtendSequence(rsentry->mstates[0]->internal_id, IntTuple(tokens));
           rsentry->mstates[0]->cached_committed_tokens =
@@ -150,13 +185,18 @@ void ActionStepPostProcess(Array<Request> requests, EngineState estate, Array<Mo
 
   for (Request request : requests) {
     RequestState rstate = estate->GetRequestState(request);
+    int64_t num_prefilled_tokens = 0;
     for (const RequestStateEntry& rsentry : rstate->entries) {
       if (!rsentry->mstates[0]->prefilled_inputs.empty()) {
         for (Data data : rsentry->mstates[0]->prefilled_inputs) {
-          estate->stats.total_prefill_length += data->GetLength();
+          num_prefilled_tokens += data->GetLength();
         }
       }
     }
+    estate->stats.total_prefill_length += num_prefilled_tokens;
+    if (num_prefilled_tokens > 0) {
+      estate->scheduler_policy->RecordService(request, num_prefilled_tokens);
+    }
   }
 
   {
@@ -170,19 +210,45 @@ void ActionStepPostProcess(Array<Request> requests, EngineState estate, Array<Mo
     RequestState rstate = estate->GetRequestState(request);
     Array<IntTuple> group_delta_token_ids;
     Array<Array<String>> group_delta_logprob_json_strs;
+    Array<NDArray> group_delta_logprob_token_ids;
+    Array<NDArray> group_delta_logprobs;
     Array<Optional<String>> group_finish_reason;
+    bool logprob_arrays = request->generation_cfg->logprobs &&
+                          request->generation_cfg->logprob_format == "array";
     group_delta_token_ids.reserve(n);
     group_delta_logprob_json_strs.reserve(n);
     group_finish_reason.reserve(n);
 
     bool invoke_callback = false;
+    bool request_finished = true;
+    int64_t num_delta_tokens = 0;
     for (int i = 0; i < n; ++i) {
-      const RequestStateEntry& rsentry = n == 1 ? rstate->entries[0] : rstate->entries[i + 1];
+      // The root entry generates the only output when there are no parallel generations or
+      // beams, and the children generate the outputs otherwise.
+      const RequestStateEntry& rsentry =
+          rstate->entries.size() == 1 ? rstate->entries[0] : rstate->entries[i + 1];
+      bool finished_before = rsentry->status == RequestStateStatus::kFinished;
       const DeltaRequestReturn& delta_request_ret =
           rsentry->GetReturnTokenIds(tokenizer, max_single_sequence_length);
       group_delta_token_ids.push_back(IntTuple{delta_request_ret.delta_token_ids.begin(),
                                                delta_request_ret.delta_token_ids.end()});
-      group_delta_logprob_json_strs.push_back(delta_request_ret.delta_logprob_json_strs);
+      num_delta_tokens += delta_request_ret.delta_token_ids.size();
+      if (!rstate->response_cache_key.empty()) {
+        std::vector<int32_t>& token_ids = rstate->cached_response.group_token_ids[i];
+        token_ids.insert(token_ids.end(), delta_request_ret.delta_token_ids.begin(),
+                         delta_request_ret.delta_token_ids.end());
+        if (delta_request_ret.finish_reason.defined()) {
+          rstate->cached_response.group_finish_reason[i] = delta_request_ret.finish_reason.value();
+        }
+      }
+      if (logprob_arrays) {
+        auto [token_ids, logprobs] = PackLogProbArrays(delta_request_ret.delta_sample_results,
+                                                       request->generation_cfg->top_logprobs);
+        group_delta_logprob_token_ids.push_back(token_ids);
+        group_delta_logprobs.push_back(logprobs);
+      } else {
+        group_delta_logprob_json_strs.push_back(delta_request_ret.delta_logprob_json_strs);
+      }
       group_finish_reason.push_back(delta_request_ret.finish_reason);
       if (delta_request_ret.finish_reason.defined()) {
         invoke_callback = true;
@@ -192,14 +258,45 @@ void ActionStepPostProcess(Array<Request> requests, EngineState estate, Array<Mo
       if (!delta_request_ret.delta_token_ids.empty()) {
         invoke_callback = true;
       }
+      request_finished &= finished_before || delta_request_ret.finish_reason.defined();
+      rstate->metrics.num_output_tokens =
+          std::max(rstate->metrics.num_output_tokens,
+                   static_cast<int64_t>(rsentry->mstates[0]->committed_tokens.size()));
+    }
+    if (num_delta_tokens > 0) {
+      estate->scheduler_policy->RecordService(request, num_delta_tokens);
+    }
+
+    // - Update the timing metrics, and attach them to the final output of the request.
+    RequestMetrics& metrics = rstate->metrics;
+    if (invoke_callback && !metrics.tfirst_token.has_value()) {
+      metrics.tfirst_token = std::chrono::high_resolution_clock::now();
+    }
+    Optional<String> metrics_json_str;
+    if (request_finished) {
+      metrics.tfinish = std::chrono::high_resolution_clock::now();
+      estate->stats.UpdateRequestMetrics(metrics);
+      metrics_json_str = metrics.AsJSONString();
+      if (!rstate->response_cache_key.empty()) {
+        // Aborted generations are not reproducible outputs of the request.
+        const std::vector<String>& finish_reasons = rstate->cached_response.group_finish_reason;
+        if (std::find(finish_reasons.begin(), finish_reasons.end(), "abort") ==
+            finish_reasons.end()) {
+          estate->response_cache->Insert(rstate->response_cache_key,
+                                         std::move(rstate->cached_response));
+        }
+      }
     }
 
     if (invoke_callback) {
       callback_delta_outputs.push_back(RequestStreamOutput(
           request->id, std::move(group_delta_token_ids),
-          request->generation_cfg->logprobs > 0 ? std::move(group_delta_logprob_json_strs)
-                                                : Optional<Array<Array<String>>>(),
-          std::move(group_finish_reason)));
+          request->generation_cfg->logprobs && !logprob_arrays
+              ? std::move(group_delta_logprob_json_strs)
+              : Optional<Array<Array<String>>>(),
+          std::move(group_finish_reason), std::move(metrics_json_str),
+          logprob_arrays ? std::move(group_delta_logprob_token_ids) : Optional<Array<NDArray>>(),
+          logprob_arrays ? std::move(group_delta_logprobs) : Optional<Array<NDArray>>()));
     }
   }
 
@@ -230,27 +327,58 @@ RequestStateEntry PreemptLastRunningRequestStateEntry(
     }
   }
   ICHECK_NE(preempt_rstate_idx, -1);
+  if (request->generation_cfg->num_beams > 1 && preempt_rstate_idx > 0) {
+    // The beams are preempted together with the whole request.
+    return RestartBeamSearchRequest(estate, models, request, trace_recorder);
+  }
   RequestStateEntry rsentry = rstate->entries[preempt_rstate_idx];
   // When the request state entry still has pending inputs,
   // it means the request is still in the waiting queue.
   bool partially_alive = !rsentry->mstates[0]->inputs.empty();
 
+  // Under the swap preemption mode, copy the KV data of the entry to host memory
+  // before it gets removed from models. Only the entries that own their whole
+  // KV data (that is, without parent or children) are swapped.
+  bool swapped_out = false;
+  if (estate->kv_swap_pool.defined() && !partially_alive && rsentry->parent_idx == -1 &&
+      rsentry->child_indices.empty()) {
+    // The KV data of the last committed token has not been computed yet.
+    int64_t num_kv_tokens = request->input_total_length +
+                            static_cast<int64_t>(rsentry->mstates[0]->committed_tokens.size()) - 1;
+    swapped_out =
+        estate->kv_swap_pool->SwapOut(rsentry->mstates[0]->internal_id, num_kv_tokens, models);
+    if (swapped_out) {
+      RECORD_EVENT(trace_recorder, rsentry->request->id, "swap out");
+    }
+  }
+
   // Remove from models.
   // - Clear model speculation draft.
   // - Update `inputs` for future prefill.
   RECORD_EVENT(trace_recorder, rsentry->request->id, "preempt");
   rsentry->status = RequestStateStatus::kPending;
+  rstate->metrics.tpreemptions.push_back(std::chrono::high_resolution_clock::now());
+  ++estate->stats.total_preemptions;
+  // - Remove the sequences forked for the branches of draft token trees.
+  for (int model_id = 0; model_id < static_cast<int>(rsentry->mstates.size()); ++model_id) {
+    const RequestModelState& mstate = rsentry->mstates[model_id];
+    std::unordered_set<int64_t> branch_seq_ids(mstate->draft_token_seq_ids.begin(),
+                                               mstate->draft_token_seq_ids.end());
+    for (int64_t seq_id : branch_seq_ids) {
+      if (seq_id != -1 && seq_id != mstate->internal_id) {
+        models[model_id]->RemoveSequence(seq_id);
+        estate->id_manager.RecycleId(seq_id);
+      }
+    }
+  }
   std::vector<int> draft_token_slots;
   for (RequestModelState mstate : rsentry->mstates) {
+    // The n-gram drafts take no slots in the draft token workspace.
+    mstate->RemoveAllDraftTokens(&draft_token_slots);
     if (draft_token_workspace_manager.defined()) {
-      mstate->RemoveAllDraftTokens(&draft_token_slots);
       draft_token_workspace_manager.value()->FreeSlots(draft_token_slots);
     }
-    std::vector<int32_t> committed_token_ids;
-    committed_token_ids.reserve(mstate->committed_tokens.size());
-    for (const SampleResult& committed_token : mstate->committed_tokens) {
-      committed_token_ids.push_back(committed_token.sampled_token_id.first);
-    }
+    const std::vector<int32_t>& committed_token_ids = mstate->committed_token_ids;
     mstate->num_prefilled_tokens = 0;
 
     Array<Data> inputs;
@@ -279,6 +407,9 @@ RequestStateEntry PreemptLastRunningRequestStateEntry(
   }
   // Since the sequence has been removed from model, assign a new sequence ID.
   int64_t new_seq_id = estate->id_manager.GetNewId();
+  if (swapped_out) {
+    estate->kv_swap_pool->RenameSequence(rsentry->mstates[0]->internal_id, new_seq_id);
+  }
   for (RequestModelState mstate : rsentry->mstates) {
     mstate->internal_id = new_seq_id;
   }
@@ -314,6 +445,236 @@ std::pair<NDArray, std::vector<SampleResult>> ApplyLogitProcessorAndSample(
   return {std::move(probs_on_device), std::move(sample_results)};
 }
 
+/****************** Draft token trees ******************/
+
+int GetSlidingWindowPageBound(const Model& model, int page_size) {
+  int sliding_window_size = model->GetSlidingWindowSize();
+  if (sliding_window_size == -1) {
+    return -1;
+  }
+  // The pages of the attention sink are kept, and the window spans one more page at most
+  // when it does not start at a page boundary.
+  int attention_sink_size = model->GetAttentionSinkSize();
+  return (attention_sink_size + page_size - 1) / page_size +
+         (sliding_window_size + page_size - 1) / page_size + 1;
+}
+
+int64_t GetRequestStateEntrySequenceLength(const EngineState& estate,
+                                           const RequestStateEntry& rsentry, int model_id) {
+  RequestState rstate = estate->GetRequestState(rsentry->request);
+  int64_t length = rsentry->mstates[model_id]->num_prefilled_tokens +
+                   rsentry->mstates[model_id]->committed_tokens.size();
+  for (int parent_idx = rsentry->parent_idx; parent_idx != -1;
+       parent_idx = rstate->entries[parent_idx]->parent_idx) {
+    length += rstate->entries[parent_idx]->mstates[model_id]->num_prefilled_tokens;
+  }
+  return length;
+}
+
+int GetSpecTreeWidth(const EngineConfig& engine_config, const Model& verify_model) {
+  bool support_token_tree = engine_config->speculative_mode == SpeculativeMode::kSmallDraft ||
+                            engine_config->speculative_mode == SpeculativeMode::kMedusa;
+  return support_token_tree && verify_model->SupportTokenTreeVerify()
+             ? engine_config->spec_tree_width
+             : 1;
+}
+
+int GetDraftTokenTreeWidth(const GenerationConfig& generation_cfg,
+                           const RequestModelState& mstate, int tree_width) {
+  bool draft_chain = generation_cfg->frequency_penalty != 0.0 ||
+                     generation_cfg->presence_penalty != 0.0 ||
+                     generation_cfg->repetition_penalty != 1.0 || mstate->RequireNextTokenBitmask();
+  return draft_chain ? 1 : tree_width;
+}
+
+GenerationConfig GetDraftTokenTreeGenerationConfig(const GenerationConfig& generation_cfg,
+                                                   int tree_width) {
+  if (tree_width == 1 || generation_cfg->temperature >= 1e-5) {
+    return generation_cfg;
+  }
+  ObjectPtr<GenerationConfigNode> n = make_object<GenerationConfigNode>(*generation_cfg.get());
+  n->temperature = 1.0;
+  return GenerationConfig(n);
+}
+
+std::vector<int> AllocateDraftTokenTreeChildren(const std::vector<double>& path_probs,
+                                                int tree_width) {
+  int num_nodes = path_probs.size();
+  std::vector<int> num_children(num_nodes, 1);
+  if (num_nodes > 0 && tree_width > num_nodes) {
+    int top_node = std::max_element(path_probs.begin(), path_probs.end()) - path_probs.begin();
+    num_children[top_node] += tree_width - num_nodes;
+  }
+  return num_children;
+}
+
+int GetDraftTokenTreeDepth(const RequestModelState& draft_mstate) {
+  const std::vector<int>& parent_idx = draft_mstate->draft_token_parent_idx;
+  std::vector<int> depths(parent_idx.size());
+  int tree_depth = 0;
+  for (int j = 0; j < static_cast<int>(parent_idx.size()); ++j) {
+    depths[j] = parent_idx[j] == -1 ? 1 : depths[parent_idx[j]] + 1;
+    tree_depth = std::max(tree_depth, depths[j]);
+  }
+  return tree_depth;
+}
+
+std::vector<int> GetAcceptedDraftTokens(const RequestModelState& draft_mstate,
+                                        const std::vector<SampleResult>& sample_results) {
+  std::vector<int> accepted_nodes;
+  int num_draft_tokens = draft_mstate->draft_output_tokens.size();
+  int cur_node = -1;
+  // The last sample result is the token sampled after the accepted draft tokens.
+  for (int k = 0; k + 1 < static_cast<int>(sample_results.size()); ++k) {
+    int32_t token_id = sample_results[k].sampled_token_id.first;
+    int child = cur_node + 1;
+    while (child < num_draft_tokens &&
+           (draft_mstate->draft_token_parent_idx[child] != cur_node ||
+            draft_mstate->draft_output_tokens[child].sampled_token_id.first != token_id)) {
+      ++child;
+    }
+    ICHECK_LT(child, num_draft_tokens) << "The accepted token is not in the draft token tree.";
+    accepted_nodes.push_back(child);
+    cur_node = child;
+  }
+  return accepted_nodes;
+}
+
+void ProposeMedusaDraftTokenTrees(
+    const Array<NDArray>& multi_step_logits, int draft_length, int tree_width,
+    const LogitProcessor& logit_processor, const Sampler& sampler, const Model& model,
+    const DraftTokenWorkspaceManager& draft_token_workspace_manager,
+    const Array<RequestModelState>& mstates, const Array<GenerationConfig>& generation_cfg,
+    const Array<String>& request_ids, const std::vector<RandomGenerator*>& rngs,
+    EngineState estate) {
+  int num_rsentries = mstates.size();
+  std::vector<int> tree_widths;
+  Array<GenerationConfig> draft_generation_cfg;
+  tree_widths.reserve(num_rsentries);
+  draft_generation_cfg.reserve(num_rsentries);
+  for (int i = 0; i < num_rsentries; ++i) {
+    tree_widths.push_back(GetDraftTokenTreeWidth(generation_cfg[i], mstates[i], tree_width));
+    draft_generation_cfg.push_back(
+        GetDraftTokenTreeGenerationConfig(generation_cfg[i], tree_widths[i]));
+  }
+  // The draft token index and the path probability of the nodes at the current level of each
+  // tree, where -1 is the last committed token.
+  std::vector<std::vector<std::pair<int, double>>> frontier(num_rsentries, {{-1, 1.0}});
+  std::vector<int> draft_token_slots;
+
+  for (int level = 0; level < draft_length; ++level) {
+    const NDArray& logits = multi_step_logits[level];
+    // - Update logits and compute probability distributions.
+    logit_processor->InplaceUpdateLogits(logits, generation_cfg, mstates, request_ids);
+    NDArray probs_on_device =
+        logit_processor->ComputeProbsFromLogits(logits, draft_generation_cfg, request_ids);
+
+    // - Sample the children of each node from the distribution of its request.
+    std::vector<std::vector<int>> num_children;
+    std::vector<int> sample_indices;
+    Array<String> sample_request_ids;
+    Array<GenerationConfig> sample_generation_cfg;
+    std::vector<RandomGenerator*> sample_rngs;
+    num_children.reserve(num_rsentries);
+    for (int i = 0; i < num_rsentries; ++i) {
+      std::vector<double> path_probs;
+      path_probs.reserve(frontier[i].size());
+      for (const auto& [draft_token_index, path_prob] : frontier[i]) {
+        path_probs.push_back(path_prob);
+      }
+      num_children.push_back(AllocateDraftTokenTreeChildren(path_probs, tree_widths[i]));
+      int num_samples = std::accumulate(num_children[i].begin(), num_children[i].end(), 0);
+      for (int j = 0; j < num_samples; ++j) {
+        sample_indices.push_back(i);
+        sample_request_ids.push_back(request_ids[i]);
+        sample_generation_cfg.push_back(draft_generation_cfg[i]);
+        sample_rngs.push_back(rngs[i]);
+      }
+    }
+    NDArray renormalized_probs = sampler->BatchRenormalizeProbsByTopP(
+        probs_on_device, sample_indices, sample_request_ids, sample_generation_cfg);
+    std::vector<SampleResult> sample_results = sampler->BatchSampleTokensWithProbAfterTopP(
+        renormalized_probs, sample_indices, sample_request_ids, sample_generation_cfg,
+        sample_rngs);
+    ICHECK_EQ(sample_results.size(), sample_indices.size());
+
+    // - Add the distinct children of each node to the tree.
+    std::vector<int> child_rows;
+    std::vector<std::pair<int, int>> children;
+    for (int sample_id = 0, i = 0; i < num_rsentries; ++i) {
+      std::vector<std::pair<int, double>> next_frontier;
+      for (int k = 0; k < static_cast<int>(frontier[i].size()); ++k) {
+        const auto& [parent_idx, path_prob] = frontier[i][k];
+        std::unordered_set<int32_t> child_tokens;
+        for (int j = 0; j < num_children[i][k]; ++j, ++sample_id) {
+          const SampleResult& sample_result = sample_results[sample_id];
+          if (!child_tokens.insert(sample_result.sampled_token_id.first).second) {
+            continue;
+          }
+          int draft_token_index = mstates[i]->draft_output_tokens.size();
+          next_frontier.push_back(
+              {draft_token_index, path_prob * sample_result.sampled_token_id.second});
+          child_rows.push_back(i);
+          children.push_back({i, draft_token_index});
+          mstates[i]->AddDraftToken(sample_result, /*draft_token_slot=*/-1, parent_idx);
+          estate->stats.total_draft_length += 1;
+        }
+      }
+      frontier[i] = std::move(next_frontier);
+    }
+    draft_token_workspace_manager->AllocSlots(children.size(), &draft_token_slots);
+    NDArray draft_probs_buffer =
+        draft_token_workspace_manager->GetDraftProbsBuffer(child_rows.size());
+    NDArray child_probs = model->GatherDraftProbs(probs_on_device, child_rows, &draft_probs_buffer);
+    NDArray draft_probs_storage = draft_token_workspace_manager->GetDraftProbsStorage();
+    model->ScatterDraftProbs(child_probs, draft_token_slots, &draft_probs_storage);
+    for (int k = 0; k < static_cast<int>(children.size()); ++k) {
+      const auto& [i, draft_token_index] = children[k];
+      mstates[i]->draft_token_slots[draft_token_index] = draft_token_slots[k];
+    }
+  }
+}
+
+void CompactKVCache(EngineState estate, const Array<Model>& models) {
+  for (const auto& [seq_id, num_tokens] : estate->prefix_cache->TrimRecyclingSequences()) {
+    for (const Model& model : models) {
+      model->PopNFromKVCache(seq_id, num_tokens);
+    }
+  }
+}
+
+void CompactDraftTokenWorkspace(EngineState estate,
+                                const DraftTokenWorkspaceManager& draft_token_workspace_manager) {
+  std::vector<int> live_slots;
+  for (const Request& request : estate->running_queue) {
+    for (const RequestStateEntry& rsentry : estate->GetRequestState(request)->entries) {
+      for (const RequestModelState& mstate : rsentry->mstates) {
+        for (int slot : mstate->draft_token_slots) {
+          if (slot >= 0) {
+            live_slots.push_back(slot);
+          }
+        }
+      }
+    }
+  }
+  std::vector<int> slot_map = draft_token_workspace_manager->CompactSlots(live_slots);
+  if (slot_map.empty()) {
+    return;
+  }
+  for (const Request& request : estate->running_queue) {
+    for (const RequestStateEntry& rsentry : estate->GetRequestState(request)->entries) {
+      for (const RequestModelState& mstate : rsentry->mstates) {
+        for (int& slot : mstate->draft_token_slots) {
+          if (slot >= 0) {
+            slot = slot_map[slot];
+            ICHECK_NE(slot, -1);
+          }
+        }
+      }
+    }
+  }
+}
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
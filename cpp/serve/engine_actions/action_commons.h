@@ -50,6 +50,8 @@ void ActionStepPostProcess(Array<Request> requests, EngineState estate, Array<Mo
 
 /*!
  * \brief Preempt the last running request state entry from `running_queue`.
+ * The running queue is ordered by the engine scheduler policy beforehand,
+ * so the last entry is the one the policy picks to preempt first.
  * If all entries of the selected request have been preempted,
  * remove it from running request.
  * If it is not in the waiting request queue, add it to the waiting queue.
@@ -65,10 +67,16 @@ RequestStateEntry PreemptLastRunningRequestStateEntry(
     Optional<DraftTokenWorkspaceManager> draft_token_workspace_manager,
     Optional<EventTraceRecorder> trace_recorder);
 
-/*! \brief Get the running request entries from the engine state. */
+/*!
+ * \brief Get the running request entries from the engine state. The entries of the cancelled
+ * requests are left out, since the engine aborts them right after the action.
+ */
 inline std::vector<RequestStateEntry> GetRunningRequestStateEntries(const EngineState& estate) {
   std::vector<RequestStateEntry> rsentries;
   for (const Request& request : estate->running_queue) {
+    if (estate->cancelled_requests->Contains(request->id)) {
+      continue;
+    }
     for (const RequestStateEntry& rsentry : estate->GetRequestState(request)->entries) {
       // One request entry is considered as running for decode if it is a leaf and has
       // finished all input prefill.
@@ -99,6 +107,114 @@ std::pair<NDArray, std::vector<SampleResult>> ApplyLogitProcessorAndSample(
     const Array<RequestModelState>& mstates, const std::vector<RandomGenerator*>& rngs,
     const std::vector<int>& sample_indices);
 
+/*!
+ * \brief Get the max number of KV cache pages that a sequence holds under the sliding window
+ * of the model. Once a sequence reaches the bound, the KV cache recycles the pages that fall
+ * out of the window and the attention sink, so that the sequence needs no new page for decode.
+ * \param model The model to get the sliding window of.
+ * \param page_size The KV cache page size.
+ * \return The page bound, or -1 if the model does not use sliding window.
+ */
+int GetSlidingWindowPageBound(const Model& model, int page_size);
+
+/*!
+ * \brief Get the length of the KV cache sequence of a request state entry in a model,
+ * including the prefix prefilled in the ancestor entries it is forked from.
+ */
+int64_t GetRequestStateEntrySequenceLength(const EngineState& estate,
+                                           const RequestStateEntry& rsentry, int model_id);
+
+/****************** Draft token trees ******************/
+
+/*!
+ * \brief Get the width of draft token trees in speculative decoding, which is 1 when the
+ * speculative mode or the verify model does not support token trees.
+ * \param engine_config The engine config.
+ * \param verify_model The model that verifies the draft tokens.
+ */
+int GetSpecTreeWidth(const EngineConfig& engine_config, const Model& verify_model);
+
+/*!
+ * \brief Get the tree width of the draft token tree of a request. The logit processor applies
+ * the penalties and grammar of draft tokens in chain order, so the requests with them draft
+ * chains.
+ */
+int GetDraftTokenTreeWidth(const GenerationConfig& generation_cfg,
+                           const RequestModelState& mstate, int tree_width);
+
+/*!
+ * \brief Get the generation config to sample the draft token tree of a request with. Greedy
+ * requests draft at temperature 1 to propose different branches, while the verification
+ * against the greedy target distribution stays exact.
+ */
+GenerationConfig GetDraftTokenTreeGenerationConfig(const GenerationConfig& generation_cfg,
+                                                   int tree_width);
+
+/*!
+ * \brief Allocate the number of children to sample for the nodes at a level of the draft
+ * token tree of a request. Every node gets one child, and the remaining budget of the level
+ * goes to the node with the largest path probability.
+ * \param path_probs The probability of the path to each node under the draft model.
+ * \param tree_width The maximum number of draft tokens at each level of the tree.
+ * \return The number of children of each node.
+ */
+std::vector<int> AllocateDraftTokenTreeChildren(const std::vector<double>& path_probs,
+                                                int tree_width);
+
+/*! \brief Get the depth of the draft token tree, which is the draft length for chains. */
+int GetDraftTokenTreeDepth(const RequestModelState& draft_mstate);
+
+/*!
+ * \brief Get the accepted draft tokens from the verification results, by matching the
+ * accepted tokens with the children in the draft token tree.
+ * \param draft_mstate The draft model state which holds the draft token tree.
+ * \param sample_results The accepted tokens followed by the token sampled after them.
+ * \return The indices of the accepted draft tokens, from the root to the leaf.
+ */
+std::vector<int> GetAcceptedDraftTokens(const RequestModelState& draft_mstate,
+                                        const std::vector<SampleResult>& sample_results);
+
+/*!
+ * \brief Propose draft token trees from the Medusa heads. The head at each level predicts
+ * the tokens at its offset after the last committed token, so the children of all the nodes
+ * at a level are sampled from the distribution of the same head. Each level of the tree of a
+ * request has at most `tree_width` draft tokens, which are allocated to the nodes in the same
+ * way as `AllocateDraftTokenTreeChildren`, and the duplicate children of a node are merged.
+ * \param multi_step_logits The logits of each Medusa head with shape (num_requests, vocab).
+ * \param draft_length The number of heads to draft with, which is the depth of the trees.
+ * \param tree_width The maximum number of draft tokens at each level of the trees.
+ * \param model The model to gather and scatter the draft probabilities with.
+ * \param draft_token_workspace_manager The manager to allocate the draft token slots from.
+ * \param mstates The draft model states of the requests to add the draft tokens to.
+ * \param estate The engine state to update the statistics.
+ */
+void ProposeMedusaDraftTokenTrees(
+    const Array<NDArray>& multi_step_logits, int draft_length, int tree_width,
+    const LogitProcessor& logit_processor, const Sampler& sampler, const Model& model,
+    const DraftTokenWorkspaceManager& draft_token_workspace_manager,
+    const Array<RequestModelState>& mstates, const Array<GenerationConfig>& generation_cfg,
+    const Array<String>& request_ids, const std::vector<RandomGenerator*>& rngs,
+    EngineState estate);
+
+/*!
+ * \brief Compact the draft token workspace with the draft token slots held by the running
+ * requests. The slots that are no longer held are reclaimed, and the slots of the requests
+ * are updated when the storage is repacked.
+ * \param estate The engine state whose running requests hold the draft token slots.
+ * \param draft_token_workspace_manager The manager of the draft token workspace.
+ */
+void CompactDraftTokenWorkspace(EngineState estate,
+                                const DraftTokenWorkspaceManager& draft_token_workspace_manager);
+
+/*!
+ * \brief Compact the KV cache when the engine is idle. The recycling sequences of prefix cache
+ * are trimmed to the last full page of their exclusive parts, and the trimmed tokens are popped
+ * from the KV cache of all models, which frees the partially filled pages.
+ * \param estate The engine state whose prefix cache holds the recycling sequences.
+ * \param models The models whose KV cache to compact.
+ */
+void CompactKVCache(EngineState estate, const Array<Model>& models);
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
@@ -5,6 +5,7 @@
 
 #include <tvm/runtime/nvtx.h>
 
+#include <algorithm>
 #include <numeric>
 
 #include "../../support/random.h"
@@ -13,6 +14,7 @@
 #include "../sampler/sampler.h"
 #include "action.h"
 #include "action_commons.h"
+#include "beam_search.h"
 
 namespace mlc {
 namespace llm {
@@ -22,6 +24,9 @@ namespace serve {
  * \brief The action that runs one-step decode for requests in the
  * `running_queue` of engine state. Preempt low-priority requests
  * accordingly when it is impossible to decode all the running requests.
+ * When decode batch size buckets are configured, the decode batch is padded
+ * to the next bucket size with placeholder sequences, so that models compiled
+ * with CUDA graph replay the graph captured for the bucket.
  * \note The BatchDecode action **does not** take effect for speculative
  * decoding scenarios where there are multiple models. For speculative
  * decoding in the future, we will use other specific actions.
@@ -29,11 +34,33 @@ namespace serve {
 class BatchDecodeActionObj : public EngineActionObj {
  public:
   explicit BatchDecodeActionObj(Array<Model> models, LogitProcessor logit_processor,
-                                Sampler sampler, Optional<EventTraceRecorder> trace_recorder)
+                                Sampler sampler, EngineConfig engine_config,
+                                Optional<EventTraceRecorder> trace_recorder)
       : models_(std::move(models)),
         logit_processor_(std::move(logit_processor)),
         sampler_(std::move(sampler)),
-        trace_recorder_(std::move(trace_recorder)) {}
+        trace_recorder_(std::move(trace_recorder)),
+        max_single_sequence_length_(engine_config->max_single_sequence_length),
+        num_decode_steps_per_step_(engine_config->num_decode_steps_per_step),
+        restricted_vocab_max_tokens_(models_[0]->CanGetLogitsForTokens()
+                                         ? engine_config->restricted_vocab_max_tokens
+                                         : 0),
+        sliding_window_page_bound_(
+            GetSlidingWindowPageBound(models_[0], engine_config->kv_cache_page_size)),
+        page_size_(engine_config->kv_cache_page_size) {
+    // Padding only applies to the single-model KV cache decode.
+    if (models_.size() == 1 &&
+        models_[0]->GetMetadata().kv_state_kind == KVStateKind::kKVCache) {
+      for (int batch_size : engine_config->decode_batch_size_buckets) {
+        if (batch_size <= engine_config->max_num_sequence) {
+          batch_size_buckets_.push_back(batch_size);
+        }
+      }
+      CaptureDecodeGraphs();
+    }
+  }
+
+  const char* Name() const final { return "BatchDecode"; }
 
   Array<Request> Step(EngineState estate) final {
     // - Do not run decode when there are multiple models or no running requests.
@@ -45,17 +72,31 @@ class BatchDecodeActionObj : public EngineActionObj {
     std::vector<RequestStateEntry> running_rsentries;
     {
       NVTXScopedRange nvtx_scope("BatchDecode getting requests");
+      // Order the running queue so that the preemption victim is at the back.
+      estate->scheduler_policy->SortRunningQueue(&estate->running_queue, estate->request_states);
       running_rsentries = GetRunningRequestStateEntries(estate);
-      while (!CanDecode(running_rsentries.size())) {
+      if (!CanDecode(GetNumDecodePages(estate, running_rsentries))) {
+        // Finish the deferred post-processing first, so that finished requests release
+        // their KV cache before any preemption.
+        estate->FlushDeferredPostProcess();
+        running_rsentries = GetRunningRequestStateEntries(estate);
+      }
+      while (!CanDecode(GetNumDecodePages(estate, running_rsentries))) {
         if (estate->prefix_cache->TryFreeMemory()) continue;
-        RequestStateEntry preempted =
-            PreemptLastRunningRequestStateEntry(estate, models_, NullOpt, trace_recorder_);
-        if (preempted.same_as(running_rsentries.back())) {
+        PreemptLastRunningRequestStateEntry(estate, models_, NullOpt, trace_recorder_);
+        // A beam search request is preempted with all its beams at once.
+        while (!running_rsentries.empty() &&
+               running_rsentries.back()->status != RequestStateStatus::kAlive) {
           running_rsentries.pop_back();
         }
       }
     }
 
+    if (running_rsentries.empty() && !estate->cancelled_requests->Empty()) {
+      // All the running requests are cancelled, and the engine aborts them after the action.
+      return {};
+    }
+
     auto tstart = std::chrono::high_resolution_clock::now();
 
     // NOTE: Right now we only support decode all the running request states at a time.
@@ -63,6 +104,42 @@ class BatchDecodeActionObj : public EngineActionObj {
     ICHECK_GT(num_rsentries, 0)
         << "There should be at least one request state entry that can run decode. "
            "Possible failure reason: none of the prefill phase of the running requests is finished";
+    double postproc_time = DecodeOnce(estate, running_rsentries);
+
+    // - Run more decode iterations back-to-back before the host post-processing. The entries
+    // that finished in the deferred post-processing of the last step are left out.
+    int num_extra_steps = GetNumExtraDecodeSteps(running_rsentries);
+    if (num_extra_steps > 0) {
+      running_rsentries.erase(std::remove_if(running_rsentries.begin(), running_rsentries.end(),
+                                             [](const RequestStateEntry& rsentry) {
+                                               return rsentry->status != RequestStateStatus::kAlive;
+                                             }),
+                              running_rsentries.end());
+    }
+    for (int i = 0; i < num_extra_steps && !running_rsentries.empty(); ++i) {
+      // Stop early when requests are cancelled, so that the engine aborts them in this step.
+      if (!CanDecode(GetNumDecodePages(estate, running_rsentries)) ||
+          !estate->cancelled_requests->Empty()) {
+        break;
+      }
+      DecodeOnce(estate, running_rsentries);
+    }
+
+    auto tend = std::chrono::high_resolution_clock::now();
+    estate->stats.engine_total_decode_time +=
+        static_cast<double>((tend - tstart).count()) / 1e9 - postproc_time;
+
+    return estate->running_queue;
+  }
+
+ private:
+  /*!
+   * \brief Run one decode iteration for the given request state entries, and commit the
+   * sampled tokens to them.
+   * \return The time in seconds of the deferred post-processing run during the decode.
+   */
+  double DecodeOnce(EngineState estate, const std::vector<RequestStateEntry>& running_rsentries) {
+    int num_rsentries = running_rsentries.size();
     // Collect
     // - the last committed token,
     // - the request id,
@@ -89,22 +166,71 @@ class BatchDecodeActionObj : public EngineActionObj {
       generation_cfg.push_back(rsentry->request->generation_cfg);
       rngs.push_back(&rsentry->rng);
     }
+    // - Pad the batch to the bucket size.
+    int num_padding_seqs = GetPaddedBatchSize(num_rsentries) - num_rsentries;
+    AddPaddingSequences(num_padding_seqs, &input_tokens, &request_internal_ids);
 
-    // - Compute embeddings.
+    // - Start computing the grammar bitmasks, which overlaps with the decode. The deferred
+    // post-processing reads the grammar states, so the bitmasks start after it if there is one.
+    bool has_deferred_postproc = estate->deferred_postproc != nullptr;
+    if (!has_deferred_postproc) {
+      logit_processor_->ComputeTokenBitmaskAsync(mstates);
+    }
+
+    // - Compute embeddings. The input tokens sampled on device by the last decode are embedded
+    // from device when no other sampling ran since, skipping the copy of the ids from host.
     RECORD_EVENT(trace_recorder_, request_ids, "start embedding");
-    ObjectRef embeddings =
-        models_[0]->TokenEmbed({IntTuple(input_tokens.begin(), input_tokens.end())});
+    ObjectRef embeddings{nullptr};
+    if (CanEmbedLastSampledTokens(input_tokens, request_internal_ids)) {
+      embeddings = models_[0]->TokenEmbedOnDevice(last_sampled_token_ids_device_);
+    } else {
+      embeddings = models_[0]->TokenEmbed({IntTuple(input_tokens.begin(), input_tokens.end())});
+    }
     RECORD_EVENT(trace_recorder_, request_ids, "finish embedding");
 
-    // - Invoke model decode.
+    // - Invoke model decode. When every entry is constrained by a grammar, the decode stops
+    // at the hidden states, so that the logits can be computed for the allowed tokens only.
     RECORD_EVENT(trace_recorder_, request_ids, "start decode");
-    NDArray logits = models_[0]->BatchDecode(embeddings, request_internal_ids);
+    NDArray logits{nullptr};
+    ObjectRef hidden_states{nullptr};
+    if (CanRestrictVocab(running_rsentries)) {
+      hidden_states = models_[0]->BatchDecodeToLastHidden(embeddings, request_internal_ids);
+    } else {
+      logits = models_[0]->BatchDecode(embeddings, request_internal_ids);
+    }
     RECORD_EVENT(trace_recorder_, request_ids, "finish decode");
+    RemovePaddingSequences(num_padding_seqs);
+    // - Run the deferred post-processing of the last step while the device runs decode.
+    // The time is excluded from the decode time. The entries finishing in it have their last
+    // committed token in the KV cache, which is rolled back when they are removed.
+    auto tpostproc_start = std::chrono::high_resolution_clock::now();
+    if (has_deferred_postproc) {
+      for (const RequestStateEntry& rsentry : running_rsentries) {
+        estate->overlapped_decode_seq_ids.insert(rsentry->mstates[0]->internal_id);
+      }
+      estate->FlushDeferredPostProcess();
+      estate->overlapped_decode_seq_ids.clear();
+    }
+    auto tpostproc_end = std::chrono::high_resolution_clock::now();
+    double postproc_time = static_cast<double>((tpostproc_end - tpostproc_start).count()) / 1e9;
+    if (has_deferred_postproc) {
+      logit_processor_->ComputeTokenBitmaskAsync(mstates);
+    }
+    if (hidden_states.defined()) {
+      std::vector<int32_t> allowed_token_ids;
+      if (logit_processor_->GetAllowedTokenUnion(mstates, restricted_vocab_max_tokens_,
+                                                 &allowed_token_ids)) {
+        logits = models_[0]->GetLogitsForTokens(hidden_states, allowed_token_ids);
+      } else {
+        logits = models_[0]->GetLogits(hidden_states);
+      }
+      logits = logits.CreateView({logits->shape[0], 1, logits->shape[1]}, logits->dtype);
+    }
     ICHECK_EQ(logits->ndim, 3);
-    ICHECK_EQ(logits->shape[0], num_rsentries);
+    ICHECK_EQ(logits->shape[0], num_rsentries + num_padding_seqs);
     ICHECK_EQ(logits->shape[1], 1);
 
-    // - Update logits.
+    // - Update logits. The rows of padding sequences are at the end and are dropped.
     logits = logits.CreateView({num_rsentries, logits->shape[2]}, logits->dtype);
     logit_processor_->InplaceUpdateLogits(logits, generation_cfg, mstates, request_ids);
 
@@ -112,34 +238,194 @@ class BatchDecodeActionObj : public EngineActionObj {
     NDArray probs_on_device =
         logit_processor_->ComputeProbsFromLogits(logits, generation_cfg, request_ids);
 
-    // - Sample tokens.
+    // - Sample tokens, except for the beams of beam search which are expanded instead.
     // Fill range [0, num_rsentries) into `sample_indices`.
     std::vector<int> sample_indices(num_rsentries);
     std::iota(sample_indices.begin(), sample_indices.end(), 0);
-    NDArray renormalized_probs = sampler_->BatchRenormalizeProbsByTopP(
-        probs_on_device, sample_indices, request_ids, generation_cfg);
-    std::vector<SampleResult> sample_results = sampler_->BatchSampleTokensWithProbAfterTopP(
-        renormalized_probs, sample_indices, request_ids, generation_cfg, rngs);
-    ICHECK_EQ(sample_results.size(), num_rsentries);
+    std::vector<RequestStateEntry> sample_rsentries = running_rsentries;
+    auto [beams, beam_prob_rows] = TakeBeamsFromSampleInputs(
+        &sample_indices, &sample_rsentries, &request_ids, &generation_cfg, &rngs, nullptr);
+    std::vector<SampleResult> sample_results;
+    if (!sample_indices.empty()) {
+      NDArray renormalized_probs = sampler_->BatchRenormalizeProbsByTopP(
+          probs_on_device, sample_indices, request_ids, generation_cfg);
+      sample_results = sampler_->BatchSampleTokensWithProbAfterTopP(
+          renormalized_probs, sample_indices, request_ids, generation_cfg, rngs);
+    }
+    ICHECK_EQ(sample_results.size(), sample_rsentries.size());
+    KeepLastSampledTokens(sample_results, request_internal_ids,
+                          /*in_entry_order=*/beams.empty() && num_padding_seqs == 0);
 
-    // - Update the committed tokens of states.
-    for (int i = 0; i < num_rsentries; ++i) {
-      mstates[i]->CommitToken(sample_results[i]);
+    // - Update the committed tokens of states. The entries that finished in the
+    // deferred post-processing discard their tokens.
+    for (int i = 0; i < static_cast<int>(sample_rsentries.size()); ++i) {
+      if (sample_rsentries[i]->status != RequestStateStatus::kFinished) {
+        sample_rsentries[i]->mstates[0]->CommitToken(sample_results[i]);
+      }
+    }
+    if (!beams.empty()) {
+      BeamSearchStep(estate, models_, sampler_, probs_on_device, beams, beam_prob_rows,
+                     max_single_sequence_length_);
     }
 
-    auto tend = std::chrono::high_resolution_clock::now();
-    estate->stats.engine_total_decode_time += static_cast<double>((tend - tstart).count()) / 1e9;
+    return postproc_time;
+  }
 
-    return estate->running_queue;
+  /*!
+   * \brief Get the number of decode iterations to run after the first in a step. Multi-step
+   * decode applies when no entry uses beam search or grammar, and it stops short of the max
+   * tokens and the max single sequence length of every entry.
+   */
+  int GetNumExtraDecodeSteps(const std::vector<RequestStateEntry>& running_rsentries) const {
+    int num_extra_steps = num_decode_steps_per_step_ - 1;
+    for (const RequestStateEntry& rsentry : running_rsentries) {
+      if (num_extra_steps <= 0) {
+        break;
+      }
+      const GenerationConfig& generation_cfg = rsentry->request->generation_cfg;
+      if (generation_cfg->num_beams > 1 || rsentry->mstates[0]->grammar_state_matcher.defined()) {
+        return 0;
+      }
+      int64_t num_committed_tokens = rsentry->mstates[0]->committed_tokens.size();
+      int64_t sequence_length = rsentry->request->input_total_length + num_committed_tokens;
+      if (generation_cfg->max_tokens >= 0) {
+        num_extra_steps = std::min<int64_t>(num_extra_steps,
+                                            generation_cfg->max_tokens - num_committed_tokens);
+      }
+      num_extra_steps =
+          std::min<int64_t>(num_extra_steps, max_single_sequence_length_ - sequence_length);
+    }
+    return std::max(num_extra_steps, 0);
   }
 
- private:
-  /*! \brief Check if the input request state entries can be decoded under conditions. */
-  bool CanDecode(int num_rsentries) {
+  /*!
+   * \brief Check if the logits of the decode may be computed for a restricted vocabulary,
+   * which is when every entry is constrained by a grammar and applies no LoRA adapter.
+   * Whether the allowed tokens are few enough is known only from the grammar bitmasks.
+   */
+  bool CanRestrictVocab(const std::vector<RequestStateEntry>& running_rsentries) const {
+    if (restricted_vocab_max_tokens_ == 0) {
+      return false;
+    }
+    return std::all_of(running_rsentries.begin(), running_rsentries.end(),
+                       [](const RequestStateEntry& rsentry) {
+                         return rsentry->mstates[0]->RequireNextTokenBitmask() &&
+                                rsentry->request->generation_cfg->lora_adapter.empty();
+                       });
+  }
+
+  /*!
+   * \brief Keep the token ids sampled on device in the step for the embedding of the next
+   * decode. They are kept only when the samples are in the order of the entries.
+   */
+  void KeepLastSampledTokens(const std::vector<SampleResult>& sample_results,
+                             const std::vector<int64_t>& seq_ids, bool in_entry_order) {
+    last_sampled_token_ids_device_ = NDArray(nullptr);
+    if (!in_entry_order || sample_results.empty() || !models_[0]->CanTokenEmbedOnDevice()) {
+      return;
+    }
+    last_sampled_token_ids_device_ = sampler_->GetLastSampledTokenIdsOnDevice();
+    last_decode_seq_ids_ = seq_ids;
+    last_sampled_token_ids_.clear();
+    for (const SampleResult& sample_result : sample_results) {
+      last_sampled_token_ids_.push_back(sample_result.sampled_token_id.first);
+    }
+  }
+
+  /*!
+   * \brief Check if the input tokens of the decode are the ones sampled on device by the last
+   * decode, for the same sequences, and the sampler has not sampled since.
+   */
+  bool CanEmbedLastSampledTokens(const std::vector<int>& input_tokens,
+                                 const std::vector<int64_t>& seq_ids) {
+    return last_sampled_token_ids_device_.defined() &&
+           last_sampled_token_ids_device_.same_as(sampler_->GetLastSampledTokenIdsOnDevice()) &&
+           seq_ids == last_decode_seq_ids_ && input_tokens == last_sampled_token_ids_;
+  }
+
+  /*! \brief Check if the decode that needs the given number of new pages can run. */
+  bool CanDecode(int num_required_pages) {
     int num_available_pages = models_[0]->GetNumAvailablePages();
-    return num_rsentries <= num_available_pages;
+    return num_required_pages <= num_available_pages;
   }
 
+  /*!
+   * \brief Get the number of new KV cache pages that the decode of the given request state
+   * entries needs at most, which is one page for each sequence of the padded batch. Under
+   * sliding window, the entries that already hold the bounded footprint recycle the pages
+   * falling out of the window, and need no new page.
+   */
+  int GetNumDecodePages(const EngineState& estate,
+                        const std::vector<RequestStateEntry>& rsentries) const {
+    int num_required_pages = GetPaddedBatchSize(rsentries.size());
+    if (sliding_window_page_bound_ == -1) {
+      return num_required_pages;
+    }
+    for (const RequestStateEntry& rsentry : rsentries) {
+      int64_t length = GetRequestStateEntrySequenceLength(estate, rsentry, /*model_id=*/0);
+      if ((length + page_size_ - 1) / page_size_ >= sliding_window_page_bound_) {
+        --num_required_pages;
+      }
+    }
+    return num_required_pages;
+  }
+
+  /*!
+   * \brief Get the batch size that the decode batch is padded to, which is the
+   * smallest bucket no less than the input batch size. Batches larger than the
+   * largest bucket are not padded.
+   */
+  int GetPaddedBatchSize(int num_rsentries) const {
+    auto it = std::lower_bound(batch_size_buckets_.begin(), batch_size_buckets_.end(),
+                               num_rsentries);
+    return it == batch_size_buckets_.end() ? num_rsentries : *it;
+  }
+
+  /*!
+   * \brief Add the given number of padding sequences to the model, and append
+   * their input tokens and sequence ids to the decode inputs.
+   */
+  void AddPaddingSequences(int num_padding_seqs, std::vector<int>* input_tokens,
+                           std::vector<int64_t>* request_internal_ids) {
+    for (int i = 0; i < num_padding_seqs; ++i) {
+      models_[0]->AddNewSequence(kPaddingSeqIdBase + i);
+      input_tokens->push_back(0);
+      request_internal_ids->push_back(kPaddingSeqIdBase + i);
+    }
+  }
+
+  /*! \brief Remove the padding sequences from the model after decode. */
+  void RemovePaddingSequences(int num_padding_seqs) {
+    for (int i = 0; i < num_padding_seqs; ++i) {
+      models_[0]->RemoveSequence(kPaddingSeqIdBase + i);
+    }
+  }
+
+  /*!
+   * \brief Run decode once for each bucket with padding sequences only, so that the
+   * models compiled with CUDA graph capture the graphs of all buckets ahead of serving.
+   */
+  void CaptureDecodeGraphs() {
+    for (int batch_size : batch_size_buckets_) {
+      if (!CanDecode(batch_size)) {
+        break;
+      }
+      std::vector<int> input_tokens;
+      std::vector<int64_t> seq_ids;
+      AddPaddingSequences(batch_size, &input_tokens, &seq_ids);
+      ObjectRef embeddings =
+          models_[0]->TokenEmbed({IntTuple(input_tokens.begin(), input_tokens.end())});
+      models_[0]->BatchDecode(embeddings, seq_ids);
+      RemovePaddingSequences(batch_size);
+    }
+  }
+
+  /*!
+   * \brief The first sequence id of padding sequences, which never collides
+   * with the internal ids of requests.
+   */
+  static constexpr int64_t kPaddingSeqIdBase = static_cast<int64_t>(1) << 40;
+
   /*!
    * \brief The model to run decode in. When there are multiple
    * models, the `Step` function of the created action will not take effect.
@@ -151,14 +437,35 @@ class BatchDecodeActionObj : public EngineActionObj {
   Sampler sampler_;
   /*! \brief Event trace recorder. */
   Optional<EventTraceRecorder> trace_recorder_;
+  /*! \brief The max single sequence length, which ends beam search. */
+  int64_t max_single_sequence_length_;
+  /*! \brief The number of decode iterations a step runs back-to-back. */
+  int num_decode_steps_per_step_;
+  /*!
+   * \brief The maximum number of tokens in the restricted vocabulary of a decode step, or 0
+   * when the logits are always computed for the full vocabulary.
+   */
+  int restricted_vocab_max_tokens_;
+  /*! \brief The bucketed batch sizes that decode batches are padded to, in ascending order. */
+  std::vector<int> batch_size_buckets_;
+  /*! \brief The page bound of a sequence under sliding window, or -1 without sliding window. */
+  int sliding_window_page_bound_;
+  /*! \brief The KV cache page size. */
+  int page_size_;
+  /*! \brief The token ids sampled on device by the last decode, or undefined. */
+  NDArray last_sampled_token_ids_device_{nullptr};
+  /*! \brief The sequence ids of the last decode whose sampled tokens are kept. */
+  std::vector<int64_t> last_decode_seq_ids_;
+  /*! \brief The token ids sampled by the last decode, on host. */
+  std::vector<int> last_sampled_token_ids_;
 };
 
 EngineAction EngineAction::BatchDecode(Array<Model> models, LogitProcessor logit_processor,
-                                       Sampler sampler,
+                                       Sampler sampler, EngineConfig engine_config,
                                        Optional<EventTraceRecorder> trace_recorder) {
-  return EngineAction(
-      make_object<BatchDecodeActionObj>(std::move(models), std::move(logit_processor),
-                                        std::move(sampler), std::move(trace_recorder)));
+  return EngineAction(make_object<BatchDecodeActionObj>(
+      std::move(models), std::move(logit_processor), std::move(sampler), std::move(engine_config),
+      std::move(trace_recorder)));
 }
 
 }  // namespace serve
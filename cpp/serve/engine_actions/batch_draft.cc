@@ -3,7 +3,9 @@
  * \file serve/engine_actions/batch_draft.cc
  */
 
+#include <algorithm>
 #include <numeric>
+#include <unordered_set>
 
 #include "../config.h"
 #include "../model.h"
@@ -25,17 +27,24 @@ class BatchDraftActionObj : public EngineActionObj {
   explicit BatchDraftActionObj(Array<Model> models, LogitProcessor logit_processor, Sampler sampler,
                                std::vector<ModelWorkspace> model_workspaces,
                                DraftTokenWorkspaceManager draft_token_workspace_manager,
-                               Optional<EventTraceRecorder> trace_recorder, int draft_length)
+                               Optional<EventTraceRecorder> trace_recorder, int draft_length,
+                               int tree_width, bool adaptive_draft_length, int max_batch_size)
       : models_(std::move(models)),
         logit_processor_(std::move(logit_processor)),
         sampler_(std::move(sampler)),
         model_workspaces_(std::move(model_workspaces)),
         draft_token_workspace_manager_(std::move(draft_token_workspace_manager)),
         trace_recorder_(std::move(trace_recorder)),
-        draft_length_(draft_length) {
+        draft_length_(draft_length),
+        tree_width_(tree_width),
+        adaptive_draft_length_(adaptive_draft_length),
+        max_batch_size_(max_batch_size) {
     ICHECK_GT(draft_length_, 0);
+    ICHECK_GT(tree_width_, 0);
   }
 
+  const char* Name() const final { return "BatchDraft"; }
+
   Array<Request> Step(EngineState estate) final {
     // - Only run spec decode when there are two models (llm+ssm) and >=1 running requests.
     if (models_.size() != 2 || estate->running_queue.empty()) {
@@ -43,6 +52,8 @@ class BatchDraftActionObj : public EngineActionObj {
     }
 
     // Preempt request state entries when decode cannot apply.
+    // Order the running queue so that the preemption victim is at the back.
+    estate->scheduler_policy->SortRunningQueue(&estate->running_queue, estate->request_states);
     std::vector<RequestStateEntry> running_rsentries = GetRunningRequestStateEntries(estate);
     while (!CanDecode(running_rsentries.size())) {
       if (estate->prefix_cache->TryFreeMemory()) continue;
@@ -52,6 +63,10 @@ class BatchDraftActionObj : public EngineActionObj {
         running_rsentries.pop_back();
       }
     }
+    if (running_rsentries.empty()) {
+      // All the running requests are cancelled, and the engine aborts them after the action.
+      return {};
+    }
 
     auto tstart = std::chrono::high_resolution_clock::now();
 
@@ -70,68 +85,97 @@ class BatchDraftActionObj : public EngineActionObj {
       rngs.push_back(&rsentry->rng);
     }
 
+    // - Decide the draft length of each request.
+    std::vector<int> draft_lengths = GetDraftLengths(estate, running_rsentries);
+    int max_draft_length =
+        draft_lengths.empty() ? 0 : *std::max_element(draft_lengths.begin(), draft_lengths.end());
+
+    if (tree_width_ > 1) {
+      DraftTokenTrees(estate, running_rsentries, draft_lengths, request_ids, generation_cfg, rngs);
+      auto tend = std::chrono::high_resolution_clock::now();
+      estate->stats.engine_total_decode_time +=
+          static_cast<double>((tend - tstart).count()) / 1e9;
+      return {};
+    }
+
     // The first model doesn't get involved in draft proposal.
     for (int model_id = 1; model_id < static_cast<int>(models_.size()); ++model_id) {
       // Collect
       // - the last committed token,
       // - the request model state
-      // of each request.
+      // of each request whose draft is not finished.
       std::vector<int> input_tokens;
+      std::vector<int64_t> draft_internal_ids;
       Array<RequestModelState> mstates;
-      input_tokens.reserve(num_rsentries);
-      mstates.reserve(num_rsentries);
-      for (const RequestStateEntry& rsentry : running_rsentries) {
-        mstates.push_back(rsentry->mstates[model_id]);
-      }
-      // draft_length_ rounds of draft proposal.
-      for (int draft_id = 0; draft_id < draft_length_; ++draft_id) {
+      Array<String> draft_request_ids;
+      Array<GenerationConfig> draft_generation_cfg;
+      std::vector<RandomGenerator*> draft_rngs;
+      // max_draft_length rounds of draft proposal.
+      for (int draft_id = 0; draft_id < max_draft_length; ++draft_id) {
         // prepare new input tokens
         input_tokens.clear();
+        draft_internal_ids.clear();
+        mstates.clear();
+        draft_request_ids.clear();
+        draft_generation_cfg.clear();
+        draft_rngs.clear();
         for (int i = 0; i < num_rsentries; ++i) {
+          if (draft_id >= draft_lengths[i]) {
+            continue;
+          }
+          RequestModelState mstate = running_rsentries[i]->mstates[model_id];
           // The first draft proposal uses the last committed token.
           input_tokens.push_back(
-              draft_id == 0 ? mstates[i]->committed_tokens.back().sampled_token_id.first
-                            : mstates[i]->draft_output_tokens.back().sampled_token_id.first);
+              draft_id == 0 ? mstate->committed_tokens.back().sampled_token_id.first
+                            : mstate->draft_output_tokens.back().sampled_token_id.first);
+          draft_internal_ids.push_back(request_internal_ids[i]);
+          mstates.push_back(mstate);
+          draft_request_ids.push_back(request_ids[i]);
+          draft_generation_cfg.push_back(generation_cfg[i]);
+          draft_rngs.push_back(rngs[i]);
         }
+        int num_drafts = input_tokens.size();
 
         // - Compute embeddings.
-        RECORD_EVENT(trace_recorder_, request_ids, "start proposal embedding");
+        RECORD_EVENT(trace_recorder_, draft_request_ids, "start proposal embedding");
         ObjectRef embeddings =
             models_[model_id]->TokenEmbed({IntTuple{input_tokens.begin(), input_tokens.end()}});
-        RECORD_EVENT(trace_recorder_, request_ids, "finish proposal embedding");
+        RECORD_EVENT(trace_recorder_, draft_request_ids, "finish proposal embedding");
 
         // - Invoke model decode.
-        RECORD_EVENT(trace_recorder_, request_ids, "start proposal decode");
-        NDArray logits = models_[model_id]->BatchDecode(embeddings, request_internal_ids);
-        RECORD_EVENT(trace_recorder_, request_ids, "finish proposal decode");
+        RECORD_EVENT(trace_recorder_, draft_request_ids, "start proposal decode");
+        NDArray logits = models_[model_id]->BatchDecode(embeddings, draft_internal_ids);
+        RECORD_EVENT(trace_recorder_, draft_request_ids, "finish proposal decode");
         ICHECK_EQ(logits->ndim, 3);
-        ICHECK_EQ(logits->shape[0], num_rsentries);
+        ICHECK_EQ(logits->shape[0], num_drafts);
         ICHECK_EQ(logits->shape[1], 1);
 
         // - Update logits.
-        logits = logits.CreateView({num_rsentries, logits->shape[2]}, logits->dtype);
-        logit_processor_->InplaceUpdateLogits(logits, generation_cfg, mstates, request_ids);
+        logits = logits.CreateView({num_drafts, logits->shape[2]}, logits->dtype);
+        logit_processor_->InplaceUpdateLogits(logits, draft_generation_cfg, mstates,
+                                              draft_request_ids);
 
         // - Compute probability distributions.
-        NDArray probs_on_device =
-            logit_processor_->ComputeProbsFromLogits(logits, generation_cfg, request_ids);
+        NDArray probs_on_device = logit_processor_->ComputeProbsFromLogits(
+            logits, draft_generation_cfg, draft_request_ids);
 
         // - Sample tokens.
-        // Fill range [0, num_rsentries) into `sample_indices`.
-        std::vector<int> sample_indices(num_rsentries);
+        // Fill range [0, num_drafts) into `sample_indices`.
+        std::vector<int> sample_indices(num_drafts);
         std::iota(sample_indices.begin(), sample_indices.end(), 0);
-        std::vector<NDArray> prob_dist;
         NDArray renormalized_probs = sampler_->BatchRenormalizeProbsByTopP(
-            probs_on_device, sample_indices, request_ids, generation_cfg);
+            probs_on_device, sample_indices, draft_request_ids, draft_generation_cfg);
         std::vector<SampleResult> sample_results = sampler_->BatchSampleTokensWithProbAfterTopP(
-            renormalized_probs, sample_indices, request_ids, generation_cfg, rngs);
-        ICHECK_EQ(sample_results.size(), num_rsentries);
+            renormalized_probs, sample_indices, draft_request_ids, draft_generation_cfg,
+            draft_rngs);
+        ICHECK_EQ(sample_results.size(), num_drafts);
 
         // - Add draft token to the state.
-        draft_token_workspace_manager_->AllocSlots(num_rsentries, &draft_token_slots_);
+        draft_token_workspace_manager_->AllocSlots(num_drafts, &draft_token_slots_);
+        NDArray draft_probs_storage = draft_token_workspace_manager_->GetDraftProbsStorage();
         models_[model_id]->ScatterDraftProbs(probs_on_device, draft_token_slots_,
-                                             &model_workspaces_[0].draft_probs_storage);
-        for (int i = 0; i < num_rsentries; ++i) {
+                                             &draft_probs_storage);
+        for (int i = 0; i < num_drafts; ++i) {
           mstates[i]->AddDraftToken(sample_results[i], draft_token_slots_[i]);
           estate->stats.total_draft_length += 1;
         }
@@ -145,6 +189,228 @@ class BatchDraftActionObj : public EngineActionObj {
   }
 
  private:
+  /*!
+   * \brief Decide the draft length of each request. The requests are decoded without
+   * speculation, with no draft token, when the batch is larger than the limit. The draft
+   * lengths are further bounded by the draft tokens the step planner allocates.
+   */
+  std::vector<int> GetDraftLengths(EngineState estate,
+                                   const std::vector<RequestStateEntry>& rsentries) {
+    if (max_batch_size_ != -1 && static_cast<int>(rsentries.size()) > max_batch_size_) {
+      return std::vector<int>(rsentries.size(), 0);
+    }
+    std::vector<int> draft_lengths;
+    draft_lengths.reserve(rsentries.size());
+    for (const RequestStateEntry& rsentry : rsentries) {
+      int draft_length = adaptive_draft_length_
+                             ? rsentry->spec_draft_controller.GetDraftLength(draft_length_)
+                             : draft_length_;
+      draft_lengths.push_back(estate->step_planner.GetDraftLength(draft_length, tree_width_));
+    }
+    return draft_lengths;
+  }
+
+  /*! \brief A node of the draft token trees that is decoded at the current level. */
+  struct FrontierNode {
+    /*! \brief The index of the request state entry. */
+    int rsentry_index;
+    /*! \brief The index of the draft token, or -1 for the last committed token. */
+    int draft_token_index;
+    /*! \brief The sequence in the draft model to decode the token in. */
+    int64_t seq_id;
+    /*! \brief The probability of the path to the node under the draft model. */
+    double path_prob;
+    /*! \brief The number of children to sample for the node. */
+    int num_children;
+  };
+
+  /*!
+   * \brief Run draft proposal in token trees. The tree of each request grows level by level
+   * until it reaches the draft length of the request, and each level has at most
+   * `tree_width_` draft tokens. Every decoded node samples its children i.i.d. from the draft
+   * distribution, and the duplicate children are merged, so that the verification stays
+   * exact. The number of children of each node is allocated by the path probability, where
+   * every node gets one child and the remaining budget of the level goes to the most probable
+   * node. The first child of a node is decoded in the sequence of the node, and the other children
+   * are decoded in sequences forked from it. The forked sequences are removed after
+   * verification or preemption.
+   */
+  void DraftTokenTrees(EngineState estate, const std::vector<RequestStateEntry>& rsentries,
+                       const std::vector<int>& draft_lengths, const Array<String>& request_ids,
+                       const Array<GenerationConfig>& generation_cfg,
+                       const std::vector<RandomGenerator*>& rngs) {
+    const int model_id = 1;
+    const Model& model = models_[model_id];
+    int num_rsentries = rsentries.size();
+
+    // - Decide the tree width and the draft generation config of each request.
+    std::vector<int> tree_widths;
+    Array<GenerationConfig> draft_generation_cfg;
+    std::vector<FrontierNode> frontier;
+    tree_widths.reserve(num_rsentries);
+    draft_generation_cfg.reserve(num_rsentries);
+    frontier.reserve(num_rsentries);
+    for (int i = 0; i < num_rsentries; ++i) {
+      const RequestModelState& mstate = rsentries[i]->mstates[model_id];
+      tree_widths.push_back(GetDraftTokenTreeWidth(generation_cfg[i], mstate, tree_width_));
+      GenerationConfig cfg = GetDraftTokenTreeGenerationConfig(generation_cfg[i], tree_widths[i]);
+      draft_generation_cfg.push_back(cfg);
+      if (draft_lengths[i] > 0) {
+        frontier.push_back({i, -1, mstate->internal_id, 1.0, tree_widths[i]});
+      }
+    }
+
+    for (int level = 0; !frontier.empty(); ++level) {
+      int num_rows = frontier.size();
+      std::vector<int> input_tokens;
+      std::vector<int64_t> seq_ids;
+      Array<RequestModelState> mstates;
+      Array<String> row_request_ids;
+      Array<GenerationConfig> row_generation_cfg;
+      Array<GenerationConfig> row_draft_generation_cfg;
+      input_tokens.reserve(num_rows);
+      seq_ids.reserve(num_rows);
+      for (const FrontierNode& node : frontier) {
+        const RequestModelState& mstate = rsentries[node.rsentry_index]->mstates[model_id];
+        if (node.draft_token_index == -1) {
+          input_tokens.push_back(mstate->committed_tokens.back().sampled_token_id.first);
+        } else {
+          input_tokens.push_back(
+              mstate->draft_output_tokens[node.draft_token_index].sampled_token_id.first);
+          mstate->draft_token_seq_ids[node.draft_token_index] = node.seq_id;
+        }
+        seq_ids.push_back(node.seq_id);
+        mstates.push_back(mstate);
+        row_request_ids.push_back(request_ids[node.rsentry_index]);
+        row_generation_cfg.push_back(generation_cfg[node.rsentry_index]);
+        row_draft_generation_cfg.push_back(draft_generation_cfg[node.rsentry_index]);
+      }
+
+      // - Compute embeddings.
+      RECORD_EVENT(trace_recorder_, request_ids, "start proposal embedding");
+      ObjectRef embeddings =
+          model->TokenEmbed({IntTuple{input_tokens.begin(), input_tokens.end()}});
+      RECORD_EVENT(trace_recorder_, request_ids, "finish proposal embedding");
+
+      // - Invoke model decode.
+      RECORD_EVENT(trace_recorder_, request_ids, "start proposal decode");
+      NDArray logits = model->BatchDecode(embeddings, seq_ids);
+      RECORD_EVENT(trace_recorder_, request_ids, "finish proposal decode");
+      ICHECK_EQ(logits->ndim, 3);
+      ICHECK_EQ(logits->shape[0], num_rows);
+      ICHECK_EQ(logits->shape[1], 1);
+
+      // - Update logits and compute probability distributions.
+      logits = logits.CreateView({num_rows, logits->shape[2]}, logits->dtype);
+      logit_processor_->InplaceUpdateLogits(logits, row_generation_cfg, mstates, row_request_ids);
+      NDArray probs_on_device = logit_processor_->ComputeProbsFromLogits(
+          logits, row_draft_generation_cfg, row_request_ids);
+
+      // - Sample the children of each node.
+      std::vector<int> sample_indices;
+      Array<String> sample_request_ids;
+      Array<GenerationConfig> sample_generation_cfg;
+      std::vector<RandomGenerator*> sample_rngs;
+      for (int row = 0; row < num_rows; ++row) {
+        for (int j = 0; j < frontier[row].num_children; ++j) {
+          sample_indices.push_back(row);
+          sample_request_ids.push_back(row_request_ids[row]);
+          sample_generation_cfg.push_back(row_draft_generation_cfg[row]);
+          sample_rngs.push_back(rngs[frontier[row].rsentry_index]);
+        }
+      }
+      NDArray renormalized_probs = sampler_->BatchRenormalizeProbsByTopP(
+          probs_on_device, sample_indices, sample_request_ids, sample_generation_cfg);
+      std::vector<SampleResult> sample_results = sampler_->BatchSampleTokensWithProbAfterTopP(
+          renormalized_probs, sample_indices, sample_request_ids, sample_generation_cfg,
+          sample_rngs);
+      ICHECK_EQ(sample_results.size(), sample_indices.size());
+
+      // - Add the distinct children of each node to the tree.
+      std::vector<FrontierNode> children;
+      std::vector<int> child_rows;
+      std::vector<int64_t> parent_seq_ids;
+      for (int sample_id = 0, row = 0; row < num_rows; ++row) {
+        const FrontierNode& node = frontier[row];
+        const RequestModelState& mstate = rsentries[node.rsentry_index]->mstates[model_id];
+        std::unordered_set<int32_t> child_tokens;
+        for (int j = 0; j < node.num_children; ++j, ++sample_id) {
+          const SampleResult& sample_result = sample_results[sample_id];
+          if (!child_tokens.insert(sample_result.sampled_token_id.first).second) {
+            continue;
+          }
+          // The first child is decoded in the sequence of its parent.
+          int64_t seq_id = child_tokens.size() == 1 ? node.seq_id : -1;
+          children.push_back({node.rsentry_index,
+                              static_cast<int>(mstate->draft_output_tokens.size()), seq_id,
+                              node.path_prob * sample_result.sampled_token_id.second, 0});
+          child_rows.push_back(row);
+          parent_seq_ids.push_back(node.seq_id);
+          mstate->AddDraftToken(sample_result, /*draft_token_slot=*/-1,
+                                /*parent_idx=*/node.draft_token_index);
+          estate->stats.total_draft_length += 1;
+        }
+      }
+      draft_token_workspace_manager_->AllocSlots(children.size(), &draft_token_slots_);
+      NDArray draft_probs_buffer =
+          draft_token_workspace_manager_->GetDraftProbsBuffer(child_rows.size());
+      NDArray child_probs =
+          model->GatherDraftProbs(probs_on_device, child_rows, &draft_probs_buffer);
+      NDArray draft_probs_storage = draft_token_workspace_manager_->GetDraftProbsStorage();
+      model->ScatterDraftProbs(child_probs, draft_token_slots_, &draft_probs_storage);
+      for (int k = 0; k < static_cast<int>(children.size()); ++k) {
+        const FrontierNode& child = children[k];
+        rsentries[child.rsentry_index]
+            ->mstates[model_id]
+            ->draft_token_slots[child.draft_token_index] = draft_token_slots_[k];
+      }
+      // - Decide the nodes to decode at the next level. The children that are not the
+      // first child of their parent need forked sequences, which are skipped when the
+      // model does not have enough pages for them.
+      // The children at the last level of their tree are not decoded.
+      auto f_at_last_level = [&](const FrontierNode& child) {
+        return level + 1 >= draft_lengths[child.rsentry_index];
+      };
+      int num_decoded = 0;
+      int num_forks = 0;
+      for (const FrontierNode& child : children) {
+        num_decoded += !f_at_last_level(child);
+        num_forks += !f_at_last_level(child) && child.seq_id == -1;
+      }
+      bool can_fork = num_decoded + num_forks <= model->GetNumAvailablePages();
+      frontier.clear();
+      for (int k = 0; k < static_cast<int>(children.size()); ++k) {
+        FrontierNode& child = children[k];
+        if (f_at_last_level(child)) {
+          continue;
+        }
+        if (child.seq_id == -1) {
+          if (!can_fork) {
+            continue;
+          }
+          child.seq_id = estate->id_manager.GetNewId();
+          model->ForkSequence(parent_seq_ids[k], child.seq_id);
+        }
+        frontier.push_back(child);
+      }
+      // - Allocate the children to sample at the next level. The nodes of a request are
+      // consecutive in the frontier.
+      for (int begin = 0, end = 0; begin < static_cast<int>(frontier.size()); begin = end) {
+        int rsentry_index = frontier[begin].rsentry_index;
+        std::vector<double> path_probs;
+        while (end < static_cast<int>(frontier.size()) &&
+               frontier[end].rsentry_index == rsentry_index) {
+          path_probs.push_back(frontier[end++].path_prob);
+        }
+        std::vector<int> num_children =
+            AllocateDraftTokenTreeChildren(path_probs, tree_widths[rsentry_index]);
+        for (int k = begin; k < end; ++k) {
+          frontier[k].num_children = num_children[k - begin];
+        }
+      }
+    }
+  }
+
   /*! \brief Check if the input requests can be decoded under conditions. */
   bool CanDecode(int num_rsentries) {
     // The first model is not involved in draft proposal.
@@ -172,6 +438,12 @@ class BatchDraftActionObj : public EngineActionObj {
   Optional<EventTraceRecorder> trace_recorder_;
   /*! \brief Draft proposal length */
   int draft_length_;
+  /*! \brief The maximum number of draft tokens at each level of a draft token tree. */
+  int tree_width_;
+  /*! \brief Whether to adapt the draft length of each request to its acceptance rate. */
+  bool adaptive_draft_length_;
+  /*! \brief The largest batch size to draft for, or -1 for no limit. */
+  int max_batch_size_;
   /*! \brief Temporary buffer to store the slots of the current draft tokens */
   std::vector<int> draft_token_slots_;
 };
@@ -179,12 +451,14 @@ class BatchDraftActionObj : public EngineActionObj {
 EngineAction EngineAction::BatchDraft(Array<Model> models, LogitProcessor logit_processor,
                                       Sampler sampler, std::vector<ModelWorkspace> model_workspaces,
                                       DraftTokenWorkspaceManager draft_token_workspace_manager,
-                                      Optional<EventTraceRecorder> trace_recorder,
-                                      int draft_length) {
+                                      Optional<EventTraceRecorder> trace_recorder, int draft_length,
+                                      int tree_width, bool adaptive_draft_length,
+                                      int max_batch_size) {
   return EngineAction(make_object<BatchDraftActionObj>(
       std::move(models), std::move(logit_processor), std::move(sampler),
       std::move(model_workspaces), std::move(draft_token_workspace_manager),
-      std::move(trace_recorder), draft_length));
+      std::move(trace_recorder), draft_length, tree_width, adaptive_draft_length,
+      max_batch_size));
 }
 
 }  // namespace serve
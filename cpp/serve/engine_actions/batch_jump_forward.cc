@@ -0,0 +1,247 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/engine_actions/batch_jump_forward.cc
+ */
+
+#include <tvm/runtime/nvtx.h>
+
+#include <algorithm>
+#include <numeric>
+
+#include "../config.h"
+#include "../model.h"
+#include "../sampler/sampler.h"
+#include "action.h"
+#include "action_commons.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*!
+ * \brief The action that decodes the requests in the `running_queue` of
+ * engine state with jump-forward decoding. When the grammar of a request
+ * forces a unique continuation string (e.g., JSON keys and punctuation), the
+ * tokens of the string are fed to the model together with the last committed
+ * token in one prefill-style forward pass, instead of being decoded one by one.
+ * The forced tokens are committed without sampling, and one new token is sampled
+ * from the logits at the last position of each request. Requests without forced
+ * tokens take one token in the same forward pass, as in decode.
+ * \note The action does not take effect when no running request has forced
+ * tokens, or when there are multiple models. The BatchDecode action decodes
+ * the running requests then.
+ */
+class BatchJumpForwardActionObj : public EngineActionObj {
+ public:
+  explicit BatchJumpForwardActionObj(Array<Model> models, LogitProcessor logit_processor,
+                                     Sampler sampler, std::vector<ModelWorkspace> model_workspaces,
+                                     EngineConfig engine_config,
+                                     Optional<EventTraceRecorder> trace_recorder)
+      : models_(std::move(models)),
+        logit_processor_(std::move(logit_processor)),
+        sampler_(std::move(sampler)),
+        model_workspaces_(std::move(model_workspaces)),
+        engine_config_(std::move(engine_config)),
+        trace_recorder_(std::move(trace_recorder)) {}
+
+  const char* Name() const final { return "BatchJumpForward"; }
+
+  Array<Request> Step(EngineState estate) final {
+    // - Do not run when there are multiple models or no running requests.
+    if (models_.size() > 1 || estate->running_queue.empty()) {
+      return {};
+    }
+
+    std::vector<RequestStateEntry> running_rsentries;
+    std::vector<std::vector<int32_t>> jump_forward_tokens;
+    {
+      NVTXScopedRange nvtx_scope("BatchJumpForward getting requests");
+      running_rsentries = GetRunningRequestStateEntries(estate);
+      if (std::none_of(running_rsentries.begin(), running_rsentries.end(),
+                       [](const RequestStateEntry& rsentry) {
+                         return rsentry->mstates[0]->RequireNextTokenBitmask();
+                       })) {
+        return {};
+      }
+      // The forced tokens depend on the grammar states after the post-processing of the last
+      // step, which also releases the finished requests.
+      estate->FlushDeferredPostProcess();
+      running_rsentries = GetRunningRequestStateEntries(estate);
+      jump_forward_tokens = GetJumpForwardTokens(running_rsentries);
+      if (std::all_of(jump_forward_tokens.begin(), jump_forward_tokens.end(),
+                      [](const std::vector<int32_t>& tokens) { return tokens.empty(); })) {
+        return {};
+      }
+    }
+
+    auto tstart = std::chrono::high_resolution_clock::now();
+
+    // Collect
+    // - the last committed token and the forced tokens,
+    // - the request id,
+    // - the generation config,
+    // - the random number generator,
+    // of each request state entry.
+    int num_rsentries = running_rsentries.size();
+    std::vector<int32_t> input_tokens;
+    std::vector<int> lengths;
+    Array<String> request_ids;
+    std::vector<int64_t> request_internal_ids;
+    Array<RequestModelState> mstates;
+    Array<GenerationConfig> generation_cfg;
+    std::vector<RandomGenerator*> rngs;
+    lengths.reserve(num_rsentries);
+    request_ids.reserve(num_rsentries);
+    request_internal_ids.reserve(num_rsentries);
+    mstates.reserve(num_rsentries);
+    generation_cfg.reserve(num_rsentries);
+    rngs.reserve(num_rsentries);
+    for (int i = 0; i < num_rsentries; ++i) {
+      const RequestStateEntry& rsentry = running_rsentries[i];
+      input_tokens.push_back(rsentry->mstates[0]->committed_tokens.back().sampled_token_id.first);
+      input_tokens.insert(input_tokens.end(), jump_forward_tokens[i].begin(),
+                          jump_forward_tokens[i].end());
+      lengths.push_back(1 + jump_forward_tokens[i].size());
+      request_ids.push_back(rsentry->request->id);
+      request_internal_ids.push_back(rsentry->mstates[0]->internal_id);
+      mstates.push_back(rsentry->mstates[0]);
+      generation_cfg.push_back(rsentry->request->generation_cfg);
+      rngs.push_back(&rsentry->rng);
+    }
+
+    // - Compute embeddings.
+    RECORD_EVENT(trace_recorder_, request_ids, "start embedding");
+    ObjectRef embeddings = model_workspaces_[0].embeddings;
+    embeddings = TokenData(input_tokens)->GetEmbedding(models_[0], &embeddings, /*offset=*/0);
+    RECORD_EVENT(trace_recorder_, request_ids, "finish embedding");
+
+    // - Invoke model prefill, which gives the logits at the last position of each request.
+    RECORD_EVENT(trace_recorder_, request_ids, "start jump-forward");
+    NDArray logits = models_[0]->BatchPrefill(embeddings, request_internal_ids, lengths);
+    RECORD_EVENT(trace_recorder_, request_ids, "finish jump-forward");
+    ICHECK_EQ(logits->ndim, 3);
+    ICHECK_EQ(logits->shape[0], 1);
+    ICHECK_EQ(logits->shape[1], num_rsentries);
+
+    // - Commit the forced tokens, which advances the grammar states that the logit
+    // processor masks the logits with.
+    for (int i = 0; i < num_rsentries; ++i) {
+      for (int32_t token_id : jump_forward_tokens[i]) {
+        mstates[i]->CommitToken(SampleResult{{token_id, 1.0f}, {}});
+      }
+      estate->stats.total_jump_forward_length += jump_forward_tokens[i].size();
+    }
+
+    // - Update logits.
+    logits = logits.CreateView({num_rsentries, logits->shape[2]}, logits->dtype);
+    logit_processor_->InplaceUpdateLogits(logits, generation_cfg, mstates, request_ids);
+
+    // - Compute probability distributions.
+    NDArray probs_on_device =
+        logit_processor_->ComputeProbsFromLogits(logits, generation_cfg, request_ids);
+
+    // - Sample tokens.
+    // Fill range [0, num_rsentries) into `sample_indices`.
+    std::vector<int> sample_indices(num_rsentries);
+    std::iota(sample_indices.begin(), sample_indices.end(), 0);
+    NDArray renormalized_probs = sampler_->BatchRenormalizeProbsByTopP(
+        probs_on_device, sample_indices, request_ids, generation_cfg);
+    std::vector<SampleResult> sample_results = sampler_->BatchSampleTokensWithProbAfterTopP(
+        renormalized_probs, sample_indices, request_ids, generation_cfg, rngs);
+    ICHECK_EQ(sample_results.size(), num_rsentries);
+
+    // - Update the committed tokens of states.
+    for (int i = 0; i < num_rsentries; ++i) {
+      mstates[i]->CommitToken(sample_results[i]);
+    }
+
+    auto tend = std::chrono::high_resolution_clock::now();
+    estate->stats.engine_total_decode_time += static_cast<double>((tend - tstart).count()) / 1e9;
+
+    return estate->running_queue;
+  }
+
+ private:
+  /*!
+   * \brief Get the forced tokens of each request state entry. The number of forced tokens is
+   * bounded by the jump-forward limit in engine config and the remaining generation length of
+   * the request. The forced tokens of the last entries are dropped when all the tokens cannot
+   * fit in the prefill chunk or the available KV cache pages.
+   */
+  std::vector<std::vector<int32_t>> GetJumpForwardTokens(
+      const std::vector<RequestStateEntry>& rsentries) {
+    int num_rsentries = rsentries.size();
+    std::vector<std::vector<int32_t>> jump_forward_tokens(num_rsentries);
+    int total_length = num_rsentries;
+    int num_required_pages = num_rsentries;
+    int num_available_pages = models_[0]->GetNumAvailablePages();
+    int page_size = engine_config_->kv_cache_page_size;
+    for (int i = 0; i < num_rsentries; ++i) {
+      const RequestStateEntry& rsentry = rsentries[i];
+      RequestModelState mstate = rsentry->mstates[0];
+      int max_num_tokens = engine_config_->grammar_jump_forward_max_tokens;
+      // Leave room for the token sampled after the forced tokens.
+      int64_t sequence_length = mstate->num_prefilled_tokens + mstate->committed_tokens.size();
+      max_num_tokens = std::min<int64_t>(
+          max_num_tokens, engine_config_->max_single_sequence_length - sequence_length - 1);
+      if (rsentry->request->generation_cfg->max_tokens >= 0) {
+        max_num_tokens = std::min<int64_t>(
+            max_num_tokens,
+            rsentry->request->generation_cfg->max_tokens - mstate->committed_tokens.size() - 1);
+      }
+      max_num_tokens = std::min<int64_t>(
+          max_num_tokens, engine_config_->prefill_chunk_size - total_length);
+      if (max_num_tokens <= 0) {
+        continue;
+      }
+      std::vector<int32_t> tokens = mstate->FindJumpForwardTokens(max_num_tokens);
+      if (tokens.empty()) {
+        continue;
+      }
+      // The last committed token and the n forced tokens take at most ceil((n + 1) / page_size)
+      // new pages, one of which is already counted for decode.
+      int num_pages = (tokens.size() + page_size) / page_size;
+      if (num_required_pages - 1 + num_pages > num_available_pages) {
+        continue;
+      }
+      num_required_pages += num_pages - 1;
+      total_length += tokens.size();
+      jump_forward_tokens[i] = std::move(tokens);
+    }
+    if (num_required_pages > num_available_pages) {
+      // Even decode cannot run. The BatchDecode action preempts requests then.
+      return std::vector<std::vector<int32_t>>(num_rsentries);
+    }
+    return jump_forward_tokens;
+  }
+
+  /*!
+   * \brief The model to run jump-forward decoding in. When there are multiple
+   * models, the `Step` function of the created action will not take effect.
+   */
+  Array<Model> models_;
+  /*! \brief The logit processor. */
+  LogitProcessor logit_processor_;
+  /*! \brief The sampler to sample new tokens. */
+  Sampler sampler_;
+  /*! \brief Workspace of each model. */
+  std::vector<ModelWorkspace> model_workspaces_;
+  /*! \brief The engine config. */
+  EngineConfig engine_config_;
+  /*! \brief Event trace recorder. */
+  Optional<EventTraceRecorder> trace_recorder_;
+};
+
+EngineAction EngineAction::BatchJumpForward(Array<Model> models, LogitProcessor logit_processor,
+                                            Sampler sampler,
+                                            std::vector<ModelWorkspace> model_workspaces,
+                                            EngineConfig engine_config,
+                                            Optional<EventTraceRecorder> trace_recorder) {
+  return EngineAction(make_object<BatchJumpForwardActionObj>(
+      std::move(models), std::move(logit_processor), std::move(sampler),
+      std::move(model_workspaces), std::move(engine_config), std::move(trace_recorder)));
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
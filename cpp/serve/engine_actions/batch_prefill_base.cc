@@ -5,7 +5,11 @@
 
 #include "batch_prefill_base.h"
 
+#include <algorithm>
+#include <limits>
 #include <numeric>
+#include <string_view>
+#include <unordered_map>
 
 #include "../../support/json_parser.h"
 
@@ -13,6 +17,25 @@ namespace mlc {
 namespace llm {
 namespace serve {
 
+namespace {
+
+/*! \brief Get the leading tokens of the request inputs up to the given length. */
+std::vector<int64_t> GetLeadingInputTokens(const Request& request, size_t max_length) {
+  std::vector<int64_t> tokens;
+  for (const Data& input : request->inputs) {
+    const auto* token_data = input.as<TokenDataNode>();
+    if (token_data == nullptr || tokens.size() == max_length) {
+      break;
+    }
+    size_t length = std::min(max_length - tokens.size(), token_data->token_ids.size());
+    tokens.insert(tokens.end(), token_data->token_ids.begin(),
+                  token_data->token_ids.begin() + length);
+  }
+  return tokens;
+}
+
+}  // namespace
+
 BatchPrefillBaseActionObj::BatchPrefillBaseActionObj(Array<Model> models,
                                                      EngineConfig engine_config,
                                                      std::vector<picojson::object> model_configs,
@@ -32,14 +55,23 @@ BatchPrefillBaseActionObj::BatchPrefillBaseActionObj(Array<Model> models,
 /*!
  * \brief Find one or multiple request state entries to run prefill.
  * \param estate The engine state.
+ * \param num_decode_tokens The number of decode tokens packed into the same forward pass,
+ * which take up the prefill chunk.
  * \return The request entries to prefill, together with their input lengths.
  */
 std::vector<BatchPrefillBaseActionObj::PrefillInput>
-BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
-  if (estate->waiting_queue.empty()) {
+BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate,
+                                                           int num_decode_tokens) {
+  // The decode tokens packed into the same forward pass take up the prefill chunk.
+  int prefill_chunk_size = estate->step_planner.prefill_chunk_size - num_decode_tokens;
+  if (estate->waiting_queue.empty() || prefill_chunk_size <= 0) {
     // No request to prefill.
     return {};
   }
+  // Let the scheduler policy decide the order to walk the waiting queue.
+  estate->scheduler_policy->SortWaitingQueue(&estate->waiting_queue, estate->request_states);
+  std::unordered_set<const RequestNode*> requests_waiting_for_prefix =
+      GetRequestsWaitingForSharedPrefix(estate);
 
   std::vector<std::vector<PrefillInput>> prefill_inputs_for_all_models;
   prefill_inputs_for_all_models.reserve(models_.size());
@@ -55,10 +87,37 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
     int num_running_rsentries = GetRunningRequestStateEntries(estate).size();
     int current_total_seq_len = models_[i]->GetCurrentTotalSequenceLength();
     KVStateKind kv_state_kind = models_[i]->GetMetadata().kv_state_kind;
+    // The pages reserved for the headroom and the forecast decode of the running requests,
+    // which the admission of new requests leaves free.
+    bool reserve_pages = kv_state_kind == KVStateKind::kKVCache;
+    int num_reserved_pages = reserve_pages ? GetNumReservedPages(estate, i) : 0;
+    // The KV tokens held by each tenant, when the tenants are capped.
+    std::unordered_map<std::string, int64_t> tenant_kv_tokens;
+    bool cap_tenants = engine_config_->tenant_max_kv_tokens != -1 &&
+                       kv_state_kind == KVStateKind::kKVCache;
+    if (cap_tenants) {
+      tenant_kv_tokens = GetTenantKVTokens(estate, i);
+    }
 
     int num_prefill_rsentries = 0;
     for (const Request& request : estate->waiting_queue) {
+      // The cancelled requests are aborted after the action, and are not prefilled.
+      if (requests_waiting_for_prefix.count(request.get()) ||
+          estate->cancelled_requests->Contains(request->id)) {
+        continue;
+      }
       RequestState rstate = estate->GetRequestState(request);
+      if (cap_tenants && rstate->entries[0]->status == RequestStateStatus::kPending) {
+        // A new request is not admitted while it takes its tenant over the cap, unless
+        // the tenant holds nothing. The requests of other tenants can still be admitted.
+        int64_t& num_tenant_tokens = tenant_kv_tokens[request->generation_cfg->tenant_id];
+        int64_t num_input_tokens = rstate->entries[0]->mstates[i]->GetInputLength();
+        if (num_tenant_tokens > 0 &&
+            num_tenant_tokens + num_input_tokens > engine_config_->tenant_max_kv_tokens) {
+          continue;
+        }
+        num_tenant_tokens += num_input_tokens;
+      }
       bool prefill_stops = false;
       for (const RequestStateEntry& rsentry : rstate->entries) {
         // A request state entry can be prefilled only when:
@@ -72,50 +131,80 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
         }
 
         int input_length = rsentry->mstates[i]->GetInputLength();
+        // The prefix that prefix cache provides is not prefilled, so that the new entries are
+        // charged with the estimated length beyond it. The estimate may be stale at matching,
+        // in which case the entry prefills the remaining inputs in later steps.
+        int estimated_cached_length = rsentry->request->estimated_cached_prefix_length;
+        bool skip_cached_prefix =
+            estimated_cached_length > 0 && rsentry->parent_idx == -1 &&
+            rsentry->status == RequestStateStatus::kPending && sliding_window_sizes_[i] == -1 &&
+            rsentry->request->generation_cfg->lora_adapter.empty() &&
+            !estate->prefix_cache->HasSequence(rsentry->mstates[i]->internal_id);
+        if (skip_cached_prefix) {
+          input_length = std::max(input_length - estimated_cached_length, 1);
+        }
         int num_require_pages = (input_length + engine_config_->kv_cache_page_size - 1) /
                                 engine_config_->kv_cache_page_size;
+        if (skip_cached_prefix) {
+          // Forking from the cached prefix copies its partially filled last page.
+          ++num_require_pages;
+        }
         bool sliding_window_enabled = sliding_window_sizes_[i] != -1;
         int num_required_pages_under_sliding_window = std::numeric_limits<int>::max();
         if (sliding_window_enabled) {
-          // Sliding window for model i is enabled.
-          int max_single_request_page_requirement =
-              1 + (sliding_window_sizes_[i] + engine_config_->kv_cache_page_size - 1) /
-                      engine_config_->kv_cache_page_size;
-          int num_total_prefilled_tokens = rsentry->mstates[i]->num_prefilled_tokens;
-          int parent_ptr = rsentry->parent_idx;
-          while (parent_ptr != -1) {
-            num_total_prefilled_tokens +=
-                rstate->entries[parent_ptr]->mstates[i]->num_prefilled_tokens;
-            parent_ptr = rstate->entries[parent_ptr]->parent_idx;
-          }
-
-          int num_pages_in_use = (std::min(num_total_prefilled_tokens, sliding_window_sizes_[i]) +
-                                  engine_config_->kv_cache_page_size - 1) /
-                                 engine_config_->kv_cache_page_size;
+          // Sliding window for model i is enabled. The entry holds at most the bounded
+          // footprint of the window and the attention sink.
           num_required_pages_under_sliding_window =
-              max_single_request_page_requirement - num_pages_in_use;
+              GetSlidingWindowPageBound(models_[i], engine_config_->kv_cache_page_size) -
+              GetNumPagesInUse(estate, rsentry, i);
           num_require_pages = std::min(num_require_pages, num_required_pages_under_sliding_window);
           ICHECK_GE(num_require_pages, 0);
         }
 
+        // A new request is admitted only when the reserved pages stay free, unless nothing else
+        // runs. The request entries already admitted continue their prefill regardless.
+        bool admit_new = rsentry->status == RequestStateStatus::kPending;
+        bool apply_reservation =
+            reserve_pages && admit_new && (num_running_rsentries > 0 || num_prefill_rsentries > 0);
+        int num_forecast_pages_per_leaf =
+            reserve_pages && admit_new ? ForecastDecodePages(estate, rsentry, i) : 0;
+        // The pages required beyond the inputs, when the entry is admitted with the given
+        // number of children to activate.
+        auto f_extra_pages = [&](int num_child_to_activate) {
+          return apply_reservation ? num_reserved_pages + num_forecast_pages_per_leaf *
+                                                              std::max(num_child_to_activate, 1)
+                                   : 0;
+        };
+
         total_input_length += input_length;
         total_required_pages += num_require_pages;
         // - Attempt 1. Check if the entire request state entry can fit for prefill.
+        // The beams of beam search are activated all at once, since every beam takes part in
+        // each expansion step.
         bool can_prefill = false;
-        for (int num_child_to_activate = rsentry->child_indices.size(); num_child_to_activate >= 0;
-             --num_child_to_activate) {
+        int min_num_child_to_activate =
+            rsentry->request->generation_cfg->num_beams > 1 ? rsentry->child_indices.size() : 0;
+        for (int num_child_to_activate = rsentry->child_indices.size();
+             num_child_to_activate >= min_num_child_to_activate; --num_child_to_activate) {
+          int num_extra_pages = f_extra_pages(num_child_to_activate);
           while (!CanPrefill(estate, num_prefill_rsentries + 1 + num_child_to_activate,
-                             total_input_length, total_required_pages, num_available_pages,
+                             total_input_length + num_decode_tokens,
+                             total_required_pages + num_extra_pages, num_available_pages,
                              current_total_seq_len, num_running_rsentries, kv_state_kind,
                              sliding_window_enabled)) {
             if (!estate->prefix_cache->TryFreeMemory()) break;
           }
           if (CanPrefill(estate, num_prefill_rsentries + 1 + num_child_to_activate,
-                         total_input_length, total_required_pages, num_available_pages,
+                         total_input_length + num_decode_tokens,
+                         total_required_pages + num_extra_pages, num_available_pages,
                          current_total_seq_len, num_running_rsentries, kv_state_kind,
                          sliding_window_enabled)) {
             prefill_inputs.push_back({rsentry, input_length, num_child_to_activate});
             num_prefill_rsentries += 1 + num_child_to_activate;
+            if (reserve_pages && admit_new) {
+              num_reserved_pages +=
+                  num_forecast_pages_per_leaf * std::max(num_child_to_activate, 1);
+            }
             can_prefill = true;
             break;
           }
@@ -127,9 +216,9 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
         total_required_pages -= num_require_pages;
 
         // - Attempt 2. Check if the request state entry can partially fit by input chunking.
-        ICHECK_LE(total_input_length, engine_config_->prefill_chunk_size);
-        if (engine_config_->prefill_chunk_size - total_input_length >= input_length ||
-            engine_config_->prefill_chunk_size == total_input_length) {
+        ICHECK_LE(total_input_length, prefill_chunk_size);
+        if (prefill_chunk_size - total_input_length >= input_length ||
+            prefill_chunk_size == total_input_length) {
           // 1. If the input length can fit the remaining prefill chunk size,
           // it means the failure of attempt 1 is not because of the input
           // length being too long, and thus chunking does not help.
@@ -139,7 +228,7 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
           prefill_stops = true;
           break;
         }
-        input_length = engine_config_->prefill_chunk_size - total_input_length;
+        input_length = prefill_chunk_size - total_input_length;
         num_require_pages = (input_length + engine_config_->kv_cache_page_size - 1) /
                             engine_config_->kv_cache_page_size;
         if (sliding_window_enabled) {
@@ -150,9 +239,10 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
 
         total_input_length += input_length;
         total_required_pages += num_require_pages;
-        if (CanPrefill(estate, num_prefill_rsentries, total_input_length, total_required_pages,
-                       num_available_pages, current_total_seq_len, num_running_rsentries,
-                       kv_state_kind, sliding_window_enabled)) {
+        if (CanPrefill(estate, num_prefill_rsentries, total_input_length + num_decode_tokens,
+                       total_required_pages + f_extra_pages(0), num_available_pages,
+                       current_total_seq_len, num_running_rsentries, kv_state_kind,
+                       sliding_window_enabled)) {
           prefill_inputs.push_back({rsentry, input_length, 0});
         }
 
@@ -202,6 +292,126 @@ BatchPrefillBaseActionObj::GetRequestStateEntriesToPrefill(EngineState estate) {
   return prefill_inputs;
 }
 
+std::unordered_set<const RequestNode*> BatchPrefillBaseActionObj::GetRequestsWaitingForSharedPrefix(
+    EngineState estate) {
+  std::unordered_set<const RequestNode*> waiting_requests;
+  size_t min_length = engine_config_->prefix_share_min_length;
+  // Forking is not supported under sliding window, and there is nothing to fork from without
+  // prefix cache.
+  if (min_length == 0 || sliding_window_sizes_[0] != -1 ||
+      estate->prefix_cache->GetMatchIndex() == nullptr) {
+    return waiting_requests;
+  }
+  // The earliest request of each group of requests with the same first tokens, which
+  // prefills the shared prefix of the group. Its full tokens are collected when needed.
+  struct PrefixOwner {
+    Request request;
+    std::vector<int64_t> tokens;
+  };
+  std::unordered_map<std::string_view, PrefixOwner> prefix_owners;
+  std::vector<std::vector<int64_t>> first_tokens_of_owners;
+  first_tokens_of_owners.reserve(estate->waiting_queue.size());
+  for (const Request& request : estate->waiting_queue) {
+    if (!request->generation_cfg->lora_adapter.empty()) {
+      // The requests with LoRA adapters bypass prefix cache.
+      continue;
+    }
+    std::vector<int64_t> first_tokens = GetLeadingInputTokens(request, min_length);
+    if (first_tokens.size() < min_length) {
+      continue;
+    }
+    std::string_view key(reinterpret_cast<const char*>(first_tokens.data()),
+                         first_tokens.size() * sizeof(int64_t));
+    auto it_owner = prefix_owners.find(key);
+    if (it_owner == prefix_owners.end()) {
+      // The key views the tokens kept alive in the vector of first tokens.
+      first_tokens_of_owners.push_back(std::move(first_tokens));
+      const std::vector<int64_t>& owner_first_tokens = first_tokens_of_owners.back();
+      key = std::string_view(reinterpret_cast<const char*>(owner_first_tokens.data()),
+                             owner_first_tokens.size() * sizeof(int64_t));
+      prefix_owners.emplace(key, PrefixOwner{request, {}});
+      continue;
+    }
+    const RequestStateEntry& rsentry = estate->GetRequestState(request)->entries[0];
+    if (rsentry->status != RequestStateStatus::kPending ||
+        estate->prefix_cache->HasSequence(rsentry->mstates[0]->internal_id)) {
+      continue;
+    }
+    // Wait for the owner when the prefix shared beyond the cached part is long enough.
+    PrefixOwner& owner = it_owner->second;
+    if (owner.tokens.empty()) {
+      owner.tokens = GetLeadingInputTokens(owner.request, std::numeric_limits<size_t>::max());
+    }
+    std::vector<int64_t> tokens =
+        GetLeadingInputTokens(request, std::numeric_limits<size_t>::max());
+    size_t shared_length =
+        std::mismatch(tokens.begin(), tokens.begin() + std::min(tokens.size(), owner.tokens.size()),
+                      owner.tokens.begin())
+            .first -
+        tokens.begin();
+    size_t cached_length = std::max(request->estimated_cached_prefix_length, 0);
+    if (shared_length >= cached_length + min_length) {
+      waiting_requests.insert(request.get());
+    }
+  }
+  return waiting_requests;
+}
+
+std::unordered_map<std::string, int64_t> BatchPrefillBaseActionObj::GetTenantKVTokens(
+    EngineState estate, int model_id) {
+  std::unordered_map<std::string, int64_t> tenant_kv_tokens;
+  for (const Request& request : estate->running_queue) {
+    int64_t& num_tokens = tenant_kv_tokens[request->generation_cfg->tenant_id];
+    for (const RequestStateEntry& rsentry : estate->GetRequestState(request)->entries) {
+      // The prefix of a forked entry is counted once, in its parent.
+      if (rsentry->status == RequestStateStatus::kAlive) {
+        num_tokens += rsentry->mstates[model_id]->num_prefilled_tokens +
+                      rsentry->mstates[model_id]->committed_tokens.size();
+      }
+    }
+  }
+  return tenant_kv_tokens;
+}
+
+int BatchPrefillBaseActionObj::GetNumReservedPages(EngineState estate, int model_id) {
+  int page_size = engine_config_->kv_cache_page_size;
+  int num_reserved_pages = static_cast<int>(engine_config_->admission_kv_headroom *
+                                            engine_config_->max_total_sequence_length / page_size);
+  for (const Request& request : estate->running_queue) {
+    for (const RequestStateEntry& rsentry : estate->GetRequestState(request)->entries) {
+      if (rsentry->status == RequestStateStatus::kAlive && rsentry->child_indices.empty()) {
+        num_reserved_pages += ForecastDecodePages(estate, rsentry, model_id);
+      }
+    }
+  }
+  return num_reserved_pages;
+}
+
+int BatchPrefillBaseActionObj::ForecastDecodePages(EngineState estate,
+                                                   const RequestStateEntry& rsentry,
+                                                   int model_id) {
+  int64_t num_remaining_tokens = estate->output_length_forecaster.ForecastRemainingLength(
+      rsentry->mstates[model_id]->committed_tokens.size(),
+      rsentry->request->generation_cfg->max_tokens);
+  int page_size = engine_config_->kv_cache_page_size;
+  int num_pages = static_cast<int>((num_remaining_tokens + page_size - 1) / page_size);
+  int page_bound = GetSlidingWindowPageBound(models_[model_id], page_size);
+  if (page_bound != -1) {
+    // The decode under sliding window grows the sequence no further than the page bound.
+    num_pages = std::min(num_pages, page_bound - GetNumPagesInUse(estate, rsentry, model_id));
+  }
+  return num_pages;
+}
+
+int BatchPrefillBaseActionObj::GetNumPagesInUse(EngineState estate,
+                                                const RequestStateEntry& rsentry, int model_id) {
+  int page_size = engine_config_->kv_cache_page_size;
+  int64_t length = GetRequestStateEntrySequenceLength(estate, rsentry, model_id);
+  int num_pages = static_cast<int>((length + page_size - 1) / page_size);
+  int page_bound = GetSlidingWindowPageBound(models_[model_id], page_size);
+  return page_bound == -1 ? num_pages : std::min(num_pages, page_bound);
+}
+
 bool BatchPrefillBaseActionObj::CanPrefill(EngineState estate, int num_prefill_rsentries,
                                            int total_input_length, int num_required_pages,
                                            int num_available_pages, int current_total_seq_len,
@@ -216,12 +426,19 @@ bool BatchPrefillBaseActionObj::CanPrefill(EngineState estate, int num_prefill_r
 
   // No exceeding of the maximum allowed requests that can
   // run simultaneously.
-  int spec_factor = engine_config_->speculative_mode != SpeculativeMode::kDisable
-                        ? (engine_config_->spec_draft_length + 1)
-                        : 1;
+  // Under the step token budget, the draft lengths shrink with the running requests, so
+  // each request entry only needs its decode token in the budget.
+  bool step_budget_enabled = estate->step_planner.token_budget > 0;
+  int spec_factor =
+      engine_config_->speculative_mode != SpeculativeMode::kDisable && !step_budget_enabled
+          ? (engine_config_->spec_draft_length + 1)
+          : 1;
+  int max_num_tokens = step_budget_enabled ? estate->step_planner.token_budget
+                                           : static_cast<int>(engine_config_->prefill_chunk_size);
+  // The running requests are capped lower when the device is hot or on low battery.
   if ((num_running_rsentries + num_prefill_rsentries) * spec_factor >
-      std::min(static_cast<int64_t>(engine_config_->max_num_sequence),
-               engine_config_->prefill_chunk_size)) {
+      std::min(estate->power_controller.ScaleCapacity(engine_config_->max_num_sequence),
+               static_cast<int64_t>(max_num_tokens))) {
     return false;
   }
 
@@ -232,7 +449,7 @@ bool BatchPrefillBaseActionObj::CanPrefill(EngineState estate, int num_prefill_r
   // exceed the limit, where 8 is a watermark number can
   // be configured and adjusted in the future.
   int new_batch_size = num_running_rsentries + num_prefill_rsentries;
-  return total_input_length <= engine_config_->prefill_chunk_size &&
+  return total_input_length <= estate->step_planner.prefill_chunk_size &&
          num_required_pages + (!sliding_window_enabled ? new_batch_size : 0) <=
              num_available_pages &&
          (sliding_window_enabled ||
@@ -298,10 +515,10 @@ std::pair<Array<Data>, int> BatchPrefillBaseActionObj::ChunkPrefillInputData(
     // Return the first part for prefill, and keep the second part.
     int chunked_input_length = max_prefill_length - cum_input_length;
     ICHECK_GT(input_length, chunked_input_length);
-    TokenData chunked_input(IntTuple{token_input->token_ids.begin(),
-                                     token_input->token_ids.begin() + chunked_input_length});
-    TokenData remaining_input(IntTuple{token_input->token_ids.begin() + chunked_input_length,
-                                       token_input->token_ids.end()});
+    // The parts view into the token data, so that a long input is not copied at every chunk.
+    TokenData token_data = Downcast<TokenData>(input);
+    TokenData chunked_input = token_data.Slice(0, chunked_input_length);
+    TokenData remaining_input = token_data.Slice(chunked_input_length, input_length);
     inputs.push_back(chunked_input);
     cum_input_length += chunked_input_length;
     std::vector<Data> remaining_inputs{mstate->inputs.begin() + i + 1, mstate->inputs.end()};
@@ -341,6 +558,9 @@ void BatchPrefillBaseActionObj::UpdateRequestToAlive(
       }
       if (!alive_state_existed) {
         estate->running_queue.push_back(request);
+        if (!request_rstate->metrics.tfirst_scheduled.has_value()) {
+          request_rstate->metrics.tfirst_scheduled = std::chrono::high_resolution_clock::now();
+        }
       }
     }
     rstates_of_entries->push_back(std::move(request_rstate));
@@ -409,6 +629,12 @@ IntTuple BatchPrefillBaseActionObj::GetConcatPrefillInputData(const RequestModel
     if (const TokenDataNode* token_data = data.as<TokenDataNode>()) {
       tokens.reserve(tokens.size() + token_data->GetLength());
       tokens.insert(tokens.end(), token_data->token_ids.begin(), token_data->token_ids.end());
+    } else if (const ImageDataNode* image_data = data.as<ImageDataNode>();
+               image_data != nullptr && image_data->content_hash != 0 &&
+               models_[0]->GetSlidingWindowSize() == -1) {
+      // Sliding window forbids rolling back, which aligning the matches to images requires.
+      std::vector<int64_t> image_tokens = image_data->GetPrefixCacheTokens();
+      tokens.insert(tokens.end(), image_tokens.begin(), image_tokens.end());
     } else {
       return IntTuple({});
     }
@@ -416,6 +642,38 @@ IntTuple BatchPrefillBaseActionObj::GetConcatPrefillInputData(const RequestModel
   return IntTuple(tokens);
 }
 
+void BatchPrefillBaseActionObj::AlignPrefixCacheMatchToInputs(EngineState estate,
+                                                              const RequestStateEntry& rsentry,
+                                                              PrefixCacheMatchedResult* result) {
+  size_t input_start = 0;
+  size_t aligned_offset = result->prefilled_offset;
+  for (const Data& data : rsentry->mstates[0]->inputs) {
+    size_t input_end = input_start + data->GetLength();
+    if (input_end > result->prefilled_offset) {
+      if (data.as<ImageDataNode>() != nullptr && input_start < result->prefilled_offset) {
+        aligned_offset = input_start;
+      }
+      break;
+    }
+    input_start = input_end;
+  }
+  if (aligned_offset == result->prefilled_offset) {
+    return;
+  }
+  size_t num_excess_tokens = result->prefilled_offset - aligned_offset;
+  if (result->reused_seq_id != -1) {
+    estate->prefix_cache->RollBackSequence(result->reused_seq_id, num_excess_tokens);
+    result->reused_seq_pop_last_tokens += num_excess_tokens;
+  } else {
+    estate->prefix_cache->RollBackSequence(rsentry->mstates[0]->internal_id, num_excess_tokens);
+    if (aligned_offset == 0) {
+      // Nothing is left to fork from, so the sequence is added as a new one.
+      result->forked_seq_id = -1;
+    }
+  }
+  result->prefilled_offset = aligned_offset;
+}
+
 void BatchPrefillBaseActionObj::PopPrefillInputData(const RequestModelState& mstate,
                                                     size_t num_tokens) {
   while (mstate->inputs[0]->GetLength() <= num_tokens) {
@@ -423,13 +681,8 @@ void BatchPrefillBaseActionObj::PopPrefillInputData(const RequestModelState& mst
     mstate->inputs.erase(mstate->inputs.begin());
   }
   if (num_tokens) {
-    const TokenDataNode* token_data = mstate->inputs[0].as<TokenDataNode>();
-    std::vector<int32_t> tokens;
-    tokens.reserve(token_data->GetLength() - num_tokens);
-    tokens.insert(tokens.begin(), token_data->token_ids.begin() + num_tokens,
-                  token_data->token_ids.end());
-    mstate->inputs.erase(mstate->inputs.begin());
-    mstate->inputs.insert(mstate->inputs.begin(), TokenData(tokens));
+    TokenData token_data = Downcast<TokenData>(mstate->inputs[0]);
+    mstate->inputs.Set(0, token_data.Slice(num_tokens, token_data->GetLength()));
   }
 }
 
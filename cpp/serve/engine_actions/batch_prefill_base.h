@@ -5,6 +5,10 @@
 
 #include <tvm/runtime/nvtx.h>
 
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
 #include "../config.h"
 #include "../model.h"
 #include "action.h"
@@ -34,9 +38,43 @@ class BatchPrefillBaseActionObj : public EngineActionObj {
   /*!
    * \brief Find one or multiple request state entries to run prefill.
    * \param estate The engine state.
+   * \param num_decode_tokens The number of decode tokens packed into the same forward pass,
+   * which take up the prefill chunk.
    * \return The request entries to prefill, together with their input lengths.
    */
-  std::vector<PrefillInput> GetRequestStateEntriesToPrefill(EngineState estate);
+  std::vector<PrefillInput> GetRequestStateEntriesToPrefill(EngineState estate,
+                                                            int num_decode_tokens = 0);
+
+  /*!
+   * \brief Get the pending requests that share a long uncached prefix with an earlier request
+   * in the waiting queue. They are not prefilled until the earlier request has prefilled the
+   * shared prefix, so that they fork the prefix from prefix cache rather than prefilling it
+   * again in the same batch.
+   * \param estate The engine state, whose waiting queue is already sorted.
+   * \return The requests to skip in this step.
+   */
+  std::unordered_set<const RequestNode*> GetRequestsWaitingForSharedPrefix(EngineState estate);
+
+  /*!
+   * \brief Get the KV cache tokens that the running requests of each tenant hold in the given
+   * model, against which the admission of new requests checks "tenant_max_kv_tokens".
+   */
+  std::unordered_map<std::string, int64_t> GetTenantKVTokens(EngineState estate, int model_id);
+
+  /*!
+   * \brief Get the KV cache pages the admission of new requests leaves free for the given
+   * model, which cover the headroom and the forecast decode of the running requests.
+   */
+  int GetNumReservedPages(EngineState estate, int model_id);
+
+  /*! \brief Forecast the KV cache pages the given request state entry takes to decode. */
+  int ForecastDecodePages(EngineState estate, const RequestStateEntry& rsentry, int model_id);
+
+  /*!
+   * \brief Get the KV cache pages the given request state entry holds in the given model,
+   * which are bounded under sliding window.
+   */
+  int GetNumPagesInUse(EngineState estate, const RequestStateEntry& rsentry, int model_id);
 
   /*! \brief Check if the input requests can be prefilled under conditions. */
   bool CanPrefill(EngineState estate, int num_prefill_rsentries, int total_input_length,
@@ -97,12 +135,24 @@ class BatchPrefillBaseActionObj : public EngineActionObj {
 
   /*!
    * \brief Get the concatenated IntTuple of RequestModelState input data, return empty IntTuple if
-   * there is untokenized data.
+   * there is untokenized data. The images of known content hash are represented by their
+   * prefix cache tokens when sliding window is disabled.
    * \param mstate The RequestModelState whose input data is to be concatenated.
    * \return The concatenate IntTuple.
    */
   IntTuple GetConcatPrefillInputData(const RequestModelState& mstate);
 
+  /*!
+   * \brief Align the prefix cache match of the request state entry to the start of the image
+   * that the match ends in, as an image cannot be partially prefilled. The excess matched
+   * tokens are rolled back from prefix cache, and from the reused sequence if any.
+   * \param estate The engine state.
+   * \param rsentry The request state entry whose sequence is just inserted into prefix cache.
+   * \param[in, out] result The prefix cache matched result to align.
+   */
+  void AlignPrefixCacheMatchToInputs(EngineState estate, const RequestStateEntry& rsentry,
+                                     PrefixCacheMatchedResult* result);
+
   /*!
    * \brief Pop the prefix tokens of the RequestModelState input data array.
    * \param mstate The RequestModelState to be popped.
@@ -0,0 +1,246 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/engine_actions/batch_prefill_only.cc
+ */
+
+#include <tvm/runtime/nvtx.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "../config.h"
+#include "../model.h"
+#include "action.h"
+#include "action_commons.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*!
+ * \brief The action that prefills the requests in the `prefill_only_queue` of engine state.
+ * The prompts of many requests are prefilled together to the hidden states of all the prompt
+ * tokens, from which the output of each request is computed. The KV cache sequence of each
+ * request is removed right after the prefill, and the request finishes in the same step
+ * without sampling any token, so that the prefilled KV data is not kept in prefix cache.
+ * \note The prompt of each prefill-only request fits in one prefill chunk, which is checked
+ * when the request is added to the engine.
+ */
+class BatchPrefillOnlyActionObj : public EngineActionObj {
+ public:
+  explicit BatchPrefillOnlyActionObj(Array<Model> models,
+                                     std::vector<ModelWorkspace> model_workspaces,
+                                     EngineConfig engine_config,
+                                     Optional<EventTraceRecorder> trace_recorder)
+      : models_(std::move(models)),
+        model_workspaces_(std::move(model_workspaces)),
+        engine_config_(std::move(engine_config)),
+        trace_recorder_(std::move(trace_recorder)) {}
+
+  const char* Name() const final { return "BatchPrefillOnly"; }
+
+  Array<Request> Step(EngineState estate) final {
+    // - Find the requests to prefill.
+    std::vector<Request> requests;
+    {
+      NVTXScopedRange nvtx_scope("BatchPrefillOnly getting requests");
+      requests = GetRequestsToPrefill(estate);
+      if (requests.empty()) {
+        return {};
+      }
+    }
+    auto tstart = std::chrono::high_resolution_clock::now();
+    const Model& model = models_[0];
+    int num_requests = requests.size();
+
+    // - Add the sequences and embed the prompts of all the requests together.
+    Array<String> request_ids;
+    std::vector<int64_t> seq_ids;
+    std::vector<int> lengths;
+    std::vector<IntTuple> token_ids;
+    request_ids.reserve(num_requests);
+    seq_ids.reserve(num_requests);
+    lengths.reserve(num_requests);
+    for (const Request& request : requests) {
+      request_ids.push_back(request->id);
+      seq_ids.push_back(estate->id_manager.GetNewId());
+      model->AddNewSequence(seq_ids.back());
+      lengths.push_back(request->input_total_length);
+      for (const Data& input : request->inputs) {
+        const auto* token_data = input.as<TokenDataNode>();
+        ICHECK(token_data != nullptr);
+        token_ids.push_back(token_data->token_ids);
+      }
+    }
+    int total_length = 0;
+    for (const IntTuple& request_token_ids : token_ids) {
+      total_length += request_token_ids.size();
+    }
+    RECORD_EVENT(trace_recorder_, request_ids, "start prefill-only");
+    ObjectRef embeddings = model_workspaces_[0].embeddings;
+    embeddings = model->GatherTokenEmbed(token_ids, &embeddings);
+
+    // - Prefill to the hidden states of all the prompt tokens.
+    // hidden_states: (total_length, h)
+    ObjectRef hidden_states = model->BatchPrefillToLastHidden(embeddings, seq_ids, lengths);
+    RECORD_EVENT(trace_recorder_, request_ids, "finish prefill-only");
+
+    // - Compute the output of each request.
+    std::vector<NDArray> outputs(num_requests);
+    std::vector<int> last_positions;
+    std::vector<int> last_position_requests;
+    for (int i = 0, begin = 0; i < num_requests; begin += lengths[i], ++i) {
+      if (requests[i]->generation_cfg->prefill_only_output == "last_hidden_state") {
+        last_positions.push_back(begin + lengths[i] - 1);
+        last_position_requests.push_back(i);
+      }
+    }
+    if (!last_positions.empty()) {
+      NDArray last_hidden_states = CopyToCPU(model->GatherHiddenStates(
+          hidden_states, last_positions, &model_workspaces_[0].hidden_states));
+      int64_t hidden_size = last_hidden_states->shape[1];
+      size_t row_bytes = hidden_size * last_hidden_states->dtype.bytes();
+      for (int j = 0; j < static_cast<int>(last_positions.size()); ++j) {
+        NDArray output =
+            NDArray::Empty({hidden_size}, last_hidden_states->dtype, DLDevice{kDLCPU, 0});
+        std::memcpy(output->data, static_cast<char*>(last_hidden_states->data) + j * row_bytes,
+                    row_bytes);
+        outputs[last_position_requests[j]] = output;
+      }
+    }
+    ComputePromptLogProbs(requests, lengths, token_ids, hidden_states, &outputs);
+
+    // - Remove the sequences right away, along with the requests.
+    for (int64_t seq_id : seq_ids) {
+      model->RemoveSequence(seq_id);
+      estate->id_manager.RecycleId(seq_id);
+    }
+    estate->prefill_only_queue.erase(estate->prefill_only_queue.begin(),
+                                     estate->prefill_only_queue.begin() + num_requests);
+    for (int i = 0; i < num_requests; ++i) {
+      estate->prefill_only_outputs.push_back(RequestStreamOutput(
+          requests[i]->id, {IntTuple{}}, NullOpt, {String("stop")}, NullOpt, NullOpt, NullOpt,
+          outputs[i]));
+    }
+    RECORD_EVENT(trace_recorder_, request_ids, "finish");
+
+    auto tend = std::chrono::high_resolution_clock::now();
+    estate->stats.engine_total_prefill_time += static_cast<double>((tend - tstart).count()) / 1e9;
+    estate->stats.total_prefill_length += total_length;
+    return {};
+  }
+
+ private:
+  /*!
+   * \brief Get the requests at the front of `prefill_only_queue` that are prefilled together,
+   * within the prefill chunk size, the max batch size and the available KV cache pages.
+   */
+  std::vector<Request> GetRequestsToPrefill(EngineState estate) {
+    std::vector<Request> requests;
+    int page_size = engine_config_->kv_cache_page_size;
+    int total_length = 0;
+    int num_required_pages = 0;
+    for (const Request& request : estate->prefill_only_queue) {
+      int length = request->input_total_length;
+      int num_pages = (length + page_size - 1) / page_size;
+      // The first request is always taken, as its prompt fits in the largest prefill chunk.
+      if (static_cast<int64_t>(requests.size()) == engine_config_->max_num_sequence ||
+          (!requests.empty() &&
+           total_length + length > estate->step_planner.prefill_chunk_size)) {
+        break;
+      }
+      // Free the prefix cache for the pages, as the prefilled KV data is not kept.
+      while (num_required_pages + num_pages > models_[0]->GetNumAvailablePages()) {
+        if (!estate->prefix_cache->TryFreeMemory()) {
+          return requests;
+        }
+      }
+      requests.push_back(request);
+      total_length += length;
+      num_required_pages += num_pages;
+    }
+    return requests;
+  }
+
+  /*!
+   * \brief Compute the logprob of each prompt token after the first, of the requests whose
+   * output is "prompt_logprobs". The logits of the positions are computed at most
+   * `max_num_sequence` rows at a time.
+   */
+  void ComputePromptLogProbs(const std::vector<Request>& requests, const std::vector<int>& lengths,
+                             const std::vector<int64_t>& token_ids, const ObjectRef& hidden_states,
+                             std::vector<NDArray>* outputs) {
+    // The position of each logit row, with the request and the index of the row in it.
+    std::vector<int> positions;
+    std::vector<std::pair<int, int>> row_owners;
+    for (int i = 0, begin = 0; i < static_cast<int>(requests.size()); begin += lengths[i], ++i) {
+      if (requests[i]->generation_cfg->prefill_only_output != "prompt_logprobs") {
+        continue;
+      }
+      (*outputs)[i] = NDArray::Empty({lengths[i] - 1}, DataType::Float(32), DLDevice{kDLCPU, 0});
+      for (int j = 0; j + 1 < lengths[i]; ++j) {
+        positions.push_back(begin + j);
+        row_owners.emplace_back(i, j);
+      }
+    }
+    int max_num_rows = engine_config_->max_num_sequence;
+    for (int row_begin = 0; row_begin < static_cast<int>(positions.size());
+         row_begin += max_num_rows) {
+      int num_rows = std::min(max_num_rows, static_cast<int>(positions.size()) - row_begin);
+      std::vector<int> chunk_positions(positions.begin() + row_begin,
+                                       positions.begin() + row_begin + num_rows);
+      ObjectRef chunk_hidden_states = models_[0]->GatherHiddenStates(
+          hidden_states, chunk_positions, &model_workspaces_[0].hidden_states);
+      // logits: (num_rows, v)
+      NDArray logits = CopyToCPU(models_[0]->GetLogits(chunk_hidden_states));
+      ICHECK(logits.DataType() == DataType::Float(32));
+      int64_t vocab_size = logits->shape[1];
+      const float* p_logits = static_cast<const float*>(logits->data);
+      for (int r = 0; r < num_rows; ++r) {
+        const float* p_row = p_logits + r * vocab_size;
+        float max_logit = *std::max_element(p_row, p_row + vocab_size);
+        double sum_exp = 0;
+        for (int64_t v = 0; v < vocab_size; ++v) {
+          sum_exp += std::exp(p_row[v] - max_logit);
+        }
+        auto [request_index, token_index] = row_owners[row_begin + r];
+        int64_t target_token = token_ids[positions[row_begin + r] + 1];
+        static_cast<float*>((*outputs)[request_index]->data)[token_index] =
+            p_row[target_token] - max_logit - std::log(sum_exp);
+      }
+    }
+  }
+
+  /*! \brief Copy the given NDArray or DRef of worker 0 to CPU. */
+  static NDArray CopyToCPU(const ObjectRef& array) {
+    NDArray array_nd = array->IsInstance<DRefObj>() ? Downcast<DRef>(array)->DebugGetFromRemote(0)
+                                                    : Downcast<NDArray>(array);
+    return array_nd.CopyTo(DLDevice{kDLCPU, 0});
+  }
+
+  /*! \brief The models to run prefill in. */
+  Array<Model> models_;
+  /*! \brief The workspace of each model. */
+  std::vector<ModelWorkspace> model_workspaces_;
+  /*! \brief The engine config. */
+  EngineConfig engine_config_;
+  /*! \brief Event trace recorder. */
+  Optional<EventTraceRecorder> trace_recorder_;
+};
+
+EngineAction EngineAction::BatchPrefillOnly(Array<Model> models,
+                                            std::vector<ModelWorkspace> model_workspaces,
+                                            EngineConfig engine_config,
+                                            Optional<EventTraceRecorder> trace_recorder) {
+  return EngineAction(make_object<BatchPrefillOnlyActionObj>(
+      std::move(models), std::move(model_workspaces), std::move(engine_config),
+      std::move(trace_recorder)));
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
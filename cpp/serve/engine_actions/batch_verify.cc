@@ -5,9 +5,11 @@
 
 #include <tvm/runtime/threading_backend.h>
 
+#include <algorithm>
 #include <cmath>
 #include <exception>
 #include <numeric>
+#include <unordered_map>
 
 #include "../../support/random.h"
 #include "../config.h"
@@ -24,6 +26,10 @@ namespace serve {
  * \brief The action that runs verification for requests in the
  * `running_queue` of engine state. Preempt low-priority requests
  * accordingly when it is impossible to decode all the running requests.
+ * In the "ngram" speculative mode, there is no draft model, and the action
+ * proposes the drafts from the n-gram index of each request before verification.
+ * In the "layer_skip" speculative mode, the action proposes the drafts by decoding
+ * through the early-exit layers of the verify model itself.
  */
 class BatchVerifyActionObj : public EngineActionObj {
  public:
@@ -39,13 +45,25 @@ class BatchVerifyActionObj : public EngineActionObj {
         draft_token_workspace_manager_(std::move(draft_token_workspace_manager)),
         engine_config_(std::move(engine_config)),
         trace_recorder_(std::move(trace_recorder)),
-        rng_(RandomGenerator::GetInstance()) {}
+        rng_(RandomGenerator::GetInstance()),
+        ngram_draft_(engine_config_->speculative_mode == SpeculativeMode::kNGram),
+        layer_skip_draft_(engine_config_->speculative_mode == SpeculativeMode::kLayerSkip),
+        draft_model_id_(ngram_draft_ || layer_skip_draft_ ? 0 : 1) {}
+
+  const char* Name() const final { return "BatchVerify"; }
 
   Array<Request> Step(EngineState estate) final {
-    // - Only run spec decode when there are two models (llm+ssm) and >=1 running requests.
-    if (models_.size() != 2 || estate->running_queue.empty()) {
+    // - Only run spec decode when there are two models (llm+ssm), or one model proposing
+    // n-gram or early-exit drafts, and >=1 running requests.
+    if (static_cast<int>(models_.size()) != (draft_model_id_ == verify_model_id_ ? 1 : 2) ||
+        estate->running_queue.empty()) {
       return {};
     }
+    if (ngram_draft_) {
+      ProposeNGramDrafts(estate);
+    } else if (layer_skip_draft_) {
+      ProposeLayerSkipDrafts(estate);
+    }
 
     const auto& [rsentries, verify_lengths, total_verify_length] = GetDraftsToVerify(estate);
     ICHECK_EQ(rsentries.size(), verify_lengths.size());
@@ -65,6 +83,8 @@ class BatchVerifyActionObj : public EngineActionObj {
     Array<GenerationConfig> generation_cfg;
     std::vector<RandomGenerator*> rngs;
     std::vector<std::vector<SampleResult>> draft_output_tokens;
+    std::vector<int64_t> token_tree_parent_ptr;
+    bool verify_token_tree = false;
     request_internal_ids.reserve(num_rsentries);
     all_tokens_to_verify.reserve(total_verify_length);
     verify_request_mstates.reserve(num_rsentries);
@@ -83,18 +103,29 @@ class BatchVerifyActionObj : public EngineActionObj {
       // the last committed token + all the draft tokens.
       draft_token_slots_.push_back(0);  // placeholder for the last committed token
       all_tokens_to_verify.push_back(draft_mstate->committed_tokens.back().sampled_token_id.first);
+      token_tree_parent_ptr.push_back(-1);
       for (int j = 0; j < static_cast<int>(draft_mstate->draft_output_tokens.size()); ++j) {
         all_tokens_to_verify.push_back(draft_mstate->draft_output_tokens[j].sampled_token_id.first);
         draft_token_slots_.push_back(draft_mstate->draft_token_slots[j]);
+        // The position of a draft token's parent is its parent index plus one, since the
+        // last committed token comes first.
+        token_tree_parent_ptr.push_back(draft_mstate->draft_token_parent_idx[j] + 1);
+        verify_token_tree |= draft_mstate->draft_token_parent_idx[j] != j - 1;
       }
       verify_request_mstates.push_back(verify_mstate);
       generation_cfg.push_back(rsentries[i]->request->generation_cfg);
       rngs.push_back(&rsentries[i]->rng);
       draft_output_tokens.push_back(draft_mstate->draft_output_tokens);
     }
-    NDArray draft_probs_on_device = models_[draft_model_id_]->GatherDraftProbs(
-        model_workspaces_[verify_model_id_].draft_probs_storage, draft_token_slots_,
-        &model_workspaces_[verify_model_id_].draft_probs);
+    // The n-gram and early-exit drafts are deterministic, whose distributions are left undefined.
+    NDArray draft_probs_on_device{nullptr};
+    if (draft_model_id_ != verify_model_id_) {
+      NDArray draft_probs_buffer =
+          draft_token_workspace_manager_->GetDraftProbsBuffer(draft_token_slots_.size());
+      draft_probs_on_device = models_[draft_model_id_]->GatherDraftProbs(
+          draft_token_workspace_manager_->GetDraftProbsStorage(), draft_token_slots_,
+          &draft_probs_buffer);
+    }
 
     RECORD_EVENT(trace_recorder_, request_ids, "start verify embedding");
     ObjectRef embeddings = models_[verify_model_id_]->TokenEmbed(
@@ -102,9 +133,18 @@ class BatchVerifyActionObj : public EngineActionObj {
     RECORD_EVENT(trace_recorder_, request_ids, "finish verify embedding");
 
     RECORD_EVENT(trace_recorder_, request_ids, "start verify");
-    NDArray logits =
-        models_[verify_model_id_]->BatchVerify(embeddings, request_internal_ids, verify_lengths);
+    NDArray logits = models_[verify_model_id_]->BatchVerify(
+        embeddings, request_internal_ids, verify_lengths,
+        verify_token_tree ? token_tree_parent_ptr : std::vector<int64_t>());
     RECORD_EVENT(trace_recorder_, request_ids, "finish verify");
+    if (draft_probs_on_device.defined() &&
+        (draft_probs_on_device->device.device_type != logits->device.device_type ||
+         draft_probs_on_device->device.device_id != logits->device.device_id)) {
+      // The draft models run on another device, where the draft probabilities are gathered
+      // while the target model verifies. They are then copied to the verify device.
+      draft_probs_on_device = draft_token_workspace_manager_->CopyDraftProbsToDevice(
+          draft_probs_on_device, logits->device);
+    }
     ICHECK_EQ(logits->ndim, 3);
     ICHECK_EQ(logits->shape[0], 1);
     ICHECK_EQ(logits->shape[1], total_verify_length);
@@ -130,7 +170,11 @@ class BatchVerifyActionObj : public EngineActionObj {
     std::vector<std::vector<SampleResult>> sample_results_arr =
         sampler_->BatchVerifyDraftTokensWithProbAfterTopP(
             renormalized_probs, request_ids, cum_verify_lengths, generation_cfg, rngs,
-            draft_output_tokens, draft_probs_on_device);
+            draft_output_tokens,
+            verify_token_tree ? std::vector<int>(token_tree_parent_ptr.begin(),
+                                                 token_tree_parent_ptr.end())
+                              : std::vector<int>(),
+            draft_probs_on_device);
     ICHECK_EQ(sample_results_arr.size(), num_rsentries);
 
     // We collect the requests whose drafts are fully accepted.
@@ -139,17 +183,34 @@ class BatchVerifyActionObj : public EngineActionObj {
     // In this case, an additional batch decode step is needed for these requests.
     std::vector<int64_t> fully_accepted_rsentries;
     fully_accepted_rsentries.reserve(num_rsentries);
+    std::vector<int64_t> accepted_leaf_indices;
+    accepted_leaf_indices.reserve(num_rsentries);
 
     for (int i = 0; i < num_rsentries; ++i) {
       const std::vector<SampleResult>& sample_results = sample_results_arr[i];
       int accept_length = sample_results.size();
+      std::vector<int> accepted_nodes =
+          GetAcceptedDraftTokens(rsentries[i]->mstates[draft_model_id_], sample_results);
       for (SampleResult sample_result : sample_results) {
         rsentries[i]->mstates[verify_model_id_]->CommitToken(sample_result);
-        rsentries[i]->mstates[draft_model_id_]->CommitToken(sample_result);
+        if (draft_model_id_ != verify_model_id_) {
+          rsentries[i]->mstates[draft_model_id_]->CommitToken(sample_result);
+        }
       }
       estate->stats.total_accepted_length += accept_length;
       estate->stats.UpdateSpecDecodingStats(cum_verify_lengths[i + 1] - cum_verify_lengths[i],
                                             accept_length);
+      rsentries[i]->spec_draft_controller.Update(
+          GetDraftTokenTreeDepth(rsentries[i]->mstates[draft_model_id_]), accepted_nodes.size());
+      if (verify_token_tree) {
+        // The verified token tree keeps the path to the last accepted node.
+        accepted_leaf_indices.push_back(accepted_nodes.empty() ? 0 : accepted_nodes.back() + 1);
+        if (CommitAcceptedDraftPath(estate, rsentries[i]->mstates[draft_model_id_],
+                                    accepted_nodes)) {
+          fully_accepted_rsentries.push_back(i);
+        }
+        continue;
+      }
       int rollback_length =
           std::max(cum_verify_lengths[i + 1] - cum_verify_lengths[i] - accept_length, 0);
       // rollback kv cache
@@ -158,14 +219,21 @@ class BatchVerifyActionObj : public EngineActionObj {
       if (rollback_length > 0) {
         models_[verify_model_id_]->PopNFromKVCache(
             rsentries[i]->mstates[verify_model_id_]->internal_id, rollback_length);
+        if (draft_model_id_ == verify_model_id_) {
+          continue;
+        }
         // The last accepted token is not yet added into the draft model.
         // Therefore, the rollback length for the draft model is one less.
         models_[draft_model_id_]->PopNFromKVCache(
             rsentries[i]->mstates[draft_model_id_]->internal_id, rollback_length - 1);
-      } else {
+      } else if (draft_model_id_ != verify_model_id_) {
         fully_accepted_rsentries.push_back(i);
       }
     }
+    if (verify_token_tree) {
+      models_[verify_model_id_]->CommitAcceptedTokenTreeNodes(request_internal_ids,
+                                                              accepted_leaf_indices);
+    }
 
     if (!fully_accepted_rsentries.empty()) {
       // - Run a step of batch decode for requests whose drafts are fully accepted.
@@ -204,7 +272,9 @@ class BatchVerifyActionObj : public EngineActionObj {
     // clear the draft model state entries
     for (int i = 0; i < num_rsentries; ++i) {
       rsentries[i]->mstates[draft_model_id_]->RemoveAllDraftTokens(&draft_token_slots_);
-      draft_token_workspace_manager_->FreeSlots(draft_token_slots_);
+      if (draft_model_id_ != verify_model_id_) {
+        draft_token_workspace_manager_->FreeSlots(draft_token_slots_);
+      }
     }
 
     auto tend = std::chrono::high_resolution_clock::now();
@@ -214,6 +284,206 @@ class BatchVerifyActionObj : public EngineActionObj {
   }
 
  private:
+  /*!
+   * \brief Keep the accepted path of the draft token tree in the draft model sequence of
+   * the request, and remove the sequences forked for the other branches.
+   * \param estate The engine state.
+   * \param draft_mstate The draft model state of the request.
+   * \param accepted_nodes The indices of the accepted draft tokens.
+   * \return Whether the last accepted draft token is not added into the draft model yet,
+   * in which case an additional decode step is needed.
+   */
+  bool CommitAcceptedDraftPath(EngineState estate, const RequestModelState& draft_mstate,
+                               const std::vector<int>& accepted_nodes) {
+    const Model& draft_model = models_[draft_model_id_];
+    int64_t internal_id = draft_mstate->internal_id;
+    const std::vector<int>& parent_idx = draft_mstate->draft_token_parent_idx;
+    const std::vector<int64_t>& seq_ids = draft_mstate->draft_token_seq_ids;
+    int num_draft_tokens = parent_idx.size();
+    if (num_draft_tokens == 0) {
+      // The request is decoded without speculation, and the last committed token before
+      // verification is not added into the draft model.
+      return true;
+    }
+
+    // - Compute the number of draft tokens held by each sequence.
+    std::vector<int> depths(num_draft_tokens);
+    std::unordered_map<int64_t, int> seq_lengths = {{internal_id, 0}};
+    for (int j = 0; j < num_draft_tokens; ++j) {
+      depths[j] = parent_idx[j] == -1 ? 1 : depths[parent_idx[j]] + 1;
+      if (seq_ids[j] != -1) {
+        seq_lengths[seq_ids[j]] = std::max(seq_lengths[seq_ids[j]], depths[j]);
+      }
+    }
+
+    // - Find the deepest accepted node that is added into the draft model, and keep the path
+    // to it in the sequence of the request.
+    bool last_accepted_decoded = accepted_nodes.empty() || seq_ids[accepted_nodes.back()] != -1;
+    int num_kept = accepted_nodes.size() - (last_accepted_decoded ? 0 : 1);
+    int64_t kept_seq_id = num_kept == 0 ? internal_id : seq_ids[accepted_nodes[num_kept - 1]];
+    int num_popped = seq_lengths[kept_seq_id] - num_kept;
+    if (num_popped > 0) {
+      draft_model->PopNFromKVCache(kept_seq_id, num_popped);
+    }
+    if (kept_seq_id != internal_id) {
+      draft_model->RemoveSequence(internal_id);
+      draft_model->ForkSequence(kept_seq_id, internal_id);
+    }
+    for (const auto& [seq_id, length] : seq_lengths) {
+      if (seq_id != internal_id) {
+        draft_model->RemoveSequence(seq_id);
+        estate->id_manager.RecycleId(seq_id);
+      }
+    }
+    return !last_accepted_decoded;
+  }
+
+  /*!
+   * \brief Propose the draft of each running request state entry from its n-gram index. The
+   * entries under grammar-guided generation are decoded without drafts, since the n-gram
+   * drafts may violate the grammar.
+   */
+  void ProposeNGramDrafts(EngineState estate) {
+    std::vector<RequestStateEntry> running_rsentries = GetRunningRequestStateEntries(estate);
+    if (engine_config_->spec_max_batch_size != -1 &&
+        static_cast<int>(running_rsentries.size()) > engine_config_->spec_max_batch_size) {
+      return;
+    }
+    for (const RequestStateEntry& rsentry : running_rsentries) {
+      RequestModelState mstate = rsentry->mstates[0];
+      if (!mstate->ngram_index.Enabled() || mstate->RequireNextTokenBitmask()) {
+        continue;
+      }
+      int draft_length = engine_config_->adaptive_spec_draft_length
+                             ? rsentry->spec_draft_controller.GetDraftLength(
+                                   engine_config_->spec_draft_length)
+                             : engine_config_->spec_draft_length;
+      draft_length = estate->step_planner.GetDraftLength(draft_length, /*tree_width=*/1);
+      if (draft_length == 0) {
+        continue;
+      }
+      for (int32_t token : mstate->ngram_index.Propose(draft_length)) {
+        mstate->AddDraftToken(SampleResult{{token, 1.0f}, {}}, /*draft_token_slot=*/-1);
+      }
+      estate->stats.total_draft_length += mstate->draft_output_tokens.size();
+    }
+  }
+
+  /*!
+   * \brief Propose the draft of each running request state entry by greedily decoding through
+   * the early-exit layers of the verify model, which attend to the KV cache of those layers.
+   * The greedy drafts are deterministic, and are verified like the n-gram drafts. The decoded
+   * positions are popped from the KV cache afterward, so that verification rewrites the KV of
+   * all the layers. The entries under grammar-guided generation are decoded without drafts.
+   */
+  void ProposeLayerSkipDrafts(EngineState estate) {
+    std::vector<RequestStateEntry> running_rsentries = GetRunningRequestStateEntries(estate);
+    if (engine_config_->spec_max_batch_size != -1 &&
+        static_cast<int>(running_rsentries.size()) > engine_config_->spec_max_batch_size) {
+      return;
+    }
+    const Model& model = models_[verify_model_id_];
+    Array<RequestModelState> mstates;
+    Array<String> request_ids;
+    Array<GenerationConfig> generation_cfg;
+    std::vector<int64_t> internal_ids;
+    std::vector<int> draft_lengths;
+    std::vector<RandomGenerator*> rngs;
+    int max_draft_length = 0;
+    int num_available_pages = model->GetNumAvailablePages();
+    for (const RequestStateEntry& rsentry : running_rsentries) {
+      RequestModelState mstate = rsentry->mstates[verify_model_id_];
+      if (mstate->RequireNextTokenBitmask()) {
+        continue;
+      }
+      int draft_length = engine_config_->adaptive_spec_draft_length
+                             ? rsentry->spec_draft_controller.GetDraftLength(
+                                   engine_config_->spec_draft_length)
+                             : engine_config_->spec_draft_length;
+      draft_length = estate->step_planner.GetDraftLength(draft_length, /*tree_width=*/1);
+      // The early-exit decode steps temporarily take the KV pages of the drafts.
+      int num_require_pages = (draft_length + engine_config_->kv_cache_page_size - 1) /
+                              engine_config_->kv_cache_page_size;
+      if (draft_length == 0 || num_require_pages > num_available_pages) {
+        continue;
+      }
+      num_available_pages -= num_require_pages;
+      // The drafts are the greedy tokens under the logit processing of the request.
+      ObjectPtr<GenerationConfigNode> greedy_cfg =
+          make_object<GenerationConfigNode>(*rsentry->request->generation_cfg.get());
+      greedy_cfg->temperature = 0.0;
+      mstates.push_back(mstate);
+      request_ids.push_back(rsentry->request->id);
+      generation_cfg.push_back(GenerationConfig(greedy_cfg));
+      internal_ids.push_back(mstate->internal_id);
+      draft_lengths.push_back(draft_length);
+      rngs.push_back(&rsentry->rng);
+      max_draft_length = std::max(max_draft_length, draft_length);
+    }
+
+    std::vector<int> input_tokens;
+    std::vector<int64_t> draft_internal_ids;
+    Array<RequestModelState> draft_mstates;
+    Array<String> draft_request_ids;
+    Array<GenerationConfig> draft_generation_cfg;
+    std::vector<RandomGenerator*> draft_rngs;
+    for (int draft_id = 0; draft_id < max_draft_length; ++draft_id) {
+      input_tokens.clear();
+      draft_internal_ids.clear();
+      draft_mstates.clear();
+      draft_request_ids.clear();
+      draft_generation_cfg.clear();
+      draft_rngs.clear();
+      for (int i = 0; i < static_cast<int>(mstates.size()); ++i) {
+        if (draft_id >= draft_lengths[i]) {
+          continue;
+        }
+        // The first draft proposal uses the last committed token.
+        input_tokens.push_back(
+            draft_id == 0 ? mstates[i]->committed_tokens.back().sampled_token_id.first
+                          : mstates[i]->draft_output_tokens.back().sampled_token_id.first);
+        draft_internal_ids.push_back(internal_ids[i]);
+        draft_mstates.push_back(mstates[i]);
+        draft_request_ids.push_back(request_ids[i]);
+        draft_generation_cfg.push_back(generation_cfg[i]);
+        draft_rngs.push_back(rngs[i]);
+      }
+      int num_drafts = input_tokens.size();
+
+      RECORD_EVENT(trace_recorder_, draft_request_ids, "start early-exit proposal");
+      ObjectRef embeddings =
+          model->TokenEmbed({IntTuple{input_tokens.begin(), input_tokens.end()}});
+      NDArray logits = model->BatchDecodeEarlyExit(embeddings, draft_internal_ids);
+      RECORD_EVENT(trace_recorder_, draft_request_ids, "finish early-exit proposal");
+      ICHECK_EQ(logits->ndim, 3);
+      ICHECK_EQ(logits->shape[0], num_drafts);
+      ICHECK_EQ(logits->shape[1], 1);
+
+      logits = logits.CreateView({num_drafts, logits->shape[2]}, logits->dtype);
+      logit_processor_->InplaceUpdateLogits(logits, draft_generation_cfg, draft_mstates,
+                                            draft_request_ids);
+      NDArray probs_on_device =
+          logit_processor_->ComputeProbsFromLogits(logits, draft_generation_cfg, draft_request_ids);
+      std::vector<int> sample_indices(num_drafts);
+      std::iota(sample_indices.begin(), sample_indices.end(), 0);
+      NDArray renormalized_probs = sampler_->BatchRenormalizeProbsByTopP(
+          probs_on_device, sample_indices, draft_request_ids, draft_generation_cfg);
+      std::vector<SampleResult> sample_results = sampler_->BatchSampleTokensWithProbAfterTopP(
+          renormalized_probs, sample_indices, draft_request_ids, draft_generation_cfg,
+          draft_rngs);
+      ICHECK_EQ(sample_results.size(), num_drafts);
+      for (int i = 0; i < num_drafts; ++i) {
+        int32_t token = sample_results[i].sampled_token_id.first;
+        draft_mstates[i]->AddDraftToken(SampleResult{{token, 1.0f}, {}}, /*draft_token_slot=*/-1);
+      }
+    }
+
+    for (int i = 0; i < static_cast<int>(mstates.size()); ++i) {
+      model->PopNFromKVCache(internal_ids[i], draft_lengths[i]);
+      estate->stats.total_draft_length += draft_lengths[i];
+    }
+  }
+
   struct DraftRequestStateEntries {
     /*! \brief The request state entries to verify. */
     Array<RequestStateEntry> draft_rsentries;
@@ -236,6 +506,8 @@ class BatchVerifyActionObj : public EngineActionObj {
     int num_available_pages = models_[verify_model_id_]->GetNumAvailablePages();
 
     // Preempt the request state entries that cannot fit the large model for verification.
+    // Order the running queue so that the preemption victim is at the back.
+    estate->scheduler_policy->SortRunningQueue(&estate->running_queue, estate->request_states);
     std::vector<RequestStateEntry> running_rsentries = GetRunningRequestStateEntries(estate);
     std::vector<int> num_page_requirement;
     num_page_requirement.reserve(running_rsentries.size());
@@ -288,9 +560,13 @@ class BatchVerifyActionObj : public EngineActionObj {
   Optional<EventTraceRecorder> trace_recorder_;
   /*! \brief Random number generator. */
   RandomGenerator& rng_;
-  /*! \brief The ids of verify/draft models. */
+  /*! \brief Whether the drafts are proposed from the n-gram index of requests. */
+  const bool ngram_draft_;
+  /*! \brief Whether the drafts are proposed by the early-exit layers of the verify model. */
+  const bool layer_skip_draft_;
+  /*! \brief The ids of verify/draft models, which are the same without draft models. */
   const int verify_model_id_ = 0;
-  const int draft_model_id_ = 1;
+  const int draft_model_id_;
   const float eps_ = 1e-5;
   /*! \brief Temporary buffer to store the slots of the current draft tokens */
   std::vector<int> draft_token_slots_;
@@ -0,0 +1,366 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/engine_actions/beam_search.cc
+ */
+
+#include "beam_search.h"
+
+#include <tvm/runtime/nvtx.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+#include "action_commons.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+namespace {
+
+/*! \brief A candidate token to extend a beam with. */
+struct BeamCandidate {
+  /*! \brief The log probability of the beam extended with the token. */
+  double logprob;
+  /*! \brief The index of the beam in its request. */
+  int beam;
+  /*! \brief The token id and probability of the token. */
+  TokenProbPair token;
+};
+
+/*! \brief Get the initial log probability of a beam, where only the first beam is expanded. */
+double GetInitialBeamLogProb(int beam) {
+  return beam == 0 ? 0.0 : -std::numeric_limits<double>::infinity();
+}
+
+/*! \brief Add a finished beam, keeping the best `num_beams` ones in descending order of score. */
+void AddFinishedBeam(std::vector<BeamHypothesis>* finished_beams, BeamHypothesis hypothesis,
+                     int num_beams) {
+  auto it = std::upper_bound(
+      finished_beams->begin(), finished_beams->end(), hypothesis.score,
+      [](double score, const BeamHypothesis& other) { return score > other.score; });
+  finished_beams->insert(it, std::move(hypothesis));
+  if (static_cast<int>(finished_beams->size()) > num_beams) {
+    finished_beams->pop_back();
+  }
+}
+
+/*!
+ * \brief Commit the best finished beams to the outputs of the request, and remove the other
+ * beams from the models.
+ */
+void FinishBeamSearch(const EngineState& estate, const Array<Model>& models,
+                      const RequestState& rstate) {
+  const GenerationConfig& generation_cfg = rstate->entries[0]->request->generation_cfg;
+  ICHECK_GE(static_cast<int>(rstate->finished_beams.size()), generation_cfg->n);
+  for (int i = 0; i < generation_cfg->num_beams; ++i) {
+    const RequestStateEntry& rsentry = rstate->entries[i + 1];
+    if (i < generation_cfg->n) {
+      // The output is then returned in the post-processing of the step, which finishes it.
+      for (RequestModelState mstate : rsentry->mstates) {
+        mstate->SetCommittedTokens(rstate->finished_beams[i].tokens);
+      }
+      rsentry->next_callback_token_pos = 0;
+      rsentry->hold_output = false;
+    } else {
+      rsentry->status = RequestStateStatus::kFinished;
+      RemoveRequestFromModel(estate, rsentry->mstates[0]->internal_id, models);
+      estate->id_manager.RecycleId(rsentry->mstates[0]->internal_id);
+    }
+  }
+}
+
+}  // namespace
+
+std::pair<std::vector<RequestStateEntry>, std::vector<int>> TakeBeamsFromSampleInputs(
+    std::vector<int>* sample_indices, std::vector<RequestStateEntry>* rsentries,
+    Array<String>* request_ids, Array<GenerationConfig>* generation_cfg,
+    std::vector<RandomGenerator*>* rngs, std::vector<bool>* rsentry_activated) {
+  std::vector<RequestStateEntry> beams;
+  std::vector<int> prob_rows;
+  Array<String> sample_request_ids;
+  Array<GenerationConfig> sample_generation_cfg;
+  int num_samples = 0;
+  for (int i = 0; i < static_cast<int>(rsentries->size()); ++i) {
+    if ((*generation_cfg)[i]->num_beams > 1) {
+      // The beams are activated all at once in prefill.
+      ICHECK(rsentry_activated == nullptr || (*rsentry_activated)[i]);
+      beams.push_back((*rsentries)[i]);
+      prob_rows.push_back((*sample_indices)[i]);
+      continue;
+    }
+    (*sample_indices)[num_samples] = (*sample_indices)[i];
+    (*rsentries)[num_samples] = (*rsentries)[i];
+    (*rngs)[num_samples] = (*rngs)[i];
+    if (rsentry_activated != nullptr) {
+      (*rsentry_activated)[num_samples] = (*rsentry_activated)[i];
+    }
+    sample_request_ids.push_back((*request_ids)[i]);
+    sample_generation_cfg.push_back((*generation_cfg)[i]);
+    ++num_samples;
+  }
+  if (beams.empty()) {
+    return {};
+  }
+  sample_indices->resize(num_samples);
+  rsentries->resize(num_samples);
+  rngs->resize(num_samples);
+  if (rsentry_activated != nullptr) {
+    rsentry_activated->resize(num_samples);
+  }
+  *request_ids = std::move(sample_request_ids);
+  *generation_cfg = std::move(sample_generation_cfg);
+  return {std::move(beams), std::move(prob_rows)};
+}
+
+void BeamSearchStep(EngineState estate, const Array<Model>& models, const Sampler& sampler,
+                    const NDArray& probs_on_device, const std::vector<RequestStateEntry>& beams,
+                    const std::vector<int>& prob_rows, int64_t max_single_sequence_length) {
+  NVTXScopedRange nvtx_scope("BeamSearchStep");
+  // - Group the beams by request. A request expands only when all its beams run in the step,
+  // which is not the case once the search of the request has finished.
+  std::vector<std::pair<RequestState, std::vector<int>>> groups;
+  std::unordered_map<const RequestNode*, int> group_indices;
+  for (int i = 0; i < static_cast<int>(beams.size()); ++i) {
+    auto [it, inserted] = group_indices.emplace(beams[i]->request.get(), groups.size());
+    if (inserted) {
+      groups.push_back({estate->GetRequestState(beams[i]->request), {}});
+    }
+    groups[it->second].second.push_back(i);
+  }
+
+  // - Get the top tokens of the beams to expand, all in one batch.
+  std::vector<int> row_indices;
+  Array<String> request_ids;
+  int num_tokens = 0;
+  for (auto& [rstate, beam_indices] : groups) {
+    const GenerationConfig& generation_cfg = rstate->entries[0]->request->generation_cfg;
+    bool expand = static_cast<int>(beam_indices.size()) == generation_cfg->num_beams;
+    for (int i : beam_indices) {
+      expand &= beams[i]->status == RequestStateStatus::kAlive && beams[i]->hold_output;
+    }
+    if (!expand) {
+      beam_indices.clear();
+      continue;
+    }
+    // Enough tokens are taken, so that the stop tokens never leave fewer candidates than beams.
+    int num_stop_tokens = generation_cfg->ignore_eos ? 0 : generation_cfg->stop_token_ids.size();
+    num_tokens = std::max(num_tokens, std::min(generation_cfg->num_beams * 2 + num_stop_tokens,
+                                               SamplerObj::kMaxNumTopTokens));
+    num_tokens = std::max(num_tokens, generation_cfg->top_logprobs);
+    for (int i : beam_indices) {
+      if (!std::isinf(beams[i]->beam_logprob)) {
+        row_indices.push_back(prob_rows[i]);
+        request_ids.push_back(beams[i]->request->id);
+      }
+    }
+  }
+  if (row_indices.empty()) {
+    return;
+  }
+  std::vector<std::vector<TokenProbPair>> top_tokens =
+      sampler->BatchGetTopTokens(probs_on_device, row_indices, request_ids, num_tokens);
+  ICHECK_EQ(top_tokens.size(), row_indices.size());
+
+  auto tnow = std::chrono::high_resolution_clock::now();
+  int top_tokens_offset = 0;
+  for (const auto& [rstate, beam_indices] : groups) {
+    if (beam_indices.empty()) {
+      continue;
+    }
+    const GenerationConfig& generation_cfg = rstate->entries[0]->request->generation_cfg;
+    int num_beams = generation_cfg->num_beams;
+    int cur_len = beams[beam_indices[0]]->mstates[0]->committed_tokens.size() + 1;
+    double length_normalizer = std::pow(static_cast<double>(cur_len),
+                                        generation_cfg->length_penalty);
+
+    // - Collect and rank the candidates, each of which extends a beam with a top token.
+    std::vector<BeamCandidate> candidates;
+    std::vector<const std::vector<TokenProbPair>*> beam_top_tokens(num_beams, nullptr);
+    for (int b = 0; b < num_beams; ++b) {
+      const RequestStateEntry& beam = beams[beam_indices[b]];
+      if (std::isinf(beam->beam_logprob)) {
+        continue;
+      }
+      beam_top_tokens[b] = &top_tokens[top_tokens_offset++];
+      for (const TokenProbPair& token : *beam_top_tokens[b]) {
+        if (token.second > 0) {
+          candidates.push_back({beam->beam_logprob + std::log(token.second), b, token});
+        }
+      }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const BeamCandidate& lhs, const BeamCandidate& rhs) {
+                       return lhs.logprob > rhs.logprob;
+                     });
+    ICHECK(!candidates.empty());
+
+    // - Select the best candidates as the new beams. A candidate ending with a stop token is a
+    // finished beam instead, when it ranks among the best `num_beams` candidates.
+    auto f_sample_result = [&](const BeamCandidate& candidate) {
+      SampleResult result{candidate.token, {}};
+      if (generation_cfg->logprobs) {
+        const std::vector<TokenProbPair>& row_tokens = *beam_top_tokens[candidate.beam];
+        int num_top_tokens = std::min<int>(generation_cfg->top_logprobs, row_tokens.size());
+        result.top_prob_tokens.assign(row_tokens.begin(), row_tokens.begin() + num_top_tokens);
+      }
+      return result;
+    };
+    std::vector<BeamCandidate> selected;
+    for (int rank = 0; rank < static_cast<int>(candidates.size()) &&
+                       static_cast<int>(selected.size()) < num_beams;
+         ++rank) {
+      const BeamCandidate& candidate = candidates[rank];
+      bool is_stop = !generation_cfg->ignore_eos &&
+                     std::find(generation_cfg->stop_token_ids.begin(),
+                               generation_cfg->stop_token_ids.end(),
+                               candidate.token.first) != generation_cfg->stop_token_ids.end();
+      if (!is_stop) {
+        selected.push_back(candidate);
+      } else if (rank < num_beams) {
+        BeamHypothesis hypothesis{beams[beam_indices[candidate.beam]]->mstates[0]->committed_tokens,
+                                  candidate.logprob / length_normalizer};
+        hypothesis.tokens.push_back(f_sample_result(candidate));
+        AddFinishedBeam(&rstate->finished_beams, std::move(hypothesis), num_beams);
+      }
+    }
+
+    // - Check if the search finishes, either by length, or because no running beam can
+    // score better than the finished beams any more.
+    bool reach_length_limit =
+        (generation_cfg->max_tokens >= 0 && cur_len >= generation_cfg->max_tokens) ||
+        rstate->entries[0]->request->input_total_length + cur_len >= max_single_sequence_length;
+    bool no_better_beam = static_cast<int>(rstate->finished_beams.size()) >= num_beams &&
+                          (selected.empty() || selected[0].logprob / length_normalizer <=
+                                                   rstate->finished_beams.back().score);
+    if (reach_length_limit || no_better_beam || selected.empty()) {
+      if (!no_better_beam) {
+        for (const BeamCandidate& candidate : selected) {
+          BeamHypothesis hypothesis{
+              beams[beam_indices[candidate.beam]]->mstates[0]->committed_tokens,
+              candidate.logprob / length_normalizer};
+          hypothesis.tokens.push_back(f_sample_result(candidate));
+          AddFinishedBeam(&rstate->finished_beams, std::move(hypothesis), num_beams);
+        }
+      }
+      FinishBeamSearch(estate, models, rstate);
+      continue;
+    }
+    // The beams left without candidates repeat the best beam, and are never expanded.
+    while (static_cast<int>(selected.size()) < num_beams) {
+      selected.push_back(selected[0]);
+      selected.back().logprob = -std::numeric_limits<double>::infinity();
+    }
+
+    // - Assign the new beams to the beam slots. The first new beam extending a beam stays in
+    // the slot of the beam, and the others take the slots of the beams that are not extended.
+    std::vector<int> slots(num_beams, -1);
+    std::vector<bool> slot_taken(num_beams, false);
+    for (int j = 0; j < num_beams; ++j) {
+      if (!slot_taken[selected[j].beam]) {
+        slots[j] = selected[j].beam;
+        slot_taken[selected[j].beam] = true;
+      }
+    }
+    for (int j = 0, free_slot = 0; j < num_beams; ++j) {
+      if (slots[j] == -1) {
+        while (slot_taken[free_slot]) ++free_slot;
+        slots[j] = free_slot;
+        slot_taken[free_slot] = true;
+      }
+    }
+    // Keep the tokens of the extended beams before the slots are overwritten.
+    std::vector<std::vector<std::vector<SampleResult>>> committed_tokens(num_beams);
+    std::vector<std::vector<std::unordered_map<int32_t, int32_t>>> appeared_token_ids(num_beams);
+    for (int j = 0; j < num_beams; ++j) {
+      int b = selected[j].beam;
+      if (slots[j] != b && committed_tokens[b].empty()) {
+        for (const RequestModelState& mstate : beams[beam_indices[b]]->mstates) {
+          committed_tokens[b].push_back(mstate->committed_tokens);
+          appeared_token_ids[b].push_back(mstate->appeared_token_ids);
+        }
+      }
+    }
+    for (int j = 0; j < num_beams; ++j) {
+      const RequestStateEntry& parent = beams[beam_indices[selected[j].beam]];
+      const RequestStateEntry& beam = beams[beam_indices[slots[j]]];
+      if (!beam.same_as(parent)) {
+        // The beams share the KV cache of the prompt before the first token is committed.
+        if (cur_len > 1) {
+          for (int model_id = 0; model_id < static_cast<int>(models.size()); ++model_id) {
+            models[model_id]->RemoveSequence(beam->mstates[model_id]->internal_id);
+            models[model_id]->ForkSequence(parent->mstates[model_id]->internal_id,
+                                           beam->mstates[model_id]->internal_id);
+          }
+        }
+        for (int model_id = 0; model_id < static_cast<int>(beam->mstates.size()); ++model_id) {
+          beam->mstates[model_id]->SetCommittedTokens(
+              committed_tokens[selected[j].beam][model_id]);
+          beam->mstates[model_id]->appeared_token_ids =
+              appeared_token_ids[selected[j].beam][model_id];
+          beam->mstates[model_id]->token_cnt_table_slot = -1;
+        }
+      }
+      SampleResult result = f_sample_result(selected[j]);
+      for (const RequestModelState& mstate : beam->mstates) {
+        mstate->CommitToken(result);
+      }
+      beam->beam_logprob = selected[j].logprob;
+      if (beam->mstates[0]->committed_tokens.size() == 1) {
+        beam->tprefill_finish = tnow;
+      }
+    }
+  }
+}
+
+RequestStateEntry RestartBeamSearchRequest(EngineState estate, const Array<Model>& models,
+                                           const Request& request,
+                                           Optional<EventTraceRecorder> trace_recorder) {
+  RECORD_EVENT(trace_recorder, request->id, "preempt");
+  RequestState rstate = estate->GetRequestState(request);
+  rstate->metrics.tpreemptions.push_back(std::chrono::high_resolution_clock::now());
+  ++estate->stats.total_preemptions;
+  for (int i = static_cast<int>(rstate->entries.size()) - 1; i >= 0; --i) {
+    const RequestStateEntry& rsentry = rstate->entries[i];
+    int64_t seq_id = rsentry->mstates[0]->internal_id;
+    // The finished beams have been removed from models.
+    if (rsentry->status == RequestStateStatus::kAlive) {
+      if (estate->prefix_cache->HasSequence(seq_id)) {
+        estate->prefix_cache->RecycleSequence(seq_id, /*lazy=*/false);
+      } else {
+        RemoveRequestFromModel(estate, seq_id, models);
+        estate->id_manager.RecycleId(seq_id);
+      }
+    }
+    int64_t new_seq_id = estate->id_manager.GetNewId();
+    for (RequestModelState mstate : rsentry->mstates) {
+      mstate->internal_id = new_seq_id;
+      mstate->SetCommittedTokens({});
+      mstate->appeared_token_ids.clear();
+      mstate->token_cnt_table_slot = -1;
+      mstate->inputs = i == 0 ? request->inputs : Array<Data>();
+      mstate->prefilled_inputs.clear();
+      mstate->num_prefilled_tokens = 0;
+      mstate->cached_committed_tokens = 0;
+    }
+    rsentry->status = RequestStateStatus::kPending;
+    rsentry->next_callback_token_pos = 0;
+    if (i > 0) {
+      rsentry->hold_output = true;
+      rsentry->beam_logprob = GetInitialBeamLogProb(i - 1);
+    }
+  }
+  rstate->finished_beams.clear();
+
+  auto it = std::find(estate->running_queue.begin(), estate->running_queue.end(), request);
+  ICHECK(it != estate->running_queue.end());
+  estate->running_queue.erase(it);
+  estate->waiting_queue.insert(estate->waiting_queue.begin(), request);
+  return rstate->entries[0];
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
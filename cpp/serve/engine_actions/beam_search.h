@@ -0,0 +1,75 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/engine_actions/beam_search.h
+ * \brief The beam search functions shared by the decode and prefill EngineActions.
+ */
+#ifndef MLC_LLM_SERVE_ENGINE_ACTIONS_BEAM_SEARCH_H_
+#define MLC_LLM_SERVE_ENGINE_ACTIONS_BEAM_SEARCH_H_
+
+#include <utility>
+#include <vector>
+
+#include "../../support/random.h"
+#include "../engine_state.h"
+#include "../event_trace_recorder.h"
+#include "../model.h"
+#include "../sampler/sampler.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief Take the beams of beam search out of the sampling inputs of an action step. The beams
+ * are expanded by `BeamSearchStep` instead of being sampled.
+ * \param sample_indices The row of the prob distributions of each entry to sample for.
+ * \param rsentries The request state entries to sample for.
+ * \param request_ids The request id of each entry.
+ * \param generation_cfg The generation config of each entry.
+ * \param rngs The random number generator of each entry.
+ * \param rsentry_activated Whether each entry is activated in the step, or nullptr if all the
+ * entries are.
+ * \return The beams taken out, and the row of the prob distributions of each beam.
+ */
+std::pair<std::vector<RequestStateEntry>, std::vector<int>> TakeBeamsFromSampleInputs(
+    std::vector<int>* sample_indices, std::vector<RequestStateEntry>* rsentries,
+    Array<String>* request_ids, Array<GenerationConfig>* generation_cfg,
+    std::vector<RandomGenerator*>* rngs, std::vector<bool>* rsentry_activated);
+
+/*!
+ * \brief Run one step of beam search for the given beams. The beams of each request are
+ * extended with the best candidate tokens, and the KV cache of each new beam is forked from
+ * the beam it extends. When the search of a request finishes, the best finished beams are
+ * committed to the outputs of the request, and the other beams are removed from the models.
+ * \param estate The engine state.
+ * \param models The models the beams run in.
+ * \param sampler The sampler to get the top tokens of the prob distributions with.
+ * \param probs_on_device The prob distributions computed in the step.
+ * \param beams The beams to run beam search for, grouped by request in the entry order.
+ * \param prob_rows The row of the prob distributions of each beam.
+ * \param max_single_sequence_length The max single sequence length, which ends the search.
+ */
+void BeamSearchStep(EngineState estate, const Array<Model>& models, const Sampler& sampler,
+                    const NDArray& probs_on_device, const std::vector<RequestStateEntry>& beams,
+                    const std::vector<int>& prob_rows, int64_t max_single_sequence_length);
+
+/*!
+ * \brief Preempt a beam search request by restarting it. The beams are reordered at every
+ * step, so that they cannot resume one by one and the whole request is prefilled again.
+ * \param estate The engine state to update due to preemption.
+ * \param models The models to remove the request from.
+ * \param request The beam search request to preempt, which is at the back of `running_queue`.
+ * \param trace_recorder The event trace recorder for requests.
+ * \return The root request state entry of the request.
+ */
+RequestStateEntry RestartBeamSearchRequest(EngineState estate, const Array<Model>& models,
+                                           const Request& request,
+                                           Optional<EventTraceRecorder> trace_recorder);
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_ENGINE_ACTIONS_BEAM_SEARCH_H_
@@ -3,6 +3,7 @@
  * \file serve/engine_actions/eagle_batch_draft.cc
  */
 
+#include <algorithm>
 #include <numeric>
 
 #include "../config.h"
@@ -25,17 +26,22 @@ class EagleBatchDraftActionObj : public EngineActionObj {
   explicit EagleBatchDraftActionObj(Array<Model> models, LogitProcessor logit_processor,
                                     Sampler sampler, std::vector<ModelWorkspace> model_workspaces,
                                     DraftTokenWorkspaceManager draft_token_workspace_manager,
-                                    Optional<EventTraceRecorder> trace_recorder, int draft_length)
+                                    Optional<EventTraceRecorder> trace_recorder, int draft_length,
+                                    bool adaptive_draft_length, int max_batch_size)
       : models_(std::move(models)),
         logit_processor_(std::move(logit_processor)),
         sampler_(std::move(sampler)),
         model_workspaces_(std::move(model_workspaces)),
         draft_token_workspace_manager_(std::move(draft_token_workspace_manager)),
         trace_recorder_(std::move(trace_recorder)),
-        draft_length_(draft_length) {
+        draft_length_(draft_length),
+        adaptive_draft_length_(adaptive_draft_length),
+        max_batch_size_(max_batch_size) {
     ICHECK_GT(draft_length_, 0);
   }
 
+  const char* Name() const final { return "EagleBatchDraft"; }
+
   Array<Request> Step(EngineState estate) final {
     // - Only run spec decode when there are two models (llm+ssm) and >=1 running requests.
     if (models_.size() != 2 || estate->running_queue.empty()) {
@@ -43,6 +49,8 @@ class EagleBatchDraftActionObj : public EngineActionObj {
     }
 
     // Preempt request state entries when decode cannot apply.
+    // Order the running queue so that the preemption victim is at the back.
+    estate->scheduler_policy->SortRunningQueue(&estate->running_queue, estate->request_states);
     std::vector<RequestStateEntry> running_rsentries = GetRunningRequestStateEntries(estate);
     while (!CanDecode(running_rsentries.size())) {
       if (estate->prefix_cache->TryFreeMemory()) continue;
@@ -52,6 +60,10 @@ class EagleBatchDraftActionObj : public EngineActionObj {
         running_rsentries.pop_back();
       }
     }
+    if (running_rsentries.empty()) {
+      // All the running requests are cancelled, and the engine aborts them after the action.
+      return {};
+    }
 
     auto tstart = std::chrono::high_resolution_clock::now();
 
@@ -70,51 +82,89 @@ class EagleBatchDraftActionObj : public EngineActionObj {
       rngs.push_back(&rsentry->rng);
     }
 
+    // - Decide the draft length of each request.
+    std::vector<int> draft_lengths = GetDraftLengths(estate, running_rsentries);
+    int max_draft_length =
+        draft_lengths.empty() ? 0 : *std::max_element(draft_lengths.begin(), draft_lengths.end());
+
     // The first model doesn't get involved in draft proposal.
     for (int model_id = 1; model_id < static_cast<int>(models_.size()); ++model_id) {
       // Collect
       // - the last committed token,
       // - the request model state
-      // of each request.
+      // of each request whose draft is not finished.
       std::vector<int> input_tokens;
+      std::vector<int64_t> draft_internal_ids;
       Array<RequestModelState> mstates;
-      input_tokens.reserve(num_rsentries);
-      mstates.reserve(num_rsentries);
-      for (const RequestStateEntry& rsentry : running_rsentries) {
-        mstates.push_back(rsentry->mstates[model_id]);
-      }
-      // draft_length_ rounds of draft proposal.
+      Array<String> draft_request_ids;
+      Array<GenerationConfig> draft_generation_cfg;
+      std::vector<RandomGenerator*> draft_rngs;
+      // The indices of the requests that the rows of `hidden_states` correspond to.
+      std::vector<int> hidden_states_rsentries;
       ObjectRef hidden_states = model_workspaces_[model_id].hidden_states;
-      // Concat last hidden_states
-      draft_token_slots_.clear();
-      if (draft_length_ > 1) {
-        for (int i = 0; i < num_rsentries; ++i) {
-          draft_token_slots_.push_back(mstates[i]->draft_token_slots.back());
-        }
-        hidden_states = models_[model_id]->GatherHiddenStates(
-            model_workspaces_[0].draft_hidden_states_storage, draft_token_slots_, &hidden_states);
-      }
       // The first draft token has been generated in prefill/verify stage
-      for (int draft_id = 1; draft_id < draft_length_; ++draft_id) {
+      for (int draft_id = 1; draft_id < max_draft_length; ++draft_id) {
         // prepare new input tokens
         input_tokens.clear();
+        draft_internal_ids.clear();
+        mstates.clear();
+        draft_request_ids.clear();
+        draft_generation_cfg.clear();
+        draft_rngs.clear();
+        std::vector<int> draft_rsentries;
         for (int i = 0; i < num_rsentries; ++i) {
-          ICHECK(!mstates[i]->draft_output_tokens.empty());
-          input_tokens.push_back(mstates[i]->draft_output_tokens.back().sampled_token_id.first);
+          if (draft_id >= draft_lengths[i]) {
+            continue;
+          }
+          RequestModelState mstate = running_rsentries[i]->mstates[model_id];
+          ICHECK(!mstate->draft_output_tokens.empty());
+          input_tokens.push_back(mstate->draft_output_tokens.back().sampled_token_id.first);
+          draft_internal_ids.push_back(request_internal_ids[i]);
+          mstates.push_back(mstate);
+          draft_request_ids.push_back(request_ids[i]);
+          draft_generation_cfg.push_back(generation_cfg[i]);
+          draft_rngs.push_back(rngs[i]);
+          draft_rsentries.push_back(i);
         }
+        int num_drafts = input_tokens.size();
+
+        // - Gather the last hidden_states of the requests in this round.
+        if (draft_id == 1) {
+          // Concat last hidden_states
+          draft_token_slots_.clear();
+          for (int i = 0; i < num_drafts; ++i) {
+            draft_token_slots_.push_back(mstates[i]->draft_token_slots.back());
+          }
+          hidden_states = models_[model_id]->GatherHiddenStates(
+              draft_token_workspace_manager_->GetDraftHiddenStatesStorage(), draft_token_slots_,
+              &hidden_states);
+        } else if (num_drafts < static_cast<int>(hidden_states_rsentries.size())) {
+          // Keep the rows of the requests whose drafts are not finished.
+          std::vector<int> rows;
+          rows.reserve(num_drafts);
+          for (int row = 0, j = 0; j < num_drafts; ++row) {
+            if (hidden_states_rsentries[row] == draft_rsentries[j]) {
+              rows.push_back(row);
+              ++j;
+            }
+          }
+          hidden_states = models_[model_id]->GatherHiddenStates(
+              hidden_states, rows, &model_workspaces_[model_id].hidden_states);
+        }
+        hidden_states_rsentries = std::move(draft_rsentries);
 
         // - Compute embeddings.
-        RECORD_EVENT(trace_recorder_, request_ids, "start proposal embedding");
+        RECORD_EVENT(trace_recorder_, draft_request_ids, "start proposal embedding");
         ObjectRef embeddings =
             models_[model_id]->TokenEmbed({IntTuple{input_tokens.begin(), input_tokens.end()}});
-        RECORD_EVENT(trace_recorder_, request_ids, "finish proposal embedding");
+        RECORD_EVENT(trace_recorder_, draft_request_ids, "finish proposal embedding");
 
         // - Invoke model decode.
-        RECORD_EVENT(trace_recorder_, request_ids, "start proposal decode");
+        RECORD_EVENT(trace_recorder_, draft_request_ids, "start proposal decode");
         ObjectRef fused_embedding_hidden_states = models_[model_id]->FuseEmbedHidden(
-            embeddings, hidden_states, /*batch_size*/ num_rsentries, /*seq_len*/ 1);
+            embeddings, hidden_states, /*batch_size*/ num_drafts, /*seq_len*/ 1);
         hidden_states = models_[model_id]->BatchDecodeToLastHidden(fused_embedding_hidden_states,
-                                                                   request_internal_ids);
+                                                                   draft_internal_ids);
         NDArray logits;
         if (models_[model_id]->CanGetLogits()) {
           logits = models_[model_id]->GetLogits(hidden_states);
@@ -122,33 +172,36 @@ class EagleBatchDraftActionObj : public EngineActionObj {
           // - Use base model's head.
           logits = models_[0]->GetLogits(hidden_states);
         }
-        RECORD_EVENT(trace_recorder_, request_ids, "finish proposal decode");
+        RECORD_EVENT(trace_recorder_, draft_request_ids, "finish proposal decode");
         ICHECK_EQ(logits->ndim, 2);
-        ICHECK_EQ(logits->shape[0], num_rsentries);
+        ICHECK_EQ(logits->shape[0], num_drafts);
 
         // - Update logits.
-        logit_processor_->InplaceUpdateLogits(logits, generation_cfg, mstates, request_ids);
+        logit_processor_->InplaceUpdateLogits(logits, draft_generation_cfg, mstates,
+                                              draft_request_ids);
 
         // - Compute probability distributions.
-        NDArray probs_on_device =
-            logit_processor_->ComputeProbsFromLogits(logits, generation_cfg, request_ids);
+        NDArray probs_on_device = logit_processor_->ComputeProbsFromLogits(
+            logits, draft_generation_cfg, draft_request_ids);
 
         // - Sample tokens.
-        // Fill range [0, num_rsentries) into `sample_indices`.
-        std::vector<int> sample_indices(num_rsentries);
+        // Fill range [0, num_drafts) into `sample_indices`.
+        std::vector<int> sample_indices(num_drafts);
         std::iota(sample_indices.begin(), sample_indices.end(), 0);
         NDArray renormalized_probs = sampler_->BatchRenormalizeProbsByTopP(
-            probs_on_device, sample_indices, request_ids, generation_cfg);
+            probs_on_device, sample_indices, draft_request_ids, draft_generation_cfg);
         std::vector<SampleResult> sample_results = sampler_->BatchSampleTokensWithProbAfterTopP(
-            renormalized_probs, sample_indices, request_ids, generation_cfg, rngs);
-        ICHECK_EQ(sample_results.size(), num_rsentries);
+            renormalized_probs, sample_indices, draft_request_ids, draft_generation_cfg,
+            draft_rngs);
+        ICHECK_EQ(sample_results.size(), num_drafts);
 
         // - Add draft token to the state.
-        draft_token_workspace_manager_->AllocSlots(num_rsentries, &draft_token_slots_);
+        draft_token_workspace_manager_->AllocSlots(num_drafts, &draft_token_slots_);
+        NDArray draft_probs_storage = draft_token_workspace_manager_->GetDraftProbsStorage();
         models_[model_id]->ScatterDraftProbs(probs_on_device, draft_token_slots_,
-                                             &model_workspaces_[0].draft_probs_storage);
+                                             &draft_probs_storage);
         // No need to save hidden states as they are not used by subsequent engine actions
-        for (int i = 0; i < num_rsentries; ++i) {
+        for (int i = 0; i < num_drafts; ++i) {
           mstates[i]->AddDraftToken(sample_results[i], draft_token_slots_[i]);
           estate->stats.total_draft_length += 1;
         }
@@ -162,6 +215,29 @@ class EagleBatchDraftActionObj : public EngineActionObj {
   }
 
  private:
+  /*!
+   * \brief Decide the draft length of each request, including the draft token proposed in
+   * verification. The requests only verify that draft token when the batch is larger than
+   * the limit. The draft lengths are further bounded by the draft tokens the step planner
+   * allocates.
+   */
+  std::vector<int> GetDraftLengths(EngineState estate,
+                                   const std::vector<RequestStateEntry>& rsentries) {
+    if (max_batch_size_ != -1 && static_cast<int>(rsentries.size()) > max_batch_size_) {
+      return std::vector<int>(rsentries.size(), 1);
+    }
+    std::vector<int> draft_lengths;
+    draft_lengths.reserve(rsentries.size());
+    for (const RequestStateEntry& rsentry : rsentries) {
+      int draft_length = adaptive_draft_length_
+                             ? rsentry->spec_draft_controller.GetDraftLength(draft_length_)
+                             : draft_length_;
+      draft_lengths.push_back(
+          std::max(estate->step_planner.GetDraftLength(draft_length, /*tree_width=*/1), 1));
+    }
+    return draft_lengths;
+  }
+
   /*! \brief Check if the input requests can be decoded under conditions. */
   bool CanDecode(int num_rsentries) {
     // The first model is not involved in draft proposal.
@@ -189,6 +265,10 @@ class EagleBatchDraftActionObj : public EngineActionObj {
   Optional<EventTraceRecorder> trace_recorder_;
   /*! \brief Draft proposal length */
   int draft_length_;
+  /*! \brief Whether to adapt the draft length of each request to its acceptance rate. */
+  bool adaptive_draft_length_;
+  /*! \brief The largest batch size to draft for, or -1 for no limit. */
+  int max_batch_size_;
   /*! \brief Temporary buffer to store the slots of the current draft tokens */
   std::vector<int> draft_token_slots_;
 };
@@ -198,11 +278,12 @@ EngineAction EngineAction::EagleBatchDraft(Array<Model> models, LogitProcessor l
                                            std::vector<ModelWorkspace> model_workspaces,
                                            DraftTokenWorkspaceManager draft_token_workspace_manager,
                                            Optional<EventTraceRecorder> trace_recorder,
-                                           int draft_length) {
+                                           int draft_length, bool adaptive_draft_length,
+                                           int max_batch_size) {
   return EngineAction(make_object<EagleBatchDraftActionObj>(
       std::move(models), std::move(logit_processor), std::move(sampler),
       std::move(model_workspaces), std::move(draft_token_workspace_manager),
-      std::move(trace_recorder), draft_length));
+      std::move(trace_recorder), draft_length, adaptive_draft_length, max_batch_size));
 }
 
 }  // namespace serve
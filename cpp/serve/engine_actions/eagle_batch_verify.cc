@@ -39,7 +39,13 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
         draft_token_workspace_manager_(std::move(draft_token_workspace_manager)),
         engine_config_(std::move(engine_config)),
         trace_recorder_(std::move(trace_recorder)),
-        rng_(RandomGenerator::GetInstance()) {}
+        rng_(RandomGenerator::GetInstance()) {
+    if (engine_config_->speculative_mode == SpeculativeMode::kMedusa) {
+      tree_width_ = GetSpecTreeWidth(engine_config_, models_[verify_model_id_]);
+    }
+  }
+
+  const char* Name() const final { return "EagleBatchVerify"; }
 
   Array<Request> Step(EngineState estate) final {
     // - Only run spec decode when there are two models (llm+ssm) and >=1 running requests.
@@ -65,6 +71,8 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
     Array<GenerationConfig> generation_cfg;
     std::vector<RandomGenerator*> rngs;
     std::vector<std::vector<SampleResult>> draft_output_tokens;
+    std::vector<int64_t> token_tree_parent_ptr;
+    bool verify_token_tree = false;
     request_internal_ids.reserve(num_rsentries);
     all_tokens_to_verify.reserve(total_draft_length);
     verify_request_mstates.reserve(num_rsentries);
@@ -83,9 +91,13 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
       // the last committed token + all the draft tokens but the last one.
       all_tokens_to_verify.push_back(draft_mstate->committed_tokens.back().sampled_token_id.first);
       draft_token_slots_.push_back(0);  // placeholder for the last committed token
+      token_tree_parent_ptr.push_back(-1);
       for (int j = 0; j < static_cast<int>(draft_mstate->draft_output_tokens.size()); ++j) {
         all_tokens_to_verify.push_back(draft_mstate->draft_output_tokens[j].sampled_token_id.first);
         draft_token_slots_.push_back(draft_mstate->draft_token_slots[j]);
+        // The last committed token comes first, so the parent position is the index plus one.
+        token_tree_parent_ptr.push_back(draft_mstate->draft_token_parent_idx[j] + 1);
+        verify_token_tree |= draft_mstate->draft_token_parent_idx[j] != j - 1;
       }
       verify_request_mstates.push_back(verify_mstate);
       generation_cfg.push_back(rsentries[i]->request->generation_cfg);
@@ -93,9 +105,11 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
       draft_output_tokens.push_back(draft_mstate->draft_output_tokens);
     }
 
+    NDArray draft_probs_buffer =
+        draft_token_workspace_manager_->GetDraftProbsBuffer(draft_token_slots_.size());
     NDArray draft_probs_on_device = models_[draft_model_id_]->GatherDraftProbs(
-        model_workspaces_[verify_model_id_].draft_probs_storage, draft_token_slots_,
-        &model_workspaces_[verify_model_id_].draft_probs);
+        draft_token_workspace_manager_->GetDraftProbsStorage(), draft_token_slots_,
+        &draft_probs_buffer);
 
     std::vector<int> cum_verify_lengths = {0};
     cum_verify_lengths.reserve(num_rsentries + 1);
@@ -113,7 +127,8 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
 
     RECORD_EVENT(trace_recorder_, request_ids, "start verify");
     ObjectRef hidden_states = models_[verify_model_id_]->BatchVerifyToLastHidden(
-        embeddings, request_internal_ids, verify_lengths);
+        embeddings, request_internal_ids, verify_lengths,
+        verify_token_tree ? token_tree_parent_ptr : std::vector<int64_t>());
     NDArray logits = models_[verify_model_id_]->GetLogits(hidden_states);
     RECORD_EVENT(trace_recorder_, request_ids, "finish verify");
     ICHECK_EQ(logits->ndim, 2);
@@ -133,7 +148,11 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
     std::vector<std::vector<SampleResult>> sample_results_arr =
         sampler_->BatchVerifyDraftTokensWithProbAfterTopP(
             renormalized_probs, request_ids, cum_verify_lengths, generation_cfg, rngs,
-            draft_output_tokens, draft_probs_on_device);
+            draft_output_tokens,
+            verify_token_tree ? std::vector<int>(token_tree_parent_ptr.begin(),
+                                                 token_tree_parent_ptr.end())
+                              : std::vector<int>(),
+            draft_probs_on_device);
     ICHECK_EQ(sample_results_arr.size(), num_rsentries);
 
     // We collect the requests whose drafts are fully accepted.
@@ -145,10 +164,33 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
 
     std::vector<int> last_accepted_hidden_positions;
     last_accepted_hidden_positions.reserve(num_rsentries);
+    std::vector<int64_t> accepted_leaf_indices;
+    accepted_leaf_indices.reserve(num_rsentries);
     for (int i = 0; i < num_rsentries; ++i) {
       const std::vector<SampleResult>& sample_results = sample_results_arr[i];
       int accept_length = sample_results.size();
       ICHECK_GE(accept_length, 1);
+      if (verify_token_tree) {
+        // Medusa has no KV cache in the draft model, so only the verified token tree in the
+        // target model keeps the path to the last accepted node.
+        const RequestModelState& draft_mstate = rsentries[i]->mstates[draft_model_id_];
+        std::vector<int> accepted_nodes = GetAcceptedDraftTokens(draft_mstate, sample_results);
+        int leaf_position = accepted_nodes.empty() ? 0 : accepted_nodes.back() + 1;
+        rsentries[i]->spec_draft_controller.Update(GetDraftTokenTreeDepth(draft_mstate),
+                                                   accepted_nodes.size());
+        for (SampleResult sample_result : sample_results) {
+          rsentries[i]->mstates[verify_model_id_]->CommitToken(sample_result);
+          draft_mstate->CommitToken(sample_result);
+        }
+        estate->stats.UpdateSpecDecodingStats(cum_verify_lengths[i + 1] - cum_verify_lengths[i],
+                                              accept_length);
+        estate->stats.total_accepted_length += accept_length - 1;
+        accepted_leaf_indices.push_back(leaf_position);
+        draft_mstate->RemoveAllDraftTokens(&draft_token_slots_);
+        draft_token_workspace_manager_->FreeSlots(draft_token_slots_);
+        last_accepted_hidden_positions.push_back(cum_verify_lengths[i] + leaf_position);
+        continue;
+      }
       for (SampleResult sample_result : sample_results) {
         rsentries[i]->mstates[verify_model_id_]->CommitToken(sample_result);
         rsentries[i]->mstates[draft_model_id_]->CommitToken(sample_result);
@@ -156,6 +198,7 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
       estate->stats.UpdateSpecDecodingStats(cum_verify_lengths[i + 1] - cum_verify_lengths[i],
                                             accept_length);
       estate->stats.total_accepted_length += accept_length - 1;
+      rsentries[i]->spec_draft_controller.Update(draft_lengths[i], accept_length - 1);
       // - Minus one because the last draft token has no kv cache entry
       // - Take max with 0 in case of all accepted.
       int rollback_length =
@@ -179,6 +222,10 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
       // - Slice and save hidden_states_for_sample
       last_accepted_hidden_positions.push_back(cum_verify_lengths[i] + accept_length - 1);
     }
+    if (verify_token_tree) {
+      models_[verify_model_id_]->CommitAcceptedTokenTreeNodes(request_internal_ids,
+                                                              accepted_leaf_indices);
+    }
     if (!fully_accepted_rsentries.empty() &&
         engine_config_->speculative_mode == SpeculativeMode::kEagle) {
       // - Run a step of batch decode for requests whose drafts are fully accepted.
@@ -291,6 +338,11 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
                                          request_ids, mstates, rngs, sample_indices);
         UpdateRequestStatesWithDraftProposals(mstates, sample_results, draft_model_id_,
                                               renormalized_probs, hidden_states, estate);
+      } else if (engine_config_->speculative_mode == SpeculativeMode::kMedusa && tree_width_ > 1) {
+        ProposeMedusaDraftTokenTrees(multi_step_logits, engine_config_->spec_draft_length,
+                                     tree_width_, logit_processor_, sampler_, models_[0],
+                                     draft_token_workspace_manager_, mstates, generation_cfg,
+                                     request_ids, rngs, estate);
       } else if (engine_config_->speculative_mode == SpeculativeMode::kMedusa) {
         for (int draft_id = 0; draft_id < engine_config_->spec_draft_length; draft_id++) {
           const auto& [renormalized_probs, sample_results] = ApplyLogitProcessorAndSample(
@@ -330,6 +382,8 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
     int num_available_pages = models_[verify_model_id_]->GetNumAvailablePages();
 
     // Preempt the request state entries that cannot fit the large model for verification.
+    // Order the running queue so that the preemption victim is at the back.
+    estate->scheduler_policy->SortRunningQueue(&estate->running_queue, estate->request_states);
     std::vector<RequestStateEntry> running_rsentries = GetRunningRequestStateEntries(estate);
     std::vector<int> num_page_requirement;
     num_page_requirement.reserve(running_rsentries.size());
@@ -369,12 +423,14 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
                                              const ObjectRef& hidden_states_for_sample,
                                              EngineState estate) {
     draft_token_workspace_manager_->AllocSlots(mstates.size(), &draft_token_slots_);
-    models_[0]->ScatterDraftProbs(renormalized_probs, draft_token_slots_,
-                                  &model_workspaces_[0].draft_probs_storage);
+    NDArray draft_probs_storage = draft_token_workspace_manager_->GetDraftProbsStorage();
+    models_[0]->ScatterDraftProbs(renormalized_probs, draft_token_slots_, &draft_probs_storage);
     if (engine_config_->speculative_mode == SpeculativeMode::kEagle &&
         engine_config_->spec_draft_length > 1) {
+      ObjectRef draft_hidden_states_storage =
+          draft_token_workspace_manager_->GetDraftHiddenStatesStorage();
       models_[0]->ScatterHiddenStates(hidden_states_for_sample, draft_token_slots_,
-                                      &model_workspaces_[0].draft_hidden_states_storage);
+                                      &draft_hidden_states_storage);
     }
     for (int i = 0; i < static_cast<int>(mstates.size()); ++i) {
       mstates[i]->AddDraftToken(sample_results[i], draft_token_slots_[i]);
@@ -403,6 +459,8 @@ class EagleBatchVerifyActionObj : public EngineActionObj {
   /*! \brief The ids of verify/draft models. */
   const int verify_model_id_ = 0;
   const int draft_model_id_ = 1;
+  /*! \brief The width of the draft token trees proposed by the Medusa heads. */
+  int tree_width_ = 1;
   const float eps_ = 1e-5;
   /*! \brief Temporary buffer to store the slots of the current draft tokens */
   std::vector<int> draft_token_slots_;
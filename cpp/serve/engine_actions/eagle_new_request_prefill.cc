@@ -3,6 +3,8 @@
  * \file serve/engine_actions/eagle_new_request_prefill.cc
  */
 
+#include <algorithm>
+
 #include "../sampler/sampler.h"
 #include "batch_prefill_base.h"
 
@@ -30,6 +32,8 @@ class EagleNewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
         model_workspaces_(std::move(model_workspaces)),
         draft_token_workspace_manager_(std::move(draft_token_workspace_manager)) {}
 
+  const char* Name() const final { return "EagleNewRequestPrefill"; }
+
   Array<Request> Step(EngineState estate) final {
     // - Find the requests in `waiting_queue` that can prefill in this step.
     std::vector<PrefillInput> prefill_inputs;
@@ -115,9 +119,7 @@ class EagleNewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
             for (int j = 1; j < static_cast<int>(models_.size()); ++j) {
               ICHECK(rsentry->mstates[j]->inputs.size());
               TokenData token_data = Downcast<TokenData>(rsentry->mstates[j]->inputs[0]);
-              rsentry->mstates[j]->inputs.Set(
-                  0, TokenData(
-                         IntTuple(token_data->token_ids.begin() + 1, token_data->token_ids.end())));
+              rsentry->mstates[j]->inputs.Set(0, token_data.Slice(1, token_data->GetLength()));
             }
           }
         }
@@ -215,6 +217,7 @@ class EagleNewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
         }
 
         int remaining_num_child_to_activate = prefill_inputs[i].num_child_to_activate;
+        std::vector<int> activated_child_indices;
         for (int child_idx : rsentry->child_indices) {
           // Only use base model to judge if we need to add child entries.
           if (rstates_of_entries[i]->entries[child_idx]->status == RequestStateStatus::kPending &&
@@ -246,13 +249,25 @@ class EagleNewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
                      RequestStateStatus::kPending);
               rstates_of_entries[i]->entries[child_idx]->status = RequestStateStatus::kAlive;
             }
-            int64_t child_internal_id =
-                rstates_of_entries[i]->entries[child_idx]->mstates[model_id]->internal_id;
-            models_[model_id]->ForkSequence(rsentry->mstates[model_id]->internal_id,
-                                            child_internal_id);
+            activated_child_indices.push_back(child_idx);
+          }
+        }
+        // Fork all the activated children from the prefilled parent at once, so that they
+        // share the KV cache of the prompt.
+        if (!activated_child_indices.empty()) {
+          std::vector<int64_t> child_internal_ids;
+          child_internal_ids.reserve(activated_child_indices.size());
+          for (int child_idx : activated_child_indices) {
+            child_internal_ids.push_back(
+                rstates_of_entries[i]->entries[child_idx]->mstates[model_id]->internal_id);
+          }
+          models_[model_id]->ForkSequences(rsentry->mstates[model_id]->internal_id,
+                                           child_internal_ids);
+          for (int j = 0; j < static_cast<int>(activated_child_indices.size()); ++j) {
             // Enable sliding window for the child sequence if the child is not a parent.
+            int child_idx = activated_child_indices[j];
             if (rstates_of_entries[i]->entries[child_idx]->child_indices.empty()) {
-              models_[model_id]->EnableSlidingWindowForSeq(child_internal_id);
+              models_[model_id]->EnableSlidingWindowForSeq(child_internal_ids[j]);
             }
           }
         }
@@ -330,12 +345,14 @@ class EagleNewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
       const NDArray& renormalized_probs, const ObjectRef& hidden_states_for_sample,
       EngineState estate) {
     draft_token_workspace_manager_->AllocSlots(rsentries_for_sample.size(), &draft_token_slots_);
-    models_[0]->ScatterDraftProbs(renormalized_probs, draft_token_slots_,
-                                  &model_workspaces_[0].draft_probs_storage);
+    NDArray draft_probs_storage = draft_token_workspace_manager_->GetDraftProbsStorage();
+    models_[0]->ScatterDraftProbs(renormalized_probs, draft_token_slots_, &draft_probs_storage);
     if (engine_config_->speculative_mode == SpeculativeMode::kEagle &&
         engine_config_->spec_draft_length > 1) {
+      ObjectRef draft_hidden_states_storage =
+          draft_token_workspace_manager_->GetDraftHiddenStatesStorage();
       models_[0]->ScatterHiddenStates(hidden_states_for_sample, draft_token_slots_,
-                                      &model_workspaces_[0].draft_hidden_states_storage);
+                                      &draft_hidden_states_storage);
     }
     for (int i = 0; i < static_cast<int>(rsentries_for_sample.size()); ++i) {
       rsentries_for_sample[i]->mstates[model_id]->AddDraftToken(sample_results[i],
@@ -368,7 +385,12 @@ class EagleNewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
     if (rsentry->parent_idx == -1 && rsentry->status == RequestStateStatus::kPending &&
         !estate->prefix_cache->HasSequence(rsentry->mstates[0]->internal_id)) {
       IntTuple tokens = GetConcatPrefillInputData(rsentry->mstates[0]);
-      if (!tokens.size()) {
+      // The matches are shifted by one token for the draft model, which cannot be aligned to
+      // the images. So the requests with images bypass prefix cache.
+      bool has_image = std::any_of(
+          rsentry->mstates[0]->inputs.begin(), rsentry->mstates[0]->inputs.end(),
+          [](const Data& data) { return data.as<ImageDataNode>() != nullptr; });
+      if (!tokens.size() || has_image) {
         // If the RequestStateEntry is of empty input data, or not fully tokenized, do nothing
         // and return.
         return;
@@ -3,8 +3,11 @@
  * \file serve/engine_actions/new_request_prefill.cc
  */
 
+#include <unordered_set>
+
 #include "../sampler/sampler.h"
 #include "batch_prefill_base.h"
+#include "beam_search.h"
 
 namespace mlc {
 namespace llm {
@@ -12,7 +15,8 @@ namespace serve {
 
 /*!
  * \brief The action that prefills requests in the `waiting_queue` of
- * the engine state.
+ * the engine state. Under the hybrid prefill mode, the action also decodes
+ * the running requests in the same forward pass as the prefill.
  */
 class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
  public:
@@ -25,26 +29,56 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
                                   std::move(model_configs), std::move(trace_recorder)),
         logit_processor_(std::move(logit_processor)),
         sampler_(std::move(sampler)),
-        model_workspaces_(std::move(model_workspaces)) {}
+        model_workspaces_(std::move(model_workspaces)) {
+    // Decode is packed into prefill only when there is a single model, which is
+    // the same condition where the BatchDecode action takes effect.
+    hybrid_prefill_enabled_ =
+        engine_config_->prefill_mode == PrefillMode::kHybrid && models_.size() == 1;
+    concurrent_draft_prefill_ = engine_config_->concurrent_draft_prefill &&
+                                engine_config_->speculative_mode == SpeculativeMode::kSmallDraft;
+    for (const Model& model : models_) {
+      concurrent_draft_prefill_ &= model->SupportSideStream();
+    }
+    // The state checkpoints are kept as recycling sequences of prefix cache.
+    rnn_state_ = models_[0]->GetMetadata().kv_state_kind == KVStateKind::kRNNState;
+    if (rnn_state_ && engine_config_->prefix_cache_mode == PrefixCacheMode::kRadix &&
+        engine_config_->prefix_cache_max_num_recycling_seqs != 0) {
+      rnn_state_checkpoint_interval_ = engine_config_->rnn_state_checkpoint_interval;
+    }
+  }
+
+  const char* Name() const final { return "NewRequestPrefill"; }
 
   Array<Request> Step(EngineState estate) final {
     // - Find the requests in `waiting_queue` that can prefill in this step.
+    // - Under the hybrid prefill mode, decode all the running request state entries
+    // together with the prefill, each of which takes one token of the prefill chunk.
     std::vector<PrefillInput> prefill_inputs;
+    std::vector<RequestStateEntry> decode_rsentries;
     {
       NVTXScopedRange nvtx_scope("NewRequestPrefill getting requests");
-      prefill_inputs = GetRequestStateEntriesToPrefill(estate);
+      if (hybrid_prefill_enabled_ && !estate->waiting_queue.empty()) {
+        decode_rsentries = GetRunningRequestStateEntries(estate);
+      }
+      prefill_inputs = GetRequestStateEntriesToPrefill(estate, decode_rsentries.size());
       if (prefill_inputs.empty()) {
+        // The running requests are decoded by the BatchDecode action instead.
         return {};
       }
     }
 
     int num_rsentries = prefill_inputs.size();
+    int num_decode_rsentries = decode_rsentries.size();
     {
       NVTXScopedRange nvtx_scope("NewRequestPrefill matching prefix");
       for (int i = 0; i < num_rsentries; ++i) {
         MatchPrefixCache(estate, &prefill_inputs[i]);
       }
     }
+    std::vector<int64_t> state_lengths;
+    if (rnn_state_checkpoint_interval_ > 0) {
+      state_lengths = AlignChunksToStateCheckpoints(estate, &prefill_inputs);
+    }
 
     auto tstart = std::chrono::high_resolution_clock::now();
 
@@ -60,12 +94,19 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
     prefill_lengths.resize(/*size=*/num_rsentries, /*value=*/-1);
     NDArray logits_for_sample{nullptr};
     for (int model_id = 0; model_id < static_cast<int>(models_.size()); ++model_id) {
+      // The draft models prefill on their side streams, which overlap with the target model.
+      bool on_side_stream = concurrent_draft_prefill_ && model_id > 0;
+      if (on_side_stream) {
+        models_[model_id]->BeginSideStream();
+      }
       std::vector<int64_t> request_internal_ids;
       request_internal_ids.reserve(num_rsentries);
+      std::vector<Array<Data>> rsentry_input_data;
+      rsentry_input_data.reserve(num_rsentries);
       ObjectRef embeddings = model_workspaces_[model_id].embeddings;
       int cum_prefill_length = 0;
-      bool single_input =
-          num_rsentries == 1 && prefill_inputs[0].rsentry->mstates[model_id]->inputs.size() == 1;
+      bool single_input = num_rsentries == 1 && num_decode_rsentries == 0 &&
+                          prefill_inputs[0].rsentry->mstates[model_id]->inputs.size() == 1;
       for (int i = 0; i < num_rsentries; ++i) {
         const RequestStateEntry& rsentry = prefill_inputs[i].rsentry;
         RequestModelState mstate = rsentry->mstates[model_id];
@@ -87,6 +128,10 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
           // KVCache.
           if (rsentry->parent_idx == -1) {
             models_[model_id]->AddNewSequence(mstate->internal_id);
+            if (rstates_of_entries[i]->lora_adapter_slot != -1) {
+              models_[model_id]->SetSequenceLoRAAdapter(mstate->internal_id,
+                                                        rstates_of_entries[i]->lora_adapter_slot);
+            }
           } else {
             models_[model_id]->ForkSequence(
                 rstates_of_entries[i]->entries[rsentry->parent_idx]->mstates[model_id]->internal_id,
@@ -98,32 +143,107 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
           }
         }
         request_internal_ids.push_back(mstate->internal_id);
-        RECORD_EVENT(trace_recorder_, rsentry->request->id, "start embedding");
-        for (int i = 0; i < static_cast<int>(input_data.size()); ++i) {
+        rsentry_input_data.push_back(std::move(input_data));
+      }
+
+      // - Embed the images of all the request state entries in one batch, so that the vision
+      // encoder runs once for the step rather than once per image.
+      std::vector<NDArray> images;
+      std::vector<uint64_t> image_hashes;
+      for (const Array<Data>& input_data : rsentry_input_data) {
+        for (const Data& data : input_data) {
+          if (const auto* image_data = data.as<ImageDataNode>()) {
+            if (image_data->content_hash != 0) {
+              images.push_back(image_data->image);
+              image_hashes.push_back(image_data->content_hash);
+            }
+          }
+        }
+      }
+      if (images.size() >= 2) {
+        models_[model_id]->PrefetchImageEmbeddings(images, image_hashes);
+      }
+
+      // The consecutive token inputs, across the request state entries, are gathered into one
+      // staging buffer and embedded in one call.
+      std::vector<IntTuple> gathered_token_ids;
+      int gathered_offset = 0;
+      auto f_embed_gathered_tokens = [&]() {
+        if (!gathered_token_ids.empty()) {
+          embeddings = models_[model_id]->GatherTokenEmbed(
+              gathered_token_ids, /*dst=*/!single_input ? &embeddings : nullptr,
+              /*offset=*/gathered_offset);
+          gathered_token_ids.clear();
+        }
+      };
+      RECORD_EVENT(trace_recorder_, request_ids, "start embedding");
+      for (int i = 0; i < num_rsentries; ++i) {
+        const RequestStateEntry& rsentry = prefill_inputs[i].rsentry;
+        RequestModelState mstate = rsentry->mstates[model_id];
+        const Array<Data>& input_data = rsentry_input_data[i];
+        for (int j = 0; j < static_cast<int>(input_data.size()); ++j) {
           if (!model_id) {
-            mstate->prefilled_inputs.push_back(input_data[i]);
+            mstate->prefilled_inputs.push_back(input_data[j]);
           }
-          embeddings = input_data[i]->GetEmbedding(models_[model_id],
-                                                   /*dst=*/!single_input ? &embeddings : nullptr,
-                                                   /*offset=*/cum_prefill_length);
-          cum_prefill_length += input_data[i]->GetLength();
+          if (const auto* token_data = input_data[j].as<TokenDataNode>()) {
+            if (gathered_token_ids.empty()) {
+              gathered_offset = cum_prefill_length;
+            }
+            gathered_token_ids.push_back(token_data->token_ids);
+          } else {
+            f_embed_gathered_tokens();
+            embeddings = input_data[j]->GetEmbedding(models_[model_id],
+                                                     /*dst=*/!single_input ? &embeddings : nullptr,
+                                                     /*offset=*/cum_prefill_length);
+          }
+          cum_prefill_length += input_data[j]->GetLength();
+        }
+      }
+      // Pack the last committed token of each decode entry after the prefill inputs.
+      std::vector<int> forward_lengths = prefill_lengths;
+      if (num_decode_rsentries > 0) {
+        std::vector<int64_t> decode_tokens;
+        decode_tokens.reserve(num_decode_rsentries);
+        for (const RequestStateEntry& rsentry : decode_rsentries) {
+          decode_tokens.push_back(
+              rsentry->mstates[model_id]->committed_tokens.back().sampled_token_id.first);
+          request_internal_ids.push_back(rsentry->mstates[model_id]->internal_id);
+        }
+        if (gathered_token_ids.empty()) {
+          gathered_offset = cum_prefill_length;
         }
-        RECORD_EVENT(trace_recorder_, rsentry->request->id, "finish embedding");
+        gathered_token_ids.push_back(IntTuple(decode_tokens.begin(), decode_tokens.end()));
+        forward_lengths.insert(forward_lengths.end(), num_decode_rsentries, 1);
       }
+      f_embed_gathered_tokens();
+      RECORD_EVENT(trace_recorder_, request_ids, "finish embedding");
 
       RECORD_EVENT(trace_recorder_, request_ids, "start prefill");
       NDArray logits =
-          models_[model_id]->BatchPrefill(embeddings, request_internal_ids, prefill_lengths);
+          models_[model_id]->BatchPrefill(embeddings, request_internal_ids, forward_lengths);
       RECORD_EVENT(trace_recorder_, request_ids, "finish prefill");
       ICHECK_EQ(logits->ndim, 3);
       ICHECK_EQ(logits->shape[0], 1);
-      ICHECK_EQ(logits->shape[1], num_rsentries);
+      ICHECK_EQ(logits->shape[1], num_rsentries + num_decode_rsentries);
+
+      if (on_side_stream) {
+        models_[model_id]->EndSideStream();
+      }
 
       if (model_id == 0) {
         // We only need to sample for model 0 in prefill.
         logits_for_sample = logits;
       }
     }
+    if (concurrent_draft_prefill_) {
+      // The later steps on the compute stream use the KV cache of the draft models.
+      for (int model_id = 1; model_id < static_cast<int>(models_.size()); ++model_id) {
+        models_[model_id]->SyncSideStream();
+      }
+    }
+    if (!state_lengths.empty()) {
+      TakeStateCheckpoints(estate, prefill_inputs, prefill_lengths, state_lengths);
+    }
 
     // - Update logits.
     ICHECK(logits_for_sample.defined());
@@ -135,8 +255,14 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
       generation_cfg.push_back(prefill_inputs[i].rsentry->request->generation_cfg);
       mstates_for_logitproc.push_back(prefill_inputs[i].rsentry->mstates[0]);
     }
-    logits_for_sample = logits_for_sample.CreateView({num_rsentries, logits_for_sample->shape[2]},
-                                                     logits_for_sample->dtype);
+    for (const RequestStateEntry& rsentry : decode_rsentries) {
+      request_ids.push_back(rsentry->request->id);
+      generation_cfg.push_back(rsentry->request->generation_cfg);
+      mstates_for_logitproc.push_back(rsentry->mstates[0]);
+    }
+    logits_for_sample = logits_for_sample.CreateView(
+        {num_rsentries + num_decode_rsentries, logits_for_sample->shape[2]},
+        logits_for_sample->dtype);
     logit_processor_->InplaceUpdateLogits(logits_for_sample, generation_cfg, mstates_for_logitproc,
                                           request_ids);
 
@@ -166,6 +292,7 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
       }
 
       int remaining_num_child_to_activate = prefill_inputs[i].num_child_to_activate;
+      std::vector<int> activated_child_indices;
       for (int child_idx : rsentry->child_indices) {
         // If rstates_of_entries[i]->entries[child_idx] has no committed token,
         // the prefill of the current rsentry will unblock
@@ -193,14 +320,25 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
         rsentry_activated.push_back(true);
         --remaining_num_child_to_activate;
         rstates_of_entries[i]->entries[child_idx]->status = RequestStateStatus::kAlive;
+        activated_child_indices.push_back(child_idx);
+      }
+      // Fork all the activated children from the prefilled parent at once, so that they share
+      // the KV cache of the prompt.
+      if (!activated_child_indices.empty()) {
         for (int model_id = 0; model_id < static_cast<int>(models_.size()); ++model_id) {
-          int64_t child_internal_id =
-              rstates_of_entries[i]->entries[child_idx]->mstates[model_id]->internal_id;
-          models_[model_id]->ForkSequence(rsentry->mstates[model_id]->internal_id,
-                                          child_internal_id);
-          // Enable sliding window for the child sequence if the child is not a parent.
-          if (rstates_of_entries[i]->entries[child_idx]->child_indices.empty()) {
-            models_[model_id]->EnableSlidingWindowForSeq(child_internal_id);
+          std::vector<int64_t> child_internal_ids;
+          child_internal_ids.reserve(activated_child_indices.size());
+          for (int child_idx : activated_child_indices) {
+            child_internal_ids.push_back(
+                rstates_of_entries[i]->entries[child_idx]->mstates[model_id]->internal_id);
+          }
+          models_[model_id]->ForkSequences(rsentry->mstates[model_id]->internal_id,
+                                           child_internal_ids);
+          for (int j = 0; j < static_cast<int>(activated_child_indices.size()); ++j) {
+            // Enable sliding window for the child sequence if the child is not a parent.
+            if (rstates_of_entries[i]->entries[activated_child_indices[j]]->child_indices.empty()) {
+              models_[model_id]->EnableSlidingWindowForSeq(child_internal_ids[j]);
+            }
           }
         }
       }
@@ -214,32 +352,162 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
         rsentry_activated.push_back(true);
       }
     }
-    NDArray renormalized_probs = sampler_->BatchRenormalizeProbsByTopP(
-        probs_on_device, sample_indices, request_ids, generation_cfg);
-    std::vector<SampleResult> sample_results = sampler_->BatchSampleTokensWithProbAfterTopP(
-        renormalized_probs, sample_indices, request_ids, generation_cfg, rngs);
+    // Each decode entry samples a token for itself.
+    for (int i = 0; i < num_decode_rsentries; ++i) {
+      const RequestStateEntry& rsentry = decode_rsentries[i];
+      sample_indices.push_back(num_rsentries + i);
+      rsentries_for_sample.push_back(rsentry);
+      request_ids.push_back(rsentry->request->id);
+      generation_cfg.push_back(rsentry->request->generation_cfg);
+      rngs.push_back(&rsentry->rng);
+      rsentry_activated.push_back(true);
+    }
+    // The beams of beam search are expanded instead of sampled.
+    auto [beams, beam_prob_rows] =
+        TakeBeamsFromSampleInputs(&sample_indices, &rsentries_for_sample, &request_ids,
+                                  &generation_cfg, &rngs, &rsentry_activated);
+    std::vector<SampleResult> sample_results;
+    if (!sample_indices.empty()) {
+      NDArray renormalized_probs = sampler_->BatchRenormalizeProbsByTopP(
+          probs_on_device, sample_indices, request_ids, generation_cfg);
+      sample_results = sampler_->BatchSampleTokensWithProbAfterTopP(
+          renormalized_probs, sample_indices, request_ids, generation_cfg, rngs);
+    }
     ICHECK_EQ(sample_results.size(), rsentries_for_sample.size());
 
     // - Update the committed tokens of states.
     // - If a request is first-time prefilled, set the prefill finish time.
     UpdateRequestStateEntriesWithSampleResults(rsentries_for_sample, rsentry_activated,
                                                sample_results);
+    if (!beams.empty()) {
+      BeamSearchStep(estate, models_, sampler_, probs_on_device, beams, beam_prob_rows,
+                     engine_config_->max_single_sequence_length);
+    }
 
     auto tend = std::chrono::high_resolution_clock::now();
     estate->stats.engine_total_prefill_time += static_cast<double>((tend - tstart).count()) / 1e9;
 
     std::vector<Request> processed_requests =
         RemoveProcessedRequests(prefill_inputs, estate, rstates_of_entries);
+    if (num_decode_rsentries > 0) {
+      // The decoded requests are also processed in this step.
+      std::unordered_set<const RequestNode*> dedup_map;
+      for (const Request& request : processed_requests) {
+        dedup_map.insert(request.get());
+      }
+      for (const RequestStateEntry& rsentry : decode_rsentries) {
+        if (dedup_map.insert(rsentry->request.get()).second) {
+          processed_requests.push_back(rsentry->request);
+        }
+      }
+    }
     return processed_requests;
   }
 
  private:
+  /*!
+   * \brief Get the prompt tokens of a request in the same way as prefix cache takes them.
+   * \return The tokens, or empty if the request has untokenized text.
+   */
+  static std::vector<int64_t> GetPromptTokens(const Request& request) {
+    std::vector<int64_t> tokens;
+    for (const Data& data : request->inputs) {
+      if (const auto* token_data = data.as<TokenDataNode>()) {
+        tokens.insert(tokens.end(), token_data->token_ids.begin(), token_data->token_ids.end());
+      } else if (const auto* image_data = data.as<ImageDataNode>()) {
+        std::vector<int64_t> image_tokens = image_data->GetPrefixCacheTokens();
+        tokens.insert(tokens.end(), image_tokens.begin(), image_tokens.end());
+      } else {
+        return {};
+      }
+    }
+    return tokens;
+  }
+
+  /*!
+   * \brief Cut the prefill chunks of the prompts at the multiples of the RNN state checkpoint
+   * interval, so that the states at the multiples are available to checkpoint after the step.
+   * \param estate The engine state.
+   * \param[in, out] prefill_inputs The prefill inputs whose max prefill lengths are cut.
+   * \return The length of the sequence of each input in the RNN state before the step, or -1
+   * for the inputs that are not checkpointed.
+   */
+  std::vector<int64_t> AlignChunksToStateCheckpoints(EngineState estate,
+                                                     std::vector<PrefillInput>* prefill_inputs) {
+    std::vector<int64_t> state_lengths(prefill_inputs->size(), -1);
+    for (int i = 0; i < static_cast<int>(prefill_inputs->size()); ++i) {
+      PrefillInput& input = (*prefill_inputs)[i];
+      int64_t seq_id = input.rsentry->mstates[0]->internal_id;
+      if (input.rsentry->parent_idx != -1 || !estate->prefix_cache->HasSequence(seq_id)) {
+        continue;
+      }
+      // The prefix cache is extended with the prefilled tokens at the end of each step, so that
+      // it holds the sequence in the RNN state before this step.
+      int64_t state_length = estate->prefix_cache->GetSequenceLength(seq_id);
+      int64_t prompt_length = 0;
+      for (const Data& data : input.rsentry->request->inputs) {
+        prompt_length += data->GetLength();
+      }
+      int64_t next_checkpoint =
+          (state_length / rnn_state_checkpoint_interval_ + 1) * rnn_state_checkpoint_interval_;
+      if (next_checkpoint > prompt_length) {
+        continue;
+      }
+      input.max_prefill_length =
+          std::min(input.max_prefill_length, static_cast<int>(next_checkpoint - state_length));
+      state_lengths[i] = state_length;
+    }
+    return state_lengths;
+  }
+
+  /*!
+   * \brief Checkpoint the RNN states of the prompts whose prefilled lengths reach a multiple
+   * of the checkpoint interval, by forking them at the end into sequences recycled to prefix
+   * cache. The new requests sharing the prompt prefix fork from the checkpoints.
+   * \param estate The engine state.
+   * \param prefill_inputs The prefill inputs of the step.
+   * \param prefill_lengths The prefilled length of each input in the step.
+   * \param state_lengths The length of the sequence of each input before the step.
+   */
+  void TakeStateCheckpoints(EngineState estate, const std::vector<PrefillInput>& prefill_inputs,
+                            const std::vector<int>& prefill_lengths,
+                            const std::vector<int64_t>& state_lengths) {
+    for (int i = 0; i < static_cast<int>(prefill_inputs.size()); ++i) {
+      if (state_lengths[i] == -1) {
+        continue;
+      }
+      int64_t checkpoint_length = state_lengths[i] + prefill_lengths[i];
+      if (checkpoint_length % rnn_state_checkpoint_interval_ != 0) {
+        continue;
+      }
+      std::vector<int64_t> tokens = GetPromptTokens(prefill_inputs[i].rsentry->request);
+      if (static_cast<int64_t>(tokens.size()) < checkpoint_length) {
+        continue;
+      }
+      tokens.resize(checkpoint_length);
+      int64_t seq_id = prefill_inputs[i].rsentry->mstates[0]->internal_id;
+      int64_t checkpoint_seq_id = estate->id_manager.GetNewId();
+      for (const Model& model : models_) {
+        model->ForkSequence(seq_id, checkpoint_seq_id, /*fork_pos=*/-1);
+      }
+      estate->prefix_cache->AddRecyclingSequence(checkpoint_seq_id, IntTuple(tokens));
+    }
+  }
+
   /*! \brief The logit processor. */
   LogitProcessor logit_processor_;
   /*! \brief The sampler to sample new tokens. */
   Sampler sampler_;
   /*! \brief Workspace of each model. */
   std::vector<ModelWorkspace> model_workspaces_;
+  /*! \brief Whether the running requests are decoded in the same forward pass as prefill. */
+  bool hybrid_prefill_enabled_ = false;
+  /*! \brief Whether the draft models prefill on their side streams. */
+  bool concurrent_draft_prefill_ = false;
+  /*! \brief Whether the models keep RNN state, which can only be forked at the end. */
+  bool rnn_state_ = false;
+  /*! \brief The interval of RNN state checkpoints, or 0 if the states are not checkpointed. */
+  int64_t rnn_state_checkpoint_interval_ = 0;
 
   /*!
    * \brief Match the request state entry with prefix cache, to skip prefilling common prefix
@@ -252,33 +520,56 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
     RequestStateEntry rsentry = input->rsentry;
     if (rsentry->parent_idx == -1 && rsentry->status == RequestStateStatus::kPending &&
         !estate->prefix_cache->HasSequence(rsentry->mstates[0]->internal_id)) {
+      int64_t seq_id = rsentry->mstates[0]->internal_id;
+      bool swapped_out =
+          estate->kv_swap_pool.defined() && estate->kv_swap_pool->HasSequence(seq_id);
       IntTuple tokens = GetConcatPrefillInputData(rsentry->mstates[0]);
-      if (!tokens.size()) {
+      // The KV data computed with a LoRA adapter cannot be shared with the requests applying
+      // other adapters, so that the requests with adapters bypass prefix cache. Their sequences
+      // are added to the models with the adapter in prefill.
+      bool apply_lora = !rsentry->request->generation_cfg->lora_adapter.empty();
+      if (!tokens.size() || apply_lora) {
         // If the RequestStateEntry is of empty input data, or not fully tokenized, do nothing
         // and return.
+        if (swapped_out) {
+          estate->kv_swap_pool->Discard(seq_id);
+        }
         return;
       }
       PrefixCacheMatchedResult result = estate->prefix_cache->InsertSequence(
           rsentry->mstates[0]->internal_id, tokens, models_[0]->GetSlidingWindowSize(),
           models_[0]->GetAttentionSinkSize());
+      AlignPrefixCacheMatchToInputs(estate, rsentry, &result);
 
-      if (result.prefilled_offset == 0) {
+      int64_t swapped_in_length = 0;
+      if (result.forked_seq_id == -1 && result.reused_seq_id == -1) {
         // Add new sequence
-        CHECK_EQ(result.forked_seq_id, -1);
-        CHECK_EQ(result.reused_seq_id, -1);
+        CHECK_EQ(result.prefilled_offset, 0);
         CHECK_EQ(result.reused_seq_pop_last_tokens, 0);
-        for (Model model : models_) {
-          model->AddNewSequence(rsentry->mstates[0]->internal_id);
-          model->EnableSlidingWindowForSeq(rsentry->mstates[0]->internal_id);
+        if (swapped_out) {
+          // Restore the KV data swapped out at preemption, so that the restored
+          // tokens do not need to be prefilled again.
+          swapped_in_length = estate->kv_swap_pool->SwapIn(seq_id, models_);
+          RECORD_EVENT(trace_recorder_, rsentry->request->id, "swap in");
+        } else {
+          for (Model model : models_) {
+            model->AddNewSequence(rsentry->mstates[0]->internal_id);
+            model->EnableSlidingWindowForSeq(rsentry->mstates[0]->internal_id);
+          }
         }
       } else {
+        if (swapped_out) {
+          // The prefix cache already provides the KV data of a matched prefix.
+          estate->kv_swap_pool->Discard(seq_id);
+        }
         if (result.forked_seq_id != -1) {
           CHECK_EQ(result.reused_seq_id, -1);
           CHECK_EQ(result.reused_seq_pop_last_tokens, 0);
-          // Fork from active sequence
+          // Fork from active sequence. The RNN state is matched at the end of the forked
+          // sequence, where it is forked.
+          int64_t fork_pos = rnn_state_ ? -1 : static_cast<int64_t>(result.prefilled_offset);
           for (Model model : models_) {
-            model->ForkSequence(result.forked_seq_id, rsentry->mstates[0]->internal_id,
-                                result.prefilled_offset);
+            model->ForkSequence(result.forked_seq_id, rsentry->mstates[0]->internal_id, fork_pos);
             model->EnableSlidingWindowForSeq(rsentry->mstates[0]->internal_id);
           }
         } else {
@@ -302,6 +593,12 @@ class NewRequestPrefillActionObj : public BatchPrefillBaseActionObj {
           PopPrefillInputData(rsentry->mstates[i], result.prefilled_offset);
         }
       }
+      // Pop swapped-in tokens
+      if (swapped_in_length) {
+        for (int i = 0; i < rsentry->mstates.size(); ++i) {
+          PopPrefillInputData(rsentry->mstates[i], swapped_in_length);
+        }
+      }
       // Update max prefill length
       input->max_prefill_length =
           std::min(input->max_prefill_length, rsentry->mstates[0]->GetInputLength());
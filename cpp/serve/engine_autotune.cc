@@ -0,0 +1,151 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/engine_autotune.cc
+ */
+#include "engine_autotune.h"
+
+#include <tvm/runtime/device_api.h>
+#include <tvm/runtime/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include "../support/hash.h"
+#include "../support/json_parser.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*! \brief Get the path of the autotune result file of the key. */
+inline std::string GetEngineAutotuneResultPath(const std::string& cache_dir,
+                                               const std::string& key) {
+  return cache_dir + "/engine-autotune-" + key + ".json";
+}
+
+std::string ComputeEngineAutotuneKey(const std::vector<std::string>& model_paths,
+                                     const std::vector<picojson::object>& model_configs,
+                                     DLDevice device, const EngineConfig& engine_config) {
+  ICHECK_EQ(model_paths.size(), model_configs.size());
+  uint64_t hash = kFNV1aHashOffsetBasis;
+  for (int i = 0; i < static_cast<int>(model_paths.size()); ++i) {
+    UpdateFNV1aHashWithModel(&hash, model_paths[i], model_configs[i]);
+  }
+  // The device name tells apart the GPU models behind the same device type.
+  std::string device_name;
+  if (DeviceAPI* device_api = DeviceAPI::Get(device, /*allow_missing=*/true)) {
+    TVMRetValue rv;
+    device_api->GetAttr(device, kDeviceName, &rv);
+    if (rv.type_code() == kTVMStr) {
+      device_name = rv.operator std::string();
+    }
+  }
+  UpdateFNV1aHash(&hash, std::to_string(device.device_type) + ":" + device_name);
+  UpdateFNV1aHash(&hash, KVCacheDTypeToString(engine_config->kv_cache_dtype));
+  UpdateFNV1aHash(&hash, SpeculativeModeToString(engine_config->speculative_mode));
+  for (int64_t value : {static_cast<int64_t>(engine_config->kv_cache_page_size),
+                        static_cast<int64_t>(engine_config->max_num_sequence),
+                        engine_config->max_total_sequence_length,
+                        engine_config->prefill_chunk_size}) {
+    UpdateFNV1aHash(&hash, std::to_string(value));
+  }
+  return FNV1aHashToString(hash);
+}
+
+std::optional<EngineAutotuneResult> LoadEngineAutotuneResult(const std::string& cache_dir,
+                                                             const std::string& key,
+                                                             int max_num_sequence,
+                                                             int64_t prefill_chunk_size) {
+  std::string path = GetEngineAutotuneResultPath(cache_dir, key);
+  std::ifstream fin(path, std::ios::binary);
+  if (!fin.good()) {
+    return std::nullopt;
+  }
+  std::string data((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+  picojson::value result_json;
+  std::string err = picojson::parse(result_json, data);
+  if (err.empty() && result_json.is<picojson::object>()) {
+    const picojson::object& result_obj = result_json.get<picojson::object>();
+    EngineAutotuneResult result;
+    result.max_num_sequence = json::LookupOrDefault<int64_t>(result_obj, "max_num_sequence", 0);
+    result.prefill_chunk_size =
+        json::LookupOrDefault<int64_t>(result_obj, "prefill_chunk_size", 0);
+    if (result.max_num_sequence > 0 && result.max_num_sequence <= max_num_sequence &&
+        result.prefill_chunk_size > 0 && result.prefill_chunk_size <= prefill_chunk_size) {
+      return result;
+    }
+  }
+  LOG(WARNING) << "The autotune result file \"" << path
+               << "\" is invalid or outdated. It will be overwritten.";
+  return std::nullopt;
+}
+
+void SaveEngineAutotuneResult(const std::string& cache_dir, const std::string& key,
+                              const EngineAutotuneResult& result) {
+  std::string path = GetEngineAutotuneResultPath(cache_dir, key);
+  picojson::object result_obj;
+  result_obj["max_num_sequence"] = picojson::value(static_cast<int64_t>(result.max_num_sequence));
+  result_obj["prefill_chunk_size"] = picojson::value(result.prefill_chunk_size);
+  std::string data = picojson::value(result_obj).serialize(/*prettify=*/true);
+  // Write to a temporary file unique to this process and rename it, so that readers in other
+  // processes never see a partial file.
+  std::ostringstream tmp_path;
+  tmp_path << path << ".tmp" << std::hex
+           << std::chrono::steady_clock::now().time_since_epoch().count();
+  std::error_code error;
+  std::filesystem::create_directories(cache_dir, error);
+  {
+    std::ofstream fout(tmp_path.str(), std::ios::binary);
+    fout.write(data.data(), data.size());
+    if (!fout.good()) {
+      LOG(WARNING) << "Failed to write the autotune result file \"" << tmp_path.str() << "\".";
+      fout.close();
+      std::filesystem::remove(tmp_path.str(), error);
+      return;
+    }
+  }
+  std::filesystem::rename(tmp_path.str(), path, error);
+  if (error) {
+    LOG(WARNING) << "Failed to write the autotune result file \"" << path << "\".";
+    std::filesystem::remove(tmp_path.str(), error);
+  }
+}
+
+std::vector<int64_t> GetEngineAutotuneCandidates(int64_t upper_bound, int64_t lower_bound) {
+  std::vector<int64_t> candidates{upper_bound};
+  for (int64_t value = upper_bound / 2; value >= std::max<int64_t>(lower_bound, 1); value /= 2) {
+    candidates.push_back(value);
+  }
+  std::reverse(candidates.begin(), candidates.end());
+  return candidates;
+}
+
+int64_t SelectEngineAutotuneCandidate(const std::vector<std::pair<int64_t, double>>& throughputs,
+                                      double ratio) {
+  ICHECK(!throughputs.empty());
+  double best_throughput = 0.0;
+  for (const auto& [candidate, throughput] : throughputs) {
+    best_throughput = std::max(best_throughput, throughput);
+  }
+  if (best_throughput <= 0.0) {
+    // Nothing was measured. Keep the largest candidate, which is the upper bound.
+    return std::max_element(throughputs.begin(), throughputs.end())->first;
+  }
+  int64_t selected = -1;
+  for (const auto& [candidate, throughput] : throughputs) {
+    if (throughput >= best_throughput * ratio && (selected == -1 || candidate < selected)) {
+      selected = candidate;
+    }
+  }
+  return selected;
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,90 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/engine_autotune.h
+ * \brief The startup autotuning of engine capacities, which picks the batch size and the
+ * prefill chunk size from measured throughputs, and persists the choice across restarts.
+ */
+#ifndef MLC_LLM_SERVE_ENGINE_AUTOTUNE_H_
+#define MLC_LLM_SERVE_ENGINE_AUTOTUNE_H_
+
+#include <dlpack/dlpack.h>
+#include <picojson.h>
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "config.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*! \brief The engine capacities chosen by startup autotuning. */
+struct EngineAutotuneResult {
+  /*! \brief The max batch size. */
+  int max_num_sequence;
+  /*! \brief The prefill chunk size. */
+  int64_t prefill_chunk_size;
+};
+
+/*!
+ * \brief Compute the key of autotune results. A result can only be loaded by an engine with the
+ * same key, which covers the model config and weight shard records of each model, the device,
+ * and the engine config fields bounding the capacities.
+ * \param model_paths The paths of the models.
+ * \param model_configs The model configs of the models.
+ * \param device The device that the models run on.
+ * \param engine_config The engine config before autotuning.
+ * \return The autotune key.
+ */
+std::string ComputeEngineAutotuneKey(const std::vector<std::string>& model_paths,
+                                     const std::vector<picojson::object>& model_configs,
+                                     DLDevice device, const EngineConfig& engine_config);
+
+/*!
+ * \brief Load the autotune result of the key from the cache directory. Loading is skipped with
+ * a warning when the result file is invalid or exceeds the capacity upper bounds.
+ * \param cache_dir The autotune cache directory.
+ * \param key The autotune key.
+ * \param max_num_sequence The upper bound of the max batch size.
+ * \param prefill_chunk_size The upper bound of the prefill chunk size.
+ * \return The loaded result, or std::nullopt if there is none.
+ */
+std::optional<EngineAutotuneResult> LoadEngineAutotuneResult(const std::string& cache_dir,
+                                                             const std::string& key,
+                                                             int max_num_sequence,
+                                                             int64_t prefill_chunk_size);
+
+/*!
+ * \brief Save the autotune result of the key to the cache directory. The file is written to a
+ * temporary path first and then renamed, so that other engines never see a partial file.
+ * \param cache_dir The autotune cache directory.
+ * \param key The autotune key.
+ * \param result The autotune result.
+ */
+void SaveEngineAutotuneResult(const std::string& cache_dir, const std::string& key,
+                              const EngineAutotuneResult& result);
+
+/*!
+ * \brief Get the candidates of an engine capacity, which halve from the upper bound down to
+ * the lower bound, in ascending order. The upper bound is always a candidate.
+ */
+std::vector<int64_t> GetEngineAutotuneCandidates(int64_t upper_bound, int64_t lower_bound);
+
+/*!
+ * \brief Select the smallest candidate whose measured throughput reaches the given ratio of
+ * the best throughput, which is the knee where larger capacities stop paying off.
+ * \param throughputs The pairs of candidate and its measured throughput.
+ * \param ratio The ratio of the best throughput to reach.
+ * \return The selected candidate.
+ */
+int64_t SelectEngineAutotuneCandidate(const std::vector<std::pair<int64_t, double>>& throughputs,
+                                      double ratio);
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_ENGINE_AUTOTUNE_H_
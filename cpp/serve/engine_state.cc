@@ -6,10 +6,41 @@
 
 #include <picojson.h>
 
+#include <algorithm>
+#include <cmath>
+
 namespace mlc {
 namespace llm {
 namespace serve {
 
+void LatencyWindow::Add(double latency) {
+  // The number of latest samples kept.
+  constexpr int kWindowSize = 1024;
+  if (static_cast<int>(samples.size()) < kWindowSize) {
+    samples.push_back(latency);
+  } else {
+    samples[next_index] = latency;
+  }
+  next_index = (next_index + 1) % kWindowSize;
+}
+
+double LatencyWindow::GetPercentile(double percentile) const {
+  if (samples.empty()) {
+    return 0.0;
+  }
+  std::vector<double> sorted_samples = samples;
+  int index = std::min(static_cast<int>(std::ceil(percentile * sorted_samples.size())) - 1,
+                       static_cast<int>(sorted_samples.size()) - 1);
+  index = std::max(index, 0);
+  std::nth_element(sorted_samples.begin(), sorted_samples.begin() + index, sorted_samples.end());
+  return sorted_samples[index];
+}
+
+void LatencyWindow::Reset() {
+  samples.clear();
+  next_index = 0;
+}
+
 String EngineStats::AsJSON() const {
   picojson::object config;
   config["single_token_prefill_latency"] = picojson::value(
@@ -22,6 +53,7 @@ String EngineStats::AsJSON() const {
   config["total_decode_tokens"] = picojson::value(total_decode_length);
   config["total_accepted_tokens"] = picojson::value(total_accepted_length);
   config["total_draft_tokens"] = picojson::value(total_draft_length);
+  config["total_jump_forward_tokens"] = picojson::value(total_jump_forward_length);
   auto f_vector_to_array = [](const std::vector<int64_t>& vec) {
     picojson::array arr;
     for (int64_t v : vec) {
@@ -31,6 +63,41 @@ String EngineStats::AsJSON() const {
   };
   config["accept_count"] = f_vector_to_array(accept_count);
   config["draft_count"] = f_vector_to_array(draft_count);
+  config["prefix_cache_hits"] = picojson::value(prefix_cache_stats.num_hits);
+  config["prefix_cache_misses"] = picojson::value(prefix_cache_stats.num_misses);
+  config["prefix_cache_hit_tokens"] = picojson::value(prefix_cache_stats.num_hit_tokens);
+  config["prefix_cache_evicted_tokens"] = picojson::value(prefix_cache_stats.num_evicted_tokens);
+  const DraftTokenWorkspaceStats& workspace_stats = draft_token_workspace_stats;
+  config["draft_workspace_capacity_slots"] = picojson::value(workspace_stats.capacity_slots);
+  config["draft_workspace_used_slots"] = picojson::value(workspace_stats.used_slots);
+  config["draft_workspace_peak_used_slots"] = picojson::value(workspace_stats.peak_used_slots);
+  config["draft_workspace_fragmentation"] = picojson::value(workspace_stats.fragmentation);
+  config["draft_workspace_grows"] = picojson::value(workspace_stats.num_grows);
+  config["draft_workspace_compactions"] = picojson::value(workspace_stats.num_compactions);
+  config["device_memory"] = device_memory_stats.AsJSON();
+  config["total_preemptions"] = picojson::value(total_preemptions);
+  config["response_cache_hits"] = picojson::value(response_cache_hits);
+  config["response_cache_misses"] = picojson::value(response_cache_misses);
+  config["num_rejected_requests"] = picojson::value(num_rejected_requests);
+  auto f_percentiles = [](const LatencyWindow& window) {
+    picojson::object percentiles;
+    percentiles["p50"] = picojson::value(window.GetPercentile(0.5));
+    percentiles["p90"] = picojson::value(window.GetPercentile(0.9));
+    percentiles["p99"] = picojson::value(window.GetPercentile(0.99));
+    return picojson::value(percentiles);
+  };
+  config["ttft"] = f_percentiles(ttft_window);
+  config["tpot"] = f_percentiles(tpot_window);
+  config["queue_time"] = f_percentiles(queue_time_window);
+  if (num_device_timed_steps > 0) {
+    picojson::object device_time;
+    for (int i = 0; i < kNumStepPhases; ++i) {
+      device_time[StepPhaseToString(static_cast<StepPhase>(i))] =
+          picojson::value(device_phase_time[i]);
+    }
+    config["device_phase_time"] = picojson::value(device_time);
+    config["num_device_timed_steps"] = picojson::value(num_device_timed_steps);
+  }
   return picojson::value(config).serialize(true);
 }
 
@@ -43,23 +110,285 @@ void EngineStats::Reset() {
   total_decode_length = 0;
   total_accepted_length = 0;
   total_draft_length = 0;
+  total_jump_forward_length = 0;
   accept_count.clear();
   draft_count.clear();
+  prefix_cache_stats = PrefixCacheStats();
+  draft_token_workspace_stats = DraftTokenWorkspaceStats();
+  device_memory_stats = DeviceMemoryStats();
+  total_preemptions = 0;
+  response_cache_hits = 0;
+  response_cache_misses = 0;
+  num_rejected_requests = 0;
+  ttft_window.Reset();
+  tpot_window.Reset();
+  queue_time_window.Reset();
+  device_phase_time.fill(0.0);
+  num_device_timed_steps = 0;
+}
+
+void EngineStats::UpdateRequestMetrics(const RequestMetrics& metrics) {
+  if (double ttft = metrics.GetTimeToFirstToken(); ttft >= 0) {
+    ttft_window.Add(ttft);
+  }
+  if (double tpot = metrics.GetTimePerOutputToken(); tpot >= 0) {
+    tpot_window.Add(tpot);
+  }
+  if (double queue_time = metrics.GetQueueTime(); queue_time >= 0) {
+    queue_time_window.Add(queue_time);
+  }
 }
 
 TVM_REGISTER_OBJECT_TYPE(EngineStateObj);
 
 EngineState::EngineState() { data_ = make_object<EngineStateObj>(); }
 
+void CancelledRequestSet::Add(const std::string& request_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  request_ids_.insert(request_id);
+  size_.store(request_ids_.size(), std::memory_order_release);
+}
+
+void CancelledRequestSet::Remove(const std::string& request_id) {
+  if (Empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  request_ids_.erase(request_id);
+  size_.store(request_ids_.size(), std::memory_order_release);
+}
+
+bool CancelledRequestSet::Contains(const std::string& request_id) const {
+  if (Empty()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  return request_ids_.count(request_id) > 0;
+}
+
+std::vector<std::string> CancelledRequestSet::GetAll() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return std::vector<std::string>(request_ids_.begin(), request_ids_.end());
+}
+
+void PrefillChunkSizeController::Init(int max_prefill_chunk_size, double target_itl_ms,
+                                      bool hybrid_prefill) {
+  this->max_prefill_chunk_size = max_prefill_chunk_size;
+  this->target_itl = target_itl_ms / 1e3;
+  this->hybrid_prefill = hybrid_prefill;
+  Reset();
+}
+
+void PrefillChunkSizeController::Update(double prefill_time, int64_t prefill_length,
+                                        double decode_time) {
+  if (target_itl <= 0) {
+    return;
+  }
+  // The weight of the latest step in the moving averages.
+  constexpr double kAlpha = 0.2;
+  // The lower bound of the adapted chunk size, so that prefill always makes progress.
+  constexpr int kMinPrefillChunkSize = 64;
+  auto f_update = [](double* average, double value) {
+    *average = *average > 0 ? (1 - kAlpha) * *average + kAlpha * value : value;
+  };
+  if (prefill_length > 0 && prefill_time > 0) {
+    f_update(&prefill_time_per_token, prefill_time / prefill_length);
+  }
+  if (decode_time > 0) {
+    f_update(&decode_step_time, decode_time);
+  }
+  if (prefill_time_per_token <= 0) {
+    // Keep the static chunk size until prefill has been measured.
+    return;
+  }
+  double prefill_budget = hybrid_prefill ? target_itl : target_itl - decode_step_time;
+  double chunk_size = prefill_budget / prefill_time_per_token;
+  int min_chunk_size = std::min(kMinPrefillChunkSize, max_prefill_chunk_size);
+  prefill_chunk_size = chunk_size >= max_prefill_chunk_size
+                           ? max_prefill_chunk_size
+                           : std::max(static_cast<int>(chunk_size), min_chunk_size);
+}
+
+void PrefillChunkSizeController::Reset() {
+  prefill_chunk_size = max_prefill_chunk_size;
+  prefill_time_per_token = 0.0;
+  decode_step_time = 0.0;
+}
+
+void StepTokenPlanner::Init(int token_budget) {
+  this->token_budget = token_budget;
+  step_budget = 0;
+  num_decode_tokens = 0;
+  max_draft_tokens_per_seq = std::numeric_limits<int>::max();
+  prefill_chunk_size = 0;
+}
+
+void StepTokenPlanner::Plan(int num_running_rsentries, int latency_bound) {
+  if (token_budget <= 0) {
+    prefill_chunk_size = latency_bound;
+    return;
+  }
+  step_budget = std::min(token_budget, latency_bound);
+  // Every running request entry decodes one token, even beyond the budget, since the
+  // entries cannot be left out of decode.
+  num_decode_tokens = num_running_rsentries;
+  max_draft_tokens_per_seq =
+      num_running_rsentries > 0
+          ? std::max(step_budget - num_decode_tokens, 0) / num_running_rsentries
+          : 0;
+  prefill_chunk_size = step_budget;
+}
+
+int StepTokenPlanner::GetDraftLength(int draft_length, int tree_width) const {
+  if (token_budget <= 0) {
+    return draft_length;
+  }
+  return std::min(draft_length, max_draft_tokens_per_seq / std::max(tree_width, 1));
+}
+
+void DevicePowerController::SetState(DevicePowerState state) {
+  this->state = state;
+  if (state == DevicePowerState::kNominal) {
+    capacity_fraction = 1.0;
+    idle_fraction = 0.0;
+  } else if (state == DevicePowerState::kFair) {
+    capacity_fraction = 0.75;
+    idle_fraction = 0.0;
+  } else if (state == DevicePowerState::kSerious) {
+    capacity_fraction = 0.5;
+    idle_fraction = 0.25;
+  } else {
+    // Run at half duty cycle when the device is throttled.
+    capacity_fraction = 0.25;
+    idle_fraction = 1.0;
+  }
+}
+
+int64_t DevicePowerController::ScaleCapacity(int64_t capacity) const {
+  return std::max<int64_t>(static_cast<int64_t>(capacity * capacity_fraction), 1);
+}
+
+void OutputLengthForecaster::Init(double preemption_target) {
+  quantile = 1 - preemption_target;
+  Reset();
+}
+
+void OutputLengthForecaster::Record(int64_t output_length) {
+  // The number of recent output lengths kept.
+  constexpr int kMaxNumOutputLengths = 1024;
+  if (quantile <= 0) {
+    return;
+  }
+  if (static_cast<int>(output_lengths.size()) < kMaxNumOutputLengths) {
+    output_lengths.push_back(output_length);
+  } else {
+    output_lengths[next_index] = output_length;
+  }
+  next_index = (next_index + 1) % kMaxNumOutputLengths;
+  sorted_outdated = true;
+}
+
+int64_t OutputLengthForecaster::ForecastRemainingLength(int64_t num_decoded_tokens,
+                                                        int64_t max_tokens) {
+  // The number of finished requests before the forecast takes effect.
+  constexpr int kMinNumOutputLengths = 16;
+  if (quantile <= 0 || static_cast<int>(output_lengths.size()) < kMinNumOutputLengths) {
+    return 0;
+  }
+  if (sorted_outdated) {
+    sorted_output_lengths = output_lengths;
+    std::sort(sorted_output_lengths.begin(), sorted_output_lengths.end());
+    sorted_outdated = false;
+  }
+  // Condition on the tokens decoded so far: only the longer outputs are still possible.
+  auto begin = std::upper_bound(sorted_output_lengths.begin(), sorted_output_lengths.end(),
+                                num_decoded_tokens);
+  int64_t num_longer = sorted_output_lengths.end() - begin;
+  // A request that has outlived all the recorded ones is forecast to finish soon.
+  int64_t output_length = num_decoded_tokens;
+  if (num_longer > 0) {
+    int64_t index = std::min(static_cast<int64_t>(std::ceil(quantile * num_longer)) - 1,
+                             num_longer - 1);
+    output_length = *(begin + std::max(index, static_cast<int64_t>(0)));
+  }
+  if (max_tokens >= 0) {
+    output_length = std::min(output_length, max_tokens);
+  }
+  return std::max(output_length - num_decoded_tokens, static_cast<int64_t>(0));
+}
+
+void OutputLengthForecaster::Reset() {
+  output_lengths.clear();
+  next_index = 0;
+  sorted_output_lengths.clear();
+  sorted_outdated = false;
+}
+
+void QueueDrainEstimator::Record(double step_time, int64_t prefill_length) {
+  // The weight of the latest window in the smoothed estimate.
+  constexpr double kSmoothingFactor = 0.3;
+  window_time += step_time;
+  window_length += prefill_length;
+  if (window_length < kWindowLength) {
+    return;
+  }
+  double window_seconds_per_token = window_time / window_length;
+  seconds_per_token = seconds_per_token < 0 ? window_seconds_per_token
+                                            : (1 - kSmoothingFactor) * seconds_per_token +
+                                                  kSmoothingFactor * window_seconds_per_token;
+  window_time = 0.0;
+  window_length = 0;
+}
+
+double QueueDrainEstimator::GetSecondsPerToken() const {
+  if (seconds_per_token < 0) {
+    return -1.0;
+  }
+  // The rest of the current window is assumed to go at the smoothed rate.
+  return (window_time + seconds_per_token * (kWindowLength - window_length)) / kWindowLength;
+}
+
+void QueueDrainEstimator::Reset() {
+  seconds_per_token = -1.0;
+  window_time = 0.0;
+  window_length = 0;
+}
+
 void EngineStateObj::Reset() {
   running_queue.clear();
   waiting_queue.clear();
+  prefill_only_queue.clear();
+  prefill_only_outputs.clear();
   request_states.clear();
   id_manager.Reset();
   stats.Reset();
+  prefill_chunk_controller.Reset();
+  step_planner.Init(step_planner.token_budget);
+  output_length_forecaster.Reset();
+  queue_drain_estimator.Reset();
+  deferred_postproc = nullptr;
+  overlapped_decode_seq_ids.clear();
   if (prefix_cache.defined()) {
     prefix_cache->Reset();
   }
+  if (prefix_cache_host_tier.defined()) {
+    prefix_cache_host_tier->Reset();
+  }
+  if (kv_swap_pool.defined()) {
+    kv_swap_pool->Reset();
+  }
+  if (lora_adapter_pool.defined()) {
+    lora_adapter_pool->Reset();
+  }
+}
+
+void EngineStateObj::FlushDeferredPostProcess() {
+  if (deferred_postproc) {
+    // Clear the field first so that the post-processing never runs twice.
+    std::function<void()> postproc = std::move(deferred_postproc);
+    deferred_postproc = nullptr;
+    postproc();
+  }
 }
 
 RequestState EngineStateObj::GetRequestState(Request request) {
@@ -7,10 +7,27 @@
 
 #include <tvm/runtime/container/string.h>
 
+#include <array>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
 #include "config.h"
+#include "device_timer.h"
+#include "draft_token_workspace_manager.h"
+#include "kv_swap_pool.h"
+#include "lora_adapter_pool.h"
+#include "memory_accounting.h"
 #include "prefix_cache.h"
 #include "request.h"
 #include "request_state.h"
+#include "response_cache.h"
+#include "scheduler_policy.h"
+#include "traffic_capture.h"
 
 namespace mlc {
 namespace llm {
@@ -18,6 +35,21 @@ namespace serve {
 
 using namespace tvm::runtime;
 
+/*! \brief The rolling window of the latest latency samples of requests. */
+struct LatencyWindow {
+  /*! \brief The latest samples (sec), as a ring buffer. */
+  std::vector<double> samples;
+  /*! \brief The index in `samples` to add the next sample. */
+  int next_index = 0;
+
+  /*! \brief Add a latency sample. */
+  void Add(double latency);
+  /*! \brief Return the percentile of the samples, or 0 when there is no sample. */
+  double GetPercentile(double percentile) const;
+  /*! \brief Clear the samples. */
+  void Reset();
+};
+
 /*! \brief Runtime statistics of engine. */
 struct EngineStats {
   /*! \brief The sum of "prefill time of each request". */
@@ -36,10 +68,35 @@ struct EngineStats {
   int64_t total_accepted_length = 0;
   /*! \brief The total number of speculated draft tokens. */
   int64_t total_draft_length = 0;
+  /*! \brief The total number of tokens committed without sampling by jump-forward decoding. */
+  int64_t total_jump_forward_length = 0;
   /*! \brief The number of accepted tokens in speculative decoding. */
   std::vector<int64_t> accept_count;
   /*! \brief The number of draft tokens in speculative decoding. */
   std::vector<int64_t> draft_count;
+  /*! \brief The total number of request preemptions. */
+  int64_t total_preemptions = 0;
+  /*! \brief The number of cacheable requests answered from and missing the response cache. */
+  int64_t response_cache_hits = 0;
+  int64_t response_cache_misses = 0;
+  /*! \brief The number of requests rejected at admission by load shedding. */
+  int64_t num_rejected_requests = 0;
+  /*! \brief The time to first token of the recently finished requests. */
+  LatencyWindow ttft_window;
+  /*! \brief The time per output token of the recently finished requests. */
+  LatencyWindow tpot_window;
+  /*! \brief The queue time of the recently finished requests. */
+  LatencyWindow queue_time_window;
+  /*! \brief The statistics of prefix cache, synced from the prefix cache when queried. */
+  PrefixCacheStats prefix_cache_stats;
+  /*! \brief The statistics of the draft token workspace, synced when queried. */
+  DraftTokenWorkspaceStats draft_token_workspace_stats;
+  /*! \brief The device memory statistics of each owner, synced when queried. */
+  DeviceMemoryStats device_memory_stats;
+  /*! \brief The total device time (sec) of each step phase, under device phase timing. */
+  std::array<double, kNumStepPhases> device_phase_time{};
+  /*! \brief The number of engine steps timed on the device. */
+  int64_t num_device_timed_steps = 0;
 
   /*!
    * \brief Return the engine runtime statistics in JSON string.
@@ -50,6 +107,19 @@ struct EngineStats {
    * - engine time for decode (sec)
    * - total number of processed tokens in prefill.
    * - total number of processed tokens in decode.
+   * - total number of tokens committed by jump-forward decoding.
+   * - prefix cache hits, misses, hit tokens and evicted tokens.
+   * - draft token workspace capacity, used and peak used slots, fragmentation, number of
+   *   grows and compactions.
+   * - current and peak device memory of each owner and in total, against the device memory
+   *   and the budget, and the fragmentation of KV cache pages.
+   * - total number of request preemptions.
+   * - response cache hits and misses.
+   * - number of requests rejected by load shedding.
+   * - p50/p90/p99 of time to first token, time per output token and queue time (sec) of the
+   *   recently finished requests.
+   * - total device time (sec) of each step phase and the number of timed steps, under device
+   *   phase timing.
    * \return The statistics in JSON string.
    */
   String AsJSON() const;
@@ -63,6 +133,173 @@ struct EngineStats {
    * \param accept_length The number of accepted tokens in the speculative decoding.
    */
   void UpdateSpecDecodingStats(int draft_length, int accept_length);
+
+  /*! \brief Add the timing metrics of a finished request into the latency windows. */
+  void UpdateRequestMetrics(const RequestMetrics& metrics);
+};
+
+/*!
+ * \brief The controller that adapts the prefill chunk size to the measured step latency.
+ * It keeps the moving averages of the prefill time per token and the decode step time,
+ * and picks the largest prefill chunk with which the inter-token latency of running
+ * requests stays within the target.
+ * - Under the chunked prefill mode, running requests wait for one decode step and one
+ * prefill step between two tokens.
+ * - Under the hybrid prefill mode, decode is packed into the prefill step, whose tokens
+ * (decode tokens included) are bounded by the prefill chunk size.
+ */
+struct PrefillChunkSizeController {
+  /*! \brief The static prefill chunk size in engine config, which is the upper bound. */
+  int max_prefill_chunk_size = 0;
+  /*! \brief The target inter-token latency in seconds. Non-positive means disabled. */
+  double target_itl = 0.0;
+  /*! \brief Whether decode is packed into prefill steps. */
+  bool hybrid_prefill = false;
+  /*! \brief The prefill chunk size to use in the next step. */
+  int prefill_chunk_size = 0;
+  /*! \brief The moving average of the prefill time (sec) per token. */
+  double prefill_time_per_token = 0.0;
+  /*! \brief The moving average of the decode step time (sec). */
+  double decode_step_time = 0.0;
+
+  /*! \brief Initialize the controller. Set non-positive target to keep the chunk size static. */
+  void Init(int max_prefill_chunk_size, double target_itl_ms, bool hybrid_prefill);
+
+  /*!
+   * \brief Update the moving averages with the timings of an engine step, and
+   * recompute the prefill chunk size.
+   * \param prefill_time The prefill time (sec) of the step.
+   * \param prefill_length The number of prefilled tokens in the step.
+   * \param decode_time The decode time (sec) of the step.
+   */
+  void Update(double prefill_time, int64_t prefill_length, double decode_time);
+
+  /*! \brief Reset the measured timings and the prefill chunk size. */
+  void Reset();
+};
+
+/*!
+ * \brief The planner of the tokens that an engine step processes. Each step gets one token
+ * budget, which is further bounded by the latency target through the prefill chunk size
+ * controller. The budget goes to the decode tokens of the running requests first, one for
+ * each, and the rest is split evenly into the draft tokens they verify under speculative
+ * decoding. The prefill chunk takes the budget left by the decode tokens packed into the
+ * same step. Without the token budget, each action is bounded by its own limits.
+ */
+struct StepTokenPlanner {
+  /*! \brief The token budget of each step. Non-positive means disabled. */
+  int token_budget = 0;
+  /*! \brief The token budget of this step. */
+  int step_budget = 0;
+  /*! \brief The number of decode tokens of this step, one for each running request entry. */
+  int num_decode_tokens = 0;
+  /*! \brief The maximum number of draft tokens that each running request entry verifies. */
+  int max_draft_tokens_per_seq = std::numeric_limits<int>::max();
+  /*! \brief The prefill chunk size of this step, which includes the packed decode tokens. */
+  int prefill_chunk_size = 0;
+
+  /*! \brief Initialize the planner. Set non-positive budget to disable the planner. */
+  void Init(int token_budget);
+
+  /*!
+   * \brief Plan the tokens of the next step.
+   * \param num_running_rsentries The number of running request state entries to decode.
+   * \param latency_bound The prefill chunk size that holds the latency target.
+   */
+  void Plan(int num_running_rsentries, int latency_bound);
+
+  /*!
+   * \brief Bound the draft length of a request entry by its allocated draft tokens.
+   * \param draft_length The draft length that the speculative action picks.
+   * \param tree_width The width of the draft token tree of the request entry.
+   */
+  int GetDraftLength(int draft_length, int tree_width) const;
+};
+
+/*!
+ * \brief The controller that scales the engine down by the thermal and battery state of the
+ * device, so that the sustained power draw stays below the throttling point. It caps the
+ * requests admitted into running and the prefill chunk size, and paces the steps by idling
+ * for a fraction of each step time.
+ */
+struct DevicePowerController {
+  /*! \brief The device power state. */
+  DevicePowerState state = DevicePowerState::kNominal;
+  /*! \brief The fraction of the max batch size and the prefill chunk size in use. */
+  double capacity_fraction = 1.0;
+  /*! \brief The idle time after each step, as a fraction of the step time. */
+  double idle_fraction = 0.0;
+
+  /*! \brief Set the device power state, and the capacity and idle fractions of the state. */
+  void SetState(DevicePowerState state);
+
+  /*! \brief Scale the capacity by the capacity fraction, keeping it at least 1. */
+  int64_t ScaleCapacity(int64_t capacity) const;
+};
+
+/*!
+ * \brief The forecaster of the number of tokens requests will decode, by which the admission
+ * of new requests reserves KV cache pages. It keeps the output lengths of the recently
+ * finished requests, and forecasts the output length of a request that has decoded some
+ * tokens as the quantile of the recorded lengths longer than that, capped by its
+ * `max_tokens`. With the quantile at one minus the target preemption probability, a request
+ * outgrows its forecast with roughly the target probability.
+ */
+struct OutputLengthForecaster {
+  /*! \brief The quantile of the forecast. Non-positive means the forecast is disabled. */
+  double quantile = 0.0;
+  /*! \brief The output lengths of the recently finished requests, as a ring buffer. */
+  std::vector<int64_t> output_lengths;
+  /*! \brief The index in `output_lengths` to record the next output length. */
+  int next_index = 0;
+  /*! \brief The sorted copy of `output_lengths`, refreshed lazily on forecast. */
+  std::vector<int64_t> sorted_output_lengths;
+  /*! \brief Whether `sorted_output_lengths` is outdated. */
+  bool sorted_outdated = false;
+
+  /*! \brief Initialize the forecaster. Set the target probability 1 to disable the forecast. */
+  void Init(double preemption_target);
+
+  /*! \brief Record the output length of a finished request. */
+  void Record(int64_t output_length);
+
+  /*!
+   * \brief Forecast the number of tokens a request will decode from now on.
+   * It returns 0 when the forecast is disabled or too few requests have finished.
+   * \param num_decoded_tokens The number of tokens the request has decoded.
+   * \param max_tokens The maximum number of tokens of the request. Negative means no limit.
+   */
+  int64_t ForecastRemainingLength(int64_t num_decoded_tokens, int64_t max_tokens);
+
+  /*! \brief Clear the recorded output lengths. */
+  void Reset();
+};
+
+/*!
+ * \brief The estimator of how fast the engine drains its waiting queue, by which load shedding
+ * predicts the queue time of new requests. It measures the engine time per prefilled token over
+ * the steps taken while requests are waiting, which counts the decode steps interleaved with
+ * the prefill. The measurements are smoothed over windows of prefilled tokens, and the current
+ * window is blended in as far as it goes, so that a queue that stops draining raises the
+ * estimate before the window completes.
+ */
+struct QueueDrainEstimator {
+  /*! \brief The number of prefilled tokens in a measurement window. */
+  static constexpr int64_t kWindowLength = 2048;
+  /*! \brief The smoothed engine time (sec) per prefilled token. Negative means not measured. */
+  double seconds_per_token = -1.0;
+  /*! \brief The engine time (sec) and the number of prefilled tokens of the current window. */
+  double window_time = 0.0;
+  int64_t window_length = 0;
+
+  /*! \brief Record the engine time and the prefilled tokens of a step taken while waiting. */
+  void Record(double step_time, int64_t prefill_length);
+
+  /*! \brief Estimate the engine time (sec) per prefilled token, or -1 before any window. */
+  double GetSecondsPerToken() const;
+
+  /*! \brief Clear the measurements. */
+  void Reset();
 };
 
 /*! \brief The manager of internal id for requests in engine. */
@@ -91,6 +328,31 @@ struct EngineInternalIDManager {
   }
 };
 
+/*!
+ * \brief The ids of the requests cancelled by other threads, e.g. on client disconnects. The
+ * engine actions leave the cancelled requests out when they gather their inputs, and the engine
+ * aborts them within the step, without waiting for the abort instructions to be processed before
+ * the next step.
+ */
+class CancelledRequestSet {
+ public:
+  /*! \brief Mark a request as cancelled. Thread-safe. */
+  void Add(const std::string& request_id);
+  /*! \brief Unmark a request once it is aborted. Thread-safe. */
+  void Remove(const std::string& request_id);
+  /*! \brief Check if there is no cancelled request. Lock-free. */
+  bool Empty() const { return size_.load(std::memory_order_acquire) == 0; }
+  /*! \brief Check if a request is cancelled. Lock-free when there is no cancelled request. */
+  bool Contains(const std::string& request_id) const;
+  /*! \brief Get the ids of the cancelled requests. Thread-safe. */
+  std::vector<std::string> GetAll() const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::unordered_set<std::string> request_ids_;
+  std::atomic<int> size_{0};
+};
+
 /*!
  * \brief The state of the running engine.
  * It contains the requests and their states submitted to the Engine.
@@ -101,17 +363,81 @@ class EngineStateObj : public Object {
   std::vector<Request> running_queue;
   /*! \brief The requests that have not started for process yet. */
   std::vector<Request> waiting_queue;
+  /*!
+   * \brief The prefill-only requests that have not been prefilled yet. They have no request
+   * state, since they are prefilled in one step and leave the engine right after.
+   */
+  std::vector<Request> prefill_only_queue;
+  /*! \brief The final outputs of the prefill-only requests to stream back in the step. */
+  Array<RequestStreamOutput> prefill_only_outputs;
   /*! \brief The states of all requests. */
   std::unordered_map<String, RequestState> request_states;
   /*! \brief The internal id manager. */
   EngineInternalIDManager id_manager;
   /*! \brief Runtime statistics. */
   EngineStats stats;
+  /*! \brief The controller of the prefill chunk size used by prefill actions. */
+  PrefillChunkSizeController prefill_chunk_controller;
+  /*! \brief The planner of the tokens of each step among prefill, decode and speculation. */
+  StepTokenPlanner step_planner;
+  /*! \brief The controller of the engine capacity by the device power state. */
+  DevicePowerController power_controller;
+  /*! \brief The forecaster of request output lengths used by the admission into prefill. */
+  OutputLengthForecaster output_length_forecaster;
+  /*! \brief The estimator of the waiting queue drain rate used by load shedding. */
+  QueueDrainEstimator queue_drain_estimator;
   /*! \brief The prefix cache. */
   PrefixCache prefix_cache{nullptr};
+  /*!
+   * \brief The host memory tier of prefix cache, holding the KV data of offloaded sequences.
+   * It is only defined when the host tier of prefix cache is enabled.
+   */
+  KVSwapPool prefix_cache_host_tier{nullptr};
+  /*! \brief The scheduler policy deciding the prefill and preemption order. */
+  SchedulerPolicy scheduler_policy{nullptr};
+  /*!
+   * \brief The host memory pool holding the KV cache of preempted requests.
+   * It is only defined when the engine runs with the "swap" preemption mode.
+   */
+  KVSwapPool kv_swap_pool{nullptr};
+  /*!
+   * \brief The LoRA adapters resident on device. It is only defined when the engine runs
+   * with positive `max_num_lora_adapters`.
+   */
+  LoRAAdapterPool lora_adapter_pool{nullptr};
+  /*!
+   * \brief The exact-match cache of the responses of deterministic requests. It is only
+   * defined when the engine runs with positive `response_cache_memory_mb`.
+   */
+  ResponseCache response_cache{nullptr};
+  /*!
+   * \brief The capture of the served traffic, or nullptr if the engine runs without
+   * `traffic_capture_path`. It is shared with the threaded engine.
+   */
+  std::shared_ptr<TrafficCapture> traffic_capture;
+  /*!
+   * \brief The post-processing of the last decode step that is deferred under overlapped
+   * scheduling. It is run by the next decode step after the device work is launched, or
+   * flushed by the engine before the requests are scheduled otherwise.
+   */
+  std::function<void()> deferred_postproc;
+  /*!
+   * \brief The sequences of the decode launched before the deferred post-processing runs. Their
+   * KV cache already holds the last committed token, which prefix cache does not record. The
+   * entries that finish in the post-processing roll the token back before their sequences are
+   * recycled.
+   */
+  std::unordered_set<int64_t> overlapped_decode_seq_ids;
+  /*!
+   * \brief The requests cancelled by other threads and not yet aborted. It is shared with the
+   * threaded engine, which marks the requests when their aborts are submitted.
+   */
+  std::shared_ptr<CancelledRequestSet> cancelled_requests = std::make_shared<CancelledRequestSet>();
 
   /*! \brief Reset the engine state and clear the statistics. */
   void Reset();
+  /*! \brief Run and clear the deferred post-processing, if there is any. */
+  void FlushDeferredPostProcess();
   /*! \brief Get the request state of the given request. */
   RequestState GetRequestState(Request request);
 
@@ -9,7 +9,9 @@
 #include <tvm/runtime/registry.h>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 #include <utility>
@@ -30,124 +32,299 @@ struct PairHash {
   }
 };
 
+/*! \brief The phase of a recorded event, following Chrome Trace Event Format. */
+enum class TraceEventPhase : char {
+  kBegin = 'B',
+  kEnd = 'E',
+  kInstant = 'i',
+  kComplete = 'X',
+};
+
+/*! \brief A recorded event. The request id is undefined for engine spans. */
+struct TraceEventRecord {
+  int64_t timestamp_ns = 0;
+  int64_t duration_ns = 0;
+  int name_id = 0;
+  TraceEventPhase phase = TraceEventPhase::kInstant;
+  String request_id{nullptr};
+};
+
+/*!
+ * \brief The ring buffer of the events recorded by one thread.
+ * The mutex is only taken by the owner thread and by dumps, and is thus uncontended on the
+ * recording path.
+ */
+struct ThreadEventBuffer {
+  std::mutex mutex;
+  /*! \brief The ring buffer, which grows up to the capacity. */
+  std::vector<TraceEventRecord> records;
+  /*! \brief The number of events ever recorded. */
+  int64_t num_recorded = 0;
+  /*! \brief The index of the thread in the recorder, which names the engine span track. */
+  int thread_index = 0;
+  /*! \brief The interned event name ids looked up by the thread, owned by the thread. */
+  std::unordered_map<std::string, int> name_ids;
+};
+
 }  // namespace detail
 
 TVM_REGISTER_OBJECT_TYPE(EventTraceRecorderObj);
 
+int64_t EventTraceRecorderObj::NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 /*! \brief The implementation of event trace recorder. */
 class EventTraceRecorderImpl : public EventTraceRecorderObj {
  public:
-  void AddEvent(const String& request_id, const std::string& event) final {
-    double event_time = std::chrono::duration_cast<std::chrono::duration<double>>(
-                            std::chrono::system_clock::now().time_since_epoch())
-                            .count();
+  explicit EventTraceRecorderImpl(double sampling_ratio, int64_t buffer_capacity)
+      : sampling_ratio_(sampling_ratio),
+        buffer_capacity_(buffer_capacity),
+        recorder_id_(next_recorder_id_.fetch_add(1)) {
+    CHECK(sampling_ratio >= 0 && sampling_ratio <= 1)
+        << "The sampling ratio of the event trace recorder should be in range [0, 1].";
+    CHECK_GT(buffer_capacity, 0) << "The buffer capacity of the event trace recorder should be "
+                                    "positive.";
+  }
 
-    {
-      std::lock_guard<std::mutex> lock(mutex_);
-      AddEventInternal(request_id, event, event_time);
+  void AddEvent(const String& request_id, const std::string& event) final {
+    if (!IsSampled(request_id)) {
+      return;
     }
+    int64_t event_time = NowNanos();
+    detail::ThreadEventBuffer* buffer = GetThreadBuffer();
+    auto [phase, name_id] = ParseEvent(buffer, event);
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    Append(buffer, {event_time, 0, name_id, phase, request_id});
   }
 
   void AddEvent(const Array<String>& request_ids, const std::string& event) final {
-    double event_time = std::chrono::duration_cast<std::chrono::duration<double>>(
-                            std::chrono::system_clock::now().time_since_epoch())
-                            .count();  // in seconds
-
-    {
-      std::lock_guard<std::mutex> lock(mutex_);
-      for (const String& request_id : request_ids) {
-        AddEventInternal(request_id, event, event_time);
+    int64_t event_time = NowNanos();
+    detail::ThreadEventBuffer* buffer = GetThreadBuffer();
+    auto [phase, name_id] = ParseEvent(buffer, event);
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    for (const String& request_id : request_ids) {
+      if (IsSampled(request_id)) {
+        Append(buffer, {event_time, 0, name_id, phase, request_id});
       }
     }
   }
 
+  void AddSpan(const std::string& name, int64_t start_ns, int64_t end_ns) final {
+    detail::ThreadEventBuffer* buffer = GetThreadBuffer();
+    int name_id = InternName(buffer, name);
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    Append(buffer, {start_ns, end_ns - start_ns, name_id, detail::TraceEventPhase::kComplete,
+                    String(nullptr)});
+  }
+
   std::string DumpJSON() final {
-    std::unordered_map<std::string, std::vector<std::pair<std::string, double>>> local_events;
+    // - Collect the events of all threads, in the order of time.
+    std::vector<std::pair<int, detail::TraceEventRecord>> records;
     {
-      std::lock_guard<std::mutex> lock(mutex_);
-      local_events = events_;
+      std::lock_guard<std::mutex> lock(registry_mutex_);
+      for (const std::shared_ptr<detail::ThreadEventBuffer>& buffer : buffers_) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+        for (const detail::TraceEventRecord& record : buffer->records) {
+          records.push_back({buffer->thread_index, record});
+        }
+      }
+    }
+    std::stable_sort(records.begin(), records.end(), [](const auto& lhs, const auto& rhs) {
+      return lhs.second.timestamp_ns < rhs.second.timestamp_ns;
+    });
+    std::vector<std::string> names;
+    {
+      std::lock_guard<std::mutex> lock(names_mutex_);
+      names = names_;
     }
 
-    auto fcmp_events = [](const std::pair<int64_t, picojson::value>& lhs,
-                          const std::pair<int64_t, picojson::value>& rhs) {
-      return lhs.first < rhs.first;
-    };
+    // - Group the request events by request, with the requests in the order of their first
+    // events. The "starts" and "finishes" are paired by their occurrence count.
+    std::vector<std::string> request_id_in_order;
+    std::unordered_map<std::string, picojson::array> request_events;
+    std::unordered_map<std::pair<std::string, int>, int, detail::PairHash> event_counter;
+    picojson::array span_array;
+    for (const auto& [thread_index, record] : records) {
+      picojson::object event_json;
+      event_json["ts"] = picojson::value(static_cast<double>(record.timestamp_ns) / 1e3);
+      event_json["pid"] = picojson::value(static_cast<int64_t>(1));
+      if (!record.request_id.defined()) {
+        event_json["name"] = picojson::value(names[record.name_id]);
+        event_json["ph"] = picojson::value(std::string(1, static_cast<char>(record.phase)));
+        event_json["dur"] = picojson::value(static_cast<double>(record.duration_ns) / 1e3);
+        event_json["tid"] = picojson::value("engine thread " + std::to_string(thread_index));
+        span_array.push_back(picojson::value(std::move(event_json)));
+        continue;
+      }
+      std::string request_id = record.request_id;
+      auto [it, inserted] = request_events.emplace(request_id, picojson::array());
+      if (inserted) {
+        request_id_in_order.push_back(request_id);
+      }
+      // The starts, the finishes and the instants of an event are counted separately.
+      int phase_index = record.phase == detail::TraceEventPhase::kBegin ? 0
+                        : record.phase == detail::TraceEventPhase::kEnd ? 1
+                                                                        : 2;
+      int event_cnt = event_counter[{request_id, record.name_id * 3 + phase_index}]++;
+      event_json["name"] =
+          picojson::value(names[record.name_id] + " (" + std::to_string(event_cnt) + ")");
+      event_json["ph"] = picojson::value(std::string(1, static_cast<char>(record.phase)));
+      event_json["tid"] = picojson::value(request_id);
+      it->second.push_back(picojson::value(std::move(event_json)));
+    }
 
     picojson::array event_array;
-    for (const std::string& request_id : request_id_in_order_) {
-      std::vector<std::pair<std::string, double>> event_pairs = local_events.at(request_id);
-      std::vector<std::pair<int64_t, picojson::value>> events_to_sort;
-      events_to_sort.reserve(event_pairs.size());
-      for (int i = 0; i < static_cast<int>(event_pairs.size()); ++i) {
-        std::string event = event_pairs[i].first;
-        double event_time = event_pairs[i].second;
-        std::string name;
-        std::string phase;
-        if (event.compare(0, 6, "start ") == 0) {
-          // Duration begin.
-          name = event.substr(6);
-          phase = "B";
-        } else if (event.compare(0, 7, "finish ") == 0) {
-          // Duration end.
-          name = event.substr(7);
-          phase = "E";
-        } else {
-          // Instant event.
-          name = event;
-          phase = "i";
-        }
-        int64_t event_time_in_us = static_cast<int64_t>(event_time * 1e6);
+    for (const std::string& request_id : request_id_in_order) {
+      picojson::array& events = request_events.at(request_id);
+      event_array.insert(event_array.end(), std::make_move_iterator(events.begin()),
+                         std::make_move_iterator(events.end()));
+    }
+    event_array.insert(event_array.end(), std::make_move_iterator(span_array.begin()),
+                       std::make_move_iterator(span_array.end()));
+    return picojson::value(event_array).serialize();
+  }
+
+  TVM_DECLARE_BASE_OBJECT_INFO(EventTraceRecorderImpl, EventTraceRecorderObj);
 
-        picojson::object event_json;
-        event_json["name"] = picojson::value(name);
-        event_json["ph"] = picojson::value(phase);
-        event_json["ts"] = picojson::value(event_time_in_us);
-        event_json["pid"] = picojson::value(static_cast<int64_t>(1));
-        event_json["tid"] = picojson::value(request_id);
+ private:
+  /*! \brief Check if the events of the given request are recorded under sampling. */
+  bool IsSampled(const String& request_id) const {
+    constexpr uint64_t kNumBuckets = 1 << 16;
+    if (sampling_ratio_ >= 1) {
+      return true;
+    }
+    uint64_t bucket = std::hash<std::string>{}(request_id) % kNumBuckets;
+    return bucket < static_cast<uint64_t>(sampling_ratio_ * kNumBuckets);
+  }
 
-        events_to_sort.push_back({event_time_in_us, picojson::value(event_json)});
+  /*! \brief Get the event buffer of the current thread, creating it on the first event. */
+  detail::ThreadEventBuffer* GetThreadBuffer() {
+    // The buffers of the current thread in all the recorders, keyed by the recorder id.
+    // The recorder owns the buffers, and the expired ones are dropped on insertion.
+    thread_local std::unordered_map<int64_t, std::weak_ptr<detail::ThreadEventBuffer>>
+        thread_buffers;
+    thread_local int64_t last_recorder_id = -1;
+    thread_local detail::ThreadEventBuffer* last_buffer = nullptr;
+    if (last_recorder_id == recorder_id_) {
+      return last_buffer;
+    }
+    std::shared_ptr<detail::ThreadEventBuffer> buffer = thread_buffers[recorder_id_].lock();
+    if (buffer == nullptr) {
+      for (auto it = thread_buffers.begin(); it != thread_buffers.end();) {
+        it = it->second.expired() ? thread_buffers.erase(it) : std::next(it);
       }
-      std::sort(events_to_sort.begin(), events_to_sort.end(), fcmp_events);
-      for (auto [timestamp, event] : events_to_sort) {
-        event_array.push_back(std::move(event));
+      buffer = std::make_shared<detail::ThreadEventBuffer>();
+      {
+        std::lock_guard<std::mutex> lock(registry_mutex_);
+        buffer->thread_index = buffers_.size();
+        buffers_.push_back(buffer);
       }
+      thread_buffers[recorder_id_] = buffer;
     }
-    return picojson::value(event_array).serialize();
+    last_recorder_id = recorder_id_;
+    last_buffer = buffer.get();
+    return last_buffer;
   }
 
-  TVM_DECLARE_BASE_OBJECT_INFO(EventTraceRecorderImpl, EventTraceRecorderObj);
+  /*! \brief Return the interned id of the given event name. */
+  int InternName(detail::ThreadEventBuffer* buffer, const std::string& name) {
+    auto it = buffer->name_ids.find(name);
+    if (it != buffer->name_ids.end()) {
+      return it->second;
+    }
+    int name_id;
+    {
+      std::lock_guard<std::mutex> lock(names_mutex_);
+      auto [name_it, inserted] = name_ids_.emplace(name, names_.size());
+      if (inserted) {
+        names_.push_back(name);
+      }
+      name_id = name_it->second;
+    }
+    buffer->name_ids.emplace(name, name_id);
+    return name_id;
+  }
 
- private:
-  /*! \brief The internal impl of AddEvent, taking the event time as input. */
-  void AddEventInternal(const std::string& request_id, const std::string& event,
-                        double event_time) {
-    if (std::find(request_id_in_order_.begin(), request_id_in_order_.end(), request_id) ==
-        request_id_in_order_.end()) {
-      request_id_in_order_.push_back(request_id);
+  /*!
+   * \brief Parse the phase of the given request event, and intern the event name.
+   * See EventTraceRecorderObj::AddEvent for the patterns of request events.
+   */
+  std::pair<detail::TraceEventPhase, int> ParseEvent(detail::ThreadEventBuffer* buffer,
+                                                     const std::string& event) {
+    if (event.compare(0, 6, "start ") == 0) {
+      // Duration begin.
+      return {detail::TraceEventPhase::kBegin, InternName(buffer, event.substr(6))};
+    } else if (event.compare(0, 7, "finish ") == 0) {
+      // Duration end.
+      return {detail::TraceEventPhase::kEnd, InternName(buffer, event.substr(7))};
+    } else {
+      // Instant event.
+      return {detail::TraceEventPhase::kInstant, InternName(buffer, event)};
     }
-    int event_cnt = event_counter_[{request_id, event}]++;
-    events_[request_id].push_back({event + " (" + std::to_string(event_cnt) + ")", event_time});
   }
 
-  /*! \brief The mutex ensuring only one thread can access critical regions. */
-  std::mutex mutex_;
+  /*! \brief Append the event into the buffer, overwriting the oldest one when full. */
+  void Append(detail::ThreadEventBuffer* buffer, detail::TraceEventRecord record) {
+    if (static_cast<int64_t>(buffer->records.size()) < buffer_capacity_) {
+      buffer->records.push_back(std::move(record));
+    } else {
+      buffer->records[buffer->num_recorded % buffer_capacity_] = std::move(record);
+    }
+    ++buffer->num_recorded;
+  }
 
-  /************** Critical Regions **************/
-  /*! \brief The request ids in time order. Each id only appears once. */
-  std::vector<std::string> request_id_in_order_;
-  /*! \brief The number of a certain event for a request. */
-  std::unordered_map<std::pair<std::string, std::string>, int, detail::PairHash> event_counter_;
-  /*! \brief The event list of each request together with the timestamps. */
-  std::unordered_map<std::string, std::vector<std::pair<std::string, double>>> events_;
+  /*! \brief The ratio of requests whose events are recorded. */
+  const double sampling_ratio_;
+  /*! \brief The number of the latest events each thread keeps. */
+  const int64_t buffer_capacity_;
+  /*! \brief The unique id of the recorder, which keys the thread-local buffers. */
+  const int64_t recorder_id_;
+  /*! \brief The counter of recorder ids. */
+  static std::atomic<int64_t> next_recorder_id_;
+
+  /*! \brief The mutex guarding the registry of thread buffers. */
+  std::mutex registry_mutex_;
+  /*! \brief The event buffers of all the threads that have recorded events. */
+  std::vector<std::shared_ptr<detail::ThreadEventBuffer>> buffers_;
+  /*! \brief The mutex guarding the event name table. */
+  std::mutex names_mutex_;
+  /*! \brief The interned event names, indexed by name id. */
+  std::vector<std::string> names_;
+  /*! \brief The id of each interned event name. */
+  std::unordered_map<std::string, int> name_ids_;
 };
 
-EventTraceRecorder EventTraceRecorder::Create() {
-  return EventTraceRecorder(make_object<EventTraceRecorderImpl>());
+std::atomic<int64_t> EventTraceRecorderImpl::next_recorder_id_{0};
+
+EventTraceRecorder EventTraceRecorder::Create(double sampling_ratio, int64_t buffer_capacity) {
+  return EventTraceRecorder(make_object<EventTraceRecorderImpl>(sampling_ratio, buffer_capacity));
+}
+
+/*! \brief The trace recorder bound to the current thread. */
+thread_local EventTraceRecorderObj* current_thread_trace_recorder = nullptr;
+
+TraceRecorderThreadScope::TraceRecorderThreadScope(
+    const Optional<EventTraceRecorder>& trace_recorder)
+    : prev_recorder_(current_thread_trace_recorder) {
+  current_thread_trace_recorder =
+      trace_recorder.defined() ? trace_recorder.value().get() : nullptr;
+}
+
+TraceRecorderThreadScope::~TraceRecorderThreadScope() {
+  current_thread_trace_recorder = prev_recorder_;
+}
+
+EventTraceRecorderObj* TraceRecorderThreadScope::Current() {
+  return current_thread_trace_recorder;
 }
 
-TVM_REGISTER_GLOBAL("mlc.serve.EventTraceRecorder").set_body_typed([]() {
-  return EventTraceRecorder::Create();
-});
+TVM_REGISTER_GLOBAL("mlc.serve.EventTraceRecorder")
+    .set_body_typed([](double sampling_ratio, int64_t buffer_capacity) {
+      return EventTraceRecorder::Create(sampling_ratio, buffer_capacity);
+    });
 
 TVM_REGISTER_GLOBAL("mlc.serve.EventTraceRecorderAddEvent")
     .set_body_typed([](const EventTraceRecorder& trace_recorder, const String& request_id,
@@ -7,9 +7,12 @@
 #define MLC_LLM_SERVE_EVENT_TRACE_RECORDER_H_
 
 #include <tvm/runtime/container/array.h>
+#include <tvm/runtime/container/optional.h>
 #include <tvm/runtime/container/string.h>
+#include <tvm/runtime/nvtx.h>
 #include <tvm/runtime/object.h>
 
+#include <cstdint>
 #include <string>
 
 namespace mlc {
@@ -18,7 +21,12 @@ namespace serve {
 
 using namespace tvm::runtime;
 
-/*! \brief The event trace recorder for requests. */
+/*!
+ * \brief The event trace recorder for requests and engine steps.
+ * Each thread records into its own bounded ring buffer, so that recording never contends
+ * with the other threads, and only the latest events are kept under always-on tracing.
+ * The event names are interned, and the timestamps come from the steady clock.
+ */
 class EventTraceRecorderObj : public Object {
  public:
   /*!
@@ -36,9 +44,24 @@ class EventTraceRecorderObj : public Object {
   /*! \brief Record a event for the list of input requests. */
   virtual void AddEvent(const Array<String>& request_ids, const std::string& event) = 0;
 
-  /*! \brief Dump the logged events in Chrome Trace Event Format in JSON string. */
+  /*!
+   * \brief Record a span of the engine on the current thread, such as an engine action step
+   * or a model function launch. The spans are not sampled.
+   * \param name The span name.
+   * \param start_ns The start time of the span, from NowNanos.
+   * \param end_ns The end time of the span, from NowNanos.
+   */
+  virtual void AddSpan(const std::string& name, int64_t start_ns, int64_t end_ns) = 0;
+
+  /*!
+   * \brief Dump the logged events in Chrome Trace Event Format in JSON string, which is
+   * loadable by both chrome://tracing and Perfetto.
+   */
   virtual std::string DumpJSON() = 0;
 
+  /*! \brief Return the steady clock time in nanoseconds that events are timestamped with. */
+  static int64_t NowNanos();
+
   static constexpr const char* _type_key = "mlc.serve.EventTraceRecorder";
   static constexpr const bool _type_has_method_sequal_reduce = false;
   static constexpr const bool _type_has_method_shash_reduce = false;
@@ -51,13 +74,69 @@ class EventTraceRecorderObj : public Object {
  */
 class EventTraceRecorder : public ObjectRef {
  public:
-  /*! \brief Create an event trace recorder. */
-  static EventTraceRecorder Create();
+  /*!
+   * \brief Create an event trace recorder.
+   * \param sampling_ratio The ratio of requests whose events are recorded. The requests are
+   * sampled by the hash of their ids, so that all the events of a sampled request are kept.
+   * \param buffer_capacity The number of the latest events each thread keeps.
+   */
+  static EventTraceRecorder Create(double sampling_ratio = 1.0,
+                                   int64_t buffer_capacity = 1 << 16);
 
   TVM_DEFINE_MUTABLE_NOTNULLABLE_OBJECT_REF_METHODS(EventTraceRecorder, ObjectRef,
                                                     EventTraceRecorderObj);
 };
 
+/*!
+ * \brief The scope in which the given trace recorder is bound to the current thread, so that
+ * the TraceScopedRanges on the thread are recorded into it. Scopes can nest.
+ */
+class TraceRecorderThreadScope {
+ public:
+  explicit TraceRecorderThreadScope(const Optional<EventTraceRecorder>& trace_recorder);
+  ~TraceRecorderThreadScope();
+
+  TraceRecorderThreadScope(const TraceRecorderThreadScope&) = delete;
+  TraceRecorderThreadScope& operator=(const TraceRecorderThreadScope&) = delete;
+
+  /*! \brief Return the trace recorder bound to the current thread, or nullptr. */
+  static EventTraceRecorderObj* Current();
+
+ private:
+  EventTraceRecorderObj* prev_recorder_;
+};
+
+/*!
+ * \brief The scoped range that is both an NVTX range and a span in the trace recorder bound
+ * to the current thread. The span covers the host time of the range, which is the kernel
+ * launch time unless the range synchronizes with the device.
+ */
+class TraceScopedRange {
+ public:
+  explicit TraceScopedRange(std::string name)
+      : nvtx_scope_(name), recorder_(TraceRecorderThreadScope::Current()) {
+    if (recorder_ != nullptr) {
+      name_ = std::move(name);
+      start_ns_ = EventTraceRecorderObj::NowNanos();
+    }
+  }
+
+  ~TraceScopedRange() {
+    if (recorder_ != nullptr) {
+      recorder_->AddSpan(name_, start_ns_, EventTraceRecorderObj::NowNanos());
+    }
+  }
+
+  TraceScopedRange(const TraceScopedRange&) = delete;
+  TraceScopedRange& operator=(const TraceScopedRange&) = delete;
+
+ private:
+  NVTXScopedRange nvtx_scope_;
+  EventTraceRecorderObj* recorder_;
+  std::string name_;
+  int64_t start_ns_ = 0;
+};
+
 /****************** Helper macro ******************/
 
 /*! \brief Record a event for the input request or list or requests. */
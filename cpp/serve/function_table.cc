@@ -6,18 +6,24 @@
 
 #include "function_table.h"
 
+#include <tvm/runtime/device_api.h>
 #include <tvm/runtime/disco/session.h>
 #include <tvm/runtime/memory/memory_manager.h>
 #include <tvm/runtime/module.h>
 #include <tvm/runtime/ndarray.h>
 #include <tvm/runtime/packed_func.h>
 #include <tvm/runtime/registry.h>
+#include <tvm/runtime/relax_vm/ndarray_cache_support.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <filesystem>
+#include <mutex>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#include "../support/hash.h"
 #include "../support/load_bytes_from_file.h"
 #include "../support/utils.h"
 #include "sampler/sampler.h"
@@ -147,6 +153,34 @@ void FunctionTable::Init(String reload_lib_path, Device device, picojson::object
   }
 }
 
+// The NDArray cache is global, and models may be loaded from multiple threads.
+static std::mutex ndarray_cache_mutex;
+
+std::string FunctionTable::GetWeightShardCachePath(const std::string& model_path) const {
+  if (this->weight_shard_cache_dir.empty() || getenv("MLC_INTERNAL_PRESHARD_NUM") != nullptr) {
+    return "";
+  }
+  bool needs_sharding = false;
+  for (const ModelMetadata::Param& param : this->model_metadata_.params) {
+    needs_sharding |= !param.preprocs.empty();
+  }
+  if (!needs_sharding) {
+    return "";
+  }
+  uint64_t hash = kFNV1aHashOffsetBasis;
+  UpdateFNV1aHashWithModel(&hash, model_path, this->model_config);
+  UpdateFNV1aHash(&hash, std::to_string(this->model_metadata_.tensor_parallel_shards));
+  for (const ModelMetadata::Param& param : this->model_metadata_.params) {
+    std::ostringstream os;
+    os << param.name;
+    for (const ModelMetadata::Param::Preproc& preproc : param.preprocs) {
+      os << ' ' << preproc.func_name << preproc.out_shape << preproc.out_dtype;
+    }
+    UpdateFNV1aHash(&hash, os.str());
+  }
+  return (std::filesystem::path(this->weight_shard_cache_dir) / FNV1aHashToString(hash)).string();
+}
+
 ObjectRef FunctionTable::LoadParams(const std::string& model_path, Device device) {
   if (this->use_disco) {
     DRef params{nullptr};
@@ -162,6 +196,17 @@ ObjectRef FunctionTable::LoadParams(const std::string& model_path, Device device
       CHECK(loader_load_all != nullptr);
       DRef loader = loader_create(metadata_path, ndarray_cache_metadata, "", this->disco_mod);
       params = loader_load_all(loader);
+    } else if (std::string cache_path = GetWeightShardCachePath(model_path);
+               !cache_path.empty()) {
+      std::string model_config_str = picojson::value(this->model_config).serialize();
+      if (std::filesystem::exists(cache_path + "/ndarray-cache.json")) {
+        LOG(INFO) << "Loading the preprocessed weight shards from \"" << cache_path << "\".";
+        PackedFunc loader = this->get_global_func("mlc.loader.LoadMultiGPUPresharded");
+        params = loader(cache_path, this->disco_mod, model_config_str);
+      } else {
+        PackedFunc loader = this->get_global_func("mlc.loader.LoadMultiGPUAndSaveShards");
+        params = loader(model_path, this->disco_mod, model_config_str, cache_path);
+      }
     } else {
       auto load_func_name = getenv("MLC_INTERNAL_PRESHARD_NUM") == nullptr
                                 ? "mlc.loader.LoadMultiGPU"
@@ -171,6 +216,22 @@ ObjectRef FunctionTable::LoadParams(const std::string& model_path, Device device
     }
     return params;
   } else {
+    const PackedFunc* fload_mmap = tvm::runtime::Registry::Get("mlc.loader.LoadParamsMMap");
+    if (!this->offloaded_params.empty()) {
+      return LoadParamsWithOffloading(model_path, device, fload_mmap);
+    }
+    if (fload_mmap != nullptr && !this->model_metadata_.params.empty()) {
+      // Memory-map the parameter shards instead of reading them into staging buffers.
+      // The parameters alias the mapped shards when the device is host memory.
+      Array<String> param_names;
+      param_names.reserve(this->model_metadata_.params.size());
+      for (const auto& param : this->model_metadata_.params) {
+        param_names.push_back(param.name);
+      }
+      Array<NDArray> params = (*fload_mmap)(model_path, device, param_names);
+      return params;
+    }
+    std::lock_guard<std::mutex> lock(ndarray_cache_mutex);
     const PackedFunc* fload_cache = tvm::runtime::Registry::Get("vm.builtin.ndarray_cache.load");
     ICHECK(fload_cache) << "TVM runtime cannot find vm.builtin.ndarray_cache.load";
     (*fload_cache)(model_path, static_cast<int32_t>(device.device_type), device.device_id);
@@ -201,6 +262,89 @@ ObjectRef FunctionTable::LoadParams(const std::string& model_path, Device device
   }
 }
 
+Array<NDArray> FunctionTable::LoadParamsWithOffloading(const std::string& model_path,
+                                                       Device device,
+                                                       const PackedFunc* fload_mmap) {
+  ICHECK(!this->model_metadata_.params.empty());
+  ICHECK(device.device_type == kDLCUDA || device.device_type == kDLROCM);
+  Array<String> param_names;
+  param_names.reserve(this->model_metadata_.params.size());
+  for (const auto& param : this->model_metadata_.params) {
+    param_names.push_back(param.name);
+  }
+  // Load the parameters to host memory first, so that the offloaded ones never take up
+  // the device memory.
+  Device device_cpu{kDLCPU, 0};
+  Array<NDArray> host_params;
+  if (fload_mmap != nullptr) {
+    host_params = (*fload_mmap)(model_path, device_cpu, param_names);
+  } else {
+    std::lock_guard<std::mutex> lock(ndarray_cache_mutex);
+    const PackedFunc* fload_cache = tvm::runtime::Registry::Get("vm.builtin.ndarray_cache.load");
+    ICHECK(fload_cache) << "TVM runtime cannot find vm.builtin.ndarray_cache.load";
+    (*fload_cache)(model_path, static_cast<int32_t>(kDLCPU), 0);
+    const PackedFunc* fload_params =
+        tvm::runtime::Registry::Get("vm.builtin.param_array_from_cache_by_name");
+    ICHECK(fload_params) << "Cannot find env function: vm.builtin.param_array_from_cache_by_name";
+    host_params = (*fload_params)(param_names);
+    const PackedFunc* fclear_ndarray_cache =
+        tvm::runtime::Registry::Get("vm.builtin.ndarray_cache.clear");
+    ICHECK(fclear_ndarray_cache) << "Cannot find env function vm.builtin.ndarray_cache.clear";
+    (*fclear_ndarray_cache)();
+  }
+
+  Device device_pinned{device.device_type == kDLROCM ? kDLROCMHost : kDLCUDAHost, 0};
+  Array<NDArray> params;
+  params.reserve(host_params.size());
+  for (int i = 0; i < static_cast<int>(host_params.size()); ++i) {
+    const NDArray& host_param = host_params[i];
+    if (!this->offloaded_params.count(param_names[i])) {
+      NDArray param = NDArray::Empty(host_param.Shape(), host_param.DataType(), device);
+      param.CopyFrom(host_param);
+      params.push_back(param);
+      continue;
+    }
+    NDArray pinned_param =
+        NDArray::Empty(host_param.Shape(), host_param.DataType(), device_pinned);
+    pinned_param.CopyFrom(host_param);
+    // Under unified virtual addressing, the device kernels read the page-locked host memory
+    // with the same pointer, so that the parameter is passed to them as device memory.
+    DLManagedTensor* tensor = pinned_param.ToDLPack();
+    tensor->dl_tensor.device = device;
+    params.push_back(NDArray::FromDLPack(tensor));
+  }
+  return params;
+}
+
+ObjectRef FunctionTable::LoadLoRAAdapter(const std::string& adapter_path, Device device) {
+  CHECK(!this->use_disco) << "LoRA adapters are not supported under tensor parallelism.";
+  tvm::runtime::relax_vm::NDArrayCacheMetadata metadata =
+      tvm::runtime::relax_vm::NDArrayCacheMetadata::Load(adapter_path);
+  Array<String> param_names;
+  for (const auto& file_record : metadata.records) {
+    for (const auto& param_record : file_record.records) {
+      param_names.push_back(param_record.name);
+    }
+  }
+  if (const PackedFunc* fload_mmap = tvm::runtime::Registry::Get("mlc.loader.LoadParamsMMap")) {
+    Array<NDArray> params = (*fload_mmap)(adapter_path, device, param_names);
+    return params;
+  }
+  std::lock_guard<std::mutex> lock(ndarray_cache_mutex);
+  const PackedFunc* fload_cache = tvm::runtime::Registry::Get("vm.builtin.ndarray_cache.load");
+  ICHECK(fload_cache) << "TVM runtime cannot find vm.builtin.ndarray_cache.load";
+  (*fload_cache)(adapter_path, static_cast<int32_t>(device.device_type), device.device_id);
+  const PackedFunc* fload_params =
+      tvm::runtime::Registry::Get("vm.builtin.param_array_from_cache_by_name");
+  ICHECK(fload_params) << "Cannot find env function: vm.builtin.param_array_from_cache_by_name";
+  Array<NDArray> params = (*fload_params)(param_names);
+  const PackedFunc* fclear_ndarray_cache =
+      tvm::runtime::Registry::Get("vm.builtin.ndarray_cache.clear");
+  ICHECK(fclear_ndarray_cache) << "Cannot find env function vm.builtin.ndarray_cache.clear";
+  (*fclear_ndarray_cache)();
+  return params;
+}
+
 void FunctionTable::_InitFunctions() {
   this->embed_func_ = mod_get_func("embed");
   this->image_embed_func_ = mod_get_func("image_embed");
@@ -208,7 +352,13 @@ void FunctionTable::_InitFunctions() {
   this->single_batch_decode_func_ = mod_get_func("decode");
   this->prefill_func_ = mod_get_func("batch_prefill");
   this->decode_func_ = mod_get_func("batch_decode");
+  // The LoRA variants additionally take the adapter slot of each sequence and the
+  // parameters of all adapter slots. They are optional.
+  this->prefill_lora_func_ = mod_get_func("batch_prefill_lora");
+  this->decode_lora_func_ = mod_get_func("batch_decode_lora");
   this->verify_func_ = mod_get_func("batch_verify");
+  // The decode through the early-exit layers for self-speculation. It is optional.
+  this->decode_early_exit_func_ = mod_get_func("batch_decode_early_exit");
   this->single_batch_prefill_to_last_hidden_func_ = mod_get_func("prefill_to_last_hidden_states");
   this->single_batch_decode_to_last_hidden_func_ = mod_get_func("decode_to_last_hidden_states");
   this->prefill_to_last_hidden_func_ = mod_get_func("batch_prefill_to_last_hidden_states");
@@ -218,11 +368,17 @@ void FunctionTable::_InitFunctions() {
   Module mod = this->use_disco ? this->disco_mod->DebugGetFromRemote(0) : this->local_vm;
   this->get_logits_func_ = mod_get_func("get_logits");
   this->batch_get_logits_func_ = mod_get_func("batch_get_logits");
+  this->get_logits_for_tokens_func_ = mod_get_func("get_logits_for_tokens");
   this->batch_select_last_hidden_func_ = mod_get_func("batch_select_last_hidden_states");
   this->softmax_func_ = mod->GetFunction("softmax_with_temperature", true);
   this->apply_logit_bias_func_ = mod->GetFunction("apply_logit_bias_inplace", true);
   this->apply_penalty_func_ = mod->GetFunction("apply_penalty_inplace", true);
   this->apply_bitmask_func_ = mod->GetFunction("apply_bitmask_inplace", true);
+  this->apply_logit_bias_and_penalty_func_ =
+      mod->GetFunction("apply_logit_bias_and_penalty_inplace", true);
+  this->update_token_cnt_table_func_ = mod->GetFunction("update_token_cnt_table_inplace", true);
+  this->apply_penalty_from_table_func_ =
+      mod->GetFunction("apply_penalty_from_table_inplace", true);
   this->alloc_embedding_tensor_func_ = mod_get_func("alloc_embedding_tensor");
   this->create_kv_cache_func_ = mod_get_func("create_flashinfer_paged_kv_cache");
   if (!this->create_kv_cache_func_.defined()) {
@@ -242,17 +398,36 @@ void FunctionTable::_InitFunctions() {
   this->kv_cache_begin_forward_func_ = get_global_func("vm.builtin.kv_state_begin_forward");
   this->kv_cache_end_forward_func_ = get_global_func("vm.builtin.kv_state_end_forward");
   this->kv_cache_popn_func_ = get_global_func("vm.builtin.kv_state_popn");
+  // The token tree commit function is optional. It is only used to verify draft token trees.
+  const char* commit_token_tree_func_name =
+      "vm.builtin.attention_kv_cache_commit_accepted_token_tree_nodes";
+  if (tvm::runtime::Registry::Get(commit_token_tree_func_name)) {
+    this->kv_cache_commit_accepted_token_tree_nodes_func_ =
+        get_global_func(commit_token_tree_func_name);
+  }
   this->kv_cache_get_num_available_pages_func_ =
       *tvm::runtime::Registry::Get("vm.builtin.attention_kv_cache_get_num_available_pages");
   this->kv_cache_get_total_sequence_length_func_ =
       *tvm::runtime::Registry::Get("vm.builtin.attention_kv_cache_get_total_sequence_length");
+  if (!this->use_disco) {
+    // The KV data read/write functions are optional. They are only used for
+    // swapping the KV cache of preempted sequences to host memory.
+    if (const auto* f = tvm::runtime::Registry::Get("vm.builtin.attention_kv_cache_debug_get_kv")) {
+      this->kv_cache_debug_get_kv_func_ = *f;
+    }
+    if (const auto* f = tvm::runtime::Registry::Get("vm.builtin.attention_kv_cache_debug_set_kv")) {
+      this->kv_cache_debug_set_kv_func_ = *f;
+    }
+  }
   if (Sampler::SupportGPUSampler(local_gpu_device)) {
     gpu_multinomial_from_uniform_func_ = mod->GetFunction("multinomial_from_uniform", true);
     gpu_argsort_probs_func_ = mod->GetFunction("argsort_probs", true);
     gpu_sample_with_top_p_func_ = mod->GetFunction("sample_with_top_p", true);
     gpu_sampler_take_probs_func_ = mod->GetFunction("sampler_take_probs", true);
+    gpu_sampler_take_top_probs_func_ = mod->GetFunction("sampler_take_top_probs", true);
     gpu_verify_draft_tokens_func_ = mod->GetFunction("sampler_verify_draft_tokens", true);
     gpu_renormalize_by_top_p_func_ = mod->GetFunction("renormalize_by_top_p", true);
+    gpu_renormalize_by_top_k_min_p_func_ = mod->GetFunction("renormalize_by_top_k_min_p", true);
   }
   this->nd_view_func_ = get_global_func("vm.builtin.reshape");
   this->nd_get_shape_func_ = get_global_func("vm.builtin.shape_of");
@@ -287,9 +462,23 @@ ObjectRef FunctionTable::CopyToWorker0(const NDArray& host_array, String buffer_
     } else {
       buffer = Downcast<DRef>(this->Empty(max_reserved_shape, host_array.DataType(), null_device));
       this->cached_buffers.Set(buffer_cache_key, buffer);
+      int64_t num_elements = 1;
+      for (int64_t dim : max_reserved_shape) {
+        num_elements *= dim;
+      }
+      this->cached_buffer_bytes += num_elements * host_array.DataType().bytes();
     }
     ShapeTuple real_shape = host_array.Shape();
-    DRef buffer_view = nd_view_func_(buffer, real_shape);
+    auto view_it = this->cached_buffer_views.find(buffer_cache_key);
+    if (view_it == this->cached_buffer_views.end() ||
+        !std::equal(real_shape.begin(), real_shape.end(), view_it->second.first.begin(),
+                    view_it->second.first.end())) {
+      DRef buffer_view = nd_view_func_(buffer, real_shape);
+      view_it = this->cached_buffer_views
+                    .insert_or_assign(buffer_cache_key, std::make_pair(real_shape, buffer_view))
+                    .first;
+    }
+    DRef buffer_view = view_it->second.second;
     sess->CopyToWorker0(host_array, buffer_view);
     return buffer_view;
   } else {
@@ -300,10 +489,14 @@ ObjectRef FunctionTable::CopyToWorker0(const NDArray& host_array, String buffer_
     } else {
       buffer = NDArray::Empty(max_reserved_shape, host_array->dtype, local_gpu_device);
       this->cached_buffers.Set(buffer_cache_key, buffer);
+      this->cached_buffer_bytes += static_cast<int64_t>(GetDataSize(*buffer.operator->()));
     }
     buffer = buffer.CreateView(host_array.Shape(), host_array->dtype);
     DLTensor copy_dst = *(buffer.operator->());
-    NDArray::CopyFromTo(host_array.operator->(), &copy_dst);
+    // Copy on the current stream, so that models running on side streams do not serialize
+    // on the default stream.
+    TVMStreamHandle stream = DeviceAPI::Get(local_gpu_device)->GetCurrentStream(local_gpu_device);
+    NDArray::CopyFromTo(host_array.operator->(), &copy_dst, stream);
     return buffer;
   }
 }
@@ -14,6 +14,9 @@
 #include <tvm/runtime/packed_func.h>
 
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 
 #include "../metadata/model.h"
 
@@ -44,10 +47,32 @@ struct FunctionTable {
   void Init(String reload_lib_path, Device device, picojson::object model_config,
             Optional<Session> session);
 
+  /*!
+   * \brief Load the model parameters. The parameters in `offloaded_params` are kept in
+   * page-locked host memory, and the others are loaded to the device.
+   */
   ObjectRef LoadParams(const std::string& model_path, Device device);
 
+  /*!
+   * \brief Load the parameters of a LoRA adapter, which is stored as an NDArray cache.
+   * The parameters are ordered as they are recorded in the NDArray cache metadata.
+   */
+  ObjectRef LoadLoRAAdapter(const std::string& adapter_path, Device device);
+
   void _InitFunctions();
 
+  /*!
+   * \brief Get the path of the preprocessed weight shards of the model in the weight shard
+   * cache, or empty if the cache is disabled or the weights are not sharded at loading time.
+   * The path is keyed by the weight shard records, the model config and the preprocessing of
+   * the parameters, which covers the number of shards.
+   */
+  std::string GetWeightShardCachePath(const std::string& model_path) const;
+
+  /*! \brief Load the model parameters with the offloaded ones in page-locked host memory. */
+  Array<NDArray> LoadParamsWithOffloading(const std::string& model_path, Device device,
+                                          const PackedFunc* fload_mmap);
+
   ObjectRef Empty(ShapeTuple shape, DataType dtype, Device device) const;
 
   /*!
@@ -70,6 +95,14 @@ struct FunctionTable {
   Session sess{nullptr};
   DRef disco_mod{nullptr};
   Map<String, ObjectRef> cached_buffers{nullptr};
+  /*! \brief The total bytes of the cached buffers on the local gpu or on each worker. */
+  int64_t cached_buffer_bytes = 0;
+  /*!
+   * \brief The last view of each cached buffer on the workers, and the shape of the view.
+   * Creating a view is a call broadcast to all the workers, which is skipped when the shape is
+   * unchanged from the last copy, as is the common case in decode.
+   */
+  std::unordered_map<std::string, std::pair<ShapeTuple, DRef>> cached_buffer_views;
   tvm::runtime::Module local_vm{nullptr};
   picojson::object model_config;
 
@@ -77,6 +110,16 @@ struct FunctionTable {
   TypedPackedFunc<PackedFunc(const std::string&)> get_global_func;
 
   ModelMetadata model_metadata_;
+  /*!
+   * \brief The names of the parameters kept in page-locked host memory, which the device
+   * kernels read in place under unified virtual addressing.
+   */
+  std::unordered_set<std::string> offloaded_params;
+  /*!
+   * \brief The directory of the cache of the preprocessed weight shards under tensor
+   * parallelism, or empty if disabled.
+   */
+  std::string weight_shard_cache_dir;
 
   PackedFunc embed_func_;
   PackedFunc image_embed_func_;
@@ -84,7 +127,10 @@ struct FunctionTable {
   PackedFunc single_batch_decode_func_;
   PackedFunc prefill_func_;
   PackedFunc decode_func_;
+  PackedFunc prefill_lora_func_;
+  PackedFunc decode_lora_func_;
   PackedFunc verify_func_;
+  PackedFunc decode_early_exit_func_;
   PackedFunc single_batch_prefill_to_last_hidden_func_;
   PackedFunc single_batch_decode_to_last_hidden_func_;
   PackedFunc prefill_to_last_hidden_func_;
@@ -93,11 +139,15 @@ struct FunctionTable {
   PackedFunc fuse_embed_hidden_func_;
   PackedFunc get_logits_func_;
   PackedFunc batch_get_logits_func_;
+  PackedFunc get_logits_for_tokens_func_;
   PackedFunc batch_select_last_hidden_func_;
   PackedFunc softmax_func_;
   PackedFunc apply_logit_bias_func_;
   PackedFunc apply_penalty_func_;
   PackedFunc apply_bitmask_func_;
+  PackedFunc apply_logit_bias_and_penalty_func_;
+  PackedFunc update_token_cnt_table_func_;
+  PackedFunc apply_penalty_from_table_func_;
   PackedFunc alloc_embedding_tensor_func_;
   PackedFunc create_kv_cache_func_;
   PackedFunc reset_kv_cache_func_;
@@ -109,14 +159,19 @@ struct FunctionTable {
   PackedFunc kv_cache_begin_forward_func_;
   PackedFunc kv_cache_end_forward_func_;
   PackedFunc kv_cache_popn_func_;
+  PackedFunc kv_cache_commit_accepted_token_tree_nodes_func_;
   PackedFunc kv_cache_get_num_available_pages_func_;
   PackedFunc kv_cache_get_total_sequence_length_func_;
+  PackedFunc kv_cache_debug_get_kv_func_;
+  PackedFunc kv_cache_debug_set_kv_func_;
   PackedFunc gpu_multinomial_from_uniform_func_;
   PackedFunc gpu_argsort_probs_func_;
   PackedFunc gpu_sample_with_top_p_func_;
   PackedFunc gpu_sampler_take_probs_func_;
+  PackedFunc gpu_sampler_take_top_probs_func_;
   PackedFunc gpu_verify_draft_tokens_func_;
   PackedFunc gpu_renormalize_by_top_p_func_;
+  PackedFunc gpu_renormalize_by_top_k_min_p_func_;
   PackedFunc nd_view_func_;
   PackedFunc nd_get_shape_func_;
   PackedFunc nd_copy_embedding_to_offset_func_;
@@ -459,15 +459,19 @@ BNFGrammar EBNFParser::Parse(std::string ebnf_string, std::string main_rule) {
 }
 
 BNFGrammar BNFJSONParser::Parse(std::string json_string) {
+  return Parse(json::ParseToJSONObject(json_string));
+}
+
+BNFGrammar BNFJSONParser::Parse(const picojson::object& grammar_json) {
   auto node = make_object<BNFGrammarNode>();
-  auto grammar_json = json::ParseToJSONObject(json_string);
   auto rules_json = json::Lookup<picojson::array>(grammar_json, "rules");
   for (const auto& rule_json : rules_json) {
     auto rule_json_obj = rule_json.get<picojson::object>();
-    auto name = json::Lookup<std::string>(rule_json.get<picojson::object>(), "name");
-    auto rule_expr = static_cast<int32_t>(
-        json::Lookup<int64_t>(rule_json.get<picojson::object>(), "body_expr_id"));
-    node->rules_.push_back(BNFGrammarNode::Rule({name, rule_expr}));
+    auto name = json::Lookup<std::string>(rule_json_obj, "name");
+    auto rule_expr = static_cast<int32_t>(json::Lookup<int64_t>(rule_json_obj, "body_expr_id"));
+    auto lookahead_assertion_id = static_cast<int32_t>(
+        json::LookupOrDefault<int64_t>(rule_json_obj, "lookahead_assertion_id", -1));
+    node->rules_.push_back(BNFGrammarNode::Rule({name, rule_expr, lookahead_assertion_id}));
   }
   auto rule_expr_data_json = json::Lookup<picojson::array>(grammar_json, "rule_expr_data");
   for (const auto& data_json : rule_expr_data_json) {
@@ -477,6 +481,14 @@ BNFGrammar BNFJSONParser::Parse(std::string json_string) {
   for (const auto& index_ptr_json : rule_expr_indptr_json) {
     node->rule_expr_indptr_.push_back(static_cast<int32_t>(index_ptr_json.get<int64_t>()));
   }
+  // Older dumps do not record the main rule. Fall back to the rule named "main".
+  node->main_rule_id_ =
+      static_cast<int32_t>(json::LookupOrDefault<int64_t>(grammar_json, "main_rule_id", -1));
+  for (int i = 0; node->main_rule_id_ == -1 && i < static_cast<int>(node->rules_.size()); ++i) {
+    if (node->rules_[i].name == "main") {
+      node->main_rule_id_ = i;
+    }
+  }
   return BNFGrammar(std::move(node));
 }
 
@@ -7,6 +7,7 @@
 #ifndef MLC_LLM_SERVE_GRAMMAR_GRAMMAR_PARSER_H_
 #define MLC_LLM_SERVE_GRAMMAR_GRAMMAR_PARSER_H_
 
+#include <picojson.h>
 #include <tvm/runtime/container/string.h>
 #include <tvm/runtime/logging.h>
 
@@ -59,6 +60,13 @@ class BNFJSONParser {
    * \return The parsed BNF grammar.
    */
   static BNFGrammar Parse(std::string json_string);
+
+  /*!
+   * \brief Parse the JSON object dumped by BNFGrammarJSONSerializer::ToJSONObject.
+   * \param grammar_json The JSON object. Fields other than the grammar are ignored.
+   * \return The parsed BNF grammar.
+   */
+  static BNFGrammar Parse(const picojson::object& grammar_json);
 };
 
 }  // namespace serve
@@ -139,7 +139,7 @@ TVM_REGISTER_GLOBAL("mlc.serve.BNFGrammarToString").set_body_typed([](const BNFG
   return BNFGrammarPrinter(grammar).ToString();
 });
 
-std::string BNFGrammarJSONSerializer::ToString() {
+picojson::object BNFGrammarJSONSerializer::ToJSONObject() {
   picojson::object grammar_json_obj;
 
   picojson::array rules_json;
@@ -147,6 +147,8 @@ std::string BNFGrammarJSONSerializer::ToString() {
     picojson::object rule_json;
     rule_json["name"] = picojson::value(rule.name);
     rule_json["body_expr_id"] = picojson::value(static_cast<int64_t>(rule.body_expr_id));
+    rule_json["lookahead_assertion_id"] =
+        picojson::value(static_cast<int64_t>(rule.lookahead_assertion_id));
     rules_json.push_back(picojson::value(rule_json));
   }
   grammar_json_obj["rules"] = picojson::value(rules_json);
@@ -161,9 +163,12 @@ std::string BNFGrammarJSONSerializer::ToString() {
     rule_expr_indptr_json.push_back(picojson::value(static_cast<int64_t>(index_ptr)));
   }
   grammar_json_obj["rule_expr_indptr"] = picojson::value(rule_expr_indptr_json);
+  grammar_json_obj["main_rule_id"] = picojson::value(static_cast<int64_t>(grammar_->main_rule_id_));
+  return grammar_json_obj;
+}
 
-  auto grammar_json = picojson::value(grammar_json_obj);
-  return grammar_json.serialize(prettify_);
+std::string BNFGrammarJSONSerializer::ToString() {
+  return picojson::value(ToJSONObject()).serialize(prettify_);
 }
 
 TVM_REGISTER_GLOBAL("mlc.serve.BNFGrammarToJSON")
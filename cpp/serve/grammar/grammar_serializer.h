@@ -7,6 +7,8 @@
 #ifndef MLC_LLM_SERVE_GRAMMAR_GRAMMAR_SERIALIZER_H_
 #define MLC_LLM_SERVE_GRAMMAR_GRAMMAR_SERIALIZER_H_
 
+#include <picojson.h>
+
 #include <string>
 
 #include "grammar.h"
@@ -84,11 +86,12 @@ class BNFGrammarPrinter : public BNFGrammarSerializer {
  * \details JSON format:
  *  {
  *    "rules": [
- *      {"name": "...", "rule_expr": rule_expr_id},
- *      {"name": "...", "rule_expr": rule_expr_id},
+ *      {"name": "...", "body_expr_id": rule_expr_id, "lookahead_assertion_id": rule_expr_id},
+ *      {"name": "...", "body_expr_id": rule_expr_id, "lookahead_assertion_id": rule_expr_id},
  *    ],
  *    "rule_expr_data": [integers...],
  *    "rule_expr_indptr": [integers...],
+ *    "main_rule_id": rule_id,
  *  }
  */
 class BNFGrammarJSONSerializer : public BNFGrammarSerializer {
@@ -106,6 +109,10 @@ class BNFGrammarJSONSerializer : public BNFGrammarSerializer {
    */
   std::string ToString() final;
 
+  /*! \brief Dump the raw representation of the AST to a JSON object, so that other artifacts can
+   * extend it with more fields. */
+  picojson::object ToJSONObject();
+
  private:
   bool prettify_;
 };
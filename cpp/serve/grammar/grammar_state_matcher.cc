@@ -5,8 +5,11 @@
 // #define TVM_LOG_DEBUG 1
 #include "grammar_state_matcher.h"
 
+#include <algorithm>
 #include <chrono>
+#include <optional>
 #include <queue>
+#include <string_view>
 
 #include "../../tokenizers.h"
 #include "grammar.h"
@@ -136,17 +139,31 @@ class GrammarStateMatcherNodeImpl : public GrammarStateMatcherNode, public Gramm
 
   bool AcceptToken(int32_t token_id) final;
 
+  int AcceptTokens(const std::vector<int32_t>& token_ids) final;
+
   void FindNextTokenBitmask(DLTensor* next_token_bitmask) final;
 
+  std::string FindJumpForwardString() final;
+
+  std::vector<int32_t> FindJumpForwardTokens(int max_num_tokens) final;
+
   void Rollback(int num_tokens) final;
 
   int MaxRollbackSteps() const final { return max_rollback_steps_; }
 
+  GrammarStateSnapshot SaveSnapshot() final {
+    ++num_snapshots_;
+    return {static_cast<int>(token_length_history.size()), stack_tops_history_.Size()};
+  }
+
+  void RestoreSnapshot(const GrammarStateSnapshot& snapshot) final;
+
   bool IsTerminated() const { return stack_tops_history_.GetLatest().empty(); }
 
   void ResetState() final {
     stack_tops_history_.Reset();
     token_length_history.clear();
+    num_snapshots_ = 0;
     PushInitialState(kInvalidRulePosition, true);
   }
 
@@ -162,6 +179,16 @@ class GrammarStateMatcherNodeImpl : public GrammarStateMatcherNode, public Gramm
                             const std::vector<int>& uncertain_indices,
                             const std::vector<bool>& uncertain_tokens_bitset);
 
+  /*!
+   * \brief Get the current stack state as the key of the compiled token bitmasks. Each stack
+   * contributes the RulePositions from its top to the root. The stacks are sorted and
+   * deduplicated, so that the same state reached in different ways has the same key.
+   */
+  void GetStackStateKey(std::vector<int32_t>* key);
+
+  /*! \brief Check the shape and dtype of next_token_bitmask. */
+  void CheckTokenBitmask(DLTensor* next_token_bitmask) const;
+
   /*! \brief Set the acceptable next token in next_token_bitmask. */
   void SetTokenBitmask(DLTensor* next_token_bitmask, const DynamicBitset& accepted_bitset,
                        const std::vector<int32_t>& rejected_indices, bool can_reach_end);
@@ -172,17 +199,31 @@ class GrammarStateMatcherNodeImpl : public GrammarStateMatcherNode, public Gramm
    */
   bool AcceptStopToken();
 
+  /*!
+   * \brief Discard the earliest history beyond the maximum number of rollback steps, unless a
+   * snapshot or a batch of tokens needs it.
+   */
+  void DiscardExcessHistory();
+
+  /*! \brief The maximum length of the jump-forward string, which bounds the search cost. */
+  static constexpr int kMaxJumpForwardStringLength = 256;
+
   friend IntTuple FindNextRejectedTokens(GrammarStateMatcher matcher, bool verbose);
   friend NDArray FindNextTokenBitmaskAsNDArray(GrammarStateMatcher matcher);
 
   std::shared_ptr<GrammarStateInitContext> init_ctx_;
   int max_rollback_steps_;
   std::deque<int> token_length_history;
+  // The number of snapshots not restored yet, plus one while accepting a batch of tokens.
+  int num_snapshots_ = 0;
 
   // Temporary data for FindNextTokenBitmask. They are stored here to avoid repeated allocation.
   DynamicBitset tmp_accepted_bitset_;
   std::vector<int32_t> tmp_rejected_indices_;
   std::vector<int32_t> tmp_rejected_indices_delta_;
+  std::vector<int32_t> tmp_rejected_indices_expanded_;
+  std::vector<std::vector<int32_t>> tmp_stack_states_;
+  std::vector<int32_t> tmp_stack_state_key_;
 };
 
 bool GrammarStateMatcherNodeImpl::AcceptStopToken() {
@@ -210,29 +251,81 @@ bool GrammarStateMatcherNodeImpl::AcceptToken(int32_t token_id) {
 
   if (init_ctx_->special_token_ids.count(token_id) > 0) {
     LOG(FATAL)
-        << "Token id " << token_id << ": " << init_ctx_->token_table[token_id]
+        << "Token id " << token_id << ": " << (*init_ctx_->token_table)[token_id]
         << " is regarded as a special token, and cannot be accepted by the GrammarStateMatcher";
   }
 
-  const auto& token = init_ctx_->token_table[token_id];
+  std::string_view token = (*init_ctx_->token_table)[token_id];
+  int accepted_cnt = 0;
   for (auto char_value : token) {
     if (!AcceptChar(char_value, false)) {
+      // Roll back the accepted prefix of the token, so that the state is unchanged.
+      RollbackChars(accepted_cnt);
       return false;
     }
+    ++accepted_cnt;
   }
   token_length_history.push_back(token.size());
-  if (token_length_history.size() > max_rollback_steps_) {
+  DiscardExcessHistory();
+  return true;
+}
+
+int GrammarStateMatcherNodeImpl::AcceptTokens(const std::vector<int32_t>& token_ids) {
+  int num_accepted = 0;
+  ++num_snapshots_;
+  for (int32_t token_id : token_ids) {
+    if (IsTerminated() || !AcceptToken(token_id)) {
+      break;
+    }
+    ++num_accepted;
+  }
+  --num_snapshots_;
+  DiscardExcessHistory();
+  return num_accepted;
+}
+
+void GrammarStateMatcherNodeImpl::RestoreSnapshot(const GrammarStateSnapshot& snapshot) {
+  CHECK_GT(num_snapshots_, 0) << "GrammarStateMatcher has no snapshot to restore";
+  CHECK(snapshot.num_tokens <= static_cast<int>(token_length_history.size()) &&
+        snapshot.num_stack_tops <= stack_tops_history_.Size())
+      << "The snapshot of GrammarStateMatcher is rolled back over";
+  RollbackChars(stack_tops_history_.Size() - snapshot.num_stack_tops);
+  token_length_history.resize(snapshot.num_tokens);
+  --num_snapshots_;
+  DiscardExcessHistory();
+}
+
+void GrammarStateMatcherNodeImpl::DiscardExcessHistory() {
+  if (num_snapshots_ > 0) {
+    return;
+  }
+  while (token_length_history.size() > max_rollback_steps_) {
     DiscardEarliestChars(token_length_history.front());
     token_length_history.pop_front();
   }
-  return true;
 }
 
 void GrammarStateMatcherNodeImpl::FindNextTokenBitmask(DLTensor* next_token_bitmask) {
   CHECK(!IsTerminated())
       << "GrammarStateMatcher has terminated after accepting the stop token, but is trying to "
          "find the next token mask";
-  const auto& sorted_token_table = init_ctx_->sorted_token_table;
+  CheckTokenBitmask(next_token_bitmask);
+  int bitmask_size = DynamicBitset::CalculateBufferSize(init_ctx_->vocab_size);
+
+  // Step 1. Look up the bitmask compiled for the current stack state.
+  GetStackStateKey(&tmp_stack_state_key_);
+  auto& token_bitmask_cache = init_ctx_->token_bitmask_cache;
+  {
+    std::lock_guard<std::mutex> lock(init_ctx_->token_bitmask_cache_mutex);
+    auto it = token_bitmask_cache.find(tmp_stack_state_key_);
+    if (it != token_bitmask_cache.end()) {
+      std::memcpy(next_token_bitmask->data, it->second.data(), bitmask_size * sizeof(uint32_t));
+      return;
+    }
+  }
+
+  const TokenTable& token_table = *init_ctx_->token_table;
+  const std::vector<int32_t>& sorted_token_ids = *init_ctx_->sorted_token_ids;
   const auto& catagorized_tokens_for_grammar = init_ctx_->catagorized_tokens_for_grammar;
   const auto& latest_stack_tops = stack_tops_history_.GetLatest();
 
@@ -241,7 +334,7 @@ void GrammarStateMatcherNodeImpl::FindNextTokenBitmask(DLTensor* next_token_bitm
   // The final accepted token set is the union of the accepted token sets of all stacks.
   // The final rejected token set is the intersection of the rejected token sets of all stacks.
 
-  // Note these indices store the indices in sorted_token_table, instead of the token ids.
+  // Note these indices store the indices in sorted_token_ids, instead of the token ids.
   tmp_accepted_bitset_.Reset();
   // {-1} means the universal set, i.e. all tokens initially
   tmp_rejected_indices_.assign({-1});
@@ -274,7 +367,7 @@ void GrammarStateMatcherNodeImpl::FindNextTokenBitmask(DLTensor* next_token_bitm
     // Examine only the current one stack
     stack_tops_history_.PushHistory({tree_.NewNode(cur_rule_position)});
 
-    const std::string* prev_token = nullptr;
+    std::optional<std::string_view> prev_token;
     int prev_matched_size = 0;
 
     // std::cout << tree_.PrintNode(top) << std::endl;
@@ -289,7 +382,7 @@ void GrammarStateMatcherNodeImpl::FindNextTokenBitmask(DLTensor* next_token_bitm
     //   for (int i = 0; i < catagorized_tokens.accepted_indices.size(); ++i) {
     //     std::cout << "<"
     //               << PrintAsEscaped(
-    //                      sorted_token_table[catagorized_tokens.accepted_indices[i]].second)
+    //                      token_table[sorted_token_ids[catagorized_tokens.accepted_indices[i]]])
     //               << "> ";
     //   }
     //   std::cout << "\n";
@@ -300,14 +393,14 @@ void GrammarStateMatcherNodeImpl::FindNextTokenBitmask(DLTensor* next_token_bitm
     // for (int i = 0; i < catagorized_tokens.uncertain_indices.size(); ++i) {
     //   std::cout << "<"
     //             << PrintAsEscaped(
-    //                    sorted_token_table[catagorized_tokens.uncertain_indices[i]].second)
+    //                    token_table[sorted_token_ids[catagorized_tokens.uncertain_indices[i]]])
     //             << "> ";
     // }
     // std::cout << "\n";
     // }
 
-    for (auto cur_token_idx : catagorized_tokens.uncertain_indices) {
-      const auto& cur_token = sorted_token_table[cur_token_idx].second;
+    catagorized_tokens.uncertain_indices.ForEach([&](int32_t cur_token_idx) {
+      std::string_view cur_token = token_table[sorted_token_ids[cur_token_idx]];
       bool accepted = true;
 
       // Step 2.1. Find the longest common prefix with the accepted part of the previous token.
@@ -341,7 +434,7 @@ void GrammarStateMatcherNodeImpl::FindNextTokenBitmask(DLTensor* next_token_bitm
       if (catagorized_tokens.save_type == SaveType::kAcceptedBitset ||
           catagorized_tokens.save_type == SaveType::kAccepted) {
         if (accepted) {
-          tmp_accepted_bitset_.Set(sorted_token_table[cur_token_idx].first, true);
+          tmp_accepted_bitset_.Set(sorted_token_ids[cur_token_idx], true);
         }
       } else {
         if (!accepted) {
@@ -349,8 +442,8 @@ void GrammarStateMatcherNodeImpl::FindNextTokenBitmask(DLTensor* next_token_bitm
         }
       }
 
-      prev_token = &cur_token;
-    }
+      prev_token = cur_token;
+    });
 
     RollbackChars(prev_matched_size + 1);
 
@@ -364,14 +457,14 @@ void GrammarStateMatcherNodeImpl::FindNextTokenBitmask(DLTensor* next_token_bitm
     if (catagorized_tokens.save_type == SaveType::kAcceptedBitset) {
       tmp_accepted_bitset_ |= catagorized_tokens.accepted_bitset;
     } else if (catagorized_tokens.save_type == SaveType::kAccepted) {
-      for (auto idx : catagorized_tokens.accepted_indices) {
-        tmp_accepted_bitset_.Set(sorted_token_table[idx].first, true);
-      }
+      catagorized_tokens.accepted_indices.ForEach(
+          [&](int32_t idx) { tmp_accepted_bitset_.Set(sorted_token_ids[idx], true); });
     } else {
       // rejected_indices = Intersect(
       //     rejected_indices,
       //     catagorized_tokens.rejected_indices + rejected_indices_delta)
-      IntsetUnion(&tmp_rejected_indices_delta_, catagorized_tokens.rejected_indices);
+      catagorized_tokens.rejected_indices.ToVector(&tmp_rejected_indices_expanded_);
+      IntsetUnion(&tmp_rejected_indices_delta_, tmp_rejected_indices_expanded_);
       IntsetIntersection(&tmp_rejected_indices_, tmp_rejected_indices_delta_);
     }
     // end = std::chrono::high_resolution_clock::now();
@@ -382,6 +475,23 @@ void GrammarStateMatcherNodeImpl::FindNextTokenBitmask(DLTensor* next_token_bitm
   // auto start = std::chrono::high_resolution_clock::now();
   bool can_reach_end = CanReachEnd();
   SetTokenBitmask(next_token_bitmask, tmp_accepted_bitset_, tmp_rejected_indices_, can_reach_end);
+
+  // Step 4. Save the bitmask for the current stack state.
+  std::lock_guard<std::mutex> lock(init_ctx_->token_bitmask_cache_mutex);
+  if (init_ctx_->token_bitmask_cache_bytes + bitmask_size * sizeof(uint32_t) >
+      GrammarStateInitContext::kMaxTokenBitmaskCacheBytes) {
+    token_bitmask_cache.clear();
+    init_ctx_->token_bitmask_cache_bytes = 0;
+  }
+  const uint32_t* bitmask_data = static_cast<const uint32_t*>(next_token_bitmask->data);
+  bool inserted =
+      token_bitmask_cache
+          .emplace(tmp_stack_state_key_,
+                   std::vector<uint32_t>(bitmask_data, bitmask_data + bitmask_size))
+          .second;
+  if (inserted) {
+    init_ctx_->token_bitmask_cache_bytes += bitmask_size * sizeof(uint32_t);
+  }
   // auto end = std::chrono::high_resolution_clock::now();
   // time_idx += std::chrono::duration_cast<std::chrono::microseconds>(end - start);
   // std::cout << "Time for uncertain: " << time_unc.count()
@@ -389,6 +499,78 @@ void GrammarStateMatcherNodeImpl::FindNextTokenBitmask(DLTensor* next_token_bitm
   // std::cout << "Check cnt " << check_cnt << std::endl;
 }
 
+std::string GrammarStateMatcherNodeImpl::FindJumpForwardString() {
+  CHECK(!IsTerminated())
+      << "GrammarStateMatcher has terminated after accepting the stop token, but is trying to "
+         "find the jump-forward string";
+  std::string result;
+  // The stop token is another continuation when the end of the grammar can be reached.
+  while (static_cast<int>(result.size()) < kMaxJumpForwardStringLength && !CanReachEnd()) {
+    int next_char = -1;
+    bool is_unique = true;
+    for (int char_value = 0; char_value < 256; ++char_value) {
+      if (!AcceptChar(char_value, false)) {
+        continue;
+      }
+      RollbackChars(1);
+      if (next_char != -1) {
+        is_unique = false;
+        break;
+      }
+      next_char = char_value;
+    }
+    if (next_char == -1 || !is_unique) {
+      break;
+    }
+    AcceptChar(next_char, false);
+    result.push_back(static_cast<char>(next_char));
+  }
+  RollbackChars(result.size());
+  return result;
+}
+
+std::vector<int32_t> GrammarStateMatcherNodeImpl::FindJumpForwardTokens(int max_num_tokens) {
+  std::vector<int32_t> tokens;
+  if (max_num_tokens <= 0) {
+    return tokens;
+  }
+  std::string str = FindJumpForwardString();
+  const TokenTable& token_table = *init_ctx_->token_table;
+  const std::vector<int32_t>& sorted_token_ids = *init_ctx_->sorted_token_ids;
+  auto f_compare_token = [&](int32_t token_id, std::string_view b) {
+    return token_table[token_id] < b;
+  };
+  int pos = 0;
+  // One more token is found, as the last one is excluded.
+  while (pos < static_cast<int>(str.size()) && static_cast<int>(tokens.size()) <= max_num_tokens) {
+    // Find the longest token that is a prefix of the rest of the string. The prefix is extended
+    // until no token starts with it.
+    int longest_token_id = -1;
+    int longest_token_length = 0;
+    for (int length = 1; pos + length <= static_cast<int>(str.size()); ++length) {
+      std::string_view prefix(str.data() + pos, length);
+      auto it = std::lower_bound(sorted_token_ids.begin(), sorted_token_ids.end(), prefix,
+                                 f_compare_token);
+      if (it == sorted_token_ids.end() || token_table[*it].compare(0, length, prefix) != 0) {
+        break;
+      }
+      if (token_table[*it].size() == static_cast<size_t>(length)) {
+        longest_token_id = *it;
+        longest_token_length = length;
+      }
+    }
+    if (longest_token_id == -1) {
+      break;
+    }
+    tokens.push_back(longest_token_id);
+    pos += longest_token_length;
+  }
+  if (!tokens.empty()) {
+    tokens.pop_back();
+  }
+  return tokens;
+}
+
 void GrammarStateMatcherNodeImpl::Rollback(int num_tokens) {
   CHECK(num_tokens <= token_length_history.size())
       << "Intended to rollback " << num_tokens << " tokens, but only the last "
@@ -401,6 +583,40 @@ void GrammarStateMatcherNodeImpl::Rollback(int num_tokens) {
   }
 }
 
+void GrammarStateMatcherNodeImpl::GetStackStateKey(std::vector<int32_t>* key) {
+  const auto& latest_stack_tops = stack_tops_history_.GetLatest();
+  tmp_stack_states_.resize(latest_stack_tops.size());
+  for (int i = 0; i < static_cast<int>(latest_stack_tops.size()); ++i) {
+    auto& stack_state = tmp_stack_states_[i];
+    stack_state.clear();
+    for (int32_t node_id = latest_stack_tops[i]; node_id != RulePosition::kNoParent;
+         node_id = tree_[node_id].parent_id) {
+      const auto& rule_position = tree_[node_id];
+      stack_state.insert(stack_state.end(),
+                         {rule_position.rule_id, rule_position.sequence_id,
+                          rule_position.element_id, rule_position.left_utf8_bytes,
+                          rule_position.element_in_string});
+    }
+  }
+  std::sort(tmp_stack_states_.begin(), tmp_stack_states_.end());
+  auto end = std::unique(tmp_stack_states_.begin(), tmp_stack_states_.end());
+  key->clear();
+  for (auto stack_it = tmp_stack_states_.begin(); stack_it != end; ++stack_it) {
+    key->insert(key->end(), stack_it->begin(), stack_it->end());
+    // Separate the stacks, since no RulePosition field is smaller than -1.
+    key->push_back(-2);
+  }
+}
+
+void GrammarStateMatcherNodeImpl::CheckTokenBitmask(DLTensor* next_token_bitmask) const {
+  CHECK(next_token_bitmask->dtype.code == kDLUInt && next_token_bitmask->dtype.bits == 32 &&
+        next_token_bitmask->data && next_token_bitmask->ndim == 1 && next_token_bitmask->shape)
+      << "The provied bitmask's shape or dtype is not valid.";
+  CHECK(next_token_bitmask->shape[0] >= DynamicBitset::CalculateBufferSize(init_ctx_->vocab_size))
+      << "The provided bitmask is not large enough to store the token set. The length should be "
+      << DynamicBitset::CalculateBufferSize(init_ctx_->vocab_size) << " at least";
+}
+
 void GrammarStateMatcherNodeImpl::SetTokenBitmask(DLTensor* next_token_bitmask,
                                                   const DynamicBitset& accepted_bitset,
                                                   const std::vector<int32_t>& rejected_indices,
@@ -410,16 +626,9 @@ void GrammarStateMatcherNodeImpl::SetTokenBitmask(DLTensor* next_token_bitmask,
   //    (when rejected_ids != {-1}, i.e. rejected_ids is not the universal set)
   // 2. accepted_ids
   //    (otherwise, when rejected_ids is the universal set)
-  CHECK(next_token_bitmask->dtype.code == kDLUInt && next_token_bitmask->dtype.bits == 32 &&
-        next_token_bitmask->data && next_token_bitmask->ndim == 1 && next_token_bitmask->shape)
-      << "The provied bitmask's shape or dtype is not valid.";
-  CHECK(next_token_bitmask->shape[0] >= DynamicBitset::CalculateBufferSize(init_ctx_->vocab_size))
-      << "The provided bitmask is not large enough to store the token set. The length should be "
-      << DynamicBitset::CalculateBufferSize(init_ctx_->vocab_size) << " at least";
-
   DynamicBitset next_token_bitset(init_ctx_->vocab_size,
                                   reinterpret_cast<uint32_t*>(next_token_bitmask->data));
-  const auto& sorted_token_table = init_ctx_->sorted_token_table;
+  const std::vector<int32_t>& sorted_token_ids = *init_ctx_->sorted_token_ids;
 
   if (rejected_indices.size() == 1 && rejected_indices[0] == -1) {
     // If rejected_indices is the universal set, the final accepted token set is just
@@ -433,15 +642,14 @@ void GrammarStateMatcherNodeImpl::SetTokenBitmask(DLTensor* next_token_bitmask,
       }
     }
   } else {
-    // Otherwise, the final rejected token set is (rejected_indices \ accepted_indices)
+    // Otherwise, the final rejected token set is (rejected_indices \ accepted_indices). Clear
+    // all the rejected tokens, and then add the accepted tokens back word by word.
     next_token_bitset.Set();
 
     for (auto i : rejected_indices) {
-      auto id = sorted_token_table[i].first;
-      if (!accepted_bitset[id]) {
-        next_token_bitset.Set(id, false);
-      }
+      next_token_bitset.Set(sorted_token_ids[i], false);
     }
+    next_token_bitset |= accepted_bitset;
 
     for (int id : init_ctx_->special_token_ids) {
       next_token_bitset.Set(id, false);
@@ -503,6 +711,36 @@ TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherFromTokenizer")
                 << "us";
       return GrammarStateMatcher(init_ctx, max_rollback_steps);
     });
+
+TVM_REGISTER_GLOBAL("mlc.serve.GrammarCompileJSONSchema")
+    .set_body([](TVMArgs args, TVMRetValue* rv) {
+      std::string schema = args[0];
+      String token_table_postproc_method = args[2];
+      bool prettify = args[3];
+      bool binary = args[4];
+      // args[1] is either the tokenizer or the postprocessed token table.
+      std::vector<std::string> token_table;
+      if (args[1].IsObjectRef<Tokenizer>()) {
+        Tokenizer tokenizer = args[1];
+        token_table =
+            Tokenizer::PostProcessTokenTable(tokenizer->TokenTable(), token_table_postproc_method);
+      } else {
+        Array<String> token_table_arr = args[1];
+        token_table = std::vector<std::string>(token_table_arr.begin(), token_table_arr.end());
+      }
+      // Use the same schema conversion options as GrammarInitContextCache. The empty schema
+      // stands for the built-in JSON grammar.
+      auto init_ctx = GrammarStateMatcher::CreateInitContext(
+          schema.empty() ? BNFGrammar::GetGrammarOfJSON() : BNFGrammar::FromSchema(schema),
+          token_table);
+      if (binary) {
+        std::string compiled_grammar = SerializeCompiledGrammarBinary(*init_ctx, schema);
+        TVMByteArray compiled_grammar_bytes{compiled_grammar.data(), compiled_grammar.size()};
+        *rv = compiled_grammar_bytes;
+      } else {
+        *rv = SerializeCompiledGrammar(*init_ctx, schema, prettify);
+      }
+    });
 #endif
 
 TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherFromTokenTable")
@@ -518,6 +756,26 @@ TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherFromTokenTable")
       *rv = GrammarStateMatcher(init_ctx, max_rollback_steps);
     });
 
+/*!
+ * \brief Create the matcher from a compiled grammar in either format, which skips the
+ * preprocessing of the grammar. The web runtime passes the compiled grammar shipped with the
+ * model as the bytes of an ArrayBuffer.
+ */
+TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherFromCompiledGrammar")
+    .set_body([](TVMArgs args, TVMRetValue* rv) {
+      std::string compiled_grammar = args[0];
+      Array<String> token_table_arr = args[1];
+      int max_rollback_steps = args[2];
+      std::vector<std::string> token_table(token_table_arr.begin(), token_table_arr.end());
+      std::string schema;
+      auto init_ctx = DeserializeCompiledGrammarAnyFormat(
+          &compiled_grammar, *CreateTokenizerInitContext(TokenTable::FromTokens(token_table)),
+          &schema);
+      CHECK(init_ctx != nullptr)
+          << "The compiled grammar is compiled with another tokenizer or version.";
+      *rv = GrammarStateMatcher(init_ctx, max_rollback_steps);
+    });
+
 TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherDebugAcceptChar")
     .set_body_typed([](GrammarStateMatcher matcher, int32_t codepoint, bool verbose) {
       auto mutable_node =
@@ -530,6 +788,22 @@ TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherAcceptToken")
       return matcher->AcceptToken(token_id);
     });
 
+TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherAcceptTokens")
+    .set_body_typed([](GrammarStateMatcher matcher, IntTuple token_ids) {
+      return matcher->AcceptTokens(std::vector<int32_t>(token_ids.begin(), token_ids.end()));
+    });
+
+TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherFindJumpForwardString")
+    .set_body_typed([](GrammarStateMatcher matcher) {
+      return String(matcher->FindJumpForwardString());
+    });
+
+TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherFindJumpForwardTokens")
+    .set_body_typed([](GrammarStateMatcher matcher, int max_num_tokens) {
+      std::vector<int32_t> tokens = matcher->FindJumpForwardTokens(max_num_tokens);
+      return IntTuple(tokens.begin(), tokens.end());
+    });
+
 TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherRollback")
     .set_body_typed([](GrammarStateMatcher matcher, int num_tokens) {
       matcher->Rollback(num_tokens);
@@ -538,6 +812,18 @@ TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherRollback")
 TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherMaxRollbackSteps")
     .set_body_typed([](GrammarStateMatcher matcher) { return matcher->MaxRollbackSteps(); });
 
+TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherSaveSnapshot")
+    .set_body_typed([](GrammarStateMatcher matcher) {
+      GrammarStateSnapshot snapshot = matcher->SaveSnapshot();
+      return IntTuple{snapshot.num_tokens, snapshot.num_stack_tops};
+    });
+
+TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherRestoreSnapshot")
+    .set_body_typed([](GrammarStateMatcher matcher, IntTuple snapshot) {
+      CHECK_EQ(snapshot.size(), 2) << "The snapshot of GrammarStateMatcher is invalid";
+      matcher->RestoreSnapshot({static_cast<int>(snapshot[0]), static_cast<int>(snapshot[1])});
+    });
+
 TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherIsTerminated")
     .set_body_typed([](GrammarStateMatcher matcher) { return matcher->IsTerminated(); });
 
@@ -598,7 +884,7 @@ std::string PrintAcceptedRejectedTokens(
   auto end_it =
       accepted_ids.size() > threshold ? accepted_ids.begin() + threshold : accepted_ids.end();
   for (auto it = accepted_ids.begin(); it != end_it; ++it) {
-    ss << "<" << PrintAsEscaped(init_ctx->token_table[*it]) << "> ";
+    ss << "<" << PrintAsEscaped(std::string((*init_ctx->token_table)[*it])) << "> ";
   }
   if (accepted_ids.size() > threshold) {
     ss << "...";
@@ -608,7 +894,7 @@ std::string PrintAcceptedRejectedTokens(
   ss << "Rejected: ";
   end_it = rejected_ids.size() > threshold ? rejected_ids.begin() + threshold : rejected_ids.end();
   for (auto it = rejected_ids.begin(); it != end_it; ++it) {
-    ss << "<" << PrintAsEscaped(init_ctx->token_table[*it]) << "> ";
+    ss << "<" << PrintAsEscaped(std::string((*init_ctx->token_table)[*it])) << "> ";
   }
   if (rejected_ids.size() > threshold) {
     ss << "...";
@@ -680,6 +966,81 @@ NDArray FindNextTokenBitmaskAsNDArray(GrammarStateMatcher matcher) {
 TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherFindNextTokenBitmaskAsNDArray")
     .set_body_typed(FindNextTokenBitmaskAsNDArray);
 
+/*!
+ * \brief Serialize the init context of the grammar and the token table into the format of the
+ * on-disk grammar cache, for testing.
+ */
+TVM_REGISTER_GLOBAL("mlc.serve.GrammarDebugSerializeInitContext")
+    .set_body([](TVMArgs args, TVMRetValue* rv) {
+      BNFGrammar grammar = args[0];
+      Array<String> token_table_arr = args[1];
+      std::vector<std::string> token_table(token_table_arr.begin(), token_table_arr.end());
+      auto init_ctx = GrammarStateMatcher::CreateInitContext(grammar, token_table);
+      std::string data = SerializeInitContext(*init_ctx, /*key=*/"", /*schema=*/"");
+      TVMByteArray data_bytes{data.data(), data.size()};
+      *rv = data_bytes;
+    });
+
+/*!
+ * \brief Create the matcher from an init context serialized by GrammarDebugSerializeInitContext,
+ * for testing. Return None if the data is invalid or does not match the grammar.
+ */
+TVM_REGISTER_GLOBAL("mlc.serve.GrammarStateMatcherDebugFromSerializedInitContext")
+    .set_body([](TVMArgs args, TVMRetValue* rv) {
+      std::string data = args[0];
+      BNFGrammar grammar = args[1];
+      Array<String> token_table_arr = args[2];
+      int max_rollback_steps = args[3];
+      std::vector<std::string> token_table(token_table_arr.begin(), token_table_arr.end());
+      auto init_ctx = DeserializeInitContext(
+          &data, /*key=*/"", /*schema=*/"", grammar,
+          *CreateTokenizerInitContext(TokenTable::FromTokens(token_table)));
+      if (init_ctx == nullptr) {
+        *rv = Optional<GrammarStateMatcher>();
+      } else {
+        *rv = GrammarStateMatcher(init_ctx, max_rollback_steps);
+      }
+    });
+
+/*!
+ * \brief Encode the sorted integers into a CompactIntset, for testing.
+ * \returns Whether the set holds runs, followed by the data of the set.
+ */
+TVM_REGISTER_GLOBAL("mlc.serve.GrammarDebugCompactIntsetEncode")
+    .set_body_typed([](Array<Integer> values) {
+      std::vector<int32_t> sorted_values;
+      sorted_values.reserve(values.size());
+      for (const Integer& value : values) {
+        sorted_values.push_back(value->value);
+      }
+      CompactIntset intset(sorted_values);
+      Array<Integer> result{Integer(intset.IsRuns())};
+      for (int32_t value : intset.Data()) {
+        result.push_back(Integer(value));
+      }
+      return result;
+    });
+
+/*!
+ * \brief Decode the data of a CompactIntset into the sorted integers, for testing.
+ * \returns The integers, or None if the data is invalid under the upper bound.
+ */
+TVM_REGISTER_GLOBAL("mlc.serve.GrammarDebugCompactIntsetDecode")
+    .set_body_typed([](bool is_runs, Array<Integer> data, int upper_bound) {
+      std::vector<int32_t> data_vec;
+      data_vec.reserve(data.size());
+      for (const Integer& value : data) {
+        data_vec.push_back(value->value);
+      }
+      CompactIntset intset;
+      if (!CompactIntset::FromData(is_runs, std::move(data_vec), upper_bound, &intset)) {
+        return Optional<Array<Integer>>();
+      }
+      Array<Integer> result;
+      intset.ForEach([&](int32_t value) { result.push_back(Integer(value)); });
+      return Optional<Array<Integer>>(result);
+    });
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
@@ -12,10 +12,12 @@
 #include <tvm/runtime/registry.h>
 
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "../../support/encoding.h"
+#include "../../token_table.h"
 #include "grammar.h"
 #include "support.h"
 
@@ -25,6 +27,17 @@ namespace serve {
 
 using namespace tvm::runtime;
 
+/*!
+ * \brief A snapshot of the state of a GrammarStateMatcher.
+ * \sa GrammarStateMatcherNode::SaveSnapshot
+ */
+struct GrammarStateSnapshot {
+  /*! \brief The number of tokens in the rollback history when the snapshot is saved. */
+  int num_tokens = 0;
+  /*! \brief The number of stack tops records in the history when the snapshot is saved. */
+  int num_stack_tops = 0;
+};
+
 /*!
  * \brief A stateful matcher to match tokens to the specified BNF grammar. This class is the core
  * logic of the grammar-guided generation.
@@ -66,6 +79,15 @@ class GrammarStateMatcherNode : public Object {
    */
   virtual bool AcceptToken(int32_t token_id) = 0;
 
+  /*!
+   * \brief Accept the tokens in order, until a token is not accepted or the matcher terminates.
+   * The earliest history beyond the maximum number of rollback steps is discarded once at the
+   * end instead of after each token.
+   * \param token_ids The ids of the tokens to accept.
+   * \return The number of accepted tokens. The state is the one after the last accepted token.
+   */
+  virtual int AcceptTokens(const std::vector<int32_t>& token_ids) = 0;
+
   /*!
    * \brief Find the set of tokens that are acceptable for the next step and store them in a
    * bitmask.
@@ -74,6 +96,27 @@ class GrammarStateMatcherNode : public Object {
    */
   virtual void FindNextTokenBitmask(DLTensor* next_token_bitmask) = 0;
 
+  /*!
+   * \brief Find the string that the grammar forces to be matched next, i.e. each of its bytes is
+   * the only byte that can be accepted at its position. It does not include the bytes after the
+   * end of the grammar can be reached, since the stop token is also acceptable there. Does not
+   * change the state of the matcher.
+   * \return The forced string, which is empty when the next byte is not unique.
+   */
+  virtual std::string FindJumpForwardString() = 0;
+
+  /*!
+   * \brief Find the tokens of the forced string that can be accepted without sampling, which
+   * is the core of jump-forward decoding. The forced string is tokenized greedily with the
+   * longest matching token, and the last token is excluded since it may merge with the text
+   * that follows. Does not change the state of the matcher. The returned tokens are accepted
+   * one by one by AcceptToken, so that they can be rolled back like sampled tokens.
+   * \param max_num_tokens The maximum number of tokens to return.
+   * \return The forced token ids.
+   * \sa FindJumpForwardString
+   */
+  virtual std::vector<int32_t> FindJumpForwardTokens(int max_num_tokens) = 0;
+
   /*!
    * \brief Rollback the matcher to a previous state.
    * \param num_tokens The number of tokens to rollback. It cannot exceed the current number of
@@ -84,6 +127,22 @@ class GrammarStateMatcherNode : public Object {
   /*! \brief Get the maximum number of rollback steps allowed. */
   virtual int MaxRollbackSteps() const = 0;
 
+  /*!
+   * \brief Save a snapshot of the current state in O(1), which is restored by RestoreSnapshot.
+   * The stacks after the snapshot share their nodes with the stacks of the snapshot, and the
+   * history after the snapshot is kept regardless of the maximum number of rollback steps until
+   * the snapshot is restored. It is used to try tokens speculatively, e.g., the draft tokens of
+   * speculative decoding.
+   * \note Snapshots can be nested, and are restored in the reverse order of saving.
+   */
+  virtual GrammarStateSnapshot SaveSnapshot() = 0;
+
+  /*!
+   * \brief Restore the state of a snapshot, which is the latest one not restored yet. The cost
+   * is the cost of rolling back the characters accepted after the snapshot.
+   */
+  virtual void RestoreSnapshot(const GrammarStateSnapshot& snapshot) = 0;
+
   /*!
    * \brief Check if the matcher has accepted the stop token and terminated.
    * \sa AcceptToken
@@ -145,7 +204,8 @@ class GrammarInitContextCacheNode : public Object {
   virtual std::shared_ptr<GrammarStateInitContext> GetInitContextForJSONSchema(
       const std::string& schema) = 0;
 
-  /*! \brief Clear the interal cache of init contexts. */
+  /*! \brief Clear the interal cache of init contexts. The on-disk cache and the compiled
+   * grammars loaded at construction are kept. */
   virtual void Clear() = 0;
 
   static constexpr const char* _type_key = "mlc.serve.GrammarInitContextCacheNode";
@@ -159,9 +219,22 @@ class GrammarInitContextCache : public ObjectRef {
   /*!
    * \brief Construct a GrammarInitContextCache with a token table. This class will always create
    * grammar state init contexts with this token table.
-   * \param token_table The token table that the grammar will use.
+   * \param token_table The token table that the grammar will use. It is shared by all the init
+   * contexts created by the cache.
+   * \param cache_dir The directory of the on-disk cache of the init contexts for JSON schemas,
+   * keyed by the hash of the schema and the token table. The directory can be shared by
+   * multiple processes. Empty means the on-disk cache is disabled.
+   * \param max_num_schemas The maximum number of init contexts for JSON schemas kept in memory.
+   * The least recently used one is evicted beyond it.
+   * \param precompiled_path A compiled grammar file, or a directory of .json compiled grammar
+   * files, to load at construction. The init contexts of their schemas are kept in memory and
+   * never evicted, so their first requests skip the schema conversion and preprocessing. Empty
+   * means no compiled grammar is loaded.
+   * \sa SerializeCompiledGrammar for the format of compiled grammars.
    */
-  GrammarInitContextCache(const std::vector<std::string>& token_table);
+  GrammarInitContextCache(std::shared_ptr<const TokenTable> token_table,
+                          const std::string& cache_dir = "", int max_num_schemas = 64,
+                          const std::string& precompiled_path = "");
 
   TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(GrammarInitContextCache, ObjectRef,
                                         GrammarInitContextCacheNode);
@@ -6,11 +6,29 @@
 #ifndef MLC_LLM_SERVE_GRAMMAR_GRAMMAR_STATE_MATCHER_PREPROC_H_
 #define MLC_LLM_SERVE_GRAMMAR_GRAMMAR_STATE_MATCHER_PREPROC_H_
 
+#include <dmlc/memory_io.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "../../support/encoding.h"
+#include "../../support/hash.h"
+#include "../../support/json_parser.h"
 #include "../../support/utils.h"
+#include "../../token_table.h"
 #include "grammar.h"
+#include "grammar_parser.h"
+#include "grammar_serializer.h"
 #include "grammar_state_matcher_base.h"
 
 namespace mlc {
@@ -27,8 +45,9 @@ using namespace tvm::runtime;
  * Uncertain: tokens that need the state of the parent RulePositions to determine if acceptable
  *
  * \note uncertain indices are stored directly. Accepted / rejected indices have three ways to
- * store to reduce memory and computation usage. See SaveType.
- * \note These indices are the indices of sorted_token_table in the GrammarStateInitContext
+ * store to reduce memory and computation usage. See SaveType. The index sets are stored as
+ * CompactIntset, which keeps the runs of adjacent indices when they take less memory.
+ * \note These indices are the indices of sorted_token_ids in the GrammarStateInitContext
  * object, instead of the token ids. That helps the matching process.
  */
 struct CatagorizedTokens {
@@ -47,16 +66,15 @@ struct CatagorizedTokens {
 
   static constexpr int USE_BITSET_THRESHOLD = 200;
 
-  std::vector<int32_t> accepted_indices;
-  std::vector<int32_t> rejected_indices;
+  CompactIntset accepted_indices;
+  CompactIntset rejected_indices;
   DynamicBitset accepted_bitset;
 
-  std::vector<int32_t> uncertain_indices;
+  CompactIntset uncertain_indices;
 
   CatagorizedTokens() = default;
 
-  CatagorizedTokens(int vocab_size,
-                    const std::vector<std::pair<int32_t, std::string>>& sorted_token_table,
+  CatagorizedTokens(int vocab_size, const std::vector<int32_t>& sorted_token_ids,
                     const std::vector<int32_t>& accepted_indices,
                     const std::vector<int32_t>& rejected_indices,
                     const std::vector<int32_t>& uncertain_indices);
@@ -74,10 +92,13 @@ class GrammarStateInitContext {
   /*! \brief The vocabulary size of the tokenizer. Special tokens are included. */
   size_t vocab_size;
   /*! \brief The token table. Special tokens are included. */
-  std::vector<std::string> token_table;
-  /*! \brief All (id, token) pairs sorted in lexicographic order. This sorting is done to
-   * maximize prefix reuse during matching. Special tokens and stop tokens are not included. */
-  std::vector<std::pair<int32_t, std::string>> sorted_token_table;
+  std::shared_ptr<const TokenTable> token_table;
+  /*! \brief The hash of the token table, which identifies it in the grammar caches. */
+  uint64_t token_table_hash = 0;
+  /*! \brief The token ids sorted in lexicographic order of the tokens. This sorting is done to
+   * maximize prefix reuse during matching. Special tokens and stop tokens are not included. It
+   * is shared by the init contexts of the same token table. */
+  std::shared_ptr<const std::vector<int32_t>> sorted_token_ids;
   /*! \brief The stop tokens. When the GrammarStateMatcher can reach the end of the= grammar,
    * stop tokens can be accepted. */
   std::vector<int32_t> stop_token_ids;
@@ -110,6 +131,37 @@ class GrammarStateInitContext {
   /*! \brief Mapping from RulePositions to the catagorized tokens. */
   std::unordered_map<RulePosition, CatagorizedTokens, RulePositionHash, RulePositionEqual>
       catagorized_tokens_for_grammar;
+
+  /******************* Compiled token bitmasks *******************/
+
+  struct StackStateHash {
+    std::size_t operator()(const std::vector<int32_t>& stack_state) const noexcept {
+      uint32_t seed = 0;
+      for (int32_t value : stack_state) {
+        HashCombineBinary(seed, value);
+      }
+      return seed;
+    }
+  };
+
+  /*! \brief The maximum number of bytes of the bitmasks in token_bitmask_cache. */
+  static constexpr int64_t kMaxTokenBitmaskCacheBytes = 16 * 1024 * 1024;
+
+  /*!
+   * \brief Mapping from the stack states of the matcher to the next token bitmasks. A stack
+   * state is the set of all stacks, each of which is the RulePositions from the stack top to the
+   * root, so it is a state of the DFA determinized from the NPDA lazily. For the regular parts
+   * of the grammar, e.g. the rules from JSON schemas, there are a limited number of such states,
+   * and the bitmask is looked up without matching the uncertain tokens again. The cache is shared
+   * by all the matchers of the grammar, and is cleared when it exceeds
+   * kMaxTokenBitmaskCacheBytes.
+   */
+  std::unordered_map<std::vector<int32_t>, std::vector<uint32_t>, StackStateHash>
+      token_bitmask_cache;
+  /*! \brief The number of bytes of the bitmasks in token_bitmask_cache. */
+  int64_t token_bitmask_cache_bytes = 0;
+  /*! \brief The mutex of token_bitmask_cache, since the matchers may run in parallel. */
+  std::mutex token_bitmask_cache_mutex;
 };
 
 /*! \brief The concrete implementation of GrammarStateMatcherNode. */
@@ -126,16 +178,16 @@ class GrammarStateMatcherForInitContext : public GrammarStateMatcherBase {
    * \param consider_parent_rule Whether to consider the parent rule. If false, there will be
    * no uncertain tokens. Useful for the main rule.
    */
-  CatagorizedTokens GetCatagorizedTokens(
-      int vocab_size, const std::vector<std::pair<int32_t, std::string>>& sorted_token_table,
-      bool consider_parent_rule);
+  CatagorizedTokens GetCatagorizedTokens(const TokenTable& token_table,
+                                         const std::vector<int32_t>& sorted_token_ids,
+                                         bool consider_parent_rule);
 
  private:
   using RuleExpr = BNFGrammarNode::RuleExpr;
   using RuleExprType = BNFGrammarNode::RuleExprType;
 
   /*! \brief Check if a token can pass the lookahead assertion. */
-  bool IsTokenPassLookaheadAssertion(const std::string& token,
+  bool IsTokenPassLookaheadAssertion(std::string_view token,
                                      const std::vector<bool>& can_reach_end_stack);
 
   // The id of the initial rule.
@@ -150,7 +202,7 @@ class GrammarStateMatcherForInitContext : public GrammarStateMatcherBase {
 };
 
 inline CatagorizedTokens::CatagorizedTokens(
-    int vocab_size, const std::vector<std::pair<int32_t, std::string>>& sorted_token_table,
+    int vocab_size, const std::vector<int32_t>& sorted_token_ids,
     const std::vector<int32_t>& accepted_indices, const std::vector<int32_t>& rejected_indices,
     const std::vector<int32_t>& uncertain_indices) {
   auto size_acc = accepted_indices.size();
@@ -164,19 +216,19 @@ inline CatagorizedTokens::CatagorizedTokens(
   if (save_type == SaveType::kAcceptedBitset) {
     accepted_bitset = DynamicBitset(vocab_size);
     for (auto idx : accepted_indices) {
-      accepted_bitset.Set(sorted_token_table[idx].first, true);
+      accepted_bitset.Set(sorted_token_ids[idx], true);
     }
   } else if (save_type == SaveType::kAccepted) {
-    this->accepted_indices = accepted_indices;
+    this->accepted_indices = CompactIntset(accepted_indices);
   } else {
-    this->rejected_indices = rejected_indices;
+    this->rejected_indices = CompactIntset(rejected_indices);
   }
 
-  this->uncertain_indices = uncertain_indices;
+  this->uncertain_indices = CompactIntset(uncertain_indices);
 }
 
 bool GrammarStateMatcherForInitContext::IsTokenPassLookaheadAssertion(
-    const std::string& token, const std::vector<bool>& can_reach_end_stack) {
+    std::string_view token, const std::vector<bool>& can_reach_end_stack) {
   auto lookahead_assertion_id = grammar_->GetRule(init_rule_id).lookahead_assertion_id;
   if (lookahead_assertion_id == -1) {
     return true;
@@ -219,7 +271,7 @@ bool GrammarStateMatcherForInitContext::IsTokenPassLookaheadAssertion(
 }
 
 inline CatagorizedTokens GrammarStateMatcherForInitContext::GetCatagorizedTokens(
-    int vocab_size, const std::vector<std::pair<int32_t, std::string>>& sorted_token_table,
+    const TokenTable& token_table, const std::vector<int32_t>& sorted_token_ids,
     bool consider_parent_rule) {
   tmp_accepted_indices_.clear();
   tmp_rejected_indices_.clear();
@@ -231,15 +283,15 @@ inline CatagorizedTokens GrammarStateMatcherForInitContext::GetCatagorizedTokens
   tmp_can_reach_end_prefix_or_stack_.assign({tmp_can_reach_end_stack_.back()});
 
   int prev_matched_size = 0;
-  for (int i = 0; i < static_cast<int>(sorted_token_table.size()); ++i) {
-    const auto& token = sorted_token_table[i].second;
+  for (int i = 0; i < static_cast<int>(sorted_token_ids.size()); ++i) {
+    std::string_view token = token_table[sorted_token_ids[i]];
 
     bool accepted = true;
 
     // Many tokens may contain the same prefix, so we will avoid unnecessary matching
     // by finding the longest common prefix with the previous token.
     if (i > 0) {
-      const auto& prev_token = sorted_token_table[i - 1].second;
+      std::string_view prev_token = token_table[sorted_token_ids[i - 1]];
       int lcp_len =
           std::mismatch(token.begin(), token.end(), prev_token.begin(), prev_token.end()).first -
           token.begin();
@@ -290,25 +342,34 @@ inline CatagorizedTokens GrammarStateMatcherForInitContext::GetCatagorizedTokens
   }
   // Rollback the last matched part
   RollbackChars(prev_matched_size);
-  return CatagorizedTokens(vocab_size, sorted_token_table, tmp_accepted_indices_,
+  return CatagorizedTokens(token_table.size(), sorted_token_ids, tmp_accepted_indices_,
                            tmp_rejected_indices_, tmp_uncertain_indices_);
 }
 
-inline std::shared_ptr<GrammarStateInitContext> GrammarStateMatcher::CreateInitContext(
-    const BNFGrammar& grammar, const std::vector<std::string>& token_table) {
-  using RuleExprType = BNFGrammarNode::RuleExprType;
-  auto ptr = std::make_shared<GrammarStateInitContext>();
-
-  ptr->grammar = grammar;
-  ptr->vocab_size = token_table.size();
-  ptr->token_table = token_table;
-
-  if (ptr->vocab_size == 0) {
-    return ptr;
+/*! \brief Get the hash of a token table, which identifies the token table in the grammar caches. */
+inline uint64_t GetTokenTableHash(const TokenTable& token_table) {
+  uint64_t hash = kFNV1aHashOffsetBasis;
+  UpdateFNV1aHash(&hash, std::to_string(token_table.size()));
+  for (int32_t i = 0; i < token_table.size(); ++i) {
+    UpdateFNV1aHash(&hash, token_table[i]);
   }
+  return hash;
+}
+
+/*!
+ * \brief Create the init context holding only the information about the tokenizer, i.e. without
+ * the grammar and the catagorized tokens. It is cheap compared with the catagorization, as the
+ * tokens are sorted in the token table already.
+ */
+inline std::shared_ptr<GrammarStateInitContext> CreateTokenizerInitContext(
+    std::shared_ptr<const TokenTable> token_table) {
+  auto ptr = std::make_shared<GrammarStateInitContext>();
+  ptr->vocab_size = token_table->size();
+  ptr->token_table_hash = GetTokenTableHash(*token_table);
 
-  for (int i = 0; i < token_table.size(); ++i) {
-    const auto& token = token_table[i];
+  std::vector<bool> is_sorted_token(token_table->size(), false);
+  for (int i = 0; i < token_table->size(); ++i) {
+    std::string_view token = (*token_table)[i];
     // LLaMA2: </s>
     // LLaMA3: <|end_of_text|>, <|eot_id|>
     // Phi-2: <|endoftext|>
@@ -316,20 +377,56 @@ inline std::shared_ptr<GrammarStateInitContext> GrammarStateMatcher::CreateInitC
     if (token == "</s>" || token == "<|end_of_text|>" || token == "<|eot_id|>" ||
         token == "<|endoftext|>" || token == "<eos>" || token == "<end_of_turn>") {
       ptr->stop_token_ids.push_back(i);
-    } else if ((token[0] == '<' && token.back() == '>' && token.size() >= 3) ||
+    } else if ((token.size() >= 3 && token[0] == '<' && token.back() == '>') ||
                token == "[@BOS@]") {
       // gemma treats [@BOS@] as a special token
       ptr->special_token_ids.insert(i);
     } else {
-      ptr->sorted_token_table.push_back({i, token});
+      is_sorted_token[i] = true;
     }
   }
 
-  auto f_compare_token = [](const std::pair<int32_t, std::string>& a,
-                            const std::pair<int32_t, std::string>& b) {
-    return a.second < b.second;
-  };
-  std::sort(ptr->sorted_token_table.begin(), ptr->sorted_token_table.end(), f_compare_token);
+  auto sorted_token_ids = std::make_shared<std::vector<int32_t>>();
+  const int32_t* all_sorted_token_ids = token_table->SortedTokenIds();
+  for (int i = 0; i < token_table->size(); ++i) {
+    if (is_sorted_token[all_sorted_token_ids[i]]) {
+      sorted_token_ids->push_back(all_sorted_token_ids[i]);
+    }
+  }
+  ptr->sorted_token_ids = std::move(sorted_token_ids);
+  ptr->token_table = std::move(token_table);
+  return ptr;
+}
+
+/*!
+ * \brief Share the tokenizer information of an init context with another init context of the
+ * same token table.
+ */
+inline void CopyTokenizerInfo(const GrammarStateInitContext& tokenizer_info,
+                              GrammarStateInitContext* init_ctx) {
+  init_ctx->vocab_size = tokenizer_info.vocab_size;
+  init_ctx->token_table = tokenizer_info.token_table;
+  init_ctx->token_table_hash = tokenizer_info.token_table_hash;
+  init_ctx->sorted_token_ids = tokenizer_info.sorted_token_ids;
+  init_ctx->stop_token_ids = tokenizer_info.stop_token_ids;
+  init_ctx->special_token_ids = tokenizer_info.special_token_ids;
+}
+
+/*!
+ * \brief Create the init context of a grammar, sharing the tokenizer information of the given
+ * init context.
+ * \sa GrammarStateMatcher::CreateInitContext
+ */
+inline std::shared_ptr<GrammarStateInitContext> CreateInitContextWithTokenizerInfo(
+    const BNFGrammar& grammar, const GrammarStateInitContext& tokenizer_info) {
+  using RuleExprType = BNFGrammarNode::RuleExprType;
+  auto ptr = std::make_shared<GrammarStateInitContext>();
+  CopyTokenizerInfo(tokenizer_info, ptr.get());
+  ptr->grammar = grammar;
+
+  if (ptr->vocab_size == 0) {
+    return ptr;
+  }
 
   // Find the corresponding catagorized tokens for:
   // 1. All character class or character class star (with last_utf8_bytes=0, 1, 2, 3)
@@ -354,7 +451,7 @@ inline std::shared_ptr<GrammarStateInitContext> GrammarStateMatcher::CreateInitC
         auto add_catagorized_tokens = [&](const RulePosition& rule_position) {
           auto grammar_state_matcher = GrammarStateMatcherForInitContext(grammar, rule_position);
           auto cur_catagorized_tokens_for_grammar = grammar_state_matcher.GetCatagorizedTokens(
-              ptr->vocab_size, ptr->sorted_token_table, rule_id != main_rule_id);
+              *ptr->token_table, *ptr->sorted_token_ids, rule_id != main_rule_id);
           ptr->catagorized_tokens_for_grammar[rule_position] = cur_catagorized_tokens_for_grammar;
         };
 
@@ -378,9 +475,386 @@ inline std::shared_ptr<GrammarStateInitContext> GrammarStateMatcher::CreateInitC
   return ptr;
 }
 
+inline std::shared_ptr<GrammarStateInitContext> GrammarStateMatcher::CreateInitContext(
+    const BNFGrammar& grammar, const std::vector<std::string>& token_table) {
+  return CreateInitContextWithTokenizerInfo(
+      grammar, *CreateTokenizerInitContext(TokenTable::FromTokens(token_table)));
+}
+
+/*! \brief The magic number at the beginning of the init context cache files. */
+constexpr uint64_t kGrammarInitContextMagic = 0x4D4C434749435832;  // "MLCGICX2"
+
+/*! \brief Write the catagorized tokens of every RulePosition of the init context. */
+inline void WriteCatagorizedTokens(dmlc::Stream* stream, const GrammarStateInitContext& init_ctx) {
+  stream->Write(static_cast<uint64_t>(init_ctx.catagorized_tokens_for_grammar.size()));
+  for (const auto& [rule_position, catagorized_tokens] : init_ctx.catagorized_tokens_for_grammar) {
+    stream->Write(std::vector<int32_t>{rule_position.rule_id, rule_position.sequence_id,
+                                       rule_position.element_id, rule_position.left_utf8_bytes,
+                                       rule_position.element_in_string});
+    stream->Write(static_cast<int32_t>(catagorized_tokens.save_type));
+    for (const CompactIntset* intset :
+         {&catagorized_tokens.accepted_indices, &catagorized_tokens.rejected_indices,
+          &catagorized_tokens.uncertain_indices}) {
+      stream->Write(static_cast<int32_t>(intset->IsRuns()));
+      stream->Write(intset->Data());
+    }
+    const DynamicBitset& bitset = catagorized_tokens.accepted_bitset;
+    stream->Write(std::vector<uint32_t>(
+        bitset.Data(), bitset.Data() + DynamicBitset::CalculateBufferSize(bitset.Size())));
+  }
+}
+
+/*!
+ * \brief Read the catagorized tokens written by WriteCatagorizedTokens into the init context,
+ * whose tokenizer information is already set.
+ * \return Whether the catagorized tokens are read successfully.
+ */
+inline bool ReadCatagorizedTokens(dmlc::Stream* stream, GrammarStateInitContext* init_ctx) {
+  uint64_t num_rule_positions = 0;
+  if (!stream->Read(&num_rule_positions)) {
+    return false;
+  }
+  int num_sorted_tokens = init_ctx->sorted_token_ids->size();
+  auto f_read_intset = [&](CompactIntset* intset) {
+    int32_t is_runs = 0;
+    std::vector<int32_t> data;
+    return stream->Read(&is_runs) && stream->Read(&data) &&
+           CompactIntset::FromData(is_runs, std::move(data), num_sorted_tokens, intset);
+  };
+  for (uint64_t i = 0; i < num_rule_positions; ++i) {
+    std::vector<int32_t> fields;
+    int32_t save_type = 0;
+    CatagorizedTokens catagorized_tokens;
+    std::vector<uint32_t> bitset_data;
+    if (!stream->Read(&fields) || fields.size() != 5 || !stream->Read(&save_type) ||
+        save_type < 0 || save_type > 2 || !f_read_intset(&catagorized_tokens.accepted_indices) ||
+        !f_read_intset(&catagorized_tokens.rejected_indices) ||
+        !f_read_intset(&catagorized_tokens.uncertain_indices) || !stream->Read(&bitset_data)) {
+      return false;
+    }
+    catagorized_tokens.save_type = static_cast<CatagorizedTokens::SaveType>(save_type);
+    if (catagorized_tokens.save_type == CatagorizedTokens::SaveType::kAcceptedBitset) {
+      if (bitset_data.size() != DynamicBitset::CalculateBufferSize(init_ctx->vocab_size)) {
+        return false;
+      }
+      catagorized_tokens.accepted_bitset = DynamicBitset(init_ctx->vocab_size);
+      std::copy(bitset_data.begin(), bitset_data.end(), catagorized_tokens.accepted_bitset.Data());
+    }
+    RulePosition rule_position(fields[0], fields[1], fields[2]);
+    rule_position.left_utf8_bytes = fields[3];
+    rule_position.element_in_string = fields[4];
+    init_ctx->catagorized_tokens_for_grammar[rule_position] = std::move(catagorized_tokens);
+  }
+  return true;
+}
+
+/*!
+ * \brief Serialize the grammar-specific part of the init context, i.e. the catagorized tokens,
+ * together with the grammar for validation. The tokenizer information is not saved, as it is
+ * shared by all the init contexts of the same token table.
+ * \param init_ctx The init context to serialize.
+ * \param key The key of the init context.
+ * \param schema The JSON schema of the grammar.
+ * \return The serialized bytes.
+ */
+inline std::string SerializeInitContext(const GrammarStateInitContext& init_ctx,
+                                        const std::string& key, const std::string& schema) {
+  std::string data;
+  dmlc::MemoryStringStream stream(&data);
+  stream.Write(kGrammarInitContextMagic);
+  stream.Write(key);
+  stream.Write(schema);
+  stream.Write(BNFGrammarJSONSerializer(init_ctx.grammar, false).ToString());
+  stream.Write(static_cast<uint64_t>(init_ctx.vocab_size));
+  WriteCatagorizedTokens(&stream, init_ctx);
+  return data;
+}
+
+/*!
+ * \brief Deserialize the init context saved by SerializeInitContext.
+ * \param data The serialized bytes.
+ * \param key The expected key of the init context.
+ * \param schema The expected JSON schema of the grammar.
+ * \param grammar The grammar of the schema, which must be the same as the saved one.
+ * \param tokenizer_info An init context of the same token table to copy the tokenizer
+ * information from.
+ * \return The init context, or nullptr if the data is invalid or does not match.
+ */
+inline std::shared_ptr<GrammarStateInitContext> DeserializeInitContext(
+    std::string* data, const std::string& key, const std::string& schema,
+    const BNFGrammar& grammar, const GrammarStateInitContext& tokenizer_info) {
+  dmlc::MemoryStringStream stream(data);
+  uint64_t magic = 0;
+  std::string saved_key;
+  std::string saved_schema;
+  std::string saved_grammar;
+  uint64_t vocab_size = 0;
+  // The grammar converted from the schema may change across versions, which invalidates the
+  // saved token sets.
+  if (!stream.Read(&magic) || magic != kGrammarInitContextMagic || !stream.Read(&saved_key) ||
+      saved_key != key || !stream.Read(&saved_schema) || saved_schema != schema ||
+      !stream.Read(&saved_grammar) ||
+      saved_grammar != BNFGrammarJSONSerializer(grammar, false).ToString() ||
+      !stream.Read(&vocab_size) || vocab_size != tokenizer_info.vocab_size) {
+    return nullptr;
+  }
+
+  auto ptr = std::make_shared<GrammarStateInitContext>();
+  ptr->grammar = grammar;
+  CopyTokenizerInfo(tokenizer_info, ptr.get());
+  if (!ReadCatagorizedTokens(&stream, ptr.get())) {
+    return nullptr;
+  }
+  return ptr;
+}
+
+/*! \brief The version of the compiled grammar format written by SerializeCompiledGrammar. */
+constexpr int64_t kCompiledGrammarVersion = 1;
+
+/*!
+ * \brief Serialize the init context of a JSON schema to a compiled grammar, which is loaded at
+ * startup so that the schema is neither converted nor preprocessed at the first request.
+ * \details The format extends the JSON format of BNFGrammarJSONSerializer with the schema, the
+ * token table hash, and the catagorized tokens of every RulePosition:
+ *  {
+ *    "rules": ..., "rule_expr_data": ..., "rule_expr_indptr": ..., "main_rule_id": ...,
+ *    "compiled_grammar_version": 1,
+ *    "schema": "...",
+ *    "token_table_hash": "<16 hex digits>",
+ *    "vocab_size": integer,
+ *    "catagorized_tokens": [
+ *      {
+ *        "rule_position": [rule_id, sequence_id, element_id, left_utf8_bytes, element_in_string],
+ *        "save_type": integer,
+ *        "accepted_indices": {"is_runs": bool, "data": [integers...]},
+ *        "rejected_indices": {"is_runs": bool, "data": [integers...]},
+ *        "uncertain_indices": {"is_runs": bool, "data": [integers...]},
+ *        "accepted_bitset": [integers...]
+ *      },
+ *      ...
+ *    ]
+ *  }
+ * \param init_ctx The init context to serialize.
+ * \param schema The JSON schema of the grammar.
+ * \param prettify Whether to format the JSON string.
+ * \return The compiled grammar in JSON format.
+ */
+inline std::string SerializeCompiledGrammar(const GrammarStateInitContext& init_ctx,
+                                            const std::string& schema, bool prettify) {
+  picojson::object compiled_json = BNFGrammarJSONSerializer(init_ctx.grammar).ToJSONObject();
+  compiled_json["compiled_grammar_version"] = picojson::value(kCompiledGrammarVersion);
+  compiled_json["schema"] = picojson::value(schema);
+  compiled_json["token_table_hash"] = picojson::value(FNV1aHashToString(init_ctx.token_table_hash));
+  compiled_json["vocab_size"] = picojson::value(static_cast<int64_t>(init_ctx.vocab_size));
+
+  auto f_int_array = [](const int32_t* begin, const int32_t* end) {
+    picojson::array array;
+    array.reserve(end - begin);
+    for (const int32_t* it = begin; it != end; ++it) {
+      array.push_back(picojson::value(static_cast<int64_t>(*it)));
+    }
+    return picojson::value(array);
+  };
+  auto f_intset = [&](const CompactIntset& intset) {
+    picojson::object intset_json;
+    intset_json["is_runs"] = picojson::value(intset.IsRuns());
+    const std::vector<int32_t>& data = intset.Data();
+    intset_json["data"] = f_int_array(data.data(), data.data() + data.size());
+    return picojson::value(intset_json);
+  };
+  picojson::array catagorized_tokens_json;
+  for (const auto& [rule_position, catagorized_tokens] : init_ctx.catagorized_tokens_for_grammar) {
+    picojson::object entry;
+    std::vector<int32_t> fields{rule_position.rule_id, rule_position.sequence_id,
+                                rule_position.element_id, rule_position.left_utf8_bytes,
+                                rule_position.element_in_string};
+    entry["rule_position"] = f_int_array(fields.data(), fields.data() + fields.size());
+    entry["save_type"] = picojson::value(static_cast<int64_t>(catagorized_tokens.save_type));
+    entry["accepted_indices"] = f_intset(catagorized_tokens.accepted_indices);
+    entry["rejected_indices"] = f_intset(catagorized_tokens.rejected_indices);
+    entry["uncertain_indices"] = f_intset(catagorized_tokens.uncertain_indices);
+    const DynamicBitset& bitset = catagorized_tokens.accepted_bitset;
+    picojson::array bitset_json;
+    for (int i = 0; i < DynamicBitset::CalculateBufferSize(bitset.Size()); ++i) {
+      bitset_json.push_back(picojson::value(static_cast<int64_t>(bitset.Data()[i])));
+    }
+    entry["accepted_bitset"] = picojson::value(bitset_json);
+    catagorized_tokens_json.push_back(picojson::value(entry));
+  }
+  compiled_json["catagorized_tokens"] = picojson::value(catagorized_tokens_json);
+  return picojson::value(compiled_json).serialize(prettify);
+}
+
+/*!
+ * \brief Deserialize the compiled grammar written by SerializeCompiledGrammar. The grammar is
+ * parsed from the compiled grammar directly, so the schema is not converted again.
+ * \param compiled_grammar The compiled grammar in JSON format.
+ * \param tokenizer_info An init context of the token table to copy the tokenizer information
+ * from. The compiled grammar must be compiled with the same token table.
+ * \param schema The JSON schema of the compiled grammar, as the output.
+ * \return The init context, or nullptr if the compiled grammar is compiled with another token
+ * table or another version. Throws if the compiled grammar is malformed.
+ */
+inline std::shared_ptr<GrammarStateInitContext> DeserializeCompiledGrammar(
+    const std::string& compiled_grammar, const GrammarStateInitContext& tokenizer_info,
+    std::string* schema) {
+  picojson::object compiled_json = json::ParseToJSONObject(compiled_grammar);
+  if (json::LookupOrDefault<int64_t>(compiled_json, "compiled_grammar_version", 0) !=
+          kCompiledGrammarVersion ||
+      json::Lookup<std::string>(compiled_json, "token_table_hash") !=
+          FNV1aHashToString(tokenizer_info.token_table_hash) ||
+      json::Lookup<int64_t>(compiled_json, "vocab_size") !=
+          static_cast<int64_t>(tokenizer_info.vocab_size)) {
+    return nullptr;
+  }
+  *schema = json::Lookup<std::string>(compiled_json, "schema");
+
+  auto ptr = std::make_shared<GrammarStateInitContext>();
+  ptr->grammar = BNFJSONParser::Parse(compiled_json);
+  CopyTokenizerInfo(tokenizer_info, ptr.get());
+  int num_sorted_tokens = ptr->sorted_token_ids->size();
+
+  auto f_int_vector = [](const picojson::array& array) {
+    std::vector<int32_t> result;
+    result.reserve(array.size());
+    for (const picojson::value& value : array) {
+      CHECK(value.is<int64_t>()) << "The compiled grammar has a non-integer index.";
+      result.push_back(static_cast<int32_t>(value.get<int64_t>()));
+    }
+    return result;
+  };
+  auto f_intset = [&](const picojson::object& entry, const std::string& key) {
+    picojson::object intset_json = json::Lookup<picojson::object>(entry, key);
+    CompactIntset intset;
+    CHECK(CompactIntset::FromData(json::Lookup<bool>(intset_json, "is_runs"),
+                                  f_int_vector(json::Lookup<picojson::array>(intset_json, "data")),
+                                  num_sorted_tokens, &intset))
+        << "The compiled grammar has invalid \"" << key << "\".";
+    return intset;
+  };
+  for (const picojson::value& entry_json :
+       json::Lookup<picojson::array>(compiled_json, "catagorized_tokens")) {
+    CHECK(entry_json.is<picojson::object>()) << "The compiled grammar has a non-object entry.";
+    const picojson::object& entry = entry_json.get<picojson::object>();
+    std::vector<int32_t> fields =
+        f_int_vector(json::Lookup<picojson::array>(entry, "rule_position"));
+    int64_t save_type = json::Lookup<int64_t>(entry, "save_type");
+    CHECK(fields.size() == 5 && save_type >= 0 && save_type <= 2)
+        << "The compiled grammar has an invalid rule position.";
+    CatagorizedTokens catagorized_tokens;
+    catagorized_tokens.save_type = static_cast<CatagorizedTokens::SaveType>(save_type);
+    catagorized_tokens.accepted_indices = f_intset(entry, "accepted_indices");
+    catagorized_tokens.rejected_indices = f_intset(entry, "rejected_indices");
+    catagorized_tokens.uncertain_indices = f_intset(entry, "uncertain_indices");
+    if (catagorized_tokens.save_type == CatagorizedTokens::SaveType::kAcceptedBitset) {
+      picojson::array bitset_json = json::Lookup<picojson::array>(entry, "accepted_bitset");
+      CHECK_EQ(static_cast<int>(bitset_json.size()),
+               DynamicBitset::CalculateBufferSize(ptr->vocab_size))
+          << "The compiled grammar has an invalid accepted bitset.";
+      catagorized_tokens.accepted_bitset = DynamicBitset(ptr->vocab_size);
+      for (int i = 0; i < static_cast<int>(bitset_json.size()); ++i) {
+        CHECK(bitset_json[i].is<int64_t>()) << "The compiled grammar has an invalid bitset word.";
+        catagorized_tokens.accepted_bitset.Data()[i] =
+            static_cast<uint32_t>(bitset_json[i].get<int64_t>());
+      }
+    }
+    RulePosition rule_position(fields[0], fields[1], fields[2]);
+    rule_position.left_utf8_bytes = fields[3];
+    rule_position.element_in_string = fields[4];
+    ptr->catagorized_tokens_for_grammar[rule_position] = std::move(catagorized_tokens);
+  }
+  return ptr;
+}
+
+/*! \brief The magic number at the beginning of compiled grammars in the binary format. */
+constexpr uint64_t kCompiledGrammarBinaryMagic = 0x4D4C434743474231;  // "MLCGCGB1"
+
+/*!
+ * \brief Serialize the init context of a JSON schema to a compiled grammar in the binary format.
+ * It holds the same information as SerializeCompiledGrammar, with the token sets stored as raw
+ * integers, so it is several times smaller and is loaded without JSON parsing. It suits the
+ * runtimes that load the compiled grammars from memory, e.g. the web runtime loading them from
+ * an ArrayBuffer shipped with the model.
+ * \param init_ctx The init context to serialize.
+ * \param schema The JSON schema of the grammar, or empty for the built-in JSON grammar.
+ * \return The compiled grammar in the binary format.
+ */
+inline std::string SerializeCompiledGrammarBinary(const GrammarStateInitContext& init_ctx,
+                                                  const std::string& schema) {
+  std::string data;
+  dmlc::MemoryStringStream stream(&data);
+  stream.Write(kCompiledGrammarBinaryMagic);
+  stream.Write(kCompiledGrammarVersion);
+  stream.Write(init_ctx.token_table_hash);
+  stream.Write(static_cast<uint64_t>(init_ctx.vocab_size));
+  stream.Write(schema);
+  stream.Write(BNFGrammarJSONSerializer(init_ctx.grammar, false).ToString());
+  WriteCatagorizedTokens(&stream, init_ctx);
+  return data;
+}
+
+/*! \brief Whether the compiled grammar is in the binary format. */
+inline bool IsCompiledGrammarBinary(const std::string& compiled_grammar) {
+  uint64_t magic = 0;
+  if (compiled_grammar.size() < sizeof(magic)) {
+    return false;
+  }
+  std::memcpy(&magic, compiled_grammar.data(), sizeof(magic));
+  return magic == kCompiledGrammarBinaryMagic;
+}
+
+/*!
+ * \brief Deserialize the compiled grammar written by SerializeCompiledGrammarBinary.
+ * \param compiled_grammar The compiled grammar in the binary format.
+ * \param tokenizer_info An init context of the token table to copy the tokenizer information
+ * from. The compiled grammar must be compiled with the same token table.
+ * \param schema The JSON schema of the compiled grammar, as the output.
+ * \return The init context, or nullptr if the compiled grammar is compiled with another token
+ * table or another version. Throws if the compiled grammar is malformed.
+ */
+inline std::shared_ptr<GrammarStateInitContext> DeserializeCompiledGrammarBinary(
+    std::string* compiled_grammar, const GrammarStateInitContext& tokenizer_info,
+    std::string* schema) {
+  dmlc::MemoryStringStream stream(compiled_grammar);
+  uint64_t magic = 0;
+  int64_t version = 0;
+  uint64_t token_table_hash = 0;
+  uint64_t vocab_size = 0;
+  CHECK(stream.Read(&magic) && magic == kCompiledGrammarBinaryMagic && stream.Read(&version))
+      << "The compiled grammar is malformed.";
+  if (version != kCompiledGrammarVersion || !stream.Read(&token_table_hash) ||
+      token_table_hash != tokenizer_info.token_table_hash ||
+      !stream.Read(&vocab_size) || vocab_size != tokenizer_info.vocab_size) {
+    return nullptr;
+  }
+  std::string grammar_json;
+  CHECK(stream.Read(schema) && stream.Read(&grammar_json)) << "The compiled grammar is malformed.";
+
+  auto ptr = std::make_shared<GrammarStateInitContext>();
+  ptr->grammar = BNFJSONParser::Parse(grammar_json);
+  CopyTokenizerInfo(tokenizer_info, ptr.get());
+  CHECK(ReadCatagorizedTokens(&stream, ptr.get())) << "The compiled grammar is malformed.";
+  return ptr;
+}
+
+/*!
+ * \brief Deserialize the compiled grammar in either the JSON format or the binary format.
+ * \sa DeserializeCompiledGrammar, DeserializeCompiledGrammarBinary
+ */
+inline std::shared_ptr<GrammarStateInitContext> DeserializeCompiledGrammarAnyFormat(
+    std::string* compiled_grammar, const GrammarStateInitContext& tokenizer_info,
+    std::string* schema) {
+  if (IsCompiledGrammarBinary(*compiled_grammar)) {
+    return DeserializeCompiledGrammarBinary(compiled_grammar, tokenizer_info, schema);
+  }
+  return DeserializeCompiledGrammar(*compiled_grammar, tokenizer_info, schema);
+}
+
 class GrammarInitContextCacheImpl : public GrammarInitContextCacheNode {
  public:
-  GrammarInitContextCacheImpl(const std::vector<std::string>& token_table);
+  GrammarInitContextCacheImpl(std::shared_ptr<const TokenTable> token_table,
+                              const std::string& cache_dir, int max_num_schemas,
+                              const std::string& precompiled_path);
 
   std::shared_ptr<GrammarStateInitContext> GetInitContextForJSONSchema(
       const std::string& schema) final;
@@ -390,31 +864,94 @@ class GrammarInitContextCacheImpl : public GrammarInitContextCacheNode {
   void Clear() final;
 
  private:
-  /*! \brief The token table associated with this storage class. */
-  std::vector<std::string> token_table_;
-  /*! \brief The cache for the init context of a JSON schema. */
-  std::unordered_map<std::string, std::shared_ptr<GrammarStateInitContext>>
+  /*! \brief Get the key of the init context for a schema in the on-disk cache. */
+  std::string GetOnDiskKey(const std::string& schema) const;
+
+  /*! \brief Load the init context for a schema from the on-disk cache, or nullptr if missing. */
+  std::shared_ptr<GrammarStateInitContext> LoadFromDisk(const std::string& schema,
+                                                        const BNFGrammar& grammar);
+
+  /*! \brief Save the init context for a schema to the on-disk cache. */
+  void SaveToDisk(const std::string& schema, const GrammarStateInitContext& init_ctx);
+
+  /*!
+   * \brief Load the compiled grammars in a file, or in all the .json and .bin files of a
+   * directory. A compiled grammar with an empty schema is the built-in JSON grammar.
+   */
+  void LoadCompiledGrammars(const std::string& path);
+
+  /*! \brief The directory of the on-disk cache, or empty if disabled. */
+  std::string cache_dir_;
+  /*! \brief The maximum number of init contexts for schemas in memory. */
+  int max_num_schemas_;
+  /*!
+   * \brief The cache for the init context of a JSON schema, with the position of the schema in
+   * the LRU list.
+   */
+  std::unordered_map<std::string, std::pair<std::shared_ptr<GrammarStateInitContext>,
+                                            std::list<std::string>::iterator>>
       init_ctx_for_schema_cache_;
+  /*! \brief The schemas in the cache, from the most recently used to the least. */
+  std::list<std::string> schema_lru_list_;
+  /*!
+   * \brief The init contexts of the compiled grammars loaded at startup, keyed by the schema.
+   * They are never evicted.
+   */
+  std::unordered_map<std::string, std::shared_ptr<GrammarStateInitContext>>
+      precompiled_init_ctx_for_schema_;
+  /*!
+   * \brief The init context holding only the tokenizer information of the token table, which is
+   * shared by all the init contexts created by the cache.
+   */
+  std::shared_ptr<GrammarStateInitContext> tokenizer_info_;
   /*! \brief The init context for JSON. */
   std::shared_ptr<GrammarStateInitContext> init_ctx_for_json_;
 };
 
 inline GrammarInitContextCacheImpl::GrammarInitContextCacheImpl(
-    const std::vector<std::string>& token_table)
-    : token_table_(token_table) {
-  init_ctx_for_json_ =
-      GrammarStateMatcher::CreateInitContext(BNFGrammar::GetGrammarOfJSON(), token_table_);
+    std::shared_ptr<const TokenTable> token_table, const std::string& cache_dir,
+    int max_num_schemas, const std::string& precompiled_path)
+    : cache_dir_(cache_dir), max_num_schemas_(max_num_schemas) {
+  CHECK_GT(max_num_schemas_, 0);
+  tokenizer_info_ = CreateTokenizerInitContext(std::move(token_table));
+  if (!precompiled_path.empty()) {
+    LoadCompiledGrammars(precompiled_path);
+  }
+  // Preprocess the JSON grammar unless it is compiled ahead of time.
+  if (init_ctx_for_json_ == nullptr) {
+    init_ctx_for_json_ =
+        CreateInitContextWithTokenizerInfo(BNFGrammar::GetGrammarOfJSON(), *tokenizer_info_);
+  }
 }
 
 inline std::shared_ptr<GrammarStateInitContext>
 GrammarInitContextCacheImpl::GetInitContextForJSONSchema(const std::string& schema) {
+  auto precompiled_it = precompiled_init_ctx_for_schema_.find(schema);
+  if (precompiled_it != precompiled_init_ctx_for_schema_.end()) {
+    return precompiled_it->second;
+  }
   auto it = init_ctx_for_schema_cache_.find(schema);
   if (it != init_ctx_for_schema_cache_.end()) {
-    return it->second;
+    schema_lru_list_.splice(schema_lru_list_.begin(), schema_lru_list_, it->second.second);
+    return it->second.first;
+  }
+  BNFGrammar grammar = BNFGrammar::FromSchema(schema);
+  std::shared_ptr<GrammarStateInitContext> init_ctx = nullptr;
+  if (!cache_dir_.empty()) {
+    init_ctx = LoadFromDisk(schema, grammar);
+  }
+  if (init_ctx == nullptr) {
+    init_ctx = CreateInitContextWithTokenizerInfo(grammar, *tokenizer_info_);
+    if (!cache_dir_.empty()) {
+      SaveToDisk(schema, *init_ctx);
+    }
+  }
+  if (static_cast<int>(init_ctx_for_schema_cache_.size()) >= max_num_schemas_) {
+    init_ctx_for_schema_cache_.erase(schema_lru_list_.back());
+    schema_lru_list_.pop_back();
   }
-  auto init_ctx =
-      GrammarStateMatcher::CreateInitContext(BNFGrammar::FromSchema(schema), token_table_);
-  init_ctx_for_schema_cache_[schema] = init_ctx;
+  schema_lru_list_.push_front(schema);
+  init_ctx_for_schema_cache_[schema] = {init_ctx, schema_lru_list_.begin()};
   return init_ctx;
 }
 
@@ -423,10 +960,105 @@ GrammarInitContextCacheImpl::GetInitContextForJSON() {
   return init_ctx_for_json_;
 }
 
-inline void GrammarInitContextCacheImpl::Clear() { init_ctx_for_schema_cache_.clear(); }
+inline void GrammarInitContextCacheImpl::Clear() {
+  init_ctx_for_schema_cache_.clear();
+  schema_lru_list_.clear();
+}
+
+inline std::string GrammarInitContextCacheImpl::GetOnDiskKey(const std::string& schema) const {
+  uint64_t hash = tokenizer_info_->token_table_hash;
+  UpdateFNV1aHash(&hash, schema);
+  return FNV1aHashToString(hash);
+}
+
+inline std::shared_ptr<GrammarStateInitContext> GrammarInitContextCacheImpl::LoadFromDisk(
+    const std::string& schema, const BNFGrammar& grammar) {
+  std::string key = GetOnDiskKey(schema);
+  std::ifstream fin(cache_dir_ + "/" + key + ".bin", std::ios::binary);
+  if (!fin.good()) {
+    return nullptr;
+  }
+  std::string data((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+  std::shared_ptr<GrammarStateInitContext> init_ctx =
+      DeserializeInitContext(&data, key, schema, grammar, *tokenizer_info_);
+  if (init_ctx == nullptr) {
+    LOG(WARNING) << "The grammar cache file \"" << cache_dir_ << "/" << key
+                 << ".bin\" is invalid or outdated. It will be overwritten.";
+  }
+  return init_ctx;
+}
+
+inline void GrammarInitContextCacheImpl::SaveToDisk(const std::string& schema,
+                                                    const GrammarStateInitContext& init_ctx) {
+  std::string key = GetOnDiskKey(schema);
+  std::string path = cache_dir_ + "/" + key + ".bin";
+  // Write to a temporary file unique to this process and rename it, so that readers in other
+  // processes never see a partial file.
+  std::ostringstream tmp_path;
+  tmp_path << path << ".tmp" << std::hex
+           << std::chrono::steady_clock::now().time_since_epoch().count()
+           << reinterpret_cast<uintptr_t>(this);
+  std::error_code error;
+  std::filesystem::create_directories(cache_dir_, error);
+  std::string data = SerializeInitContext(init_ctx, key, schema);
+  {
+    std::ofstream fout(tmp_path.str(), std::ios::binary);
+    fout.write(data.data(), data.size());
+    if (!fout.good()) {
+      LOG(WARNING) << "Failed to write the grammar cache file \"" << tmp_path.str() << "\".";
+      fout.close();
+      std::filesystem::remove(tmp_path.str(), error);
+      return;
+    }
+  }
+  std::filesystem::rename(tmp_path.str(), path, error);
+  if (error) {
+    LOG(WARNING) << "Failed to write the grammar cache file \"" << path << "\".";
+    std::filesystem::remove(tmp_path.str(), error);
+  }
+}
+
+inline void GrammarInitContextCacheImpl::LoadCompiledGrammars(const std::string& path) {
+  std::vector<std::string> files;
+  if (std::filesystem::is_directory(path)) {
+    for (const auto& entry : std::filesystem::directory_iterator(path)) {
+      if (entry.is_regular_file() &&
+          (entry.path().extension() == ".json" || entry.path().extension() == ".bin")) {
+        files.push_back(entry.path().string());
+      }
+    }
+    std::sort(files.begin(), files.end());
+  } else {
+    files.push_back(path);
+  }
+  for (const std::string& file : files) {
+    std::ifstream fin(file, std::ios::binary);
+    CHECK(fin.good()) << "Cannot open the compiled grammar file \"" << file << "\".";
+    std::string data((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+    std::string schema;
+    std::shared_ptr<GrammarStateInitContext> init_ctx =
+        DeserializeCompiledGrammarAnyFormat(&data, *tokenizer_info_, &schema);
+    if (init_ctx == nullptr) {
+      LOG(WARNING) << "The compiled grammar file \"" << file
+                   << "\" is compiled with another tokenizer or version. It is skipped.";
+      continue;
+    }
+    if (schema.empty()) {
+      init_ctx_for_json_ = std::move(init_ctx);
+    } else {
+      precompiled_init_ctx_for_schema_[schema] = std::move(init_ctx);
+    }
+  }
+  int num_loaded = precompiled_init_ctx_for_schema_.size() + (init_ctx_for_json_ != nullptr);
+  LOG(INFO) << "Loaded " << num_loaded << " compiled grammars from \"" << path << "\".";
+}
 
-GrammarInitContextCache::GrammarInitContextCache(const std::vector<std::string>& token_table)
-    : ObjectRef(make_object<GrammarInitContextCacheImpl>(token_table)) {}
+GrammarInitContextCache::GrammarInitContextCache(std::shared_ptr<const TokenTable> token_table,
+                                                 const std::string& cache_dir,
+                                                 int max_num_schemas,
+                                                 const std::string& precompiled_path)
+    : ObjectRef(make_object<GrammarInitContextCacheImpl>(std::move(token_table), cache_dir,
+                                                         max_num_schemas, precompiled_path)) {}
 
 }  // namespace serve
 }  // namespace llm
@@ -72,6 +72,9 @@ class DynamicBitset {
 
   int Size() const { return size_; }
 
+  /*! \brief Get the underlying buffer, which has CalculateBufferSize(Size()) elements. */
+  uint32_t* Data() const { return data_; }
+
   void Set(int index, bool value) {
     DCHECK(data_ && index >= 0 && index < size_);
     if (value) {
@@ -107,6 +110,107 @@ class DynamicBitset {
   bool is_internal_;
 };
 
+/*!
+ * \brief A compact set of sorted non-negative integers. The integers are stored either as a
+ * plain list, or as the [begin, end) runs of consecutive integers, whichever takes less memory.
+ * Sets of sorted token table indices are usually made of long runs, since the tokens sharing a
+ * prefix are adjacent in the sorted token table.
+ */
+class CompactIntset {
+ public:
+  CompactIntset() = default;
+
+  /*! \brief Construct the set from sorted and deduplicated integers. */
+  explicit CompactIntset(const std::vector<int32_t>& sorted_values)
+      : size_(sorted_values.size()) {
+    int num_runs = 0;
+    for (int i = 0; i < size_; ++i) {
+      num_runs += i == 0 || sorted_values[i] != sorted_values[i - 1] + 1;
+    }
+    is_runs_ = num_runs * 2 < size_;
+    if (!is_runs_) {
+      data_ = sorted_values;
+      return;
+    }
+    data_.reserve(num_runs * 2);
+    for (int i = 0; i < size_; ++i) {
+      if (i == 0 || sorted_values[i] != sorted_values[i - 1] + 1) {
+        if (i != 0) {
+          data_.push_back(sorted_values[i - 1] + 1);
+        }
+        data_.push_back(sorted_values[i]);
+      }
+    }
+    data_.push_back(sorted_values.back() + 1);
+  }
+
+  /*!
+   * \brief Construct the set from the data returned by Data(), which is validated against the
+   * exclusive upper bound of the integers.
+   * \return Whether the data is valid.
+   */
+  static bool FromData(bool is_runs, std::vector<int32_t> data, int32_t upper_bound,
+                       CompactIntset* result) {
+    if (is_runs && data.size() % 2 != 0) {
+      return false;
+    }
+    int32_t last = -1;
+    int size = 0;
+    for (int i = 0; i < static_cast<int>(data.size()); i += is_runs ? 2 : 1) {
+      int32_t begin = data[i];
+      int32_t end = is_runs ? data[i + 1] : data[i] + 1;
+      if (begin <= last || begin >= end || end > upper_bound) {
+        return false;
+      }
+      last = end - 1;
+      size += end - begin;
+    }
+    result->is_runs_ = is_runs;
+    result->size_ = size;
+    result->data_ = std::move(data);
+    return true;
+  }
+
+  /*! \brief The number of integers in the set. */
+  int Size() const { return size_; }
+
+  bool Empty() const { return size_ == 0; }
+
+  /*! \brief Whether Data() holds the runs of consecutive integers instead of the integers. */
+  bool IsRuns() const { return is_runs_; }
+
+  /*! \brief The integers, or the begin and end of each run when IsRuns() is true. */
+  const std::vector<int32_t>& Data() const { return data_; }
+
+  /*! \brief Call the function on each integer in ascending order. */
+  template <typename FVisit>
+  void ForEach(FVisit f_visit) const {
+    if (!is_runs_) {
+      for (int32_t value : data_) {
+        f_visit(value);
+      }
+      return;
+    }
+    for (int i = 0; i < static_cast<int>(data_.size()); i += 2) {
+      for (int32_t value = data_[i]; value < data_[i + 1]; ++value) {
+        f_visit(value);
+      }
+    }
+  }
+
+  /*! \brief Expand the set to sorted integers. */
+  void ToVector(std::vector<int32_t>* result) const {
+    result->clear();
+    result->reserve(size_);
+    ForEach([&](int32_t value) { result->push_back(value); });
+  }
+
+ private:
+  bool is_runs_ = false;
+  int size_ = 0;
+  std::vector<int32_t> data_;
+};
+
 /*!
  * \brief Let lhs be the union of lhs and rhs. Suppose that both sets are sorted.
  * \note No additional vectors are allocated, and the time complexity is O(n)
@@ -0,0 +1,111 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/kv_swap_pool.cc
+ */
+#include "kv_swap_pool.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+TVM_REGISTER_OBJECT_TYPE(KVSwapPoolObj);
+
+KVSwapPool::KVSwapPool(int64_t capacity_bytes) {
+  ObjectPtr<KVSwapPoolObj> n = make_object<KVSwapPoolObj>();
+  n->capacity_bytes = capacity_bytes;
+  data_ = std::move(n);
+}
+
+bool KVSwapPoolObj::SwapOut(int64_t seq_id, int64_t length, const Array<Model>& models) {
+  CHECK(!entries_.count(seq_id)) << "The sequence " << seq_id << " has already been swapped out.";
+  if (length <= 0) {
+    return false;
+  }
+  // Skip the copy when we already know from earlier swaps that the pool cannot hold it.
+  if (bytes_per_token_ > 0 && used_bytes + bytes_per_token_ * length > capacity_bytes) {
+    return false;
+  }
+
+  Entry entry;
+  entry.kv_data.reserve(models.size());
+  entry.length = length;
+  entry.num_bytes = 0;
+  for (const Model& model : models) {
+    Array<NDArray> kv_data = model->SwapOutSequence(seq_id, length);
+    for (const NDArray& array : kv_data) {
+      entry.num_bytes += static_cast<int64_t>(GetDataSize(*array.operator->()));
+    }
+    entry.kv_data.push_back(std::move(kv_data));
+  }
+  bytes_per_token_ = (entry.num_bytes + length - 1) / length;
+  if (used_bytes + entry.num_bytes > capacity_bytes) {
+    // Not enough capacity. The host arrays are released back to the allocator pool.
+    return false;
+  }
+  used_bytes += entry.num_bytes;
+  entries_.emplace(seq_id, std::move(entry));
+  return true;
+}
+
+int64_t KVSwapPoolObj::SwapIn(int64_t seq_id, const Array<Model>& models) {
+  auto it = entries_.find(seq_id);
+  CHECK(it != entries_.end()) << "The sequence " << seq_id << " is not in the KV swap pool.";
+  const Entry& entry = it->second;
+  ICHECK_EQ(entry.kv_data.size(), models.size());
+  for (int i = 0; i < static_cast<int>(models.size()); ++i) {
+    models[i]->SwapInSequence(seq_id, entry.kv_data[i]);
+  }
+  int64_t length = entry.length;
+  used_bytes -= entry.num_bytes;
+  entries_.erase(it);
+  return length;
+}
+
+bool KVSwapPoolObj::Import(int64_t seq_id, std::vector<Array<NDArray>> kv_data, int64_t length) {
+  CHECK(!entries_.count(seq_id)) << "The sequence " << seq_id << " is already in the pool.";
+  if (length <= 0) {
+    return false;
+  }
+  Entry entry;
+  entry.length = length;
+  entry.num_bytes = 0;
+  for (const Array<NDArray>& model_kv_data : kv_data) {
+    for (const NDArray& array : model_kv_data) {
+      entry.num_bytes += static_cast<int64_t>(GetDataSize(*array.operator->()));
+    }
+  }
+  if (used_bytes + entry.num_bytes > capacity_bytes) {
+    return false;
+  }
+  entry.kv_data = std::move(kv_data);
+  used_bytes += entry.num_bytes;
+  entries_.emplace(seq_id, std::move(entry));
+  return true;
+}
+
+void KVSwapPoolObj::RenameSequence(int64_t seq_id, int64_t new_seq_id) {
+  auto it = entries_.find(seq_id);
+  CHECK(it != entries_.end()) << "The sequence " << seq_id << " is not in the KV swap pool.";
+  CHECK(!entries_.count(new_seq_id));
+  Entry entry = std::move(it->second);
+  entries_.erase(it);
+  entries_.emplace(new_seq_id, std::move(entry));
+}
+
+void KVSwapPoolObj::Discard(int64_t seq_id) {
+  auto it = entries_.find(seq_id);
+  if (it == entries_.end()) {
+    return;
+  }
+  used_bytes -= it->second.num_bytes;
+  entries_.erase(it);
+}
+
+void KVSwapPoolObj::Reset() {
+  entries_.clear();
+  used_bytes = 0;
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,122 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/kv_swap_pool.h
+ * \brief The host memory pool holding the KV cache of preempted sequences.
+ */
+#ifndef MLC_LLM_SERVE_KV_SWAP_POOL_H_
+#define MLC_LLM_SERVE_KV_SWAP_POOL_H_
+
+#include <tvm/runtime/container/array.h>
+#include <tvm/runtime/ndarray.h>
+#include <tvm/runtime/object.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "model.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief The KV swap pool. When a sequence is preempted under the "swap"
+ * preemption mode, its KV data is copied to the pool before the sequence is
+ * removed from the KV cache. When the sequence resumes, the KV data is copied
+ * back, so that only the tokens not covered by the swapped-out KV data need
+ * to be prefilled again. The pool also holds the KV data of the requests imported
+ * from other engines under prefill/decode disaggregation until they are scheduled.
+ */
+class KVSwapPoolObj : public Object {
+ public:
+  /*!
+   * \brief Copy the KV data of the given sequence from all models into the pool.
+   * The sequence is left untouched in the KV cache of models.
+   * \param seq_id The id of the sequence to swap out.
+   * \param length The number of tokens whose KV data is copied.
+   * \param models The models to copy the KV data from.
+   * \return A boolean indicating if the sequence is swapped out. It returns false
+   * when the pool does not have enough capacity, in which case nothing is copied.
+   */
+  bool SwapOut(int64_t seq_id, int64_t length, const Array<Model>& models);
+
+  /*!
+   * \brief Add the given sequence to all models and restore its KV data from the pool.
+   * The sequence is removed from the pool afterwards.
+   * \param seq_id The id of the sequence to swap in.
+   * \param models The models to restore the KV data to.
+   * \return The number of tokens whose KV data is restored.
+   */
+  int64_t SwapIn(int64_t seq_id, const Array<Model>& models);
+
+  /*!
+   * \brief Put the KV data exported from the models of another engine into the pool, so that
+   * the given sequence restores it through `SwapIn` when it is scheduled.
+   * \param seq_id The id of the sequence in this engine.
+   * \param kv_data The K data and V data of each model, returned by `ExportSequenceKV`.
+   * \param length The number of tokens whose KV data is held.
+   * \return A boolean indicating if the KV data is put into the pool. It returns false
+   * when the pool does not have enough capacity.
+   */
+  bool Import(int64_t seq_id, std::vector<Array<NDArray>> kv_data, int64_t length);
+
+  /*!
+   * \brief Move the swapped-out KV data of a sequence to a new sequence id.
+   * The engine assigns preempted sequences a new id after removing them from models.
+   */
+  void RenameSequence(int64_t seq_id, int64_t new_seq_id);
+
+  /*! \brief Drop the swapped-out KV data of the given sequence, if there is any. */
+  void Discard(int64_t seq_id);
+
+  /*! \brief Check if the pool holds the KV data of the given sequence. */
+  bool HasSequence(int64_t seq_id) const { return entries_.count(seq_id); }
+
+  /*! \brief Drop all the swapped-out KV data. */
+  void Reset();
+
+  /*! \brief The capacity of the pool in bytes. */
+  int64_t capacity_bytes = 0;
+  /*! \brief The number of bytes currently held in the pool. */
+  int64_t used_bytes = 0;
+
+  static constexpr const char* _type_key = "mlc.serve.KVSwapPool";
+  static constexpr const bool _type_has_method_sequal_reduce = false;
+  static constexpr const bool _type_has_method_shash_reduce = false;
+  TVM_DECLARE_FINAL_OBJECT_INFO(KVSwapPoolObj, Object);
+
+ private:
+  /*! \brief The swapped-out KV data of a sequence. */
+  struct Entry {
+    /*! \brief The K data and V data on host of each model. */
+    std::vector<Array<NDArray>> kv_data;
+    /*! \brief The number of tokens whose KV data is held. */
+    int64_t length;
+    /*! \brief The total number of bytes of the KV data. */
+    int64_t num_bytes;
+  };
+
+  /*! \brief The swapped-out sequences, keyed by sequence id. */
+  std::unordered_map<int64_t, Entry> entries_;
+  /*! \brief The number of bytes per token observed in the last swap, or 0 if unknown. */
+  int64_t bytes_per_token_ = 0;
+};
+
+class KVSwapPool : public ObjectRef {
+ public:
+  /*!
+   * \brief Create the KV swap pool.
+   * \param capacity_bytes The maximum number of bytes the pool can hold.
+   */
+  explicit KVSwapPool(int64_t capacity_bytes);
+
+  TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(KVSwapPool, ObjectRef, KVSwapPoolObj);
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_KV_SWAP_POOL_H_
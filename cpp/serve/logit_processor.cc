@@ -12,15 +12,22 @@
 #include <tvm/runtime/registry.h>
 #include <tvm/runtime/threading_backend.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "../support/parallel_for.h"
+#include "device_timer.h"
+#include "memory_accounting.h"
+
 namespace mlc {
 namespace llm {
 namespace serve {
 
-inline void CopyArray(NDArray src, NDArray dst, TVMStreamHandle copy_stream) {
-  DLTensor dl_dst = *(dst.operator->());
-  NDArray::CopyFromTo(src.operator->(), &dl_dst, copy_stream);
-}
-
 inline void SyncCopyStream(Device device, TVMStreamHandle compute_stream,
                            TVMStreamHandle copy_stream) {
   // - If there is no particular copy stream, no action is needed.
@@ -39,6 +46,7 @@ class LogitProcessorImpl : public LogitProcessorObj {
  public:
   /*! * \brief Constructor of LogitProcessorImpl. */
   explicit LogitProcessorImpl(int max_num_token, int vocab_size, FunctionTable* ft, DLDevice device,
+                              StagingArena staging_arena,
                               Optional<EventTraceRecorder> trace_recorder)
       : max_num_token_(max_num_token),
         vocab_size_(vocab_size),
@@ -48,10 +56,15 @@ class LogitProcessorImpl : public LogitProcessorObj {
         apply_logit_bias_func_(ft->apply_logit_bias_func_),
         apply_penalty_func_(ft->apply_penalty_func_),
         apply_bitmask_func_(ft->apply_bitmask_func_),
+        apply_logit_bias_and_penalty_func_(ft->apply_logit_bias_and_penalty_func_),
+        update_token_cnt_table_func_(ft->update_token_cnt_table_func_),
+        apply_penalty_from_table_func_(ft->apply_penalty_from_table_func_),
+        staging_arena_(std::move(staging_arena)),
         trace_recorder_(std::move(trace_recorder)) {
     DLDevice device_cpu{DLDeviceType::kDLCPU, /*device_id=*/0};
     // Initialize auxiliary arrays on CPU.
     seq_ids_host_ = NDArray::Empty({max_num_token}, dtype_i32_, device_cpu);
+    slot_ids_host_ = NDArray::Empty({max_num_token}, dtype_i32_, device_cpu);
     pos2seq_id_host_ = NDArray::Empty({max_num_token * vocab_size}, dtype_i32_, device_cpu);
     token_ids_host_ = NDArray::Empty({max_num_token * vocab_size}, dtype_i32_, device_cpu);
     token_cnt_host_ = NDArray::Empty({max_num_token * vocab_size}, dtype_i32_, device_cpu);
@@ -61,6 +74,7 @@ class LogitProcessorImpl : public LogitProcessorObj {
     temperature_host_ = NDArray::Empty({max_num_token}, dtype_f32_, device_cpu);
     // Initialize auxiliary arrays on GPU.
     seq_ids_device_ = NDArray::Empty({max_num_token}, dtype_i32_, device);
+    slot_ids_device_ = NDArray::Empty({max_num_token}, dtype_i32_, device);
     pos2seq_id_device_ = NDArray::Empty({max_num_token * vocab_size}, dtype_i32_, device);
     token_ids_device_ = NDArray::Empty({max_num_token * vocab_size}, dtype_i32_, device);
     token_cnt_device_ = NDArray::Empty({max_num_token * vocab_size}, dtype_i32_, device);
@@ -74,30 +88,89 @@ class LogitProcessorImpl : public LogitProcessorObj {
     CHECK(apply_penalty_func_.defined()) << "Function \"apply_penalty_inplace\" not found in model";
     CHECK(apply_bitmask_func_.defined()) << "Function \"apply_bitmask_inplace\" not found in model";
 
-    // If the device is CUDA/ROCm, we create a standalone copy stream, in
-    // purpose to hide the latency of auxiliary stream copy.
-    if (device.device_type == DLDeviceType::kDLCUDA ||
-        device.device_type == DLDeviceType::kDLROCM) {
+    // If the device is CUDA/ROCm, the staging arena has a standalone copy stream,
+    // in purpose to hide the latency of auxiliary stream copy.
+    copy_stream_ = staging_arena_->copy_stream;
+    if (copy_stream_ != nullptr) {
       // The compute stream is the default stream.
       compute_stream_ = DeviceAPI::Get(device)->GetCurrentStream(device);
-      copy_stream_ = DeviceAPI::Get(device)->CreateStream(device);
     }
   }
 
   ~LogitProcessorImpl() {
-    // Free the copy stream if defined.
-    if (copy_stream_ != nullptr) {
-      DeviceAPI::Get(device_)->FreeStream(device_, copy_stream_);
+    if (bitmask_thread_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(bitmask_mutex_);
+        bitmask_thread_exit_ = true;
+      }
+      bitmask_cv_.notify_all();
+      bitmask_thread_.join();
     }
   }
 
+  void ComputeTokenBitmaskAsync(const Array<RequestModelState>& mstates) final {
+    WaitTokenBitmask();
+    async_bitmask_mstates_ = Array<RequestModelState>();
+    if (std::none_of(mstates.begin(), mstates.end(), [](const RequestModelState& mstate) {
+          return mstate->RequireNextTokenBitmask();
+        })) {
+      return;
+    }
+    CHECK_LE(mstates.size(), max_num_token_);
+    if (!bitmask_thread_.joinable()) {
+      bitmask_thread_ = std::thread([this]() { BitmaskThreadLoop(); });
+    }
+    async_bitmask_mstates_ = mstates;
+    {
+      std::lock_guard<std::mutex> lock(bitmask_mutex_);
+      bitmask_task_ = [this, mstates]() {
+        ComputeTokenBitmask(mstates, /*cum_num_token=*/nullptr, /*draft_tokens=*/nullptr,
+                            &async_require_mask_);
+      };
+    }
+    bitmask_cv_.notify_all();
+  }
+
+  bool GetAllowedTokenUnion(const Array<RequestModelState>& mstates, int max_num_tokens,
+                            std::vector<int32_t>* token_ids) final {
+    token_ids->clear();
+    if (!IsAsyncBitmaskOf(mstates)) {
+      return false;
+    }
+    WaitTokenBitmask();
+    if (std::find(async_require_mask_.begin(), async_require_mask_.end(), 0) !=
+        async_require_mask_.end()) {
+      return false;
+    }
+    const uint32_t* p_bitmask = static_cast<const uint32_t*>(bitmask_host_->data);
+    int num_sequence = mstates.size();
+    for (int j = 0; j < bitmask_size_; ++j) {
+      uint32_t word = 0;
+      for (int i = 0; i < num_sequence; ++i) {
+        word |= p_bitmask[i * bitmask_size_ + j];
+      }
+      for (int bit = 0; word != 0 && bit < 32; ++bit, word >>= 1) {
+        int32_t token_id = j * 32 + bit;
+        if ((word & 1) == 0 || token_id >= vocab_size_) {
+          continue;
+        }
+        if (static_cast<int>(token_ids->size()) == max_num_tokens) {
+          return false;
+        }
+        token_ids->push_back(token_id);
+      }
+    }
+    return !token_ids->empty();
+  }
+
   void InplaceUpdateLogits(NDArray logits,                                 //
                            const Array<GenerationConfig>& generation_cfg,  //
                            const Array<RequestModelState>& mstates,        //
                            const Array<String>& request_ids,               //
                            const std::vector<int>* cum_num_token,          //
                            const std::vector<std::vector<SampleResult>>* draft_tokens) final {
-    NVTXScopedRange nvtx_scope("Logit inplace update");
+    TraceScopedRange trace_scope("Logit inplace update");
+    StepPhaseScope phase_scope(StepPhase::kLogitProcess);
     CHECK_EQ(logits->ndim, 2);
     CHECK_EQ(logits->shape[1], vocab_size_);
     CHECK(logits.DataType() == DataType::Float(32));
@@ -117,15 +190,33 @@ class LogitProcessorImpl : public LogitProcessorObj {
 
     RECORD_EVENT(trace_recorder_, request_ids, "start update logits");
 
-    // Update 1. logit bias
-    RECORD_EVENT(trace_recorder_, request_ids, "start apply logit bias");
-    UpdateWithLogitBias(logits, generation_cfg, cum_num_token);
-    RECORD_EVENT(trace_recorder_, request_ids, "finish apply logit bias");
-
-    // Update 2. penalties
-    RECORD_EVENT(trace_recorder_, request_ids, "start apply penalty");
-    UpdateWithPenalty(logits, generation_cfg, mstates, cum_num_token, draft_tokens);
-    RECORD_EVENT(trace_recorder_, request_ids, "finish apply penalty");
+    if (CanUseTokenCntTable(generation_cfg, mstates, cum_num_token)) {
+      // Update 1. logit bias
+      RECORD_EVENT(trace_recorder_, request_ids, "start apply logit bias");
+      UpdateWithLogitBias(logits, generation_cfg, cum_num_token);
+      RECORD_EVENT(trace_recorder_, request_ids, "finish apply logit bias");
+
+      // Update 2. penalties, with the token counts kept on device.
+      RECORD_EVENT(trace_recorder_, request_ids, "start apply penalty");
+      UpdateWithPenaltyFromTable(logits, generation_cfg, mstates);
+      RECORD_EVENT(trace_recorder_, request_ids, "finish apply penalty");
+    } else if (apply_logit_bias_and_penalty_func_.defined()) {
+      // Update 1&2. logit bias and penalties in one kernel, when the model provides it.
+      RECORD_EVENT(trace_recorder_, request_ids, "start apply logit bias and penalty");
+      UpdateWithLogitBiasAndPenalty(logits, generation_cfg, mstates, cum_num_token,
+                                    draft_tokens);
+      RECORD_EVENT(trace_recorder_, request_ids, "finish apply logit bias and penalty");
+    } else {
+      // Update 1. logit bias
+      RECORD_EVENT(trace_recorder_, request_ids, "start apply logit bias");
+      UpdateWithLogitBias(logits, generation_cfg, cum_num_token);
+      RECORD_EVENT(trace_recorder_, request_ids, "finish apply logit bias");
+
+      // Update 2. penalties
+      RECORD_EVENT(trace_recorder_, request_ids, "start apply penalty");
+      UpdateWithPenalty(logits, generation_cfg, mstates, cum_num_token, draft_tokens);
+      RECORD_EVENT(trace_recorder_, request_ids, "finish apply penalty");
+    }
 
     // Update 3. Vocabulary mask.
     RECORD_EVENT(trace_recorder_, request_ids, "start apply logit mask");
@@ -138,7 +229,8 @@ class LogitProcessorImpl : public LogitProcessorObj {
   NDArray ComputeProbsFromLogits(NDArray logits, const Array<GenerationConfig>& generation_cfg,
                                  const Array<String>& request_ids,
                                  const std::vector<int>* cum_num_token) final {
-    NVTXScopedRange nvtx_scope("Compute probs from logits");
+    TraceScopedRange trace_scope("Compute probs from logits");
+    StepPhaseScope phase_scope(StepPhase::kLogitProcess);
     // logits: (n, v)
     CHECK_EQ(logits->ndim, 2);
     CHECK_LE(logits->shape[0], max_num_token_);
@@ -175,7 +267,7 @@ class LogitProcessorImpl : public LogitProcessorObj {
     NDArray temperature_device = temperature_device_.CreateView({num_total_token}, dtype_f32_);
 
     // - Copy arrays to GPU.
-    CopyArray(/*src=*/temperature_host, /*dst=*/temperature_device, copy_stream_);
+    staging_arena_->CopyToDevice(/*src=*/temperature_host, /*dst=*/temperature_device);
     SyncCopyStream(device_, compute_stream_, copy_stream_);
 
     // - Call kernel.
@@ -192,10 +284,21 @@ class LogitProcessorImpl : public LogitProcessorObj {
     return probs.CreateView({num_total_token, vocab_size_}, probs->dtype);
   }
 
+  int64_t GetDeviceMemoryBytes() const final {
+    int64_t bytes = 0;
+    for (const NDArray* array :
+         {&seq_ids_device_, &slot_ids_device_, &pos2seq_id_device_, &token_ids_device_,
+          &token_cnt_device_, &token_logit_bias_device_, &penalties_device_, &bitmask_device_,
+          &temperature_device_, &token_cnt_table_device_}) {
+      bytes += GetNDArrayBytes(*array);
+    }
+    return bytes;
+  }
+
  private:
   void UpdateWithLogitBias(NDArray logits, const Array<GenerationConfig>& generation_cfg,
                            const std::vector<int>* cum_num_token) {
-    NVTXScopedRange nvtx_scope("UpdateWithLogitBias");
+    TraceScopedRange trace_scope("UpdateWithLogitBias");
     // Construct:
     // - pos2seq_id (max_num_token * vocab_size,) int32
     // - token_ids (max_num_token * vocab_size,) int32
@@ -238,9 +341,9 @@ class LogitProcessorImpl : public LogitProcessorObj {
     NDArray token_logit_bias_device = token_logit_bias_device_.CreateView({num_token}, dtype_f32_);
 
     // - Copy arrays to GPU.
-    CopyArray(/*src=*/pos2seq_id_host, /*dst=*/pos2seq_id_device, copy_stream_);
-    CopyArray(/*src=*/token_ids_host, /*dst=*/token_ids_device, copy_stream_);
-    CopyArray(/*src=*/token_logit_bias_host, /*dst=*/token_logit_bias_device, copy_stream_);
+    staging_arena_->CopyToDevice(/*src=*/pos2seq_id_host, /*dst=*/pos2seq_id_device);
+    staging_arena_->CopyToDevice(/*src=*/token_ids_host, /*dst=*/token_ids_device);
+    staging_arena_->CopyToDevice(/*src=*/token_logit_bias_host, /*dst=*/token_logit_bias_device);
     SyncCopyStream(device_, compute_stream_, copy_stream_);
 
     // - Call kernel.
@@ -254,7 +357,7 @@ class LogitProcessorImpl : public LogitProcessorObj {
                          const Array<RequestModelState>& mstates,
                          const std::vector<int>* cum_num_token,
                          const std::vector<std::vector<SampleResult>>* draft_tokens) {
-    NVTXScopedRange nvtx_scope("UpdateWithPenalty");
+    TraceScopedRange trace_scope("UpdateWithPenalty");
     // Construct:
     // - seq_ids (max_num_token,) int32
     // - pos2seq_id (max_num_token * vocab_size,) int32
@@ -320,11 +423,11 @@ class LogitProcessorImpl : public LogitProcessorObj {
     NDArray penalties_device = penalties_device_.CreateView({num_seq, 3}, dtype_f32_);
 
     // - Copy arrays to GPU.
-    CopyArray(/*src=*/seq_ids_host, /*dst=*/seq_ids_device, copy_stream_);
-    CopyArray(/*src=*/pos2seq_id_host, /*dst=*/pos2seq_id_device, copy_stream_);
-    CopyArray(/*src=*/token_ids_host, /*dst=*/token_ids_device, copy_stream_);
-    CopyArray(/*src=*/token_cnt_host, /*dst=*/token_cnt_device, copy_stream_);
-    CopyArray(/*src=*/penalties_host, /*dst=*/penalties_device, copy_stream_);
+    staging_arena_->CopyToDevice(/*src=*/seq_ids_host, /*dst=*/seq_ids_device);
+    staging_arena_->CopyToDevice(/*src=*/pos2seq_id_host, /*dst=*/pos2seq_id_device);
+    staging_arena_->CopyToDevice(/*src=*/token_ids_host, /*dst=*/token_ids_device);
+    staging_arena_->CopyToDevice(/*src=*/token_cnt_host, /*dst=*/token_cnt_device);
+    staging_arena_->CopyToDevice(/*src=*/penalties_host, /*dst=*/penalties_device);
     SyncCopyStream(device_, compute_stream_, copy_stream_);
 
     // - Call kernel.
@@ -335,49 +438,324 @@ class LogitProcessorImpl : public LogitProcessorObj {
     }
   }
 
+  /*!
+   * \brief Apply logit bias and penalties with a single kernel launch. The bias entries
+   * and the appeared tokens of each row are merged, so that every (row, token) pair is
+   * updated once, with the bias added before the penalties as in the separate path.
+   */
+  void UpdateWithLogitBiasAndPenalty(NDArray logits, const Array<GenerationConfig>& generation_cfg,
+                                     const Array<RequestModelState>& mstates,
+                                     const std::vector<int>* cum_num_token,
+                                     const std::vector<std::vector<SampleResult>>* draft_tokens) {
+    TraceScopedRange trace_scope("UpdateWithLogitBiasAndPenalty");
+    // Construct:
+    // - pos2seq_id (max_num_token * vocab_size,) int32
+    // - token_ids (max_num_token * vocab_size,) int32
+    // - token_cnt (max_num_token * vocab_size,) int32
+    // - token_logit_bias (max_num_token * vocab_size,) float32
+    // - penalties (max_num_token, 3) float32
+    int* p_pos2seq_id = static_cast<int*>(pos2seq_id_host_->data);
+    int* p_token_ids = static_cast<int*>(token_ids_host_->data);
+    int* p_token_cnt = static_cast<int*>(token_cnt_host_->data);
+    float* p_token_logit_bias = static_cast<float*>(token_logit_bias_host_->data);
+    float* p_penalties = static_cast<float*>(penalties_host_->data);
+
+    // - Set arrays.
+    int num_total_token = logits->shape[0];
+    int num_token = 0;
+    // The entry index of each token in the current row.
+    std::unordered_map<int32_t, int> token_entry;
+    for (int i = 0; i < static_cast<int>(generation_cfg.size()); ++i) {
+      int num_token_to_process =
+          cum_num_token == nullptr ? 1 : (cum_num_token->at(i + 1) - cum_num_token->at(i));
+      int token_offset = cum_num_token == nullptr ? i : cum_num_token->at(i);
+      bool require_penalty = generation_cfg[i]->frequency_penalty != 0.0 ||
+                             generation_cfg[i]->presence_penalty != 0.0 ||
+                             generation_cfg[i]->repetition_penalty != 1.0;
+      if (require_penalty) {
+        CHECK(num_token_to_process == 1 || mstates[i]->draft_output_tokens.empty());
+      }
+      for (int j = 0; j < num_token_to_process; ++j) {
+        int row = token_offset + j;
+        p_penalties[row * 3] = generation_cfg[i]->presence_penalty;
+        p_penalties[row * 3 + 1] = generation_cfg[i]->frequency_penalty;
+        p_penalties[row * 3 + 2] = generation_cfg[i]->repetition_penalty;
+        token_entry.clear();
+        for (auto [token_id, bias] : generation_cfg[i]->logit_bias) {
+          p_pos2seq_id[num_token] = row;
+          p_token_ids[num_token] = token_id;
+          p_token_cnt[num_token] = 0;
+          p_token_logit_bias[num_token] = bias;
+          token_entry[token_id] = num_token;
+          ++num_token;
+        }
+        if (!require_penalty) {
+          continue;
+        }
+        for (auto [token_id, cnt] : mstates[i]->appeared_token_ids) {
+          auto it = token_entry.find(token_id);
+          if (it != token_entry.end()) {
+            p_token_cnt[it->second] = cnt;
+            continue;
+          }
+          p_pos2seq_id[num_token] = row;
+          p_token_ids[num_token] = token_id;
+          p_token_cnt[num_token] = cnt;
+          p_token_logit_bias[num_token] = 0.0f;
+          ++num_token;
+        }
+        if (j > 0) {
+          mstates[i]->AddDraftToken(draft_tokens->at(i)[j - 1], /*draft_token_slot=*/-1);
+        }
+      }
+      if (require_penalty && num_token_to_process != 1) {
+        // Roll back.
+        mstates[i]->RemoveAllDraftTokens();
+      }
+    }
+
+    if (num_token == 0) {
+      return;
+    }
+
+    // - View arrays.
+    NDArray pos2seq_id_host = pos2seq_id_host_.CreateView({num_token}, dtype_i32_);
+    NDArray pos2seq_id_device = pos2seq_id_device_.CreateView({num_token}, dtype_i32_);
+    NDArray token_ids_host = token_ids_host_.CreateView({num_token}, dtype_i32_);
+    NDArray token_ids_device = token_ids_device_.CreateView({num_token}, dtype_i32_);
+    NDArray token_cnt_host = token_cnt_host_.CreateView({num_token}, dtype_i32_);
+    NDArray token_cnt_device = token_cnt_device_.CreateView({num_token}, dtype_i32_);
+    NDArray token_logit_bias_host = token_logit_bias_host_.CreateView({num_token}, dtype_f32_);
+    NDArray token_logit_bias_device = token_logit_bias_device_.CreateView({num_token}, dtype_f32_);
+    NDArray penalties_host = penalties_host_.CreateView({num_total_token, 3}, dtype_f32_);
+    NDArray penalties_device = penalties_device_.CreateView({num_total_token, 3}, dtype_f32_);
+
+    // - Copy arrays to GPU.
+    staging_arena_->CopyToDevice(/*src=*/pos2seq_id_host, /*dst=*/pos2seq_id_device);
+    staging_arena_->CopyToDevice(/*src=*/token_ids_host, /*dst=*/token_ids_device);
+    staging_arena_->CopyToDevice(/*src=*/token_cnt_host, /*dst=*/token_cnt_device);
+    staging_arena_->CopyToDevice(/*src=*/token_logit_bias_host, /*dst=*/token_logit_bias_device);
+    staging_arena_->CopyToDevice(/*src=*/penalties_host, /*dst=*/penalties_device);
+    SyncCopyStream(device_, compute_stream_, copy_stream_);
+
+    // - Call kernel.
+    apply_logit_bias_and_penalty_func_(logits, pos2seq_id_device, token_ids_device,
+                                       token_cnt_device, token_logit_bias_device,
+                                       penalties_device);
+    if (trace_recorder_.defined()) {
+      TVMSynchronize(device_.device_type, device_.device_id, /*stream=*/nullptr);
+    }
+  }
+
+  /*!
+   * \brief Check whether the penalties can be applied with the token count table. The table
+   * holds the counts of the committed tokens only, so it is used when there is one row per
+   * sequence and no sequence to penalize has draft tokens.
+   */
+  bool CanUseTokenCntTable(const Array<GenerationConfig>& generation_cfg,
+                           const Array<RequestModelState>& mstates,
+                           const std::vector<int>* cum_num_token) {
+    if (!update_token_cnt_table_func_.defined() || !apply_penalty_from_table_func_.defined() ||
+        cum_num_token != nullptr) {
+      return false;
+    }
+    for (int i = 0; i < static_cast<int>(generation_cfg.size()); ++i) {
+      if (RequirePenalty(generation_cfg[i]) && !mstates[i]->draft_output_tokens.empty()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /*!
+   * \brief Apply penalties with the token counts in the device token count table. Each
+   * sequence to penalize holds a row of the table, and only the tokens committed since the
+   * last step are uploaded to update the row, so the upload does not grow with the output
+   * length.
+   */
+  void UpdateWithPenaltyFromTable(NDArray logits, const Array<GenerationConfig>& generation_cfg,
+                                  const Array<RequestModelState>& mstates) {
+    TraceScopedRange trace_scope("UpdateWithPenaltyFromTable");
+    // Construct:
+    // - seq_ids (max_num_token,) int32
+    // - slot_ids (max_num_token,) int32
+    // - penalties (max_num_token, 3) float32
+    // - the (slot, token, count delta) entries of the table update, which are distinct
+    //   in (slot, token), in pos2seq_id, token_ids and token_cnt
+    int* p_seq_ids = static_cast<int*>(seq_ids_host_->data);
+    int* p_slot_ids = static_cast<int*>(slot_ids_host_->data);
+    float* p_penalties = static_cast<float*>(penalties_host_->data);
+    int* p_delta_slot_ids = static_cast<int*>(pos2seq_id_host_->data);
+    int* p_delta_token_ids = static_cast<int*>(token_ids_host_->data);
+    int* p_delta_token_cnt = static_cast<int*>(token_cnt_host_->data);
+
+    // - Set arrays.
+    ++token_cnt_table_step_;
+    int num_seq = 0;
+    int num_delta = 0;
+    std::unordered_map<int32_t, int32_t> token_cnt_delta;
+    for (int i = 0; i < static_cast<int>(generation_cfg.size()); ++i) {
+      if (!RequirePenalty(generation_cfg[i])) {
+        continue;
+      }
+      token_cnt_delta.clear();
+      int slot = AcquireTokenCntSlot(mstates[i], &token_cnt_delta);
+      TokenCntSlot& entry = token_cnt_slots_[slot];
+      const std::vector<int32_t>& committed_token_ids = mstates[i]->committed_token_ids;
+      for (int64_t k = entry.num_synced_tokens;
+           k < static_cast<int64_t>(committed_token_ids.size()); ++k) {
+        int32_t token_id = committed_token_ids[k];
+        ++entry.token_cnt[token_id];
+        ++token_cnt_delta[token_id];
+      }
+      entry.num_synced_tokens = committed_token_ids.size();
+      for (auto [token_id, delta] : token_cnt_delta) {
+        if (delta != 0) {
+          p_delta_slot_ids[num_delta] = slot;
+          p_delta_token_ids[num_delta] = token_id;
+          p_delta_token_cnt[num_delta] = delta;
+          ++num_delta;
+        }
+      }
+      p_seq_ids[num_seq] = i;
+      p_slot_ids[num_seq] = slot;
+      p_penalties[num_seq * 3] = generation_cfg[i]->presence_penalty;
+      p_penalties[num_seq * 3 + 1] = generation_cfg[i]->frequency_penalty;
+      p_penalties[num_seq * 3 + 2] = generation_cfg[i]->repetition_penalty;
+      ++num_seq;
+    }
+
+    if (num_seq == 0) {
+      return;
+    }
+
+    // - View arrays and copy arrays to GPU.
+    NDArray delta_slot_ids_device = pos2seq_id_device_.CreateView({num_delta}, dtype_i32_);
+    NDArray delta_token_ids_device = token_ids_device_.CreateView({num_delta}, dtype_i32_);
+    NDArray delta_token_cnt_device = token_cnt_device_.CreateView({num_delta}, dtype_i32_);
+    if (num_delta > 0) {
+      staging_arena_->CopyToDevice(/*src=*/pos2seq_id_host_.CreateView({num_delta}, dtype_i32_),
+                                   /*dst=*/delta_slot_ids_device);
+      staging_arena_->CopyToDevice(/*src=*/token_ids_host_.CreateView({num_delta}, dtype_i32_),
+                                   /*dst=*/delta_token_ids_device);
+      staging_arena_->CopyToDevice(/*src=*/token_cnt_host_.CreateView({num_delta}, dtype_i32_),
+                                   /*dst=*/delta_token_cnt_device);
+    }
+    NDArray seq_ids_host = seq_ids_host_.CreateView({num_seq}, dtype_i32_);
+    NDArray seq_ids_device = seq_ids_device_.CreateView({num_seq}, dtype_i32_);
+    NDArray slot_ids_host = slot_ids_host_.CreateView({num_seq}, dtype_i32_);
+    NDArray slot_ids_device = slot_ids_device_.CreateView({num_seq}, dtype_i32_);
+    NDArray penalties_host = penalties_host_.CreateView({num_seq, 3}, dtype_f32_);
+    NDArray penalties_device = penalties_device_.CreateView({num_seq, 3}, dtype_f32_);
+    staging_arena_->CopyToDevice(/*src=*/seq_ids_host, /*dst=*/seq_ids_device);
+    staging_arena_->CopyToDevice(/*src=*/slot_ids_host, /*dst=*/slot_ids_device);
+    staging_arena_->CopyToDevice(/*src=*/penalties_host, /*dst=*/penalties_device);
+    SyncCopyStream(device_, compute_stream_, copy_stream_);
+
+    // - Call kernels.
+    if (num_delta > 0) {
+      update_token_cnt_table_func_(token_cnt_table_device_, delta_slot_ids_device,
+                                   delta_token_ids_device, delta_token_cnt_device);
+    }
+    apply_penalty_from_table_func_(logits, seq_ids_device, slot_ids_device,
+                                   token_cnt_table_device_, penalties_device);
+    if (trace_recorder_.defined()) {
+      TVMSynchronize(device_.device_type, device_.device_id, /*stream=*/nullptr);
+    }
+  }
+
+  /*!
+   * \brief Get the token count table row of the given request state. When the state holds
+   * no valid row, the least recently used row that is not used in this step is taken, or the
+   * table grows, and the deltas clearing the counts of the previous owner are added.
+   * \param token_cnt_delta The count deltas of the row to upload.
+   * \return The row of the request state.
+   */
+  int AcquireTokenCntSlot(const RequestModelState& mstate,
+                          std::unordered_map<int32_t, int32_t>* token_cnt_delta) {
+    int slot = mstate->token_cnt_table_slot;
+    if (slot >= 0 && slot < static_cast<int>(token_cnt_slots_.size()) &&
+        token_cnt_slots_[slot].owner == mstate.get() &&
+        token_cnt_slots_[slot].num_synced_tokens <=
+            static_cast<int64_t>(mstate->committed_tokens.size())) {
+      token_cnt_slots_[slot].last_used_step = token_cnt_table_step_;
+      return slot;
+    }
+    slot = -1;
+    for (int s = 0; s < static_cast<int>(token_cnt_slots_.size()); ++s) {
+      int64_t last_used_step = token_cnt_slots_[s].last_used_step;
+      if (last_used_step != token_cnt_table_step_ &&
+          (slot == -1 || last_used_step < token_cnt_slots_[slot].last_used_step)) {
+        slot = s;
+      }
+    }
+    if (slot == -1) {
+      slot = token_cnt_slots_.size();
+      GrowTokenCntTable(slot + 1);
+    }
+    TokenCntSlot& entry = token_cnt_slots_[slot];
+    for (auto [token_id, cnt] : entry.token_cnt) {
+      (*token_cnt_delta)[token_id] -= cnt;
+    }
+    entry.token_cnt.clear();
+    entry.owner = mstate.get();
+    entry.num_synced_tokens = 0;
+    entry.last_used_step = token_cnt_table_step_;
+    mstate->token_cnt_table_slot = slot;
+    return slot;
+  }
+
+  /*!
+   * \brief Grow the token count table to at least the given number of rows, keeping the
+   * counts of the existing rows. The table is allocated on first use, so that it takes no
+   * memory when no request has penalties.
+   */
+  void GrowTokenCntTable(int min_num_slots) {
+    int num_slots = std::max(static_cast<int>(token_cnt_slots_.size()) * 2, kMinTokenCntSlots);
+    num_slots = std::max(std::min(num_slots, max_num_token_), min_num_slots);
+    CHECK_LE(num_slots, max_num_token_);
+    NDArray table = NDArray::Empty({num_slots, vocab_size_}, dtype_i32_, device_);
+    std::vector<int32_t> zeros(static_cast<int64_t>(num_slots) * vocab_size_, 0);
+    table.CopyFromBytes(zeros.data(), zeros.size() * sizeof(int32_t));
+    if (token_cnt_table_device_.defined()) {
+      table.CreateView(token_cnt_table_device_.Shape(), dtype_i32_)
+          .CopyFrom(token_cnt_table_device_);
+    }
+    token_cnt_table_device_ = table;
+    token_cnt_slots_.resize(num_slots);
+  }
+
+  static bool RequirePenalty(const GenerationConfig& generation_cfg) {
+    return generation_cfg->frequency_penalty != 0.0 || generation_cfg->presence_penalty != 0.0 ||
+           generation_cfg->repetition_penalty != 1.0;
+  }
+
   void UpdateWithMask(NDArray logits, const Array<RequestModelState>& mstates,
                       const std::vector<int>* cum_num_token,
                       const std::vector<std::vector<SampleResult>>* draft_tokens) {
-    NVTXScopedRange nvtx_scope("UpdateWithMask");
+    TraceScopedRange trace_scope("UpdateWithMask");
     // Construct:
     // - seq_ids (max_num_token,) int32
     // - bitmask (max_num_token, ceildiv(vocab_size, 32)), int32
     int32_t* p_seq_ids = static_cast<int32_t*>(seq_ids_host_->data);
-    uint32_t* p_bitmask = static_cast<uint32_t*>(bitmask_host_->data);
 
     // - Set arrays.
     int batch_size = logits->shape[0];
     ICHECK((cum_num_token == nullptr && batch_size == mstates.size()) ||
            (cum_num_token != nullptr && batch_size == cum_num_token->back()));
 
-    std::memset(p_seq_ids, 0, batch_size * sizeof(int32_t));
-
-    for (int i = 0; i < static_cast<int>(mstates.size()); ++i) {
-      int token_start_offset = cum_num_token == nullptr ? i : cum_num_token->at(i);
-      int token_number =
-          cum_num_token == nullptr ? 1 : (cum_num_token->at(i + 1) - cum_num_token->at(i));
-      CHECK(token_number == 1 || mstates[i]->draft_output_tokens.empty());
-      bool require_mask = mstates[i]->RequireNextTokenBitmask();
-      for (int j = 0; j < token_number; ++j) {
-        if (require_mask) {
-          // Find a slice of bitmask_host_: bitmask_host_[num_token_for_mask, :]
-          auto bitmask_dltensor = *bitmask_host_.operator->();
-          int64_t bitmask_shape[] = {bitmask_size_};
-          bitmask_dltensor.data = p_bitmask + (token_start_offset + j) * bitmask_size_;
-          bitmask_dltensor.shape = bitmask_shape;
-          bitmask_dltensor.ndim = 1;
-
-          mstates[i]->FindNextTokenBitmask(&bitmask_dltensor);
-          p_seq_ids[token_start_offset + j] = 1;
-        }
-        if (j > 0) {
-          mstates[i]->AddDraftToken(draft_tokens->at(i)[j - 1], /*draft_token_slot=*/-1);
-        }
-      }
-      if (token_number != 1) {
-        // Roll back.
-        mstates[i]->RemoveAllDraftTokens();
-      }
+    std::vector<int8_t>* require_mask = &require_mask_;
+    bool use_async_bitmask = cum_num_token == nullptr && IsAsyncBitmaskOf(mstates);
+    // The bitmasks computed in the background share the host buffer, so always wait for them.
+    WaitTokenBitmask();
+    async_bitmask_mstates_ = Array<RequestModelState>();
+    if (use_async_bitmask) {
+      require_mask = &async_require_mask_;
+    } else {
+      ComputeTokenBitmask(mstates, cum_num_token, draft_tokens, require_mask);
+    }
+    for (int i = 0; i < batch_size; ++i) {
+      p_seq_ids[i] = require_mask->at(i);
     }
 
     int num_token_for_mask = 0;
@@ -400,8 +778,8 @@ class LogitProcessorImpl : public LogitProcessorObj {
     NDArray bitmask_device = bitmask_device_.CreateView({batch_size, bitmask_size_}, dtype_i32_);
 
     // - Copy arrays to GPU.
-    CopyArray(/*src=*/seq_ids_host, /*dst=*/seq_ids_device, copy_stream_);
-    CopyArray(/*src=*/bitmask_host, /*dst=*/bitmask_device, copy_stream_);
+    staging_arena_->CopyToDevice(/*src=*/seq_ids_host, /*dst=*/seq_ids_device);
+    staging_arena_->CopyToDevice(/*src=*/bitmask_host, /*dst=*/bitmask_device);
     SyncCopyStream(device_, compute_stream_, copy_stream_);
 
     // - Call kernel.
@@ -411,6 +789,95 @@ class LogitProcessorImpl : public LogitProcessorObj {
     }
   }
 
+  /*!
+   * \brief Compute the next token bitmasks of the requests that require them into bitmask_host_,
+   * in parallel across the requests.
+   * \param require_mask The output flag of each token, which is 1 if the bitmask of the token
+   * is computed, and 0 otherwise.
+   */
+  void ComputeTokenBitmask(const Array<RequestModelState>& mstates,
+                           const std::vector<int>* cum_num_token,
+                           const std::vector<std::vector<SampleResult>>* draft_tokens,
+                           std::vector<int8_t>* require_mask) {
+    TraceScopedRange trace_scope("ComputeTokenBitmask");
+    int num_sequence = mstates.size();
+    int num_total_token = cum_num_token == nullptr ? num_sequence : cum_num_token->back();
+    uint32_t* p_bitmask = static_cast<uint32_t*>(bitmask_host_->data);
+    require_mask->assign(num_total_token, 0);
+
+    // Each task touches only the grammar matcher and the bitmask rows of its own request.
+    ParallelForDynamic(num_sequence, [&](int64_t i) {
+      int token_start_offset = cum_num_token == nullptr ? i : cum_num_token->at(i);
+      int token_number =
+          cum_num_token == nullptr ? 1 : (cum_num_token->at(i + 1) - cum_num_token->at(i));
+      CHECK(token_number == 1 || mstates[i]->draft_output_tokens.empty());
+      for (int j = 0; j < token_number; ++j) {
+        // The row of position j follows the draft tokens before it, which the grammar state
+        // follows as well.
+        if (j > 0) {
+          mstates[i]->AddDraftToken(draft_tokens->at(i)[j - 1], /*draft_token_slot=*/-1);
+        }
+        if (mstates[i]->RequireNextTokenBitmask()) {
+          // Find a slice of bitmask_host_: bitmask_host_[token_start_offset + j, :]
+          auto bitmask_dltensor = *bitmask_host_.operator->();
+          int64_t bitmask_shape[] = {bitmask_size_};
+          bitmask_dltensor.data = p_bitmask + (token_start_offset + j) * bitmask_size_;
+          bitmask_dltensor.shape = bitmask_shape;
+          bitmask_dltensor.ndim = 1;
+
+          mstates[i]->FindNextTokenBitmask(&bitmask_dltensor);
+          (*require_mask)[token_start_offset + j] = 1;
+        }
+      }
+      if (token_number != 1) {
+        // Roll back.
+        mstates[i]->RemoveAllDraftTokens();
+      }
+    });
+  }
+
+  /*! \brief Check if the bitmasks started in the background are of the given request states. */
+  bool IsAsyncBitmaskOf(const Array<RequestModelState>& mstates) const {
+    return async_bitmask_mstates_.size() == mstates.size() &&
+           std::equal(mstates.begin(), mstates.end(), async_bitmask_mstates_.begin(),
+                      [](const RequestModelState& a, const RequestModelState& b) {
+                        return a.same_as(b);
+                      });
+  }
+
+  /*! \brief Wait for the bitmasks computed in the background, and rethrow its error if any. */
+  void WaitTokenBitmask() {
+    std::unique_lock<std::mutex> lock(bitmask_mutex_);
+    bitmask_cv_.wait(lock, [this]() { return bitmask_task_ == nullptr; });
+    if (bitmask_error_ != nullptr) {
+      std::exception_ptr error = std::move(bitmask_error_);
+      bitmask_error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+  /*! \brief The loop of the thread computing the bitmasks in the background. */
+  void BitmaskThreadLoop() {
+    std::unique_lock<std::mutex> lock(bitmask_mutex_);
+    while (true) {
+      bitmask_cv_.wait(lock, [this]() { return bitmask_thread_exit_ || bitmask_task_ != nullptr; });
+      if (bitmask_thread_exit_) {
+        return;
+      }
+      lock.unlock();
+      std::exception_ptr error = nullptr;
+      try {
+        bitmask_task_();
+      } catch (...) {
+        error = std::current_exception();
+      }
+      lock.lock();
+      bitmask_error_ = error;
+      bitmask_task_ = nullptr;
+      bitmask_cv_.notify_all();
+    }
+  }
+
   // Model configurations
   const int max_num_token_;
   const int vocab_size_;
@@ -424,8 +891,14 @@ class LogitProcessorImpl : public LogitProcessorObj {
   PackedFunc apply_logit_bias_func_;
   PackedFunc apply_penalty_func_;
   PackedFunc apply_bitmask_func_;
+  PackedFunc apply_logit_bias_and_penalty_func_;
+  PackedFunc update_token_cnt_table_func_;
+  PackedFunc apply_penalty_from_table_func_;
+  // The staging arena for uploading auxiliary arrays.
+  StagingArena staging_arena_;
   // Auxiliary NDArrays on CPU
   NDArray seq_ids_host_;
+  NDArray slot_ids_host_;
   NDArray pos2seq_id_host_;
   NDArray token_ids_host_;
   NDArray token_cnt_host_;
@@ -435,6 +908,7 @@ class LogitProcessorImpl : public LogitProcessorObj {
   NDArray temperature_host_;
   // Auxiliary NDArrays on GPU
   NDArray seq_ids_device_;
+  NDArray slot_ids_device_;
   NDArray pos2seq_id_device_;
   NDArray token_ids_device_;
   NDArray token_cnt_device_;
@@ -446,16 +920,49 @@ class LogitProcessorImpl : public LogitProcessorObj {
   Optional<EventTraceRecorder> trace_recorder_;
   // The device stream for the default computation operations.
   TVMStreamHandle compute_stream_ = nullptr;
-  // The device stream for copying auxiliary data structure to GPU.
+  // The device stream for copying auxiliary data structure to GPU, owned by the staging arena.
   TVMStreamHandle copy_stream_ = nullptr;
   // A small epsilon.
   const double eps_ = 1e-5;
+  // The flag of each token whether its bitmask is computed.
+  std::vector<int8_t> require_mask_;
+  // The thread computing the bitmasks in the background, which is started on first use.
+  std::thread bitmask_thread_;
+  std::mutex bitmask_mutex_;
+  std::condition_variable bitmask_cv_;
+  // The pending background task, or nullptr if there is none.
+  std::function<void()> bitmask_task_ = nullptr;
+  // The error thrown by the last background task.
+  std::exception_ptr bitmask_error_ = nullptr;
+  bool bitmask_thread_exit_ = false;
+  // The request states and the token flags of the bitmasks computed in the background.
+  Array<RequestModelState> async_bitmask_mstates_;
+  std::vector<int8_t> async_require_mask_;
+
+  /*! \brief A row of the token count table, with the host copy of its counts. */
+  struct TokenCntSlot {
+    /*! \brief The request state owning the row. It is only compared, never dereferenced. */
+    const Object* owner = nullptr;
+    /*! \brief The number of committed tokens of the owner counted in the row. */
+    int64_t num_synced_tokens = 0;
+    /*! \brief The last step the row is used in. */
+    int64_t last_used_step = -1;
+    /*! \brief The nonzero counts of the row. */
+    std::unordered_map<int32_t, int32_t> token_cnt;
+  };
+  static constexpr int kMinTokenCntSlots = 16;
+  // The occurrence times of the committed tokens of each row, (num_slots, vocab_size) int32.
+  NDArray token_cnt_table_device_;
+  std::vector<TokenCntSlot> token_cnt_slots_;
+  // The number of steps that apply penalties with the token count table.
+  int64_t token_cnt_table_step_ = 0;
 };
 
 LogitProcessor::LogitProcessor(int max_num_token, int vocab_size, FunctionTable* ft,
-                               DLDevice device, Optional<EventTraceRecorder> trace_recorder) {
+                               DLDevice device, StagingArena staging_arena,
+                               Optional<EventTraceRecorder> trace_recorder) {
   data_ = make_object<LogitProcessorImpl>(max_num_token, vocab_size, ft, device,
-                                          std::move(trace_recorder));
+                                          std::move(staging_arena), std::move(trace_recorder));
 }
 
 }  // namespace serve
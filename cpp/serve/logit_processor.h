@@ -15,6 +15,7 @@
 #include "event_trace_recorder.h"
 #include "function_table.h"
 #include "request_state.h"
+#include "staging_arena.h"
 
 namespace mlc {
 namespace llm {
@@ -51,6 +52,30 @@ class LogitProcessorObj : public Object {
       const std::vector<int>* cum_num_token = nullptr,
       const std::vector<std::vector<SampleResult>>* draft_tokens = nullptr) = 0;
 
+  /*!
+   * \brief Start computing the next token bitmasks of the given requests in the background,
+   * so that the computation overlaps with the model forward. The bitmasks only depend on the
+   * grammar states committed before the step, and the grammar states must not be changed until
+   * the next InplaceUpdateLogits. If the next InplaceUpdateLogits is called with the same
+   * request states and without draft tokens, it waits for and applies these bitmasks instead
+   * of computing them again.
+   * \param mstates The request states of each sequence in the next batch.
+   */
+  virtual void ComputeTokenBitmaskAsync(const Array<RequestModelState>& mstates) = 0;
+
+  /*!
+   * \brief Get the union of the tokens that the grammars of the given requests allow next,
+   * from the bitmasks started by ComputeTokenBitmaskAsync with the same request states.
+   * The bitmasks are still applied by the next InplaceUpdateLogits.
+   * \param mstates The request states of each sequence in the batch.
+   * \param max_num_tokens The maximum number of tokens in the union.
+   * \param token_ids The allowed token ids in ascending order, as the output.
+   * \return Whether every request is constrained by its grammar, and the union has no more
+   * than `max_num_tokens` tokens.
+   */
+  virtual bool GetAllowedTokenUnion(const Array<RequestModelState>& mstates, int max_num_tokens,
+                                    std::vector<int32_t>* token_ids) = 0;
+
   /*!
    * \brief Compute probability distributions for the input batch of logits.
    * \param logits The batch of updated logits.
@@ -65,6 +90,9 @@ class LogitProcessorObj : public Object {
                                          const Array<String>& request_ids,
                                          const std::vector<int>* cum_num_token = nullptr) = 0;
 
+  /*! \brief Get the bytes of the device arrays that the logit processor holds. */
+  virtual int64_t GetDeviceMemoryBytes() const = 0;
+
   static constexpr const char* _type_key = "mlc.serve.LogitProcessor";
   static constexpr const bool _type_has_method_sequal_reduce = false;
   static constexpr const bool _type_has_method_shash_reduce = false;
@@ -79,10 +107,11 @@ class LogitProcessor : public ObjectRef {
    * \param vocab_size The model's vocabulary size.
    * \param ft The packed function table.
    * \param device The device that the model runs on.
+   * \param staging_arena The staging arena for uploading auxiliary arrays to device.
    * \param trace_recorder The event trace recorder.
    */
   explicit LogitProcessor(int max_num_token, int vocab_size, FunctionTable* ft, DLDevice device,
-                          Optional<EventTraceRecorder> trace_recorder);
+                          StagingArena staging_arena, Optional<EventTraceRecorder> trace_recorder);
 
   TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(LogitProcessor, ObjectRef, LogitProcessorObj);
 };
@@ -0,0 +1,75 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/lora_adapter_pool.cc
+ */
+#include "lora_adapter_pool.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+TVM_REGISTER_OBJECT_TYPE(LoRAAdapterPoolObj);
+
+LoRAAdapterPool::LoRAAdapterPool(int num_slots) {
+  CHECK_GT(num_slots, 0);
+  ObjectPtr<LoRAAdapterPoolObj> n = make_object<LoRAAdapterPoolObj>();
+  n->num_slots = num_slots;
+  n->slots_.resize(num_slots);
+  data_ = std::move(n);
+}
+
+int LoRAAdapterPoolObj::Acquire(const std::string& adapter_path, const Model& model) {
+  ++clock_;
+  auto it = path2slot_.find(adapter_path);
+  if (it != path2slot_.end()) {
+    Slot& slot = slots_[it->second];
+    ++slot.ref_count;
+    slot.last_used = clock_;
+    return it->second;
+  }
+
+  // Pick a free slot, or otherwise the least recently used slot no request applies.
+  int victim = -1;
+  for (int i = 0; i < num_slots; ++i) {
+    if (slots_[i].ref_count > 0) {
+      continue;
+    }
+    if (slots_[i].adapter_path.empty()) {
+      victim = i;
+      break;
+    }
+    if (victim == -1 || slots_[i].last_used < slots_[victim].last_used) {
+      victim = i;
+    }
+  }
+  if (victim == -1) {
+    return -1;
+  }
+
+  model->LoadLoRAAdapter(victim, adapter_path);
+  Slot& slot = slots_[victim];
+  if (!slot.adapter_path.empty()) {
+    path2slot_.erase(slot.adapter_path);
+  }
+  slot.adapter_path = adapter_path;
+  slot.ref_count = 1;
+  slot.last_used = clock_;
+  path2slot_[adapter_path] = victim;
+  return victim;
+}
+
+void LoRAAdapterPoolObj::Release(int slot) {
+  CHECK(slot >= 0 && slot < num_slots);
+  CHECK_GT(slots_[slot].ref_count, 0) << "The LoRA adapter slot " << slot << " is not acquired.";
+  --slots_[slot].ref_count;
+}
+
+void LoRAAdapterPoolObj::Reset() {
+  for (Slot& slot : slots_) {
+    slot.ref_count = 0;
+  }
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
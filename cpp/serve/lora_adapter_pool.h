@@ -0,0 +1,90 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/lora_adapter_pool.h
+ * \brief The pool of LoRA adapters resident on device for multi-adapter serving.
+ */
+#ifndef MLC_LLM_SERVE_LORA_ADAPTER_POOL_H_
+#define MLC_LLM_SERVE_LORA_ADAPTER_POOL_H_
+
+#include <tvm/runtime/container/string.h>
+#include <tvm/runtime/object.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "model.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief The LoRA adapter pool. It keeps a fixed number of adapter slots in the model,
+ * each holding the parameters of one adapter on device. The requests applying the same
+ * adapter share its slot, and the batches mixing requests of different adapters apply each
+ * adapter to its own sequences. When all slots are taken, the least recently used adapter
+ * that no request applies is evicted to load a new one.
+ */
+class LoRAAdapterPoolObj : public Object {
+ public:
+  /*!
+   * \brief Acquire the slot of the adapter at the given path for a request, loading the
+   * adapter into the model when it is not resident.
+   * \param adapter_path The path to the adapter directory.
+   * \param model The model to load the adapter into.
+   * \return The slot of the adapter, or -1 when all slots are applied by running requests.
+   */
+  int Acquire(const std::string& adapter_path, const Model& model);
+
+  /*! \brief Release a slot acquired by `Acquire` when its request is finished or aborted. */
+  void Release(int slot);
+
+  /*! \brief Release all the slots, keeping the adapters resident for later requests. */
+  void Reset();
+
+  /*! \brief The number of adapter slots. */
+  int num_slots = 0;
+
+  static constexpr const char* _type_key = "mlc.serve.LoRAAdapterPool";
+  static constexpr const bool _type_has_method_sequal_reduce = false;
+  static constexpr const bool _type_has_method_shash_reduce = false;
+  TVM_DECLARE_FINAL_OBJECT_INFO(LoRAAdapterPoolObj, Object);
+
+ private:
+  /*! \brief An adapter slot. */
+  struct Slot {
+    /*! \brief The path of the resident adapter, or empty if the slot is free. */
+    std::string adapter_path;
+    /*! \brief The number of requests applying the adapter. */
+    int ref_count = 0;
+    /*! \brief The logical time at which the adapter was last acquired. */
+    int64_t last_used = 0;
+  };
+
+  /*! \brief The adapter slots. */
+  std::vector<Slot> slots_;
+  /*! \brief The slot of each resident adapter, keyed by adapter path. */
+  std::unordered_map<std::string, int> path2slot_;
+  /*! \brief The logical clock advanced at every acquisition. */
+  int64_t clock_ = 0;
+};
+
+class LoRAAdapterPool : public ObjectRef {
+ public:
+  /*!
+   * \brief Create the LoRA adapter pool.
+   * \param num_slots The maximum number of adapters resident on device at the same time.
+   */
+  explicit LoRAAdapterPool(int num_slots);
+
+  TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(LoRAAdapterPool, ObjectRef, LoRAAdapterPoolObj);
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_LORA_ADAPTER_POOL_H_
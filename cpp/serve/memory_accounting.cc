@@ -0,0 +1,136 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/memory_accounting.cc
+ */
+#include "memory_accounting.h"
+
+#include <tvm/runtime/logging.h>
+#include <tvm/runtime/ndarray.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*! \brief Get the bytes of a model parameter. */
+inline int64_t GetParamBytes(const ModelMetadata::Param& param) {
+  int64_t param_size = param.dtype.bytes();
+  for (int64_t v : param.shape) {
+    ICHECK_GE(v, 0);
+    param_size *= v;
+  }
+  return param_size;
+}
+
+int64_t GetNDArrayBytes(const ObjectRef& array) {
+  if (const auto* container = array.as<NDArray::Container>()) {
+    return GetDataSize(container->dl_tensor);
+  }
+  return 0;
+}
+
+int64_t GetModelParamsBytes(const ModelMetadata& metadata) {
+  int64_t params_bytes = 0;
+  for (const ModelMetadata::Param& param : metadata.params) {
+    params_bytes += GetParamBytes(param);
+  }
+  return params_bytes;
+}
+
+std::unordered_set<std::string> SelectOffloadedParams(const ModelMetadata& metadata,
+                                                      int64_t offload_bytes) {
+  // Group the parameters by the decoder layer in their names, e.g. "model.layers.3.mlp...".
+  std::map<int, std::vector<const ModelMetadata::Param*>, std::greater<int>> layer_params;
+  std::vector<const ModelMetadata::Param*> embedding_params;
+  bool has_lm_head = false;
+  for (const ModelMetadata::Param& param : metadata.params) {
+    const std::string& name = param.name;
+    size_t pos = name.find("layers.");
+    if (pos != std::string::npos && std::isdigit(name[pos + 7])) {
+      layer_params[std::atoi(name.c_str() + pos + 7)].push_back(&param);
+    } else if (name.find("embed_tokens") != std::string::npos) {
+      embedding_params.push_back(&param);
+    }
+    has_lm_head |= name.find("lm_head") != std::string::npos;
+  }
+  std::vector<std::vector<const ModelMetadata::Param*>> groups;
+  if (has_lm_head && !embedding_params.empty()) {
+    groups.push_back(std::move(embedding_params));
+  }
+  for (auto& [layer, params] : layer_params) {
+    groups.push_back(std::move(params));
+  }
+
+  std::unordered_set<std::string> offloaded_params;
+  int64_t offloaded_bytes = 0;
+  for (const std::vector<const ModelMetadata::Param*>& group : groups) {
+    if (offloaded_bytes >= offload_bytes) {
+      break;
+    }
+    for (const ModelMetadata::Param* param : group) {
+      offloaded_params.insert(param->name);
+      offloaded_bytes += GetParamBytes(*param);
+    }
+  }
+  return offloaded_params;
+}
+
+double GetKVCacheBytesPerToken(const ModelMetadata& metadata, KVCacheDType kv_cache_dtype,
+                               int kv_cache_page_size) {
+  int64_t num_layers = metadata.kv_cache_metadata.num_hidden_layers;
+  int64_t head_dim = metadata.kv_cache_metadata.head_dim;
+  int64_t num_kv_heads = metadata.kv_cache_metadata.num_key_value_heads;
+  // The K data and V data of each layer, and under quantized storage, the 16-bit scales of
+  // the K data and V data of each layer and KV head in a page, amortized over the page.
+  double kv_bytes_per_token =
+      head_dim * num_kv_heads * num_layers * 2 * KVCacheDTypeBits(kv_cache_dtype) / 8.0 + 1.25;
+  if (kv_cache_dtype != KVCacheDType::kAuto) {
+    kv_bytes_per_token += num_kv_heads * num_layers * 2 * 2.0 / kv_cache_page_size;
+  }
+  return kv_bytes_per_token;
+}
+
+picojson::value DeviceMemoryStats::AsJSON() const {
+  auto f_megabytes = [](int64_t bytes) { return picojson::value(bytes / 1024.0 / 1024.0); };
+  picojson::object owners_json;
+  for (const auto& [owner, owner_stats] : owners) {
+    picojson::object owner_json;
+    owner_json["current_mb"] = f_megabytes(owner_stats.current_bytes);
+    owner_json["peak_mb"] = f_megabytes(owner_stats.peak_bytes);
+    owners_json[owner] = picojson::value(owner_json);
+  }
+  picojson::object config;
+  config["owners"] = picojson::value(owners_json);
+  config["current_mb"] = f_megabytes(current_bytes);
+  config["peak_mb"] = f_megabytes(peak_bytes);
+  config["device_total_mb"] = f_megabytes(device_total_bytes);
+  config["budget_mb"] = f_megabytes(budget_bytes);
+  config["kv_cache_page_fragmentation"] = picojson::value(kv_cache_page_fragmentation);
+  return picojson::value(config);
+}
+
+void DeviceMemoryAccountant::Update(const std::string& owner, int64_t bytes) {
+  DeviceMemoryOwnerStats& owner_stats = stats_.owners[owner];
+  stats_.current_bytes += bytes - owner_stats.current_bytes;
+  owner_stats.current_bytes = bytes;
+  owner_stats.peak_bytes = std::max(owner_stats.peak_bytes, bytes);
+  stats_.peak_bytes = std::max(stats_.peak_bytes, stats_.current_bytes);
+}
+
+void DeviceMemoryAccountant::SetDeviceBudget(int64_t device_total_bytes, int64_t budget_bytes) {
+  stats_.device_total_bytes = device_total_bytes;
+  stats_.budget_bytes = budget_bytes;
+}
+
+void DeviceMemoryAccountant::SetKVCachePageFragmentation(double fragmentation) {
+  stats_.kv_cache_page_fragmentation = fragmentation;
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
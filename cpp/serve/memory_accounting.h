@@ -0,0 +1,108 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/memory_accounting.h
+ * \brief The accounting of the device memory allocated by the engine, tagged by owner, which
+ * validates the memory estimation of engine config inference against the actual usage.
+ */
+#ifndef MLC_LLM_SERVE_MEMORY_ACCOUNTING_H_
+#define MLC_LLM_SERVE_MEMORY_ACCOUNTING_H_
+
+#include <picojson.h>
+#include <tvm/runtime/object.h>
+
+#include <map>
+#include <string>
+#include <unordered_set>
+
+#include "../metadata/model.h"
+#include "config.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief Get the bytes of the given array. Return 0 when the array is undefined or is not an
+ * NDArray (e.g., a DRef under tensor parallelism, whose shards live on the workers).
+ */
+int64_t GetNDArrayBytes(const ObjectRef& array);
+
+/*! \brief Get the total bytes of the model parameters on a single GPU. */
+int64_t GetModelParamsBytes(const ModelMetadata& metadata);
+
+/*!
+ * \brief Select the model parameters kept in host memory under parameter offloading, which
+ * take at least the given bytes unless the candidates run out. The embedding table goes first
+ * when it is not shared with the LM head, since only the rows of the input tokens are read in
+ * each forward pass. The decoder layers follow from the last one, in whole layers.
+ * \return The names of the selected parameters.
+ */
+std::unordered_set<std::string> SelectOffloadedParams(const ModelMetadata& metadata,
+                                                      int64_t offload_bytes);
+
+/*!
+ * \brief Get the bytes of KV cache per token of a model, including the amortized quantization
+ * scales of quantized KV cache storage and the auxiliary data of pages.
+ */
+double GetKVCacheBytesPerToken(const ModelMetadata& metadata, KVCacheDType kv_cache_dtype,
+                               int kv_cache_page_size);
+
+/*! \brief The device memory usage of an owner. */
+struct DeviceMemoryOwnerStats {
+  /*! \brief The bytes the owner currently holds. */
+  int64_t current_bytes = 0;
+  /*! \brief The largest bytes the owner has held at the same time. */
+  int64_t peak_bytes = 0;
+};
+
+/*! \brief The device memory statistics of the engine. */
+struct DeviceMemoryStats {
+  /*! \brief The usage of each owner, ordered by owner name. */
+  std::map<std::string, DeviceMemoryOwnerStats> owners;
+  /*! \brief The bytes all owners currently hold. */
+  int64_t current_bytes = 0;
+  /*! \brief The largest bytes all owners have held at the same time. */
+  int64_t peak_bytes = 0;
+  /*! \brief The total memory of the device. */
+  int64_t device_total_bytes = 0;
+  /*! \brief The memory budget of the engine, by "gpu_memory_utilization". */
+  int64_t budget_bytes = 0;
+  /*!
+   * \brief The fraction of the token slots in used KV cache pages that hold no token, which
+   * the partially filled last pages of sequences waste.
+   */
+  double kv_cache_page_fragmentation = 0.0;
+
+  /*! \brief Return the statistics in JSON, with the bytes in megabytes. */
+  picojson::value AsJSON() const;
+};
+
+/*!
+ * \brief The accountant of device memory. The owners report the bytes they hold, and the
+ * accountant keeps the current and peak usage of each owner and of all owners.
+ */
+class DeviceMemoryAccountant {
+ public:
+  /*! \brief Set the bytes that the owner currently holds. */
+  void Update(const std::string& owner, int64_t bytes);
+
+  /*! \brief Set the device total memory and the memory budget. */
+  void SetDeviceBudget(int64_t device_total_bytes, int64_t budget_bytes);
+
+  /*! \brief Set the fraction of empty token slots in used KV cache pages. */
+  void SetKVCachePageFragmentation(double fragmentation);
+
+  /*! \brief Get the statistics. */
+  const DeviceMemoryStats& GetStats() const { return stats_; }
+
+ private:
+  DeviceMemoryStats stats_;
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_MEMORY_ACCOUNTING_H_
@@ -0,0 +1,163 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/metrics.cc
+ */
+#include "metrics.h"
+
+#include <tvm/runtime/logging.h>
+
+#include <algorithm>
+#include <sstream>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/****************** MetricSeries ******************/
+
+MetricSeries::MetricSeries(std::string labels, std::vector<double> bucket_bounds)
+    : labels(std::move(labels)), bucket_bounds(std::move(bucket_bounds)) {
+  ICHECK(std::is_sorted(this->bucket_bounds.begin(), this->bucket_bounds.end()));
+  bucket_counts_ = std::make_unique<std::atomic<int64_t>[]>(this->bucket_bounds.size() + 1);
+  for (int i = 0; i <= static_cast<int>(this->bucket_bounds.size()); ++i) {
+    bucket_counts_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void MetricSeries::Add(double delta) {
+  double value = value_.load(std::memory_order_relaxed);
+  while (!value_.compare_exchange_weak(value, value + delta, std::memory_order_relaxed)) {
+  }
+}
+
+void MetricSeries::Observe(double sample) {
+  int bucket = std::lower_bound(bucket_bounds.begin(), bucket_bounds.end(), sample) -
+               bucket_bounds.begin();
+  bucket_counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+  double sum = sum_.load(std::memory_order_relaxed);
+  while (!sum_.compare_exchange_weak(sum, sum + sample, std::memory_order_relaxed)) {
+  }
+}
+
+/****************** MetricsRegistry ******************/
+
+TVM_REGISTER_OBJECT_TYPE(MetricsRegistryObj);
+
+MetricSeries* MetricsRegistryObj::GetOrAddSeries(const std::string& name, const std::string& help,
+                                                 MetricType type, const std::string& labels,
+                                                 const std::vector<double>& bucket_bounds) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = std::find_if(families_.begin(), families_.end(),
+                         [&name](const Family& family) { return family.name == name; });
+  if (it == families_.end()) {
+    families_.push_back(Family{name, help, type, {}});
+    it = families_.end() - 1;
+  }
+  CHECK(it->type == type) << "The metric \"" << name << "\" is registered with another type.";
+  for (const std::unique_ptr<MetricSeries>& series : it->series) {
+    if (series->labels == labels) {
+      return series.get();
+    }
+  }
+  it->series.push_back(std::make_unique<MetricSeries>(labels, bucket_bounds));
+  return it->series.back().get();
+}
+
+std::string MetricsRegistryObj::RenderOpenMetrics(
+    const std::vector<std::pair<std::string, const MetricsRegistryObj*>>& registries) {
+  // - Collect the families by name, keeping the order of registration.
+  struct RenderFamily {
+    const Family* family;
+    std::vector<std::pair<std::string, const MetricSeries*>> series;
+  };
+  std::vector<RenderFamily> render_families;
+  std::vector<std::unique_lock<std::mutex>> locks;
+  locks.reserve(registries.size());
+  for (const auto& [registry_labels, registry] : registries) {
+    locks.emplace_back(registry->mutex_);
+    for (const Family& family : registry->families_) {
+      auto it = std::find_if(
+          render_families.begin(), render_families.end(),
+          [&family](const RenderFamily& f) { return f.family->name == family.name; });
+      if (it == render_families.end()) {
+        render_families.push_back(RenderFamily{&family, {}});
+        it = render_families.end() - 1;
+      }
+      for (const std::unique_ptr<MetricSeries>& series : family.series) {
+        std::string labels = registry_labels;
+        if (!labels.empty() && !series->labels.empty()) {
+          labels += ",";
+        }
+        labels += series->labels;
+        it->series.push_back({std::move(labels), series.get()});
+      }
+    }
+  }
+
+  // - Render the families.
+  std::ostringstream os;
+  auto f_labels = [](const std::string& labels, const std::string& extra_label = "") {
+    std::string all_labels = labels;
+    if (!all_labels.empty() && !extra_label.empty()) {
+      all_labels += ",";
+    }
+    all_labels += extra_label;
+    return all_labels.empty() ? std::string() : "{" + all_labels + "}";
+  };
+  for (const RenderFamily& render_family : render_families) {
+    const Family& family = *render_family.family;
+    static const char* kTypeNames[] = {"counter", "gauge", "histogram"};
+    os << "# TYPE " << family.name << " " << kTypeNames[static_cast<int>(family.type)] << "\n";
+    os << "# HELP " << family.name << " " << family.help << "\n";
+    for (const auto& [labels, series] : render_family.series) {
+      if (family.type == MetricType::kCounter) {
+        os << family.name << "_total" << f_labels(labels) << " "
+           << series->value_.load(std::memory_order_relaxed) << "\n";
+      } else if (family.type == MetricType::kGauge) {
+        os << family.name << f_labels(labels) << " "
+           << series->value_.load(std::memory_order_relaxed) << "\n";
+      } else {
+        int64_t cumulative_count = 0;
+        for (int i = 0; i <= static_cast<int>(series->bucket_bounds.size()); ++i) {
+          cumulative_count += series->bucket_counts_[i].load(std::memory_order_relaxed);
+          std::ostringstream bound;
+          if (i < static_cast<int>(series->bucket_bounds.size())) {
+            bound << series->bucket_bounds[i];
+          } else {
+            bound << "+Inf";
+          }
+          os << family.name << "_bucket" << f_labels(labels, "le=\"" + bound.str() + "\"") << " "
+             << cumulative_count << "\n";
+        }
+        os << family.name << "_sum" << f_labels(labels) << " "
+           << series->sum_.load(std::memory_order_relaxed) << "\n";
+        // The count is the +Inf bucket, so that the rendered histogram stays consistent.
+        os << family.name << "_count" << f_labels(labels) << " " << cumulative_count << "\n";
+      }
+    }
+  }
+  os << "# EOF\n";
+  return os.str();
+}
+
+MetricsRegistry MetricsRegistry::Create() {
+  return MetricsRegistry(make_object<MetricsRegistryObj>());
+}
+
+String MetricsRegistry::RenderOpenMetrics() const {
+  return MetricsRegistryObj::RenderOpenMetrics({{"", get()}});
+}
+
+String MetricsRegistry::RenderOpenMetrics(
+    const std::vector<std::pair<std::string, MetricsRegistry>>& registries) {
+  std::vector<std::pair<std::string, const MetricsRegistryObj*>> registry_objs;
+  registry_objs.reserve(registries.size());
+  for (const auto& [labels, registry] : registries) {
+    registry_objs.emplace_back(labels, registry.get());
+  }
+  return MetricsRegistryObj::RenderOpenMetrics(registry_objs);
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
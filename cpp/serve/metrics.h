@@ -0,0 +1,133 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/metrics.h
+ * \brief The registry of engine metrics exported in OpenMetrics text format.
+ */
+#ifndef MLC_LLM_SERVE_METRICS_H_
+#define MLC_LLM_SERVE_METRICS_H_
+
+#include <tvm/runtime/container/string.h>
+#include <tvm/runtime/object.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*! \brief The type of a metric family. */
+enum class MetricType : int {
+  kCounter = 0,
+  kGauge = 1,
+  kHistogram = 2,
+};
+
+/*!
+ * \brief A time series of a metric family, identified by its labels.
+ * The values are atomics, so that the engine thread updates them while other threads render
+ * them without synchronizing with the engine.
+ */
+class MetricSeries {
+ public:
+  explicit MetricSeries(std::string labels, std::vector<double> bucket_bounds = {});
+
+  /*! \brief Set the value of a counter or a gauge. */
+  void Set(double value) { value_.store(value, std::memory_order_relaxed); }
+  /*! \brief Add to the value of a counter or a gauge. */
+  void Add(double delta);
+  /*! \brief Observe a sample of a histogram. */
+  void Observe(double sample);
+
+  /*! \brief The labels in OpenMetrics syntax without braces, e.g., `action="BatchDecode"`. */
+  const std::string labels;
+  /*! \brief The ascending upper bounds of the histogram buckets, excluding +Inf. */
+  const std::vector<double> bucket_bounds;
+
+ private:
+  friend class MetricsRegistryObj;
+
+  std::atomic<double> value_{0.0};
+  /*! \brief The (non-cumulative) sample count of each bucket, with +Inf as the last one. */
+  std::unique_ptr<std::atomic<int64_t>[]> bucket_counts_;
+  std::atomic<double> sum_{0.0};
+};
+
+/*!
+ * \brief The registry of the metrics of an engine.
+ * The series are registered when the engine is created or reconfigured, and they live as
+ * long as the registry, so that the engine keeps raw pointers to them for updates.
+ * Rendering only takes the registry mutex that guards the registration, never the engine.
+ */
+class MetricsRegistryObj : public Object {
+ public:
+  /*!
+   * \brief Get the series of the given family and labels, registering it on the first call.
+   * \param name The family name. The counter samples are suffixed with "_total".
+   * \param help The help text of the family.
+   * \param type The metric type.
+   * \param labels The labels of the series in OpenMetrics syntax without braces.
+   * \param bucket_bounds The ascending upper bounds of the histogram buckets.
+   */
+  MetricSeries* GetOrAddSeries(const std::string& name, const std::string& help, MetricType type,
+                               const std::string& labels = "",
+                               const std::vector<double>& bucket_bounds = {});
+
+  /*!
+   * \brief Render the metrics of the given registries in OpenMetrics text format. The series
+   * of the same family from different registries are merged, with the registry labels
+   * prepended to the series labels.
+   * \param registries The registries and their labels, e.g., `replica="0"`.
+   */
+  static std::string RenderOpenMetrics(
+      const std::vector<std::pair<std::string, const MetricsRegistryObj*>>& registries);
+
+  static constexpr const char* _type_key = "mlc.serve.MetricsRegistry";
+  static constexpr const bool _type_has_method_sequal_reduce = false;
+  static constexpr const bool _type_has_method_shash_reduce = false;
+  TVM_DECLARE_FINAL_OBJECT_INFO(MetricsRegistryObj, Object);
+
+ private:
+  /*! \brief A metric family. */
+  struct Family {
+    std::string name;
+    std::string help;
+    MetricType type;
+    std::vector<std::unique_ptr<MetricSeries>> series;
+  };
+
+  /*! \brief The mutex guarding the registration. */
+  mutable std::mutex mutex_;
+  /*! \brief The metric families in the order of registration. */
+  std::vector<Family> families_;
+};
+
+class MetricsRegistry : public ObjectRef {
+ public:
+  /*! \brief Create an empty metrics registry. */
+  static MetricsRegistry Create();
+
+  /*! \brief Render the metrics of this registry in OpenMetrics text format. */
+  String RenderOpenMetrics() const;
+
+  /*!
+   * \brief Render the metrics of the given labeled registries in OpenMetrics text format.
+   * \sa MetricsRegistryObj::RenderOpenMetrics
+   */
+  static String RenderOpenMetrics(
+      const std::vector<std::pair<std::string, MetricsRegistry>>& registries);
+
+  TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(MetricsRegistry, ObjectRef, MetricsRegistryObj);
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_METRICS_H_
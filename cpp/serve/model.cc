@@ -5,15 +5,22 @@
  */
 #include "model.h"
 
+#include <tvm/runtime/device_api.h>
 #include <tvm/runtime/memory/memory_manager.h>
 #include <tvm/runtime/nvtx.h>
 #include <tvm/runtime/packed_func.h>
 #include <tvm/runtime/registry.h>
 
+#include <exception>
 #include <fstream>
+#include <list>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "../support/json_parser.h"
 #include "config.h"
+#include "device_timer.h"
 #include "logit_processor.h"
 
 namespace mlc {
@@ -70,20 +77,40 @@ class ModelImpl : public ModelObj {
     this->kind = GetMetadata().kv_state_kind;
   }
 
+  ~ModelImpl() {
+    if (params_loader_.joinable()) {
+      params_loader_.join();
+    }
+    if (side_stream_ != nullptr) {
+      DeviceAPI::Get(device_)->FreeStream(device_, side_stream_);
+    }
+  }
+
   /*********************** Model Computation  ***********************/
 
   ObjectRef TokenEmbed(IntTuple token_ids, ObjectRef* dst, int offset) final {
-    NVTXScopedRange nvtx_scope("TokenEmbed");
-    int num_tokens = token_ids.size();
+    return GatherTokenEmbed({std::move(token_ids)}, dst, offset);
+  }
+
+  ObjectRef GatherTokenEmbed(const std::vector<IntTuple>& token_ids, ObjectRef* dst,
+                             int offset) final {
+    TraceScopedRange trace_scope("TokenEmbed");
+    StepPhaseScope phase_scope(StepPhase::kEmbed);
+    int num_tokens = 0;
+    for (const IntTuple& input_token_ids : token_ids) {
+      num_tokens += input_token_ids.size();
+    }
     // Copy input token ids to device.
     DLDataType dtype(DataType::Int(32));
     NDArray token_ids_nd;
     {
-      NVTXScopedRange nvtx_scope("Allocate token_ids at offset");
+      TraceScopedRange trace_scope("Allocate token_ids at offset");
       token_ids_nd = token_ids_storage_->AllocNDArray(offset * 4, {num_tokens}, dtype);
       int* p_token_ids = static_cast<int*>(token_ids_nd->data) + (token_ids_nd->byte_offset) / 4;
-      for (int i = 0; i < num_tokens; ++i) {
-        p_token_ids[i] = token_ids[i];
+      for (const IntTuple& input_token_ids : token_ids) {
+        for (int64_t token_id : input_token_ids) {
+          *p_token_ids++ = token_id;
+        }
       }
     }
     ICHECK_EQ(token_ids_nd->ndim, 1);
@@ -91,7 +118,7 @@ class ModelImpl : public ModelObj {
     ICHECK_NE(prefill_chunk_size_, -1);
     auto token_ids_dref_or_nd = ft_.CopyToWorker0(token_ids_nd, "token_ids", {prefill_chunk_size_});
 
-    ObjectRef embeddings = ft_.embed_func_(token_ids_dref_or_nd, params_);
+    ObjectRef embeddings = ft_.embed_func_(token_ids_dref_or_nd, GetParams());
     if (dst != nullptr) {
       CHECK(dst->defined());
       ft_.nd_copy_embedding_to_offset_func_(embeddings, *dst, offset);
@@ -102,11 +129,36 @@ class ModelImpl : public ModelObj {
     }
   }
 
-  ObjectRef ImageEmbed(const NDArray& image, ObjectRef* dst, int offset) final {
-    NVTXScopedRange nvtx_scope("ImageEmbed");
+  ObjectRef ImageEmbed(const NDArray& image, ObjectRef* dst, int offset,
+                       uint64_t content_hash) final {
+    TraceScopedRange trace_scope("ImageEmbed");
+    StepPhaseScope phase_scope(StepPhase::kEmbed);
     CHECK(ft_.image_embed_func_.defined()) << "`image_embed` function is not found in the model. ";
-    auto image_dref_or_nd = ft_.CopyToWorker0(image, "image", image.Shape());
-    ObjectRef embeddings = ft_.image_embed_func_(image_dref_or_nd, params_);
+    ObjectRef embeddings{nullptr};
+    bool use_cache = content_hash != 0 && image_embedding_cache_size_ > 0;
+    auto it_cached = use_cache ? image_embedding_cache_.find(content_hash)
+                               : image_embedding_cache_.end();
+    if (it_cached != image_embedding_cache_.end()) {
+      // Move the hit entry to the front of the LRU list.
+      image_embedding_lru_.splice(image_embedding_lru_.begin(), image_embedding_lru_,
+                                  it_cached->second);
+      embeddings = it_cached->second->second;
+    } else {
+      auto it_prefetched = content_hash != 0 ? prefetched_image_embeddings_.find(content_hash)
+                                             : prefetched_image_embeddings_.end();
+      if (it_prefetched != prefetched_image_embeddings_.end()) {
+        embeddings = it_prefetched->second;
+        prefetched_image_embeddings_.erase(it_prefetched);
+      } else {
+        auto image_dref_or_nd = ft_.CopyToWorker0(image, "image", image.Shape());
+        embeddings = ft_.image_embed_func_(image_dref_or_nd, GetParams());
+      }
+      if (use_cache) {
+        image_embedding_lru_.emplace_front(content_hash, embeddings);
+        image_embedding_cache_[content_hash] = image_embedding_lru_.begin();
+        EvictImageEmbeddings();
+      }
+    }
     if (dst != nullptr) {
       CHECK(dst->defined());
       ft_.nd_copy_embedding_to_offset_func_(embeddings, *dst, offset);
@@ -117,12 +169,105 @@ class ModelImpl : public ModelObj {
     }
   }
 
+  bool SupportBatchedImageEmbed() const final { return ft_.model_metadata_.batched_image_embed; }
+
+  void PrefetchImageEmbeddings(const std::vector<NDArray>& images,
+                               const std::vector<uint64_t>& content_hashes) final {
+    ICHECK_EQ(images.size(), content_hashes.size());
+    prefetched_image_embeddings_.clear();
+    if (!ft_.image_embed_func_.defined() || !SupportBatchedImageEmbed() || ft_.use_disco) {
+      return;
+    }
+    // - Collect the images to embed, skipping the cached and the repeated ones, and the ones
+    // whose size differs from the first image.
+    std::vector<int> image_indices;
+    std::unordered_set<uint64_t> collected_hashes;
+    int64_t num_images = 0;
+    for (int i = 0; i < static_cast<int>(images.size()); ++i) {
+      if (image_embedding_cache_.count(content_hashes[i]) ||
+          !collected_hashes.insert(content_hashes[i]).second) {
+        continue;
+      }
+      if (!image_indices.empty()) {
+        const NDArray& first_image = images[image_indices[0]];
+        if (images[i]->shape[2] != first_image->shape[2] ||
+            images[i]->shape[3] != first_image->shape[3]) {
+          continue;
+        }
+      }
+      image_indices.push_back(i);
+      num_images += images[i]->shape[0];
+    }
+    if (image_indices.size() < 2) {
+      return;
+    }
+
+    TraceScopedRange trace_scope("BatchImageEmbed");
+    StepPhaseScope phase_scope(StepPhase::kEmbed);
+    // - Gather the images into one batch on device, whose size is padded to a power of two,
+    // so that the vision encoder runs in a few batch sizes.
+    int64_t padded_num_images = 1;
+    while (padded_num_images < num_images) {
+      padded_num_images *= 2;
+    }
+    const NDArray& first_image = images[image_indices[0]];
+    int64_t image_bytes = GetDataSize(*first_image.operator->()) / first_image->shape[0];
+    if (!image_batch_buffer_.defined() ||
+        image_batch_buffer_->shape[0] < padded_num_images * image_bytes) {
+      image_batch_buffer_ =
+          NDArray::Empty({padded_num_images * image_bytes}, DataType::UInt(8), device_);
+    }
+    NDArray image_batch = image_batch_buffer_.CreateView(
+        {padded_num_images, first_image->shape[1], first_image->shape[2], first_image->shape[3]},
+        first_image->dtype);
+    int64_t image_offset = 0;
+    for (int i : image_indices) {
+      NDArray image_view =
+          image_batch.CreateView(images[i].Shape(), images[i]->dtype, image_offset * image_bytes);
+      image_view.CopyFrom(images[i]);
+      image_offset += images[i]->shape[0];
+    }
+    // The padded images are left uninitialized. The images do not attend to each other in
+    // the vision encoder, so that the padding does not change the embeddings of the others.
+    NDArray embeddings = Downcast<NDArray>(ft_.image_embed_func_(image_batch, GetParams()));
+
+    // - Split the embeddings of each input, which are consumed by ImageEmbed.
+    int64_t embed_size_per_image = embeddings->shape[0] / padded_num_images;
+    int64_t row_bytes = embeddings->shape[1] * embeddings.DataType().bytes();
+    image_offset = 0;
+    for (int i : image_indices) {
+      int64_t embed_size = images[i]->shape[0] * embed_size_per_image;
+      prefetched_image_embeddings_[content_hashes[i]] =
+          embeddings.CreateView({embed_size, embeddings->shape[1]}, embeddings->dtype,
+                                image_offset * embed_size_per_image * row_bytes);
+      image_offset += images[i]->shape[0];
+    }
+  }
+
   bool CanGetLogits() final {
     return ft_.get_logits_func_.defined() && ft_.batch_get_logits_func_.defined();
   }
 
+  bool CanTokenEmbedOnDevice() final { return !ft_.use_disco; }
+
+  ObjectRef TokenEmbedOnDevice(const NDArray& token_ids_on_device) final {
+    TraceScopedRange trace_scope("TokenEmbedOnDevice");
+    StepPhaseScope phase_scope(StepPhase::kEmbed);
+    CHECK(!ft_.use_disco) << "Embedding token ids on device is not supported with disco.";
+    ICHECK_EQ(token_ids_on_device->ndim, 1);
+    ICHECK(token_ids_on_device.DataType() == DataType::Int(32));
+    return ft_.embed_func_(token_ids_on_device, GetParams());
+  }
+
+  bool CanPrefillToLastHidden() final {
+    return ft_.prefill_to_last_hidden_func_.defined() &&
+           ft_.single_batch_prefill_to_last_hidden_func_.defined() &&
+           ft_.gather_hidden_states_func_.defined();
+  }
+
   NDArray GetLogits(const ObjectRef& hidden_states) final {
-    NVTXScopedRange nvtx_scope("GetLogits");
+    TraceScopedRange trace_scope("GetLogits");
+    StepPhaseScope phase_scope(StepPhase::kLogits);
     CHECK(ft_.get_logits_func_.defined()) << "`get_logits` function is not found in the model.";
 
     ObjectRef hidden_states_dref_or_nd{nullptr};
@@ -131,7 +276,7 @@ class ModelImpl : public ModelObj {
     } else {
       hidden_states_dref_or_nd = hidden_states;
     }
-    ObjectRef ret = ft_.get_logits_func_(hidden_states_dref_or_nd, params_);
+    ObjectRef ret = ft_.get_logits_func_(hidden_states_dref_or_nd, GetParams());
     if (trace_enabled_) {
       TVMSynchronize(device_.device_type, device_.device_id, nullptr);
     }
@@ -146,11 +291,12 @@ class ModelImpl : public ModelObj {
   }
 
   Array<NDArray> GetMultiStepLogits(const ObjectRef& hidden_states) final {
-    NVTXScopedRange nvtx_scope("GetMultiStepLogits");
+    TraceScopedRange trace_scope("GetMultiStepLogits");
+    StepPhaseScope phase_scope(StepPhase::kLogits);
     CHECK(ft_.get_logits_func_.defined()) << "`get_logits` function is not found in the model.";
 
     ObjectRef hidden_states_dref_or_nd{nullptr};
-    ObjectRef ret = ft_.get_logits_func_(hidden_states, params_);
+    ObjectRef ret = ft_.get_logits_func_(hidden_states, GetParams());
     Array<NDArray> logits{nullptr};
     if (ft_.use_disco) {
       logits = Downcast<DRef>(ret)->DebugGetFromRemote(0);
@@ -160,9 +306,49 @@ class ModelImpl : public ModelObj {
     return logits;
   }
 
+  bool CanGetLogitsForTokens() final {
+    return ft_.get_logits_for_tokens_func_.defined() && ft_.decode_to_last_hidden_func_.defined() &&
+           ft_.single_batch_decode_to_last_hidden_func_.defined();
+  }
+
+  NDArray GetLogitsForTokens(const ObjectRef& hidden_states,
+                             const std::vector<int32_t>& token_ids) final {
+    TraceScopedRange trace_scope("GetLogitsForTokens num_tokens=" +
+                                 std::to_string(token_ids.size()));
+    StepPhaseScope phase_scope(StepPhase::kLogits);
+    CHECK(ft_.get_logits_for_tokens_func_.defined())
+        << "`get_logits_for_tokens` function is not found in the model.";
+    ICHECK(!token_ids.empty());
+    ICHECK_LE(static_cast<int>(token_ids.size()), vocab_size_);
+    if (!logits_token_ids_arr_.defined()) {
+      logits_token_ids_arr_ =
+          NDArray::Empty({vocab_size_}, DataType::Int(32), Device{DLDeviceType::kDLCPU, 0});
+    }
+    NDArray token_ids_nd = logits_token_ids_arr_.CreateView(
+        {static_cast<int64_t>(token_ids.size())}, DataType::Int(32));
+    token_ids_nd.CopyFromBytes(token_ids.data(), token_ids.size() * sizeof(int32_t));
+    ObjectRef token_ids_dref_or_nd =
+        ft_.CopyToWorker0(token_ids_nd, "logits_token_ids", {vocab_size_});
+
+    ObjectRef ret =
+        ft_.get_logits_for_tokens_func_(hidden_states, token_ids_dref_or_nd, GetParams());
+    if (trace_enabled_) {
+      TVMSynchronize(device_.device_type, device_.device_id, nullptr);
+    }
+    NDArray logits{nullptr};
+    if (ft_.use_disco) {
+      logits = Downcast<DRef>(ret)->DebugGetFromRemote(0);
+    } else {
+      logits = Downcast<NDArray>(ret);
+    }
+    // logits: (b, v)
+    return logits;
+  }
+
   ObjectRef FuseEmbedHidden(const ObjectRef& embeddings, const ObjectRef& previous_hidden_states,
                             int batch_size, int seq_len) final {
-    NVTXScopedRange nvtx_scope("FuseEmbedHidden");
+    TraceScopedRange trace_scope("FuseEmbedHidden");
+    StepPhaseScope phase_scope(StepPhase::kEmbed);
 
     ObjectRef embeddings_dref_or_nd{nullptr};
     if (!embeddings->IsInstance<DRefObj>()) {
@@ -187,7 +373,7 @@ class ModelImpl : public ModelObj {
       previous_hidden_states_dref_or_nd = previous_hidden_states;
     }
     ObjectRef fused = ft_.fuse_embed_hidden_func_(embeddings_dref_or_nd,
-                                                  previous_hidden_states_dref_or_nd, params_);
+                                                  previous_hidden_states_dref_or_nd, GetParams());
     if (trace_enabled_) {
       TVMSynchronize(device_.device_type, device_.device_id, nullptr);
     }
@@ -204,7 +390,8 @@ class ModelImpl : public ModelObj {
 
   NDArray BatchPrefill(const ObjectRef& embeddings, const std::vector<int64_t>& seq_ids,
                        const std::vector<int>& lengths) final {
-    NVTXScopedRange nvtx_scope("BatchPrefill");
+    TraceScopedRange trace_scope("BatchPrefill");
+    StepPhaseScope phase_scope(StepPhase::kForward);
     CHECK(!seq_ids.empty());
     CHECK_EQ(seq_ids.size(), lengths.size());
     int num_sequences = seq_ids.size();
@@ -248,12 +435,17 @@ class ModelImpl : public ModelObj {
     ICHECK_NE(max_num_sequence_, -1);
     ObjectRef logit_pos_dref_or_nd =
         ft_.CopyToWorker0(logit_pos_nd, "logit_pos", {max_num_sequence_});
+    ObjectRef lora_indices_dref_or_nd = GetLoRAAdapterIndices(seq_ids);
     // args: embeddings, logit_pos, kv_cache, params
     ObjectRef ret;
-    if (seq_ids.size() == 1) {
-      ret = ft_.single_batch_prefill_func_(embeddings_dref_or_nd, kv_cache_, params_);
+    if (lora_indices_dref_or_nd.defined()) {
+      // args: embeddings, logit_pos, kv_cache, params, adapter indices, adapter params
+      ret = ft_.prefill_lora_func_(embeddings_dref_or_nd, logit_pos_dref_or_nd, kv_cache_,
+                                   GetParams(), lora_indices_dref_or_nd, lora_adapters_);
+    } else if (seq_ids.size() == 1) {
+      ret = ft_.single_batch_prefill_func_(embeddings_dref_or_nd, kv_cache_, GetParams());
     } else {
-      ret = ft_.prefill_func_(embeddings_dref_or_nd, logit_pos_dref_or_nd, kv_cache_, params_);
+      ret = ft_.prefill_func_(embeddings_dref_or_nd, logit_pos_dref_or_nd, kv_cache_, GetParams());
     }
     NDArray logits;
     if (ft_.use_disco) {
@@ -277,7 +469,8 @@ class ModelImpl : public ModelObj {
   ObjectRef BatchPrefillToLastHidden(const ObjectRef& embedding_or_hidden_states,
                                      const std::vector<int64_t>& seq_ids,
                                      const std::vector<int>& lengths) final {
-    NVTXScopedRange nvtx_scope("BatchPrefillToLastHidden");
+    TraceScopedRange trace_scope("BatchPrefillToLastHidden");
+    StepPhaseScope phase_scope(StepPhase::kForward);
     CHECK(!seq_ids.empty());
     CHECK_EQ(seq_ids.size(), lengths.size());
     int num_sequences = seq_ids.size();
@@ -315,10 +508,10 @@ class ModelImpl : public ModelObj {
       CHECK(ft_.single_batch_prefill_to_last_hidden_func_.defined())
           << "`single_batch_prefill_to_last_hidden_states` function is not found in the model.";
       result = ft_.single_batch_prefill_to_last_hidden_func_(embedding_or_hidden_states_dref_or_nd,
-                                                             kv_cache_, params_);
+                                                             kv_cache_, GetParams());
     } else {
       result = ft_.prefill_to_last_hidden_func_(embedding_or_hidden_states_dref_or_nd, kv_cache_,
-                                                params_);
+                                                GetParams());
     }
     ObjectRef hidden_states = ft_.tuple_getitem_func_(result, 0);
 
@@ -341,7 +534,8 @@ class ModelImpl : public ModelObj {
   }
 
   NDArray BatchDecode(const ObjectRef& embeddings, const std::vector<int64_t>& seq_ids) final {
-    NVTXScopedRange nvtx_scope("BatchDecode num_seqs=" + std::to_string(seq_ids.size()));
+    TraceScopedRange trace_scope("BatchDecode num_seqs=" + std::to_string(seq_ids.size()));
+    StepPhaseScope phase_scope(StepPhase::kForward);
     int num_sequence = seq_ids.size();
 
     CHECK(ft_.decode_func_.defined())
@@ -374,12 +568,17 @@ class ModelImpl : public ModelObj {
       embeddings_dref_or_nd = ft_.nd_view_func_(embeddings, embedding_shape);
     }
 
+    ObjectRef lora_indices_dref_or_nd = GetLoRAAdapterIndices(seq_ids);
     // args: embeddings, kv_cache, params
     ObjectRef ret;
-    if (seq_ids.size() == 1) {
-      ret = ft_.single_batch_decode_func_(embeddings_dref_or_nd, kv_cache_, params_);
+    if (lora_indices_dref_or_nd.defined()) {
+      // args: embeddings, kv_cache, params, adapter indices, adapter params
+      ret = ft_.decode_lora_func_(embeddings_dref_or_nd, kv_cache_, GetParams(),
+                                  lora_indices_dref_or_nd, lora_adapters_);
+    } else if (seq_ids.size() == 1) {
+      ret = ft_.single_batch_decode_func_(embeddings_dref_or_nd, kv_cache_, GetParams());
     } else {
-      ret = ft_.decode_func_(embeddings_dref_or_nd, kv_cache_, params_);
+      ret = ft_.decode_func_(embeddings_dref_or_nd, kv_cache_, GetParams());
     }
     NDArray logits;
     if (ft_.use_disco) {
@@ -400,10 +599,60 @@ class ModelImpl : public ModelObj {
     return logits;
   }
 
+  bool CanDecodeEarlyExit() final { return ft_.decode_early_exit_func_.defined(); }
+
+  NDArray BatchDecodeEarlyExit(const ObjectRef& embeddings,
+                               const std::vector<int64_t>& seq_ids) final {
+    TraceScopedRange trace_scope("BatchDecodeEarlyExit num_seqs=" +
+                                 std::to_string(seq_ids.size()));
+    StepPhaseScope phase_scope(StepPhase::kForward);
+    int num_sequence = seq_ids.size();
+
+    CHECK(ft_.decode_early_exit_func_.defined())
+        << "`batch_decode_early_exit` function is not found in the model. Please make sure the "
+           "model is compiled with a positive \"self_spec_num_layers\".";
+    ICHECK(kv_cache_.defined()) << "KV cache has not been initialized.";
+
+    IntTuple seq_ids_tuple(seq_ids);
+    IntTuple lengths_tuple(std::vector<int64_t>(/*n=*/seq_ids.size(), /*v=*/1));
+    ft_.kv_cache_begin_forward_func_(kv_cache_, seq_ids_tuple, lengths_tuple);
+
+    ObjectRef embeddings_dref_or_nd;
+    if (!embeddings->IsInstance<DRefObj>()) {
+      NDArray embeddings_nd = Downcast<NDArray>(embeddings);
+      ICHECK_NE(hidden_size_, -1);
+      ICHECK_EQ(embeddings_nd->ndim, 2);
+      ICHECK_GE(embeddings_nd->shape[0], num_sequence);
+      embeddings_dref_or_nd =
+          embeddings_nd.CreateView({num_sequence, 1, hidden_size_}, embeddings_nd->dtype);
+    } else {
+      ShapeTuple embedding_shape{num_sequence, 1, hidden_size_};
+      embeddings_dref_or_nd = ft_.nd_view_func_(embeddings, embedding_shape);
+    }
+
+    // args: embeddings, kv_cache, params
+    ObjectRef ret = ft_.decode_early_exit_func_(embeddings_dref_or_nd, kv_cache_, GetParams());
+    NDArray logits;
+    if (ft_.use_disco) {
+      Array<ObjectRef> result = Downcast<DRef>(ret)->DebugGetFromRemote(0);
+      logits = Downcast<NDArray>(result[0]);
+    } else {
+      logits = Downcast<Array<NDArray>>(ret)[0];
+    }
+    ft_.kv_cache_end_forward_func_(kv_cache_);
+
+    // logits: (b, 1, v)
+    ICHECK_EQ(logits->ndim, 3);
+    ICHECK_EQ(logits->shape[0], num_sequence);
+    ICHECK_EQ(logits->shape[1], 1);
+    return logits;
+  }
+
   ObjectRef BatchDecodeToLastHidden(const ObjectRef& hidden_states_dref_or_nd,
                                     const std::vector<int64_t>& seq_ids) final {
-    NVTXScopedRange nvtx_scope("BatchDecodeToLastHidden num_seqs=" +
-                               std::to_string(seq_ids.size()));
+    TraceScopedRange trace_scope("BatchDecodeToLastHidden num_seqs=" +
+                                 std::to_string(seq_ids.size()));
+    StepPhaseScope phase_scope(StepPhase::kForward);
     int num_sequence = seq_ids.size();
 
     CHECK(ft_.decode_to_last_hidden_func_.defined())
@@ -424,9 +673,9 @@ class ModelImpl : public ModelObj {
       CHECK(ft_.single_batch_decode_to_last_hidden_func_.defined())
           << "`decode_to_last_hidden_states` function is not found in the model.";
       result = ft_.single_batch_decode_to_last_hidden_func_(hidden_states_dref_or_nd, kv_cache_,
-                                                            params_);
+                                                            GetParams());
     } else {
-      result = ft_.decode_to_last_hidden_func_(hidden_states_dref_or_nd, kv_cache_, params_);
+      result = ft_.decode_to_last_hidden_func_(hidden_states_dref_or_nd, kv_cache_, GetParams());
     }
     ft_.kv_cache_end_forward_func_(kv_cache_);
     ObjectRef hidden_states = ft_.tuple_getitem_func_(result, 0);
@@ -450,7 +699,8 @@ class ModelImpl : public ModelObj {
   }
 
   NDArray BatchVerify(const ObjectRef& embeddings, const std::vector<int64_t>& seq_ids,
-                      const std::vector<int>& lengths) final {
+                      const std::vector<int>& lengths,
+                      const std::vector<int64_t>& token_tree_parent_ptr) final {
     CHECK(!seq_ids.empty());
     CHECK_EQ(seq_ids.size(), lengths.size());
     int num_sequences = seq_ids.size();
@@ -459,7 +709,8 @@ class ModelImpl : public ModelObj {
       total_length += lengths[i];
     }
 
-    NVTXScopedRange nvtx_scope("BatchVerify num_tokens=" + std::to_string(total_length));
+    TraceScopedRange trace_scope("BatchVerify num_tokens=" + std::to_string(total_length));
+    StepPhaseScope phase_scope(StepPhase::kForward);
 
     CHECK(ft_.verify_func_.defined())
         << "`verify_with_embed` function is not found in the model. Please make sure the model is "
@@ -471,7 +722,14 @@ class ModelImpl : public ModelObj {
     // Begin forward with the sequence ids and new lengths.
     IntTuple seq_ids_tuple(seq_ids);
     IntTuple lengths_tuple(lengths.begin(), lengths.end());
-    ft_.kv_cache_begin_forward_func_(kv_cache_, seq_ids_tuple, lengths_tuple);
+    if (token_tree_parent_ptr.empty()) {
+      ft_.kv_cache_begin_forward_func_(kv_cache_, seq_ids_tuple, lengths_tuple);
+    } else {
+      CHECK(SupportTokenTreeVerify()) << "The model does not support verifying token trees.";
+      CHECK_EQ(token_tree_parent_ptr.size(), total_length);
+      ft_.kv_cache_begin_forward_func_(kv_cache_, seq_ids_tuple, lengths_tuple,
+                                       IntTuple(token_tree_parent_ptr));
+    }
 
     ObjectRef embeddings_dref_or_nd;
     if (!embeddings->IsInstance<DRefObj>()) {
@@ -490,7 +748,7 @@ class ModelImpl : public ModelObj {
       embeddings_dref_or_nd = ft_.nd_view_func_(embeddings, embedding_shape);
     }
     // args: embeddings, logit_pos, kv_cache, params
-    ObjectRef ret = ft_.verify_func_(embeddings_dref_or_nd, kv_cache_, params_);
+    ObjectRef ret = ft_.verify_func_(embeddings_dref_or_nd, kv_cache_, GetParams());
     NDArray logits;
     if (ft_.use_disco) {
       Array<ObjectRef> result = Downcast<DRef>(ret)->DebugGetFromRemote(0);
@@ -512,7 +770,8 @@ class ModelImpl : public ModelObj {
 
   ObjectRef BatchVerifyToLastHidden(const ObjectRef& embeddings,
                                     const std::vector<int64_t>& seq_ids,
-                                    const std::vector<int>& lengths) final {
+                                    const std::vector<int>& lengths,
+                                    const std::vector<int64_t>& token_tree_parent_ptr) final {
     CHECK(!seq_ids.empty());
     CHECK_EQ(seq_ids.size(), lengths.size());
     int num_sequences = seq_ids.size();
@@ -520,8 +779,9 @@ class ModelImpl : public ModelObj {
     for (int i = 0; i < num_sequences; ++i) {
       total_length += lengths[i];
     }
-    NVTXScopedRange nvtx_scope("BatchVerifyToLastHidden num_tokens=" +
-                               std::to_string(total_length));
+    TraceScopedRange trace_scope("BatchVerifyToLastHidden num_tokens=" +
+                                 std::to_string(total_length));
+    StepPhaseScope phase_scope(StepPhase::kForward);
 
     CHECK(ft_.verify_to_last_hidden_func_.defined())
         << "`batch_verify_to_last_hidden_states` function is not found in the model.";
@@ -548,10 +808,18 @@ class ModelImpl : public ModelObj {
     // Begin forward with the sequence ids and new lengths.
     IntTuple seq_ids_tuple(seq_ids);
     IntTuple lengths_tuple(lengths.begin(), lengths.end());
-    ft_.kv_cache_begin_forward_func_(kv_cache_, seq_ids_tuple, lengths_tuple);
+    if (token_tree_parent_ptr.empty()) {
+      ft_.kv_cache_begin_forward_func_(kv_cache_, seq_ids_tuple, lengths_tuple);
+    } else {
+      CHECK(SupportTokenTreeVerify()) << "The model does not support verifying token trees.";
+      CHECK_EQ(token_tree_parent_ptr.size(), total_length);
+      ft_.kv_cache_begin_forward_func_(kv_cache_, seq_ids_tuple, lengths_tuple,
+                                       IntTuple(token_tree_parent_ptr));
+    }
 
     // args: embeddings, logit_pos, kv_cache, params
-    ObjectRef result = ft_.verify_to_last_hidden_func_(embeddings_dref_or_nd, kv_cache_, params_);
+    ObjectRef result =
+        ft_.verify_to_last_hidden_func_(embeddings_dref_or_nd, kv_cache_, GetParams());
     ft_.kv_cache_end_forward_func_(kv_cache_);
     ObjectRef hidden_states = ft_.tuple_getitem_func_(result, 0);
     if (trace_enabled_) {
@@ -574,18 +842,37 @@ class ModelImpl : public ModelObj {
   /*********************** KV Cache Management  ***********************/
 
   void CreateKVCache(int page_size, int max_num_sequence, int64_t max_total_sequence_length,
-                     int64_t prefill_chunk_size, int max_history_size) final {
+                     int64_t prefill_chunk_size, int max_history_size,
+                     KVCacheDType kv_cache_dtype) final {
     //  KVStateKind kv_state_kind) final {
     KVStateKind kv_state_kind = GetMetadata().kv_state_kind;
+    // Release the previous KV cache first when the KV cache is recreated with new capacities,
+    // so that its memory can be reused by the new one.
+    kv_cache_ = ObjectRef{nullptr};
+    local_kv_cache_ = ObjectRef{nullptr};
     if (kv_state_kind == KVStateKind::kKVCache) {
+      PackedFunc create_kv_cache_func = ft_.create_kv_cache_func_;
+      if (kv_cache_dtype != KVCacheDType::kAuto) {
+        // The quantized KV cache and the attention kernels reading it are compiled into
+        // the model library, with the storage data type appended to the function name.
+        std::string dtype_suffix = "_" + KVCacheDTypeToString(kv_cache_dtype);
+        create_kv_cache_func = ft_.mod_get_func("create_flashinfer_paged_kv_cache" + dtype_suffix);
+        if (!create_kv_cache_func.defined()) {
+          create_kv_cache_func = ft_.mod_get_func("create_tir_paged_kv_cache" + dtype_suffix);
+        }
+        CHECK(create_kv_cache_func.defined())
+            << "The model library is not compiled with the KV cache of dtype \""
+            << KVCacheDTypeToString(kv_cache_dtype) << "\".";
+      }
+      kv_cache_dtype_ = kv_cache_dtype;
       IntTuple max_num_sequence_tuple{max_num_sequence};
       IntTuple max_total_sequence_length_tuple{max_total_sequence_length};
       IntTuple prefill_chunk_size_tuple{prefill_chunk_size};
       IntTuple page_size_tuple{page_size};
       IntTuple support_sliding_window{sliding_window_size_ != -1};
-      kv_cache_ = ft_.create_kv_cache_func_(max_num_sequence_tuple, max_total_sequence_length_tuple,
-                                            prefill_chunk_size_tuple, page_size_tuple,
-                                            support_sliding_window);
+      kv_cache_ = create_kv_cache_func(max_num_sequence_tuple, max_total_sequence_length_tuple,
+                                       prefill_chunk_size_tuple, page_size_tuple,
+                                       support_sliding_window);
       local_kv_cache_ =
           ft_.use_disco ? Downcast<DRef>(kv_cache_)->DebugGetFromRemote(0) : kv_cache_;
     } else if (kv_state_kind == KVStateKind::kRNNState) {
@@ -609,13 +896,36 @@ class ModelImpl : public ModelObj {
   }
 
   void ForkSequence(int64_t parent_seq_id, int64_t child_seq_id, int64_t fork_pos) final {
+    auto it_lora = seq_lora_slots_.find(parent_seq_id);
+    if (it_lora != seq_lora_slots_.end()) {
+      seq_lora_slots_[child_seq_id] = it_lora->second;
+    }
     if (ft_.model_metadata_.kv_state_kind == KVStateKind::kNone) {
       return;
     }
     ft_.kv_cache_fork_sequence_func_(kv_cache_, parent_seq_id, child_seq_id, fork_pos);
   }
 
+  void ForkSequences(int64_t parent_seq_id, const std::vector<int64_t>& child_seq_ids) final {
+    auto it_lora = seq_lora_slots_.find(parent_seq_id);
+    if (it_lora != seq_lora_slots_.end()) {
+      int lora_slot = it_lora->second;
+      for (int64_t child_seq_id : child_seq_ids) {
+        seq_lora_slots_[child_seq_id] = lora_slot;
+      }
+    }
+    if (ft_.model_metadata_.kv_state_kind == KVStateKind::kNone) {
+      return;
+    }
+    // Forking at the end of the parent only references the parent pages in the children, and
+    // copies nothing until a child writes into the last partially filled page.
+    for (int64_t child_seq_id : child_seq_ids) {
+      ft_.kv_cache_fork_sequence_func_(kv_cache_, parent_seq_id, child_seq_id, /*fork_pos=*/-1);
+    }
+  }
+
   void RemoveSequence(int64_t seq_id) final {
+    seq_lora_slots_.erase(seq_id);
     if (this->kind == KVStateKind::kNone) {
       return;
     }
@@ -639,6 +949,119 @@ class ModelImpl : public ModelObj {
     }
   }
 
+  bool SupportTokenTreeVerify() const final {
+    return this->kind == KVStateKind::kKVCache &&
+           ft_.kv_cache_commit_accepted_token_tree_nodes_func_.defined();
+  }
+
+  void CommitAcceptedTokenTreeNodes(const std::vector<int64_t>& seq_ids,
+                                    const std::vector<int64_t>& accepted_leaf_indices) final {
+    CHECK(SupportTokenTreeVerify()) << "The model does not support verifying token trees.";
+    CHECK_EQ(seq_ids.size(), accepted_leaf_indices.size());
+    ft_.kv_cache_commit_accepted_token_tree_nodes_func_(kv_cache_, IntTuple(seq_ids),
+                                                        IntTuple(accepted_leaf_indices));
+  }
+
+  bool SupportKVSwap() const final {
+    // Sliding window sequences do not keep the KV data of all tokens,
+    // and thus cannot be restored from a plain copy.
+    // The quantized KV cache cannot be read and written in the activation data type.
+    return this->kind == KVStateKind::kKVCache && !ft_.use_disco && sliding_window_size_ == -1 &&
+           kv_cache_dtype_ == KVCacheDType::kAuto && ft_.kv_cache_debug_get_kv_func_.defined() &&
+           ft_.kv_cache_debug_set_kv_func_.defined();
+  }
+
+  Array<NDArray> SwapOutSequence(int64_t seq_id, int64_t length) final {
+    CHECK(SupportKVSwap()) << "The model does not support swapping KV cache.";
+    Array<NDArray> kv_data_device = GetSequenceKV(seq_id, length);
+
+    // The host arrays are allocated from a pooled allocator of page-locked memory when
+    // available, so that repeated swaps reuse the pinned buffers.
+    Device device_host = GetKVSwapHostDevice();
+    memory::Allocator* allocator =
+        memory::MemoryManager::GetOrCreateAllocator(device_host, memory::AllocatorType::kPooled);
+    ICHECK_NOTNULL(allocator);
+    ShapeTuple shape = kv_data_device[0].Shape();
+    NDArray k_data_host = allocator->Empty(shape, hidden_states_dtype_, device_host);
+    NDArray v_data_host = allocator->Empty(shape, hidden_states_dtype_, device_host);
+    k_data_host.CopyFrom(kv_data_device[0]);
+    v_data_host.CopyFrom(kv_data_device[1]);
+    TVMSynchronize(device_.device_type, device_.device_id, nullptr);
+    return {k_data_host, v_data_host};
+  }
+
+  void SwapInSequence(int64_t seq_id, const Array<NDArray>& kv_data) final {
+    CHECK(SupportKVSwap()) << "The model does not support swapping KV cache.";
+    ImportSequenceKV(seq_id, kv_data);
+  }
+
+  Array<NDArray> ExportSequenceKV(int64_t seq_id, int64_t length, Device device) final {
+    CHECK(SupportKVSwap()) << "The model does not support exporting KV cache.";
+    Array<NDArray> kv_data_device = GetSequenceKV(seq_id, length);
+    if (device.device_type == device_.device_type && device.device_id == device_.device_id) {
+      return kv_data_device;
+    }
+    // Device-to-device copies go through peer access when the runtime supports it.
+    ShapeTuple shape = kv_data_device[0].Shape();
+    NDArray k_data = NDArray::Empty(shape, hidden_states_dtype_, device);
+    NDArray v_data = NDArray::Empty(shape, hidden_states_dtype_, device);
+    k_data.CopyFrom(kv_data_device[0]);
+    v_data.CopyFrom(kv_data_device[1]);
+    TVMSynchronize(device_.device_type, device_.device_id, nullptr);
+    return {k_data, v_data};
+  }
+
+  void ImportSequenceKV(int64_t seq_id, const Array<NDArray>& kv_data) final {
+    CHECK(SupportKVSwap()) << "The model does not support importing KV cache.";
+    ICHECK_EQ(kv_data.size(), 2);
+    const ModelMetadata::KVCacheMetadata& kv_metadata = ft_.model_metadata_.kv_cache_metadata;
+    CHECK(kv_data[0]->ndim == 4 && kv_data[0]->shape[0] == kv_metadata.num_hidden_layers &&
+          kv_data[0]->shape[2] == kv_metadata.num_key_value_heads &&
+          kv_data[0]->shape[3] == kv_metadata.head_dim)
+        << "The KV data to import does not match the KV cache layout of the model.";
+    int64_t length = kv_data[0]->shape[1];
+    NDArray k_data_device = kv_data[0];
+    NDArray v_data_device = kv_data[1];
+    if (k_data_device->device.device_type != device_.device_type ||
+        k_data_device->device.device_id != device_.device_id) {
+      k_data_device = NDArray::Empty(kv_data[0].Shape(), kv_data[0].DataType(), device_);
+      v_data_device = NDArray::Empty(kv_data[1].Shape(), kv_data[1].DataType(), device_);
+      k_data_device.CopyFrom(kv_data[0]);
+      v_data_device.CopyFrom(kv_data[1]);
+    }
+
+    ft_.kv_cache_add_sequence_func_(kv_cache_, seq_id);
+    // Reserve the KV cache pages for the sequence, and then write the KV data into them.
+    ft_.kv_cache_begin_forward_func_(kv_cache_, IntTuple{seq_id}, IntTuple{length});
+    ft_.kv_cache_debug_set_kv_func_(kv_cache_, seq_id, 0, k_data_device, v_data_device);
+    ft_.kv_cache_end_forward_func_(kv_cache_);
+  }
+
+  /*********************** LoRA Adapters  ***********************/
+
+  bool SupportLoRA() const final {
+    return !ft_.use_disco && ft_.prefill_lora_func_.defined() && ft_.decode_lora_func_.defined();
+  }
+
+  void LoadLoRAAdapter(int slot, const String& adapter_path) final {
+    CHECK(SupportLoRA()) << "The model library is not compiled with LoRA support.";
+    CHECK_GE(slot, 0);
+    while (static_cast<int>(lora_adapters_.size()) <= slot) {
+      lora_adapters_.push_back(Array<NDArray>());
+    }
+    lora_adapters_.Set(slot, ft_.LoadLoRAAdapter(adapter_path, device_));
+  }
+
+  void SetSequenceLoRAAdapter(int64_t seq_id, int slot) final {
+    if (slot == -1) {
+      seq_lora_slots_.erase(seq_id);
+      return;
+    }
+    CHECK(slot >= 0 && slot < static_cast<int>(lora_adapters_.size()))
+        << "The LoRA adapter slot " << slot << " has not been loaded.";
+    seq_lora_slots_[seq_id] = slot;
+  }
+
   /************** Raw Info Query **************/
 
   ModelMetadata GetMetadata() const final { return ft_.model_metadata_; }
@@ -661,14 +1084,54 @@ class ModelImpl : public ModelObj {
     }
   }
 
+  int64_t GetCachedInputBufferBytes() const final { return ft_.cached_buffer_bytes; }
+
   /*********************** Utilities  ***********************/
 
-  void LoadParams() final { this->params_ = ft_.LoadParams(model_, device_); }
+  void LoadParams(bool in_background) final {
+    if (!in_background || ft_.use_disco) {
+      // The disco session cannot be driven from multiple threads.
+      this->params_ = ft_.LoadParams(model_, device_);
+      return;
+    }
+    ICHECK(!params_loader_.joinable());
+    params_loader_ = std::thread([this]() {
+      try {
+        this->params_ = ft_.LoadParams(model_, device_);
+      } catch (...) {
+        params_load_error_ = std::current_exception();
+      }
+    });
+  }
+
+  void SetOffloadedParams(std::unordered_set<std::string> param_names) final {
+    if (param_names.empty()) {
+      ft_.offloaded_params.clear();
+      return;
+    }
+    if (ft_.use_disco || ft_.model_metadata_.params.empty() ||
+        (device_.device_type != kDLCUDA && device_.device_type != kDLROCM)) {
+      LOG(WARNING) << "Parameter offloading is only supported on CUDA and ROCm without tensor "
+                      "parallelism. All the parameters are loaded to the device.";
+      return;
+    }
+    ft_.offloaded_params = std::move(param_names);
+  }
+
+  const std::unordered_set<std::string>& GetOffloadedParams() const final {
+    return ft_.offloaded_params;
+  }
+
+  void SetWeightShardCacheDir(std::string cache_dir) final {
+    ft_.weight_shard_cache_dir = std::move(cache_dir);
+  }
 
   void SetMaxNumSequence(int max_num_sequence) final {
     this->max_num_sequence_ = max_num_sequence;
     this->logit_pos_arr_ =
         NDArray::Empty({max_num_sequence}, DataType::Int(32), Device{DLDeviceType::kDLCPU, 0});
+    this->lora_indices_arr_ =
+        NDArray::Empty({max_num_sequence}, DataType::Int(32), Device{DLDeviceType::kDLCPU, 0});
   }
 
   void SetPrefillChunkSize(int prefill_chunk_size) final {
@@ -681,9 +1144,15 @@ class ModelImpl : public ModelObj {
         allocator->Alloc(device_host, {prefill_chunk_size_}, DataType::Int(32)), allocator);
   }
 
+  void SetImageEmbeddingCacheSize(int cache_size) final {
+    CHECK_GE(cache_size, 0);
+    image_embedding_cache_size_ = cache_size;
+    EvictImageEmbeddings();
+  }
+
   LogitProcessor CreateLogitProcessor(int max_num_token,
                                       Optional<EventTraceRecorder> trace_recorder) final {
-    return LogitProcessor(max_num_token, vocab_size_, &this->ft_, device_,
+    return LogitProcessor(max_num_token, vocab_size_, &this->ft_, device_, GetStagingArena(),
                           std::move(trace_recorder));
   }
 
@@ -691,7 +1160,7 @@ class ModelImpl : public ModelObj {
                         Optional<EventTraceRecorder> trace_recorder) final {
     if (Sampler::SupportGPUSampler(device_)) {
       return Sampler::CreateGPUSampler(max_num_sample, vocab_size_, &this->ft_, device_,
-                                       std::move(trace_recorder));
+                                       GetStagingArena(), std::move(trace_recorder));
     } else {
       return Sampler::CreateCPUSampler(std::move(trace_recorder));
     }
@@ -754,12 +1223,38 @@ class ModelImpl : public ModelObj {
   }
 
   void Reset() final {
+    seq_lora_slots_.clear();
     // Reset the KV cache.
     if (kv_cache_.defined()) {
       ft_.reset_kv_cache_func_(kv_cache_);
     }
   }
 
+  /*********************** Side stream ***********************/
+
+  bool SupportSideStream() const final {
+    return !ft_.use_disco && (device_.device_type == kDLCUDA || device_.device_type == kDLROCM);
+  }
+
+  void BeginSideStream() final {
+    ICHECK(SupportSideStream());
+    DeviceAPI* device_api = DeviceAPI::Get(device_);
+    if (side_stream_ == nullptr) {
+      side_stream_ = device_api->CreateStream(device_);
+    }
+    compute_stream_ = device_api->GetCurrentStream(device_);
+    device_api->SyncStreamFromTo(device_, compute_stream_, side_stream_);
+    device_api->SetStream(device_, side_stream_);
+  }
+
+  void EndSideStream() final { DeviceAPI::Get(device_)->SetStream(device_, compute_stream_); }
+
+  void SyncSideStream() final {
+    if (side_stream_ != nullptr) {
+      DeviceAPI::Get(device_)->SyncStreamFromTo(device_, side_stream_, compute_stream_);
+    }
+  }
+
   /********************** Utilities for speculative decoding **********************/
 
   DraftTokenWorkspaceManager CreateDraftTokenWorkspaceManager(int max_num_tokens) {
@@ -839,6 +1334,79 @@ class ModelImpl : public ModelObj {
   }
 
  private:
+  /*! \brief Get the parameters, waiting for the background loading to finish if any. */
+  const ObjectRef& GetParams() {
+    if (params_loader_.joinable()) {
+      params_loader_.join();
+      if (params_load_error_ != nullptr) {
+        std::rethrow_exception(params_load_error_);
+      }
+    }
+    return params_;
+  }
+
+  /*!
+   * \brief Copy the LoRA adapter slot of each given sequence to the device, where -1 stands
+   * for the base model. Return a null reference when no sequence applies an adapter, in which
+   * case the batch runs the functions without LoRA.
+   */
+  ObjectRef GetLoRAAdapterIndices(const std::vector<int64_t>& seq_ids) {
+    if (seq_lora_slots_.empty()) {
+      return ObjectRef{nullptr};
+    }
+    int num_sequences = seq_ids.size();
+    ICHECK_LE(num_sequences, max_num_sequence_);
+    int* p_lora_indices = static_cast<int*>(lora_indices_arr_->data);
+    bool has_adapter = false;
+    for (int i = 0; i < num_sequences; ++i) {
+      auto it = seq_lora_slots_.find(seq_ids[i]);
+      p_lora_indices[i] = it != seq_lora_slots_.end() ? it->second : -1;
+      has_adapter |= p_lora_indices[i] != -1;
+    }
+    if (!has_adapter) {
+      return ObjectRef{nullptr};
+    }
+    NDArray lora_indices_nd = lora_indices_arr_.CreateView({num_sequences}, DataType::Int(32));
+    return ft_.CopyToWorker0(lora_indices_nd, "lora_adapter_indices", {max_num_sequence_});
+  }
+
+  /*! \brief Get the staging arena shared by the logit processor and sampler of the model. */
+  StagingArena GetStagingArena() {
+    if (!staging_arena_.defined()) {
+      staging_arena_ = StagingArena(device_);
+    }
+    return staging_arena_;
+  }
+
+  /*! \brief Return the host device holding the swapped-out KV cache. */
+  Device GetKVSwapHostDevice() const {
+    if (device_.device_type == kDLCUDA) {
+      return Device{kDLCUDAHost, 0};
+    } else if (device_.device_type == kDLROCM) {
+      return Device{kDLROCMHost, 0};
+    }
+    return Device{kDLCPU, 0};
+  }
+
+  /*! \brief Copy the KV data of the first `length` tokens of a sequence to new device arrays. */
+  Array<NDArray> GetSequenceKV(int64_t seq_id, int64_t length) {
+    const ModelMetadata::KVCacheMetadata& kv_metadata = ft_.model_metadata_.kv_cache_metadata;
+    ShapeTuple shape{kv_metadata.num_hidden_layers, length, kv_metadata.num_key_value_heads,
+                     kv_metadata.head_dim};
+    NDArray k_data_device = NDArray::Empty(shape, hidden_states_dtype_, device_);
+    NDArray v_data_device = NDArray::Empty(shape, hidden_states_dtype_, device_);
+    ft_.kv_cache_debug_get_kv_func_(kv_cache_, seq_id, 0, length, k_data_device, v_data_device);
+    return {k_data_device, v_data_device};
+  }
+
+  /*! \brief Evict the least recently used image embeddings beyond the cache size. */
+  void EvictImageEmbeddings() {
+    while (static_cast<int>(image_embedding_lru_.size()) > image_embedding_cache_size_) {
+      image_embedding_cache_.erase(image_embedding_lru_.back().first);
+      image_embedding_lru_.pop_back();
+    }
+  }
+
   /*! \brief Load model configuration from JSON. */
   void LoadModelConfigJSON(const picojson::object& config) {
     this->sliding_window_size_ =
@@ -878,13 +1446,40 @@ class ModelImpl : public ModelObj {
   // except that it is always a local object.
   ObjectRef kv_cache_{nullptr};
   ObjectRef local_kv_cache_{nullptr};
+  // The storage data type of the KV cache.
+  KVCacheDType kv_cache_dtype_ = KVCacheDType::kAuto;
   // Runtime device
   Device device_;
   // Model parameters
   ObjectRef params_;
+  // The thread loading the parameters in background, and the error it raised
+  std::thread params_loader_;
+  std::exception_ptr params_load_error_ = nullptr;
   // Shared NDArray
   memory::Storage token_ids_storage_{nullptr};
   NDArray logit_pos_arr_{nullptr};
+  // The host array of the token ids whose logits are computed, allocated on first use.
+  NDArray logits_token_ids_arr_{nullptr};
+  // The parameters of each LoRA adapter slot, the adapter slot of the sequences applying
+  // an adapter, and the host array of the per-sequence adapter slots in a batch.
+  Array<ObjectRef> lora_adapters_;
+  std::unordered_map<int64_t, int> seq_lora_slots_;
+  NDArray lora_indices_arr_{nullptr};
+  // The device image embeddings of the recently embedded images in LRU order, and their
+  // positions in the LRU list by image content hash.
+  int image_embedding_cache_size_ = 0;
+  std::list<std::pair<uint64_t, ObjectRef>> image_embedding_lru_;
+  std::unordered_map<uint64_t, std::list<std::pair<uint64_t, ObjectRef>>::iterator>
+      image_embedding_cache_;
+  // The embeddings computed in a batch by PrefetchImageEmbeddings for this prefill step, and
+  // the device buffer that the batched images are gathered into.
+  std::unordered_map<uint64_t, ObjectRef> prefetched_image_embeddings_;
+  NDArray image_batch_buffer_{nullptr};
+  // The staging arena for uploading auxiliary arrays of logit processor and sampler.
+  StagingArena staging_arena_{nullptr};
+  // The side stream of the model, and the compute stream to switch back to from it.
+  TVMStreamHandle side_stream_ = nullptr;
+  TVMStreamHandle compute_stream_ = nullptr;
   // A boolean indicating if tracing is enabled.
   bool trace_enabled_;
   // An enum indicating whether it's RNN-based.
@@ -905,7 +1500,8 @@ TVM_REGISTER_GLOBAL("mlc.copy_embedding_to_offset")
       copy_dst.shape = embedding->shape;
       copy_dst.byte_offset =
           offset * embedding->shape[1] * ((embedding->dtype.bits * embedding->dtype.lanes + 7) / 8);
-      NDArray::CopyFromTo(&copy_src, &copy_dst);
+      NDArray::CopyFromTo(&copy_src, &copy_dst,
+                          DeviceAPI::Get(dst->device)->GetCurrentStream(dst->device));
     });
 
 }  // namespace serve
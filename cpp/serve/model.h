@@ -47,22 +47,6 @@ struct ModelWorkspace {
    * model parallelism is not enabled, or a DRef when using tensor model parallelism.
    */
   ObjectRef hidden_states{nullptr};
-
-  /*!
-   * \brief The draft token probabilities tensor for the current batch.
-   */
-  NDArray draft_probs{nullptr};
-
-  /*!
-   * \brief The hidden_states tensor storing the hidden_states of draft tokens of all requests.
-   */
-  ObjectRef draft_hidden_states_storage{nullptr};
-
-  /*!
-   * \brief The draft token probabilities tensor storing the probabilities of draft tokens of all
-   * requests.
-   */
-  NDArray draft_probs_storage{nullptr};
 };
 
 /*!
@@ -108,12 +92,47 @@ class ModelObj : public Object {
   virtual ObjectRef TokenEmbed(IntTuple batch_token_ids, ObjectRef* dst = nullptr,
                                int offset = 0) = 0;
 
+  /*!
+   * \brief Compute embeddings for the concatenation of the input token ids, which are gathered
+   * into the host staging buffer in one pass and embedded in one call.
+   * \param token_ids The token ids to concatenate and compute embedding for.
+   * \param dst The destination array of the embedding lookup.
+   * \param offset The token offset where the computed embeddings will be written
+   * into the destination array.
+   * \return The updated destination embedding array or the computed embeddings.
+   * \sa TokenEmbed
+   */
+  virtual ObjectRef GatherTokenEmbed(const std::vector<IntTuple>& token_ids,
+                                     ObjectRef* dst = nullptr, int offset = 0) = 0;
+
   /*!
    * \brief Compute embeddings for the input image.
    * \param image The image to compute embedding for.
+   * \param content_hash The hash of the image content, or 0 if unknown. The embeddings of
+   * the images with known hashes are cached on device, and reused for the same hash.
    * \return The computed embeddings.
+   * \note The cached embeddings are returned when `dst` is undefined, which must not be
+   * written to.
+   */
+  virtual ObjectRef ImageEmbed(const NDArray& image, ObjectRef* dst = nullptr, int offset = 0,
+                               uint64_t content_hash = 0) = 0;
+
+  /*!
+   * \brief Check if the model embeds a batch of images of shape (n, 3, h, w) in one
+   * ImageEmbed call. Otherwise ImageEmbed only takes a single image.
    */
-  virtual ObjectRef ImageEmbed(const NDArray& image, ObjectRef* dst = nullptr, int offset = 0) = 0;
+  virtual bool SupportBatchedImageEmbed() const = 0;
+
+  /*!
+   * \brief Embed the images of a prefill step in one batched call of the vision encoder. The
+   * embeddings are consumed by the ImageEmbed calls of the same content hashes that follow
+   * in the step, which then skip the encoder. The images already in the embedding cache are
+   * skipped, and so are the images whose size differs from the first one.
+   * \param images The images to embed, each of shape (n, 3, h, w).
+   * \param content_hashes The nonzero content hash of each image.
+   */
+  virtual void PrefetchImageEmbeddings(const std::vector<NDArray>& images,
+                                       const std::vector<uint64_t>& content_hashes) = 0;
 
   /*!
    * \brief Fuse the embeddings and hidden_states.
@@ -132,6 +151,23 @@ class ModelObj : public Object {
    */
   virtual bool CanGetLogits() = 0;
 
+  /*!
+   * \brief Return if the model can prefill to the hidden states of all input tokens, and
+   * gather the hidden states of the given positions.
+   */
+  virtual bool CanPrefillToLastHidden() = 0;
+
+  /*! \brief Return if the model can embed token ids that reside on its device. */
+  virtual bool CanTokenEmbedOnDevice() = 0;
+
+  /*!
+   * \brief Compute the embeddings of the token ids that reside on the device of the model,
+   * e.g., the tokens sampled by the GPU sampler, without copying the ids from host.
+   * \param token_ids_on_device The 1-D int32 token ids on device.
+   * \return The embeddings of the tokens.
+   */
+  virtual ObjectRef TokenEmbedOnDevice(const NDArray& token_ids_on_device) = 0;
+
   /*!
    * \brief Compute logits for last hidden_states.
    * \param last_hidden_states The last hidden_states to compute logits for.
@@ -141,6 +177,22 @@ class ModelObj : public Object {
 
   virtual Array<NDArray> GetMultiStepLogits(const ObjectRef& last_hidden_states) = 0;
 
+  /*!
+   * \brief Return if the model can decode to the last hidden states and compute the logits
+   * of a subset of the vocabulary from them.
+   */
+  virtual bool CanGetLogitsForTokens() = 0;
+
+  /*!
+   * \brief Compute the logits of the given tokens only, which projects the hidden states onto
+   * the lm_head rows of the tokens. The logits of the other tokens are the minimum float.
+   * \param last_hidden_states The last hidden_states to compute logits for.
+   * \param token_ids The tokens to compute the logits of.
+   * \return The computed logits, in shape (num_hidden_states, vocab_size).
+   */
+  virtual NDArray GetLogitsForTokens(const ObjectRef& last_hidden_states,
+                                     const std::vector<int32_t>& token_ids) = 0;
+
   /*!
    * \brief Batch prefill function. Embedding in, logits out.
    * The embedding order of sequences in `embedding_arr` follows
@@ -175,6 +227,21 @@ class ModelObj : public Object {
    */
   virtual NDArray BatchDecode(const ObjectRef& embeddings, const std::vector<int64_t>& seq_ids) = 0;
 
+  /*! \brief Return if the model is compiled with an early-exit decode function. */
+  virtual bool CanDecodeEarlyExit() = 0;
+
+  /*!
+   * \brief Batch decode through the early-exit subset of the layers, whose output goes through
+   * the final norm and the lm_head. The KV of the skipped layers at the decoded positions is
+   * left unwritten, and the decoded positions are expected to be popped from the KV cache
+   * before the next full forward of the sequences.
+   * \param embeddings The embedding of last generated token in the entire batch.
+   * \param seq_id The id of the sequence in the KV cache.
+   * \return The early-exit logits for the next token for each sequence in the batch.
+   */
+  virtual NDArray BatchDecodeEarlyExit(const ObjectRef& embeddings,
+                                       const std::vector<int64_t>& seq_ids) = 0;
+
   /*!
    * \brief Batch decode function. Input hidden_states are computed from
    * input embeddings and previous hidden_states, output last hidden_states.
@@ -190,13 +257,18 @@ class ModelObj : public Object {
    * \param embeddings The embedding of the input to be verified.
    * \param seq_id The id of the sequence in the KV cache.
    * \param lengths The length of each sequence to verify.
+   * \param token_tree_parent_ptr The parent of each input token in the token tree of its
+   * sequence, as the position inside the sequence's input, or -1 for the first input token.
+   * Empty means the input tokens of each sequence form a chain. The accepted nodes of a
+   * token tree must be committed by `CommitAcceptedTokenTreeNodes` afterwards.
    * \return The logits for the draft token for each sequence in the batch.
    * \note The function runs for **every** sequence in the batch.
    * That is to say, it does not accept "running a verify step for a subset
    * of the full batch".
    */
   virtual NDArray BatchVerify(const ObjectRef& embeddings, const std::vector<int64_t>& seq_ids,
-                              const std::vector<int>& lengths) = 0;
+                              const std::vector<int>& lengths,
+                              const std::vector<int64_t>& token_tree_parent_ptr = {}) = 0;
 
   /*!
    * \brief Batch verify function. Input hidden_states are computed from
@@ -204,14 +276,17 @@ class ModelObj : public Object {
    * \param hidden_states The hidden_states of the input to be verified.
    * \param seq_id The id of the sequence in the KV cache.
    * \param lengths The length of each sequence to verify.
+   * \param token_tree_parent_ptr The parent of each input token in the token tree of its
+   * sequence, in the same format as `BatchVerify`.
    * \return The hidden_states for the draft token for each sequence in the batch.
    * \note The function runs for **every** sequence in the batch.
    * That is to say, it does not accept "running a verify step for a subset
    * of the full batch".
    */
-  virtual ObjectRef BatchVerifyToLastHidden(const ObjectRef& hidden_states,
-                                            const std::vector<int64_t>& seq_ids,
-                                            const std::vector<int>& lengths) = 0;
+  virtual ObjectRef BatchVerifyToLastHidden(
+      const ObjectRef& hidden_states, const std::vector<int64_t>& seq_ids,
+      const std::vector<int>& lengths,
+      const std::vector<int64_t>& token_tree_parent_ptr = {}) = 0;
 
   /*********************** KV Cache Management  ***********************/
 
@@ -226,9 +301,13 @@ class ModelObj : public Object {
    * are allowed to exist in the KV cache at any time.
    * \param max_history_size The maximum history size for RNN state to roll back.
    * The KV cache does not need this.
+   * \param kv_cache_dtype The storage data type of the KV cache. The quantized data types
+   * require the model library to be compiled with the KV cache creation function of the data
+   * type, e.g., "create_flashinfer_paged_kv_cache_int8".
    */
   virtual void CreateKVCache(int page_size, int max_num_sequence, int64_t max_total_sequence_length,
-                             int64_t prefill_chunk_size, int max_history_size) = 0;
+                             int64_t prefill_chunk_size, int max_history_size,
+                             KVCacheDType kv_cache_dtype = KVCacheDType::kAuto) = 0;
 
   /*! \brief Add a new sequence with the given sequence id to the KV cache. */
   virtual void AddNewSequence(int64_t seq_id) = 0;
@@ -236,12 +315,32 @@ class ModelObj : public Object {
   /*! \brief Fork a sequence from a given parent sequence. */
   virtual void ForkSequence(int64_t parent_seq_id, int64_t child_seq_id, int64_t fork_pos = -1) = 0;
 
+  /*!
+   * \brief Fork a group of sequences from the same parent sequence at the end of the parent.
+   * The children share all the KV cache pages of the parent, so that the parent prompt is
+   * prefilled once for all of them.
+   */
+  virtual void ForkSequences(int64_t parent_seq_id, const std::vector<int64_t>& child_seq_ids) = 0;
+
   /*! \brief Remove the given sequence from the KV cache in the model. */
   virtual void RemoveSequence(int64_t seq_id) = 0;
 
   /*! \brief Pop out N pages from KV cache. */
   virtual void PopNFromKVCache(int64_t seq_id, int num_tokens) = 0;
 
+  /*! \brief Check if the model supports verifying token trees in `BatchVerify`. */
+  virtual bool SupportTokenTreeVerify() const = 0;
+
+  /*!
+   * \brief Keep only the accepted path of the token tree in the last `BatchVerify` in the
+   * KV cache, and remove the other tree nodes.
+   * \param seq_ids The ids of the sequences in the last `BatchVerify`.
+   * \param accepted_leaf_indices The position of the last accepted node inside the input
+   * of each sequence. The path from the first input token to the node is kept.
+   */
+  virtual void CommitAcceptedTokenTreeNodes(const std::vector<int64_t>& seq_ids,
+                                            const std::vector<int64_t>& accepted_leaf_indices) = 0;
+
   /*!
    * \brief Enabling sliding window for the given sequence.
    * It is a no-op if the model does not support sliding window.
@@ -251,6 +350,76 @@ class ModelObj : public Object {
    */
   virtual void EnableSlidingWindowForSeq(int64_t seq_id) = 0;
 
+  /*!
+   * \brief Check if the KV cache of sequences can be swapped out to host
+   * memory and swapped back in later. The quantized KV cache does not support it.
+   */
+  virtual bool SupportKVSwap() const = 0;
+
+  /*!
+   * \brief Copy the KV data of the first `length` tokens of the given sequence to host memory.
+   * The sequence itself is left untouched in the KV cache.
+   * \param seq_id The id of the sequence to swap out.
+   * \param length The number of tokens whose KV data is copied.
+   * \return The K data and V data on host, each of shape
+   * (num_hidden_layers, length, num_key_value_heads, head_dim).
+   */
+  virtual Array<NDArray> SwapOutSequence(int64_t seq_id, int64_t length) = 0;
+
+  /*!
+   * \brief Add a new sequence to the KV cache, and fill it with the KV data
+   * returned by `SwapOutSequence`.
+   * \param seq_id The id of the sequence to swap in. It must not exist in the KV cache.
+   * \param kv_data The K data and V data on host.
+   */
+  virtual void SwapInSequence(int64_t seq_id, const Array<NDArray>& kv_data) = 0;
+
+  /*!
+   * \brief Copy the KV data of the first `length` tokens of the given sequence to the given
+   * device, so that the sequence can be handed over to the engine on that device.
+   * The sequence itself is left untouched in the KV cache.
+   * \param seq_id The id of the sequence to export.
+   * \param length The number of tokens whose KV data is copied.
+   * \param device The device to copy the KV data to, which can be the device of another
+   * engine, or the host for the transfers across nodes.
+   * \return The K data and V data on the given device, each of shape
+   * (num_hidden_layers, length, num_key_value_heads, head_dim).
+   */
+  virtual Array<NDArray> ExportSequenceKV(int64_t seq_id, int64_t length, Device device) = 0;
+
+  /*!
+   * \brief Add a new sequence to the KV cache, and fill it with the KV data
+   * returned by `ExportSequenceKV` of a model with the same architecture.
+   * \param seq_id The id of the sequence to import. It must not exist in the KV cache.
+   * \param kv_data The K data and V data, which can be on any device.
+   */
+  virtual void ImportSequenceKV(int64_t seq_id, const Array<NDArray>& kv_data) = 0;
+
+  /*********************** LoRA Adapters  ***********************/
+
+  /*!
+   * \brief Check if the model can run batches whose sequences apply different LoRA adapters.
+   * It requires the model library to be compiled with the "batch_prefill_lora" and
+   * "batch_decode_lora" functions.
+   */
+  virtual bool SupportLoRA() const = 0;
+
+  /*!
+   * \brief Load the LoRA adapter at the given path into the given adapter slot, replacing
+   * the adapter previously loaded into the slot.
+   * \param slot The adapter slot to load into.
+   * \param adapter_path The path to the adapter directory, which holds an NDArray cache.
+   */
+  virtual void LoadLoRAAdapter(int slot, const String& adapter_path) = 0;
+
+  /*!
+   * \brief Apply the LoRA adapter in the given slot to the given sequence in the subsequent
+   * `BatchPrefill` and `BatchDecode`. The sequences forked from it apply the same adapter.
+   * \param seq_id The id of the sequence, which must have been added to the KV cache.
+   * \param slot The adapter slot, or -1 for running the sequence with the base model only.
+   */
+  virtual void SetSequenceLoRAAdapter(int64_t seq_id, int slot) = 0;
+
   /************** Raw Info Query **************/
 
   /*! \brief Return the metadata JSON object of the model. */
@@ -262,10 +431,39 @@ class ModelObj : public Object {
   /*! \brief Get the current total sequence length in the KV cache. */
   virtual int GetCurrentTotalSequenceLength() const = 0;
 
+  /*!
+   * \brief Get the bytes of the device buffers that the model caches to copy its inputs to,
+   * which grow on demand.
+   */
+  virtual int64_t GetCachedInputBufferBytes() const = 0;
+
   /*********************** Utilities  ***********************/
 
-  /*! \brief Load the model's weight parameters, which is not loaded at construction time. */
-  virtual void LoadParams() = 0;
+  /*!
+   * \brief Load the model's weight parameters, which is not loaded at construction time.
+   * \param in_background Whether to load the parameters on a background thread and return
+   * immediately. The model functions wait for the loading to finish on their first run.
+   * It does not take effect under tensor parallelism.
+   */
+  virtual void LoadParams(bool in_background) = 0;
+
+  /*!
+   * \brief Set the parameters kept in page-locked host memory instead of the device memory,
+   * which takes effect at the next parameter loading. It is ignored when the device kernels
+   * cannot read host memory in place, or under tensor parallelism.
+   * \sa SelectOffloadedParams
+   */
+  virtual void SetOffloadedParams(std::unordered_set<std::string> param_names) = 0;
+
+  /*! \brief Get the parameters kept in page-locked host memory. */
+  virtual const std::unordered_set<std::string>& GetOffloadedParams() const = 0;
+
+  /*!
+   * \brief Set the directory of the cache of the preprocessed weight shards, which takes effect
+   * at the next parameter loading. It only takes effect under tensor parallelism.
+   * \sa EngineConfigNode::weight_shard_cache_dir
+   */
+  virtual void SetWeightShardCacheDir(std::string cache_dir) = 0;
 
   /*!
    * \brief Set the maximum number of sequences to be processed for the model,
@@ -279,6 +477,12 @@ class ModelObj : public Object {
    */
   virtual void SetPrefillChunkSize(int prefill_chunk_size) = 0;
 
+  /*!
+   * \brief Set the maximum number of image embeddings cached on device, evicting the least
+   * recently used ones beyond it. Set 0 to disable the cache.
+   */
+  virtual void SetImageEmbeddingCacheSize(int cache_size) = 0;
+
   /*! \brief Create a logit processor from this model. */
   virtual LogitProcessor CreateLogitProcessor(int max_num_token,
                                               Optional<EventTraceRecorder> trace_recorder) = 0;
@@ -311,6 +515,29 @@ class ModelObj : public Object {
   /*! \brief Reset the model KV cache and other statistics. */
   virtual void Reset() = 0;
 
+  /*********************** Side stream ***********************/
+
+  /*!
+   * \brief Check if the model can run on its own side stream, concurrently with the other
+   * models on the compute stream. It requires a single-GPU CUDA/ROCm device.
+   */
+  virtual bool SupportSideStream() const = 0;
+
+  /*!
+   * \brief Run the subsequent computation of the model on its side stream, after the work
+   * issued so far on the compute stream. The side stream is created at the first call.
+   */
+  virtual void BeginSideStream() = 0;
+
+  /*!
+   * \brief Switch the subsequent computation back to the compute stream. The compute stream
+   * does not wait for the side stream until `SyncSideStream` is called.
+   */
+  virtual void EndSideStream() = 0;
+
+  /*! \brief Make the subsequent work on the compute stream wait for the side stream. */
+  virtual void SyncSideStream() = 0;
+
   /*********************** Utilities for speculative decoding. ***********************/
 
   virtual DraftTokenWorkspaceManager CreateDraftTokenWorkspaceManager(int max_num_token) = 0;
@@ -0,0 +1,509 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/multi_model_engine.cc
+ * \brief The implementation for the multi-model threaded engine in MLC LLM, which keeps
+ * multiple models resident and routes requests to them by model name.
+ */
+#include <tvm/runtime/module.h>
+#include <tvm/runtime/packed_func.h>
+#include <tvm/runtime/registry.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../support/json_parser.h"
+#include "data.h"
+#include "request.h"
+#include "threaded_engine.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using tvm::Device;
+using namespace tvm::runtime;
+
+/*! \brief The GPU memory utilization split across the models when it is not specified. */
+constexpr double kDefaultGPUMemoryUtilization = 0.85;
+
+/*! \brief The implementation of the multi-model ThreadedEngine. */
+class MultiModelThreadedEngineImpl : public ThreadedEngine {
+ public:
+  ~MultiModelThreadedEngineImpl() { ExitBackgroundLoop(); }
+
+  void InitThreadedEngine(Device device, Optional<PackedFunc> request_stream_callback,
+                          Optional<EventTraceRecorder> trace_recorder) final {
+    CHECK(request_stream_callback.defined())
+        << "ThreadedEngine requires request stream callback function, but it is not given.";
+    device_ = device;
+    request_stream_callback_ = request_stream_callback.value();
+    trace_recorder_ = trace_recorder;
+  }
+
+  /*!
+   * \brief Reload all the models. The engine config is a JSON object whose "models" field lists
+   * the engine config of each model, with an additional "name" field that requests are routed
+   * by. The models not listed are unloaded, and the first listed model becomes the default
+   * model. The models without "gpu_memory_utilization" split the "gpu_memory_utilization" of
+   * the engine config evenly.
+   */
+  void Reload(String engine_config_json_str) final {
+    picojson::object config = json::ParseToJSONObject(engine_config_json_str);
+    picojson::array model_configs = json::Lookup<picojson::array>(config, "models");
+    CHECK(!model_configs.empty()) << "The multi-model engine config should list some models.";
+    double gpu_memory_utilization = json::LookupOrDefault<double>(
+        config, "gpu_memory_utilization", kDefaultGPUMemoryUtilization);
+
+    std::vector<std::string> names;
+    std::vector<std::string> model_config_json_strs;
+    for (const picojson::value& model_config_value : model_configs) {
+      CHECK(model_config_value.is<picojson::object>())
+          << "The engine config of each model should be a JSON object.";
+      picojson::object model_config = model_config_value.get<picojson::object>();
+      names.push_back(json::Lookup<std::string>(model_config, "name"));
+      model_config.erase("name");
+      if (!model_config.count("gpu_memory_utilization")) {
+        model_config["gpu_memory_utilization"] =
+            picojson::value(gpu_memory_utilization / model_configs.size());
+      }
+      model_config_json_strs.push_back(picojson::value(model_config).serialize());
+    }
+    // Unload the models not listed first, which releases their memory for the others.
+    std::vector<std::string> names_to_unload;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto& [name, slot] : slots_) {
+        if (std::find(names.begin(), names.end(), name) == names.end()) {
+          names_to_unload.push_back(name);
+        }
+      }
+    }
+    for (const std::string& name : names_to_unload) {
+      UnloadModel(name);
+    }
+    for (int i = 0; i < static_cast<int>(names.size()); ++i) {
+      ReloadModel(names[i], model_config_json_strs[i]);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    default_model_ = names[0];
+  }
+
+  /*!
+   * \brief Load the given model under the name, or reload it in place when the name is loaded.
+   * The other models keep serving their requests meanwhile.
+   * \param name The model name that requests are routed by.
+   * \param engine_config_json_str The engine config of the model.
+   */
+  void ReloadModel(String name, String engine_config_json_str) {
+    std::shared_ptr<ModelSlot> slot;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = slots_.find(name);
+      if (it != slots_.end()) {
+        slot = it->second;
+      } else {
+        slot = CreateSlot(name);
+        slots_[name] = slot;
+        if (default_model_.empty()) {
+          default_model_ = name;
+        }
+      }
+    }
+    // The requests of the model are aborted by the reload.
+    EraseRequestRecords(name);
+    slot->engine->Reload(std::move(engine_config_json_str));
+  }
+
+  /*! \brief Unload the model of the given name, if it is loaded. */
+  void UnloadModel(String name) {
+    std::shared_ptr<ModelSlot> slot;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = slots_.find(name);
+      if (it == slots_.end()) {
+        return;
+      }
+      slot = it->second;
+      slots_.erase(it);
+      if (default_model_ == name) {
+        default_model_ = slots_.empty() ? "" : slots_.begin()->first;
+      }
+    }
+    slot->engine->Unload();
+    StopSlot(slot.get());
+    EraseRequestRecords(name);
+  }
+
+  void Unload() final {
+    std::vector<std::string> names;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto& [name, slot] : slots_) {
+        names.push_back(name);
+      }
+    }
+    for (const std::string& name : names) {
+      UnloadModel(name);
+    }
+  }
+
+  /*!
+   * \brief Reconfigure the model given by the "name" field of the JSON object, or the default
+   * model when the name is absent. The other models keep serving their requests meanwhile.
+   */
+  String Reconfigure(String reconfig_json_str) final {
+    picojson::object config = json::ParseToJSONObject(reconfig_json_str);
+    std::shared_ptr<ModelSlot> slot;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::string name = json::LookupOrDefault<std::string>(config, "name", default_model_);
+      auto it = slots_.find(name);
+      CHECK(it != slots_.end()) << "The model \"" << name << "\" is not loaded.";
+      slot = it->second;
+    }
+    config.erase("name");
+    return slot->engine->Reconfigure(picojson::value(config).serialize());
+  }
+
+  void Reset() final {
+    for (const std::shared_ptr<ModelSlot>& slot : GetSlots()) {
+      slot->engine->Reset();
+    }
+  }
+
+  /*!
+   * \brief The background loops of each model run on the threads owned by the engine, which
+   * start when the model is loaded. This function waits until the engine exits.
+   */
+  void RunBackgroundLoop() final {
+    std::unique_lock<std::mutex> lock(mutex_);
+    exit_cv_.wait(lock, [this]() { return exit_now_; });
+  }
+
+  void RunBackgroundStreamBackLoop() final { RunBackgroundLoop(); }
+
+  void ExitBackgroundLoop() final {
+    std::unordered_map<std::string, std::shared_ptr<ModelSlot>> slots;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      exit_now_ = true;
+      slots.swap(slots_);
+      default_model_.clear();
+    }
+    exit_cv_.notify_all();
+    for (auto& [name, slot] : slots) {
+      StopSlot(slot.get());
+    }
+  }
+
+  /*! \brief Add the request to the default model. */
+  void AddRequest(Request request) final {
+    String name;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      name = default_model_;
+    }
+    AddRequestToModel(name, std::move(request));
+  }
+
+  /*! \brief Add the request to the model of the given name. */
+  void AddRequestToModel(String name, Request request) {
+    std::shared_ptr<ModelSlot> slot;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = slots_.find(name);
+      CHECK(it != slots_.end()) << "The model \"" << name << "\" is not loaded.";
+      slot = it->second;
+      int n = request->generation_cfg->n;
+      request_records_[request->id] = RequestRecord{name, std::vector<bool>(n, false), n};
+    }
+    slot->engine->AddRequest(std::move(request));
+  }
+
+  void AbortRequest(const String& request_id) final {
+    std::shared_ptr<ModelSlot> slot;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = request_records_.find(request_id);
+      if (it == request_records_.end()) {
+        // The request has finished or does not exist.
+        return;
+      }
+      auto it_slot = slots_.find(it->second.model_name);
+      if (it_slot == slots_.end()) {
+        return;
+      }
+      slot = it_slot->second;
+    }
+    slot->engine->AbortRequest(request_id);
+  }
+
+  /*! \brief Export the cached prefix from the default model. */
+  void ExportPrefixKV(IntTuple tokens, Device device,
+                      std::function<void(Optional<PrefixKVHandoff>)> callback) final {
+    GetDefaultSlot()->engine->ExportPrefixKV(std::move(tokens), device, std::move(callback));
+  }
+
+  /*! \brief Import the prefix into the default model. */
+  void ImportPrefixKV(PrefixKVHandoff handoff) final {
+    GetDefaultSlot()->engine->ImportPrefixKV(std::move(handoff));
+  }
+
+  /************** Query/Profile/Debug **************/
+
+  /*! \brief Return the names of the loaded models, with the default model first. */
+  Array<String> ListModels() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Array<String> names;
+    if (!default_model_.empty()) {
+      names.push_back(default_model_);
+    }
+    for (const auto& [name, slot] : slots_) {
+      if (name != default_model_) {
+        names.push_back(name);
+      }
+    }
+    return names;
+  }
+
+  String GetDefaultGenerationConfigJSONString() const final {
+    return GetDefaultSlot()->engine->GetDefaultGenerationConfigJSONString();
+  }
+
+  String GetCompleteEngineConfigJSONString() const final {
+    return GetDefaultSlot()->engine->GetCompleteEngineConfigJSONString();
+  }
+
+  /*! \brief Return the statistics of each model, keyed by the model name. */
+  String Stats() final {
+    std::vector<std::pair<std::string, std::shared_ptr<ModelSlot>>> slots;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      slots.assign(slots_.begin(), slots_.end());
+    }
+    picojson::object stats;
+    for (const auto& [name, slot] : slots) {
+      stats[name] = picojson::value(json::ParseToJSONObject(slot->engine->Stats()));
+    }
+    return picojson::value(stats).serialize(true);
+  }
+
+  int64_t GetNumAvailablePages() const final {
+    int64_t num_available_pages = 0;
+    for (const std::shared_ptr<ModelSlot>& slot : GetSlots()) {
+      int64_t slot_num_available_pages = slot->engine->GetNumAvailablePages();
+      if (slot_num_available_pages == -1) {
+        return -1;
+      }
+      num_available_pages += slot_num_available_pages;
+    }
+    return num_available_pages;
+  }
+
+  /*! \brief Return nullptr, since each model has its own prefix cache. */
+  std::shared_ptr<const PrefixMatchIndex> GetPrefixMatchIndex() const final { return nullptr; }
+
+  /*! \brief Return the metrics registries of all the models, labeled by the model name. */
+  std::vector<std::pair<std::string, MetricsRegistry>> GetMetricsRegistries() const final {
+    std::vector<std::pair<std::string, std::shared_ptr<ModelSlot>>> slots;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      slots.assign(slots_.begin(), slots_.end());
+    }
+    std::vector<std::pair<std::string, MetricsRegistry>> registries;
+    for (const auto& [name, slot] : slots) {
+      std::string model_label = "model=\"" + name + "\"";
+      for (const auto& [labels, registry] : slot->engine->GetMetricsRegistries()) {
+        registries.emplace_back(labels.empty() ? model_label : model_label + "," + labels,
+                                registry);
+      }
+    }
+    return registries;
+  }
+
+  String GetMetricsText() const final {
+    return MetricsRegistry::RenderOpenMetrics(GetMetricsRegistries());
+  }
+
+  void DebugCallFuncOnAllAllWorker(const String& func_name) final {
+    for (const std::shared_ptr<ModelSlot>& slot : GetSlots()) {
+      slot->engine->DebugCallFuncOnAllAllWorker(func_name);
+    }
+  }
+
+ private:
+  /*! \brief A resident model, served by its own threaded engine and background threads. */
+  struct ModelSlot {
+    std::unique_ptr<ThreadedEngine> engine;
+    std::thread background_loop_thread;
+    std::thread stream_back_loop_thread;
+  };
+
+  /*! \brief The routing record of a request that has not finished. */
+  struct RequestRecord {
+    /*! \brief The model that the request is routed to. */
+    std::string model_name;
+    /*! \brief Whether each generation of the request has finished. */
+    std::vector<bool> finished;
+    /*! \brief The number of unfinished generations. */
+    int num_unfinished;
+  };
+
+  /*!
+   * \brief Create the slot of a model and start its background threads.
+   * \note The function is called with `mutex_` held.
+   */
+  std::shared_ptr<ModelSlot> CreateSlot(const std::string& name) {
+    CHECK(!exit_now_) << "The engine has exited.";
+    auto slot = std::make_shared<ModelSlot>();
+    slot->engine = ThreadedEngine::Create();
+    // Track the finished requests, and serialize the callback across the models.
+    PackedFunc slot_callback([this](TVMArgs args, TVMRetValue* ret) {
+      ICHECK_EQ(args.size(), 1);
+      Array<RequestStreamOutput> delta_outputs = args[0];
+      UpdateRequestRecords(delta_outputs);
+      std::lock_guard<std::mutex> lock(request_stream_callback_mutex_);
+      request_stream_callback_(std::move(delta_outputs));
+    });
+    slot->engine->InitThreadedEngine(device_, slot_callback, trace_recorder_);
+    ThreadedEngine* engine = slot->engine.get();
+    slot->background_loop_thread = std::thread([engine]() { engine->RunBackgroundLoop(); });
+    slot->stream_back_loop_thread =
+        std::thread([engine]() { engine->RunBackgroundStreamBackLoop(); });
+    return slot;
+  }
+
+  /*! \brief Exit the background loops of the slot and join its threads. */
+  static void StopSlot(ModelSlot* slot) {
+    slot->engine->ExitBackgroundLoop();
+    if (slot->background_loop_thread.joinable()) {
+      slot->background_loop_thread.join();
+    }
+    if (slot->stream_back_loop_thread.joinable()) {
+      slot->stream_back_loop_thread.join();
+    }
+  }
+
+  std::vector<std::shared_ptr<ModelSlot>> GetSlots() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::shared_ptr<ModelSlot>> slots;
+    slots.reserve(slots_.size());
+    for (const auto& [name, slot] : slots_) {
+      slots.push_back(slot);
+    }
+    return slots;
+  }
+
+  std::shared_ptr<ModelSlot> GetDefaultSlot() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = slots_.find(default_model_);
+    CHECK(it != slots_.end()) << "No model is loaded.";
+    return it->second;
+  }
+
+  /*! \brief Remove the finished requests from the routing records. */
+  void UpdateRequestRecords(const Array<RequestStreamOutput>& delta_outputs) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const RequestStreamOutput& delta_output : delta_outputs) {
+      auto it = request_records_.find(delta_output->request_id);
+      if (it == request_records_.end()) {
+        continue;
+      }
+      RequestRecord& record = it->second;
+      for (int i = 0; i < static_cast<int>(delta_output->group_finish_reason.size()); ++i) {
+        if (delta_output->group_finish_reason[i].defined() && !record.finished[i]) {
+          record.finished[i] = true;
+          --record.num_unfinished;
+        }
+      }
+      if (record.num_unfinished == 0) {
+        request_records_.erase(it);
+      }
+    }
+  }
+
+  /*! \brief Remove the routing records of the model, as it is reloaded or unloaded. */
+  void EraseRequestRecords(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = request_records_.begin(); it != request_records_.end();) {
+      if (it->second.model_name == name) {
+        it = request_records_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  /*! \brief The device where to run the models. */
+  Device device_;
+  /*! \brief The request stream callback. */
+  PackedFunc request_stream_callback_;
+  /*! \brief The mutex serializing the request stream callback across models. */
+  std::mutex request_stream_callback_mutex_;
+  /*! \brief Event trace recorder. */
+  Optional<EventTraceRecorder> trace_recorder_;
+
+  /************** Model and routing states, guarded by `mutex_` **************/
+  mutable std::mutex mutex_;
+  /*! \brief The resident models, keyed by the model name. */
+  std::unordered_map<std::string, std::shared_ptr<ModelSlot>> slots_;
+  /*! \brief The model that the requests without model name are routed to. */
+  std::string default_model_;
+  /*! \brief The routing records of the unfinished requests. */
+  std::unordered_map<String, RequestRecord> request_records_;
+  /*! \brief Whether the engine has exited, which the background loops wait for. */
+  bool exit_now_ = false;
+  std::condition_variable exit_cv_;
+};
+
+/*! \brief The module of the multi-model ThreadedEngine. */
+class MultiModelThreadedEngineModule : public MultiModelThreadedEngineImpl, public ModuleNode {
+ public:
+  TVM_MODULE_VTABLE_BEGIN("mlc.serve.multi_model_threaded_engine");
+  TVM_MODULE_VTABLE_ENTRY("init_threaded_engine",
+                          &MultiModelThreadedEngineImpl::InitThreadedEngine);
+  TVM_MODULE_VTABLE_ENTRY("reload", &MultiModelThreadedEngineImpl::Reload);
+  TVM_MODULE_VTABLE_ENTRY("reconfigure", &MultiModelThreadedEngineImpl::Reconfigure);
+  TVM_MODULE_VTABLE_ENTRY("reload_model", &MultiModelThreadedEngineImpl::ReloadModel);
+  TVM_MODULE_VTABLE_ENTRY("unload_model", &MultiModelThreadedEngineImpl::UnloadModel);
+  TVM_MODULE_VTABLE_ENTRY("list_models", &MultiModelThreadedEngineImpl::ListModels);
+  TVM_MODULE_VTABLE_ENTRY("add_request", &MultiModelThreadedEngineImpl::AddRequest);
+  TVM_MODULE_VTABLE_ENTRY("add_request_to_model",
+                          &MultiModelThreadedEngineImpl::AddRequestToModel);
+  TVM_MODULE_VTABLE_ENTRY("abort_request", &MultiModelThreadedEngineImpl::AbortRequest);
+  TVM_MODULE_VTABLE_ENTRY("run_background_loop", &MultiModelThreadedEngineImpl::RunBackgroundLoop);
+  TVM_MODULE_VTABLE_ENTRY("run_background_stream_back_loop",
+                          &MultiModelThreadedEngineImpl::RunBackgroundStreamBackLoop);
+  TVM_MODULE_VTABLE_ENTRY("exit_background_loop",
+                          &MultiModelThreadedEngineImpl::ExitBackgroundLoop);
+  TVM_MODULE_VTABLE_ENTRY("get_default_generation_config",
+                          &MultiModelThreadedEngineImpl::GetDefaultGenerationConfigJSONString);
+  TVM_MODULE_VTABLE_ENTRY("get_complete_engine_config",
+                          &MultiModelThreadedEngineImpl::GetCompleteEngineConfigJSONString);
+  TVM_MODULE_VTABLE_ENTRY("stats", &MultiModelThreadedEngineImpl::Stats);
+  TVM_MODULE_VTABLE_ENTRY("get_num_available_pages",
+                          &MultiModelThreadedEngineImpl::GetNumAvailablePages);
+  TVM_MODULE_VTABLE_ENTRY("get_metrics", &MultiModelThreadedEngineImpl::GetMetricsText);
+  TVM_MODULE_VTABLE_ENTRY("reset", &MultiModelThreadedEngineImpl::Reset);
+  TVM_MODULE_VTABLE_ENTRY("debug_call_func_on_all_worker",
+                          &MultiModelThreadedEngineImpl::DebugCallFuncOnAllAllWorker);
+  TVM_MODULE_VTABLE_END();
+};
+
+TVM_REGISTER_GLOBAL("mlc.serve.create_multi_model_threaded_engine").set_body_typed([]() {
+  return Module(make_object<MultiModelThreadedEngineModule>());
+});
+
+std::unique_ptr<ThreadedEngine> ThreadedEngine::CreateMultiModel() {
+  return std::make_unique<MultiModelThreadedEngineImpl>();
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -6,6 +6,10 @@
 
 #include <tvm/runtime/registry.h>
 
+#include <algorithm>
+#include <map>
+#include <set>
+
 namespace mlc {
 namespace llm {
 namespace serve {
@@ -21,13 +25,27 @@ class PrefixCacheImpl : public PrefixCacheObj {
    * \brief Contructor of paged radix tree.
    * \param max_num_recycling_seqs The maximum number of sequences in prefix cache.
    * \param remove_callback The optional callback function to call when removing a sequence.
+   * \param host_tier_callbacks The optional callbacks to enable the host memory tier.
+   * \param eviction_policy The policy to select the recycling sequence to evict.
+   * \param kv_cache_page_size The page size of KV cache.
+   * \param state_checkpoint_interval The interval of state checkpoints, or -1 for KV cache.
    */
-  explicit PrefixCacheImpl(size_t max_num_recycling_seqs, PrefixCacheRemoveCallback remove_callback)
+  explicit PrefixCacheImpl(size_t max_num_recycling_seqs, PrefixCacheRemoveCallback remove_callback,
+                           PrefixCacheHostTierCallbacks host_tier_callbacks,
+                           PrefixCacheEvictionPolicy eviction_policy, size_t kv_cache_page_size,
+                           int64_t state_checkpoint_interval)
       : radix_tree_(PagedRadixTree::Create()),
         max_num_recycling_seqs_(max_num_recycling_seqs),
-        remove_callback_(remove_callback) {
-    recycling_seq_lrus_.clear();
-    reversed_recycling_seq_lrus_.clear();
+        remove_callback_(remove_callback),
+        host_tier_callbacks_(host_tier_callbacks),
+        eviction_policy_(eviction_policy),
+        kv_cache_page_size_(std::max(kv_cache_page_size, static_cast<size_t>(1))),
+        state_checkpoint_interval_(state_checkpoint_interval) {
+    recycling_seq_keys_.clear();
+    recycling_seq_eviction_order_.clear();
+    seq_hit_counts_.clear();
+    offloaded_seq_lrus_.clear();
+    reversed_offloaded_seq_lrus_.clear();
     seq_states_.clear();
     seq_sliding_window_infos_.clear();
     lru_counter_ = 0;
@@ -44,6 +62,350 @@ class PrefixCacheImpl : public PrefixCacheObj {
    */
   PrefixCacheMatchedResult InsertSequence(int64_t seq_id, IntTuple tokens, int sliding_window_size,
                                           int attention_sink_size) final {
+    PrefixCacheMatchedResult result =
+        MatchAndInsertSequence(seq_id, tokens, sliding_window_size, attention_sink_size);
+    if (result.prefilled_offset > 0) {
+      ++stats_.num_hits;
+      stats_.num_hit_tokens += result.prefilled_offset;
+    } else {
+      ++stats_.num_misses;
+    }
+    return result;
+  }
+
+  /*!
+   * \brief Extend a sequence with new tokenized sequence suffix.
+   * \param seq_id The sequence to be extneded.
+   * \param tokens The tokens of tokenized sequence suffix to extend.
+   * \throw Error if the given sequence id is not valid or active.
+   */
+  void ExtendSequence(int64_t seq_id, IntTuple tokens) final {
+    CHECK(seq_states_.at(seq_id) == SequenceState::kActive);
+    ExtendRadixTreeSequence(seq_id, tokens);
+  }
+
+  /*!
+   * \brief Roll back a sequence by number of tokens.
+   * \param seq_id The sequence ID for index.
+   * \param num_tokens The number of tokens to be rolled back.
+   * \throw Error if the given sequence id is not valid or active.
+   */
+  void RollBackSequence(int64_t seq_id, size_t num_tokens) final {
+    CHECK(seq_states_.at(seq_id) == SequenceState::kActive);
+    RollBackRadixTreeSequence(seq_id, num_tokens);
+  }
+
+  /*!
+   * \brief Recycle a sequence. The recycled sequence will not be removed immediately, as long as
+   * memory is sufficient and the number of sequence in prefix cache belows the maximum number of
+   * sequence. And it will be reused again in the future request.
+   * \param seq_id The sequence to be recycled.
+   * \param lazy The flag if the sequence should be removed lazily or intermediary.
+   * \throw Error if the given sequence id is not valid.
+   */
+  void RecycleSequence(int64_t seq_id, bool lazy = true) final {
+    CHECK(seq_states_.at(seq_id) == SequenceState::kActive);
+    CHECK(recycling_seq_keys_.find(seq_id) == recycling_seq_keys_.end());
+    if (lazy && max_num_recycling_seqs_ != 0) {
+      // Remove the sequence lazily.
+      if (recycling_seq_keys_.size() == max_num_recycling_seqs_) {
+        // If prefix cache has reached maximum number of recycling sequences, try to pop one
+        // recycling sequence.
+        CHECK(TryFreeMemory());
+        CHECK_EQ(recycling_seq_keys_.size(), max_num_recycling_seqs_ - 1);
+      }
+      seq_states_.at(seq_id) = SequenceState::kRecycling;
+      InsertEvictionKey(seq_id);
+    } else {
+      // Remove the sequence intermediately.
+      RemoveRadixTreeSequence(seq_id);
+      if (remove_callback_ != nullptr) {
+        remove_callback_(seq_id);
+      }
+      CHECK(seq_states_.erase(seq_id));
+      CHECK(seq_sliding_window_infos_.erase(seq_id));
+      CHECK(seq_hit_counts_.erase(seq_id));
+    }
+  }
+
+  /*!
+   * \brief Try to remove recycling sequence to free up memory. It will remove the recycling
+   sequence selected by the eviction policy.
+   * \return The flag if there is a sequence removed. In other word, return true when memory is
+   freed successfully.
+   * \throw Error if the given sequence id is not valid.
+   */
+  bool TryFreeMemory() final {
+    if (recycling_seq_keys_.empty()) {
+      // There is no recycling sequence. No memory can be freed.
+      return false;
+    }
+    // Evict the recycling sequence with the lowest eviction key.
+    int64_t seq_id = recycling_seq_eviction_order_.begin()->second;
+    CHECK(seq_states_.at(seq_id) == SequenceState::kRecycling);
+    CHECK(EraseEvictionKey(seq_id));
+    if (OffloadSequence(seq_id)) {
+      return true;
+    }
+    stats_.num_evicted_tokens += radix_tree_->GetSequenceExclusiveLength(seq_id);
+    RemoveRadixTreeSequence(seq_id);
+    if (remove_callback_ != nullptr) {
+      remove_callback_(seq_id);
+    }
+    CHECK(seq_states_.erase(seq_id));
+    CHECK(seq_sliding_window_infos_.erase(seq_id));
+    CHECK(seq_hit_counts_.erase(seq_id));
+    return true;
+  }
+
+  /*!
+   * \brief Check if a sequence exists.
+   * \param seq_id The sequence ID for index.
+   * \return The sequence existence.
+   * \throw Error if sequence ID is not valid.
+   */
+  bool HasSequence(int64_t seq_id) final { return radix_tree_->HasSequence(seq_id); }
+
+  /*!
+   * \brief Get the number of tokens of a sequence.
+   * \param seq_id The sequence ID for index.
+   * \return The sequence length.
+   * \throw Error if the given sequence id is not valid.
+   */
+  size_t GetSequenceLength(int64_t seq_id) final { return radix_tree_->GetSequenceLength(seq_id); }
+
+  /*!
+   * \brief Reset the prefix cache to initial status.
+   */
+  void Reset() final {
+    radix_tree_->Reset();
+    match_index_->Reset();
+    recycling_seq_keys_.clear();
+    recycling_seq_eviction_order_.clear();
+    seq_hit_counts_.clear();
+    offloaded_seq_lrus_.clear();
+    reversed_offloaded_seq_lrus_.clear();
+    seq_states_.clear();
+    seq_sliding_window_infos_.clear();
+    lru_counter_ = 0;
+    stats_ = PrefixCacheStats();
+  }
+
+  /*!
+   * \brief Get the runtime statistics of prefix cache.
+   * \return The statistics.
+   */
+  PrefixCacheStats GetStats() const final { return stats_; }
+
+  /*!
+   * \brief Get the sequences whose KV data can be persisted, i.e., the sequences that are in the
+   * KV cache and have no sliding window, together with their tokens.
+   * \return The pairs of sequence ID and sequence tokens.
+   */
+  std::vector<std::pair<int64_t, IntTuple>> GetPersistableSequences() final {
+    std::vector<std::pair<int64_t, IntTuple>> sequences;
+    for (const auto& [seq_id, state] : seq_states_) {
+      if (state == SequenceState::kOffloaded || seq_sliding_window_infos_.at(seq_id).first != -1) {
+        continue;
+      }
+      sequences.emplace_back(seq_id, radix_tree_->GetSequence(seq_id));
+    }
+    // Keep a deterministic order of sequences.
+    std::sort(sequences.begin(), sequences.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    return sequences;
+  }
+
+  /*!
+   * \brief Add a sequence whose KV data has already been restored to the KV cache as a
+   * recycling sequence, so that new sequences can reuse or fork from it.
+   * \param seq_id The sequence ID.
+   * \param tokens The tokens of the sequence.
+   * \throw Error if the given sequence id already exists.
+   */
+  void AddRecyclingSequence(int64_t seq_id, IntTuple tokens) final {
+    CHECK(seq_states_.find(seq_id) == seq_states_.end());
+    AddRadixTreeSequence(seq_id);
+    ExtendRadixTreeSequence(seq_id, tokens);
+    seq_states_.emplace(seq_id, SequenceState::kActive);
+    seq_sliding_window_infos_.emplace(seq_id, std::pair<int, size_t>{-1, 0});
+    seq_hit_counts_.emplace(seq_id, 1);
+    RecycleSequence(seq_id, /*lazy=*/true);
+  }
+
+  std::shared_ptr<const PrefixMatchIndex> GetMatchIndex() const final { return match_index_; }
+
+  /*!
+   * \brief Trim the trailing tokens of the recycling sequences that partially fill the last KV
+   * cache page of their exclusive part.
+   * \return The pairs of sequence ID and the number of trimmed tokens.
+   */
+  std::vector<std::pair<int64_t, size_t>> TrimRecyclingSequences() final {
+    std::vector<std::pair<int64_t, size_t>> trimmed_seqs;
+    if (state_checkpoint_interval_ != -1) {
+      // The model states can only be forked at the end of sequences and cannot be popped.
+      return trimmed_seqs;
+    }
+    // Trimming a sequence updates the eviction keys, so collect the sequences first.
+    std::vector<int64_t> recycling_seq_ids;
+    recycling_seq_ids.reserve(recycling_seq_keys_.size());
+    for (const auto& [seq_id, key] : recycling_seq_keys_) {
+      recycling_seq_ids.push_back(seq_id);
+    }
+    for (int64_t seq_id : recycling_seq_ids) {
+      if (seq_sliding_window_infos_.at(seq_id).first != -1) {
+        continue;
+      }
+      // The exclusive part of a sequence starts a new block of pages in the KV cache. Keep at
+      // least one token of it, so that the popped tokens never reach a block shared with other
+      // sequences.
+      size_t exclusive_length = radix_tree_->GetSequenceExclusiveLength(seq_id);
+      size_t num_trimmed_tokens = exclusive_length % kv_cache_page_size_;
+      if (num_trimmed_tokens == 0 || num_trimmed_tokens >= exclusive_length) {
+        continue;
+      }
+      RollBackRadixTreeSequence(seq_id, num_trimmed_tokens);
+      stats_.num_evicted_tokens += num_trimmed_tokens;
+      trimmed_seqs.emplace_back(seq_id, num_trimmed_tokens);
+    }
+    // Keep a deterministic order of sequences.
+    std::sort(trimmed_seqs.begin(), trimmed_seqs.end());
+    return trimmed_seqs;
+  }
+
+ private:
+  /*!
+   * \brief The key to order the recycling sequences for eviction, i.e., the retention score and
+   * the LRU time stamp.
+   * \sa GetEvictionKey
+   */
+  using EvictionKey = std::pair<double, size_t>;
+
+  /*!
+   * \brief The radix tree operations that change the sequences, which also keep the match
+   * index in sync.
+   */
+  void AddRadixTreeSequence(int64_t seq_id) {
+    radix_tree_->AddSequence(seq_id);
+    match_index_->AddSequence(seq_id);
+    UpdateEvictionKeys(GetExclusiveLengthNeighbors(seq_id));
+  }
+
+  void ExtendRadixTreeSequence(int64_t seq_id, const IntTuple& tokens) {
+    radix_tree_->ExtendSequence(seq_id, tokens);
+    match_index_->ExtendSequence(seq_id, tokens.data(), tokens.size());
+    UpdateEvictionKeys(GetExclusiveLengthNeighbors(seq_id));
+  }
+
+  void ForkRadixTreeSequence(int64_t seq_id, int64_t parent_seq_id, const IntTuple& tokens,
+                             size_t forked_offset) {
+    radix_tree_->ForkSequence(seq_id, parent_seq_id, forked_offset);
+    // The forked prefix is the first tokens of the new sequence.
+    match_index_->AddSequence(seq_id);
+    match_index_->ExtendSequence(seq_id, tokens.data(), forked_offset);
+    UpdateEvictionKeys(GetExclusiveLengthNeighbors(seq_id));
+  }
+
+  void RollBackRadixTreeSequence(int64_t seq_id, size_t num_tokens) {
+    std::vector<int64_t> neighbors = GetExclusiveLengthNeighbors(seq_id);
+    radix_tree_->RollBackSequence(seq_id, num_tokens);
+    match_index_->RollBackSequence(seq_id, num_tokens,
+                                   [this, seq_id]() { return radix_tree_->GetSequence(seq_id); });
+    neighbors.push_back(seq_id);
+    UpdateEvictionKeys(neighbors);
+  }
+
+  void RemoveRadixTreeSequence(int64_t seq_id) {
+    std::vector<int64_t> neighbors = GetExclusiveLengthNeighbors(seq_id);
+    radix_tree_->RemoveSequence(seq_id);
+    match_index_->RemoveSequence(seq_id);
+    UpdateEvictionKeys(neighbors);
+  }
+
+  /*!
+   * \brief Get the eviction key of a recycling sequence, i.e., its retention score and its LRU
+   * time stamp. The sequence with the lowest key is evicted first, so the ties of the score are
+   * broken by the LRU time stamp.
+   * - LRU: the score is constant.
+   * - LFU: the score is the hit count.
+   * - Cost-aware: the score is (sequence length x hit count / exclusively held tokens),
+   * i.e., the prefill work saved per cache slot that eviction frees.
+   */
+  EvictionKey GetEvictionKey(int64_t seq_id, size_t lru) {
+    if (eviction_policy_ == PrefixCacheEvictionPolicy::kLRU) {
+      return {0.0, lru};
+    }
+    double num_hits = static_cast<double>(seq_hit_counts_.at(seq_id));
+    if (eviction_policy_ == PrefixCacheEvictionPolicy::kLFU) {
+      return {num_hits, lru};
+    }
+    size_t num_exclusive_tokens = radix_tree_->GetSequenceExclusiveLength(seq_id);
+    return {static_cast<double>(radix_tree_->GetSequenceLength(seq_id)) * num_hits /
+                std::max(num_exclusive_tokens, static_cast<size_t>(1)),
+            lru};
+  }
+
+  /*! \brief Add a sequence to the recycling sequences to evict, as the most recently used. */
+  void InsertEvictionKey(int64_t seq_id) {
+    EvictionKey key = GetEvictionKey(seq_id, ++lru_counter_);
+    recycling_seq_keys_.emplace(seq_id, key);
+    recycling_seq_eviction_order_.emplace(key, seq_id);
+  }
+
+  /*!
+   * \brief Remove a sequence from the recycling sequences to evict.
+   * \return The flag if the sequence is a recycling sequence.
+   */
+  bool EraseEvictionKey(int64_t seq_id) {
+    auto it = recycling_seq_keys_.find(seq_id);
+    if (it == recycling_seq_keys_.end()) {
+      return false;
+    }
+    CHECK(recycling_seq_eviction_order_.erase({it->second, seq_id}));
+    recycling_seq_keys_.erase(it);
+    return true;
+  }
+
+  /*!
+   * \brief Recompute the eviction key of a recycling sequence after its score changes.
+   * \param seq_id The recycling sequence.
+   * \param used The flag if the sequence is used, which also makes it the most recently used.
+   */
+  void UpdateEvictionKey(int64_t seq_id, bool used) {
+    EvictionKey& key = recycling_seq_keys_.at(seq_id);
+    CHECK(recycling_seq_eviction_order_.erase({key, seq_id}));
+    key = GetEvictionKey(seq_id, used ? ++lru_counter_ : key.second);
+    recycling_seq_eviction_order_.emplace(key, seq_id);
+  }
+
+  /*!
+   * \brief Get the sequences whose exclusive lengths may change with a sequence in the radix
+   * tree. Only the cost-aware eviction keys depend on the exclusive lengths, so they are not
+   * looked up for the other policies.
+   */
+  std::vector<int64_t> GetExclusiveLengthNeighbors(int64_t seq_id) {
+    if (eviction_policy_ != PrefixCacheEvictionPolicy::kCostAware) {
+      return {};
+    }
+    return radix_tree_->GetExclusiveLengthNeighbors(seq_id);
+  }
+
+  /*! \brief Recompute the eviction keys of the recycling sequences among the given sequences. */
+  void UpdateEvictionKeys(const std::vector<int64_t>& seq_ids) {
+    for (int64_t seq_id : seq_ids) {
+      if (recycling_seq_keys_.count(seq_id)) {
+        UpdateEvictionKey(seq_id, /*used=*/false);
+      }
+    }
+  }
+
+  /*!
+   * \brief Match the new sequence with the sequences in prefix cache, and insert it.
+   * \sa InsertSequence
+   */
+  PrefixCacheMatchedResult MatchAndInsertSequence(int64_t seq_id, IntTuple tokens,
+                                                  int sliding_window_size,
+                                                  int attention_sink_size) {
     CHECK_NE(sliding_window_size, 0);
     CHECK_GE(attention_sink_size, 0);
     CHECK(seq_states_.find(seq_id) == seq_states_.end());
@@ -53,14 +415,20 @@ class PrefixCacheImpl : public PrefixCacheObj {
     auto [matched_offset, matched_seqs] = radix_tree_->MatchPrefix(popped_tokens);
     // No prefix matched, directly adding new sequence.
     if (!matched_offset) {
-      radix_tree_->AddSequence(seq_id);
+      AddRadixTreeSequence(seq_id);
       seq_states_.emplace(seq_id, SequenceState::kActive);
       seq_sliding_window_infos_.emplace(seq_id, sliding_window_info);
+      seq_hit_counts_.emplace(seq_id, 1);
       return PrefixCacheMatchedResult{0, -1, -1, 0};
     }
 
     CHECK(!matched_seqs.empty());
 
+    if (state_checkpoint_interval_ != -1) {
+      return MatchAndForkAtSequenceEnd(seq_id, tokens, matched_offset, std::move(matched_seqs),
+                                       sliding_window_info);
+    }
+
     // The reusage of recycling sequences logic is different between with/without sliding window
     // enabled.
     if (sliding_window_size != -1) {
@@ -93,25 +461,38 @@ class PrefixCacheImpl : public PrefixCacheObj {
           }
         }
       }
-      if (shortest_recycling_seq_id != -1) {
+      if (shortest_recycling_seq_id == -1) {
+        // No recycling sequence in the KV cache matched. Try to promote the shortest matched
+        // sequence from the host memory tier back to the KV cache.
+        shortest_recycling_seq_id = RestoreShortestOffloadedSequence(
+            matched_seqs, sliding_window_info, &shortest_recycling_seq_length);
+      }
+      if (shortest_recycling_seq_id != -1 &&
+          shortest_recycling_seq_length - matched_offset < kv_cache_page_size_) {
+        // Reuse the recycling sequence only when it drops less than one page of trailing tokens.
+        // Otherwise, fork from it below, so that its trailing pages stay reusable.
         ReuseRecyclingSequence(shortest_recycling_seq_id);
         if (shortest_recycling_seq_length > matched_offset) {
           // Recycling sequence is longer than new sequence, rolling back the redundant trailing
           // tokens, to match the new sequence.
-          radix_tree_->RollBackSequence(shortest_recycling_seq_id,
-                                        shortest_recycling_seq_length - matched_offset);
+          RollBackRadixTreeSequence(shortest_recycling_seq_id,
+                                    shortest_recycling_seq_length - matched_offset);
         }
         return PrefixCacheMatchedResult{matched_offset, -1, shortest_recycling_seq_id,
                                         shortest_recycling_seq_length - matched_offset};
       }
-      // No reusage of recycling sequence, fallback to forking matched sequence. Currently, we only
-      // fork from sequence without sliding window, due to current paged KVCache implmentation.
+      // No reusage of recycling sequence, fallback to forking matched sequence. The forked sequence
+      // shares the full pages of the matched prefix with the matched sequence in KVCache, and
+      // only the partially filled last page is copied. Currently, we only fork from sequence
+      // without sliding window, due to current paged KVCache implmentation.
       size_t longest_forking_offset = 0;
       int64_t longest_forking_seq_id = -1;
       for (int64_t matched_seq_id : matched_seqs) {
         auto [matched_seq_sliding_window_size, matched_seq_attention_sink_size] =
             seq_sliding_window_infos_.at(matched_seq_id);
-        if (matched_seq_sliding_window_size != -1) {
+        if (matched_seq_sliding_window_size != -1 ||
+            seq_states_.at(matched_seq_id) == SequenceState::kOffloaded) {
+          // Offloaded sequences are not in the KV cache and cannot be forked from.
           continue;
         }
         // If the matched is not enabled with sliding window, we can fork within matched offset
@@ -122,129 +503,163 @@ class PrefixCacheImpl : public PrefixCacheObj {
         }
       }
       if (longest_forking_offset > 0) {
-        radix_tree_->ForkSequence(seq_id, longest_forking_seq_id, longest_forking_offset);
+        ForkRadixTreeSequence(seq_id, longest_forking_seq_id, tokens, longest_forking_offset);
         seq_states_.emplace(seq_id, SequenceState::kActive);
         seq_sliding_window_infos_.emplace(seq_id, sliding_window_info);
+        seq_hit_counts_.emplace(seq_id, 1);
+        ++seq_hit_counts_.at(longest_forking_seq_id);
+        if (recycling_seq_keys_.count(longest_forking_seq_id)) {
+          // Forking from a recycling sequence counts as a use of it.
+          UpdateEvictionKey(longest_forking_seq_id, /*used=*/true);
+        }
         return PrefixCacheMatchedResult{longest_forking_offset, longest_forking_seq_id, -1, 0};
       }
     }
     // No forking from matched sequence, fallback to adding new sequence.
-    radix_tree_->AddSequence(seq_id);
+    AddRadixTreeSequence(seq_id);
     seq_states_.emplace(seq_id, SequenceState::kActive);
     seq_sliding_window_infos_.emplace(seq_id, sliding_window_info);
+    seq_hit_counts_.emplace(seq_id, 1);
     return PrefixCacheMatchedResult{0, -1, -1, 0};
   }
 
   /*!
-   * \brief Extend a sequence with new tokenized sequence suffix.
-   * \param seq_id The sequence to be extneded.
-   * \param tokens The tokens of tokenized sequence suffix to extend.
-   * \throw Error if the given sequence id is not valid or active.
-   */
-  void ExtendSequence(int64_t seq_id, IntTuple tokens) final {
-    CHECK(seq_states_.at(seq_id) == SequenceState::kActive);
-    radix_tree_->ExtendSequence(seq_id, tokens);
-  }
-
-  /*!
-   * \brief Roll back a sequence by number of tokens.
-   * \param seq_id The sequence ID for index.
-   * \param num_tokens The number of tokens to be rolled back.
-   * \throw Error if the given sequence id is not valid or active.
+   * \brief Match the new sequence with the ends of the sequences in prefix cache, as the model
+   * states can only be forked at the end of sequences. The new sequence is forked from the
+   * sequence ending where the match ends, or else from the state checkpoint at the largest
+   * multiple of the checkpoint interval below the matched offset.
+   * \sa MatchAndInsertSequence
    */
-  void RollBackSequence(int64_t seq_id, size_t num_tokens) final {
-    CHECK(seq_states_.at(seq_id) == SequenceState::kActive);
-    radix_tree_->RollBackSequence(seq_id, num_tokens);
-  }
-
-  /*!
-   * \brief Recycle a sequence. The recycled sequence will not be removed immediately, as long as
-   * memory is sufficient and the number of sequence in prefix cache belows the maximum number of
-   * sequence. And it will be reused again in the future request.
-   * \param seq_id The sequence to be recycled.
-   * \param lazy The flag if the sequence should be removed lazily or intermediary.
-   * \throw Error if the given sequence id is not valid.
-   */
-  void RecycleSequence(int64_t seq_id, bool lazy = true) final {
-    CHECK(seq_states_.at(seq_id) == SequenceState::kActive);
-    CHECK(recycling_seq_lrus_.find(seq_id) == recycling_seq_lrus_.end());
-    if (lazy && max_num_recycling_seqs_ != 0) {
-      // Remove the sequence lazily.
-      if (recycling_seq_lrus_.size() == max_num_recycling_seqs_) {
-        // If prefix cache has reached maximum number of recycling sequences, try to pop one
-        // recycling sequence.
-        CHECK(TryFreeMemory());
-        CHECK_EQ(recycling_seq_lrus_.size(), max_num_recycling_seqs_ - 1);
+  PrefixCacheMatchedResult MatchAndForkAtSequenceEnd(int64_t seq_id, const IntTuple& tokens,
+                                                     size_t matched_offset,
+                                                     std::vector<int64_t> matched_seqs,
+                                                     std::pair<int, size_t> sliding_window_info) {
+    size_t fork_offset = matched_offset;
+    while (fork_offset > 0) {
+      int64_t forked_seq_id = -1;
+      for (int64_t matched_seq_id : matched_seqs) {
+        if (seq_states_.at(matched_seq_id) != SequenceState::kOffloaded &&
+            seq_sliding_window_infos_.at(matched_seq_id).first == -1 &&
+            radix_tree_->GetSequenceLength(matched_seq_id) == fork_offset) {
+          forked_seq_id = matched_seq_id;
+          break;
+        }
       }
-      seq_states_.at(seq_id) = SequenceState::kRecycling;
-      ++lru_counter_;
-      recycling_seq_lrus_.emplace(seq_id, lru_counter_);
-      reversed_recycling_seq_lrus_.emplace(lru_counter_, seq_id);
-    } else {
-      // Remove the sequence intermediately.
-      radix_tree_->RemoveSequence(seq_id);
-      if (remove_callback_ != nullptr) {
-        remove_callback_(seq_id);
+      if (forked_seq_id != -1) {
+        ForkRadixTreeSequence(seq_id, forked_seq_id, tokens, fork_offset);
+        seq_states_.emplace(seq_id, SequenceState::kActive);
+        seq_sliding_window_infos_.emplace(seq_id, sliding_window_info);
+        seq_hit_counts_.emplace(seq_id, 1);
+        ++seq_hit_counts_.at(forked_seq_id);
+        if (recycling_seq_keys_.count(forked_seq_id)) {
+          UpdateEvictionKey(forked_seq_id, /*used=*/true);
+        }
+        return PrefixCacheMatchedResult{fork_offset, forked_seq_id, -1, 0};
       }
-      CHECK(seq_states_.erase(seq_id));
-      CHECK(seq_sliding_window_infos_.erase(seq_id));
+      if (state_checkpoint_interval_ <= 0) {
+        break;
+      }
+      // Step down to the checkpoint below, and collect the sequences through it.
+      size_t interval = static_cast<size_t>(state_checkpoint_interval_);
+      fork_offset = (fork_offset - 1) / interval * interval;
+      if (fork_offset == 0) {
+        break;
+      }
+      matched_seqs = radix_tree_
+                         ->MatchPrefix(IntTuple(
+                             std::vector<int64_t>(tokens.begin(), tokens.begin() + fork_offset)))
+                         .second;
     }
+    AddRadixTreeSequence(seq_id);
+    seq_states_.emplace(seq_id, SequenceState::kActive);
+    seq_sliding_window_infos_.emplace(seq_id, sliding_window_info);
+    seq_hit_counts_.emplace(seq_id, 1);
+    return PrefixCacheMatchedResult{0, -1, -1, 0};
+  }
+
+  void ReuseRecyclingSequence(int64_t seq_id) {
+    CHECK(seq_states_.at(seq_id) == SequenceState::kRecycling);
+    seq_states_.at(seq_id) = SequenceState::kActive;
+    CHECK(EraseEvictionKey(seq_id));
+    ++seq_hit_counts_.at(seq_id);
   }
 
   /*!
-   * \brief Try to remove recycling sequence to free up memory. It will remove the oldest recycling
-   sequence.
-   * \return The flag if there is a sequence removed. In other word, return true when memory is
-   freed successfully.
-   * \throw Error if the given sequence id is not valid.
+   * \brief Offload a recycling sequence evicted from the KV cache to the host memory tier.
+   * The oldest offloaded sequences are dropped when the host tier is full.
+   * \param seq_id The sequence to offload.
+   * \return The flag if the sequence is offloaded.
    */
-  bool TryFreeMemory() final {
-    if (reversed_recycling_seq_lrus_.empty()) {
-      // There is no recycling sequence. No memory can be freed.
+  bool OffloadSequence(int64_t seq_id) {
+    if (host_tier_callbacks_.offload == nullptr) {
       return false;
     }
-    auto [lru, seq_id] = *reversed_recycling_seq_lrus_.begin();
-    CHECK(seq_states_.at(seq_id) == SequenceState::kRecycling);
-    CHECK_EQ(recycling_seq_lrus_.at(seq_id), lru);
-    radix_tree_->RemoveSequence(seq_id);
-    if (remove_callback_ != nullptr) {
-      remove_callback_(seq_id);
+    size_t length = radix_tree_->GetSequenceLength(seq_id);
+    while (!host_tier_callbacks_.offload(seq_id, length)) {
+      if (reversed_offloaded_seq_lrus_.empty()) {
+        // The sequence does not fit in the host tier even when the host tier is empty.
+        return false;
+      }
+      DropOldestOffloadedSequence();
     }
-    CHECK(seq_states_.erase(seq_id));
-    CHECK(recycling_seq_lrus_.erase(seq_id));
-    CHECK(reversed_recycling_seq_lrus_.erase(lru));
-    CHECK(seq_sliding_window_infos_.erase(seq_id));
+    seq_states_.at(seq_id) = SequenceState::kOffloaded;
+    ++lru_counter_;
+    offloaded_seq_lrus_.emplace(seq_id, lru_counter_);
+    reversed_offloaded_seq_lrus_.emplace(lru_counter_, seq_id);
     return true;
   }
 
-  /*!
-   * \brief Check if a sequence exists.
-   * \param seq_id The sequence ID for index.
-   * \return The sequence existence.
-   * \throw Error if sequence ID is not valid.
-   */
-  bool HasSequence(int64_t seq_id) final { return radix_tree_->HasSequence(seq_id); }
+  /*! \brief Remove the oldest offloaded sequence from prefix cache and the host memory tier. */
+  void DropOldestOffloadedSequence() {
+    auto [lru, seq_id] = *reversed_offloaded_seq_lrus_.begin();
+    CHECK(seq_states_.at(seq_id) == SequenceState::kOffloaded);
+    stats_.num_evicted_tokens += radix_tree_->GetSequenceExclusiveLength(seq_id);
+    RemoveRadixTreeSequence(seq_id);
+    host_tier_callbacks_.drop(seq_id);
+    CHECK(seq_states_.erase(seq_id));
+    CHECK(seq_hit_counts_.erase(seq_id));
+    CHECK(offloaded_seq_lrus_.erase(seq_id));
+    CHECK(reversed_offloaded_seq_lrus_.erase(lru));
+    CHECK(seq_sliding_window_infos_.erase(seq_id));
+  }
 
   /*!
-   * \brief Reset the prefix cache to initial status.
+   * \brief Restore the shortest offloaded sequence among the matched sequences back to the
+   * KV cache, and make it a recycling sequence.
+   * \param matched_seqs The matched sequences.
+   * \param sliding_window_info The sliding window information of the new sequence.
+   * \param[out] restored_seq_length The length of the restored sequence.
+   * \return The restored sequence ID, or -1 if no sequence is restored.
    */
-  void Reset() final {
-    radix_tree_->Reset();
-    recycling_seq_lrus_.clear();
-    reversed_recycling_seq_lrus_.clear();
-    seq_states_.clear();
-    seq_sliding_window_infos_.clear();
-    lru_counter_ = 0;
-  }
-
- private:
-  void ReuseRecyclingSequence(int64_t seq_id) {
-    CHECK(seq_states_.at(seq_id) == SequenceState::kRecycling);
-    size_t lru = recycling_seq_lrus_.at(seq_id);
-    CHECK_EQ(reversed_recycling_seq_lrus_.at(lru), seq_id);
-    seq_states_.at(seq_id) = SequenceState::kActive;
-    CHECK(recycling_seq_lrus_.erase(seq_id));
-    CHECK(reversed_recycling_seq_lrus_.erase(lru));
+  int64_t RestoreShortestOffloadedSequence(const std::vector<int64_t>& matched_seqs,
+                                           const std::pair<int, size_t>& sliding_window_info,
+                                           size_t* restored_seq_length) {
+    if (host_tier_callbacks_.restore == nullptr) {
+      return -1;
+    }
+    int64_t shortest_seq_id = -1;
+    size_t shortest_seq_length = 0;
+    for (int64_t matched_seq_id : matched_seqs) {
+      if (seq_states_.at(matched_seq_id) == SequenceState::kOffloaded &&
+          seq_sliding_window_infos_.at(matched_seq_id) == sliding_window_info) {
+        size_t matched_seq_length = radix_tree_->GetSequenceLength(matched_seq_id);
+        if (shortest_seq_id == -1 || matched_seq_length < shortest_seq_length) {
+          shortest_seq_id = matched_seq_id;
+          shortest_seq_length = matched_seq_length;
+        }
+      }
+    }
+    if (shortest_seq_id == -1 ||
+        !host_tier_callbacks_.restore(shortest_seq_id, shortest_seq_length)) {
+      return -1;
+    }
+    size_t lru = offloaded_seq_lrus_.at(shortest_seq_id);
+    CHECK(offloaded_seq_lrus_.erase(shortest_seq_id));
+    CHECK(reversed_offloaded_seq_lrus_.erase(lru));
+    seq_states_.at(shortest_seq_id) = SequenceState::kRecycling;
+    InsertEvictionKey(shortest_seq_id);
+    *restored_seq_length = shortest_seq_length;
+    return shortest_seq_id;
   }
 
   /*!
@@ -261,20 +676,45 @@ class PrefixCacheImpl : public PrefixCacheObj {
      * reused. And it will transfer to kActive only when reused.
      */
     kRecycling = 1,
+    /*!
+     * \brief The state of sequence offloaded to the host memory tier. In this state, the sequence
+     * is kept in the radix tree for matching, but its KV data is not in the KV cache. It will
+     * transfer to kRecycling when restored to the KV cache.
+     */
+    kOffloaded = 2,
   };
   /*!
    * \brief The core data structure radix tree.
    */
   PagedRadixTree radix_tree_;
   /*!
-   * \brief The map from sequence to LRU time stamps.
+   * \brief The index of the sequences in radix tree, which other threads query.
+   */
+  std::shared_ptr<PrefixMatchIndex> match_index_ = std::make_shared<PrefixMatchIndex>();
+  /*!
+   * \brief The map from recycling sequence to its eviction key. The key is recomputed when the
+   * sequence is used or, for the cost-aware policy, when its exclusive length may change.
+   */
+  std::unordered_map<int64_t, EvictionKey> recycling_seq_keys_;
+  /*!
+   * \brief The recycling sequences ordered by their eviction keys, used to find the sequence to
+   * evict in O(log n).
    */
-  std::unordered_map<int64_t, size_t> recycling_seq_lrus_;
+  std::set<std::pair<EvictionKey, int64_t>> recycling_seq_eviction_order_;
   /*!
-   * \brief The map from LRU time stamps to sequence, used to find the sequence with earlist LRU
-   * time stamp.
+   * \brief The map from sequence to the number of requests that have used it, including the
+   * request that created it.
    */
-  std::unordered_map<size_t, int64_t> reversed_recycling_seq_lrus_;
+  std::unordered_map<int64_t, int64_t> seq_hit_counts_;
+  /*!
+   * \brief The map from offloaded sequence to LRU time stamps.
+   */
+  std::unordered_map<int64_t, size_t> offloaded_seq_lrus_;
+  /*!
+   * \brief The ordered map from LRU time stamps to offloaded sequence, used to find the offloaded
+   * sequence with earliest LRU time stamp.
+   */
+  std::map<size_t, int64_t> reversed_offloaded_seq_lrus_;
   /*!
    * \brief The maximum number of recycling sequences in prefix cache. Set -1 as infinite prefix
    * cache.
@@ -289,6 +729,28 @@ class PrefixCacheImpl : public PrefixCacheObj {
    * removing sequence in KVCache and return sequence ID to ID manager lazily
    */
   PrefixCacheRemoveCallback remove_callback_ = nullptr;
+  /*!
+   * \brief The callbacks to offload, restore and drop sequences of the host memory tier.
+   */
+  PrefixCacheHostTierCallbacks host_tier_callbacks_;
+  /*!
+   * \brief The policy to select the recycling sequence to evict.
+   */
+  PrefixCacheEvictionPolicy eviction_policy_;
+  /*!
+   * \brief The page size of KV cache. Reusing a recycling sequence is preferred over forking
+   * from it only when less than one page of its trailing tokens is popped.
+   */
+  size_t kv_cache_page_size_;
+  /*!
+   * \brief The interval of state checkpoints when the model states can only be forked at the
+   * end of sequences, or -1 when the sequences can be forked at any position.
+   */
+  int64_t state_checkpoint_interval_;
+  /*!
+   * \brief The runtime statistics.
+   */
+  PrefixCacheStats stats_;
   /*!
    * \brief The map from sequence to its sequence states.
    */
@@ -379,18 +841,70 @@ class NoPrefixCache : public PrefixCacheObj {
     return false;
   }
 
+  /*!
+   * \brief Get the number of tokens of a sequence.
+   * \throw Error if called since there is no sequence.
+   */
+  size_t GetSequenceLength(int64_t seq_id) final {
+    LOG(FATAL) << "Unreachable code.";
+    throw;
+  }
+
   /*!
    * \brief Reset the prefix cache to initial status. Do nothing and return.
    */
   void Reset() final {}
+
+  /*!
+   * \brief Get the runtime statistics of prefix cache.
+   * \return Always return empty statistics as no sequence stored.
+   */
+  PrefixCacheStats GetStats() const final { return PrefixCacheStats(); }
+
+  /*!
+   * \brief Get the sequences whose KV data can be persisted.
+   * \return Always return empty as no sequence stored.
+   */
+  std::vector<std::pair<int64_t, IntTuple>> GetPersistableSequences() final { return {}; }
+
+  /*!
+   * \brief Add a recycling sequence.
+   * \throw Error if called since this should never be called.
+   */
+  void AddRecyclingSequence(int64_t seq_id, IntTuple tokens) final {
+    // Since there is no prefix cache, this method should never be called.
+    LOG(FATAL) << "Unreachable code.";
+  }
+
+  /*!
+   * \brief Get the match index.
+   * \return Always return nullptr as no sequence stored.
+   */
+  std::shared_ptr<const PrefixMatchIndex> GetMatchIndex() const final { return nullptr; }
+
+  /*!
+   * \brief Trim the recycling sequences.
+   * \return Always return empty as no sequence stored.
+   */
+  std::vector<std::pair<int64_t, size_t>> TrimRecyclingSequences() final { return {}; }
 };
 
 TVM_REGISTER_OBJECT_TYPE(NoPrefixCache);
 
 PrefixCache PrefixCache::CreateRadixPrefixCache(size_t max_num_recycling_seqs,
-                                                PrefixCacheRemoveCallback remove_callback) {
+                                                PrefixCacheRemoveCallback remove_callback,
+                                                PrefixCacheHostTierCallbacks host_tier_callbacks,
+                                                PrefixCacheEvictionPolicy eviction_policy,
+                                                int kv_cache_page_size,
+                                                int64_t state_checkpoint_interval) {
+  if (host_tier_callbacks.offload == nullptr || host_tier_callbacks.restore == nullptr ||
+      host_tier_callbacks.drop == nullptr) {
+    host_tier_callbacks = PrefixCacheHostTierCallbacks();
+  }
   ObjectPtr<PrefixCacheImpl> n =
-      make_object<PrefixCacheImpl>(max_num_recycling_seqs, remove_callback);
+      make_object<PrefixCacheImpl>(max_num_recycling_seqs, remove_callback, host_tier_callbacks,
+                                   eviction_policy, static_cast<size_t>(kv_cache_page_size),
+                                   state_checkpoint_interval);
   return PrefixCache(std::move(n));
 }
 
@@ -9,11 +9,15 @@
 #include <tvm/runtime/packed_func.h>
 
 #include <functional>
+#include <memory>
 #include <optional>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "model.h"
+#include "prefix_match_index.h"
 #include "radix_tree.h"
 #include "request_state.h"
 
@@ -28,6 +32,29 @@ using namespace tvm::runtime;
  */
 using PrefixCacheRemoveCallback = std::function<void(int64_t)>;
 
+/*!
+ * \brief The callbacks that move sequences between the KV cache (GPU tier) and
+ * the host memory tier of prefix cache. The host tier is disabled when any
+ * callback is not provided.
+ */
+struct PrefixCacheHostTierCallbacks {
+  /*!
+   * \brief Copy the KV data of a sequence with the given length to host memory, and remove the
+   * sequence from the KV cache. Return false if the host tier does not have enough capacity.
+   */
+  std::function<bool(int64_t, size_t)> offload = nullptr;
+  /*!
+   * \brief Restore the KV data of an offloaded sequence with the given length to the KV cache.
+   * Return false if the KV cache does not have enough memory.
+   */
+  std::function<bool(int64_t, size_t)> restore = nullptr;
+  /*!
+   * \brief Drop the host KV data of an offloaded sequence, and return its sequence ID to the
+   * ID manager.
+   */
+  std::function<void(int64_t)> drop = nullptr;
+};
+
 /*!
  * \brief The matched result from prefix cache. This result describes how to pre-process the new
  * sequence, to leverage the existing data in KVCache by reusing past sequences or forking from
@@ -53,6 +80,18 @@ class PrefixCacheMatchedResult {
   size_t reused_seq_pop_last_tokens = 0;
 };
 
+/*! \brief The runtime statistics of prefix cache. */
+struct PrefixCacheStats {
+  /*! \brief The number of inserted sequences that matched a cached prefix. */
+  int64_t num_hits = 0;
+  /*! \brief The number of inserted sequences that matched no cached prefix. */
+  int64_t num_misses = 0;
+  /*! \brief The total number of matched prefix tokens that skip prefill. */
+  int64_t num_hit_tokens = 0;
+  /*! \brief The total number of tokens removed from prefix cache due to eviction. */
+  int64_t num_evicted_tokens = 0;
+};
+
 class PrefixCacheObj : public Object {
  public:
   /*!
@@ -96,7 +135,7 @@ class PrefixCacheObj : public Object {
 
   /*!
    * \brief Try to remove recycling sequence to free up memory. It will remove the oldest recycling
-   sequence.
+   sequence, or offload it to the host memory tier when the host tier is enabled.
    * \return The flag if there is a sequence removed. In other word, return true when memory is
    freed successfully.
    * \throw Error if the given sequence id is not valid.
@@ -111,11 +150,57 @@ class PrefixCacheObj : public Object {
    */
   virtual bool HasSequence(int64_t seq_id) = 0;
 
+  /*!
+   * \brief Get the number of tokens of a sequence.
+   * \param seq_id The sequence ID for index.
+   * \return The sequence length.
+   * \throw Error if the given sequence id is not valid.
+   */
+  virtual size_t GetSequenceLength(int64_t seq_id) = 0;
+
   /*!
    * \brief Reset the prefix cache to initial status.
    */
   virtual void Reset() = 0;
 
+  /*!
+   * \brief Get the runtime statistics of prefix cache.
+   * \return The statistics.
+   */
+  virtual PrefixCacheStats GetStats() const = 0;
+
+  /*!
+   * \brief Get the sequences whose KV data can be persisted, i.e., the sequences that are in the
+   * KV cache and have no sliding window, together with their tokens.
+   * \return The pairs of sequence ID and sequence tokens.
+   */
+  virtual std::vector<std::pair<int64_t, IntTuple>> GetPersistableSequences() = 0;
+
+  /*!
+   * \brief Add a sequence whose KV data has already been restored to the KV cache as a
+   * recycling sequence, so that new sequences can reuse or fork from it.
+   * \param seq_id The sequence ID.
+   * \param tokens The tokens of the sequence.
+   * \throw Error if the given sequence id already exists.
+   */
+  virtual void AddRecyclingSequence(int64_t seq_id, IntTuple tokens) = 0;
+
+  /*!
+   * \brief Get the index of prefix cache that other threads can query without locking, to
+   * estimate the cached prefix length of a request when it arrives.
+   * \return The index, or nullptr if there is no prefix cache.
+   */
+  virtual std::shared_ptr<const PrefixMatchIndex> GetMatchIndex() const = 0;
+
+  /*!
+   * \brief Trim the trailing tokens of the recycling sequences that partially fill the last KV
+   * cache page of their exclusive part, so that the KV cache can free the page. Only the tokens
+   * that no other sequence shares are trimmed. The sequences with sliding window are skipped.
+   * \return The pairs of sequence ID and the number of trimmed tokens, which the caller should
+   * pop from the KV cache.
+   */
+  virtual std::vector<std::pair<int64_t, size_t>> TrimRecyclingSequences() = 0;
+
   static constexpr const uint32_t _type_index = TypeIndex::kDynamic;
   static constexpr const char* _type_key = "mlc.serve.PrefixCache";
   TVM_DECLARE_BASE_OBJECT_INFO(PrefixCacheObj, Object)
@@ -129,9 +214,26 @@ class PrefixCache : public ObjectRef {
    * \brief Initialization of prefix cache.
    * \param max_recycling_seqs The maximum number of recycling sequences in prefix cache.
    * \param remove_callback The optional callback function to call when removing a sequence.
+   * \param host_tier_callbacks The optional callbacks to enable the host memory tier. When
+   * enabled, the recycling sequences evicted from the KV cache are offloaded to host memory
+   * instead of being removed, and are restored when a new sequence matches them.
+   * \param eviction_policy The policy to select the recycling sequence to evict.
+   * \param kv_cache_page_size The page size of KV cache. A matched recycling sequence that is
+   * longer than the new sequence by at least one page is forked from instead of being reused,
+   * so that the new sequence shares the pages of the matched prefix and the trailing pages of
+   * the recycling sequence stay in cache.
+   * \param state_checkpoint_interval "-1" when the sequences can be forked at any position, as
+   * in KV cache. Otherwise the model states (e.g., RNN state) can only be forked at the end of
+   * sequences, and a new sequence is forked from a sequence that ends exactly where the match
+   * ends, or at the largest multiple of the interval below it when the interval is positive.
+   * The state checkpoints taken at the multiples of the interval are added as recycling
+   * sequences.
    */
-  static PrefixCache CreateRadixPrefixCache(size_t max_recycling_seqs,
-                                            PrefixCacheRemoveCallback remove_callback = nullptr);
+  static PrefixCache CreateRadixPrefixCache(
+      size_t max_recycling_seqs, PrefixCacheRemoveCallback remove_callback = nullptr,
+      PrefixCacheHostTierCallbacks host_tier_callbacks = PrefixCacheHostTierCallbacks(),
+      PrefixCacheEvictionPolicy eviction_policy = PrefixCacheEvictionPolicy::kLRU,
+      int kv_cache_page_size = 16, int64_t state_checkpoint_interval = -1);
   /*!
    * \brief Initialization of no prefix cache.
    */
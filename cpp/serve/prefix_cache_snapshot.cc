@@ -0,0 +1,250 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/prefix_cache_snapshot.cc
+ */
+#include "prefix_cache_snapshot.h"
+
+#include <dmlc/io.h>
+#include <tvm/runtime/logging.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "../support/hash.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*! \brief The magic number at the beginning of prefix cache snapshot files. */
+constexpr uint64_t kPrefixCacheSnapshotMagic = 0x4D4C435043534E31;  // "MLCPCSN1"
+
+/*! \brief The write-only stream of snapshot files. */
+class SnapshotFileWriteStream : public dmlc::Stream {
+ public:
+  explicit SnapshotFileWriteStream(const std::string& path)
+      : fp_(std::fopen(path.c_str(), "wb")) {}
+
+  ~SnapshotFileWriteStream() { Close(); }
+
+  bool IsOpen() const { return fp_ != nullptr; }
+
+  /*! \brief Close the file. Return false if any write has failed. */
+  bool Close() {
+    if (fp_ != nullptr) {
+      failed_ |= std::fclose(fp_) != 0;
+      fp_ = nullptr;
+    }
+    return !failed_;
+  }
+
+  size_t Read(void* ptr, size_t size) final {
+    LOG(FATAL) << "SnapshotFileWriteStream does not support read";
+    throw;
+  }
+
+  void Write(const void* ptr, size_t size) final {
+    failed_ |= std::fwrite(ptr, 1, size, fp_) != size;
+  }
+
+ private:
+  std::FILE* fp_;
+  bool failed_ = false;
+};
+
+/*! \brief The read-only memory mapping of snapshot files, which is also a read stream. */
+class SnapshotMappedFileReadStream : public dmlc::Stream {
+ public:
+  explicit SnapshotMappedFileReadStream(const std::string& path) {
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+      void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = static_cast<const char*>(data);
+        size_ = file_stat.st_size;
+      }
+    }
+    close(fd);
+#else
+    // Memory mapping is not available. Fall back to reading the whole file.
+    std::ifstream fin(path, std::ios::binary);
+    if (fin.good()) {
+      buffer_.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+      data_ = buffer_.data();
+      size_ = buffer_.size();
+    }
+#endif
+  }
+
+  ~SnapshotMappedFileReadStream() {
+#ifndef _WIN32
+    if (data_ != nullptr) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+  }
+
+  bool IsOpen() const { return data_ != nullptr; }
+
+  size_t Read(void* ptr, size_t size) final {
+    size = std::min(size, size_ - pos_);
+    if (size == 0) {
+      return 0;
+    }
+    std::memcpy(ptr, data_ + pos_, size);
+    pos_ += size;
+    return size;
+  }
+
+  void Write(const void* ptr, size_t size) final {
+    LOG(FATAL) << "SnapshotMappedFileReadStream does not support write";
+  }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  size_t pos_ = 0;
+#ifdef _WIN32
+  std::string buffer_;
+#endif
+};
+
+std::string ComputePrefixCacheSnapshotKey(const std::vector<std::string>& model_paths,
+                                          const std::vector<picojson::object>& model_configs,
+                                          const TokenTable& token_table) {
+  ICHECK_EQ(model_paths.size(), model_configs.size());
+  uint64_t hash = kFNV1aHashOffsetBasis;
+  for (int i = 0; i < static_cast<int>(model_paths.size()); ++i) {
+    UpdateFNV1aHashWithModel(&hash, model_paths[i], model_configs[i]);
+  }
+  UpdateFNV1aHash(&hash, std::to_string(token_table.size()));
+  for (int32_t i = 0; i < token_table.size(); ++i) {
+    UpdateFNV1aHash(&hash, token_table[i]);
+  }
+  return FNV1aHashToString(hash);
+}
+
+int SavePrefixCacheSnapshot(const std::string& path, const std::string& key,
+                            const PrefixCache& prefix_cache, const Array<Model>& models) {
+  std::vector<std::pair<int64_t, std::vector<int32_t>>> sequences;
+  for (const auto& [seq_id, tokens] : prefix_cache->GetPersistableSequences()) {
+    // The image positions are keyed by the negative prefix cache tokens of the image content,
+    // which the snapshot does not persist.
+    if (tokens.empty() ||
+        std::any_of(tokens.begin(), tokens.end(), [](int64_t token) { return token < 0; })) {
+      continue;
+    }
+    sequences.emplace_back(seq_id, std::vector<int32_t>(tokens.begin(), tokens.end()));
+  }
+
+  std::string tmp_path = path + ".tmp";
+  SnapshotFileWriteStream file(tmp_path);
+  if (!file.IsOpen()) {
+    LOG(WARNING) << "Cannot open \"" << tmp_path << "\" to save the prefix cache snapshot.";
+    return 0;
+  }
+  dmlc::Stream* stream = &file;
+  stream->Write(kPrefixCacheSnapshotMagic);
+  stream->Write(key);
+  stream->Write(static_cast<uint64_t>(models.size()));
+  stream->Write(static_cast<uint64_t>(sequences.size()));
+  for (const auto& [seq_id, tokens] : sequences) {
+    stream->Write(tokens);
+    for (const Model& model : models) {
+      Array<NDArray> kv_data = model->SwapOutSequence(seq_id, tokens.size());
+      stream->Write(static_cast<uint64_t>(kv_data.size()));
+      for (const NDArray& array : kv_data) {
+        array.Save(stream);
+      }
+    }
+  }
+  if (!file.Close() || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    LOG(WARNING) << "Failed to write the prefix cache snapshot to \"" << path << "\".";
+    std::remove(tmp_path.c_str());
+    return 0;
+  }
+  return sequences.size();
+}
+
+int LoadPrefixCacheSnapshot(const std::string& path, const std::string& key, EngineState estate,
+                            const Array<Model>& models, int page_size, int max_num_seqs) {
+  SnapshotMappedFileReadStream file(path);
+  if (!file.IsOpen()) {
+    LOG(INFO) << "No prefix cache snapshot found at \"" << path << "\".";
+    return 0;
+  }
+  dmlc::Stream* stream = &file;
+  uint64_t magic = 0;
+  uint64_t num_models = 0;
+  uint64_t num_seqs = 0;
+  std::string saved_key;
+  if (!stream->Read(&magic) || magic != kPrefixCacheSnapshotMagic || !stream->Read(&saved_key) ||
+      !stream->Read(&num_models) || !stream->Read(&num_seqs)) {
+    LOG(WARNING) << "\"" << path << "\" is not a valid prefix cache snapshot. Skip loading it.";
+    return 0;
+  }
+  if (saved_key != key || num_models != models.size()) {
+    LOG(WARNING) << "The prefix cache snapshot \"" << path
+                 << "\" was saved with a different model or tokenizer. Skip loading it.";
+    return 0;
+  }
+
+  int num_restored = 0;
+  for (uint64_t i = 0; i < num_seqs && num_restored < max_num_seqs; ++i) {
+    std::vector<int32_t> tokens;
+    std::vector<Array<NDArray>> kv_data;
+    bool valid = stream->Read(&tokens) && !tokens.empty();
+    for (int model_id = 0; valid && model_id < static_cast<int>(models.size()); ++model_id) {
+      uint64_t num_arrays = 0;
+      // Each model has the K data and the V data.
+      valid = stream->Read(&num_arrays) && num_arrays == 2;
+      std::vector<NDArray> arrays(num_arrays);
+      for (uint64_t j = 0; valid && j < num_arrays; ++j) {
+        valid = arrays[j].Load(stream) && arrays[j]->ndim >= 2 &&
+                arrays[j]->shape[1] == static_cast<int64_t>(tokens.size());
+      }
+      kv_data.push_back(Array<NDArray>(arrays));
+    }
+    if (!valid) {
+      LOG(WARNING) << "The prefix cache snapshot \"" << path
+                   << "\" is truncated or corrupted. Stop loading it.";
+      break;
+    }
+    // Stop when the sequence cannot fit in the KV cache.
+    int num_required_pages = (tokens.size() + page_size - 1) / page_size;
+    bool fits = true;
+    for (const Model& model : models) {
+      fits &= model->GetNumAvailablePages() >= num_required_pages;
+    }
+    if (!fits) {
+      break;
+    }
+    int64_t seq_id = estate->id_manager.GetNewId();
+    for (int model_id = 0; model_id < static_cast<int>(models.size()); ++model_id) {
+      models[model_id]->SwapInSequence(seq_id, kv_data[model_id]);
+    }
+    estate->prefix_cache->AddRecyclingSequence(
+        seq_id, IntTuple(std::vector<int64_t>(tokens.begin(), tokens.end())));
+    ++num_restored;
+  }
+  return num_restored;
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,73 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/prefix_cache_snapshot.h
+ * \brief The on-disk snapshot of prefix cache, which persists the cached sequences and
+ * their KV data across engine restarts.
+ */
+#ifndef MLC_LLM_SERVE_PREFIX_CACHE_SNAPSHOT_H_
+#define MLC_LLM_SERVE_PREFIX_CACHE_SNAPSHOT_H_
+
+#include <picojson.h>
+#include <tvm/runtime/container/array.h>
+
+#include <string>
+#include <vector>
+
+#include "../token_table.h"
+#include "engine_state.h"
+#include "model.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief Compute the key of prefix cache snapshots. A snapshot can only be loaded by an
+ * engine with the same key, which covers the model config and weight shard records of each
+ * model, as well as the token table of the tokenizer.
+ * \param model_paths The paths of the models.
+ * \param model_configs The model configs of the models.
+ * \param token_table The token table of the tokenizer.
+ * \return The snapshot key.
+ */
+std::string ComputePrefixCacheSnapshotKey(const std::vector<std::string>& model_paths,
+                                          const std::vector<picojson::object>& model_configs,
+                                          const TokenTable& token_table);
+
+/*!
+ * \brief Save the persistable sequences in prefix cache, together with their KV data in
+ * all models, to the snapshot file. The file is written to a temporary path first and then
+ * renamed, so that a crash in the middle never leaves a broken snapshot.
+ * \param path The path of the snapshot file.
+ * \param key The snapshot key.
+ * \param prefix_cache The prefix cache whose sequences are saved.
+ * \param models The models to get the KV data from.
+ * \return The number of saved sequences.
+ */
+int SavePrefixCacheSnapshot(const std::string& path, const std::string& key,
+                            const PrefixCache& prefix_cache, const Array<Model>& models);
+
+/*!
+ * \brief Load the snapshot file by memory-mapping it, restore the KV data of the saved
+ * sequences to all models, and add the sequences to prefix cache as recycling sequences.
+ * Loading is skipped with a warning when the file is missing or has a different key.
+ * Sequences are restored in order until the KV cache runs out of pages or the prefix cache
+ * reaches its maximum number of recycling sequences.
+ * \param path The path of the snapshot file.
+ * \param key The snapshot key.
+ * \param estate The engine state whose prefix cache and id manager are updated.
+ * \param models The models to restore the KV data to.
+ * \param page_size The KV cache page size.
+ * \param max_num_seqs The maximum number of sequences to restore.
+ * \return The number of restored sequences.
+ */
+int LoadPrefixCacheSnapshot(const std::string& path, const std::string& key, EngineState estate,
+                            const Array<Model>& models, int page_size, int max_num_seqs);
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_PREFIX_CACHE_SNAPSHOT_H_
@@ -0,0 +1,330 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/prefix_match_index.cc
+ */
+#include "prefix_match_index.h"
+
+#include <tvm/runtime/logging.h>
+#include <tvm/runtime/registry.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "data.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+namespace {
+
+/*! \brief The key of empty slots. */
+constexpr uint64_t kEmptyKey = 0;
+/*! \brief The key of erased slots, which readers probe past. */
+constexpr uint64_t kErasedKey = 1;
+/*! \brief The hash of the empty prefix. */
+constexpr uint64_t kEmptyPrefixHash = 14695981039346656037ULL;
+/*! \brief The minimum capacity of hash set. */
+constexpr size_t kMinCapacity = 1024;
+/*! \brief The magic number at the beginning of serialized summaries. */
+constexpr uint64_t kPrefixCacheSummaryMagic = 0x4D4C435043534D31;  // "MLCPCSM1"
+
+/*! \brief Mix a block of tokens into the hash of the prefix before the block. */
+uint64_t HashBlock(uint64_t prefix_hash, const int64_t* tokens) {
+  uint64_t hash = prefix_hash;
+  for (int i = 0; i < PrefixMatchIndex::kBlockSize; ++i) {
+    hash = (hash ^ static_cast<uint64_t>(tokens[i])) * 0x100000001b3ULL;
+  }
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebULL;
+  hash ^= hash >> 31;
+  // Keep the keys reserved by the slots out.
+  return hash <= kErasedKey ? hash + 2 : hash;
+}
+
+}  // namespace
+
+/****************** PrefixCacheSummary ******************/
+
+size_t PrefixCacheSummary::MatchPrefixLength(const int64_t* tokens, size_t num_tokens) const {
+  uint64_t prefix_hash = kEmptyPrefixHash;
+  size_t matched_length = 0;
+  constexpr int kBlockSize = PrefixMatchIndex::kBlockSize;
+  for (; matched_length + kBlockSize <= num_tokens; matched_length += kBlockSize) {
+    prefix_hash = HashBlock(prefix_hash, tokens + matched_length);
+    if (!std::binary_search(prefix_hashes.begin(), prefix_hashes.end(), prefix_hash)) break;
+  }
+  return matched_length;
+}
+
+std::string PrefixCacheSummary::Serialize() const {
+  // The header holds the magic number, the block size, the version and the number of hashes.
+  uint64_t header[4] = {kPrefixCacheSummaryMagic, PrefixMatchIndex::kBlockSize, version,
+                        prefix_hashes.size()};
+  std::string bytes(sizeof(header) + prefix_hashes.size() * sizeof(uint64_t), '\0');
+  std::memcpy(bytes.data(), header, sizeof(header));
+  std::memcpy(bytes.data() + sizeof(header), prefix_hashes.data(),
+              prefix_hashes.size() * sizeof(uint64_t));
+  return bytes;
+}
+
+std::optional<PrefixCacheSummary> PrefixCacheSummary::Deserialize(const std::string& bytes) {
+  uint64_t header[4];
+  if (bytes.size() < sizeof(header)) {
+    return std::nullopt;
+  }
+  std::memcpy(header, bytes.data(), sizeof(header));
+  // The hashes are only comparable under the same block size.
+  if (header[0] != kPrefixCacheSummaryMagic || header[1] != PrefixMatchIndex::kBlockSize ||
+      header[3] != (bytes.size() - sizeof(header)) / sizeof(uint64_t) ||
+      (bytes.size() - sizeof(header)) % sizeof(uint64_t) != 0) {
+    return std::nullopt;
+  }
+  PrefixCacheSummary summary;
+  summary.version = header[2];
+  summary.prefix_hashes.resize(header[3]);
+  std::memcpy(summary.prefix_hashes.data(), bytes.data() + sizeof(header),
+              header[3] * sizeof(uint64_t));
+  if (!std::is_sorted(summary.prefix_hashes.begin(), summary.prefix_hashes.end())) {
+    return std::nullopt;
+  }
+  return summary;
+}
+
+/****************** HashSet ******************/
+
+PrefixMatchIndex::HashSet::HashSet(size_t capacity)
+    : capacity(capacity), slots(new std::atomic<uint64_t>[capacity]) {
+  for (size_t i = 0; i < capacity; ++i) {
+    slots[i].store(kEmptyKey, std::memory_order_relaxed);
+  }
+}
+
+bool PrefixMatchIndex::HashSet::Contains(uint64_t key) const {
+  // The set is never more than half full, so that the probing always reaches an empty slot.
+  for (size_t i = key & (capacity - 1);; i = (i + 1) & (capacity - 1)) {
+    uint64_t slot_key = slots[i].load(std::memory_order_acquire);
+    if (slot_key == key) return true;
+    if (slot_key == kEmptyKey) return false;
+  }
+}
+
+/****************** PrefixMatchIndex ******************/
+
+PrefixMatchIndex::PrefixMatchIndex() : hash_set_(std::make_shared<HashSet>(kMinCapacity)) {}
+
+void PrefixMatchIndex::AddSequence(int64_t seq_id) {
+  CHECK(seq_blocks_.emplace(seq_id, SequenceBlocks()).second)
+      << "Sequence ID = " << seq_id << " has been added.";
+}
+
+void PrefixMatchIndex::ExtendSequence(int64_t seq_id, const int64_t* tokens, size_t num_tokens) {
+  SequenceBlocks& seq = seq_blocks_.at(seq_id);
+  for (size_t i = 0; i < num_tokens; ++i) {
+    seq.tail.push_back(tokens[i]);
+    if (seq.tail.size() == kBlockSize) {
+      uint64_t prefix_hash = seq.block_hashes.empty() ? kEmptyPrefixHash : seq.block_hashes.back();
+      seq.block_hashes.push_back(HashBlock(prefix_hash, seq.tail.data()));
+      Acquire(seq.block_hashes.back());
+      seq.tail.clear();
+    }
+  }
+}
+
+void PrefixMatchIndex::RollBackSequence(int64_t seq_id, size_t num_tokens,
+                                        const std::function<IntTuple()>& get_tokens) {
+  SequenceBlocks& seq = seq_blocks_.at(seq_id);
+  if (num_tokens <= seq.tail.size()) {
+    seq.tail.resize(seq.tail.size() - num_tokens);
+    return;
+  }
+  size_t length = seq.block_hashes.size() * kBlockSize + seq.tail.size();
+  CHECK_LE(num_tokens, length);
+  size_t new_length = length - num_tokens;
+  size_t num_blocks = new_length / kBlockSize;
+  while (seq.block_hashes.size() > num_blocks) {
+    Release(seq.block_hashes.back());
+    seq.block_hashes.pop_back();
+  }
+  seq.tail.clear();
+  if (new_length > num_blocks * kBlockSize) {
+    // The sequence ends in the middle of a released block, whose tokens are not kept.
+    IntTuple tokens = get_tokens();
+    CHECK_EQ(tokens.size(), new_length);
+    seq.tail.assign(tokens.begin() + num_blocks * kBlockSize, tokens.end());
+  }
+}
+
+void PrefixMatchIndex::RemoveSequence(int64_t seq_id) {
+  auto it = seq_blocks_.find(seq_id);
+  CHECK(it != seq_blocks_.end()) << "Sequence ID = " << seq_id << " not found.";
+  for (uint64_t key : it->second.block_hashes) {
+    Release(key);
+  }
+  seq_blocks_.erase(it);
+}
+
+void PrefixMatchIndex::Reset() {
+  seq_blocks_.clear();
+  ref_counts_.clear();
+  Rebuild();
+  version_.fetch_add(1, std::memory_order_release);
+}
+
+size_t PrefixMatchIndex::MatchPrefixLength(const int64_t* tokens, size_t num_tokens) const {
+  std::shared_ptr<const HashSet> hash_set = std::atomic_load(&hash_set_);
+  uint64_t prefix_hash = kEmptyPrefixHash;
+  size_t matched_length = 0;
+  for (; matched_length + kBlockSize <= num_tokens; matched_length += kBlockSize) {
+    prefix_hash = HashBlock(prefix_hash, tokens + matched_length);
+    if (!hash_set->Contains(prefix_hash)) break;
+  }
+  return matched_length;
+}
+
+int PrefixMatchIndex::EstimateCachedPrefixLength(const Request& request) const {
+  // Collect the tokens in the same way as the prefill collects them for prefix cache. The
+  // images without content hash end the matchable prefix.
+  std::vector<int64_t> tokens;
+  bool ends_at_image = false;
+  for (const Data& input : request->inputs) {
+    if (const auto* token_data = input.as<TokenDataNode>()) {
+      tokens.insert(tokens.end(), token_data->token_ids.begin(), token_data->token_ids.end());
+    } else if (const auto* image_data = input.as<ImageDataNode>()) {
+      if (image_data->content_hash == 0) {
+        ends_at_image = true;
+        break;
+      }
+      std::vector<int64_t> image_tokens = image_data->GetPrefixCacheTokens();
+      tokens.insert(tokens.end(), image_tokens.begin(), image_tokens.end());
+    } else {
+      return -1;
+    }
+  }
+  if (tokens.empty()) {
+    return 0;
+  }
+  // The last input token is always prefilled, so that the prefill produces the logits.
+  size_t num_tokens = ends_at_image ? tokens.size() : tokens.size() - 1;
+  return static_cast<int>(MatchPrefixLength(tokens.data(), num_tokens));
+}
+
+Request PrefixMatchIndex::AttachCachedPrefixEstimate(const Request& request) const {
+  if (request->estimated_cached_prefix_length != -1) {
+    return request;
+  }
+  int estimated_length = EstimateCachedPrefixLength(request);
+  if (estimated_length == -1) {
+    return request;
+  }
+  ObjectPtr<RequestNode> n = make_object<RequestNode>(*request.get());
+  n->estimated_cached_prefix_length = estimated_length;
+  return Request(n);
+}
+
+PrefixCacheSummary PrefixMatchIndex::ExportSummary() const {
+  PrefixCacheSummary summary;
+  // Read the version first, so that a summary racing with an update is never newer than its
+  // version says.
+  summary.version = version_.load(std::memory_order_acquire);
+  std::shared_ptr<const HashSet> hash_set = std::atomic_load(&hash_set_);
+  for (size_t i = 0; i < hash_set->capacity; ++i) {
+    uint64_t slot_key = hash_set->slots[i].load(std::memory_order_acquire);
+    if (slot_key != kEmptyKey && slot_key != kErasedKey) {
+      summary.prefix_hashes.push_back(slot_key);
+    }
+  }
+  std::sort(summary.prefix_hashes.begin(), summary.prefix_hashes.end());
+  // A racing update may move a key between the scanned slots.
+  summary.prefix_hashes.erase(
+      std::unique(summary.prefix_hashes.begin(), summary.prefix_hashes.end()),
+      summary.prefix_hashes.end());
+  return summary;
+}
+
+void PrefixMatchIndex::Acquire(uint64_t key) {
+  if (++ref_counts_[key] > 1) {
+    return;
+  }
+  if ((num_used_slots_ + 1) * 2 > hash_set_->capacity) {
+    // The new key is already counted, so that the rebuilt set contains it.
+    Rebuild();
+    version_.fetch_add(1, std::memory_order_release);
+    return;
+  }
+  HashSet& hash_set = *hash_set_;
+  for (size_t i = key & (hash_set.capacity - 1);; i = (i + 1) & (hash_set.capacity - 1)) {
+    uint64_t slot_key = hash_set.slots[i].load(std::memory_order_relaxed);
+    if (slot_key == kEmptyKey || slot_key == kErasedKey) {
+      // Reusing an erased slot is safe, since the key is not in the set.
+      num_used_slots_ += slot_key == kEmptyKey;
+      hash_set.slots[i].store(key, std::memory_order_release);
+      version_.fetch_add(1, std::memory_order_release);
+      return;
+    }
+  }
+}
+
+void PrefixMatchIndex::Release(uint64_t key) {
+  auto it = ref_counts_.find(key);
+  ICHECK(it != ref_counts_.end());
+  if (--it->second > 0) {
+    return;
+  }
+  ref_counts_.erase(it);
+  HashSet& hash_set = *hash_set_;
+  for (size_t i = key & (hash_set.capacity - 1);; i = (i + 1) & (hash_set.capacity - 1)) {
+    uint64_t slot_key = hash_set.slots[i].load(std::memory_order_relaxed);
+    ICHECK_NE(slot_key, kEmptyKey);
+    if (slot_key == key) {
+      hash_set.slots[i].store(kErasedKey, std::memory_order_release);
+      version_.fetch_add(1, std::memory_order_release);
+      return;
+    }
+  }
+}
+
+void PrefixMatchIndex::Rebuild() {
+  size_t capacity = kMinCapacity;
+  while (capacity < ref_counts_.size() * 4) {
+    capacity *= 2;
+  }
+  std::shared_ptr<HashSet> hash_set = std::make_shared<HashSet>(capacity);
+  for (const auto& [key, ref_count] : ref_counts_) {
+    size_t i = key & (capacity - 1);
+    while (hash_set->slots[i].load(std::memory_order_relaxed) != kEmptyKey) {
+      i = (i + 1) & (capacity - 1);
+    }
+    hash_set->slots[i].store(key, std::memory_order_relaxed);
+  }
+  num_used_slots_ = ref_counts_.size();
+  // The release store of the pointer publishes the slots to the readers.
+  std::atomic_store(&hash_set_, std::move(hash_set));
+}
+
+/*!
+ * \brief Get the length of the longest block-aligned prefix of the tokens in a serialized
+ * summary, or -1 if the summary is invalid. It lets routers in other processes match requests
+ * against the summaries of the engines.
+ */
+TVM_REGISTER_GLOBAL("mlc.serve.PrefixCacheSummaryMatchPrefixLength")
+    .set_body_typed([](std::string summary_bytes, IntTuple tokens) -> int64_t {
+      std::optional<PrefixCacheSummary> summary = PrefixCacheSummary::Deserialize(summary_bytes);
+      if (!summary.has_value()) {
+        return -1;
+      }
+      return summary->MatchPrefixLength(tokens.data(), tokens.size());
+    });
+
+/*! \brief Get the version of a serialized summary, or -1 if the summary is invalid. */
+TVM_REGISTER_GLOBAL("mlc.serve.PrefixCacheSummaryVersion")
+    .set_body_typed([](std::string summary_bytes) -> int64_t {
+      std::optional<PrefixCacheSummary> summary = PrefixCacheSummary::Deserialize(summary_bytes);
+      return summary.has_value() ? static_cast<int64_t>(summary->version) : -1;
+    });
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
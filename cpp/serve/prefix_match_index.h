@@ -0,0 +1,159 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/prefix_match_index.h
+ * \brief The index of prefix cache that other threads query without locking, to estimate the
+ * cached prefix length of a request before the engine prefills it.
+ */
+#ifndef MLC_LLM_SERVE_PREFIX_MATCH_INDEX_H_
+#define MLC_LLM_SERVE_PREFIX_MATCH_INDEX_H_
+
+#include <tvm/runtime/container/shape_tuple.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "request.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief The compact summary of the prefix cache of an engine, which routers and peer engines
+ * query to find the engine holding the longest prefix of a request. It holds the sorted hashes
+ * of the block-aligned prefixes in prefix cache, where the hash of each block chains the hash of
+ * the prefix before it, so that it takes 8 bytes per cached block and matches prefixes in the
+ * same way as PrefixMatchIndex.
+ */
+struct PrefixCacheSummary {
+  /*!
+   * \brief The version of the index when the summary is exported. It increases whenever a
+   * prefix is added to or removed from the index, so that the receivers can drop stale ones.
+   */
+  uint64_t version = 0;
+  /*! \brief The sorted hashes of the block-aligned prefixes. */
+  std::vector<uint64_t> prefix_hashes;
+
+  /*! \brief Get the length of the longest block-aligned prefix of the tokens in the summary. */
+  size_t MatchPrefixLength(const int64_t* tokens, size_t num_tokens) const;
+
+  /*! \brief Serialize the summary into bytes, to be sent to other processes. */
+  std::string Serialize() const;
+
+  /*!
+   * \brief Deserialize the summary from the bytes returned by Serialize.
+   * \return The summary, or std::nullopt if the bytes are not a valid summary.
+   */
+  static std::optional<PrefixCacheSummary> Deserialize(const std::string& bytes);
+};
+
+/*!
+ * \brief The index of the block-aligned prefixes of the sequences in prefix cache. It holds
+ * the hash of every prefix whose length is a multiple of the block size, in a flat open
+ * addressing hash set of atomic slots.
+ *
+ * The index has a single writer, the engine thread that keeps it in sync with prefix cache,
+ * and any number of readers on other threads, which probe the hash set without locking. The
+ * writer updates the slots in place, and swaps in a rebuilt hash set through a shared pointer
+ * when the set grows, so the readers holding the old set stay valid. A reader that races with
+ * an update gets a slightly stale estimate, which is all the scheduler needs.
+ */
+class PrefixMatchIndex {
+ public:
+  /*! \brief The number of tokens in each block. Prefixes are matched at block granularity. */
+  static constexpr int kBlockSize = 16;
+
+  PrefixMatchIndex();
+
+  /*! \brief Add an empty sequence. Called by the engine thread only. */
+  void AddSequence(int64_t seq_id);
+
+  /*! \brief Extend a sequence with the given tokens. Called by the engine thread only. */
+  void ExtendSequence(int64_t seq_id, const int64_t* tokens, size_t num_tokens);
+
+  /*!
+   * \brief Roll back a sequence by number of tokens. Called by the engine thread only.
+   * \param seq_id The sequence ID.
+   * \param num_tokens The number of tokens to roll back.
+   * \param get_tokens The function returning the sequence tokens after rolling back. It is
+   * only called when the sequence ends up in the middle of a hashed block.
+   */
+  void RollBackSequence(int64_t seq_id, size_t num_tokens,
+                        const std::function<IntTuple()>& get_tokens);
+
+  /*! \brief Remove a sequence. Called by the engine thread only. */
+  void RemoveSequence(int64_t seq_id);
+
+  /*! \brief Remove all sequences. Called by the engine thread only. */
+  void Reset();
+
+  /*!
+   * \brief Get the length of the longest block-aligned prefix of the given tokens which is a
+   * prefix of some sequence in the index. Safe to call from any thread.
+   */
+  size_t MatchPrefixLength(const int64_t* tokens, size_t num_tokens) const;
+
+  /*!
+   * \brief Estimate the number of input tokens of a request that prefix cache holds, matching
+   * the inputs in the same way as the engine does at prefill. Safe to call from any thread.
+   * \return The estimated length, or -1 if the request has untokenized text.
+   */
+  int EstimateCachedPrefixLength(const Request& request) const;
+
+  /*!
+   * \brief Return the request with its estimated cached prefix length set. The request is
+   * returned as is when the estimate is known or cannot be made. Safe to call from any thread.
+   */
+  Request AttachCachedPrefixEstimate(const Request& request) const;
+
+  /*! \brief Export the summary of the prefixes in the index. Safe to call from any thread. */
+  PrefixCacheSummary ExportSummary() const;
+
+ private:
+  /*! \brief The hash set of atomic slots, whose capacity is a power of two. */
+  struct HashSet {
+    explicit HashSet(size_t capacity);
+    bool Contains(uint64_t key) const;
+
+    size_t capacity;
+    std::unique_ptr<std::atomic<uint64_t>[]> slots;
+  };
+
+  /*! \brief The hashed blocks of a sequence, and the tokens after the last full block. */
+  struct SequenceBlocks {
+    std::vector<uint64_t> block_hashes;
+    std::vector<int64_t> tail;
+  };
+
+  /*! \brief Add a reference to a prefix hash, inserting it into the hash set if new. */
+  void Acquire(uint64_t key);
+  /*! \brief Remove a reference to a prefix hash, erasing it from the hash set if unused. */
+  void Release(uint64_t key);
+  /*! \brief Rebuild the hash set with the referenced keys, and publish it to readers. */
+  void Rebuild();
+
+  /*! \brief The hash set, loaded and stored atomically since readers load it concurrently. */
+  std::shared_ptr<HashSet> hash_set_;
+  /*! \brief The version of the index, increased whenever a prefix hash is added or removed. */
+  std::atomic<uint64_t> version_ = 0;
+  /*! \brief The number of slots that are not empty, including erased slots. */
+  size_t num_used_slots_ = 0;
+  /*! \brief The number of sequences containing each prefix hash. */
+  std::unordered_map<uint64_t, int> ref_counts_;
+  /*! \brief The hashed blocks of each sequence. */
+  std::unordered_map<int64_t, SequenceBlocks> seq_blocks_;
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_PREFIX_MATCH_INDEX_H_
@@ -6,6 +6,10 @@
 
 #include <tvm/runtime/registry.h>
 
+#include <algorithm>
+#include <limits>
+#include <vector>
+
 namespace mlc {
 namespace llm {
 namespace serve {
@@ -20,6 +24,8 @@ struct SequenceIDNode {
   int64_t id = 0;
   /*! \brief The pointer to the next sequence ID. */
   SequenceIDNode* next = nullptr;
+  /*! \brief The index of the node in sequence ID node pool. */
+  size_t pool_index = 0;
 };
 
 /*!
@@ -31,10 +37,7 @@ struct SequenceIDNode {
 class SequenceIDNodePool {
  public:
   /*! \brief The constructor of sequence ID node pool, allocating a new sequence ID node block. */
-  SequenceIDNodePool() {
-    NewNodeBlock_();
-    used_nodes_.clear();
-  }
+  SequenceIDNodePool() { NewNodeBlock_(); }
 
   /*!
    * \brief Get a sequence ID node from pool, and assign the fields.
@@ -51,7 +54,7 @@ class SequenceIDNodePool {
     size_t id = free_node_indicess_.back();
     free_node_indicess_.pop_back();
     SequenceIDNode* node = nodes_[id];
-    used_nodes_[node] = id;
+    used_[id] = true;
     node->id = seq_id;
     node->next = next;
     return node;
@@ -62,17 +65,17 @@ class SequenceIDNodePool {
    * \param node The sequence ID node to free.
    */
   void Free(SequenceIDNode* node) {
-    CHECK(used_nodes_.find(node) != used_nodes_.end());
-    free_node_indicess_.push_back(used_nodes_[node]);
-    used_nodes_.erase(node);
+    CHECK(used_[node->pool_index]);
+    used_[node->pool_index] = false;
+    free_node_indicess_.push_back(node->pool_index);
   }
 
   /*!
    * \brief Reset the sequence ID node pool to initial status.
    */
   void Reset() {
-    used_nodes_.clear();
-    free_node_indicess_.reserve(nodes_.size());
+    used_.assign(nodes_.size(), false);
+    free_node_indicess_.resize(nodes_.size());
     for (size_t i = 0; i < nodes_.size(); ++i) {
       nodes_[i]->id = 0;
       nodes_[i]->next = nullptr;
@@ -96,8 +99,8 @@ class SequenceIDNodePool {
   std::vector<SequenceIDNode*> nodes_;
   /*! \brief The indices of free sequence ID node in node pool. */
   std::vector<size_t> free_node_indicess_;
-  /*! \brief The map from used paged sequence ID node to its index in node pool. */
-  std::unordered_map<SequenceIDNode*, size_t> used_nodes_;
+  /*! \brief Whether each sequence ID node in node pool is in use. */
+  std::vector<bool> used_;
 
   /*! \brief Allocate a new node pool block. */
   void NewNodeBlock_() {
@@ -105,13 +108,40 @@ class SequenceIDNodePool {
     node_blocks_.push_back(new SequenceIDNode[kNodeBlockSize_]);
     nodes_.reserve(nodes_.size() + kNodeBlockSize_);
     free_node_indicess_.reserve(free_node_indicess_.size() + kNodeBlockSize_);
+    used_.resize(used_.size() + kNodeBlockSize_, false);
     for (size_t i = 0; i < kNodeBlockSize_; ++i) {
       nodes_.push_back(&node_blocks_.back()[i]);
+      nodes_.back()->pool_index = i + node_id_offset;
       free_node_indicess_.push_back(i + node_id_offset);
     }
   }
 };
 
+/*!
+ * \brief Match two token spans, returning the length of their common prefix. The spans are
+ * compared in fixed-size blocks without early exit inside a block, which the compiler turns
+ * into SIMD comparisons, and only the mismatched block is scanned token by token.
+ * \param page_tokens The tokens stored in a radix page.
+ * \param tokens The given tokens.
+ * \param length The length of both spans.
+ * \return The length of common prefix, in [0, length].
+ */
+inline size_t MatchTokenSpan(const int32_t* page_tokens, const int64_t* tokens, size_t length) {
+  constexpr size_t kBlockSize = 16;
+  size_t i = 0;
+  for (; i + kBlockSize <= length; i += kBlockSize) {
+    bool mismatch = false;
+    for (size_t j = 0; j < kBlockSize; ++j) {
+      mismatch |= static_cast<int64_t>(page_tokens[i + j]) != tokens[i + j];
+    }
+    if (mismatch) break;
+  }
+  for (; i < length; ++i) {
+    if (page_tokens[i] != tokens[i]) return i;
+  }
+  return length;
+}
+
 /*!
  * \brief The paged radix tree node data structure.
  *
@@ -145,10 +175,17 @@ struct RedixPage {
   size_t offset;
   /*! \brief The length of stored prefix tokens. The legal value is of [0, capacity). */
   size_t length;
+  /*! \brief The index of the page in page pool, which also keys the page in child table. */
+  size_t pool_index;
   /*! \brief The offset of first prefix token in memory layout. */
   static constexpr int kDataOffset = (sizeof(RedixPage*) * 3 + sizeof(SequenceIDNode*) +
-                                      sizeof(size_t) * 3 + sizeof(int32_t) - 1) /
+                                      sizeof(size_t) * 4 + sizeof(int32_t) - 1) /
                                      sizeof(int32_t);
+  /*! \brief The pool index of root page, which is not allocated from page pool. */
+  static constexpr size_t kRootPoolIndex = std::numeric_limits<uint32_t>::max();
+
+  /*! \brief Get the raw array of the circular token buffer. */
+  int32_t* Data() { return reinterpret_cast<int32_t*>(this) + kDataOffset; }
 
   /*!
    * \brief Overload opeartor [] to get the prefix tokens by index as simple int array.
@@ -276,19 +313,6 @@ struct RedixPage {
     return nullptr;
   }
 
-  /*!
-   * \brief Find the child indexed by first token.
-   * \return The child page started with first token, or nullptr if no such child page.
-   */
-  RedixPage* FindChild(int64_t first_token) {
-    int32_t casted = first_token;
-    // Iterate all child radix pages, as the child radix pages are stored unorderly.
-    for (RedixPage* child = first_child; child; child = child->next_sibiling) {
-      if ((*child)[0] == casted) return child;
-    }
-    return nullptr;
-  }
-
   /*! \brief Insert a new child page. */
   void InsertChild(RedixPage* child) {
     child->parent = this;
@@ -336,11 +360,119 @@ struct RedixPage {
    */
   size_t MatchPrefix(const int64_t* prefix, size_t prefix_length) {
     size_t n = std::min(length, prefix_length);
-    for (int i = 0; i < n; ++i) {
-      if ((*this)[i] != prefix[i]) return i;
+    // The tokens may wrap around the end of circular buffer, which makes two contiguous spans.
+    size_t first_span = std::min(n, capacity - offset);
+    size_t matched = MatchTokenSpan(Data() + offset, prefix, first_span);
+    if (matched < first_span) return matched;
+    return first_span + MatchTokenSpan(Data(), prefix + first_span, n - first_span);
+  }
+};
+
+/*!
+ * \brief The child page table of paged radix tree, mapping a parent page and the first token of
+ * a child page to the child page.
+ *
+ * The table is an open addressing hash table with linear probing over a flat array, keyed by
+ * the pool index of parent page and the first token. So finding a child page costs a probe or
+ * two, instead of walking all the siblings of pages with large fan-out.
+ */
+class RadixChildTable {
+ public:
+  RadixChildTable() { slots_.resize(kInitialCapacity_); }
+
+  /*!
+   * \brief Find the child page indexed by first token.
+   * \return The child page started with first token, or nullptr if no such child page.
+   */
+  RedixPage* Find(const RedixPage* parent, int32_t first_token) const {
+    uint64_t key = Key(parent, first_token);
+    for (size_t i = Hash(key);; i = (i + 1) & Mask()) {
+      const Slot& slot = slots_[i];
+      if (slot.page == nullptr) return nullptr;
+      if (slot.key == key) return slot.page;
+    }
+  }
+
+  /*! \brief Insert a child page, whose first token is not in other children of parent page. */
+  void Insert(const RedixPage* parent, int32_t first_token, RedixPage* child) {
+    if ((size_ + 1) * 2 > slots_.size()) {
+      Rehash(slots_.size() * 2);
+    }
+    InsertKey(Key(parent, first_token), child);
+    ++size_;
+  }
+
+  /*!
+   * \brief Erase a child page.
+   * \throw Error if no such child page.
+   */
+  void Erase(const RedixPage* parent, int32_t first_token) {
+    uint64_t key = Key(parent, first_token);
+    size_t hole = Hash(key);
+    for (;; hole = (hole + 1) & Mask()) {
+      CHECK(slots_[hole].page != nullptr) << "The child page to erase is not found.";
+      if (slots_[hole].key == key) break;
+    }
+    // Shift back the later entries of the probe sequence, so that no tombstone is needed.
+    for (size_t i = (hole + 1) & Mask(); slots_[i].page != nullptr; i = (i + 1) & Mask()) {
+      // The entry can move to the hole if the hole is between its home slot and itself.
+      if (((i - Hash(slots_[i].key)) & Mask()) >= ((i - hole) & Mask())) {
+        slots_[hole] = slots_[i];
+        hole = i;
+      }
+    }
+    slots_[hole].page = nullptr;
+    --size_;
+  }
+
+  /*! \brief Reset the table to empty, keeping the allocated slots. */
+  void Reset() {
+    std::fill(slots_.begin(), slots_.end(), Slot());
+    size_ = 0;
+  }
+
+ private:
+  struct Slot {
+    uint64_t key = 0;
+    /*! \brief The child page, or nullptr if the slot is empty. */
+    RedixPage* page = nullptr;
+  };
+
+  static uint64_t Key(const RedixPage* parent, int32_t first_token) {
+    return (static_cast<uint64_t>(parent->pool_index) << 32) | static_cast<uint32_t>(first_token);
+  }
+
+  size_t Hash(uint64_t key) const {
+    return static_cast<size_t>((key * 0x9e3779b97f4a7c15ULL) >> 32) & Mask();
+  }
+
+  size_t Mask() const { return slots_.size() - 1; }
+
+  void InsertKey(uint64_t key, RedixPage* page) {
+    size_t i = Hash(key);
+    while (slots_[i].page != nullptr) {
+      i = (i + 1) & Mask();
     }
-    return n;
+    slots_[i].key = key;
+    slots_[i].page = page;
   }
+
+  void Rehash(size_t capacity) {
+    std::vector<Slot> slots = std::move(slots_);
+    slots_.assign(capacity, Slot());
+    for (const Slot& slot : slots) {
+      if (slot.page != nullptr) {
+        InsertKey(slot.key, slot.page);
+      }
+    }
+  }
+
+  /*! \brief The initial number of slots, which is always a power of two. */
+  static constexpr size_t kInitialCapacity_ = 64;
+  /*! \brief The slots of hash table, which are kept at most half full. */
+  std::vector<Slot> slots_;
+  /*! \brief The number of child pages in table. */
+  size_t size_ = 0;
 };
 
 /*!
@@ -352,10 +484,7 @@ struct RedixPage {
 class RadixPagePool {
  public:
   /*! \brief The constructor of paged radix tree page pool, allocating memory for each page. */
-  RadixPagePool() {
-    NewPageBlock_();
-    used_pages_.clear();
-  }
+  RadixPagePool() { NewPageBlock_(); }
 
   /*!
    * \brief Get a radix page from pool.
@@ -370,7 +499,7 @@ class RadixPagePool {
     int id = free_page_indices_.back();
     free_page_indices_.pop_back();
     RedixPage* page = pages_[id];
-    used_pages_[page] = id;
+    used_[id] = true;
     page->parent = page->first_child = page->next_sibiling = nullptr;
     page->capacity = kPageCapacity_;
     page->offset = page->length = 0;
@@ -384,9 +513,9 @@ class RadixPagePool {
    */
   void Free(RedixPage* page) {
     CHECK_EQ(page->seq_ids, nullptr);
-    CHECK(used_pages_.find(page) != used_pages_.end());
-    free_page_indices_.push_back(used_pages_[page]);
-    CHECK(used_pages_.erase(page));
+    CHECK(used_[page->pool_index]);
+    used_[page->pool_index] = false;
+    free_page_indices_.push_back(page->pool_index);
   }
 
   /*!
@@ -399,8 +528,8 @@ class RadixPagePool {
    * \brief Reset the paged radix tree page pool to initial status.
    */
   void Reset() {
-    used_pages_.clear();
-    free_page_indices_.reserve(pages_.size());
+    used_.assign(pages_.size(), false);
+    free_page_indices_.resize(pages_.size());
     for (int i = 0; i < pages_.size(); ++i) {
       pages_[i]->parent = pages_[i]->first_child = pages_[i]->next_sibiling = nullptr;
       pages_[i]->capacity = kPageCapacity_;
@@ -432,8 +561,8 @@ class RadixPagePool {
   std::vector<RedixPage*> pages_;
   /*! \brief The indices of free paged radix page in page pool. */
   std::vector<size_t> free_page_indices_;
-  /*! \brief The map from used paged radix tree page to its index in page pool. */
-  std::unordered_map<RedixPage*, size_t> used_pages_;
+  /*! \brief Whether each paged radix tree page in page pool is in use. */
+  std::vector<bool> used_;
 
   /*! \brief Allocate a new page pool block. */
   void NewPageBlock_() {
@@ -441,8 +570,10 @@ class RadixPagePool {
     page_blocks_.push_back(new int32_t[kPageBlockSize_ * kPageSize_]);
     pages_.reserve(pages_.size() + kPageBlockSize_);
     free_page_indices_.reserve(free_page_indices_.size() + kPageBlockSize_);
+    used_.resize(used_.size() + kPageBlockSize_, false);
     for (size_t i = 0; i < kPageBlockSize_; ++i) {
       pages_.push_back(reinterpret_cast<RedixPage*>(page_blocks_.back() + i * kPageSize_));
+      pages_.back()->pool_index = i + page_id_offset;
       free_page_indices_.push_back(i + page_id_offset);
     }
   }
@@ -463,6 +594,8 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
   RadixPagePool* radix_page_pool = nullptr;
   /*! \brief The root page of paged radix tree. */
   RedixPage* root = nullptr;
+  /*! \brief The table to find child pages by their first tokens. */
+  RadixChildTable child_table;
 
   explicit PagedRadixTreeImpl() {
     seq_id_node_pool = new SequenceIDNodePool();
@@ -472,6 +605,7 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
     root->parent = root->first_child = root->next_sibiling = nullptr;
     root->offset = root->length = root->capacity = 0;
     root->seq_ids = nullptr;
+    root->pool_index = RedixPage::kRootPoolIndex;
   }
 
   /*!
@@ -530,6 +664,75 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
     return length;
   }
 
+  /*!
+   * \brief Get the number of trailing tokens exclusively held by a sequence.
+   * \param seq_id The sequence ID for index.
+   * \return The exclusive length of the sequence.
+   * \throw Error if sequence ID is not valid.
+   */
+  size_t GetSequenceExclusiveLength(int64_t seq_id) {
+    CHECK(seq2page.find(seq_id) != seq2page.end());
+    RedixPage* page = seq2page[seq_id];
+    if (page->first_child || page->seq_ids->next) {
+      // The tokens of the last page are also the prefix of other sequences.
+      return 0;
+    }
+    size_t length = 0;
+    // Walk up along the pages which are only on the path of this sequence.
+    while (page->parent) {
+      length += page->length;
+      RedixPage* parent = page->parent;
+      if (parent->seq_ids || parent->first_child != page || page->next_sibiling) {
+        break;
+      }
+      page = parent;
+    }
+    return length;
+  }
+
+  /*!
+   * \brief Get the other sequences whose exclusive lengths may change when a sequence is changed.
+   * \param seq_id The sequence ID for index.
+   * \return The IDs of the sequences.
+   * \throw Error if sequence ID is not valid.
+   * \sa PagedRadixTreeObj::GetExclusiveLengthNeighbors
+   */
+  std::vector<int64_t> GetExclusiveLengthNeighbors(int64_t seq_id) {
+    CHECK(seq2page.find(seq_id) != seq2page.end());
+    std::vector<int64_t> neighbors;
+    RedixPage* path_child = nullptr;
+    for (RedixPage* page = seq2page[seq_id]; page; path_child = page, page = page->parent) {
+      // The sequences ending on the path are exclusive only when nothing continues the page.
+      for (SequenceIDNode* node = page->seq_ids; node; node = node->next) {
+        if (node->id != seq_id) {
+          neighbors.push_back(node->id);
+        }
+      }
+      // The exclusive part of a chain hanging from the page extends over the page only when the
+      // chain is the only child, which the change of the path can toggle.
+      RedixPage* other_child = nullptr;
+      int num_other_children = 0;
+      for (RedixPage* child = page->first_child; child && num_other_children < 2;
+           child = child->next_sibiling) {
+        if (child != path_child) {
+          other_child = child;
+          ++num_other_children;
+        }
+      }
+      if (num_other_children != 1) {
+        continue;
+      }
+      RedixPage* chain = other_child;
+      while (!chain->seq_ids && chain->first_child && !chain->first_child->next_sibiling) {
+        chain = chain->first_child;
+      }
+      if (chain->seq_ids && !chain->seq_ids->next && !chain->first_child) {
+        neighbors.push_back(chain->seq_ids->id);
+      }
+    }
+    return neighbors;
+  }
+
   /*!
    * \brief Fork a sequence from parent sequence at given position.
    * \param seq_id The new sequence ID.
@@ -598,11 +801,11 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
     while (offset < length) {
       // Allocate new radix page and extend tokens
       RedixPage* new_page = radix_page_pool->Allocate();
-      page->InsertChild(new_page);
-      page = new_page;
-      size_t suffix_length = std::min(page->capacity - page->length, length - offset);
-      page->Extend(suffix + offset, suffix_length);
+      size_t suffix_length = std::min(new_page->capacity, length - offset);
+      new_page->Extend(suffix + offset, suffix_length);
       offset += suffix_length;
+      InsertChild(page, new_page);
+      page = new_page;
     }
     page->AddSequence(seq_id_node_pool, seq_id);
     seq2page[seq_id] = page;
@@ -638,7 +841,7 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
       RedixPage* parent = page->parent;
       if (page->seq_ids == nullptr && page->first_child == nullptr) {
         // The leaf page is removable
-        parent->RemoveChild(page);
+        RemoveChild(parent, page);
         radix_page_pool->Free(page);
       }
       page = parent;
@@ -671,7 +874,7 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
     seq2page.erase(seq_id);
     while (page->parent && !page->seq_ids && !page->first_child) {
       RedixPage* parent = page->parent;
-      parent->RemoveChild(page);
+      RemoveChild(parent, page);
       radix_page_pool->Free(page);
       page = parent;
     }
@@ -691,6 +894,7 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
     radix_page_pool->Reset();
     seq_id_node_pool->Reset();
     seq2page.clear();
+    child_table.Reset();
     root->parent = root->first_child = root->next_sibiling = nullptr;
     root->offset = root->length = root->capacity = 0;
     root->seq_ids = nullptr;
@@ -704,6 +908,26 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
   }
 
  private:
+  /*! \brief Insert a child page, which has its prefix tokens, and register it in child table. */
+  void InsertChild(RedixPage* page, RedixPage* child) {
+    page->InsertChild(child);
+    child_table.Insert(page, (*child)[0], child);
+  }
+
+  /*! \brief Remove a child page, and unregister it from child table. */
+  void RemoveChild(RedixPage* page, RedixPage* child) {
+    child_table.Erase(page, (*child)[0]);
+    page->RemoveChild(child);
+  }
+
+  /*! \brief Move the child pages of a page to another page in child table. */
+  void MoveChildrenInTable(RedixPage* from, RedixPage* to) {
+    for (RedixPage* p = from->first_child; p; p = p->next_sibiling) {
+      child_table.Erase(from, (*p)[0]);
+      child_table.Insert(to, (*p)[0], p);
+    }
+  }
+
   /*!
    * \brief Merge a radix tree page with its child radix tree page, to save radix tree page.
    * e.g. MergePage([1, 2, _, _, _] -> [3, 4, 5, _, _]) = [1, 2, 3, 4, 5].
@@ -713,6 +937,8 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
   void MergePage(RedixPage* page) {
     CHECK(page->Mergeable());
     RedixPage* child = page->first_child;
+    child_table.Erase(page, (*child)[0]);
+    MoveChildrenInTable(child, page);
     for (int i = 0; i < child->length; ++i) {
       (*page)[i + page->length] = (*child)[i];
     }
@@ -739,6 +965,7 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
   RedixPage* SplitPage(RedixPage* page, size_t offset) {
     CHECK_LT(offset, page->length);
     RedixPage* child = radix_page_pool->Allocate();
+    MoveChildrenInTable(page, child);
     child->parent = page;
     child->first_child = page->first_child;
     for (RedixPage* p = page->first_child; p; p = p->next_sibiling) {
@@ -750,6 +977,7 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
     }
     child->length = page->length - offset;
     page->length = offset;
+    child_table.Insert(page, (*child)[0], child);
     child->seq_ids = page->seq_ids;
     std::vector<int64_t> seq_ids = page->GetLocalSequence();
     for (int64_t id : seq_ids) seq2page[id] = child;
@@ -776,7 +1004,7 @@ class PagedRadixTreeImpl : public PagedRadixTreeObj {
                                                        size_t length) {
     size_t offset = 0;
     while (offset < length) {
-      if (RedixPage* child = page->FindChild(tokens[offset])) {
+      if (RedixPage* child = child_table.Find(page, static_cast<int32_t>(tokens[offset]))) {
         // If child page starts with offset-th token, common prefix at least ends with child page
         size_t matched_offset = child->MatchPrefix(tokens + offset, length - offset);
         offset += matched_offset;
@@ -832,6 +1060,14 @@ TVM_REGISTER_GLOBAL("mlc.serve.PagedRadixTreeGetSequenceLength")
     .set_body_typed([](PagedRadixTree paged_radix_tree, int64_t seq_id) {
       return (int64_t)paged_radix_tree->GetSequenceLength(seq_id);
     });
+TVM_REGISTER_GLOBAL("mlc.serve.PagedRadixTreeGetSequenceExclusiveLength")
+    .set_body_typed([](PagedRadixTree paged_radix_tree, int64_t seq_id) {
+      return (int64_t)paged_radix_tree->GetSequenceExclusiveLength(seq_id);
+    });
+TVM_REGISTER_GLOBAL("mlc.serve.PagedRadixTreeGetExclusiveLengthNeighbors")
+    .set_body_typed([](PagedRadixTree paged_radix_tree, int64_t seq_id) {
+      return IntTuple(paged_radix_tree->GetExclusiveLengthNeighbors(seq_id));
+    });
 TVM_REGISTER_GLOBAL("mlc.serve.PagedRadixTreeFreeCapacity")
     .set_body_typed([](PagedRadixTree paged_radix_tree) {
       return (int64_t)paged_radix_tree->FreeCapacity();
@@ -9,6 +9,7 @@
 
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace mlc {
 namespace llm {
@@ -52,6 +53,29 @@ class PagedRadixTreeObj : public Object {
    */
   virtual size_t GetSequenceLength(int64_t seq_id) = 0;
 
+  /*!
+   * \brief Get the number of trailing tokens exclusively held by a sequence, which are not
+   * shared with any other sequence and will be freed when the sequence is removed.
+   * \param seq_id The sequence ID for index.
+   * \return The exclusive length of the sequence.
+   * \throw Error if sequence ID is not valid.
+   */
+  virtual size_t GetSequenceExclusiveLength(int64_t seq_id) = 0;
+
+  /*!
+   * \brief Get the other sequences whose exclusive lengths may change when a sequence is changed,
+   * i.e., the sequences ending on its path, and the sequences at the ends of the unbranched
+   * chains hanging from its path. Call it before removing or rolling back the sequence, and after
+   * adding, extending or forking it. The cost is linear in the number of pages on the path and
+   * the chains, instead of in the number of sequences.
+   * \param seq_id The sequence ID for index.
+   * \return The IDs of the sequences, which may include sequences whose exclusive lengths are
+   * unchanged.
+   * \throw Error if sequence ID is not valid.
+   * \sa GetSequenceExclusiveLength
+   */
+  virtual std::vector<int64_t> GetExclusiveLengthNeighbors(int64_t seq_id) = 0;
+
   /*!
    * \brief Fork a sequence from parent sequence at given position.
    * \param seq_id The new sequence ID.
@@ -66,6 +66,48 @@ Request Request::FromUntokenized(const Request& request, const Tokenizer& tokeni
   }
 }
 
+Array<Request> Request::FromUntokenized(const Array<Request>& requests,
+                                       const Tokenizer& tokenizer) {
+  // Collect the text inputs of all requests.
+  std::vector<std::string> texts;
+  for (const Request& request : requests) {
+    for (const Data& input : request->inputs) {
+      if (const auto* text_data = input.as<TextDataNode>()) {
+        texts.push_back(text_data->text);
+      }
+    }
+  }
+  if (texts.empty()) {
+    return requests;
+  }
+  std::vector<std::vector<int32_t>> token_ids = tokenizer->EncodeBatch(texts);
+
+  Array<Request> tokenized_requests;
+  tokenized_requests.reserve(requests.size());
+  int text_index = 0;
+  for (const Request& request : requests) {
+    bool has_untokenized_input = false;
+    Array<Data> inputs;
+    inputs.reserve(request->inputs.size());
+    for (const Data& input : request->inputs) {
+      if (input->IsInstance<TextDataNode>()) {
+        has_untokenized_input = true;
+        inputs.push_back(TokenData(std::move(token_ids[text_index++])));
+      } else {
+        inputs.push_back(input);
+      }
+    }
+    if (!has_untokenized_input) {
+      ICHECK_NE(request->input_total_length, -1);
+      tokenized_requests.push_back(request);
+    } else {
+      tokenized_requests.push_back(
+          Request(request->id, std::move(inputs), request->generation_cfg));
+    }
+  }
+  return tokenized_requests;
+}
+
 TVM_REGISTER_GLOBAL("mlc.serve.Request")
     .set_body_typed([](String id, Array<Data> inputs, String generation_cfg_json_str,
                        Optional<String> default_generation_cfg_json_str) {
@@ -48,6 +48,12 @@ class RequestNode : public Object {
    * of untokenized text data.
    */
   int input_total_length = -1;
+  /*!
+   * \brief The estimated number of leading input tokens that prefix cache holds when the
+   * request arrives, which the scheduler does not count in the prefill cost of the request.
+   * "-1" means the estimate is unknown.
+   */
+  int estimated_cached_prefix_length = -1;
   /*!
    * \brief The sampling configuration which may contain temperature,
    * top_p, repetition_penalty, max_gen_len, etc.
@@ -73,6 +79,17 @@ class Request : public ObjectRef {
    */
   static Request FromUntokenized(const Request& request, const Tokenizer& tokenizer);
 
+  /*!
+   * \brief Return the request objects with all text data tokenized. The text data of all the
+   * requests are tokenized in one batch, which runs in parallel and reuses the cached ids of
+   * repeated texts.
+   * \param requests The requests to be tokenized.
+   * \param tokenizer The tokenizer to tokenize the input data of the given requests.
+   * \return The request objects whose data are tokenized.
+   */
+  static Array<Request> FromUntokenized(const Array<Request>& requests,
+                                              const Tokenizer& tokenizer);
+
   TVM_DEFINE_OBJECT_REF_METHODS(Request, ObjectRef, RequestNode);
 };
 
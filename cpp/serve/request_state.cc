@@ -5,6 +5,12 @@
 
 #include "request_state.h"
 
+#include <picojson.h>
+
+#include <algorithm>
+
+#include "../support/pooled_obj_allocator.h"
+
 namespace mlc {
 namespace llm {
 namespace serve {
@@ -16,7 +22,7 @@ TVM_REGISTER_OBJECT_TYPE(RequestModelStateNode);
 RequestModelState::RequestModelState(
     Request request, int model_id, int64_t internal_id, Array<Data> inputs,
     const std::optional<std::shared_ptr<GrammarStateInitContext>>& grammar_state_init_ctx) {
-  ObjectPtr<RequestModelStateNode> n = make_object<RequestModelStateNode>();
+  ObjectPtr<RequestModelStateNode> n = PooledObjAllocator().make_object<RequestModelStateNode>();
   n->model_id = model_id;
   n->internal_id = internal_id;
   n->inputs = std::move(inputs);
@@ -38,7 +44,9 @@ int RequestModelStateNode::GetInputLength() const {
   return total_length;
 }
 
-bool RequestModelStateNode::RequireNextTokenBitmask() { return grammar_state_matcher.defined(); }
+bool RequestModelStateNode::RequireNextTokenBitmask() {
+  return grammar_state_matcher.defined() && !grammar_state_matcher.value()->IsTerminated();
+}
 
 void RequestModelStateNode::FindNextTokenBitmask(DLTensor* bitmask) {
   ICHECK(grammar_state_matcher.defined());
@@ -46,9 +54,25 @@ void RequestModelStateNode::FindNextTokenBitmask(DLTensor* bitmask) {
   grammar_state_matcher.value()->FindNextTokenBitmask(bitmask);
 }
 
+std::vector<int32_t> RequestModelStateNode::FindJumpForwardTokens(int max_num_tokens) {
+  if (!grammar_state_matcher.defined() || grammar_state_matcher.value()->IsTerminated()) {
+    return {};
+  }
+  return grammar_state_matcher.value()->FindJumpForwardTokens(max_num_tokens);
+}
+
 void RequestModelStateNode::CommitToken(SampleResult sampled_token) {
+  if (draft_grammar_snapshot.has_value()) {
+    // The committed tokens replace the draft tokens in the grammar state.
+    RestoreDraftGrammarSnapshot();
+    draft_grammar_diverged = true;
+  }
+  committed_token_ids.push_back(sampled_token.sampled_token_id.first);
   committed_tokens.push_back(std::move(sampled_token));
-  appeared_token_ids[sampled_token.sampled_token_id.first] += 1;
+  appeared_token_ids[committed_token_ids.back()] += 1;
+  if (ngram_index.Enabled()) {
+    ngram_index.Append(sampled_token.sampled_token_id.first);
+  }
 
   // Update the grammar matcher state if it exists.
   if (grammar_state_matcher) {
@@ -59,9 +83,30 @@ void RequestModelStateNode::CommitToken(SampleResult sampled_token) {
   }
 }
 
+void RequestModelStateNode::SetCommittedTokens(std::vector<SampleResult> tokens) {
+  committed_token_ids.clear();
+  committed_token_ids.reserve(tokens.size());
+  for (const SampleResult& token : tokens) {
+    committed_token_ids.push_back(token.sampled_token_id.first);
+  }
+  committed_tokens = std::move(tokens);
+}
+
 void RequestModelStateNode::AddDraftToken(SampleResult sampled_token, int draft_token_slot) {
+  int parent_idx = static_cast<int>(draft_output_tokens.size()) - 1;
+  AddDraftToken(std::move(sampled_token), draft_token_slot, parent_idx);
+}
+
+void RequestModelStateNode::AddDraftToken(SampleResult sampled_token, int draft_token_slot,
+                                          int parent_idx) {
+  ICHECK_LT(parent_idx, static_cast<int>(draft_output_tokens.size()));
+  if (grammar_state_matcher.defined()) {
+    AdvanceGrammarWithDraftToken(sampled_token.sampled_token_id.first, parent_idx);
+  }
   draft_output_tokens.push_back(std::move(sampled_token));
   draft_token_slots.push_back(draft_token_slot);
+  draft_token_parent_idx.push_back(parent_idx);
+  draft_token_seq_ids.push_back(-1);
   appeared_token_ids[sampled_token.sampled_token_id.first] += 1;
 }
 
@@ -69,6 +114,8 @@ void RequestModelStateNode::RemoveLastDraftToken() {
   ICHECK(!draft_output_tokens.empty());
   auto it = appeared_token_ids.find(draft_output_tokens.back().sampled_token_id.first);
   draft_output_tokens.pop_back();
+  draft_token_parent_idx.pop_back();
+  draft_token_seq_ids.pop_back();
   CHECK(it != appeared_token_ids.end());
   if (--it->second == 0) {
     appeared_token_ids.erase(it);
@@ -83,6 +130,123 @@ void RequestModelStateNode::RemoveAllDraftTokens(std::vector<int>* removed_draft
   while (!draft_output_tokens.empty()) {
     RemoveLastDraftToken();
   }
+  if (draft_grammar_snapshot.has_value()) {
+    RestoreDraftGrammarSnapshot();
+  }
+  draft_grammar_diverged = false;
+}
+
+void RequestModelStateNode::AdvanceGrammarWithDraftToken(int32_t token_id, int parent_idx) {
+  GrammarStateMatcher matcher = grammar_state_matcher.value();
+  if (!draft_grammar_snapshot.has_value()) {
+    draft_grammar_snapshot = matcher->SaveSnapshot();
+  }
+  // A draft token tree, or a draft token rejected by the grammar, ends the chain. The bitmasks
+  // after a rejected draft token do not matter, as the token is never accepted in verification.
+  if (draft_grammar_diverged || parent_idx != static_cast<int>(draft_output_tokens.size()) - 1 ||
+      matcher->IsTerminated() || !matcher->AcceptToken(token_id)) {
+    draft_grammar_diverged = true;
+  }
+}
+
+void RequestModelStateNode::RestoreDraftGrammarSnapshot() {
+  grammar_state_matcher.value()->RestoreSnapshot(draft_grammar_snapshot.value());
+  draft_grammar_snapshot.reset();
+}
+
+/****************** NGramDraftIndex ******************/
+
+void NGramDraftIndex::Init(const std::vector<int32_t>& tokens, int max_ngram_size) {
+  ICHECK_GE(max_ngram_size, 1);
+  tokens_.clear();
+  tokens_.reserve(tokens.size());
+  follower_positions_.assign(max_ngram_size, {});
+  for (int32_t token : tokens) {
+    Append(token);
+  }
+}
+
+uint64_t NGramDraftIndex::HashNGram(int end, int ngram_size) const {
+  uint64_t hash = 14695981039346656037ULL;
+  for (int i = end - ngram_size; i < end; ++i) {
+    hash = (hash ^ static_cast<uint32_t>(tokens_[i])) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+void NGramDraftIndex::Append(int32_t token) {
+  int position = tokens_.size();
+  tokens_.push_back(token);
+  // The n-grams that end right before the token are followed by the token.
+  for (int ngram_size = 1;
+       ngram_size <= static_cast<int>(follower_positions_.size()) && ngram_size <= position;
+       ++ngram_size) {
+    if (tokens_[position - ngram_size] < 0) {
+      // The n-grams across the non-token inputs never match.
+      break;
+    }
+    follower_positions_[ngram_size - 1][HashNGram(position, ngram_size)] = position;
+  }
+}
+
+std::vector<int32_t> NGramDraftIndex::Propose(int max_num_tokens) const {
+  int num_tokens = tokens_.size();
+  for (int ngram_size = std::min<int>(follower_positions_.size(), num_tokens); ngram_size >= 1;
+       --ngram_size) {
+    const auto& positions = follower_positions_[ngram_size - 1];
+    auto it = positions.find(HashNGram(num_tokens, ngram_size));
+    if (it == positions.end()) {
+      continue;
+    }
+    // The n-gram ending the tokens is not indexed yet, so the match is an earlier occurrence.
+    int follower = it->second;
+    if (!std::equal(tokens_.begin() + follower - ngram_size, tokens_.begin() + follower,
+                    tokens_.end() - ngram_size)) {
+      // Hash collision.
+      continue;
+    }
+    std::vector<int32_t> draft;
+    for (int i = follower; i < num_tokens && static_cast<int>(draft.size()) < max_num_tokens &&
+                           tokens_[i] >= 0;
+         ++i) {
+      draft.push_back(tokens_[i]);
+    }
+    if (!draft.empty()) {
+      return draft;
+    }
+  }
+  return {};
+}
+
+/****************** SpecDraftLengthController ******************/
+
+/*! \brief The decay of the counts in each update, which is about 10 drafts of memory. */
+constexpr double kSpecAcceptCountDecay = 0.9;
+/*! \brief The lowest probability of accepting the last draft token. */
+constexpr double kSpecMinLastAcceptProb = 0.2;
+
+void SpecDraftLengthController::Update(int draft_length, int accept_length) {
+  if (draft_length <= 0) {
+    return;
+  }
+  ICHECK_LE(accept_length, draft_length);
+  // The tokens after the first rejected token are never verified.
+  int verify_length = accept_length < draft_length ? accept_length + 1 : draft_length;
+  num_verified = num_verified * kSpecAcceptCountDecay + verify_length;
+  num_accepted = num_accepted * kSpecAcceptCountDecay + accept_length;
+}
+
+int SpecDraftLengthController::GetDraftLength(int max_draft_length) const {
+  double accept_rate = num_accepted / num_verified;
+  // The draft token at position `k` is accepted with probability `accept_rate^k`.
+  int draft_length = 1;
+  double last_accept_prob = accept_rate;
+  while (draft_length < max_draft_length &&
+         last_accept_prob * accept_rate >= kSpecMinLastAcceptProb) {
+    last_accept_prob *= accept_rate;
+    ++draft_length;
+  }
+  return draft_length;
 }
 
 /****************** RequestStateEntry ******************/
@@ -91,10 +255,10 @@ TVM_REGISTER_OBJECT_TYPE(RequestStateEntryNode);
 
 RequestStateEntry::RequestStateEntry(
     Request request, int num_models, int64_t internal_id, int rng_seed,
-    const std::vector<std::string>& token_table,
+    const std::shared_ptr<const TokenTable>& token_table,
     const std::optional<std::shared_ptr<GrammarStateInitContext>>& grammar_state_init_ctx,
     int parent_idx) {
-  ObjectPtr<RequestStateEntryNode> n = make_object<RequestStateEntryNode>();
+  ObjectPtr<RequestStateEntryNode> n = PooledObjAllocator().make_object<RequestStateEntryNode>();
   Array<RequestModelState> mstates;
   Array<Data> inputs;
   if (parent_idx == -1) {
@@ -121,23 +285,32 @@ DeltaRequestReturn RequestStateEntryNode::GetReturnTokenIds(const Tokenizer& tok
                                                             int64_t max_single_sequence_length) {
   std::vector<int32_t> return_token_ids;
   std::vector<String> logprob_json_strs;
+  std::vector<SampleResult> sample_results;
   Optional<String> finish_reason;
+  bool logprob_arrays = request->generation_cfg->logprobs &&
+                        request->generation_cfg->logprob_format == "array";
   const std::vector<SampleResult>& committed_tokens = this->mstates[0]->committed_tokens;
   int num_committed_tokens = committed_tokens.size();
   ICHECK_LE(this->next_callback_token_pos, num_committed_tokens);
 
-  // Case 1. There is no new token ids.
-  if (this->next_callback_token_pos == num_committed_tokens) {
-    return {{}, {}, Optional<String>()};
+  // Case 1. There is no new token ids, or the tokens are held back.
+  if (this->next_callback_token_pos == num_committed_tokens || this->hold_output) {
+    return {{}, {}, {}, Optional<String>()};
   }
 
   // Case 2. Any of the stop strings is matched.
   ICHECK(!stop_str_handler->StopTriggered());
+  int delta_begin_pos = next_callback_token_pos;
   while (next_callback_token_pos < num_committed_tokens) {
     std::vector<int32_t> delta_token_ids =
-        stop_str_handler->Put(committed_tokens[next_callback_token_pos].sampled_token_id.first);
-    logprob_json_strs.push_back(committed_tokens[next_callback_token_pos].GetLogProbJSON(
-        tokenizer, request->generation_cfg->logprobs));
+        stop_str_handler->Put(this->mstates[0]->committed_token_ids[next_callback_token_pos]);
+    if (logprob_arrays) {
+      // The logprobs are packed into arrays later, leaving the formatting to the frontend.
+      sample_results.push_back(committed_tokens[next_callback_token_pos]);
+    } else {
+      logprob_json_strs.push_back(committed_tokens[next_callback_token_pos].GetLogProbJSON(
+          tokenizer, request->generation_cfg->logprobs));
+    }
     ++next_callback_token_pos;
     return_token_ids.insert(return_token_ids.end(), delta_token_ids.begin(), delta_token_ids.end());
     if (stop_str_handler->StopTriggered()) {
@@ -150,6 +323,16 @@ DeltaRequestReturn RequestStateEntryNode::GetReturnTokenIds(const Tokenizer& tok
   // `stop_token_ids` includes the stop tokens from conversation template and user-provided tokens.
   // This check will be ignored when `ignore_eos` is set for the benchmarking purpose.
   if (!request->generation_cfg->ignore_eos) {
+    for (int pos = delta_begin_pos; pos < next_callback_token_pos; ++pos) {
+      int32_t token_id = this->mstates[0]->committed_token_ids[pos];
+      if (std::find(request->generation_cfg->stop_token_ids.begin(),
+                    request->generation_cfg->stop_token_ids.end(),
+                    token_id) != request->generation_cfg->stop_token_ids.end()) {
+        // The committed tokens after the stop token are not returned.
+        next_callback_token_pos = pos + 1;
+        break;
+      }
+    }
     for (int i = 0; i < static_cast<int>(return_token_ids.size()); ++i) {
       if (std::any_of(
               request->generation_cfg->stop_token_ids.begin(),
@@ -174,7 +357,23 @@ DeltaRequestReturn RequestStateEntryNode::GetReturnTokenIds(const Tokenizer& tok
   }
 
   if (finish_reason.defined()) {
-    return {return_token_ids, logprob_json_strs, finish_reason};
+    // Multi-step decode and speculative decoding may commit tokens past the stop in one step.
+    // Drop them, so that the committed tokens, and the output lengths counted from them, end
+    // at the stop.
+    int num_delta_tokens = next_callback_token_pos - delta_begin_pos;
+    if (logprob_arrays) {
+      sample_results.resize(std::min<int>(sample_results.size(), num_delta_tokens));
+    } else {
+      logprob_json_strs.resize(std::min<int>(logprob_json_strs.size(), num_delta_tokens));
+    }
+    for (const RequestModelState& mstate : this->mstates) {
+      if (static_cast<int>(mstate->committed_tokens.size()) > next_callback_token_pos) {
+        mstate->SetCommittedTokens(std::vector<SampleResult>(
+            mstate->committed_tokens.begin(),
+            mstate->committed_tokens.begin() + next_callback_token_pos));
+      }
+    }
+    return {return_token_ids, logprob_json_strs, sample_results, finish_reason};
   }
 
   // Case 5. Generation reaches the specified max generation length ==> Finished
@@ -183,15 +382,57 @@ DeltaRequestReturn RequestStateEntryNode::GetReturnTokenIds(const Tokenizer& tok
       num_committed_tokens >= request->generation_cfg->max_tokens) {
     std::vector<int32_t> remaining = stop_str_handler->Finish();
     return_token_ids.insert(return_token_ids.end(), remaining.begin(), remaining.end());
-    return {return_token_ids, logprob_json_strs, String("length")};
+    return {return_token_ids, logprob_json_strs, sample_results, String("length")};
   }
   // Case 6. Total length of the request reaches the maximum single sequence length ==> Finished
   if (request->input_total_length + num_committed_tokens >= max_single_sequence_length) {
     std::vector<int32_t> remaining = stop_str_handler->Finish();
     return_token_ids.insert(return_token_ids.end(), remaining.begin(), remaining.end());
-    return {return_token_ids, logprob_json_strs, String("length")};
+    return {return_token_ids, logprob_json_strs, sample_results, String("length")};
+  }
+  return {return_token_ids, logprob_json_strs, sample_results, Optional<String>()};
+}
+
+/****************** RequestMetrics ******************/
+
+namespace {
+
+double SecondsBetween(RequestMetrics::TimePoint start, RequestMetrics::TimePoint end) {
+  return static_cast<double>((end - start).count()) / 1e9;
+}
+
+}  // namespace
+
+double RequestMetrics::GetQueueTime() const {
+  return tfirst_scheduled.has_value() ? SecondsBetween(tarrival, tfirst_scheduled.value()) : -1;
+}
+
+double RequestMetrics::GetTimeToFirstToken() const {
+  return tfirst_token.has_value() ? SecondsBetween(tarrival, tfirst_token.value()) : -1;
+}
+
+double RequestMetrics::GetTimePerOutputToken() const {
+  if (!tfirst_token.has_value() || !tfinish.has_value() || num_output_tokens < 2) {
+    return -1;
+  }
+  return SecondsBetween(tfirst_token.value(), tfinish.value()) / (num_output_tokens - 1);
+}
+
+std::string RequestMetrics::AsJSONString() const {
+  picojson::object metrics;
+  metrics["queue_time"] = picojson::value(GetQueueTime());
+  metrics["ttft"] = picojson::value(GetTimeToFirstToken());
+  metrics["tpot"] = picojson::value(GetTimePerOutputToken());
+  metrics["e2e_latency"] =
+      picojson::value(tfinish.has_value() ? SecondsBetween(tarrival, tfinish.value()) : -1.0);
+  metrics["num_output_tokens"] = picojson::value(num_output_tokens);
+  metrics["num_preemptions"] = picojson::value(static_cast<int64_t>(tpreemptions.size()));
+  picojson::array preemption_times;
+  for (TimePoint tpreemption : tpreemptions) {
+    preemption_times.push_back(picojson::value(SecondsBetween(tarrival, tpreemption)));
   }
-  return {return_token_ids, logprob_json_strs, Optional<String>()};
+  metrics["preemption_times"] = picojson::value(preemption_times);
+  return picojson::value(metrics).serialize();
 }
 
 /****************** RequestState ******************/
@@ -199,11 +440,35 @@ DeltaRequestReturn RequestStateEntryNode::GetReturnTokenIds(const Tokenizer& tok
 TVM_REGISTER_OBJECT_TYPE(RequestStateNode);
 
 RequestState::RequestState(std::vector<RequestStateEntry> entries) {
-  ObjectPtr<RequestStateNode> n = make_object<RequestStateNode>();
+  ObjectPtr<RequestStateNode> n = PooledObjAllocator().make_object<RequestStateNode>();
+  n->metrics.tarrival = entries[0]->tadd;
   n->entries = std::move(entries);
   data_ = std::move(n);
 }
 
+TVM_REGISTER_OBJECT_TYPE(RequestHandoffNode);
+
+RequestHandoff::RequestHandoff(Request request, std::vector<SampleResult> committed_tokens,
+                               int next_callback_token_pos, std::vector<Array<NDArray>> kv_data,
+                               int64_t kv_length) {
+  ObjectPtr<RequestHandoffNode> n = make_object<RequestHandoffNode>();
+  n->request = std::move(request);
+  n->committed_tokens = std::move(committed_tokens);
+  n->next_callback_token_pos = next_callback_token_pos;
+  n->kv_data = std::move(kv_data);
+  n->kv_length = kv_length;
+  data_ = std::move(n);
+}
+
+TVM_REGISTER_OBJECT_TYPE(PrefixKVHandoffNode);
+
+PrefixKVHandoff::PrefixKVHandoff(IntTuple tokens, std::vector<Array<NDArray>> kv_data) {
+  ObjectPtr<PrefixKVHandoffNode> n = make_object<PrefixKVHandoffNode>();
+  n->tokens = std::move(tokens);
+  n->kv_data = std::move(kv_data);
+  data_ = std::move(n);
+}
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
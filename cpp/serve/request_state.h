@@ -11,12 +11,15 @@
 #include <tvm/runtime/object.h>
 
 #include <optional>
+#include <unordered_map>
+#include <vector>
 
 #include "../streamer.h"
 #include "../support/random.h"
 #include "config.h"
 #include "grammar/grammar_state_matcher.h"
 #include "request.h"
+#include "response_cache.h"
 
 namespace mlc {
 namespace llm {
@@ -24,6 +27,37 @@ namespace serve {
 
 using namespace tvm::runtime;
 
+/*!
+ * \brief The index of the n-grams in the prompt and the generated tokens of a request, which
+ * proposes draft tokens without draft models. For each n-gram size, the index maps every
+ * n-gram to the position following its latest occurrence, so that a draft is the tokens that
+ * followed the longest n-gram that matches the end of the tokens.
+ */
+class NGramDraftIndex {
+ public:
+  /*!
+   * \brief Initialize the index with the prompt tokens.
+   * \param tokens The prompt tokens, where the negative tokens separate the non-token inputs.
+   * \param max_ngram_size The largest n-gram to match.
+   */
+  void Init(const std::vector<int32_t>& tokens, int max_ngram_size);
+  /*! \brief Return whether the index is initialized. */
+  bool Enabled() const { return !follower_positions_.empty(); }
+  /*! \brief Append a generated token and index the n-grams ending before it. */
+  void Append(int32_t token);
+  /*! \brief Propose at most the given number of draft tokens to follow the tokens. */
+  std::vector<int32_t> Propose(int max_num_tokens) const;
+
+ private:
+  /*! \brief Get the hash of the n-gram of the given size ending at the given position. */
+  uint64_t HashNGram(int end, int ngram_size) const;
+
+  /*! \brief The prompt tokens and the generated tokens. */
+  std::vector<int32_t> tokens_;
+  /*! \brief The position following the latest occurrence of each n-gram, for each size. */
+  std::vector<std::unordered_map<uint64_t, int>> follower_positions_;
+};
+
 /*!
  * \brief The state of a request with regard to some single model.
  * \details In MLC LLM, the serving engine may leverage multiple models
@@ -50,6 +84,11 @@ class RequestModelStateNode : public Object {
    * A token is "committed" means it will no longer be updated (or changed).
    */
   std::vector<SampleResult> committed_tokens;
+  /*!
+   * \brief The token ids of committed_tokens, stored compactly for the passes that read only
+   * the ids. It is updated along with committed_tokens by CommitToken and SetCommittedTokens.
+   */
+  std::vector<int32_t> committed_token_ids;
   /*! \brief The list of input data yet for the model to prefill. */
   Array<Data> inputs;
   /*! \brief The list of prefilled input data, used to notify prefix cache. */
@@ -70,20 +109,52 @@ class RequestModelStateNode : public Object {
   std::vector<SampleResult> draft_output_tokens;
   /*! \brief The storage slots for the associated states of draft tokens. */
   std::vector<int> draft_token_slots;
+  /*!
+   * \brief The parent of each draft token in draft_output_tokens, where "-1" means the last
+   * committed token. The draft tokens form a token tree, in which a parent always comes before
+   * its children, and the siblings have distinct token ids.
+   */
+  std::vector<int> draft_token_parent_idx;
+  /*!
+   * \brief The sequence in the draft model whose KV cache holds the path to each draft token,
+   * or -1 if the token is not added to the KV cache. Besides the sequence of the request,
+   * the branches of a draft token tree are held by sequences forked for the branches.
+   */
+  std::vector<int64_t> draft_token_seq_ids;
   /*! \brief The appeared committed and draft tokens and their occurrence times. */
   std::unordered_map<int32_t, int32_t> appeared_token_ids;
+  /*!
+   * \brief The row of the device token count table of the logit processor that holds the
+   * occurrence times of the committed tokens, or -1 if there is none. It is reset to -1 when
+   * the committed tokens are replaced other than by CommitToken, so that the row is rebuilt.
+   */
+  int token_cnt_table_slot = -1;
+  /*!
+   * \brief The n-gram index of the prompt and the committed tokens, which proposes drafts in
+   * the "ngram" speculative mode. It is not initialized in the other modes.
+   */
+  NGramDraftIndex ngram_index;
 
   /*!
    * \brief The current state of the generated token matching the grammar. Used in grammar-guided
    * generation, otherwise it's NullOpt.
    */
   Optional<GrammarStateMatcher> grammar_state_matcher;
+  /*!
+   * \brief The grammar state snapshot before the draft tokens. The grammar state follows the
+   * draft tokens while they form a chain accepted by the grammar, so that the bitmasks of the
+   * draft positions are computed from the right state. It is restored when the draft tokens are
+   * removed, or when a token is committed.
+   */
+  std::optional<GrammarStateSnapshot> draft_grammar_snapshot;
+  /*! \brief Whether the grammar state stops following the later draft tokens. */
+  bool draft_grammar_diverged = false;
 
   /*! \brief Return the total length of the input data. */
   int GetInputLength() const;
   /*!
    * \brief Return whether the next token bitmask is required, i.e. the grammar-guided generation is
-   * enabled.
+   * enabled, and the grammar is not terminated by a draft token.
    */
   bool RequireNextTokenBitmask();
   /*!
@@ -92,10 +163,33 @@ class RequestModelStateNode : public Object {
    * with dtype uint32_t and shape (ceildiv(vocab_size, 32),).
    */
   void FindNextTokenBitmask(DLTensor* bitmask);
-  /*! \brief Commit a new token into committed_tokens. Update appeared_token_ids. */
+  /*!
+   * \brief Find the tokens that the grammar forces to be generated next, which are committed
+   * without sampling in jump-forward decoding. Return empty when grammar-guided generation is
+   * disabled.
+   * \param max_num_tokens The maximum number of tokens to return.
+   */
+  std::vector<int32_t> FindJumpForwardTokens(int max_num_tokens);
+  /*!
+   * \brief Commit a new token into committed_tokens. Update appeared_token_ids and the n-gram
+   * index.
+   */
   void CommitToken(SampleResult sampled_token);
-  /*! \brief Add a draft token into draft_output_tokens. Update appeared_token_ids. */
+  /*!
+   * \brief Replace committed_tokens with the given tokens, along with committed_token_ids.
+   * appeared_token_ids is not updated.
+   */
+  void SetCommittedTokens(std::vector<SampleResult> tokens);
+  /*!
+   * \brief Add a draft token into draft_output_tokens as the child of the last draft token.
+   * Update appeared_token_ids.
+   */
   void AddDraftToken(SampleResult sampled_token, int draft_token_slot);
+  /*!
+   * \brief Add a draft token into draft_output_tokens as the child of the given draft token.
+   * Update appeared_token_ids.
+   */
+  void AddDraftToken(SampleResult sampled_token, int draft_token_slot, int parent_idx);
   /*! \brief Remove all draft tokens from draft_output_tokens. Update appeared_token_ids. */
   void RemoveAllDraftTokens(std::vector<int>* removed_draft_token_slots = nullptr);
 
@@ -107,6 +201,10 @@ class RequestModelStateNode : public Object {
  private:
   /*! \brief Remove the last token from draft_output_tokens. Update appeared_token_ids. */
   void RemoveLastDraftToken();
+  /*! \brief Advance the grammar state with a draft token, if the draft tokens are a chain. */
+  void AdvanceGrammarWithDraftToken(int32_t token_id, int parent_idx);
+  /*! \brief Restore the grammar state before the draft tokens. */
+  void RestoreDraftGrammarSnapshot();
 };
 
 class RequestModelState : public ObjectRef {
@@ -121,6 +219,8 @@ class RequestModelState : public ObjectRef {
 struct DeltaRequestReturn {
   std::vector<int32_t> delta_token_ids;
   Array<String> delta_logprob_json_strs;
+  /*! \brief The sample results of the delta tokens, collected when the logprobs are in arrays. */
+  std::vector<SampleResult> delta_sample_results;
   Optional<String> finish_reason;
 };
 
@@ -153,6 +253,29 @@ struct DeltaRequestReturn {
  * of the tree.
  */
 
+/*!
+ * \brief The controller that adapts the speculative draft length of a request to its
+ * acceptance rate. The acceptance rate is estimated from the decayed counts of the verified
+ * and the accepted draft tokens. The draft length is the largest one with which the last
+ * draft token is still accepted with a reasonable probability.
+ */
+struct SpecDraftLengthController {
+  /*! \brief The decayed number of verified draft tokens, starting from a prior. */
+  double num_verified = 2.0;
+  /*! \brief The decayed number of accepted draft tokens, starting from a prior. */
+  double num_accepted = 1.8;
+
+  /*!
+   * \brief Update the acceptance rate with the verification result of a draft.
+   * \param draft_length The length of the verified draft.
+   * \param accept_length The number of accepted draft tokens.
+   */
+  void Update(int draft_length, int accept_length);
+
+  /*! \brief Get the draft length for the next draft, which is in [1, max_draft_length]. */
+  int GetDraftLength(int max_draft_length) const;
+};
+
 /*! \brief Request state status. */
 enum class RequestStateStatus : int {
   kPending = 0,
@@ -188,6 +311,19 @@ class RequestStateEntryNode : public Object {
   RandomGenerator rng;
   /*! \brief The stop string handler of this request state entry. */
   StopStrHandler stop_str_handler;
+  /*! \brief The controller of the speculative draft length of this request state entry. */
+  SpecDraftLengthController spec_draft_controller;
+  /*!
+   * \brief The sum of the log probabilities of the committed tokens, when the entry is a beam
+   * of beam search.
+   */
+  double beam_logprob = 0.0;
+  /*!
+   * \brief Whether the committed tokens are held back from the request stream callback. The
+   * beams of beam search hold their tokens back until the search finishes, since the beams
+   * are reordered at every step.
+   */
+  bool hold_output = false;
   /*!
    * \brief The start position of the committed tokens in the
    * next request stream callback invocation.
@@ -205,8 +341,8 @@ class RequestStateEntryNode : public Object {
    * generation has finished.
    * \param tokenizer The tokenizer for logprob process.
    * \param max_single_sequence_length The maximum allowed single sequence length.
-   * \return The delta token ids to return, the logprob JSON strings of each delta token id, and
-   * the optional finish reason.
+   * \return The delta token ids to return, the logprob JSON strings (or the sample results when
+   * the logprob format is "array") of each delta token id, and the optional finish reason.
    */
   DeltaRequestReturn GetReturnTokenIds(const Tokenizer& tokenizer,
                                        int64_t max_single_sequence_length);
@@ -221,17 +357,68 @@ class RequestStateEntry : public ObjectRef {
  public:
   explicit RequestStateEntry(
       Request request, int num_models, int64_t internal_id, int rng_seed,
-      const std::vector<std::string>& token_table,
+      const std::shared_ptr<const TokenTable>& token_table,
       const std::optional<std::shared_ptr<GrammarStateInitContext>>& grammar_state_init_ctx,
       int parent_idx = -1);
 
   TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(RequestStateEntry, ObjectRef, RequestStateEntryNode);
 };
 
+/*! \brief The timings of a request in the engine, by which the latency SLOs are measured. */
+struct RequestMetrics {
+  using TimePoint = std::chrono::high_resolution_clock::time_point;
+
+  /*! \brief The time the request is added to the engine. */
+  TimePoint tarrival;
+  /*! \brief The time the request is first scheduled for prefill. */
+  std::optional<TimePoint> tfirst_scheduled;
+  /*! \brief The time the first token of the request is generated. */
+  std::optional<TimePoint> tfirst_token;
+  /*! \brief The times the request is preempted. */
+  std::vector<TimePoint> tpreemptions;
+  /*! \brief The time the request finishes. */
+  std::optional<TimePoint> tfinish;
+  /*! \brief The largest number of tokens generated by a parallel generation of the request. */
+  int64_t num_output_tokens = 0;
+
+  /*! \brief The time (sec) from arrival to the first scheduling. */
+  double GetQueueTime() const;
+  /*! \brief The time (sec) from arrival to the first token. */
+  double GetTimeToFirstToken() const;
+  /*!
+   * \brief The average time (sec) per output token after the first token.
+   * It is -1 when the request generates less than two tokens.
+   */
+  double GetTimePerOutputToken() const;
+  /*! \brief Return the metrics in JSON string, with the times in seconds since arrival. */
+  std::string AsJSONString() const;
+};
+
+/*! \brief A beam that finished in beam search, with its score. */
+struct BeamHypothesis {
+  /*! \brief The generated tokens of the beam, ending with the stop token if any. */
+  std::vector<SampleResult> tokens;
+  /*! \brief The log probability of the tokens, divided by the length penalty. */
+  double score;
+};
+
 /*! \brief A request's state, which groups all the request state entries. */
 class RequestStateNode : public Object {
  public:
   std::vector<RequestStateEntry> entries;
+  /*!
+   * \brief The best finished beams of beam search so far, in descending order of score. Under
+   * beam search, the entries other than the root are the running beams.
+   */
+  std::vector<BeamHypothesis> finished_beams;
+  /*! \brief The LoRA adapter slot the request applies, or -1 if it applies no adapter. */
+  int lora_adapter_slot = -1;
+  /*! \brief The timing metrics of the request. */
+  RequestMetrics metrics;
+  /*! \brief The key of the request in the response cache, or empty if it is not cacheable. */
+  std::string response_cache_key;
+  /*! \brief The response streamed so far, kept for the response cache. */
+  CachedResponse cached_response;
 
   static constexpr const char* _type_key = "mlc.serve.RequestState";
   static constexpr const bool _type_has_method_sequal_reduce = false;
@@ -246,6 +433,64 @@ class RequestState : public ObjectRef {
   TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(RequestState, ObjectRef, RequestStateNode);
 };
 
+/*!
+ * \brief The handoff of a prefilled request between engines under prefill/decode
+ * disaggregation. It carries what the receiving engine needs to continue decoding the
+ * request: the tokenized request, the generated tokens so far, and the KV data of the
+ * request in each model.
+ */
+class RequestHandoffNode : public Object {
+ public:
+  /*! \brief The request, whose inputs are all tokenized. */
+  Request request;
+  /*! \brief The tokens committed by the exporting engine. */
+  std::vector<SampleResult> committed_tokens;
+  /*! \brief The start position of the committed tokens not yet streamed back. */
+  int next_callback_token_pos = 0;
+  /*! \brief The K data and V data of each model, returned by `ExportSequenceKV`. */
+  std::vector<Array<NDArray>> kv_data;
+  /*! \brief The number of tokens whose KV data is held. */
+  int64_t kv_length = 0;
+
+  static constexpr const char* _type_key = "mlc.serve.RequestHandoff";
+  static constexpr const bool _type_has_method_sequal_reduce = false;
+  static constexpr const bool _type_has_method_shash_reduce = false;
+  TVM_DECLARE_FINAL_OBJECT_INFO(RequestHandoffNode, Object);
+};
+
+class RequestHandoff : public ObjectRef {
+ public:
+  explicit RequestHandoff(Request request, std::vector<SampleResult> committed_tokens,
+                          int next_callback_token_pos, std::vector<Array<NDArray>> kv_data,
+                          int64_t kv_length);
+
+  TVM_DEFINE_OBJECT_REF_METHODS(RequestHandoff, ObjectRef, RequestHandoffNode);
+};
+
+/*!
+ * \brief The KV data of a cached prefix pulled from the prefix cache of another engine, so
+ * that an engine missing the prefix adds it to its prefix cache instead of recomputing it.
+ */
+class PrefixKVHandoffNode : public Object {
+ public:
+  /*! \brief The tokens of the prefix. */
+  IntTuple tokens;
+  /*! \brief The K data and V data of each model, returned by `ExportSequenceKV`. */
+  std::vector<Array<NDArray>> kv_data;
+
+  static constexpr const char* _type_key = "mlc.serve.PrefixKVHandoff";
+  static constexpr const bool _type_has_method_sequal_reduce = false;
+  static constexpr const bool _type_has_method_shash_reduce = false;
+  TVM_DECLARE_FINAL_OBJECT_INFO(PrefixKVHandoffNode, Object);
+};
+
+class PrefixKVHandoff : public ObjectRef {
+ public:
+  explicit PrefixKVHandoff(IntTuple tokens, std::vector<Array<NDArray>> kv_data);
+
+  TVM_DEFINE_OBJECT_REF_METHODS(PrefixKVHandoff, ObjectRef, PrefixKVHandoffNode);
+};
+
 }  // namespace serve
 }  // namespace llm
 }  // namespace mlc
@@ -0,0 +1,124 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/response_cache.cc
+ */
+#include "response_cache.h"
+
+#include <picojson.h>
+#include <tvm/runtime/logging.h>
+
+#include <sstream>
+
+#include "../support/hash.h"
+#include "../support/json_parser.h"
+#include "data.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+TVM_REGISTER_OBJECT_TYPE(ResponseCacheObj);
+
+ResponseCache::ResponseCache(int64_t capacity_bytes) {
+  CHECK_GT(capacity_bytes, 0);
+  ObjectPtr<ResponseCacheObj> n = make_object<ResponseCacheObj>();
+  n->capacity_bytes = capacity_bytes;
+  data_ = std::move(n);
+}
+
+std::string ResponseCacheObj::GetKey(const Request& request, const std::string& model,
+                                     std::vector<int32_t>* prompt_token_ids) {
+  const GenerationConfig& generation_cfg = request->generation_cfg;
+  bool greedy = generation_cfg->temperature == 0.0;
+  if ((!greedy && !generation_cfg->fixed_seed) || generation_cfg->logprobs ||
+      !generation_cfg->prefill_only_output.empty() || generation_cfg->debug_config.has_value()) {
+    return "";
+  }
+  prompt_token_ids->clear();
+  prompt_token_ids->reserve(request->input_total_length);
+  for (const Data& data : request->inputs) {
+    const auto* token_data = data.as<TokenDataNode>();
+    if (token_data == nullptr) {
+      return "";
+    }
+    prompt_token_ids->insert(prompt_token_ids->end(), token_data->token_ids.begin(),
+                             token_data->token_ids.end());
+  }
+
+  uint64_t hash = kFNV1aHashOffsetBasis;
+  for (int32_t token_id : *prompt_token_ids) {
+    UpdateFNV1aHash(&hash, token_id);
+  }
+  // The scheduling hints do not change the output, and neither does the seed of greedy requests.
+  picojson::object config = json::ParseToJSONObject(generation_cfg->AsJSONString());
+  for (const char* field : {"priority", "ttft_slo_ms", "tpot_slo_ms"}) {
+    config.erase(field);
+  }
+  if (greedy) {
+    config.erase("seed");
+  }
+  std::ostringstream os;
+  os << model << '\n' << picojson::value(config).serialize() << '\n' << FNV1aHashToString(hash);
+  return os.str();
+}
+
+const CachedResponse* ResponseCacheObj::Lookup(const std::string& key,
+                                               const std::vector<int32_t>& prompt_token_ids) {
+  auto it = responses_.find(key);
+  if (it == responses_.end() || it->second.first.prompt_token_ids != prompt_token_ids) {
+    return nullptr;
+  }
+  lru_list_.splice(lru_list_.begin(), lru_list_, it->second.second);
+  return &it->second.first;
+}
+
+void ResponseCacheObj::Insert(const std::string& key, CachedResponse response) {
+  int64_t response_bytes = GetResponseBytes(key, response);
+  if (response_bytes > capacity_bytes) {
+    return;
+  }
+  auto it = responses_.find(key);
+  if (it != responses_.end()) {
+    used_bytes_ -= GetResponseBytes(key, it->second.first);
+    lru_list_.erase(it->second.second);
+    responses_.erase(it);
+  }
+  while (used_bytes_ + response_bytes > capacity_bytes) {
+    EvictLRU();
+  }
+  lru_list_.push_front(key);
+  responses_.emplace(key, std::make_pair(std::move(response), lru_list_.begin()));
+  used_bytes_ += response_bytes;
+}
+
+void ResponseCacheObj::Clear() {
+  responses_.clear();
+  lru_list_.clear();
+  used_bytes_ = 0;
+}
+
+int64_t ResponseCacheObj::GetResponseBytes(const std::string& key,
+                                           const CachedResponse& response) {
+  // The key is stored twice, in the map and in the LRU list.
+  int64_t bytes = 2 * key.size() + response.prompt_token_ids.size() * sizeof(int32_t);
+  for (const std::vector<int32_t>& token_ids : response.group_token_ids) {
+    bytes += token_ids.size() * sizeof(int32_t);
+  }
+  for (const String& finish_reason : response.group_finish_reason) {
+    bytes += finish_reason.size();
+  }
+  return bytes;
+}
+
+void ResponseCacheObj::EvictLRU() {
+  ICHECK(!lru_list_.empty());
+  auto it = responses_.find(lru_list_.back());
+  ICHECK(it != responses_.end());
+  used_bytes_ -= GetResponseBytes(it->first, it->second.first);
+  responses_.erase(it);
+  lru_list_.pop_back();
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
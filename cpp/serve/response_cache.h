@@ -0,0 +1,106 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/response_cache.h
+ * \brief The exact-match cache of the responses of deterministic requests.
+ */
+#ifndef MLC_LLM_SERVE_RESPONSE_CACHE_H_
+#define MLC_LLM_SERVE_RESPONSE_CACHE_H_
+
+#include <tvm/runtime/container/string.h>
+#include <tvm/runtime/object.h>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "request.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*! \brief The cached response of a request, i.e. the tokens streamed back for each generation. */
+struct CachedResponse {
+  /*! \brief The prompt tokens of the request, compared on lookup against hash collisions. */
+  std::vector<int32_t> prompt_token_ids;
+  /*! \brief The concatenated delta tokens of each generation. */
+  std::vector<std::vector<int32_t>> group_token_ids;
+  /*! \brief The finish reason of each generation. */
+  std::vector<String> group_finish_reason;
+};
+
+/*!
+ * \brief The exact-match response cache. A request whose output is determined by its input,
+ * i.e. a greedy request or a sampled request with a fixed seed, is keyed by its prompt tokens,
+ * its generation config and the model. A request matching a cached response is answered with
+ * the cached tokens without running the model. The responses are evicted in the LRU order when
+ * their total size exceeds the capacity.
+ */
+class ResponseCacheObj : public Object {
+ public:
+  /*!
+   * \brief Get the key of the request, or the empty string if the request is not cacheable,
+   * which is when its output is random, carries logprobs, or its input is not all tokens.
+   * \param request The request, whose inputs are tokenized.
+   * \param model The model that serves the request.
+   * \param prompt_token_ids The prompt tokens of the request, as the output.
+   */
+  static std::string GetKey(const Request& request, const std::string& model,
+                            std::vector<int32_t>* prompt_token_ids);
+
+  /*!
+   * \brief Look up the response of a key, which becomes the most recently used one.
+   * \return The cached response, or nullptr if there is none.
+   */
+  const CachedResponse* Lookup(const std::string& key,
+                               const std::vector<int32_t>& prompt_token_ids);
+
+  /*! \brief Insert the response of a key, evicting the least recently used ones as needed. */
+  void Insert(const std::string& key, CachedResponse response);
+
+  /*! \brief Remove all the responses. */
+  void Clear();
+
+  /*! \brief The capacity of the cache in bytes. */
+  int64_t capacity_bytes = 0;
+
+  static constexpr const char* _type_key = "mlc.serve.ResponseCache";
+  static constexpr const bool _type_has_method_sequal_reduce = false;
+  static constexpr const bool _type_has_method_shash_reduce = false;
+  TVM_DECLARE_FINAL_OBJECT_INFO(ResponseCacheObj, Object);
+
+ private:
+  /*! \brief Get the number of bytes a response takes in the cache. */
+  static int64_t GetResponseBytes(const std::string& key, const CachedResponse& response);
+
+  /*! \brief Remove the least recently used response. */
+  void EvictLRU();
+
+  /*! \brief The cached responses and their positions in the LRU list, keyed by request key. */
+  std::unordered_map<std::string, std::pair<CachedResponse, std::list<std::string>::iterator>>
+      responses_;
+  /*! \brief The keys of the responses, from the most recently used to the least. */
+  std::list<std::string> lru_list_;
+  /*! \brief The total number of bytes of the cached responses. */
+  int64_t used_bytes_ = 0;
+};
+
+class ResponseCache : public ObjectRef {
+ public:
+  /*!
+   * \brief Create the response cache.
+   * \param capacity_bytes The maximum total size of the cached responses in bytes.
+   */
+  explicit ResponseCache(int64_t capacity_bytes);
+
+  TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(ResponseCache, ObjectRef, ResponseCacheObj);
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_RESPONSE_CACHE_H_
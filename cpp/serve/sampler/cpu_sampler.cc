@@ -6,18 +6,89 @@
 #include <tvm/runtime/ndarray.h>
 #include <tvm/runtime/packed_func.h>
 #include <tvm/runtime/registry.h>
-#include <tvm/runtime/threading_backend.h>
 
 #include <algorithm>
 #include <cmath>
 
+#include "../../support/parallel_for.h"
 #include "../../support/random.h"
+#include "../device_timer.h"
 #include "sampler.h"
 
 namespace mlc {
 namespace llm {
 namespace serve {
 
+namespace detail {
+
+/*!
+ * \brief The number of independent accumulation lanes in the blocked loops below.
+ * The lanes do not depend on each other, so compilers lower them to SIMD registers
+ * on each target (SSE/AVX, NEON, WASM SIMD) without target-specific intrinsics.
+ */
+constexpr int kNumLanes = 8;
+/*! \brief The number of probabilities screened together before any scalar work. */
+constexpr int kBlockSize = 64;
+
+/*! \brief Get the max value of the non-negative input values. */
+inline float BlockMax(const float* __restrict p, int n) {
+  float lanes[kNumLanes] = {0.0f};
+  int i = 0;
+  for (; i + kNumLanes <= n; i += kNumLanes) {
+    for (int l = 0; l < kNumLanes; ++l) {
+      lanes[l] = p[i + l] > lanes[l] ? p[i + l] : lanes[l];
+    }
+  }
+  float max_value = 0.0f;
+  for (int l = 0; l < kNumLanes; ++l) {
+    max_value = std::max(max_value, lanes[l]);
+  }
+  for (; i < n; ++i) {
+    max_value = std::max(max_value, p[i]);
+  }
+  return max_value;
+}
+
+/*! \brief Get the sum of the input values. */
+inline float BlockSum(const float* __restrict p, int n) {
+  float lanes[kNumLanes] = {0.0f};
+  int i = 0;
+  for (; i + kNumLanes <= n; i += kNumLanes) {
+    for (int l = 0; l < kNumLanes; ++l) {
+      lanes[l] += p[i + l];
+    }
+  }
+  float sum = 0.0f;
+  for (int l = 0; l < kNumLanes; ++l) {
+    sum += lanes[l];
+  }
+  for (; i < n; ++i) {
+    sum += p[i];
+  }
+  return sum;
+}
+
+/*! \brief Get the sum of the input values that are no less than the threshold. */
+inline float BlockSumAbove(const float* __restrict p, int n, float threshold) {
+  float lanes[kNumLanes] = {0.0f};
+  int i = 0;
+  for (; i + kNumLanes <= n; i += kNumLanes) {
+    for (int l = 0; l < kNumLanes; ++l) {
+      lanes[l] += p[i + l] >= threshold ? p[i + l] : 0.0f;
+    }
+  }
+  float sum = 0.0f;
+  for (int l = 0; l < kNumLanes; ++l) {
+    sum += lanes[l];
+  }
+  for (; i < n; ++i) {
+    sum += p[i] >= threshold ? p[i] : 0.0f;
+  }
+  return sum;
+}
+
+}  // namespace detail
+
 /*!
  * \brief Sample a value from the input probability distribution with top-p.
  * The input is a batch of distributions, and we use `unit_offset` to specify
@@ -54,13 +125,19 @@ TokenProbPair SampleTopPFromProb(NDArray prob, int unit_offset, int input_prob_o
     int argmax_pos = -1;
     float max_prob = 0.0;
     float sum_prob = 0.0;
-    for (int i = 0; i < ndata; ++i) {
-      if (p_prob[i] > max_prob) {
-        max_prob = p_prob[i];
-        argmax_pos = i;
+    for (int64_t begin = 0; begin < ndata; begin += detail::kBlockSize) {
+      int len = std::min<int64_t>(detail::kBlockSize, ndata - begin);
+      // Only scan the block when it contains a new max value.
+      if (detail::BlockMax(p_prob + begin, len) > max_prob) {
+        for (int i = begin; i < begin + len; ++i) {
+          if (p_prob[i] > max_prob) {
+            max_prob = p_prob[i];
+            argmax_pos = i;
+          }
+        }
       }
       // Early exit.
-      sum_prob += p_prob[i];
+      sum_prob += detail::BlockSum(p_prob + begin, len);
       if (1 - sum_prob <= max_prob) {
         break;
       }
@@ -71,10 +148,19 @@ TokenProbPair SampleTopPFromProb(NDArray prob, int unit_offset, int input_prob_o
   if (top_p >= one) {
     // Specially handle case where top_p == 1.
     double prob_sum = 0.0f;
-    for (int64_t i = 0; i < ndata; ++i) {
-      prob_sum += p_prob[i];
-      if (prob_sum >= uniform_sample) {
-        return {i, p_prob[i]};
+    for (int64_t begin = 0; begin < ndata; begin += detail::kBlockSize) {
+      int len = std::min<int64_t>(detail::kBlockSize, ndata - begin);
+      // Skip the blocks before the one where the prefix sum reaches the sample.
+      double block_sum = detail::BlockSum(p_prob + begin, len);
+      if (prob_sum + block_sum < uniform_sample) {
+        prob_sum += block_sum;
+        continue;
+      }
+      for (int64_t i = begin; i < begin + len; ++i) {
+        prob_sum += p_prob[i];
+        if (prob_sum >= uniform_sample) {
+          return {i, p_prob[i]};
+        }
       }
     }
     ICHECK(false) << "Possibly prob distribution contains NAN.";
@@ -89,14 +175,23 @@ TokenProbPair SampleTopPFromProb(NDArray prob, int unit_offset, int input_prob_o
     data.clear();
     // filter the data with cuttoff
     float cutoff_sum = 0.0f;
-    for (int64_t i = 0; i < ndata; ++i) {
-      if (p_prob[i] >= cuttoff) {
-        cutoff_sum += p_prob[i];
-        data.emplace_back(std::make_pair(p_prob[i], static_cast<int>(i)));
-        if (cutoff_sum > 1 - cuttoff) {
-          // Short cut. When the remaining parts cannot have total
-          // probability larger than cutoff, we can quit.
-          break;
+    bool finished = false;
+    for (int64_t begin = 0; begin < ndata && !finished; begin += detail::kBlockSize) {
+      int len = std::min<int64_t>(detail::kBlockSize, ndata - begin);
+      // Skip the blocks with no value above the cutoff.
+      if (cuttoff > 0.0f && detail::BlockMax(p_prob + begin, len) < cuttoff) {
+        continue;
+      }
+      for (int64_t i = begin; i < begin + len; ++i) {
+        if (p_prob[i] >= cuttoff) {
+          cutoff_sum += p_prob[i];
+          data.emplace_back(std::make_pair(p_prob[i], static_cast<int>(i)));
+          if (cutoff_sum > 1 - cuttoff) {
+            // Short cut. When the remaining parts cannot have total
+            // probability larger than cutoff, we can quit.
+            finished = true;
+            break;
+          }
         }
       }
     }
@@ -209,12 +304,21 @@ void RenormalizeProbByTopP(NDArray prob, int unit_offset, double top_p, double e
     // based on the new cutoff value.
     std::vector<float>& lower_partition = lower_partitions[round & 1];
     lower_partition.clear();
-    for (const float* ptr = lower_partition_begin; ptr != lower_partition_end; ++ptr) {
-      if (*ptr >= cutoff_values[round]) {
-        upper_partition.push_back(*ptr);
-        upper_partition_sum += *ptr;
-      } else {
-        lower_partition.push_back(*ptr);
+    for (const float* block = lower_partition_begin; block < lower_partition_end;
+         block += detail::kBlockSize) {
+      int len = std::min<int64_t>(detail::kBlockSize, lower_partition_end - block);
+      // The blocks with no value above the cutoff go to the lower partition as a whole.
+      if (detail::BlockMax(block, len) < cutoff_values[round]) {
+        lower_partition.insert(lower_partition.end(), block, block + len);
+        continue;
+      }
+      for (const float* ptr = block; ptr != block + len; ++ptr) {
+        if (*ptr >= cutoff_values[round]) {
+          upper_partition.push_back(*ptr);
+          upper_partition_sum += *ptr;
+        } else {
+          lower_partition.push_back(*ptr);
+        }
       }
     }
     // - If the upper partition sum is at least top p, exit the loop.
@@ -235,21 +339,46 @@ void RenormalizeProbByTopP(NDArray prob, int unit_offset, double top_p, double e
       break;
     }
   }
-  // - Mask all values smaller than the boundary to 0.
-  float renormalize_sum = 0.0;
-  std::vector<int> upper_partition_indices;
-  upper_partition_indices.reserve(vocab_size);
+  // - Mask all values smaller than the boundary to 0, and renormalize.
+  // Both passes are branch-free so that they are vectorized.
+  float renormalize_sum = detail::BlockSumAbove(p_prob, vocab_size, boundary_value);
+  float scale = 1.0f / renormalize_sum;
   for (int i = 0; i < vocab_size; ++i) {
-    if (p_prob[i] >= boundary_value) {
-      upper_partition_indices.push_back(i);
-      renormalize_sum += p_prob[i];
-    } else {
-      p_prob[i] = 0.0;
-    }
+    p_prob[i] = p_prob[i] >= boundary_value ? p_prob[i] * scale : 0.0f;
   }
-  // - Renormalize.
-  for (int idx : upper_partition_indices) {
-    p_prob[idx] /= renormalize_sum;
+}
+
+/*!
+ * \brief Renormalize the probability distribution by the top k and min p values.
+ * \param prob The input batch of probability distributions.
+ * \param unit_offset The offset specifying which distribution to output
+ * \param top_k The number of most probable values to keep. Non-positive means no limit.
+ * \param min_p The minimal probability to keep, relative to the max probability.
+ */
+void RenormalizeProbByTopKMinP(NDArray prob, int unit_offset, int top_k, double min_p) {
+  // prob: (*, v)
+  ICHECK(prob.IsContiguous());
+  ICHECK(prob.DataType() == DataType::Float(32));
+  ICHECK_EQ(prob->device.device_type, DLDeviceType::kDLCPU);
+
+  int vocab_size = prob->shape[prob->ndim - 1];
+  float* __restrict p_prob =
+      static_cast<float*>(__builtin_assume_aligned(prob->data, 4)) + (unit_offset * vocab_size);
+
+  float boundary_value = static_cast<float>(min_p) * detail::BlockMax(p_prob, vocab_size);
+  if (top_k > 0 && top_k < vocab_size) {
+    // - Select the k-th largest value in linear time, instead of sorting the distribution.
+    thread_local std::vector<float> values;
+    values.assign(p_prob, p_prob + vocab_size);
+    std::nth_element(values.begin(), values.begin() + (top_k - 1), values.end(),
+                     std::greater<>());
+    boundary_value = std::max(boundary_value, values[top_k - 1]);
+  }
+  // - Mask all values smaller than the boundary to 0, and renormalize.
+  float renormalize_sum = detail::BlockSumAbove(p_prob, vocab_size, boundary_value);
+  float scale = 1.0f / renormalize_sum;
+  for (int i = 0; i < vocab_size; ++i) {
+    p_prob[i] = p_prob[i] >= boundary_value ? p_prob[i] * scale : 0.0f;
   }
 }
 
@@ -266,23 +395,29 @@ std::vector<TokenProbPair> ComputeTopProbsImpl(const float* p_prob, int ndata) {
 
   float sum_prob = 0.0;
   // Selection argsort.
-  for (int p = 0; p < ndata; ++p) {
-    int i = num_top_probs - 1;
-    for (; i >= 0; --i) {
-      if (p_prob[p] > top_probs[i].second) {
+  for (int begin = 0; begin < ndata; begin += kBlockSize) {
+    int len = std::min(kBlockSize, ndata - begin);
+    // Only scan the block when it has a value that enters the top probs.
+    if (BlockMax(p_prob + begin, len) > top_probs[num_top_probs - 1].second) {
+      for (int p = begin; p < begin + len; ++p) {
+        int i = num_top_probs - 1;
+        for (; i >= 0; --i) {
+          if (p_prob[p] > top_probs[i].second) {
+            if (i != num_top_probs - 1) {
+              top_probs[i + 1] = top_probs[i];
+            }
+          } else {
+            break;
+          }
+        }
         if (i != num_top_probs - 1) {
-          top_probs[i + 1] = top_probs[i];
+          top_probs[i + 1] = {p, p_prob[p]};
         }
-      } else {
-        break;
       }
     }
-    if (i != num_top_probs - 1) {
-      top_probs[i + 1] = {p, p_prob[p]};
-    }
 
     // Early exit.
-    sum_prob += p_prob[p];
+    sum_prob += BlockSum(p_prob + begin, len);
     if (1 - sum_prob <= top_probs[num_top_probs - 1].second) {
       break;
     }
@@ -317,6 +452,34 @@ inline std::vector<TokenProbPair> ComputeTopProbs(NDArray prob, int unit_offset,
   throw;
 }
 
+/*!
+ * \brief Get the given number of tokens with top probabilities in a prob distribution, in
+ * descending order of probability. Unlike `ComputeTopProbs`, the number of tokens is not
+ * limited to a few, and is chosen at runtime.
+ */
+inline std::vector<TokenProbPair> ComputeTopTokens(const float* __restrict p_prob, int ndata,
+                                                   int num_tokens) {
+  std::vector<TokenProbPair> top_tokens(num_tokens, {-1, -1.0f});
+  for (int begin = 0; begin < ndata; begin += detail::kBlockSize) {
+    int len = std::min(detail::kBlockSize, ndata - begin);
+    // Only scan the block when it has a value that enters the top tokens.
+    if (detail::BlockMax(p_prob + begin, len) <= top_tokens.back().second) {
+      continue;
+    }
+    for (int p = begin; p < begin + len; ++p) {
+      if (p_prob[p] <= top_tokens.back().second) {
+        continue;
+      }
+      int i = num_tokens - 1;
+      for (; i > 0 && p_prob[p] > top_tokens[i - 1].second; --i) {
+        top_tokens[i] = top_tokens[i - 1];
+      }
+      top_tokens[i] = {p, p_prob[p]};
+    }
+  }
+  return top_tokens;
+}
+
 /********************* CPU Sampler *********************/
 
 TVM_REGISTER_OBJECT_TYPE(SamplerObj);
@@ -337,6 +500,7 @@ class CPUSampler : public SamplerObj {
                                       const std::vector<int>& sample_indices,  //
                                       const Array<String>& request_ids,        //
                                       const Array<GenerationConfig>& generation_cfg) final {
+    StepPhaseScope phase_scope(StepPhase::kSample);
     // probs_on_device: (n, v)
     CHECK_EQ(probs_on_device->ndim, 2);
     // - Copy probs to CPU
@@ -351,13 +515,21 @@ class CPUSampler : public SamplerObj {
 
     std::vector<int> top_p_indices;
     std::vector<double> top_p_values;
+    std::vector<int> top_k_values;
+    std::vector<double> min_p_values;
     for (int i = 0; i < num_samples; ++i) {
       if (top_p_indices.empty() || top_p_indices.back() != sample_indices[i]) {
         top_p_indices.push_back(sample_indices[i]);
         top_p_values.push_back(generation_cfg[i]->top_p);
+        top_k_values.push_back(generation_cfg[i]->top_k);
+        min_p_values.push_back(generation_cfg[i]->min_p);
       } else {
         CHECK(fabs(top_p_values.back() - generation_cfg[i]->top_p) < eps_)
             << "Sampler requires the top_p values for each prob distribution are the same.";
+        CHECK(top_k_values.back() == generation_cfg[i]->top_k &&
+              fabs(min_p_values.back() - generation_cfg[i]->min_p) < eps_)
+            << "Sampler requires the top_k and min_p values for each prob distribution are the "
+               "same.";
       }
     }
     if (top_p_indices.empty()) {
@@ -365,13 +537,19 @@ class CPUSampler : public SamplerObj {
       return probs_on_host;
     }
 
-    tvm::runtime::parallel_for_with_threading_backend(
-        [this, &probs_on_host, &request_ids, &top_p_indices, &top_p_values](int i) {
+    ParallelForDynamic(
+        static_cast<int64_t>(top_p_indices.size()),
+        [this, &probs_on_host, &request_ids, &top_p_indices, &top_p_values, &top_k_values,
+         &min_p_values](int64_t i) {
+          // Top k and min p go first, so that top p works on the renormalized distribution.
+          if (top_k_values[i] > 0 || min_p_values[i] > 0) {
+            RenormalizeProbByTopKMinP(probs_on_host, top_p_indices[i], top_k_values[i],
+                                      min_p_values[i]);
+          }
           RECORD_EVENT(this->trace_recorder_, request_ids[i], "start renormalize by top p");
           RenormalizeProbByTopP(probs_on_host, top_p_indices[i], top_p_values[i], eps_);
           RECORD_EVENT(this->trace_recorder_, request_ids[i], "finish renormalize by top p");
-        },
-        0, static_cast<int64_t>(top_p_indices.size()));
+        });
 
     return probs_on_host;
   }
@@ -382,6 +560,7 @@ class CPUSampler : public SamplerObj {
       const Array<String>& request_ids,               //
       const Array<GenerationConfig>& generation_cfg,  //
       const std::vector<RandomGenerator*>& rngs) final {
+    StepPhaseScope phase_scope(StepPhase::kSample);
     // probs_on_device: (n, v)
     CHECK_EQ(probs_on_device->ndim, 2);
     // - Copy probs to CPU
@@ -399,6 +578,7 @@ class CPUSampler : public SamplerObj {
       const Array<String>& request_ids,               //
       const Array<GenerationConfig>& generation_cfg,  //
       const std::vector<RandomGenerator*>& rngs) final {
+    StepPhaseScope phase_scope(StepPhase::kSample);
     return BatchSampleTokensImpl(probs_on_host, sample_indices, request_ids, generation_cfg, rngs,
                                  /*top_p_applied=*/true);
   }
@@ -408,7 +588,8 @@ class CPUSampler : public SamplerObj {
       const std::vector<int>& cum_verify_lengths, const Array<GenerationConfig>& generation_cfg,
       const std::vector<RandomGenerator*>& rngs,
       const std::vector<std::vector<SampleResult>>& draft_output_tokens,
-      NDArray draft_probs_on_device) final {
+      const std::vector<int>& token_tree_parent_ptr, NDArray draft_probs_on_device) final {
+    StepPhaseScope phase_scope(StepPhase::kSample);
     // probs_on_host: (n, v)
     RECORD_EVENT(trace_recorder_, request_ids, "start draft verification");
     CHECK_EQ(probs_on_host->ndim, 2);
@@ -416,83 +597,124 @@ class CPUSampler : public SamplerObj {
     int num_sequence = static_cast<int>(cum_verify_lengths.size()) - 1;
     CHECK_EQ(rngs.size(), num_sequence);
     CHECK_EQ(draft_output_tokens.size(), num_sequence);
-
-    NDArray draft_probs_on_host = draft_probs_on_device.CopyTo(DLDevice{kDLCPU, 0});
+    CHECK(token_tree_parent_ptr.empty() ||
+          static_cast<int>(token_tree_parent_ptr.size()) == cum_verify_lengths.back());
+
+    // The drafts without prob distributions are deterministic, whose distributions put all the
+    // mass on the draft tokens.
+    NDArray draft_probs_on_host = draft_probs_on_device.defined()
+                                      ? draft_probs_on_device.CopyTo(DLDevice{kDLCPU, 0})
+                                      : NDArray{nullptr};
     std::vector<std::vector<SampleResult>> sample_results;
     sample_results.resize(num_sequence);
 
     float* __restrict global_p_probs =
         static_cast<float*>(__builtin_assume_aligned(probs_on_host->data, 4));
+    const float* __restrict global_q_probs =
+        draft_probs_on_host.defined()
+            ? static_cast<float*>(__builtin_assume_aligned(draft_probs_on_host->data, 4))
+            : nullptr;
     int vocab_size = probs_on_host->shape[1];
 
-    tvm::runtime::parallel_for_with_threading_backend(
-        [&](int i) {
-          int verify_start = cum_verify_lengths[i];
-          int verify_end = cum_verify_lengths[i + 1];
-
-          int cur_token_idx = 0;
-          // Sub 1 to ignore the last prediction.
-          for (; cur_token_idx < verify_end - verify_start - 1; ++cur_token_idx) {
-            float* p_probs = global_p_probs + (verify_start + cur_token_idx) * vocab_size;
-            int cur_token = draft_output_tokens[i][cur_token_idx].sampled_token_id.first;
-            float q_value = draft_output_tokens[i][cur_token_idx].sampled_token_id.second;
-            float p_value = p_probs[cur_token];
-
-            if (p_value >= q_value) {
-              sample_results[i].push_back(
-                  SampleResult{{cur_token, p_value},
-                               ComputeTopProbs(probs_on_host, verify_start + cur_token_idx,
-                                               generation_cfg[i]->top_logprobs)});
-              continue;
-            }
-            float r = rngs[i]->GetRandomNumber();
-            if (r < p_value / (q_value + eps_)) {
-              sample_results[i].push_back(
-                  SampleResult{{cur_token, p_value},
-                               ComputeTopProbs(probs_on_host, verify_start + cur_token_idx,
-                                               generation_cfg[i]->top_logprobs)});
-              continue;
-            }
-
-            // normalize a new probability distribution
-            double sum_v = 0.0;
-            const float* __restrict p_qdist =
-                static_cast<float*>(__builtin_assume_aligned(draft_probs_on_host->data, 4)) +
-                (verify_start + cur_token_idx + 1) * vocab_size;
-
-            for (int j = 0; j < vocab_size; ++j) {
-              p_probs[j] = std::max(p_probs[j] - p_qdist[j], 0.0f);
-              sum_v += p_probs[j];
+    // - Walk down the token tree of each sequence and decide the accepted path. The children
+    // of a node are verified in order. Once a child is rejected, the distribution of the node
+    // is replaced in place by the residual of the two distributions, against which the next
+    // child is verified. The final token is sampled from the distribution of the last
+    // accepted node. Each sequence draws random numbers from its own generator in the same
+    // order as sequential verification, so sequences are verified in parallel.
+    // A chain is a token tree where each node has at most one child.
+    std::vector<std::vector<int>> accepted_nodes(num_sequence);
+    std::vector<double> final_uniform_samples(num_sequence);
+    ParallelForDynamic(num_sequence, [&](int64_t i) {
+      int verify_start = cum_verify_lengths[i];
+      int num_nodes = cum_verify_lengths[i + 1] - verify_start;
+      std::vector<std::vector<int>> children(num_nodes);
+      for (int node = 1; node < num_nodes; ++node) {
+        int parent =
+            token_tree_parent_ptr.empty() ? node - 1 : token_tree_parent_ptr[verify_start + node];
+        ICHECK(parent >= 0 && parent < node);
+        children[parent].push_back(node);
+      }
+      sample_results[i].clear();
+      int cur_node = 0;
+      while (true) {
+        float* p_probs = global_p_probs + (verify_start + cur_node) * vocab_size;
+        int accepted_child = -1;
+        for (int child : children[cur_node]) {
+          const SampleResult& draft_token = draft_output_tokens[i][child - 1];
+          int cur_token = draft_token.sampled_token_id.first;
+          float q_value = draft_token.sampled_token_id.second;
+          float p_value = p_probs[cur_token];
+          if (p_value >= q_value || rngs[i]->GetRandomNumber() < p_value / (q_value + eps_)) {
+            accepted_child = child;
+            break;
+          }
+          if (global_q_probs == nullptr) {
+            // The residual of a deterministic draft is the distribution without the token.
+            double sum_v = 1.0 - p_value;
+            if (sum_v < 1e-7) {
+              accepted_child = child;
+              break;
             }
-            for (int j = 0; j < vocab_size; ++j) {
-              p_probs[j] /= sum_v;
+            p_probs[cur_token] = 0.0f;
+            for (int v = 0; v < vocab_size; ++v) {
+              p_probs[v] /= sum_v;
             }
-
-            // sample a new token from the new distribution
-            SampleResult sample_result;
-            sample_result.sampled_token_id = SampleTopPFromProb(
-                probs_on_host, verify_start + cur_token_idx, verify_start + cur_token_idx,
-                /*top_p=*/1.0f, rngs[i]->GetRandomNumber());
-            sample_result.top_prob_tokens = ComputeTopProbs(
-                probs_on_host, verify_start + cur_token_idx, generation_cfg[i]->top_logprobs);
-            sample_results[i].push_back(sample_result);
+            continue;
+          }
+          const float* p_qdist = global_q_probs + (verify_start + child) * vocab_size;
+          double sum_v = 0.0;
+          for (int v = 0; v < vocab_size; ++v) {
+            sum_v += std::max(p_probs[v] - p_qdist[v], 0.0f);
+          }
+          if (sum_v < 1e-7) {
+            // The two distributions are the same up to rounding error.
+            accepted_child = child;
             break;
           }
-          // if cur_token_idx == verify_end - verify_start - 1
-          // all draft tokens are accepted
-          // we sample a new token
-          if (cur_token_idx == verify_end - verify_start - 1) {
-            SampleResult sample_result;
-            // sample a new token from the original distribution
-            sample_result.sampled_token_id = SampleTopPFromProb(
-                probs_on_host, verify_start + cur_token_idx, verify_start + cur_token_idx,
-                /*top_p=*/1.0f, rngs[i]->GetRandomNumber());
-            sample_result.top_prob_tokens = ComputeTopProbs(
-                probs_on_host, verify_start + cur_token_idx, generation_cfg[i]->top_logprobs);
-            sample_results[i].push_back(sample_result);
+          for (int v = 0; v < vocab_size; ++v) {
+            p_probs[v] = std::max(p_probs[v] - p_qdist[v], 0.0f) / sum_v;
           }
-        },
-        0, num_sequence);
+        }
+        if (accepted_child == -1) {
+          break;
+        }
+        // Report the probability of the accepted token under the target distribution.
+        // The distribution is modified only when a sibling was rejected, in which case
+        // the token's probability is taken from the residual it was accepted against.
+        int accepted_token = draft_output_tokens[i][accepted_child - 1].sampled_token_id.first;
+        SampleResult result;
+        result.sampled_token_id = {accepted_token, p_probs[accepted_token]};
+        sample_results[i].push_back(result);
+        accepted_nodes[i].push_back(cur_node);
+        cur_node = accepted_child;
+      }
+      accepted_nodes[i].push_back(cur_node);
+      final_uniform_samples[i] = rngs[i]->GetRandomNumber();
+      sample_results[i].emplace_back();
+    });
+
+    // - Flatten the (sequence, position) pairs into tasks. Each accepted token takes its
+    // top probs from the distribution of its parent, and the last accepted node of each
+    // sequence samples the final token.
+    std::vector<std::pair<int, int>> tasks;
+    for (int i = 0; i < num_sequence; ++i) {
+      for (int j = 0; j < static_cast<int>(accepted_nodes[i].size()); ++j) {
+        tasks.emplace_back(i, j);
+      }
+    }
+    ParallelForDynamic(static_cast<int64_t>(tasks.size()), [&](int64_t task_id) {
+      auto [i, j] = tasks[task_id];
+      int row = cum_verify_lengths[i] + accepted_nodes[i][j];
+      SampleResult& sample_result = sample_results[i][j];
+      if (j + 1 == static_cast<int>(accepted_nodes[i].size())) {
+        // Sample the final token from the residual or the original distribution.
+        sample_result.sampled_token_id = SampleTopPFromProb(
+            probs_on_host, row, row, /*top_p=*/1.0f, final_uniform_samples[i]);
+      }
+      sample_result.top_prob_tokens =
+          ComputeTopProbs(probs_on_host, row, generation_cfg[i]->top_logprobs);
+    });
     RECORD_EVENT(trace_recorder_, request_ids, "finish draft verification");
     return sample_results;
   }
@@ -517,9 +739,9 @@ class CPUSampler : public SamplerObj {
     std::vector<SampleResult> sample_results;
     sample_results.resize(n);
 
-    tvm::runtime::parallel_for_with_threading_backend(
-        [this, &sample_results, &probs_on_host, &generation_cfg, &rngs, &request_ids, top_p_applied,
-         sample_indices](int i) {
+    ParallelForDynamic(
+        n, [this, &sample_results, &probs_on_host, &generation_cfg, &rngs, &request_ids,
+            top_p_applied, &sample_indices](int64_t i) {
           RECORD_EVENT(this->trace_recorder_, request_ids[i], "start sample token");
           // Sample top p from probability.
           double top_p =
@@ -531,12 +753,39 @@ class CPUSampler : public SamplerObj {
           sample_results[i].top_prob_tokens =
               ComputeTopProbs(probs_on_host, i, generation_cfg[i]->top_logprobs);
           RECORD_EVENT(this->trace_recorder_, request_ids[i], "finish sample token");
-        },
-        0, n);
+        });
     RECORD_EVENT(trace_recorder_, request_ids, "finish sampling");
     return sample_results;
   }
 
+  NDArray GetLastSampledTokenIdsOnDevice() final { return NDArray(nullptr); }
+
+  int64_t GetDeviceMemoryBytes() const final { return 0; }
+
+  std::vector<std::vector<TokenProbPair>> BatchGetTopTokens(NDArray probs_on_device,
+                                                            const std::vector<int>& row_indices,
+                                                            const Array<String>& request_ids,
+                                                            int num_tokens) final {
+    StepPhaseScope phase_scope(StepPhase::kSample);
+    CHECK_EQ(probs_on_device->ndim, 2);
+    ICHECK_LE(num_tokens, kMaxNumTopTokens);
+    ICHECK_EQ(request_ids.size(), row_indices.size());
+    NDArray probs_on_host = probs_on_device->device.device_type == kDLCPU
+                                ? probs_on_device
+                                : CopyProbsToCPU(probs_on_device);
+    RECORD_EVENT(trace_recorder_, request_ids, "start getting top tokens");
+    int vocab_size = probs_on_host->shape[1];
+    num_tokens = std::min(num_tokens, vocab_size);
+    const float* p_probs = static_cast<float*>(__builtin_assume_aligned(probs_on_host->data, 4));
+    std::vector<std::vector<TokenProbPair>> top_tokens(row_indices.size());
+    ParallelForDynamic(static_cast<int64_t>(row_indices.size()), [&](int64_t i) {
+      top_tokens[i] =
+          ComputeTopTokens(p_probs + row_indices[i] * vocab_size, vocab_size, num_tokens);
+    });
+    RECORD_EVENT(trace_recorder_, request_ids, "finish getting top tokens");
+    return top_tokens;
+  }
+
   /*! \brief Copy prob distributions from device to CPU. */
   NDArray CopyProbsToCPU(NDArray probs_on_device) {
     // probs_on_device: (n, v)
@@ -9,6 +9,8 @@
 #include <tvm/runtime/packed_func.h>
 
 #include "../../support/random.h"
+#include "../device_timer.h"
+#include "../memory_accounting.h"
 #include "sampler.h"
 
 namespace mlc {
@@ -35,7 +37,7 @@ inline void SyncCopyStream(Device device, TVMStreamHandle compute_stream,
 class GPUSampler : public SamplerObj {
  public:
   explicit GPUSampler(int max_num_sample, int vocab_size, FunctionTable* ft, DLDevice device,
-                      Optional<EventTraceRecorder> trace_recorder)
+                      StagingArena staging_arena, Optional<EventTraceRecorder> trace_recorder)
       : max_num_sample_(max_num_sample),
         vocab_size_(vocab_size),
         device_(device),
@@ -43,8 +45,11 @@ class GPUSampler : public SamplerObj {
         gpu_argsort_probs_func_(ft->gpu_argsort_probs_func_),
         gpu_sample_with_top_p_func_(ft->gpu_sample_with_top_p_func_),
         gpu_sampler_take_probs_func_(ft->gpu_sampler_take_probs_func_),
+        gpu_sampler_take_top_probs_func_(ft->gpu_sampler_take_top_probs_func_),
         gpu_verify_draft_tokens_func_(ft->gpu_verify_draft_tokens_func_),
         gpu_renormalize_by_top_p_func_(ft->gpu_renormalize_by_top_p_func_),
+        gpu_renormalize_by_top_k_min_p_func_(ft->gpu_renormalize_by_top_k_min_p_func_),
+        staging_arena_(std::move(staging_arena)),
         trace_recorder_(std::move(trace_recorder)) {
     ICHECK(gpu_multinomial_from_uniform_func_.defined());
     ICHECK(gpu_argsort_probs_func_.defined());
@@ -55,49 +60,52 @@ class GPUSampler : public SamplerObj {
         Registry::Get("flashinfer.sampling.parallel_sampling_from_prob");
 
     DLDevice device_cpu{DLDeviceType::kDLCPU, /*device_id=*/0};
-    // We support at most 5 top prob results for each sequence.
+    // The arrays copied back from GPU are on page-locked memory when available.
+    DLDevice device_host = staging_arena_->GetHostDevice();
+    // We support at most 5 top prob results for each sequence in sampling, and at most
+    // `kMaxNumTopTokens` top tokens for each row in `BatchGetTopTokens`.
     // Initialize auxiliary arrays on CPU.
     uniform_samples_host_ = NDArray::Empty({max_num_sample}, dtype_f32_, device_cpu);
     sample_indices_host_ = NDArray::Empty({max_num_sample}, dtype_i32_, device_cpu);
     top_p_host_ = NDArray::Empty({max_num_sample}, dtype_f32_, device_cpu);
+    top_k_host_ = NDArray::Empty({max_num_sample}, dtype_i32_, device_cpu);
+    min_p_host_ = NDArray::Empty({max_num_sample}, dtype_f32_, device_cpu);
     top_p_init_pivots_host_ =
         NDArray::Empty({max_num_sample, num_top_p_cutoff_pivots_}, dtype_f32_, device_cpu);
-    top_prob_offsets_host_ = NDArray::Empty({max_num_sample * 5}, dtype_i32_, device_cpu);
+    top_prob_offsets_host_ =
+        NDArray::Empty({max_num_sample * kMaxNumTopTokens}, dtype_i32_, device_cpu);
     draft_tokens_host_ = NDArray::Empty({max_num_sample}, dtype_i32_, device_cpu);
     token_tree_first_child_host_ = NDArray::Empty({max_num_sample}, dtype_i32_, device_cpu);
     token_tree_next_sibling_host_ = NDArray::Empty({max_num_sample}, dtype_i32_, device_cpu);
-    token_tree_parent_ptr_host_ = NDArray::Empty({max_num_sample}, dtype_i32_, device_cpu);
-    sampled_token_ids_host_ = NDArray::Empty({max_num_sample}, dtype_i32_, device_cpu);
-    sampled_probs_host_ = NDArray::Empty({max_num_sample}, dtype_f32_, device_cpu);
-    top_prob_probs_host_ = NDArray::Empty({max_num_sample * 5}, dtype_f32_, device_cpu);
-    top_prob_indices_host_ = NDArray::Empty({max_num_sample * 5}, dtype_i32_, device_cpu);
+    token_tree_parent_ptr_host_ = NDArray::Empty({max_num_sample}, dtype_i32_, device_host);
+    sampled_token_ids_host_ = NDArray::Empty({max_num_sample}, dtype_i32_, device_host);
+    sampled_probs_host_ = NDArray::Empty({max_num_sample}, dtype_f32_, device_host);
+    top_prob_probs_host_ =
+        NDArray::Empty({max_num_sample * kMaxNumTopTokens}, dtype_f32_, device_host);
+    top_prob_indices_host_ =
+        NDArray::Empty({max_num_sample * kMaxNumTopTokens}, dtype_i32_, device_host);
     // Initialize auxiliary arrays on GPU.
     uniform_samples_device_ = NDArray::Empty({max_num_sample}, dtype_f32_, device);
     sample_indices_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
     top_p_device_ = NDArray::Empty({max_num_sample}, dtype_f32_, device);
+    top_k_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
+    min_p_device_ = NDArray::Empty({max_num_sample}, dtype_f32_, device);
     top_p_init_pivots_device_ =
         NDArray::Empty({max_num_sample, num_top_p_cutoff_pivots_}, dtype_f32_, device);
-    top_prob_offsets_device_ = NDArray::Empty({max_num_sample * 5}, dtype_i32_, device);
+    top_prob_offsets_device_ =
+        NDArray::Empty({max_num_sample * kMaxNumTopTokens}, dtype_i32_, device);
     draft_tokens_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
     token_tree_first_child_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
     token_tree_next_sibling_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
     token_tree_parent_ptr_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
     sampled_token_ids_device_ = NDArray::Empty({max_num_sample}, dtype_i32_, device);
 
-    // If the device is CUDA/ROCm, we create a standalone copy stream, in
-    // purpose to hide the latency of auxiliary stream copy.
-    if (device.device_type == DLDeviceType::kDLCUDA ||
-        device.device_type == DLDeviceType::kDLROCM) {
+    // If the device is CUDA/ROCm, the staging arena has a standalone copy stream,
+    // in purpose to hide the latency of auxiliary stream copy.
+    copy_stream_ = staging_arena_->copy_stream;
+    if (copy_stream_ != nullptr) {
       // The compute stream is the default stream.
       compute_stream_ = DeviceAPI::Get(device)->GetCurrentStream(device);
-      copy_stream_ = DeviceAPI::Get(device)->CreateStream(device);
-    }
-  }
-
-  ~GPUSampler() {
-    // Free the copy stream if defined.
-    if (copy_stream_ != nullptr) {
-      DeviceAPI::Get(device_)->FreeStream(device_, copy_stream_);
     }
   }
 
@@ -105,7 +113,8 @@ class GPUSampler : public SamplerObj {
                                       const std::vector<int>& sample_indices,  //
                                       const Array<String>& request_ids,        //
                                       const Array<GenerationConfig>& generation_cfg) final {
-    NVTXScopedRange nvtx_scope("BatchRenormalizeProbsByTopP");
+    TraceScopedRange trace_scope("BatchRenormalizeProbsByTopP");
+    StepPhaseScope phase_scope(StepPhase::kSample);
     // probs_on_device: (n, v)
     RECORD_EVENT(trace_recorder_, request_ids, "start renormalization by top p");
     CHECK_EQ(probs_on_device->ndim, 2);
@@ -116,6 +125,11 @@ class GPUSampler : public SamplerObj {
     ICHECK_EQ(request_ids.size(), num_samples);
     ICHECK_EQ(generation_cfg.size(), num_samples);
 
+    // - Apply top k and min p first, so that top p works on the renormalized distribution.
+    if (CheckTopKMinP(generation_cfg, sample_indices, num_probs, num_samples, vocab_size)) {
+      probs_on_device = RenormalizeByTopKMinP(probs_on_device, num_probs);
+    }
+
     // - Check if there is need for applying top p.
     bool need_top_p = CheckTopP(generation_cfg, sample_indices, num_probs, num_samples, vocab_size);
     if (!need_top_p) {
@@ -125,7 +139,7 @@ class GPUSampler : public SamplerObj {
     // - Copy auxiliary array for top-p and initial pivots.
     NDArray top_p_host = top_p_host_.CreateView({num_probs}, dtype_f32_);
     NDArray top_p_device = top_p_device_.CreateView({num_probs}, dtype_f32_);
-    CopyArray(/*src=*/top_p_host, /*dst=*/top_p_device, copy_stream_);
+    staging_arena_->CopyToDevice(/*src=*/top_p_host, /*dst=*/top_p_device);
 
     NDArray top_p_init_pivots_host =
         top_p_init_pivots_host_.CreateView({num_probs, num_top_p_cutoff_pivots_}, dtype_f32_);
@@ -145,7 +159,7 @@ class GPUSampler : public SamplerObj {
         p_top_p_init_pivots[i * num_top_p_cutoff_pivots_ + 2] = (1 - p_top_p[i]) / 4;
       }
     }
-    CopyArray(/*src=*/top_p_init_pivots_host, /*dst=*/top_p_init_pivots_device, copy_stream_);
+    staging_arena_->CopyToDevice(/*src=*/top_p_init_pivots_host, /*dst=*/top_p_init_pivots_device);
     SyncCopyStream(device_, compute_stream_, copy_stream_);
 
     // - Renormalize the prob with top p.
@@ -162,7 +176,8 @@ class GPUSampler : public SamplerObj {
       const Array<String>& request_ids,               //
       const Array<GenerationConfig>& generation_cfg,  //
       const std::vector<RandomGenerator*>& rngs) final {
-    NVTXScopedRange nvtx_scope("BatchSampleTokensWithProbBeforeTopP");
+    TraceScopedRange trace_scope("BatchSampleTokensWithProbBeforeTopP");
+    StepPhaseScope phase_scope(StepPhase::kSample);
     return BatchSampleTokensImpl(std::move(probs_on_device), sample_indices, request_ids,
                                  generation_cfg, rngs, /*top_p_applied=*/false);
   }
@@ -173,7 +188,8 @@ class GPUSampler : public SamplerObj {
       const Array<String>& request_ids,               //
       const Array<GenerationConfig>& generation_cfg,  //
       const std::vector<RandomGenerator*>& rngs) final {
-    NVTXScopedRange nvtx_scope("BatchSampleTokensWithProbAfterTopP");
+    TraceScopedRange trace_scope("BatchSampleTokensWithProbAfterTopP");
+    StepPhaseScope phase_scope(StepPhase::kSample);
     return BatchSampleTokensImpl(std::move(probs_on_device), sample_indices, request_ids,
                                  generation_cfg, rngs, /*top_p_applied=*/true);
   }
@@ -183,8 +199,20 @@ class GPUSampler : public SamplerObj {
       const std::vector<int>& cum_verify_lengths, const Array<GenerationConfig>& generation_cfg,
       const std::vector<RandomGenerator*>& rngs,
       const std::vector<std::vector<SampleResult>>& draft_output_tokens,
-      NDArray draft_probs_on_device) final {
-    NVTXScopedRange nvtx_scope("BatchVerifyDraftTokensWithProbAfterTopP");
+      const std::vector<int>& token_tree_parent_ptr, NDArray draft_probs_on_device) final {
+    TraceScopedRange trace_scope("BatchVerifyDraftTokensWithProbAfterTopP");
+    if (!draft_probs_on_device.defined()) {
+      // The verification kernel takes the draft distributions. Deterministic drafts have no
+      // distribution, and are verified on CPU against the copied prob distributions.
+      if (!cpu_sampler_.defined()) {
+        cpu_sampler_ = Sampler::CreateCPUSampler(trace_recorder_);
+      }
+      TVMSynchronize(device_.device_type, device_.device_id, compute_stream_);
+      return cpu_sampler_->BatchVerifyDraftTokensWithProbAfterTopP(
+          probs_on_device.CopyTo(DLDevice{kDLCPU, 0}), request_ids, cum_verify_lengths,
+          generation_cfg, rngs, draft_output_tokens, token_tree_parent_ptr, NDArray{nullptr});
+    }
+    StepPhaseScope phase_scope(StepPhase::kSample);
     std::vector<std::vector<SampleResult>> sample_results;
     // probs_on_device: (n, v)
     RECORD_EVENT(trace_recorder_, request_ids, "start draft verification");
@@ -197,6 +225,8 @@ class GPUSampler : public SamplerObj {
 
     int num_nodes = cum_verify_lengths.back();
     ICHECK(num_nodes <= max_num_sample_);
+    ICHECK(token_tree_parent_ptr.empty() ||
+           static_cast<int>(token_tree_parent_ptr.size()) == num_nodes);
     CHECK_EQ(draft_probs_on_device->shape[0], num_nodes);
     NDArray uniform_samples_device = GenerateUniformSamples(rngs, cum_verify_lengths);
     NDArray draft_tokens_host = draft_tokens_host_.CreateView({num_nodes}, dtype_i32_);
@@ -216,7 +246,7 @@ class GPUSampler : public SamplerObj {
         p_draft_tokens_host[start + j + 1] = draft_output_tokens_i[j].sampled_token_id.first;
       }
     }
-    CopyArray(draft_tokens_host, draft_tokens_device, copy_stream_);
+    staging_arena_->CopyToDevice(draft_tokens_host, draft_tokens_device);
 
     NDArray token_tree_first_child_host =
         token_tree_first_child_host_.CreateView({num_nodes}, dtype_i32_);
@@ -232,28 +262,38 @@ class GPUSampler : public SamplerObj {
         token_tree_parent_ptr_device_.CreateView({num_sequence}, dtype_i32_);
     std::vector<int> token_tree_child_to_parent(/*n=*/num_nodes);
 
-    // Build the tree structure on CPU
+    // Build the tree structure on CPU. The children of a node are linked in their order.
+    int* p_first_child = static_cast<int*>(token_tree_first_child_host->data);
+    int* p_next_sibling = static_cast<int*>(token_tree_next_sibling_host->data);
+    std::vector<int> last_child(num_nodes, -1);
     for (int i = 0; i < num_sequence; i++) {
-      // Assuming no tree structure for now
       int start = cum_verify_lengths[i];
       int end = cum_verify_lengths[i + 1];
-      ICHECK_GE(end - start, 2);
-      token_tree_child_to_parent[start] = -1;  // root has no parent
-      for (int j = 0; j < end - start; j++) {
-        int cur_node = j + start;
-        int child_node = j + 1 >= end - start ? -1 : cur_node + 1;
-        static_cast<int*>(token_tree_first_child_host->data)[cur_node] = child_node;
-        if (child_node != -1) {
-          token_tree_child_to_parent[child_node] = cur_node;
+      ICHECK_GE(end - start, 1);
+      for (int cur_node = start; cur_node < end; cur_node++) {
+        p_first_child[cur_node] = -1;
+        p_next_sibling[cur_node] = -1;
+        if (cur_node == start) {
+          token_tree_child_to_parent[cur_node] = -1;  // root has no parent
+          continue;
         }
-        static_cast<int*>(token_tree_next_sibling_host->data)[cur_node] = -1;
+        int parent_node =
+            token_tree_parent_ptr.empty() ? cur_node - 1 : start + token_tree_parent_ptr[cur_node];
+        ICHECK(parent_node >= start && parent_node < cur_node);
+        token_tree_child_to_parent[cur_node] = parent_node;
+        if (last_child[parent_node] == -1) {
+          p_first_child[parent_node] = cur_node;
+        } else {
+          p_next_sibling[last_child[parent_node]] = cur_node;
+        }
+        last_child[parent_node] = cur_node;
       }
       static_cast<int*>(token_tree_parent_ptr_host->data)[i] = start;  // point to the root
     }
     // Copy token tree structure to GPU
-    CopyArray(token_tree_first_child_host, token_tree_first_child_device, copy_stream_);
-    CopyArray(token_tree_next_sibling_host, token_tree_next_sibling_device, copy_stream_);
-    CopyArray(token_tree_parent_ptr_host, token_tree_parent_ptr_device, copy_stream_);
+    staging_arena_->CopyToDevice(token_tree_first_child_host, token_tree_first_child_device);
+    staging_arena_->CopyToDevice(token_tree_next_sibling_host, token_tree_next_sibling_device);
+    staging_arena_->CopyToDevice(token_tree_parent_ptr_host, token_tree_parent_ptr_device);
 
     SyncCopyStream(device_, compute_stream_, copy_stream_);
 
@@ -289,7 +329,8 @@ class GPUSampler : public SamplerObj {
         for (int i = 0; i < num_sequence; i++) {
           sample_indices.push_back(p_token_tree_parent_ptr[i]);
         }
-        CheckProbValues(generation_cfg, sample_indices, num_nodes, num_sequence, vocab_size_,
+        CheckProbValues(generation_cfg, sample_indices, num_nodes, num_sequence,
+                        GetTopProbRowStride(/*need_top_p=*/false, vocab_size_),
                         &top_prob_offset_indptr);
       }
       auto device_arrays =
@@ -324,7 +365,105 @@ class GPUSampler : public SamplerObj {
     return sample_results;
   }
 
+  NDArray GetLastSampledTokenIdsOnDevice() final { return last_sampled_token_ids_device_; }
+
+  int64_t GetDeviceMemoryBytes() const final {
+    int64_t bytes = 0;
+    for (const NDArray* array :
+         {&uniform_samples_device_, &sample_indices_device_, &top_p_device_, &top_k_device_,
+          &min_p_device_, &top_p_init_pivots_device_, &top_prob_offsets_device_,
+          &draft_tokens_device_, &token_tree_first_child_device_,
+          &token_tree_next_sibling_device_, &token_tree_parent_ptr_device_,
+          &sampled_token_ids_device_}) {
+      bytes += GetNDArrayBytes(*array);
+    }
+    return bytes;
+  }
+
+  std::vector<std::vector<TokenProbPair>> BatchGetTopTokens(NDArray probs_on_device,
+                                                            const std::vector<int>& row_indices,
+                                                            const Array<String>& request_ids,
+                                                            int num_tokens) final {
+    TraceScopedRange trace_scope("BatchGetTopTokens");
+    StepPhaseScope phase_scope(StepPhase::kSample);
+    CHECK_EQ(probs_on_device->ndim, 2);
+    ICHECK_LE(num_tokens, kMaxNumTopTokens);
+    ICHECK_EQ(request_ids.size(), row_indices.size());
+    int num_rows = row_indices.size();
+    num_tokens = std::min(num_tokens, static_cast<int>(probs_on_device->shape[1]));
+    if (num_rows == 0) {
+      return {};
+    }
+    RECORD_EVENT(trace_recorder_, request_ids, "start getting top tokens");
+    // - Sort the prob distributions on device, from which the leading tokens are taken.
+    Array<NDArray> argsort_results = gpu_argsort_probs_func_(probs_on_device);
+    ICHECK_EQ(argsort_results.size(), 2);
+    NDArray sorted_indices_on_device = argsort_results[1];
+    std::vector<std::vector<TokenProbPair>> top_tokens;
+    top_tokens.reserve(num_rows);
+    for (int chunk_start = 0; chunk_start < num_rows; chunk_start += max_num_sample_) {
+      int chunk_end = std::min(chunk_start + max_num_sample_, num_rows);
+      std::vector<int> row_indices_chunk(row_indices.begin() + chunk_start,
+                                         row_indices.begin() + chunk_end);
+      ChunkGetTopTokens(probs_on_device, sorted_indices_on_device, row_indices_chunk, num_tokens,
+                        &top_tokens);
+    }
+    RECORD_EVENT(trace_recorder_, request_ids, "finish getting top tokens");
+    return top_tokens;
+  }
+
  private:
+  /*!
+   * \brief Take the leading tokens of the given rows of the sorted prob distributions to host,
+   * and append them to the output.
+   */
+  void ChunkGetTopTokens(NDArray probs_on_device, NDArray sorted_indices_on_device,
+                         const std::vector<int>& row_indices, int num_tokens,
+                         std::vector<std::vector<TokenProbPair>>* top_tokens) {
+    int num_rows = row_indices.size();
+    int vocab_size = probs_on_device->shape[1];
+    int num_top_tokens = num_rows * num_tokens;
+    // - Copy the row indices and the offsets of the leading tokens in the sorted arrays.
+    NDArray row_indices_device = CopySampleIndicesToGPU(row_indices);
+    int* p_top_token_offsets = static_cast<int*>(top_prob_offsets_host_->data);
+    for (int i = 0; i < num_rows; ++i) {
+      for (int j = 0; j < num_tokens; ++j) {
+        p_top_token_offsets[i * num_tokens + j] = row_indices[i] * vocab_size + j;
+      }
+    }
+    NDArray top_token_offsets_host =
+        top_prob_offsets_host_.CreateView({num_top_tokens}, dtype_i32_);
+    NDArray top_token_offsets_device =
+        top_prob_offsets_device_.CreateView({num_top_tokens}, dtype_i32_);
+    staging_arena_->CopyToDevice(/*src=*/top_token_offsets_host, /*dst=*/top_token_offsets_device);
+    SyncCopyStream(device_, compute_stream_, copy_stream_);
+
+    // - Take the probs and the indices at the offsets. The function also takes the probs of
+    // the sampled tokens, which are not needed here, so that the row indices stand in for the
+    // sampled tokens. They are valid token ids as there are fewer rows than tokens.
+    ICHECK_LE(probs_on_device->shape[0], vocab_size);
+    Array<NDArray> prob_value_results =
+        gpu_sampler_take_probs_func_(probs_on_device, sorted_indices_on_device, row_indices_device,
+                                     row_indices_device, top_token_offsets_device);
+    NDArray top_token_probs_host = top_prob_probs_host_.CreateView({num_top_tokens}, dtype_f32_);
+    NDArray top_token_indices_host =
+        top_prob_indices_host_.CreateView({num_top_tokens}, dtype_i32_);
+    CopyArray(/*src=*/prob_value_results[1], /*dst=*/top_token_probs_host, compute_stream_);
+    CopyArray(/*src=*/prob_value_results[2], /*dst=*/top_token_indices_host, compute_stream_);
+    TVMSynchronize(device_.device_type, device_.device_id, compute_stream_);
+
+    const float* p_top_token_probs = static_cast<const float*>(top_token_probs_host->data);
+    const int* p_top_token_indices = static_cast<const int*>(top_token_indices_host->data);
+    for (int i = 0; i < num_rows; ++i) {
+      std::vector<TokenProbPair> row_top_tokens;
+      row_top_tokens.reserve(num_tokens);
+      for (int j = i * num_tokens; j < (i + 1) * num_tokens; ++j) {
+        row_top_tokens.emplace_back(p_top_token_indices[j], p_top_token_probs[j]);
+      }
+      top_tokens->push_back(std::move(row_top_tokens));
+    }
+  }
+
   std::vector<SampleResult> BatchSampleTokensImpl(NDArray probs_on_device,                        //
                                                   const std::vector<int>& sample_indices,         //
                                                   const Array<String>& request_ids,               //
@@ -339,6 +478,7 @@ class GPUSampler : public SamplerObj {
     int num_samples = sample_indices.size();
     int num_probs = probs_on_device->shape[0];
     int vocab_size = probs_on_device->shape[1];
+    last_sampled_token_ids_device_ = NDArray(nullptr);
     if (num_samples == 0) {
       // This synchronization is necessary for making sure that this round
       // of model forward is finished.
@@ -354,7 +494,7 @@ class GPUSampler : public SamplerObj {
     std::vector<SampleResult> sample_results;
     if (num_samples <= max_num_sample_) {
       sample_results = ChunkSampleTokensImpl(probs_on_device, sample_indices, generation_cfg, rngs,
-                                             top_p_applied);
+                                             top_p_applied, &last_sampled_token_ids_device_);
     } else {
       for (int chunk_start = 0; chunk_start < num_samples; chunk_start += max_num_sample_) {
         int chunk_end = std::min(chunk_start + max_num_sample_, num_samples);
@@ -364,8 +504,9 @@ class GPUSampler : public SamplerObj {
                                                      generation_cfg.begin() + chunk_end);
         std::vector<RandomGenerator*> rngs_chunk(rngs.begin() + chunk_start,
                                                  rngs.begin() + chunk_end);
-        std::vector<SampleResult> sample_results_chunk = ChunkSampleTokensImpl(
-            probs_on_device, sample_indices_chunk, generation_cfg_chunk, rngs_chunk, top_p_applied);
+        std::vector<SampleResult> sample_results_chunk =
+            ChunkSampleTokensImpl(probs_on_device, sample_indices_chunk, generation_cfg_chunk,
+                                  rngs_chunk, top_p_applied, /*sampled_token_ids_device=*/nullptr);
         sample_results.insert(sample_results.end(), sample_results_chunk.begin(),
                               sample_results_chunk.end());
       }
@@ -409,7 +550,8 @@ class GPUSampler : public SamplerObj {
                                                   const std::vector<int>& sample_indices,         //
                                                   const Array<GenerationConfig>& generation_cfg,  //
                                                   const std::vector<RandomGenerator*>& rngs,      //
-                                                  bool top_p_applied) {
+                                                  bool top_p_applied,
+                                                  NDArray* sampled_token_ids_device) {
     // probs_on_device: (n, v)
     int num_samples = sample_indices.size();
     int num_probs = probs_on_device->shape[0];
@@ -428,13 +570,17 @@ class GPUSampler : public SamplerObj {
     }
     // The indptr array of the number of top probs for each sample.
     std::vector<int> top_prob_offset_indptr;
-    bool need_prob_values = CheckProbValues(generation_cfg, sample_indices, num_probs, num_samples,
-                                            vocab_size, &top_prob_offset_indptr);
+    bool need_prob_values =
+        CheckProbValues(generation_cfg, sample_indices, num_probs, num_samples,
+                        GetTopProbRowStride(need_top_p, vocab_size), &top_prob_offset_indptr);
 
     // - Sample tokens on GPU, and take out the probability values if needed.
     std::vector<NDArray> device_arrays =
         SampleOnGPU(probs_on_device, uniform_samples_device, sample_indices_device, need_top_p,
                     need_prob_values, num_probs, top_prob_offset_indptr);
+    if (sampled_token_ids_device != nullptr) {
+      *sampled_token_ids_device = device_arrays[0].CreateView({num_samples}, dtype_i32_);
+    }
 
     // - Copy the GPU sampling function results to CPU.
     std::vector<NDArray> host_arrays = CopyArraysToCPU(device_arrays, num_samples, need_prob_values,
@@ -452,7 +598,7 @@ class GPUSampler : public SamplerObj {
     }
     NDArray uniform_samples_host = uniform_samples_host_.CreateView({num_samples}, dtype_f32_);
     NDArray uniform_samples_device = uniform_samples_device_.CreateView({num_samples}, dtype_f32_);
-    CopyArray(/*src=*/uniform_samples_host, /*dst=*/uniform_samples_device, copy_stream_);
+    staging_arena_->CopyToDevice(/*src=*/uniform_samples_host, /*dst=*/uniform_samples_device);
     return uniform_samples_device;
   }
 
@@ -470,7 +616,7 @@ class GPUSampler : public SamplerObj {
     NDArray uniform_samples_host = uniform_samples_host_.CreateView({total_samples}, dtype_f32_);
     NDArray uniform_samples_device =
         uniform_samples_device_.CreateView({total_samples}, dtype_f32_);
-    CopyArray(/*src=*/uniform_samples_host, /*dst=*/uniform_samples_device, copy_stream_);
+    staging_arena_->CopyToDevice(/*src=*/uniform_samples_host, /*dst=*/uniform_samples_device);
     return uniform_samples_device;
   }
 
@@ -482,11 +628,69 @@ class GPUSampler : public SamplerObj {
     int num_samples = static_cast<int>(sample_indices.size());
     NDArray sample_indices_host = sample_indices_host_.CreateView({num_samples}, dtype_i32_);
     NDArray sample_indices_device = sample_indices_device_.CreateView({num_samples}, dtype_i32_);
-    CopyArray(/*src=*/sample_indices_host, /*dst=*/sample_indices_device, copy_stream_);
+    staging_arena_->CopyToDevice(/*src=*/sample_indices_host, /*dst=*/sample_indices_device);
     return sample_indices_device;
   }
 
   /*! \brief Check if top p is needed. Update host top p array in place. */
+  /*!
+   * \brief Collect the top k and min p values of each prob distribution to the host arrays.
+   * \return Whether any distribution needs to be cut off by top k or min p.
+   */
+  bool CheckTopKMinP(const Array<GenerationConfig>& generation_cfg,
+                     const std::vector<int>& sample_indices, int num_probs, int num_samples,
+                     int vocab_size) {
+    // Initialize top k values with 0 and min p values with -1, which mean there is no cut-off.
+    int* p_top_k = static_cast<int*>(top_k_host_->data);
+    float* p_min_p = static_cast<float*>(min_p_host_->data);
+    for (int i = 0; i < num_probs; ++i) {
+      p_top_k[i] = 0;
+      p_min_p[i] = -1.0;
+    }
+    bool need_top_k_min_p = false;
+    for (int i = 0; i < num_samples; ++i) {
+      int top_k = generation_cfg[i]->top_k < vocab_size ? generation_cfg[i]->top_k : 0;
+      if (p_min_p[sample_indices[i]] == -1.0) {
+        p_top_k[sample_indices[i]] = top_k;
+        p_min_p[sample_indices[i]] = generation_cfg[i]->min_p;
+        need_top_k_min_p |= top_k > 0 || generation_cfg[i]->min_p > 0;
+      } else {
+        CHECK(p_top_k[sample_indices[i]] == top_k &&
+              fabs(p_min_p[sample_indices[i]] - generation_cfg[i]->min_p) < eps_)
+            << "GPU sampler requires the top_k and min_p values for each prob distribution are "
+               "the same.";
+      }
+    }
+    for (int i = 0; i < num_probs; ++i) {
+      p_min_p[i] = std::max(p_min_p[i], 0.0f);
+    }
+    if (need_top_k_min_p && !gpu_renormalize_by_top_k_min_p_func_.defined()) {
+      if (!warned_top_k_min_p_unsupported_) {
+        LOG(WARNING) << "The model library does not have the \"renormalize_by_top_k_min_p\" "
+                        "function. Please recompile the model to enable top_k and min_p. "
+                        "The top_k and min_p values are ignored.";
+        warned_top_k_min_p_unsupported_ = true;
+      }
+      return false;
+    }
+    return need_top_k_min_p;
+  }
+
+  /*!
+   * \brief Renormalize the probs with the top k and min p values in the host arrays. The
+   * cut-off pivot is found on device by selection, without sorting the probs.
+   */
+  NDArray RenormalizeByTopKMinP(NDArray probs_on_device, int num_probs) {
+    NDArray top_k_host = top_k_host_.CreateView({num_probs}, dtype_i32_);
+    NDArray top_k_device = top_k_device_.CreateView({num_probs}, dtype_i32_);
+    NDArray min_p_host = min_p_host_.CreateView({num_probs}, dtype_f32_);
+    NDArray min_p_device = min_p_device_.CreateView({num_probs}, dtype_f32_);
+    staging_arena_->CopyToDevice(/*src=*/top_k_host, /*dst=*/top_k_device);
+    staging_arena_->CopyToDevice(/*src=*/min_p_host, /*dst=*/min_p_device);
+    SyncCopyStream(device_, compute_stream_, copy_stream_);
+    return gpu_renormalize_by_top_k_min_p_func_(probs_on_device, top_k_device, min_p_device);
+  }
+
   bool CheckTopP(const Array<GenerationConfig>& generation_cfg,
                  const std::vector<int>& sample_indices, int num_probs, int num_samples,
                  int vocab_size) {
@@ -511,10 +715,29 @@ class GPUSampler : public SamplerObj {
     return need_top_p;
   }
 
-  /*! \brief Check whether prob values are needed, and collect info when necessary. */
+  /*!
+   * \brief Check whether the top probs are selected without sorting the probs, which takes
+   * place unless top p sampling sorts the probs anyway.
+   */
+  bool UseTopProbsKernel(bool need_top_p) const {
+    return !need_top_p && gpu_sampler_take_top_probs_func_.defined();
+  }
+
+  /*!
+   * \brief Get the row stride of the top prob offsets, i.e. the number of top probs that are
+   * available for each row of probs.
+   */
+  int GetTopProbRowStride(bool need_top_p, int vocab_size) const {
+    return UseTopProbsKernel(need_top_p) ? kMaxNumTopProbs : vocab_size;
+  }
+
+  /*!
+   * \brief Check whether prob values are needed, and collect info when necessary.
+   * The offset of the j-th top prob of row i is `i * row_stride + j`.
+   */
   bool CheckProbValues(const Array<GenerationConfig>& generation_cfg,
                        const std::vector<int>& sample_indices, int num_probs, int num_samples,
-                       int vocab_size, std::vector<int>* top_prob_offset_indptr) {
+                       int row_stride, std::vector<int>* top_prob_offset_indptr) {
     top_prob_offset_indptr->reserve(num_samples + 1);
     top_prob_offset_indptr->push_back(0);
     int* p_top_prob_offsets = static_cast<int*>(top_prob_offsets_host_->data);
@@ -523,7 +746,7 @@ class GPUSampler : public SamplerObj {
     for (int i = 0; i < num_samples; ++i) {
       need_prob_values |= generation_cfg[i]->logprobs;
       for (int j = 0; j < generation_cfg[i]->top_logprobs; ++j) {
-        p_top_prob_offsets[num_top_probs++] = sample_indices[i] * vocab_size + j;
+        p_top_prob_offsets[num_top_probs++] = sample_indices[i] * row_stride + j;
       }
       top_prob_offset_indptr->push_back(top_prob_offset_indptr->back() +
                                         generation_cfg[i]->top_logprobs);
@@ -558,11 +781,16 @@ class GPUSampler : public SamplerObj {
               top_prob_indices_device};
     }
 
-    // - Argsort the probability.
-    Array<NDArray> argsort_results = gpu_argsort_probs_func_(probs_on_device);
-    ICHECK_EQ(argsort_results.size(), 2);
-    NDArray sorted_probs_on_device = argsort_results[0];
-    NDArray sorted_indices_on_device = argsort_results[1];
+    // - Argsort the probability, unless the top probs are selected without sorting.
+    bool use_top_probs_kernel = UseTopProbsKernel(need_top_p);
+    NDArray sorted_probs_on_device{nullptr};
+    NDArray sorted_indices_on_device{nullptr};
+    if (!use_top_probs_kernel) {
+      Array<NDArray> argsort_results = gpu_argsort_probs_func_(probs_on_device);
+      ICHECK_EQ(argsort_results.size(), 2);
+      sorted_probs_on_device = argsort_results[0];
+      sorted_indices_on_device = argsort_results[1];
+    }
 
     // - Copy auxiliary array for top-p and prob values in ahead.
     NDArray top_p_device;
@@ -570,14 +798,14 @@ class GPUSampler : public SamplerObj {
     if (need_top_p) {
       NDArray top_p_host = top_p_host_.CreateView({num_probs}, dtype_f32_);
       top_p_device = top_p_device_.CreateView({num_probs}, dtype_f32_);
-      CopyArray(/*src=*/top_p_host, /*dst=*/top_p_device, copy_stream_);
+      staging_arena_->CopyToDevice(/*src=*/top_p_host, /*dst=*/top_p_device);
     }
     if (need_prob_values) {
       int num_top_probs = top_prob_offset_indptr.back();
       NDArray top_prob_offsets_host =
           top_prob_offsets_host_.CreateView({num_top_probs}, dtype_i32_);
       top_prob_offsets_device = top_prob_offsets_device_.CreateView({num_top_probs}, dtype_i32_);
-      CopyArray(/*src=*/top_prob_offsets_host, /*dst=*/top_prob_offsets_device, copy_stream_);
+      staging_arena_->CopyToDevice(/*src=*/top_prob_offsets_host, /*dst=*/top_prob_offsets_device);
     }
     SyncCopyStream(device_, compute_stream_, copy_stream_);
 
@@ -600,10 +828,16 @@ class GPUSampler : public SamplerObj {
     }
 
     if (need_prob_values) {
-      // - Take the probability values.
-      Array<NDArray> prob_value_results = gpu_sampler_take_probs_func_(
-          probs_on_device, sorted_indices_on_device, sample_indices_device,
-          sampled_token_ids_device, top_prob_offsets_device);
+      // - Take the probability values. Only the sampled probs and the top probs are written,
+      // and the full probs never leave the device.
+      Array<NDArray> prob_value_results =
+          use_top_probs_kernel
+              ? gpu_sampler_take_top_probs_func_(probs_on_device, sample_indices_device,
+                                                 sampled_token_ids_device,
+                                                 top_prob_offsets_device)
+              : gpu_sampler_take_probs_func_(probs_on_device, sorted_indices_on_device,
+                                             sample_indices_device, sampled_token_ids_device,
+                                             top_prob_offsets_device);
       sampled_probs_device = prob_value_results[0];
       top_prob_probs_device = prob_value_results[1];
       top_prob_indices_device = prob_value_results[2];
@@ -666,13 +900,19 @@ class GPUSampler : public SamplerObj {
   PackedFunc gpu_argsort_probs_func_;
   PackedFunc gpu_sample_with_top_p_func_;
   PackedFunc gpu_sampler_take_probs_func_;
+  PackedFunc gpu_sampler_take_top_probs_func_;
   PackedFunc gpu_verify_draft_tokens_func_;
   PackedFunc gpu_renormalize_by_top_p_func_;
+  PackedFunc gpu_renormalize_by_top_k_min_p_func_;
   const PackedFunc* flashinfer_multinomial_sample_func_;
+  // The staging arena for uploading auxiliary arrays.
+  StagingArena staging_arena_;
   // Auxiliary NDArrays on CPU
   NDArray uniform_samples_host_;
   NDArray sample_indices_host_;
   NDArray top_p_host_;
+  NDArray top_k_host_;
+  NDArray min_p_host_;
   NDArray top_p_init_pivots_host_;
   NDArray top_prob_offsets_host_;
   NDArray draft_tokens_host_;
@@ -687,6 +927,8 @@ class GPUSampler : public SamplerObj {
   NDArray uniform_samples_device_;
   NDArray sample_indices_device_;
   NDArray top_p_device_;
+  NDArray top_k_device_;
+  NDArray min_p_device_;
   NDArray top_p_init_pivots_device_;
   NDArray top_prob_offsets_device_;
   NDArray draft_tokens_device_;
@@ -694,20 +936,29 @@ class GPUSampler : public SamplerObj {
   NDArray token_tree_next_sibling_device_;
   NDArray token_tree_parent_ptr_device_;
   NDArray sampled_token_ids_device_;
+  // The token ids sampled on device by the last sampling call.
+  NDArray last_sampled_token_ids_device_{nullptr};
   // The event trace recorder for requests. */
   Optional<EventTraceRecorder> trace_recorder_;
+  // The CPU sampler verifying the drafts without prob distributions, created lazily.
+  Sampler cpu_sampler_{nullptr};
   // The device stream for the default computation operations.
   TVMStreamHandle compute_stream_ = nullptr;
-  // The device stream for copying auxiliary data structure to GPU.
+  // The device stream for copying auxiliary data structure to GPU, owned by the staging arena.
   TVMStreamHandle copy_stream_ = nullptr;
   const float eps_ = 1e-5;
   const int num_top_p_cutoff_pivots_ = 3;
+  // The number of top probs the top probs kernel selects for each row of probs.
+  static constexpr int kMaxNumTopProbs = 5;
+  // Whether the warning of missing top k and min p support has been logged.
+  bool warned_top_k_min_p_unsupported_ = false;
 };
 
 Sampler Sampler::CreateGPUSampler(int max_num_sample, int vocab_size, FunctionTable* ft,
-                                  DLDevice device, Optional<EventTraceRecorder> trace_recorder) {
-  return Sampler(
-      make_object<GPUSampler>(max_num_sample, vocab_size, ft, device, std::move(trace_recorder)));
+                                  DLDevice device, StagingArena staging_arena,
+                                  Optional<EventTraceRecorder> trace_recorder) {
+  return Sampler(make_object<GPUSampler>(max_num_sample, vocab_size, ft, device,
+                                         std::move(staging_arena), std::move(trace_recorder)));
 }
 
 }  // namespace serve
@@ -106,16 +106,52 @@ class SamplerObj : public Object {
    * \param rngs The random number generator of each sequence.
    * \param draft_output_tokens The draft tokens generated by the small model for
    * each sequence.
+   * \param token_tree_parent_ptr The parent of each verified token in the token tree of
+   * its sequence, as the position inside the sequence, or -1 for the last committed token.
+   * Concatenated vector of length total_verify_length. The siblings in a token tree should
+   * have distinct token ids. Empty means the draft tokens of each sequence form a chain.
    * \param draft_probs_on_device The probability distribution computed from the
    * small model for each sequence. Concatenated tensor of shape (total_verify_length, vocab_size).
    * It includes the slot for the last committed token that has undefined probablity value.
-   * \return The list of accepted tokens for each request.
+   * Undefined when the draft tokens are deterministic, e.g., looked up from the n-grams of the
+   * sequence, whose distributions put all the mass on the draft tokens.
+   * \return The list of accepted tokens for each request, which is the accepted path of the
+   * token tree followed by a token sampled after the path.
    */
   virtual std::vector<std::vector<SampleResult>> BatchVerifyDraftTokensWithProbAfterTopP(
       NDArray probs, const Array<String>& request_ids, const std::vector<int>& cum_verify_lengths,
       const Array<GenerationConfig>& generation_cfg, const std::vector<RandomGenerator*>& rngs,
       const std::vector<std::vector<SampleResult>>& draft_output_tokens,
-      NDArray draft_probs_on_device) = 0;
+      const std::vector<int>& token_tree_parent_ptr, NDArray draft_probs_on_device) = 0;
+
+  /*!
+   * \brief Get the tokens with the largest probabilities in the given rows of the input batch
+   * of prob distributions, which beam search expands beams with.
+   * \param probs_on_device The prob distributions on device.
+   * \param row_indices The rows of the prob distributions to take the tokens from.
+   * \param request_ids The id of the request of each row to take the tokens from.
+   * \param num_tokens The number of tokens to take from each row, which is at most
+   * `kMaxNumTopTokens`.
+   * \return The tokens of each row and their probabilities, in descending order of probability.
+   */
+  virtual std::vector<std::vector<TokenProbPair>> BatchGetTopTokens(
+      NDArray probs_on_device, const std::vector<int>& row_indices,
+      const Array<String>& request_ids, int num_tokens) = 0;
+
+  /*!
+   * \brief Return the token ids on device that the last call of
+   * `BatchSampleTokensWithProbBeforeTopP` or `BatchSampleTokensWithProbAfterTopP` sampled, in
+   * the order of the samples, which each call creates anew.
+   * \return The sampled token ids, or undefined if the sampler does not sample on device or
+   * the last call sampled in chunks.
+   */
+  virtual NDArray GetLastSampledTokenIdsOnDevice() = 0;
+
+  /*! \brief Get the bytes of the device arrays that the sampler holds. */
+  virtual int64_t GetDeviceMemoryBytes() const = 0;
+
+  /*! \brief The maximum number of tokens `BatchGetTopTokens` takes from each row. */
+  static constexpr int kMaxNumTopTokens = 32;
 
   static constexpr const char* _type_key = "mlc.serve.Sampler";
   static constexpr const bool _type_has_method_sequal_reduce = false;
@@ -133,10 +169,11 @@ class Sampler : public ObjectRef {
    * \param vocab_size The model's vocabulary size.
    * \param ft The packed function table.
    * \param device The device that the model runs on.
+   * \param staging_arena The staging arena for uploading auxiliary arrays to device.
    * \param trace_recorder The event trace recorder.
    */
   TVM_DLL static Sampler CreateGPUSampler(int max_num_sample, int vocab_size, FunctionTable* ft,
-                                          DLDevice device,
+                                          DLDevice device, StagingArena staging_arena,
                                           Optional<EventTraceRecorder> trace_recorder);
 
   /*! \brief Check if the given device supports GPU sampling. */
@@ -0,0 +1,309 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/scheduler_policy.cc
+ */
+#include "scheduler_policy.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <tuple>
+#include <unordered_set>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+TVM_REGISTER_OBJECT_TYPE(SchedulerPolicyObj);
+
+namespace {
+
+/*!
+ * \brief Move the waiting requests that have started chunked prefill to the front of the
+ * queue in their order, so that they finish the prefill before new requests are admitted.
+ * \return The position of the first new request.
+ */
+std::vector<Request>::iterator PartitionStartedPrefill(
+    std::vector<Request>* waiting_queue,
+    const std::unordered_map<String, RequestState>& request_states) {
+  return std::stable_partition(
+      waiting_queue->begin(), waiting_queue->end(), [&request_states](const Request& request) {
+        auto it = request_states.find(request->id);
+        ICHECK(it != request_states.end());
+        return it->second->entries[0]->status != RequestStateStatus::kPending;
+      });
+}
+
+}  // namespace
+
+/*! \brief The first-come-first-serve policy, which keeps the queue order untouched. */
+class FCFSSchedulerPolicyObj : public SchedulerPolicyObj {
+ public:
+  void SortWaitingQueue(std::vector<Request>* waiting_queue,
+                        const std::unordered_map<String, RequestState>& request_states) final {}
+
+  void SortRunningQueue(std::vector<Request>* running_queue,
+                        const std::unordered_map<String, RequestState>& request_states) final {}
+
+  static constexpr const char* _type_key = "mlc.serve.FCFSSchedulerPolicy";
+  TVM_DECLARE_FINAL_OBJECT_INFO(FCFSSchedulerPolicyObj, SchedulerPolicyObj);
+};
+
+TVM_REGISTER_OBJECT_TYPE(FCFSSchedulerPolicyObj);
+
+/*!
+ * \brief The SLO-aware policy, which orders requests by priority and
+ * then by the slack towards their TTFT/TPOT deadlines.
+ */
+class SLOAwareSchedulerPolicyObj : public SchedulerPolicyObj {
+ public:
+  void SortWaitingQueue(std::vector<Request>* waiting_queue,
+                        const std::unordered_map<String, RequestState>& request_states) final {
+    // The requests that have started chunked prefill stay at the front. The most urgent new
+    // request goes next.
+    auto it_new = PartitionStartedPrefill(waiting_queue, request_states);
+    SortByUrgency(it_new, waiting_queue->end(), request_states);
+  }
+
+  void SortRunningQueue(std::vector<Request>* running_queue,
+                        const std::unordered_map<String, RequestState>& request_states) final {
+    // The most urgent request goes to the front, so the least urgent one
+    // is at the back and gets preempted first.
+    SortByUrgency(running_queue->begin(), running_queue->end(), request_states);
+  }
+
+  static constexpr const char* _type_key = "mlc.serve.SLOAwareSchedulerPolicy";
+  TVM_DECLARE_FINAL_OBJECT_INFO(SLOAwareSchedulerPolicyObj, SchedulerPolicyObj);
+
+ private:
+  using TimePoint = std::chrono::high_resolution_clock::time_point;
+
+  /*! \brief The sort key of a request. */
+  struct UrgencyKey {
+    int priority;
+    double slack;
+  };
+
+  /*!
+   * \brief Compute the deadline slack (in seconds) of the given request.
+   * For the request entries that have not got the first token, the slack is
+   * against the TTFT deadline. Otherwise, the slack is against the deadline
+   * of the next token derived from the TPOT deadline. The slack of a request
+   * is the minimum among its unfinished leaf entries. A request without any
+   * deadline has infinite slack.
+   */
+  static double GetRequestSlack(const RequestState& rstate, TimePoint tnow) {
+    const GenerationConfig& generation_cfg = rstate->entries[0]->request->generation_cfg;
+    double slack = std::numeric_limits<double>::infinity();
+    for (const RequestStateEntry& rsentry : rstate->entries) {
+      if (rsentry->status == RequestStateStatus::kFinished || !rsentry->child_indices.empty()) {
+        continue;
+      }
+      int64_t num_committed_tokens = rsentry->mstates[0]->committed_tokens.size();
+      if (num_committed_tokens == 0) {
+        if (generation_cfg->ttft_slo_ms > 0) {
+          double elapsed = static_cast<double>((tnow - rstate->entries[0]->tadd).count()) / 1e9;
+          slack = std::min(slack, generation_cfg->ttft_slo_ms / 1e3 - elapsed);
+        }
+      } else if (generation_cfg->tpot_slo_ms > 0) {
+        double elapsed = static_cast<double>((tnow - rsentry->tprefill_finish).count()) / 1e9;
+        slack = std::min(slack, generation_cfg->tpot_slo_ms / 1e3 * num_committed_tokens - elapsed);
+      }
+    }
+    return slack;
+  }
+
+  /*! \brief Stably sort the queue range so that more urgent requests come first. */
+  static void SortByUrgency(std::vector<Request>::iterator begin,
+                            std::vector<Request>::iterator end,
+                            const std::unordered_map<String, RequestState>& request_states) {
+    if (end - begin <= 1) {
+      return;
+    }
+    TimePoint tnow = std::chrono::high_resolution_clock::now();
+    std::unordered_map<const RequestNode*, UrgencyKey> keys;
+    keys.reserve(end - begin);
+    for (auto it_request = begin; it_request != end; ++it_request) {
+      const Request& request = *it_request;
+      auto it = request_states.find(request->id);
+      ICHECK(it != request_states.end());
+      keys.emplace(request.get(), UrgencyKey{request->generation_cfg->priority,
+                                             GetRequestSlack(it->second, tnow)});
+    }
+    std::stable_sort(begin, end, [&keys](const Request& a, const Request& b) {
+      const UrgencyKey& key_a = keys.at(a.get());
+      const UrgencyKey& key_b = keys.at(b.get());
+      if (key_a.priority != key_b.priority) {
+        return key_a.priority > key_b.priority;
+      }
+      return key_a.slack < key_b.slack;
+    });
+  }
+};
+
+TVM_REGISTER_OBJECT_TYPE(SLOAwareSchedulerPolicyObj);
+
+/*!
+ * \brief The fair-share policy, which orders the requests of different tenants by the
+ * weighted number of tokens served to each tenant.
+ */
+class FairShareSchedulerPolicyObj : public SchedulerPolicyObj {
+ public:
+  explicit FairShareSchedulerPolicyObj(std::unordered_map<std::string, double> tenant_weights)
+      : tenant_weights_(std::move(tenant_weights)) {}
+
+  void SortWaitingQueue(std::vector<Request>* waiting_queue,
+                        const std::unordered_map<String, RequestState>& request_states) final {
+    UpdateActiveTenants(request_states);
+    // The requests that have started chunked prefill stay at the front.
+    auto it_new = PartitionStartedPrefill(waiting_queue, request_states);
+    if (waiting_queue->end() - it_new <= 1) {
+      return;
+    }
+    // Split the new requests by tenant, keeping the order within each tenant.
+    std::unordered_map<std::string, std::vector<Request>> tenant_queues;
+    std::vector<std::string> tenants;
+    for (auto it_request = it_new; it_request != waiting_queue->end(); ++it_request) {
+      const Request& request = *it_request;
+      std::string tenant_id = request->generation_cfg->tenant_id;
+      std::vector<Request>& tenant_queue = tenant_queues[tenant_id];
+      if (tenant_queue.empty()) {
+        tenants.push_back(tenant_id);
+      }
+      tenant_queue.push_back(request);
+    }
+    if (tenants.size() == 1) {
+      return;
+    }
+    // Merge the tenant queues by the projected weighted service of each tenant, which grows
+    // by the inputs of the requests placed ahead. Ties go to the tenant that arrives first.
+    using Entry = std::tuple<double, int, size_t>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+    for (int i = 0; i < static_cast<int>(tenants.size()); ++i) {
+      heap.emplace(GetWeightedService(tenants[i]), i, 0);
+    }
+    waiting_queue->erase(it_new, waiting_queue->end());
+    while (!heap.empty()) {
+      auto [service, tenant_index, position] = heap.top();
+      heap.pop();
+      const std::string& tenant_id = tenants[tenant_index];
+      const std::vector<Request>& tenant_queue = tenant_queues.at(tenant_id);
+      const Request& request = tenant_queue[position];
+      waiting_queue->push_back(request);
+      if (position + 1 < tenant_queue.size()) {
+        double num_input_tokens = std::max(request->input_total_length, 1);
+        heap.emplace(service + num_input_tokens / GetWeight(tenant_id), tenant_index,
+                     position + 1);
+      }
+    }
+  }
+
+  void SortRunningQueue(std::vector<Request>* running_queue,
+                        const std::unordered_map<String, RequestState>& request_states) final {
+    // The requests of the least served tenant go to the front, so the requests of
+    // the most served tenant are at the back and get preempted first.
+    std::stable_sort(running_queue->begin(), running_queue->end(),
+                     [this](const Request& a, const Request& b) {
+                       return GetWeightedService(a->generation_cfg->tenant_id) <
+                              GetWeightedService(b->generation_cfg->tenant_id);
+                     });
+  }
+
+  void RecordService(const Request& request, int64_t num_tokens) final {
+    const std::string& tenant_id = request->generation_cfg->tenant_id;
+    weighted_service_[tenant_id] += num_tokens / GetWeight(tenant_id);
+  }
+
+  static constexpr const char* _type_key = "mlc.serve.FairShareSchedulerPolicy";
+  TVM_DECLARE_FINAL_OBJECT_INFO(FairShareSchedulerPolicyObj, SchedulerPolicyObj);
+
+ private:
+  double GetWeight(const std::string& tenant_id) const {
+    auto it = tenant_weights_.find(tenant_id);
+    return it == tenant_weights_.end() ? 1.0 : it->second;
+  }
+
+  double GetWeightedService(const std::string& tenant_id) const {
+    auto it = weighted_service_.find(tenant_id);
+    return it == weighted_service_.end() ? 0.0 : it->second;
+  }
+
+  /*!
+   * \brief Update the tenants that have requests in engine. The tenants that become active
+   * are lifted to the least service among the tenants that stay active. When no tenant stays
+   * active, i.e., the engine has drained, all tenants start over.
+   */
+  void UpdateActiveTenants(const std::unordered_map<String, RequestState>& request_states) {
+    std::unordered_set<std::string> active_tenants;
+    for (const auto& [request_id, rstate] : request_states) {
+      active_tenants.insert(rstate->entries[0]->request->generation_cfg->tenant_id);
+    }
+    double virtual_time = std::numeric_limits<double>::infinity();
+    for (const std::string& tenant_id : active_tenants) {
+      if (active_tenants_.count(tenant_id)) {
+        virtual_time = std::min(virtual_time, GetWeightedService(tenant_id));
+      }
+    }
+    if (virtual_time == std::numeric_limits<double>::infinity()) {
+      weighted_service_.clear();
+    } else {
+      for (auto it = weighted_service_.begin(); it != weighted_service_.end();) {
+        // The idle tenants below the virtual time would be lifted on return anyway.
+        if (!active_tenants.count(it->first) && it->second <= virtual_time) {
+          it = weighted_service_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      for (const std::string& tenant_id : active_tenants) {
+        if (!active_tenants_.count(tenant_id)) {
+          double& service = weighted_service_[tenant_id];
+          service = std::max(service, virtual_time);
+        }
+      }
+    }
+    active_tenants_ = std::move(active_tenants);
+  }
+
+  /*! \brief The share weight of each tenant. */
+  std::unordered_map<std::string, double> tenant_weights_;
+  /*! \brief The tokens served to each tenant divided by the tenant weight. */
+  std::unordered_map<std::string, double> weighted_service_;
+  /*! \brief The tenants that had requests in engine at the last update. */
+  std::unordered_set<std::string> active_tenants_;
+};
+
+TVM_REGISTER_OBJECT_TYPE(FairShareSchedulerPolicyObj);
+
+SchedulerPolicy SchedulerPolicy::Create(const EngineConfig& engine_config) {
+  SchedulerMode mode = engine_config->scheduler_mode;
+  if (mode == SchedulerMode::kFCFS) {
+    return CreateFCFSPolicy();
+  } else if (mode == SchedulerMode::kSLOAware) {
+    return CreateSLOAwarePolicy();
+  } else if (mode == SchedulerMode::kFairShare) {
+    return CreateFairSharePolicy(engine_config->tenant_weights);
+  } else {
+    LOG(FATAL) << "Unsupported scheduler mode: " << static_cast<int>(mode);
+    throw;
+  }
+}
+
+SchedulerPolicy SchedulerPolicy::CreateFCFSPolicy() {
+  return SchedulerPolicy(make_object<FCFSSchedulerPolicyObj>());
+}
+
+SchedulerPolicy SchedulerPolicy::CreateSLOAwarePolicy() {
+  return SchedulerPolicy(make_object<SLOAwareSchedulerPolicyObj>());
+}
+
+SchedulerPolicy SchedulerPolicy::CreateFairSharePolicy(
+    std::unordered_map<std::string, double> tenant_weights) {
+  return SchedulerPolicy(make_object<FairShareSchedulerPolicyObj>(std::move(tenant_weights)));
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
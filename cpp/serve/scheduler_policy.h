@@ -0,0 +1,111 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/scheduler_policy.h
+ * \brief The request scheduler policy which decides the prefill order of waiting
+ * requests and the preemption order of running requests.
+ */
+#ifndef MLC_LLM_SERVE_SCHEDULER_POLICY_H_
+#define MLC_LLM_SERVE_SCHEDULER_POLICY_H_
+
+#include <tvm/runtime/container/string.h>
+#include <tvm/runtime/object.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "config.h"
+#include "request.h"
+#include "request_state.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief The scheduler policy of engine.
+ * The policy does not own any request. It only reorders the waiting queue
+ * and running queue of the engine state in place, so that
+ * - the engine actions walk the waiting queue from front to back when
+ * picking prefill candidates, and
+ * - the engine actions always preempt the last request of the running queue.
+ */
+class SchedulerPolicyObj : public Object {
+ public:
+  /*!
+   * \brief Reorder the waiting queue so that the request to prefill first is at the front.
+   * \param waiting_queue The waiting queue to reorder.
+   * \param request_states The states of all requests in engine.
+   */
+  virtual void SortWaitingQueue(
+      std::vector<Request>* waiting_queue,
+      const std::unordered_map<String, RequestState>& request_states) = 0;
+
+  /*!
+   * \brief Reorder the running queue so that the request to preempt first is at the back.
+   * \param running_queue The running queue to reorder.
+   * \param request_states The states of all requests in engine.
+   */
+  virtual void SortRunningQueue(
+      std::vector<Request>* running_queue,
+      const std::unordered_map<String, RequestState>& request_states) = 0;
+
+  /*!
+   * \brief Account the tokens that the engine has just prefilled or decoded for the request.
+   * \param request The request being served.
+   * \param num_tokens The number of prefilled or decoded tokens.
+   */
+  virtual void RecordService(const Request& request, int64_t num_tokens) {}
+
+  static constexpr const char* _type_key = "mlc.serve.SchedulerPolicy";
+  static constexpr const bool _type_has_method_sequal_reduce = false;
+  static constexpr const bool _type_has_method_shash_reduce = false;
+  TVM_DECLARE_BASE_OBJECT_INFO(SchedulerPolicyObj, Object);
+};
+
+class SchedulerPolicy : public ObjectRef {
+ public:
+  /*! \brief Create the scheduler policy of the scheduler mode in the engine config. */
+  static SchedulerPolicy Create(const EngineConfig& engine_config);
+
+  /*!
+   * \brief Create the first-come-first-serve policy, which keeps both queues untouched.
+   * Requests are prefilled in arrival order and the most recently started request
+   * is preempted first.
+   */
+  static SchedulerPolicy CreateFCFSPolicy();
+
+  /*!
+   * \brief Create the SLO-aware policy. Requests are ordered by priority first
+   * (higher priority is prefilled earlier and preempted later), and then
+   * by their deadline slack (less slack is prefilled earlier and preempted later).
+   * The order is stable, so requests with the same priority and no deadline
+   * keep the first-come-first-serve order. The waiting requests that have
+   * started chunked prefill stay ahead of the new requests.
+   */
+  static SchedulerPolicy CreateSLOAwarePolicy();
+
+  /*!
+   * \brief Create the fair-share policy, which serves tenants by weighted fair queueing over
+   * the prefill and decode tokens. The waiting queue interleaves the tenants so that the tenant
+   * with the least weighted service, counting the inputs of its requests placed ahead, is
+   * prefilled next. The requests of the most served tenants are preempted first. Requests of
+   * the same tenant keep the first-come-first-serve order. A tenant that becomes active again
+   * is lifted to the least service among the active tenants, so that it cannot claim the share
+   * it left unused while idle. The waiting requests that have started chunked prefill stay
+   * ahead of the new requests.
+   * \param tenant_weights The share weight of each tenant, which is 1 when not listed.
+   */
+  static SchedulerPolicy CreateFairSharePolicy(
+      std::unordered_map<std::string, double> tenant_weights);
+
+  TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(SchedulerPolicy, ObjectRef, SchedulerPolicyObj);
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_SCHEDULER_POLICY_H_
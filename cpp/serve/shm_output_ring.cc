@@ -0,0 +1,200 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/shm_output_ring.cc
+ */
+#include "shm_output_ring.h"
+
+#include <tvm/runtime/logging.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <thread>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*! \brief Get the finish reason code of the finish reason string. */
+inline ShmOutputFinishReason GetShmOutputFinishReason(const Optional<String>& finish_reason) {
+  if (!finish_reason.defined()) {
+    return ShmOutputFinishReason::kNone;
+  }
+  const std::string& reason = finish_reason.value();
+  if (reason == "stop") {
+    return ShmOutputFinishReason::kStop;
+  } else if (reason == "length") {
+    return ShmOutputFinishReason::kLength;
+  } else if (reason == "abort") {
+    return ShmOutputFinishReason::kAbort;
+  } else if (reason == "rejected") {
+    return ShmOutputFinishReason::kRejected;
+  }
+  return ShmOutputFinishReason::kOther;
+}
+
+std::unique_ptr<ShmOutputRing> ShmOutputRing::Create(const std::string& path, int64_t capacity) {
+#ifndef _WIN32
+  uint64_t num_records = 1;
+  while (num_records < static_cast<uint64_t>(std::max<int64_t>(capacity, 1))) {
+    num_records *= 2;
+  }
+  size_t size = sizeof(ShmOutputRingHeader) + num_records * sizeof(ShmOutputRecord);
+  // Replace the existing file, whose reader may still map the stale ring.
+  unlink(path.c_str());
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    LOG(WARNING) << "Cannot create the output ring file \"" << path << "\".";
+    return nullptr;
+  }
+  void* data = MAP_FAILED;
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == 0 && ftruncate(fd, size) == 0) {
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(WARNING) << "Cannot map the output ring file \"" << path << "\".";
+    unlink(path.c_str());
+    return nullptr;
+  }
+  std::unique_ptr<ShmOutputRing> ring(new ShmOutputRing());
+  ring->path_ = path;
+  ring->inode_ = file_stat.st_ino;
+  ring->data_ = data;
+  ring->size_ = size;
+  ring->header_ = new (data) ShmOutputRingHeader();
+  ring->header_->record_size = sizeof(ShmOutputRecord);
+  ring->header_->capacity = num_records;
+  ring->header_->write_index.store(0, std::memory_order_relaxed);
+  ring->header_->read_index.store(0, std::memory_order_relaxed);
+  ring->records_ = reinterpret_cast<ShmOutputRecord*>(static_cast<char*>(data) +
+                                                      sizeof(ShmOutputRingHeader));
+  // The magic number is stored last, so that readers never see a half-initialized header.
+  std::atomic_thread_fence(std::memory_order_release);
+  ring->header_->magic = kShmOutputRingMagic;
+  return ring;
+#else
+  LOG(WARNING) << "The shared-memory output ring is not supported on Windows.";
+  return nullptr;
+#endif
+}
+
+ShmOutputRing::~ShmOutputRing() {
+#ifndef _WIN32
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+    struct stat file_stat;
+    if (stat(path_.c_str(), &file_stat) == 0 && file_stat.st_ino == inode_) {
+      unlink(path_.c_str());
+    }
+  }
+#endif
+}
+
+bool ShmOutputRing::CanWrite(const RequestStreamOutput& output) {
+  return !output->group_delta_logprob_json_strs.defined() &&
+         !output->group_delta_logprob_token_ids.defined() &&
+         !output->prefill_only_output.defined();
+}
+
+ShmOutputRecord* ShmOutputRing::NextRecord(const std::function<bool()>& should_stop) {
+  uint64_t capacity = header_->capacity;
+  if (write_index_ - header_->read_index.load(std::memory_order_acquire) >= capacity) {
+    // Let the reader consume the written records before waiting for it.
+    Publish();
+    while (write_index_ - header_->read_index.load(std::memory_order_acquire) >= capacity) {
+      if (should_stop()) {
+        return nullptr;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+  }
+  ShmOutputRecord* record = &records_[write_index_ & (capacity - 1)];
+  ++write_index_;
+  std::memset(record, 0, sizeof(ShmOutputRecord));
+  return record;
+}
+
+bool ShmOutputRing::Write(const RequestStreamOutput& output,
+                          const std::function<bool()>& should_stop) {
+  ICHECK(CanWrite(output));
+  const std::string& request_id = output->request_id;
+  auto it = request_indices_.find(request_id);
+  if (it == request_indices_.end()) {
+    uint32_t request_index = request_indices_.size();
+    if (!free_request_indices_.empty()) {
+      request_index = free_request_indices_.back();
+      free_request_indices_.pop_back();
+    }
+    it = request_indices_.emplace(request_id, request_index).first;
+    // - Tell the reader the request id of the index.
+    int64_t num_id_bytes = request_id.size();
+    int64_t chunk_size = sizeof(ShmOutputRecord::id_bytes);
+    for (int64_t begin = 0; begin == 0 || begin < num_id_bytes; begin += chunk_size) {
+      ShmOutputRecord* record = NextRecord(should_stop);
+      if (record == nullptr) {
+        return false;
+      }
+      int64_t length = std::min(chunk_size, num_id_bytes - begin);
+      record->request_index = request_index;
+      record->kind = static_cast<uint16_t>(ShmOutputRecordKind::kRequestId);
+      record->flags = begin + length < num_id_bytes ? kShmOutputRecordMoreFollows : 0;
+      record->length = length;
+      std::memcpy(record->id_bytes, request_id.data() + begin, length);
+    }
+  }
+  uint32_t request_index = it->second;
+
+  // - Write the delta tokens of each generation, with the finish reason in the last record.
+  bool finished = true;
+  for (int i = 0; i < static_cast<int>(output->group_delta_token_ids.size()); ++i) {
+    const IntTuple& delta_token_ids = output->group_delta_token_ids[i];
+    ShmOutputFinishReason finish_reason =
+        GetShmOutputFinishReason(output->group_finish_reason[i]);
+    finished &= finish_reason != ShmOutputFinishReason::kNone;
+    int64_t num_tokens = delta_token_ids.size();
+    if (num_tokens == 0 && finish_reason == ShmOutputFinishReason::kNone) {
+      continue;
+    }
+    for (int64_t begin = 0; begin == 0 || begin < num_tokens;
+         begin += kShmOutputRecordCapacity) {
+      ShmOutputRecord* record = NextRecord(should_stop);
+      if (record == nullptr) {
+        return false;
+      }
+      int64_t length = std::min<int64_t>(kShmOutputRecordCapacity, num_tokens - begin);
+      record->request_index = request_index;
+      record->kind = static_cast<uint16_t>(ShmOutputRecordKind::kTokens);
+      record->group_index = i;
+      record->length = length;
+      if (begin + length == num_tokens) {
+        record->finish_reason = static_cast<uint16_t>(finish_reason);
+      }
+      for (int64_t j = 0; j < length; ++j) {
+        record->token_ids[j] = delta_token_ids[begin + j];
+      }
+    }
+  }
+  if (finished) {
+    free_request_indices_.push_back(request_index);
+    request_indices_.erase(it);
+  }
+  return true;
+}
+
+void ShmOutputRing::Publish() {
+  header_->write_index.store(write_index_, std::memory_order_release);
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
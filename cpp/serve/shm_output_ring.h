@@ -0,0 +1,154 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/shm_output_ring.h
+ * \brief The shared-memory ring of output records, through which the threaded engine passes
+ * the delta tokens and finish reasons of requests to a frontend process polling the ring,
+ * instead of invoking the stream callback under the GIL of the frontend.
+ */
+#ifndef MLC_LLM_SERVE_SHM_OUTPUT_RING_H_
+#define MLC_LLM_SERVE_SHM_OUTPUT_RING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "data.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*! \brief The magic number at the beginning of output ring files. */
+constexpr uint64_t kShmOutputRingMagic = 0x4D4C43534F524731;  // "MLCSORG1"
+
+/*! \brief The kind of output records. */
+enum class ShmOutputRecordKind : uint16_t {
+  /*!
+   * \brief A chunk of the request id, which precedes the first token record of a request.
+   * Ids longer than one record span consecutive records, all but the last flagged with
+   * `kShmOutputRecordMoreFollows`.
+   */
+  kRequestId = 0,
+  /*! \brief Delta tokens of a request, and its finish reason in the last record of a delta. */
+  kTokens = 1,
+};
+
+/*! \brief The finish reason codes of output records. */
+enum class ShmOutputFinishReason : uint16_t {
+  kNone = 0,
+  kStop = 1,
+  kLength = 2,
+  kAbort = 3,
+  kOther = 4,
+  kRejected = 5,
+};
+
+/*! \brief The flag of request id records followed by more chunks of the same id. */
+constexpr uint16_t kShmOutputRecordMoreFollows = 1;
+/*! \brief The number of token ids or id bytes that one record holds. */
+constexpr int kShmOutputRecordCapacity = 28;
+
+/*!
+ * \brief The fixed-size record of the ring. A request is identified by its index in records,
+ * which is assigned when its first output is written and freed when it finishes, so that the
+ * reader maps the index to the request id from the preceding request id records.
+ */
+struct ShmOutputRecord {
+  uint32_t request_index;
+  uint16_t kind;
+  uint16_t flags;
+  /*! \brief The index of the generation in the group of "n" generations. */
+  uint16_t group_index;
+  /*! \brief The number of token ids, or of id bytes, in the payload. */
+  uint16_t length;
+  uint16_t finish_reason;
+  uint16_t reserved;
+  union {
+    int32_t token_ids[kShmOutputRecordCapacity];
+    char id_bytes[kShmOutputRecordCapacity * sizeof(int32_t)];
+  };
+};
+static_assert(sizeof(ShmOutputRecord) == 128, "The output record should be 128 bytes.");
+
+/*!
+ * \brief The header of the ring file, followed by the records. The writer advances
+ * `write_index` after the records are written, and the reader advances `read_index` after the
+ * records are read. The indices count records monotonically, and wrap around the capacity.
+ */
+struct ShmOutputRingHeader {
+  uint64_t magic;
+  uint32_t record_size;
+  uint32_t reserved;
+  uint64_t capacity;
+  alignas(64) std::atomic<uint64_t> write_index;
+  alignas(64) std::atomic<uint64_t> read_index;
+  alignas(64) uint8_t padding[64];
+};
+static_assert(sizeof(ShmOutputRingHeader) == 256, "The output ring header should be 256 bytes.");
+
+/*!
+ * \brief The single-producer single-consumer ring of output records in a memory-mapped file.
+ * It is written by the stream-back loop of the threaded engine only.
+ */
+class ShmOutputRing {
+ public:
+  /*!
+   * \brief Create the ring file at the given path, e.g., under "/dev/shm", replacing the
+   * existing file. Return nullptr with a warning on failure.
+   * \param path The path of the ring file.
+   * \param capacity The number of records, which is rounded up to a power of two.
+   */
+  static std::unique_ptr<ShmOutputRing> Create(const std::string& path, int64_t capacity);
+
+  ~ShmOutputRing();
+
+  /*!
+   * \brief Whether the output can be written to the ring, which carries no logprobs and no
+   * prefill-only output. Those outputs are passed through the stream callback instead.
+   */
+  static bool CanWrite(const RequestStreamOutput& output);
+
+  /*!
+   * \brief Write the records of the output. When the ring is full, the written records are
+   * published and the writer waits for the reader.
+   * \param output The output to write.
+   * \param should_stop The function telling whether to give up waiting for the reader.
+   * \return Whether the output is written.
+   */
+  bool Write(const RequestStreamOutput& output, const std::function<bool()>& should_stop);
+
+  /*! \brief Publish the written records to the reader. */
+  void Publish();
+
+ private:
+  ShmOutputRing() = default;
+
+  /*! \brief Reserve a record slot, waiting for the reader when the ring is full. */
+  ShmOutputRecord* NextRecord(const std::function<bool()>& should_stop);
+
+  std::string path_;
+  /*!
+   * \brief The inode of the ring file, which tells whether the file at the path has been
+   * replaced by the ring of a reloaded engine and should not be removed.
+   */
+  uint64_t inode_ = 0;
+  void* data_ = nullptr;
+  size_t size_ = 0;
+  ShmOutputRingHeader* header_ = nullptr;
+  ShmOutputRecord* records_ = nullptr;
+  /*! \brief The index of the next record to write, which is ahead of the published index. */
+  uint64_t write_index_ = 0;
+  /*! \brief The index of each request in the ring, and the freed indices. */
+  std::unordered_map<std::string, uint32_t> request_indices_;
+  std::vector<uint32_t> free_request_indices_;
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_SHM_OUTPUT_RING_H_
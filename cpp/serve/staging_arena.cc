@@ -0,0 +1,71 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/staging_arena.cc
+ */
+#include "staging_arena.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*! \brief The alignment of ring regions in bytes. */
+constexpr int64_t kStagingAlignment = 256;
+
+TVM_REGISTER_OBJECT_TYPE(StagingArenaObj);
+
+StagingArena::StagingArena(Device device, int64_t capacity_bytes) {
+  ObjectPtr<StagingArenaObj> n = make_object<StagingArenaObj>();
+  n->device_ = device;
+  n->host_device_ = Device{kDLCPU, 0};
+  if (device.device_type == kDLCUDA || device.device_type == kDLROCM) {
+    n->host_device_ = Device{device.device_type == kDLCUDA ? kDLCUDAHost : kDLROCMHost, 0};
+    n->copy_stream = DeviceAPI::Get(device)->CreateStream(device);
+    n->ring_ = NDArray::Empty({capacity_bytes}, DataType::UInt(8), n->host_device_);
+  }
+  data_ = std::move(n);
+}
+
+StagingArenaObj::~StagingArenaObj() {
+  if (copy_stream != nullptr) {
+    DeviceAPI::Get(device_)->FreeStream(device_, copy_stream);
+  }
+}
+
+void StagingArenaObj::CopyToDevice(const NDArray& src, const NDArray& dst) {
+  DLTensor dl_dst = *(dst.operator->());
+  if (!ring_.defined()) {
+    NDArray::CopyFromTo(src.operator->(), &dl_dst, copy_stream);
+    return;
+  }
+  ICHECK(src.IsContiguous());
+  int64_t num_bytes = static_cast<int64_t>(GetDataSize(*src.operator->()));
+  if (offset_ + num_bytes > ring_->shape[0]) {
+    WrapAround(num_bytes);
+  }
+  // Stage the host data in the ring, and copy asynchronously from the ring.
+  DLTensor dl_staged = *(src.operator->());
+  dl_staged.data = ring_->data;
+  dl_staged.byte_offset = offset_;
+  dl_staged.device = host_device_;
+  std::memcpy(static_cast<char*>(ring_->data) + offset_,
+              static_cast<const char*>(src->data) + src->byte_offset, num_bytes);
+  NDArray::CopyFromTo(&dl_staged, &dl_dst, copy_stream);
+  offset_ += (num_bytes + kStagingAlignment - 1) / kStagingAlignment * kStagingAlignment;
+}
+
+void StagingArenaObj::WrapAround(int64_t min_capacity_bytes) {
+  // The regions in the ring are reused only after all the copies from them are done.
+  DeviceAPI::Get(device_)->StreamSync(device_, copy_stream);
+  offset_ = 0;
+  if (min_capacity_bytes > ring_->shape[0]) {
+    int64_t capacity_bytes = std::max(min_capacity_bytes, ring_->shape[0] * 2);
+    ring_ = NDArray::Empty({capacity_bytes}, DataType::UInt(8), host_device_);
+  }
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
@@ -0,0 +1,86 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/staging_arena.h
+ * \brief The page-locked staging arena for uploading auxiliary arrays to device.
+ */
+#ifndef MLC_LLM_SERVE_STAGING_ARENA_H_
+#define MLC_LLM_SERVE_STAGING_ARENA_H_
+
+#include <tvm/runtime/device_api.h>
+#include <tvm/runtime/ndarray.h>
+#include <tvm/runtime/object.h>
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*!
+ * \brief The staging arena shared by the logit processor and the GPU sampler of a model.
+ * Host auxiliary arrays are uploaded by first copying them into a persistent ring buffer in
+ * page-locked memory, and then issuing an asynchronous copy from the ring on the copy stream.
+ * The host arrays can thus be rewritten right after the upload is issued, while the device
+ * copy overlaps with other host work and device execution. A ring region is reused only
+ * after the pending copies are finished, which is waited for when the ring wraps around.
+ * On devices without page-locked host memory, uploads directly copy from the host arrays.
+ */
+class StagingArenaObj : public Object {
+ public:
+  ~StagingArenaObj();
+
+  /*!
+   * \brief Upload the host array to the device array on the copy stream.
+   * \param src The source array on host.
+   * \param dst The destination array on device, which has the same shape as the source.
+   */
+  void CopyToDevice(const NDArray& src, const NDArray& dst);
+
+  /*!
+   * \brief Get the page-locked host device, or kDLCPU if there is none. Arrays that are
+   * copied back from device can be allocated on it for asynchronous downloads.
+   */
+  Device GetHostDevice() const { return host_device_; }
+
+  /*! \brief The device stream for copying auxiliary arrays, or nullptr if there is none. */
+  TVMStreamHandle copy_stream = nullptr;
+
+  static constexpr const char* _type_key = "mlc.serve.StagingArena";
+  static constexpr const bool _type_has_method_sequal_reduce = false;
+  static constexpr const bool _type_has_method_shash_reduce = false;
+  TVM_DECLARE_FINAL_OBJECT_INFO(StagingArenaObj, Object);
+
+ private:
+  /*! \brief Wait for the pending copies and reset the ring, growing it to the given size. */
+  void WrapAround(int64_t min_capacity_bytes);
+
+  friend class StagingArena;
+
+  /*! \brief The device that the arrays are uploaded to. */
+  Device device_;
+  /*! \brief The page-locked host device of the ring, or kDLCPU if there is none. */
+  Device host_device_;
+  /*! \brief The ring buffer on page-locked host memory. */
+  NDArray ring_{nullptr};
+  /*! \brief The offset of the next free byte in the ring. */
+  int64_t offset_ = 0;
+};
+
+class StagingArena : public ObjectRef {
+ public:
+  /*!
+   * \brief Create the staging arena, as well as the copy stream on CUDA/ROCm.
+   * \param device The device that the arrays are uploaded to.
+   * \param capacity_bytes The initial capacity of the ring in bytes. The ring grows when
+   * a single upload is larger than the capacity.
+   */
+  explicit StagingArena(Device device, int64_t capacity_bytes = 4 * 1024 * 1024);
+
+  TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(StagingArena, ObjectRef, StagingArenaObj);
+};
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_STAGING_ARENA_H_
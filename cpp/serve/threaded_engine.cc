@@ -9,13 +9,25 @@
 #include <tvm/runtime/packed_func.h>
 #include <tvm/runtime/registry.h>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstring>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include "../support/cpu_affinity.h"
+#include "../support/mpsc_queue.h"
 #include "../support/result.h"
 #include "engine.h"
+#include "engine_state.h"
 #include "request.h"
+#include "shm_output_ring.h"
+#include "traffic_capture.h"
 
 namespace mlc {
 namespace llm {
@@ -32,8 +44,119 @@ enum class InstructionKind : int {
   kReloadEngine = 3,
   kResetEngine = 4,
   kDebugCallFuncOnAllAllWorker = 5,
+  kReconfigureEngine = 6,
+  kExportPrefixKV = 7,
+  kImportPrefixKV = 8,
 };
 
+/*! \brief The argument of the instruction exporting the KV data of a cached prefix. */
+class PrefixKVExportArgNode : public Object {
+ public:
+  /*! \brief The tokens whose prefix to export. */
+  IntTuple tokens;
+  /*! \brief The device to copy the KV data to. */
+  Device device;
+  /*! \brief The callback receiving the exported handoff on the engine thread. */
+  std::function<void(Optional<PrefixKVHandoff>)> callback;
+
+  static constexpr const char* _type_key = "mlc.serve.PrefixKVExportArg";
+  static constexpr const bool _type_has_method_sequal_reduce = false;
+  static constexpr const bool _type_has_method_shash_reduce = false;
+  TVM_DECLARE_FINAL_OBJECT_INFO(PrefixKVExportArgNode, Object);
+};
+
+TVM_REGISTER_OBJECT_TYPE(PrefixKVExportArgNode);
+
+/*! \brief Concatenate the 2-dim arrays on CPU along the first dimension. */
+NDArray ConcatLogProbArrays(const NDArray& earlier, const NDArray& later) {
+  ICHECK_EQ(earlier->ndim, 2);
+  ICHECK_EQ(later->ndim, 2);
+  ICHECK_EQ(earlier->shape[1], later->shape[1]);
+  NDArray result = NDArray::Empty({earlier->shape[0] + later->shape[0], earlier->shape[1]},
+                                  earlier->dtype, earlier->device);
+  size_t earlier_nbytes = GetDataSize(*earlier.operator->());
+  std::memcpy(result->data, earlier->data, earlier_nbytes);
+  std::memcpy(static_cast<char*>(result->data) + earlier_nbytes, later->data,
+              GetDataSize(*later.operator->()));
+  return result;
+}
+
+/*!
+ * \brief Concatenate the delta outputs of the same request, where the later one follows the
+ * earlier one.
+ */
+RequestStreamOutput ConcatRequestStreamOutputs(const RequestStreamOutput& earlier,
+                                               const RequestStreamOutput& later) {
+  int num_groups = earlier->group_delta_token_ids.size();
+  ICHECK_EQ(later->group_delta_token_ids.size(), num_groups);
+  Array<IntTuple> group_delta_token_ids;
+  Array<Optional<String>> group_finish_reason;
+  group_delta_token_ids.reserve(num_groups);
+  group_finish_reason.reserve(num_groups);
+  for (int i = 0; i < num_groups; ++i) {
+    std::vector<int64_t> token_ids(earlier->group_delta_token_ids[i].begin(),
+                                   earlier->group_delta_token_ids[i].end());
+    token_ids.insert(token_ids.end(), later->group_delta_token_ids[i].begin(),
+                     later->group_delta_token_ids[i].end());
+    group_delta_token_ids.push_back(IntTuple(std::move(token_ids)));
+    group_finish_reason.push_back(later->group_finish_reason[i].defined()
+                                      ? later->group_finish_reason[i]
+                                      : earlier->group_finish_reason[i]);
+  }
+  Optional<Array<Array<String>>> group_delta_logprob_json_strs;
+  if (earlier->group_delta_logprob_json_strs.defined() ||
+      later->group_delta_logprob_json_strs.defined()) {
+    Array<Array<String>> logprob_json_strs;
+    logprob_json_strs.reserve(num_groups);
+    for (int i = 0; i < num_groups; ++i) {
+      Array<String> json_strs;
+      for (const RequestStreamOutput& output : {earlier, later}) {
+        if (output->group_delta_logprob_json_strs.defined()) {
+          for (const String& json_str : output->group_delta_logprob_json_strs.value()[i]) {
+            json_strs.push_back(json_str);
+          }
+        }
+      }
+      logprob_json_strs.push_back(std::move(json_strs));
+    }
+    group_delta_logprob_json_strs = std::move(logprob_json_strs);
+  }
+  Optional<Array<NDArray>> group_delta_logprob_token_ids;
+  Optional<Array<NDArray>> group_delta_logprobs;
+  if (!earlier->group_delta_logprob_token_ids.defined()) {
+    group_delta_logprob_token_ids = later->group_delta_logprob_token_ids;
+    group_delta_logprobs = later->group_delta_logprobs;
+  } else if (!later->group_delta_logprob_token_ids.defined()) {
+    group_delta_logprob_token_ids = earlier->group_delta_logprob_token_ids;
+    group_delta_logprobs = earlier->group_delta_logprobs;
+  } else {
+    Array<NDArray> token_ids;
+    Array<NDArray> logprobs;
+    token_ids.reserve(num_groups);
+    logprobs.reserve(num_groups);
+    for (int i = 0; i < num_groups; ++i) {
+      token_ids.push_back(
+          ConcatLogProbArrays(earlier->group_delta_logprob_token_ids.value()[i],
+                              later->group_delta_logprob_token_ids.value()[i]));
+      logprobs.push_back(ConcatLogProbArrays(earlier->group_delta_logprobs.value()[i],
+                                             later->group_delta_logprobs.value()[i]));
+    }
+    group_delta_logprob_token_ids = std::move(token_ids);
+    group_delta_logprobs = std::move(logprobs);
+  }
+  return RequestStreamOutput(
+      earlier->request_id, std::move(group_delta_token_ids),
+      std::move(group_delta_logprob_json_strs), std::move(group_finish_reason),
+      later->metrics_json_str.defined() ? later->metrics_json_str : earlier->metrics_json_str,
+      std::move(group_delta_logprob_token_ids), std::move(group_delta_logprobs),
+      later->prefill_only_output.defined() ? later->prefill_only_output
+                                           : earlier->prefill_only_output);
+}
+
+/*! \brief The range of the spin iterations of the background loop before it sleeps. */
+constexpr int kMinNumSpinIterations = 64;
+constexpr int kMaxNumSpinIterations = 16384;
+
 /*! \brief The implementation of ThreadedEngine. */
 class ThreadedEngineImpl : public ThreadedEngine {
  public:
@@ -47,17 +170,7 @@ class ThreadedEngineImpl : public ThreadedEngine {
   }
 
   void Reload(String engine_config_json_str) final {
-    bool need_notify = false;
-    {
-      std::lock_guard<std::mutex> lock(background_loop_mutex_);
-      instruction_queue_.emplace_back(InstructionKind::kReloadEngine,
-                                      std::move(engine_config_json_str));
-      ++pending_request_operation_cnt_;
-      need_notify = engine_waiting_;
-    }
-    if (need_notify) {
-      background_loop_cv_.notify_one();
-    }
+    PushInstruction(InstructionKind::kReloadEngine, std::move(engine_config_json_str));
     {
       std::unique_lock<std::mutex> lock(reload_unload_mutex_);
       reload_finished_ = false;
@@ -66,16 +179,7 @@ class ThreadedEngineImpl : public ThreadedEngine {
   }
 
   void Unload() final {
-    bool need_notify = false;
-    {
-      std::lock_guard<std::mutex> lock(background_loop_mutex_);
-      instruction_queue_.emplace_back(InstructionKind::kUnloadEngine, ObjectRef(nullptr));
-      ++pending_request_operation_cnt_;
-      need_notify = engine_waiting_;
-    }
-    if (need_notify) {
-      background_loop_cv_.notify_one();
-    }
+    PushInstruction(InstructionKind::kUnloadEngine, ObjectRef(nullptr));
     {
       std::unique_lock<std::mutex> lock(reload_unload_mutex_);
       unload_finished_ = false;
@@ -83,68 +187,80 @@ class ThreadedEngineImpl : public ThreadedEngine {
     }
   }
 
+  String Reconfigure(String reconfig_json_str) final {
+    PushInstruction(InstructionKind::kReconfigureEngine, std::move(reconfig_json_str));
+    std::unique_lock<std::mutex> lock(reload_unload_mutex_);
+    reconfigure_finished_ = false;
+    reload_unload_cv_.wait(lock, [this] { return reconfigure_finished_; });
+    CHECK(reconfigure_error_.empty()) << reconfigure_error_;
+    return complete_engine_config_json_str_;
+  }
+
   void Reset() final {
-    bool need_notify = false;
-    {
-      std::lock_guard<std::mutex> lock(background_loop_mutex_);
-      instruction_queue_.emplace_back(InstructionKind::kResetEngine, ObjectRef(nullptr));
-      ++pending_request_operation_cnt_;
-      need_notify = engine_waiting_;
-    }
-    if (need_notify) {
-      background_loop_cv_.notify_one();
-    }
+    PushInstruction(InstructionKind::kResetEngine, ObjectRef(nullptr));
   }
 
   void AddRequest(Request request) final {
-    bool need_notify = false;
-    {
-      std::lock_guard<std::mutex> lock(background_loop_mutex_);
-      instruction_queue_.emplace_back(InstructionKind::kAddRequest, request);
-      ++pending_request_operation_cnt_;
-      need_notify = engine_waiting_;
+    // Estimate the cached prefix length of the tokenized request on the caller thread, so
+    // that the engine loop spends no time on it.
+    if (std::shared_ptr<const PrefixMatchIndex> match_index =
+            std::atomic_load(&prefix_match_index_)) {
+      request = match_index->AttachCachedPrefixEstimate(request);
     }
-    if (need_notify) {
-      background_loop_cv_.notify_one();
+    if (std::shared_ptr<TrafficCapture> traffic_capture = std::atomic_load(&traffic_capture_)) {
+      traffic_capture->RecordArrival(request->id);
     }
+    PushInstruction(InstructionKind::kAddRequest, request);
   }
 
   void AbortRequest(const String& request_id) final {
-    bool need_notify = false;
-    {
-      std::lock_guard<std::mutex> lock(background_loop_mutex_);
-      instruction_queue_.emplace_back(InstructionKind::kAbortRequest, request_id);
-      ++pending_request_operation_cnt_;
-      need_notify = engine_waiting_;
-    }
-    if (need_notify) {
-      background_loop_cv_.notify_one();
+    // Mark the request cancelled first, so that the running step of the engine can abort it
+    // before the instruction is processed.
+    if (std::shared_ptr<CancelledRequestSet> cancelled_requests =
+            std::atomic_load(&cancelled_requests_)) {
+      cancelled_requests->Add(request_id);
     }
+    PushInstruction(InstructionKind::kAbortRequest, request_id);
+  }
+
+  void ExportPrefixKV(IntTuple tokens, Device device,
+                      std::function<void(Optional<PrefixKVHandoff>)> callback) final {
+    ObjectPtr<PrefixKVExportArgNode> arg = make_object<PrefixKVExportArgNode>();
+    arg->tokens = std::move(tokens);
+    arg->device = device;
+    arg->callback = std::move(callback);
+    PushInstruction(InstructionKind::kExportPrefixKV, ObjectRef(arg));
+  }
+
+  void ImportPrefixKV(PrefixKVHandoff handoff) final {
+    PushInstruction(InstructionKind::kImportPrefixKV, std::move(handoff));
   }
 
   void RunBackgroundLoop() final {
-    // The local vectors that load the requests from critical regions.
+    // The local vector that the instructions are drained into.
     std::vector<std::pair<InstructionKind, ObjectRef>> local_instruction_queue;
 
     while (!exit_now_.load(std::memory_order_relaxed)) {
-      {
-        std::unique_lock<std::mutex> lock(background_loop_mutex_);
-        engine_waiting_ = true;
-        background_loop_cv_.wait(lock, [this] {
-          return (background_engine_ != nullptr && !background_engine_->Empty()) ||
-                 pending_request_operation_cnt_.load() > 0 ||
-                 exit_now_.load(std::memory_order_relaxed);
-        });
-        engine_waiting_ = false;
-
-        local_instruction_queue = instruction_queue_;
-        instruction_queue_.clear();
-        pending_request_operation_cnt_ = 0;
+      if (background_engine_ == nullptr || background_engine_->Empty()) {
+        WaitForInstructions();
+      }
+      // Reset the counter before draining, so that the instructions pushed after the drain
+      // keep the counter positive.
+      local_instruction_queue.clear();
+      if (pending_request_operation_cnt_.exchange(0) > 0) {
+        instruction_queue_.PopAll(&local_instruction_queue);
       }
-      for (const auto& [kind, arg] : local_instruction_queue) {
+      for (int i = 0; i < static_cast<int>(local_instruction_queue.size()); ++i) {
+        const auto& [kind, arg] = local_instruction_queue[i];
         if (kind == InstructionKind::kAddRequest) {
           CHECK(background_engine_ != nullptr) << "Background engine is not loaded.";
-          background_engine_->AddRequest(Downcast<Request>(arg));
+          // Add the consecutive requests together, so that they are tokenized in parallel.
+          Array<Request> requests{Downcast<Request>(arg)};
+          while (i + 1 < static_cast<int>(local_instruction_queue.size()) &&
+                 local_instruction_queue[i + 1].first == InstructionKind::kAddRequest) {
+            requests.push_back(Downcast<Request>(local_instruction_queue[++i].second));
+          }
+          background_engine_->AddRequests(std::move(requests));
         } else if (kind == InstructionKind::kAbortRequest) {
           CHECK(background_engine_ != nullptr) << "Background engine is not loaded.";
           background_engine_->AbortRequest(Downcast<String>(arg));
@@ -153,10 +269,24 @@ class ThreadedEngineImpl : public ThreadedEngine {
         } else if (kind == InstructionKind::kReloadEngine) {
           EngineUnloadImpl();
           EngineReloadImpl(Downcast<String>(arg));
+        } else if (kind == InstructionKind::kReconfigureEngine) {
+          EngineReconfigureImpl(Downcast<String>(arg));
         } else if (kind == InstructionKind::kResetEngine) {
           if (background_engine_ != nullptr) {
             background_engine_->Reset();
           }
+        } else if (kind == InstructionKind::kExportPrefixKV) {
+          const auto* export_arg = arg.as<PrefixKVExportArgNode>();
+          ICHECK(export_arg != nullptr);
+          Optional<PrefixKVHandoff> handoff =
+              background_engine_ != nullptr
+                  ? background_engine_->ExportPrefixKV(export_arg->tokens, export_arg->device)
+                  : NullOpt;
+          export_arg->callback(std::move(handoff));
+        } else if (kind == InstructionKind::kImportPrefixKV) {
+          if (background_engine_ != nullptr) {
+            background_engine_->ImportPrefixKV(Downcast<PrefixKVHandoff>(arg));
+          }
         } else if (kind == InstructionKind::kDebugCallFuncOnAllAllWorker) {
           CHECK(background_engine_ != nullptr) << "Background engine is not loaded.";
           background_engine_->DebugCallFuncOnAllAllWorker(Downcast<String>(arg));
@@ -166,16 +296,24 @@ class ThreadedEngineImpl : public ThreadedEngine {
       }
       if (background_engine_ != nullptr) {
         background_engine_->Step();
+        num_available_pages_.store(background_engine_->GetNumAvailablePages(),
+                                   std::memory_order_relaxed);
       }
     }
+    // Persist the prefix cache when the engine exits without being unloaded.
+    if (background_engine_ != nullptr) {
+      background_engine_->SavePrefixCacheSnapshot();
+    }
   }
 
   void RunBackgroundStreamBackLoop() final {
-    // The local vectors that load the request stream callback inputs from critical regions.
-    std::vector<Array<RequestStreamOutput>> local_request_stream_callback_inputs;
-    std::vector<RequestStreamOutput> flattened_callback_inputs;
+    // The local vector that the pending request stream outputs are swapped into.
+    std::vector<RequestStreamOutput> local_request_stream_callback_inputs;
+    auto f_should_stop = [this]() { return exit_now_.load(std::memory_order_relaxed); };
 
     while (!exit_now_.load(std::memory_order_relaxed)) {
+      int max_batch_size = -1;
+      std::shared_ptr<ShmOutputRing> shm_output_ring;
       {
         std::unique_lock<std::mutex> lock(request_stream_callback_mutex_);
         stream_callback_waiting_ = true;
@@ -183,22 +321,51 @@ class ThreadedEngineImpl : public ThreadedEngine {
           return pending_request_stream_callback_cnt_.load() > 0 ||
                  exit_now_.load(std::memory_order_relaxed);
         });
+        // Wait for more outputs to batch within the flush interval.
+        max_batch_size = stream_back_max_batch_size_;
+        if (stream_back_flush_interval_ms_ > 0) {
+          request_stream_callback_cv_.wait_for(
+              lock, std::chrono::duration<double, std::milli>(stream_back_flush_interval_ms_),
+              [this, max_batch_size] {
+                return exit_now_.load(std::memory_order_relaxed) ||
+                       (max_batch_size != -1 && static_cast<int>(request_stream_callback_inputs_
+                                                                     .size()) >= max_batch_size);
+              });
+        }
         stream_callback_waiting_ = false;
 
-        local_request_stream_callback_inputs = request_stream_callback_inputs_;
-        request_stream_callback_inputs_.clear();
+        local_request_stream_callback_inputs.swap(request_stream_callback_inputs_);
+        request_stream_callback_input_index_.clear();
         pending_request_stream_callback_cnt_ = 0;
+        shm_output_ring = shm_output_ring_;
+        if (!stream_back_cpus_.empty()) {
+          SetCurrentThreadCPUAffinity(stream_back_cpus_);
+          stream_back_cpus_.clear();
+        }
       }
-      for (const Array<RequestStreamOutput>& callback_inputs :
-           local_request_stream_callback_inputs) {
-        for (const RequestStreamOutput& callback_input : callback_inputs) {
-          flattened_callback_inputs.push_back(callback_input);
+      // Unblock the engine loop waiting for the pending outputs to be consumed.
+      request_stream_callback_space_cv_.notify_all();
+
+      if (shm_output_ring != nullptr) {
+        // Write the outputs that the ring carries, and pass the others through the callback.
+        int num_callback_outputs = 0;
+        for (RequestStreamOutput& output : local_request_stream_callback_inputs) {
+          if (!ShmOutputRing::CanWrite(output) || !shm_output_ring->Write(output, f_should_stop)) {
+            local_request_stream_callback_inputs[num_callback_outputs++] = std::move(output);
+          }
         }
+        local_request_stream_callback_inputs.resize(num_callback_outputs);
+        shm_output_ring->Publish();
       }
-      if (!flattened_callback_inputs.empty()) {
-        request_stream_callback_(Array<RequestStreamOutput>(flattened_callback_inputs));
+      int num_outputs = local_request_stream_callback_inputs.size();
+      int batch_size = max_batch_size == -1 ? num_outputs : max_batch_size;
+      for (int begin = 0; begin < num_outputs; begin += batch_size) {
+        int end = std::min(begin + batch_size, num_outputs);
+        request_stream_callback_(
+            Array<RequestStreamOutput>(local_request_stream_callback_inputs.begin() + begin,
+                                       local_request_stream_callback_inputs.begin() + end));
       }
-      flattened_callback_inputs.clear();
+      local_request_stream_callback_inputs.clear();
     }
   }
 
@@ -208,7 +375,11 @@ class ThreadedEngineImpl : public ThreadedEngine {
       exit_now_.store(true);
     }
     background_loop_cv_.notify_one();
-    request_stream_callback_cv_.notify_one();
+    {
+      std::lock_guard<std::mutex> lock(request_stream_callback_mutex_);
+      request_stream_callback_cv_.notify_one();
+      request_stream_callback_space_cv_.notify_all();
+    }
   }
 
   /************** Query/Profile/Debug **************/
@@ -229,29 +400,102 @@ class ThreadedEngineImpl : public ThreadedEngine {
     return background_engine_->Stats();
   }
 
+  std::vector<std::pair<std::string, MetricsRegistry>> GetMetricsRegistries() const final {
+    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    if (!metrics_registry_.defined()) {
+      return {};
+    }
+    return {{"", metrics_registry_.value()}};
+  }
+
+  String GetMetricsText() const final {
+    return MetricsRegistry::RenderOpenMetrics(GetMetricsRegistries());
+  }
+
+  int64_t GetNumAvailablePages() const final {
+    return num_available_pages_.load(std::memory_order_relaxed);
+  }
+
+  std::shared_ptr<const PrefixMatchIndex> GetPrefixMatchIndex() const final {
+    return std::atomic_load(&prefix_match_index_);
+  }
+
   void DebugCallFuncOnAllAllWorker(const String& func_name) final {
-    bool need_notify = false;
-    {
+    PushInstruction(InstructionKind::kDebugCallFuncOnAllAllWorker, func_name);
+  }
+
+ private:
+  /*!
+   * \brief Push the instruction into the instruction queue, and wake up the background loop
+   * if it is sleeping.
+   */
+  void PushInstruction(InstructionKind kind, ObjectRef arg) {
+    instruction_queue_.Push({kind, std::move(arg)});
+    pending_request_operation_cnt_.fetch_add(1);
+    // The sequentially consistent counter update and flag check pair with those in
+    // WaitForInstructions, so that either the background loop sees the instruction before
+    // sleeping, or this thread sees the loop sleeping. Notifying under the lock ensures the
+    // loop has started waiting.
+    if (engine_waiting_.load()) {
       std::lock_guard<std::mutex> lock(background_loop_mutex_);
-      instruction_queue_.emplace_back(InstructionKind::kDebugCallFuncOnAllAllWorker, func_name);
-      ++pending_request_operation_cnt_;
-      need_notify = engine_waiting_;
-    }
-    if (need_notify) {
       background_loop_cv_.notify_one();
     }
   }
 
- private:
+  /*!
+   * \brief Wait for new instructions when the engine has nothing to process. The loop first
+   * spins for a while, which avoids the sleep and wake-up latency when the instructions arrive
+   * in quick succession, and then sleeps on the condition variable. The spin budget grows when
+   * spinning catches the instructions and shrinks when it does not.
+   */
+  void WaitForInstructions() {
+    for (int i = 0; i < num_spin_iterations_; ++i) {
+      if (pending_request_operation_cnt_.load() > 0 ||
+          exit_now_.load(std::memory_order_relaxed)) {
+        num_spin_iterations_ = std::min(num_spin_iterations_ * 2, kMaxNumSpinIterations);
+        return;
+      }
+      std::this_thread::yield();
+    }
+    num_spin_iterations_ = std::max(num_spin_iterations_ / 2, kMinNumSpinIterations);
+
+    std::unique_lock<std::mutex> lock(background_loop_mutex_);
+    engine_waiting_.store(true);
+    background_loop_cv_.wait(lock, [this] {
+      return pending_request_operation_cnt_.load() > 0 ||
+             exit_now_.load(std::memory_order_relaxed);
+    });
+    engine_waiting_.store(false);
+  }
+
   void EngineReloadImpl(const std::string& engine_config_json_str) {
     auto frequest_stream_callback_wrapper = [this](TVMArgs args, TVMRetValue* ret) {
       ICHECK_EQ(args.size(), 1);
       Array<RequestStreamOutput> delta_outputs = args[0];
+      if (traffic_capture_ != nullptr) {
+        traffic_capture_->RecordOutputs(delta_outputs);
+      }
       bool need_notify = false;
       {
-        std::lock_guard<std::mutex> lock(request_stream_callback_mutex_);
-        request_stream_callback_inputs_.push_back(std::move(delta_outputs));
-        ++pending_request_stream_callback_cnt_;
+        std::unique_lock<std::mutex> lock(request_stream_callback_mutex_);
+        // Backpressure: the engine loop waits when the callback falls behind.
+        request_stream_callback_space_cv_.wait(lock, [this] {
+          return stream_back_max_pending_outputs_ == -1 ||
+                 pending_request_stream_callback_cnt_.load() < stream_back_max_pending_outputs_ ||
+                 exit_now_.load(std::memory_order_relaxed);
+        });
+        for (const RequestStreamOutput& delta_output : delta_outputs) {
+          // Merge the delta outputs of the same request.
+          auto [it, inserted] = request_stream_callback_input_index_.emplace(
+              delta_output->request_id, request_stream_callback_inputs_.size());
+          if (inserted) {
+            request_stream_callback_inputs_.push_back(delta_output);
+          } else {
+            RequestStreamOutput& pending_output = request_stream_callback_inputs_[it->second];
+            pending_output = ConcatRequestStreamOutputs(pending_output, delta_output);
+          }
+        }
+        pending_request_stream_callback_cnt_ += delta_outputs.size();
         need_notify = stream_callback_waiting_;
       }
       if (need_notify) {
@@ -265,6 +509,31 @@ class ThreadedEngineImpl : public ThreadedEngine {
     CHECK(output_res.IsOk()) << output_res.UnwrapErr();
     EngineCreationOutput output = output_res.Unwrap();
     background_engine_ = std::move(output.reloaded_engine);
+    num_available_pages_.store(background_engine_->GetNumAvailablePages(),
+                               std::memory_order_relaxed);
+    std::atomic_store(&prefix_match_index_, background_engine_->GetPrefixMatchIndex());
+    std::atomic_store(&cancelled_requests_, background_engine_->GetCancelledRequestSet());
+    std::atomic_store(&traffic_capture_, background_engine_->GetTrafficCapture());
+    {
+      std::lock_guard<std::mutex> lock(metrics_mutex_);
+      metrics_registry_ = background_engine_->GetMetricsRegistry();
+    }
+    {
+      std::lock_guard<std::mutex> lock(request_stream_callback_mutex_);
+      const EngineConfig& engine_config = output.completed_engine_config;
+      stream_back_max_pending_outputs_ = engine_config->stream_back_max_pending_outputs;
+      stream_back_max_batch_size_ = engine_config->stream_back_max_batch_size;
+      stream_back_flush_interval_ms_ = engine_config->stream_back_flush_interval_ms;
+      shm_output_ring_ = nullptr;
+      if (!engine_config->stream_back_shm_path.empty()) {
+        shm_output_ring_ = ShmOutputRing::Create(engine_config->stream_back_shm_path,
+                                                 engine_config->stream_back_shm_capacity);
+      }
+      if (engine_config->host_numa_node >= 0) {
+        // The stream-back loop pins itself when it wakes up next.
+        stream_back_cpus_ = GetNUMANodeCPUs(engine_config->host_numa_node);
+      }
+    }
     default_generation_cfg_json_str_ = output.default_generation_cfg->AsJSONString();
     complete_engine_config_json_str_ = output.completed_engine_config->AsJSONString();
     {
@@ -275,10 +544,46 @@ class ThreadedEngineImpl : public ThreadedEngine {
     }
   }
 
+  void EngineReconfigureImpl(const std::string& reconfig_json_str) {
+    Result<EngineConfig> engine_config_res =
+        background_engine_ != nullptr
+            ? background_engine_->Reconfigure(reconfig_json_str)
+            : Result<EngineConfig>::Error("Background engine is not loaded.");
+    if (engine_config_res.IsOk()) {
+      num_available_pages_.store(background_engine_->GetNumAvailablePages(),
+                                 std::memory_order_relaxed);
+    }
+    {
+      // Wake up the thread waiting for reconfigure finish.
+      std::lock_guard<std::mutex> lock(reload_unload_mutex_);
+      if (engine_config_res.IsOk()) {
+        complete_engine_config_json_str_ = engine_config_res.Unwrap()->AsJSONString();
+        reconfigure_error_.clear();
+      } else {
+        reconfigure_error_ = engine_config_res.UnwrapErr();
+      }
+      reconfigure_finished_ = true;
+      reload_unload_cv_.notify_one();
+    }
+  }
+
   void EngineUnloadImpl() {
     if (background_engine_ != nullptr) {
       background_engine_->AbortAllRequests();
+      background_engine_->SavePrefixCacheSnapshot();
       background_engine_ = nullptr;
+      num_available_pages_.store(-1, std::memory_order_relaxed);
+      std::atomic_store(&prefix_match_index_, std::shared_ptr<const PrefixMatchIndex>());
+      std::atomic_store(&cancelled_requests_, std::shared_ptr<CancelledRequestSet>());
+      std::atomic_store(&traffic_capture_, std::shared_ptr<TrafficCapture>());
+      {
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        metrics_registry_ = NullOpt;
+      }
+      {
+        std::lock_guard<std::mutex> lock(request_stream_callback_mutex_);
+        shm_output_ring_ = nullptr;
+      }
       // Clear the allocated memory in cached memory pool.
       const PackedFunc* fclear_memory_manager =
           tvm::runtime::Registry::Get("vm.builtin.memory_manager.clear");
@@ -316,12 +621,36 @@ class ThreadedEngineImpl : public ThreadedEngine {
   std::condition_variable background_loop_cv_;
   std::condition_variable request_stream_callback_cv_;
   std::condition_variable reload_unload_cv_;
+  /*! \brief The condition variable that the engine loop waits on for stream-back backpressure. */
+  std::condition_variable request_stream_callback_space_cv_;
   /*! \brief A boolean flag denoting if the engine needs to exit background loop. */
   std::atomic<bool> exit_now_ = false;
+  /*! \brief The number of available KV cache pages after the last engine step. */
+  std::atomic<int64_t> num_available_pages_ = -1;
+  /*!
+   * \brief The prefix cache index of the background engine, or nullptr if not loaded. It is
+   * loaded and stored atomically, since the threads adding requests read it.
+   */
+  std::shared_ptr<const PrefixMatchIndex> prefix_match_index_;
+  /*!
+   * \brief The cancelled request set of the background engine, or nullptr if not loaded. It is
+   * loaded and stored atomically, since the threads aborting requests read it.
+   */
+  std::shared_ptr<CancelledRequestSet> cancelled_requests_;
+  /*!
+   * \brief The traffic capture of the background engine, or nullptr if not loaded or the
+   * capture is disabled. It is loaded and stored atomically, since the threads adding requests
+   * stamp their arrivals in it.
+   */
+  std::shared_ptr<TrafficCapture> traffic_capture_;
+  /*! \brief The metrics registry of the background engine, or NullOpt if not loaded. */
+  Optional<MetricsRegistry> metrics_registry_;
+  /*! \brief The mutex guarding the metrics registry, so that scrapes skip the engine loop. */
+  mutable std::mutex metrics_mutex_;
 
   /************** Critical Regions **************/
   /*!
-   * \brief The instruction queue for the threaded engine.
+   * \brief The lock-free instruction queue for the threaded engine.
    * The instructions include:
    *  - requests to add into the background engine,
    *  - requests to abort from the background engine,
@@ -330,39 +659,82 @@ class ThreadedEngineImpl : public ThreadedEngine {
    * Elements are sended from other threads and consumed by
    * the threaded engine in the background loop.
    */
-  std::vector<std::pair<InstructionKind, ObjectRef>> instruction_queue_;
+  MPSCQueue<std::pair<InstructionKind, ObjectRef>> instruction_queue_;
   /*!
-   * \brief The delta outputs to pass through callback.
+   * \brief The delta outputs to pass through callback, where the delta outputs of the same
+   * request are merged into one.
    * Elements are sended from the background loop thread and
    * consumed by the foreground thread.
    */
-  std::vector<Array<RequestStreamOutput>> request_stream_callback_inputs_;
+  std::vector<RequestStreamOutput> request_stream_callback_inputs_;
+  /*! \brief The index of each request in `request_stream_callback_inputs_`. */
+  std::unordered_map<String, int> request_stream_callback_input_index_;
+  /*! \brief The stream-back configs from the engine config. See EngineConfig. */
+  int stream_back_max_pending_outputs_ = -1;
+  int stream_back_max_batch_size_ = -1;
+  double stream_back_flush_interval_ms_ = 0;
+  /*!
+   * \brief The shared-memory output ring that the stream-back loop writes outputs to, or
+   * nullptr if the outputs are passed through the callback.
+   */
+  std::shared_ptr<ShmOutputRing> shm_output_ring_;
+  /*! \brief The CPUs that the stream-back loop is to pin itself to, or empty if it is pinned. */
+  std::vector<unsigned int> stream_back_cpus_;
   /*!
-   * \brief Number of pending request operations, should be the size of
-   * `requests_to_add_` and `requests_to_abort_`.
+   * \brief Number of instructions pushed since the background loop last drained
+   * `instruction_queue_`. It is incremented after the instruction is pushed.
    */
   std::atomic<int> pending_request_operation_cnt_ = 0;
   /*!
-   * \brief Number of pending request stream callback invocations.
-   * It should be the size of `request_stream_callback_inputs_`.
+   * \brief Number of pending delta outputs before merging, which is bounded by
+   * `stream_back_max_pending_outputs_`.
    */
   std::atomic<int> pending_request_stream_callback_cnt_ = 0;
   /*! \brief A boolean flag indicating if the engine is waiting for new requests/aborts. */
-  bool engine_waiting_ = false;
+  std::atomic<bool> engine_waiting_ = false;
+  /*! \brief The number of spin iterations before the background loop sleeps. */
+  int num_spin_iterations_ = kMinNumSpinIterations;
   /*! \brief A boolean flag indicating if the stream callback loop is waiting. */
   bool stream_callback_waiting_ = false;
   /*! \brief A boolean indicating if the engine reload has finished. */
   bool reload_finished_ = false;
   /*! \brief A boolean indicating if the engine unload has finished. */
   bool unload_finished_ = false;
+  /*! \brief A boolean indicating if the engine reconfigure has finished. */
+  bool reconfigure_finished_ = false;
+  /*! \brief The error of the last engine reconfigure, which is empty on success. */
+  std::string reconfigure_error_;
 };
 
 /*! \brief The implementation of ThreadedEngine. */
 class ThreadedEngineModule : public ThreadedEngineImpl, public ModuleNode {
  public:
+  /*!
+   * \brief Return the serialized summary of the prefix cache as bytes without waiting for the
+   * engine step, or empty bytes if there is no prefix cache. See PrefixCacheSummary.
+   */
+  void GetPrefixCacheSummary(TVMArgs args, TVMRetValue* rv) {
+    std::shared_ptr<const PrefixMatchIndex> match_index = GetPrefixMatchIndex();
+    std::string summary = match_index != nullptr ? match_index->ExportSummary().Serialize() : "";
+    *rv = TVMByteArray{summary.data(), summary.size()};
+  }
+
+  /*! \brief Replay a traffic capture through `AddRequest`. See ReplayTrafficCapture. */
+  int64_t ReplayTrafficCapture(const String& path, double time_scale) {
+    return serve::ReplayTrafficCapture(path, time_scale,
+                                       [this](Request request) { AddRequest(request); });
+  }
+
+  /*! \brief Redirection to `ExportPrefixKV`, with the callback as a packed function. */
+  void ExportPrefixKVToCallback(IntTuple tokens, Device device, PackedFunc callback) {
+    ExportPrefixKV(std::move(tokens), device,
+                   [callback](Optional<PrefixKVHandoff> handoff) { callback(handoff); });
+  }
+
   TVM_MODULE_VTABLE_BEGIN("mlc.serve.async_threaded_engine");
   TVM_MODULE_VTABLE_ENTRY("init_threaded_engine", &ThreadedEngineImpl::InitThreadedEngine);
   TVM_MODULE_VTABLE_ENTRY("reload", &ThreadedEngineImpl::Reload);
+  TVM_MODULE_VTABLE_ENTRY("reconfigure", &ThreadedEngineImpl::Reconfigure);
   TVM_MODULE_VTABLE_ENTRY("add_request", &ThreadedEngineImpl::AddRequest);
   TVM_MODULE_VTABLE_ENTRY("abort_request", &ThreadedEngineImpl::AbortRequest);
   TVM_MODULE_VTABLE_ENTRY("run_background_loop", &ThreadedEngineImpl::RunBackgroundLoop);
@@ -374,7 +746,14 @@ class ThreadedEngineModule : public ThreadedEngineImpl, public ModuleNode {
   TVM_MODULE_VTABLE_ENTRY("get_complete_engine_config",
                           &ThreadedEngineImpl::GetCompleteEngineConfigJSONString);
   TVM_MODULE_VTABLE_ENTRY("stats", &ThreadedEngineImpl::Stats);
+  TVM_MODULE_VTABLE_ENTRY("get_num_available_pages", &ThreadedEngineImpl::GetNumAvailablePages);
+  TVM_MODULE_VTABLE_ENTRY_PACKED("get_prefix_cache_summary",
+                                 &ThreadedEngineModule::GetPrefixCacheSummary);
+  TVM_MODULE_VTABLE_ENTRY("export_prefix_kv", &ThreadedEngineModule::ExportPrefixKVToCallback);
+  TVM_MODULE_VTABLE_ENTRY("import_prefix_kv", &ThreadedEngineImpl::ImportPrefixKV);
+  TVM_MODULE_VTABLE_ENTRY("get_metrics", &ThreadedEngineImpl::GetMetricsText);
   TVM_MODULE_VTABLE_ENTRY("reset", &ThreadedEngineImpl::Reset);
+  TVM_MODULE_VTABLE_ENTRY("replay_traffic_capture", &ThreadedEngineModule::ReplayTrafficCapture);
   TVM_MODULE_VTABLE_ENTRY("debug_call_func_on_all_worker",
                           &ThreadedEngineImpl::DebugCallFuncOnAllAllWorker);
   TVM_MODULE_VTABLE_END();
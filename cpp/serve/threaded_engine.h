@@ -8,8 +8,15 @@
 
 #include <tvm/runtime/packed_func.h>
 
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "data.h"
 #include "engine.h"
+#include "metrics.h"
 #include "request.h"
 
 namespace mlc {
@@ -31,6 +38,28 @@ class ThreadedEngine {
   /*! \brief Create a ThreadedEngine. */
   static std::unique_ptr<ThreadedEngine> Create();
 
+  /*!
+   * \brief Create a data-parallel ThreadedEngine, which runs multiple engine replicas behind
+   * the same interface. Each request is routed to one replica, preferring the replica whose
+   * prefix cache holds the longest prefix of the request, or that served requests with the same
+   * leading inputs, and otherwise the replica with the most available KV cache pages. A replica
+   * pulls a long prefix from the prefix cache of a peer replica instead of recomputing it.
+   * \param num_replicas The number of engine replicas.
+   * \param num_devices_per_replica The number of devices of each replica, i.e., the number of
+   * tensor parallel shards. Replica i runs on the devices starting from device id
+   * `device_id + i * num_devices_per_replica`, where `device_id` is the initialized device.
+   */
+  static std::unique_ptr<ThreadedEngine> CreateDataParallel(int num_replicas,
+                                                            int num_devices_per_replica);
+
+  /*!
+   * \brief Create a multi-model ThreadedEngine, which keeps multiple models resident on the
+   * same device. Each model is served by its own engine with its own KV cache, and the models
+   * can be loaded, reloaded and unloaded by name without interrupting the others. Requests
+   * are routed to the default model, or to a model by name.
+   */
+  static std::unique_ptr<ThreadedEngine> CreateMultiModel();
+
   virtual ~ThreadedEngine() = default;
 
   /*!
@@ -51,6 +80,14 @@ class ThreadedEngine {
   /*! \brief Unload the background engine. */
   virtual void Unload() = 0;
 
+  /*!
+   * \brief Change the KV cache capacities of the background engine without reloading it.
+   * It blocks until the change is applied. See Engine::Reconfigure.
+   * \param reconfig_json_str The JSON string of the new capacities.
+   * \return The complete engine config JSON string after the change.
+   */
+  virtual String Reconfigure(String reconfig_json_str) = 0;
+
   /*! \brief Reset the engine to the initial state. */
   virtual void Reset() = 0;
 
@@ -73,6 +110,21 @@ class ThreadedEngine {
   /*! \brief Abort the input request (specified by id string) from engine. */
   virtual void AbortRequest(const String& request_id) = 0;
 
+  /*!
+   * \brief Export the KV data of the longest cached prefix of the tokens on the engine thread,
+   * and pass the handoff, or NullOpt when there is none, to the callback on the engine thread.
+   * See Engine::ExportPrefixKV.
+   */
+  virtual void ExportPrefixKV(IntTuple tokens, Device device,
+                              std::function<void(Optional<PrefixKVHandoff>)> callback) = 0;
+
+  /*!
+   * \brief Import the KV data of a prefix exported by a peer engine. It is applied in order with
+   * the requests added after it, so that they find the prefix in prefix cache.
+   * See Engine::ImportPrefixKV.
+   */
+  virtual void ImportPrefixKV(PrefixKVHandoff handoff) = 0;
+
   /************** Query/Profile/Debug **************/
 
   /*! \brief Return the default generation config JSON string. */
@@ -84,6 +136,31 @@ class ThreadedEngine {
   /*! \brief Print the statistics of the engine. */
   virtual String Stats() = 0;
 
+  /*!
+   * \brief Return the number of available KV cache pages of the engine after its last step,
+   * or -1 if the engine is not loaded. It can be called from any thread.
+   */
+  virtual int64_t GetNumAvailablePages() const = 0;
+
+  /*!
+   * \brief Return the index of the prefix cache of the engine, or nullptr if the engine is not
+   * loaded, prefix cache is disabled, or the engine wraps multiple prefix caches. It can be
+   * called from any thread.
+   */
+  virtual std::shared_ptr<const PrefixMatchIndex> GetPrefixMatchIndex() const = 0;
+
+  /*!
+   * \brief Return the metrics registries of the loaded engines with their labels, e.g.,
+   * `replica="0"`, for engines that wrap other engines. It can be called from any thread.
+   */
+  virtual std::vector<std::pair<std::string, MetricsRegistry>> GetMetricsRegistries() const = 0;
+
+  /*!
+   * \brief Render the metrics of the engine in OpenMetrics text format. It reads the metrics
+   * without waiting for the engine step, so it can be scraped from any thread.
+   */
+  virtual String GetMetricsText() const = 0;
+
   /*! \brief Call the given global function on all workers. Only for debug purpose. */
   virtual void DebugCallFuncOnAllAllWorker(const String& func_name) = 0;
 };
@@ -0,0 +1,357 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/traffic_capture.cc
+ */
+#include "traffic_capture.h"
+
+#include <picojson.h>
+#include <tvm/runtime/logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <thread>
+
+#include "../support/hash.h"
+#include "../support/json_parser.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+/*! \brief The magic number at the beginning of traffic capture files. */
+constexpr uint64_t kTrafficCaptureMagic = 0x4D4C435452435031;  // "MLCTRCP1"
+/*! \brief The version of the traffic capture file format. */
+constexpr uint32_t kTrafficCaptureVersion = 1;
+
+/*!
+ * \brief The kinds of the records in traffic capture files, each of which leads a record.
+ * - kGenerationConfig: uint32 config id, uint32 size and the config JSON string.
+ * - kRequest: uint32 request index, int64 arrival time, uint32 config id, int32 input length,
+ *   uint32 number of prefix hashes and the uint64 prefix hashes.
+ * - kOutput: uint32 request index and int32 output length.
+ */
+enum class TrafficCaptureRecordKind : uint8_t {
+  kGenerationConfig = 1,
+  kRequest = 2,
+  kOutput = 3,
+};
+
+/*! \brief Get the current time in microseconds since the epoch. */
+inline int64_t GetCurrentTimeUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+/*! \brief The reader of a serialized capture, which fails on reading past the end. */
+class TrafficCaptureReader {
+ public:
+  explicit TrafficCaptureReader(const std::string& data) : data_(data) {}
+
+  /*! \brief Read a value in the host byte order. */
+  template <typename T>
+  bool Read(T* value) {
+    if (data_.size() - offset_ < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(value, data_.data() + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return true;
+  }
+
+  /*! \brief Read the given number of bytes as a string. */
+  bool ReadString(size_t size, std::string* value) {
+    if (data_.size() - offset_ < size) {
+      return false;
+    }
+    value->assign(data_.data() + offset_, size);
+    offset_ += size;
+    return true;
+  }
+
+  bool AtEnd() const { return offset_ == data_.size(); }
+
+ private:
+  const std::string& data_;
+  size_t offset_ = 0;
+};
+
+/*!
+ * \brief Load the requests of one capture file, in the order they are recorded.
+ * \return Whether the file is a valid capture file.
+ */
+inline bool LoadTrafficCaptureFile(const std::string& path,
+                                   std::vector<TrafficCaptureRecord>* records) {
+  std::ifstream fin(path, std::ios::binary);
+  if (!fin.good()) {
+    return false;
+  }
+  std::string data((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+  TrafficCaptureReader reader(data);
+  uint64_t magic = 0;
+  uint32_t version = 0;
+  uint32_t hash_block_size = 0;
+  if (!reader.Read(&magic) || !reader.Read(&version) || !reader.Read(&hash_block_size) ||
+      magic != kTrafficCaptureMagic || version != kTrafficCaptureVersion ||
+      hash_block_size != TrafficCapture::kHashBlockSize) {
+    return false;
+  }
+  std::unordered_map<uint32_t, std::string> generation_cfgs;
+  size_t begin = records->size();
+  while (!reader.AtEnd()) {
+    TrafficCaptureRecordKind kind;
+    if (!reader.Read(&kind)) {
+      break;
+    }
+    if (kind == TrafficCaptureRecordKind::kGenerationConfig) {
+      uint32_t cfg_id = 0;
+      uint32_t size = 0;
+      std::string cfg_json_str;
+      if (!reader.Read(&cfg_id) || !reader.Read(&size) || !reader.ReadString(size, &cfg_json_str)) {
+        break;
+      }
+      generation_cfgs[cfg_id] = std::move(cfg_json_str);
+    } else if (kind == TrafficCaptureRecordKind::kRequest) {
+      uint32_t index = 0;
+      uint32_t cfg_id = 0;
+      uint32_t num_hashes = 0;
+      TrafficCaptureRecord record;
+      if (!reader.Read(&index) || !reader.Read(&record.arrival_us) || !reader.Read(&cfg_id) ||
+          !reader.Read(&record.input_length) || !reader.Read(&num_hashes) ||
+          index != records->size() - begin || !generation_cfgs.count(cfg_id)) {
+        break;
+      }
+      record.prefix_hashes.resize(num_hashes);
+      bool complete = true;
+      for (uint64_t& hash : record.prefix_hashes) {
+        complete &= reader.Read(&hash);
+      }
+      if (!complete) {
+        break;
+      }
+      record.generation_cfg_json_str = generation_cfgs.at(cfg_id);
+      records->push_back(std::move(record));
+    } else if (kind == TrafficCaptureRecordKind::kOutput) {
+      uint32_t index = 0;
+      int32_t output_length = 0;
+      if (!reader.Read(&index) || !reader.Read(&output_length) ||
+          index >= records->size() - begin) {
+        break;
+      }
+      (*records)[begin + index].output_length = output_length;
+    } else {
+      break;
+    }
+  }
+  return true;
+}
+
+/************** TrafficCapture **************/
+
+TrafficCapture::TrafficCapture(const std::string& path)
+    : fout_(path, std::ios::binary | std::ios::trunc) {}
+
+TrafficCapture::~TrafficCapture() { Flush(); }
+
+std::shared_ptr<TrafficCapture> TrafficCapture::Open(const std::string& path) {
+  std::shared_ptr<TrafficCapture> capture(new TrafficCapture(path));
+  if (!capture->fout_.good()) {
+    return nullptr;
+  }
+  capture->Write(kTrafficCaptureMagic);
+  capture->Write(kTrafficCaptureVersion);
+  capture->Write(static_cast<uint32_t>(kHashBlockSize));
+  capture->Flush();
+  return capture;
+}
+
+void TrafficCapture::RecordArrival(const String& request_id) {
+  int64_t arrival_us = GetCurrentTimeUs();
+  std::lock_guard<std::mutex> lock(arrival_mutex_);
+  arrival_us_[request_id] = arrival_us;
+}
+
+void TrafficCapture::RecordRequest(const Request& request) {
+  int64_t arrival_us = -1;
+  {
+    std::lock_guard<std::mutex> lock(arrival_mutex_);
+    auto it = arrival_us_.find(request->id);
+    if (it != arrival_us_.end()) {
+      arrival_us = it->second;
+      arrival_us_.erase(it);
+    }
+  }
+  if (arrival_us == -1) {
+    arrival_us = GetCurrentTimeUs();
+  }
+
+  std::string cfg_json_str = request->generation_cfg->AsJSONString();
+  auto [it_cfg, inserted] = generation_cfg_ids_.emplace(cfg_json_str, generation_cfg_ids_.size());
+  if (inserted) {
+    Write(TrafficCaptureRecordKind::kGenerationConfig);
+    Write(it_cfg->second);
+    Write(static_cast<uint32_t>(cfg_json_str.size()));
+    fout_.write(cfg_json_str.data(), cfg_json_str.size());
+  }
+
+  // Hash the leading token inputs. The inputs after the first non-token input are not hashed.
+  std::vector<uint64_t> prefix_hashes;
+  uint64_t hash = kFNV1aHashOffsetBasis;
+  int64_t num_hashed_tokens = 0;
+  for (const Data& data : request->inputs) {
+    const auto* token_data = data.as<TokenDataNode>();
+    if (token_data == nullptr) {
+      break;
+    }
+    for (int64_t token_id : token_data->token_ids) {
+      UpdateFNV1aHash(&hash, static_cast<int32_t>(token_id));
+      if (++num_hashed_tokens % kHashBlockSize == 0) {
+        prefix_hashes.push_back(hash);
+      }
+    }
+  }
+
+  uint32_t index = num_requests_++;
+  Write(TrafficCaptureRecordKind::kRequest);
+  Write(index);
+  Write(arrival_us);
+  Write(it_cfg->second);
+  Write(static_cast<int32_t>(request->input_total_length));
+  Write(static_cast<uint32_t>(prefix_hashes.size()));
+  fout_.write(reinterpret_cast<const char*>(prefix_hashes.data()),
+              prefix_hashes.size() * sizeof(uint64_t));
+  int n = request->generation_cfg->n;
+  pending_outputs_[request->id] = PendingOutput{index, std::vector<int32_t>(n, 0), n};
+  OnRecordWritten();
+}
+
+void TrafficCapture::RecordOutputs(const Array<RequestStreamOutput>& delta_outputs) {
+  if (pending_outputs_.empty()) {
+    return;
+  }
+  for (const RequestStreamOutput& delta_output : delta_outputs) {
+    auto it = pending_outputs_.find(delta_output->request_id);
+    if (it == pending_outputs_.end()) {
+      continue;
+    }
+    PendingOutput& pending = it->second;
+    int num_groups = std::min(static_cast<int>(delta_output->group_delta_token_ids.size()),
+                              static_cast<int>(pending.output_lengths.size()));
+    for (int i = 0; i < num_groups; ++i) {
+      pending.output_lengths[i] += delta_output->group_delta_token_ids[i].size();
+      if (delta_output->group_finish_reason[i].defined()) {
+        --pending.num_unfinished;
+      }
+    }
+    if (pending.num_unfinished > 0) {
+      continue;
+    }
+    Write(TrafficCaptureRecordKind::kOutput);
+    Write(pending.index);
+    Write(*std::max_element(pending.output_lengths.begin(), pending.output_lengths.end()));
+    pending_outputs_.erase(it);
+    OnRecordWritten();
+  }
+}
+
+void TrafficCapture::Flush() {
+  fout_.flush();
+  num_unflushed_records_ = 0;
+}
+
+void TrafficCapture::OnRecordWritten() {
+  // The number of records buffered before the file is flushed.
+  constexpr int kFlushInterval = 1024;
+  if (++num_unflushed_records_ >= kFlushInterval) {
+    Flush();
+  }
+}
+
+std::vector<TrafficCaptureRecord> TrafficCapture::Load(const std::string& path) {
+  std::vector<TrafficCaptureRecord> records;
+  if (std::filesystem::exists(path)) {
+    CHECK(LoadTrafficCaptureFile(path, &records))
+        << "\"" << path << "\" is not a valid traffic capture file.";
+  } else {
+    for (int i = 0; std::filesystem::exists(path + ".replica" + std::to_string(i)); ++i) {
+      std::string replica_path = path + ".replica" + std::to_string(i);
+      CHECK(LoadTrafficCaptureFile(replica_path, &records))
+          << "\"" << replica_path << "\" is not a valid traffic capture file.";
+    }
+  }
+  std::stable_sort(records.begin(), records.end(),
+                   [](const TrafficCaptureRecord& a, const TrafficCaptureRecord& b) {
+                     return a.arrival_us < b.arrival_us;
+                   });
+  return records;
+}
+
+Request TrafficCapture::CreateReplayRequest(const TrafficCaptureRecord& record,
+                                            String request_id) {
+  // The synthesized tokens are drawn from a range of ordinary token ids shared by the common
+  // vocabularies, which keeps clear of the special tokens at both ends.
+  constexpr int32_t kReplayTokenBegin = 1000;
+  constexpr int32_t kNumReplayTokens = 8000;
+  std::vector<int32_t> token_ids;
+  token_ids.reserve(std::max(record.input_length, 1));
+  auto f_append_tokens = [&token_ids](uint64_t seed, int64_t num_tokens) {
+    for (int64_t i = 0; i < num_tokens; ++i) {
+      // The splitmix64 sequence from the seed.
+      seed += 0x9E3779B97F4A7C15;
+      uint64_t z = seed;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+      z ^= z >> 31;
+      token_ids.push_back(kReplayTokenBegin + static_cast<int32_t>(z % kNumReplayTokens));
+    }
+  };
+  auto f_num_remaining_tokens = [&record, &token_ids]() {
+    return static_cast<int64_t>(record.input_length) - static_cast<int64_t>(token_ids.size());
+  };
+  for (uint64_t hash : record.prefix_hashes) {
+    f_append_tokens(hash, std::min<int64_t>(kHashBlockSize, f_num_remaining_tokens()));
+  }
+  uint64_t request_seed = kFNV1aHashOffsetBasis;
+  UpdateFNV1aHash(&request_seed, std::string(request_id));
+  f_append_tokens(request_seed,
+                  std::max<int64_t>(f_num_remaining_tokens(), token_ids.empty() ? 1 : 0));
+
+  picojson::object cfg = json::ParseToJSONObject(record.generation_cfg_json_str);
+  if (record.output_length > 0) {
+    cfg["max_tokens"] = picojson::value(static_cast<int64_t>(record.output_length));
+    cfg["ignore_eos"] = picojson::value(true);
+    cfg.erase("stop_strs");
+    cfg.erase("stop_token_ids");
+  }
+  GenerationConfig generation_cfg(picojson::value(cfg).serialize(), NullOpt);
+  return Request(std::move(request_id), {TokenData(std::move(token_ids))},
+                 std::move(generation_cfg));
+}
+
+int64_t ReplayTrafficCapture(const std::string& path, double time_scale,
+                             const std::function<void(Request)>& f_add_request) {
+  CHECK_GE(time_scale, 0) << "The time scale of traffic replay should not be negative.";
+  std::vector<TrafficCaptureRecord> records = TrafficCapture::Load(path);
+  CHECK(!records.empty()) << "No request is captured in \"" << path << "\".";
+  static std::atomic<int64_t> replay_counter = 0;
+  std::string id_prefix = "replay-" + std::to_string(replay_counter++) + "-";
+  auto tstart = std::chrono::steady_clock::now();
+  for (int i = 0; i < static_cast<int>(records.size()); ++i) {
+    // Create the request ahead of its arrival, so that the arrival is kept on time.
+    Request request =
+        TrafficCapture::CreateReplayRequest(records[i], id_prefix + std::to_string(i));
+    double offset_us = (records[i].arrival_us - records[0].arrival_us) * time_scale;
+    std::this_thread::sleep_until(tstart +
+                                  std::chrono::microseconds(static_cast<int64_t>(offset_us)));
+    f_add_request(std::move(request));
+  }
+  return records.size();
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
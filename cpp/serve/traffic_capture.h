@@ -0,0 +1,169 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve/traffic_capture.h
+ * \brief The capture of the served traffic in a compact binary file, and its replay.
+ */
+#ifndef MLC_LLM_SERVE_TRAFFIC_CAPTURE_H_
+#define MLC_LLM_SERVE_TRAFFIC_CAPTURE_H_
+
+#include <tvm/runtime/container/string.h>
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "data.h"
+#include "request.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+
+using namespace tvm::runtime;
+
+/*! \brief The shape of a captured request, which is all that its replay reproduces. */
+struct TrafficCaptureRecord {
+  /*! \brief The arrival time of the request in microseconds since the epoch. */
+  int64_t arrival_us = 0;
+  /*! \brief The total input length of the request. */
+  int32_t input_length = 0;
+  /*!
+   * \brief The chained hash of the leading input tokens at every
+   * TrafficCapture::kHashBlockSize tokens, by which the requests sharing a prefix are known.
+   */
+  std::vector<uint64_t> prefix_hashes;
+  /*! \brief The generation config JSON string of the request. */
+  std::string generation_cfg_json_str;
+  /*!
+   * \brief The number of tokens output by the longest generation of the request, or -1 if the
+   * request did not finish within the capture.
+   */
+  int32_t output_length = -1;
+};
+
+/*!
+ * \brief The capture of the requests an engine serves, for the production traffic to be
+ * replayed against other scheduler and cache configs. For each request, it records the arrival
+ * time, the input length, the hashes of the input prefix, the generation config and the
+ * realized output length, without the input tokens themselves. The records are appended to a
+ * binary file through a buffered stream: the distinct generation configs are written once, and
+ * a request takes a few dozen bytes plus 8 bytes per kHashBlockSize input tokens.
+ *
+ * The threaded engine stamps the arrival of a request when it is added, the engine records the
+ * request after tokenizing it, and the threaded engine records the output length when the
+ * request finishes. The arrivals are stamped from the threads adding requests, and the rest is
+ * recorded on the engine thread.
+ */
+class TrafficCapture {
+ public:
+  /*! \brief The number of input tokens hashed into each prefix hash. */
+  static constexpr int kHashBlockSize = 256;
+
+  /*!
+   * \brief Open the capture file, which is truncated.
+   * \return The capture, or nullptr if the file cannot be opened.
+   */
+  static std::shared_ptr<TrafficCapture> Open(const std::string& path);
+
+  ~TrafficCapture();
+  TrafficCapture(const TrafficCapture&) = delete;
+  TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+  /*! \brief Stamp the arrival of a request at the current time. Thread-safe. */
+  void RecordArrival(const String& request_id);
+
+  /*!
+   * \brief Record a tokenized request, with its arrival stamped before, or the current time
+   * when it is not stamped.
+   */
+  void RecordRequest(const Request& request);
+
+  /*!
+   * \brief Record the delta outputs of the requests, and the output lengths of the requests
+   * whose generations all finish.
+   */
+  void RecordOutputs(const Array<RequestStreamOutput>& delta_outputs);
+
+  /*! \brief Flush the buffered records to the file. */
+  void Flush();
+
+  /*!
+   * \brief Load the requests of a capture file in the order of arrival. When the file does not
+   * exist, the files of the engine replicas, i.e. the path suffixed by ".replica0",
+   * ".replica1" and so on, are loaded and merged. A truncated record at the end of a file,
+   * e.g. of an engine that exited without flushing, is ignored.
+   */
+  static std::vector<TrafficCaptureRecord> Load(const std::string& path);
+
+  /*!
+   * \brief Create the request that replays a captured one. The input tokens are synthesized
+   * from the prefix hashes, so that the requests sharing a captured prefix share the
+   * synthesized one, and the rest of the input is unique to the request. A request that
+   * finished with output is forced to output the same number of tokens, ignoring the stop
+   * conditions. Other requests keep their generation configs.
+   * \param record The captured request.
+   * \param request_id The id of the replayed request.
+   */
+  static Request CreateReplayRequest(const TrafficCaptureRecord& record, String request_id);
+
+ private:
+  explicit TrafficCapture(const std::string& path);
+
+  /*! \brief The output progress of a recorded request. */
+  struct PendingOutput {
+    /*! \brief The index of the request record. */
+    uint32_t index;
+    /*! \brief The number of tokens output by each generation. */
+    std::vector<int32_t> output_lengths;
+    /*! \brief The number of generations that have not finished. */
+    int num_unfinished;
+  };
+
+  /*! \brief Write a value to the file in the host byte order. */
+  template <typename T>
+  void Write(const T& value) {
+    fout_.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  /*! \brief Count a written record, and flush the file every few records. */
+  void OnRecordWritten();
+
+  /*! \brief The buffered file stream. */
+  std::ofstream fout_;
+  /*! \brief The mutex guarding the stamped arrivals. */
+  std::mutex arrival_mutex_;
+  /*! \brief The arrival times of the requests added and not yet recorded. */
+  std::unordered_map<std::string, int64_t> arrival_us_;
+  /*! \brief The id of each distinct generation config written to the file. */
+  std::unordered_map<std::string, uint32_t> generation_cfg_ids_;
+  /*! \brief The output progress of each recorded request that has not finished. */
+  std::unordered_map<std::string, PendingOutput> pending_outputs_;
+  /*! \brief The number of requests recorded. */
+  uint32_t num_requests_ = 0;
+  /*! \brief The number of records written since the last flush. */
+  int num_unflushed_records_ = 0;
+};
+
+/*!
+ * \brief Replay a traffic capture by adding the replayed requests with the captured arrival
+ * times, relative to the first arrival and scaled by the time scale. It blocks the calling
+ * thread until the last request is added. The replayed requests are identified by the
+ * "replay-" prefix, followed by a number unique to the replay and the index of the request.
+ * \param path The path of the capture file. See TrafficCapture::Load.
+ * \param time_scale The scale of the arrival intervals, e.g. 0.5 for twice the arrival rate.
+ * \param f_add_request The function to add a request to the engine.
+ * \return The number of replayed requests.
+ */
+int64_t ReplayTrafficCapture(const std::string& path, double time_scale,
+                             const std::function<void(Request)>& f_add_request);
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SERVE_TRAFFIC_CAPTURE_H_
@@ -8,7 +8,9 @@
 #include <tvm/runtime/registry.h>
 
 #include <algorithm>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 #include "tokenizers.h"
 
@@ -19,7 +21,9 @@ namespace llm {
 
 TVM_REGISTER_OBJECT_TYPE(TextStreamerObj);
 
-TextStreamerObj::TextStreamerObj(Tokenizer tokenizer) : tokenizer_(std::move(tokenizer)) {}
+TextStreamerObj::TextStreamerObj(Tokenizer tokenizer) : tokenizer_(std::move(tokenizer)) {
+  decode_table_ = tokenizer_->GetIncrementalDecodeTable(&strip_leading_space_);
+}
 
 TextStreamer::TextStreamer(Tokenizer tokenizer) {
   data_ = make_object<TextStreamerObj>(std::move(tokenizer));
@@ -32,6 +36,22 @@ std::string TextStreamerObj::Put(const std::vector<int32_t>& delta_tokens) {
   }
 
   std::string ret;
+  if (decode_table_ != nullptr) {
+    // Incremental detokenization: append the bytes of each token.
+    for (int32_t delta_token : delta_tokens) {
+      ICHECK(delta_token >= 0 && delta_token < static_cast<int>(decode_table_->size()));
+      const std::string& token = (*decode_table_)[delta_token];
+      if (token.empty()) {
+        continue;
+      }
+      bool strip = at_text_start_ && strip_leading_space_ && token[0] == ' ';
+      pending_bytes_.append(token, strip ? 1 : 0, std::string::npos);
+      at_text_start_ = false;
+    }
+    TakeValidUTF8(/*flush=*/false, &ret);
+    return ret;
+  }
+
   // We process delta tokens one by one.
   for (int32_t delta_token : delta_tokens) {
     // push to pending tokens.
@@ -115,6 +135,13 @@ std::string TextStreamerObj::Put(const std::vector<int32_t>& delta_tokens) {
 }
 
 std::string TextStreamerObj::Finish() {
+  if (decode_table_ != nullptr) {
+    finished_ = true;
+    std::string ret;
+    TakeValidUTF8(/*flush=*/true, &ret);
+    return ret;
+  }
+
   // all_tokens = prefix_tokens_ + pending_tokens_
   std::vector<int32_t> all_tokens;
   all_tokens.reserve(prefix_tokens_.size() + pending_tokens_.size());
@@ -137,6 +164,41 @@ std::string TextStreamerObj::Finish() {
   }
 }
 
+void TextStreamerObj::TakeValidUTF8(bool flush, std::string* output) {
+  const auto* bytes = reinterpret_cast<const unsigned char*>(pending_bytes_.data());
+  int size = pending_bytes_.size();
+  int pos = 0;
+  while (pos < size) {
+    // Get the character length from the leading byte. 0 means an invalid leading byte.
+    unsigned char lead = bytes[pos];
+    int length = lead < 0x80                  ? 1
+                 : lead >= 0xC2 && lead <= 0xDF ? 2
+                 : lead >= 0xE0 && lead <= 0xEF ? 3
+                 : lead >= 0xF0 && lead <= 0xF4 ? 4
+                                                : 0;
+    if (length == 0) {
+      output->append(kReplacementCharacter);
+      ++pos;
+      continue;
+    }
+    int num_valid_bytes = 1;
+    while (num_valid_bytes < length && pos + num_valid_bytes < size &&
+           (bytes[pos + num_valid_bytes] & 0xC0) == 0x80) {
+      ++num_valid_bytes;
+    }
+    if (num_valid_bytes == length) {
+      output->append(pending_bytes_, pos, length);
+    } else if (pos + num_valid_bytes == size && !flush) {
+      // The character may be completed by the following tokens.
+      break;
+    } else {
+      output->append(kReplacementCharacter);
+    }
+    pos += num_valid_bytes;
+  }
+  pending_bytes_.erase(0, pos);
+}
+
 TVM_REGISTER_GLOBAL("mlc.TextStreamer").set_body_typed([](Tokenizer tokenizer) {
   return TextStreamer(std::move(tokenizer));
 });
@@ -153,32 +215,101 @@ TVM_REGISTER_GLOBAL("mlc.TextStreamerFinish")
 
 TVM_REGISTER_OBJECT_TYPE(StopStrHandlerObj);
 
-/*! \brief Create the KMP partial match table for the input string. */
-inline std::vector<int> CreatePartialMatchTable(const String& str) {
-  int length = str.length();
-  std::vector<int> partial_match_table = {-1};
-  partial_match_table.reserve(length);
-  for (int i = 1; i < length; ++i) {
-    int ptr = partial_match_table[i - 1];
-    while (ptr != -1 && str.at(ptr) != str.at(i - 1)) {
-      ptr = partial_match_table[ptr];
+/*! \brief The number of cached automata beyond which the expired cache entries are dropped. */
+constexpr size_t kMaxStopStrAutomatonCacheSize = 1024;
+
+StopStrAutomaton::StopStrAutomaton(const std::vector<std::string>& stop_strs) {
+  // - Assign a class to each byte that appears in the stop strings.
+  byte_classes_.fill(0);
+  num_byte_classes_ = 1;
+  for (const std::string& stop_str : stop_strs) {
+    ICHECK(!stop_str.empty());
+    for (char ch : stop_str) {
+      int32_t& byte_class = byte_classes_[static_cast<uint8_t>(ch)];
+      if (byte_class == 0) {
+        byte_class = num_byte_classes_++;
+      }
+    }
+  }
+
+  // - Build the trie of the stop strings, where -1 denotes a missing child.
+  transitions_.assign(num_byte_classes_, -1);
+  depths_.push_back(0);
+  match_lengths_.push_back(0);
+  for (const std::string& stop_str : stop_strs) {
+    int state = 0;
+    for (char ch : stop_str) {
+      int index = state * num_byte_classes_ + byte_classes_[static_cast<uint8_t>(ch)];
+      if (transitions_[index] == -1) {
+        transitions_[index] = depths_.size();
+        depths_.push_back(depths_[state] + 1);
+        match_lengths_.push_back(0);
+        transitions_.resize(transitions_.size() + num_byte_classes_, -1);
+      }
+      state = transitions_[index];
+    }
+    match_lengths_[state] = stop_str.length();
+  }
+
+  // - Compute the failure links in BFS order, and complete the transitions with them.
+  std::vector<int32_t> failure_links(depths_.size(), 0);
+  std::vector<int32_t> queue = {0};
+  for (int i = 0; i < static_cast<int>(queue.size()); ++i) {
+    int state = queue[i];
+    int failure = failure_links[state];
+    if (match_lengths_[state] == 0) {
+      match_lengths_[state] = match_lengths_[failure];
+    }
+    for (int byte_class = 0; byte_class < num_byte_classes_; ++byte_class) {
+      int index = state * num_byte_classes_ + byte_class;
+      int failure_next = state == 0 ? 0 : transitions_[failure * num_byte_classes_ + byte_class];
+      if (transitions_[index] == -1) {
+        transitions_[index] = failure_next;
+      } else {
+        failure_links[transitions_[index]] = failure_next;
+        queue.push_back(transitions_[index]);
+      }
     }
-    partial_match_table.push_back(ptr + 1);
   }
-  return partial_match_table;
 }
 
-StopStrHandlerObj::StopStrHandlerObj(Array<String> stop_strs,
-                                     const std::vector<std::string>& token_table)
-    : stop_strs_(std::move(stop_strs)), token_table_(token_table) {
-  int num_stop_strs = stop_strs_.size();
-  cur_match_lengths_.resize(num_stop_strs, 0);
+std::shared_ptr<const StopStrAutomaton> StopStrAutomaton::Get(const Array<String>& stop_strs) {
+  std::vector<std::string> sorted_stop_strs(stop_strs.begin(), stop_strs.end());
+  std::sort(sorted_stop_strs.begin(), sorted_stop_strs.end());
+  sorted_stop_strs.erase(std::unique(sorted_stop_strs.begin(), sorted_stop_strs.end()),
+                         sorted_stop_strs.end());
+  std::string key;
+  for (const std::string& stop_str : sorted_stop_strs) {
+    key += std::to_string(stop_str.length()) + ":" + stop_str;
+  }
+
+  // The automata are held by the handlers, and are released with the last handler using them.
+  static std::mutex mutex;
+  static std::unordered_map<std::string, std::weak_ptr<const StopStrAutomaton>> cache;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::weak_ptr<const StopStrAutomaton>& entry = cache[key];
+  if (std::shared_ptr<const StopStrAutomaton> automaton = entry.lock()) {
+    return automaton;
+  }
+  auto automaton = std::make_shared<const StopStrAutomaton>(sorted_stop_strs);
+  entry = automaton;
+  // Drop the expired entries when the cache grows large.
+  if (cache.size() > kMaxStopStrAutomatonCacheSize) {
+    for (auto it = cache.begin(); it != cache.end();) {
+      it = it->second.expired() ? cache.erase(it) : std::next(it);
+    }
+  }
+  return automaton;
+}
 
-  // Create the KMP partial match table for each stop string.
-  partial_match_tables_.reserve(num_stop_strs);
+StopStrHandlerObj::StopStrHandlerObj(Array<String> stop_strs,
+                                     std::shared_ptr<const TokenTable> token_table)
+    : stop_strs_(std::move(stop_strs)), token_table_(std::move(token_table)) {
   for (const String& stop_str : stop_strs_) {
     CHECK(!stop_str.empty()) << "Stop string cannot be empty.";
-    partial_match_tables_.push_back(CreatePartialMatchTable(stop_str));
+  }
+  if (!stop_strs_.empty()) {
+    automaton_ = StopStrAutomaton::Get(stop_strs_);
   }
 }
 
@@ -190,52 +321,28 @@ std::vector<int32_t> StopStrHandlerObj::Put(int32_t token_id) {
 
   CHECK(!stop_triggered_) << "Cannot put new token when already stopped.";
 
-  ICHECK_LT(token_id, static_cast<int>(token_table_.size()));
-  const std::string& token = token_table_[token_id];
+  ICHECK_LT(token_id, token_table_->size());
+  std::string_view token = (*token_table_)[token_id];
   pending_token_ids_.push_back(token_id);
   pending_token_lengths_.push_back(token.length());
 
   std::vector<int32_t> return_token_ids;
 
   for (char ch : token) {
-    // The earliest starting point of stop string.
-    int stop_starting_pos = std::numeric_limits<int>::max();
-    // The cutoff length that can be safely return.
-    int cutoff_length = std::numeric_limits<int>::max();
-    // The maximum matched length.
-    int max_match_length = 0;
-
-    for (int str_id = 0; str_id < static_cast<int>(stop_strs_.size()); ++str_id) {
-      // - Run one step of KMP algorithm.
-      const std::vector<int>& partial_match_table = partial_match_tables_[str_id];
-      int& cur_match_length = cur_match_lengths_[str_id];
-      while (cur_match_length != -1 && ch != stop_strs_[str_id].at(cur_match_length)) {
-        cur_match_length = partial_match_table[cur_match_length];
-      }
-      ++cur_match_length;
-
-      // Case 1. The stop string is matched.
-      if (cur_match_length == stop_strs_[str_id].length()) {
-        stop_triggered_ = true;
-        stop_starting_pos =
-            std::min(stop_starting_pos,
-                     pending_string_len_ + 1 - static_cast<int>(stop_strs_[str_id].length()));
-        continue;
-      }
-
-      // Case 2. The stop string is not matched.
-      // - Get the cutoff length that can be safely return.
-      ICHECK_GE(pending_string_len_ + 1, cur_match_length);
-      cutoff_length = std::min(cutoff_length, pending_string_len_ + 1 - cur_match_length);
-      // - Get the updated pending string length.
-      max_match_length = std::max(max_match_length, cur_match_length);
+    automaton_state_ = automaton_->Next(automaton_state_, static_cast<uint8_t>(ch));
+    // The longest suffix of the pending string that is a prefix of some stop string.
+    int max_match_length = automaton_->Depth(automaton_state_);
+    ICHECK_GE(pending_string_len_ + 1, max_match_length);
+    // The cutoff length that can be safely return. When a stop string is matched, it is the
+    // earliest starting point of the matched stop strings, i.e., that of the longest one.
+    int stop_length = automaton_->MatchLength(automaton_state_);
+    int cutoff_length = pending_string_len_ + 1 - max_match_length;
+    if (stop_length > 0) {
+      stop_triggered_ = true;
+      cutoff_length = pending_string_len_ + 1 - stop_length;
     }
 
     // Collect the token ids that can be safely cut off and returned.
-    if (stop_triggered_) {
-      cutoff_length = stop_starting_pos;
-    }
-    ICHECK_NE(cutoff_length, std::numeric_limits<int>::max());
     ICHECK_GE(cutoff_length, 0);
     int cum_length = 0;
     while (!pending_token_ids_.empty() &&
@@ -257,13 +364,13 @@ std::vector<int32_t> StopStrHandlerObj::Put(int32_t token_id) {
 }
 
 StopStrHandler::StopStrHandler(Array<String> stop_strs,
-                               const std::vector<std::string>& token_table) {
-  data_ = make_object<StopStrHandlerObj>(std::move(stop_strs), token_table);
+                               std::shared_ptr<const TokenTable> token_table) {
+  data_ = make_object<StopStrHandlerObj>(std::move(stop_strs), std::move(token_table));
 }
 
 TVM_REGISTER_GLOBAL("mlc.StopStrHandler")
     .set_body_typed([](Array<String> stop_strs, const Tokenizer& tokenizer) {
-      return StopStrHandler(std::move(stop_strs), tokenizer->TokenTable());
+      return StopStrHandler(std::move(stop_strs), TokenTable::FromTokens(tokenizer->TokenTable()));
     });
 
 TVM_REGISTER_GLOBAL("mlc.StopStrHandlerPut")
@@ -11,6 +11,12 @@
 #include <tvm/runtime/container/string.h>
 #include <tvm/runtime/object.h>
 
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "token_table.h"
 #include "tokenizers.h"
 
 namespace mlc {
@@ -23,6 +29,11 @@ using namespace tvm::runtime;
 /*!
  * \brief The class that streams back validated utf-8 text strings
  * that generated by tokenizer.
+ * \note When the tokenizer supports incremental detokenization (see
+ * TokenizerObj::GetIncrementalDecodeTable), the streamer appends the bytes of
+ * each token to a pending buffer and returns the complete UTF-8 characters in
+ * it, without invoking the decoder. Otherwise, it decodes the window of recent
+ * tokens with the decoder for each new token.
  */
 class TextStreamerObj : public Object {
  public:
@@ -50,10 +61,26 @@ class TextStreamerObj : public Object {
   TVM_DECLARE_BASE_OBJECT_INFO(TextStreamerObj, Object);
 
  private:
+  /*!
+   * \brief Move the complete UTF-8 characters at the front of the pending bytes to the output.
+   * Each invalid byte sequence is replaced by the replacement character. An incomplete character
+   * at the end is kept pending unless flush is true.
+   */
+  void TakeValidUTF8(bool flush, std::string* output);
+
   Tokenizer tokenizer_;
   std::vector<int32_t> prefix_tokens_;
   std::vector<int32_t> pending_tokens_;
   bool finished_ = false;
+
+  /*! \brief The decoded token strings in incremental detokenization, or nullptr if disabled. */
+  const std::vector<std::string>* decode_table_ = nullptr;
+  /*! \brief Whether the leading space of the text is stripped in incremental detokenization. */
+  bool strip_leading_space_ = false;
+  /*! \brief Whether no byte has been put in incremental detokenization. */
+  bool at_text_start_ = true;
+  /*! \brief The bytes that do not form a complete UTF-8 character yet. */
+  std::string pending_bytes_;
 };
 
 /*!
@@ -70,14 +97,58 @@ class TextStreamer : public ObjectRef {
 
 /****************** StopStrHandler ******************/
 
+/*!
+ * \brief The Aho-Corasick automaton of a set of stop strings, which matches all the stop
+ * strings in a single pass over the bytes of text. Each state stands for the longest suffix of
+ * the text that is a prefix of some stop string. The transitions are precomputed for the bytes
+ * that appear in the stop strings, and all the other bytes go back to the initial state.
+ * An automaton is immutable, and is shared by the handlers of the same stop strings.
+ */
+class StopStrAutomaton {
+ public:
+  /*! \brief Build the automaton of the given non-empty stop strings. */
+  explicit StopStrAutomaton(const std::vector<std::string>& stop_strs);
+
+  /*! \brief Get the automaton of the given stop strings, which is built once and shared. */
+  static std::shared_ptr<const StopStrAutomaton> Get(const Array<String>& stop_strs);
+
+  /*! \brief Get the next state after matching the byte in the given state. */
+  int Next(int state, uint8_t byte) const {
+    return transitions_[state * num_byte_classes_ + byte_classes_[byte]];
+  }
+
+  /*! \brief The length of the stop string prefix that the state stands for. */
+  int Depth(int state) const { return depths_[state]; }
+
+  /*!
+   * \brief The length of the longest stop string that ends at the state, i.e. the longest one
+   * that is a suffix of the prefix that the state stands for. 0 means no stop string ends here.
+   */
+  int MatchLength(int state) const { return match_lengths_[state]; }
+
+ private:
+  /*! \brief The class of each byte. Bytes not in the stop strings have class 0. */
+  std::array<int32_t, 256> byte_classes_;
+  /*! \brief The number of byte classes. */
+  int num_byte_classes_;
+  /*! \brief The next state of each state and byte class. */
+  std::vector<int32_t> transitions_;
+  /*! \brief The depth of each state. */
+  std::vector<int32_t> depths_;
+  /*! \brief The longest stop string length ending at each state. */
+  std::vector<int32_t> match_lengths_;
+};
+
 /*!
  * \brief The stop string handler in MLC LLM, which takes input delta tokens
  * one at a time, and return the output delta token before stopping due to
- * stop strings.
+ * stop strings. The bytes of tokens are matched against all the stop strings
+ * at once with StopStrAutomaton.
  */
 class StopStrHandlerObj : public Object {
  public:
-  explicit StopStrHandlerObj(Array<String> stop_strs, const std::vector<std::string>& token_table);
+  explicit StopStrHandlerObj(Array<String> stop_strs,
+                             std::shared_ptr<const TokenTable> token_table);
 
   /*!
    * \brief Add new input delta token to the handler, return output
@@ -99,10 +170,10 @@ class StopStrHandlerObj : public Object {
  private:
   /*! \brief The stop strings. */
   Array<String> stop_strs_;
-  /*! \brief The partial match table for each stop string in the KMP algorithm. */
-  std::vector<std::vector<int>> partial_match_tables_;
-  /*! \brief The tokenizer token table for token id lookup. */
-  const std::vector<std::string>& token_table_;
+  /*! \brief The automaton of the stop strings, or nullptr if there is no stop string. */
+  std::shared_ptr<const StopStrAutomaton> automaton_;
+  /*! \brief The post-processed token table for token id lookup. */
+  std::shared_ptr<const TokenTable> token_table_;
 
   /************ Global states across all stop strings. ************/
 
@@ -113,12 +184,9 @@ class StopStrHandlerObj : public Object {
   /*! \brief The token string length of each pending token id. */
   std::vector<int> pending_token_lengths_;
   /*! \brief A boolean flag indicating if stop has been triggered. */
-  bool stop_triggered_;
-
-  /************ Per-stop-string states. ************/
-
-  /*! \brief The current match position of the pending string to each stop string. */
-  std::vector<int> cur_match_lengths_;
+  bool stop_triggered_ = false;
+  /*! \brief The current state in the automaton. */
+  int automaton_state_ = 0;
 };
 
 /*!
@@ -127,7 +195,7 @@ class StopStrHandlerObj : public Object {
  */
 class StopStrHandler : public ObjectRef {
  public:
-  explicit StopStrHandler(Array<String> stop_strs, const std::vector<std::string>& token_table);
+  explicit StopStrHandler(Array<String> stop_strs, std::shared_ptr<const TokenTable> token_table);
 
   TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(StopStrHandler, ObjectRef, StopStrHandlerObj);
 };
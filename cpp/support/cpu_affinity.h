@@ -0,0 +1,70 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file cpu_affinity.h
+ * \brief Helpers to pin host threads to the cores of a NUMA node.
+ */
+
+#ifndef MLC_LLM_SUPPORT_CPU_AFFINITY_H_
+#define MLC_LLM_SUPPORT_CPU_AFFINITY_H_
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+namespace mlc {
+namespace llm {
+
+/*!
+ * \brief Get the CPU ids of the given NUMA node, read from the node's cpulist in sysfs.
+ * \return The CPU ids, or empty if the node does not exist or the platform has no sysfs.
+ */
+inline std::vector<unsigned int> GetNUMANodeCPUs(int numa_node) {
+  std::vector<unsigned int> cpus;
+  std::ifstream fin("/sys/devices/system/node/node" + std::to_string(numa_node) + "/cpulist");
+  std::string cpulist;
+  if (!fin || !std::getline(fin, cpulist)) {
+    return cpus;
+  }
+  // The cpulist is the comma-separated ranges, e.g., "0-15,32-47".
+  for (const std::string& range : Split(cpulist, ',')) {
+    if (range.empty()) continue;
+    size_t dash = range.find('-');
+    unsigned int begin = std::stoul(range.substr(0, dash));
+    unsigned int end = dash == std::string::npos ? begin : std::stoul(range.substr(dash + 1));
+    for (unsigned int cpu = begin; cpu <= end; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+/*!
+ * \brief Pin the calling thread to the given CPUs.
+ * \return Whether the affinity is set. It is never set on the platforms other than Linux.
+ */
+inline bool SetCurrentThreadCPUAffinity(const std::vector<unsigned int>& cpus) {
+#if defined(__linux__)
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (unsigned int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &cpu_set);
+    }
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set) == 0;
+#else
+  return false;
+#endif
+}
+
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SUPPORT_CPU_AFFINITY_H_
@@ -7,6 +7,7 @@
 #include <tvm/runtime/logging.h>
 
 #include <array>
+#include <cstring>
 
 namespace mlc {
 namespace llm {
@@ -129,14 +130,53 @@ std::pair<TCodepoint, const char*> ParseNextUTF8(const char* utf8, UTF8ErrorPoli
 }
 
 std::vector<TCodepoint> ParseUTF8(const char* utf8, UTF8ErrorPolicy error_policy) {
+  return ParseUTF8(utf8, std::strlen(utf8), error_policy);
+}
+
+std::vector<TCodepoint> ParseUTF8(const char* utf8, size_t length, UTF8ErrorPolicy error_policy) {
+  static constexpr uint64_t kHighBitMask = 0x8080808080808080ULL;
   std::vector<TCodepoint> codepoints;
-  while (*utf8 != 0) {
-    TCodepoint codepoint;
-    std::tie(codepoint, utf8) = ParseNextUTF8(utf8, error_policy);
-    if (codepoint == CharHandlingError::kInvalidUTF8) {
-      return {codepoint};
+  codepoints.reserve(length);
+  const uint8_t* cur = reinterpret_cast<const uint8_t*>(utf8);
+  const uint8_t* end = cur + length;
+  while (cur != end) {
+    // Convert the ASCII bytes eight at a time, until a word has a byte with the high bit set.
+    while (end - cur >= 8) {
+      uint64_t word;
+      std::memcpy(&word, cur, sizeof(word));
+      if ((word & kHighBitMask) != 0) {
+        break;
+      }
+      codepoints.insert(codepoints.end(), cur, cur + 8);
+      cur += 8;
+    }
+    if (cur == end) {
+      break;
+    }
+    if (*cur < 0x80) {
+      codepoints.push_back(*cur++);
+      continue;
+    }
+    // Parse a multi-byte codepoint, whose continuation bytes must be within the string.
+    auto [accepted, num_bytes, codepoint] = HandleUTF8FirstByte(*cur);
+    if (accepted && end - cur < num_bytes) {
+      accepted = false;
+    }
+    for (int i = 1; accepted && i < num_bytes; ++i) {
+      if ((cur[i] & 0xC0) != 0x80) {
+        accepted = false;
+      } else {
+        codepoint = (codepoint << 6) | (cur[i] & 0x3F);
+      }
+    }
+    if (accepted) {
+      codepoints.push_back(codepoint);
+      cur += num_bytes;
+    } else if (error_policy == UTF8ErrorPolicy::kReturnInvalid) {
+      return {CharHandlingError::kInvalidUTF8};
+    } else {
+      codepoints.push_back(*cur++);
     }
-    codepoints.push_back(codepoint);
   }
   return codepoints;
 }
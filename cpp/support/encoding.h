@@ -87,6 +87,18 @@ std::pair<TCodepoint, const char*> ParseNextUTF8(
 std::vector<TCodepoint> ParseUTF8(const char* utf8,
                                   UTF8ErrorPolicy error_policy = UTF8ErrorPolicy::kReturnInvalid);
 
+/*!
+ * \brief Parse all codepoints in a UTF-8 string of the given length at once. The runs of ASCII
+ * bytes are checked and converted eight bytes at a time, which is the common case of token
+ * strings. Null bytes are parsed as codepoint 0.
+ * \param utf8 The UTF-8 string.
+ * \param length The length of the string in bytes.
+ * \return All codepoints. If the UTF-8 string is invalid, and the error policy is
+ * kReturnInvalid, the function returns {CharHandlingError::kInvalidUTF8}.
+ */
+std::vector<TCodepoint> ParseUTF8(const char* utf8, size_t length,
+                                  UTF8ErrorPolicy error_policy = UTF8ErrorPolicy::kReturnInvalid);
+
 /*!
  * \brief Parse the first codepoint from a UTF-8 string. Also checks escape sequences and converts
  * the escaped char to its original value.
@@ -0,0 +1,79 @@
+/*!
+ * Copyright (c) 2023 by Contributors
+ * \file hash.h
+ * \brief The stable hash of the keys of the files persisted across runs.
+ */
+#ifndef MLC_LLM_SUPPORT_HASH_H_
+#define MLC_LLM_SUPPORT_HASH_H_
+
+#include <picojson.h>
+
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+namespace mlc {
+namespace llm {
+
+/*! \brief The initial value of the 64-bit FNV-1a hash. */
+constexpr uint64_t kFNV1aHashOffsetBasis = 0xCBF29CE484222325;
+
+/*! \brief The multiplier of the 64-bit FNV-1a hash. */
+constexpr uint64_t kFNV1aHashPrime = 0x100000001B3;
+
+/*!
+ * \brief Update the 64-bit FNV-1a hash with a field. Unlike std::hash, the hash is stable across
+ * platforms and builds, so it can key the caches and the fingerprints saved to files.
+ * \note A separator byte is hashed after the field, so that different splits of the same bytes
+ * into consecutive fields give different hashes.
+ */
+inline void UpdateFNV1aHash(uint64_t* hash, std::string_view field) {
+  for (unsigned char c : field) {
+    *hash ^= c;
+    *hash *= kFNV1aHashPrime;
+  }
+  *hash ^= 0xFF;
+  *hash *= kFNV1aHashPrime;
+}
+
+/*!
+ * \brief Update the 64-bit FNV-1a hash with a token id, whose 4 bytes are hashed in the little
+ * endian order. No separator is hashed, as the token ids have a fixed size.
+ */
+inline void UpdateFNV1aHash(uint64_t* hash, int32_t token_id) {
+  for (int i = 0; i < 4; ++i) {
+    *hash ^= (static_cast<uint32_t>(token_id) >> (i * 8)) & 0xFF;
+    *hash *= kFNV1aHashPrime;
+  }
+}
+
+/*!
+ * \brief Update the 64-bit FNV-1a hash with the identity of a model, i.e. its config and the
+ * weight shard records in its ndarray-cache.json. The records identify the model weights without
+ * reading the weights.
+ */
+inline void UpdateFNV1aHashWithModel(uint64_t* hash, const std::string& model_path,
+                                     const picojson::object& model_config) {
+  UpdateFNV1aHash(hash, picojson::value(model_config).serialize());
+  std::ifstream fin(model_path + "/ndarray-cache.json", std::ios::binary);
+  if (fin.good()) {
+    std::ostringstream records;
+    records << fin.rdbuf();
+    UpdateFNV1aHash(hash, records.str());
+  }
+}
+
+/*! \brief Format the hash as 16 hexadecimal digits, e.g. for file names. */
+inline std::string FNV1aHashToString(uint64_t hash) {
+  std::ostringstream os;
+  os << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return os.str();
+}
+
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SUPPORT_HASH_H_
@@ -29,7 +29,7 @@ inline picojson::object ParseToJSONObject(const std::string& json_str) {
   CHECK(err.empty()) << "Failed to parse JSON: err. The JSON string is:" << json_str;
   CHECK(result.is<picojson::object>())
       << "ValueError: The given string is not a JSON object: " << json_str;
-  return result.get<picojson::object>();
+  return std::move(result.get<picojson::object>());
 }
 /*!
  * \brief Parse a JSON string to a JSON object.
@@ -47,7 +47,7 @@ inline Result<picojson::object> ParseToJSONObjectWithResultReturn(const std::str
   if (!result.is<picojson::object>()) {
     return TResult::Error("ValueError: The given string is not a JSON object: " + json_str);
   }
-  return TResult::Ok(result.get<picojson::object>());
+  return TResult::Ok(std::move(result.get<picojson::object>()));
 }
 
 /*!
@@ -0,0 +1,147 @@
+/*!
+ * \file json_writer.h
+ * \brief Helps to write JSON strings directly into a buffer, without building a JSON tree.
+ */
+#ifndef MLC_LLM_SUPPORT_JSON_WRITER_H_
+#define MLC_LLM_SUPPORT_JSON_WRITER_H_
+
+#include <tvm/runtime/logging.h>
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+namespace json {
+
+/*!
+ * \brief The writer that appends compact JSON text to a string buffer. The buffer can be
+ * cleared and reused across writes, so that writing does not allocate once the buffer has
+ * grown to the size of the largest JSON text.
+ */
+class JSONWriter {
+ public:
+  explicit JSONWriter(std::string* buffer) : buffer_(buffer) {}
+
+  void BeginObject() {
+    BeforeValue();
+    buffer_->push_back('{');
+    has_elements_.push_back(false);
+  }
+
+  void EndObject() {
+    ICHECK(!has_elements_.empty() && !after_key_);
+    has_elements_.pop_back();
+    buffer_->push_back('}');
+  }
+
+  void BeginArray() {
+    BeforeValue();
+    buffer_->push_back('[');
+    has_elements_.push_back(false);
+  }
+
+  void EndArray() {
+    ICHECK(!has_elements_.empty());
+    has_elements_.pop_back();
+    buffer_->push_back(']');
+  }
+
+  /*! \brief Write the key of the next value in the current object. */
+  void WriteKey(const std::string& key) {
+    BeforeValue();
+    AppendEscapedString(key);
+    buffer_->push_back(':');
+    after_key_ = true;
+  }
+
+  void WriteString(const std::string& value) {
+    BeforeValue();
+    AppendEscapedString(value);
+  }
+
+  void WriteInt(int64_t value) {
+    BeforeValue();
+    char chars[24];
+    std::to_chars_result result = std::to_chars(chars, chars + sizeof(chars), value);
+    buffer_->append(chars, result.ptr);
+  }
+
+  void WriteBool(bool value) {
+    BeforeValue();
+    buffer_->append(value ? "true" : "false");
+  }
+
+  void WriteNull() {
+    BeforeValue();
+    buffer_->append("null");
+  }
+
+ private:
+  /*! \brief Write the separator before a value or a key when needed. */
+  void BeforeValue() {
+    if (after_key_) {
+      after_key_ = false;
+      return;
+    }
+    if (!has_elements_.empty()) {
+      if (has_elements_.back()) {
+        buffer_->push_back(',');
+      }
+      has_elements_.back() = true;
+    }
+  }
+
+  /*!
+   * \brief Append the quoted string with the characters escaped. The runs of characters that
+   * need no escaping are appended at once.
+   */
+  void AppendEscapedString(const std::string& str) {
+    static const char* kHexDigits = "0123456789abcdef";
+    buffer_->push_back('"');
+    const char* run_begin = str.data();
+    const char* end = str.data() + str.size();
+    for (const char* p = run_begin; p != end; ++p) {
+      unsigned char c = static_cast<unsigned char>(*p);
+      if (c >= 0x20 && c != '"' && c != '\\' && c != 0x7f) {
+        continue;
+      }
+      buffer_->append(run_begin, p);
+      run_begin = p + 1;
+      if (c == '"') {
+        buffer_->append("\\\"");
+      } else if (c == '\\') {
+        buffer_->append("\\\\");
+      } else if (c == '\b') {
+        buffer_->append("\\b");
+      } else if (c == '\f') {
+        buffer_->append("\\f");
+      } else if (c == '\n') {
+        buffer_->append("\\n");
+      } else if (c == '\r') {
+        buffer_->append("\\r");
+      } else if (c == '\t') {
+        buffer_->append("\\t");
+      } else {
+        char escaped[] = {'\\', 'u', '0', '0', kHexDigits[c >> 4], kHexDigits[c & 0xf]};
+        buffer_->append(escaped, sizeof(escaped));
+      }
+    }
+    buffer_->append(run_begin, end);
+    buffer_->push_back('"');
+  }
+
+  std::string* buffer_;
+  /*! \brief Whether each of the current nested objects and arrays has elements. */
+  std::vector<bool> has_elements_;
+  /*! \brief Whether a key was just written, so that the next value follows it directly. */
+  bool after_key_ = false;
+};
+
+}  // namespace json
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SUPPORT_JSON_WRITER_H_
@@ -0,0 +1,96 @@
+/*!
+ * Copyright (c) 2024 by Contributors
+ * \file mpsc_queue.h
+ * \brief The header for the lock-free multi-producer single-consumer queue in MLC LLM.
+ */
+#ifndef MLC_LLM_SUPPORT_MPSC_QUEUE_H_
+#define MLC_LLM_SUPPORT_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <utility>
+
+namespace mlc {
+namespace llm {
+
+/*!
+ * \brief The unbounded lock-free queue with multiple producers and a single consumer.
+ * The elements are kept in a linked list. A producer appends its node with one atomic
+ * exchange, and the consumer pops the nodes without synchronizing with the producers.
+ * \note An element pushed while another producer is in the middle of a push becomes visible
+ * to the consumer only after that push finishes.
+ * \tparam T The element type, which must be default constructible.
+ */
+template <typename T>
+class MPSCQueue {
+ public:
+  MPSCQueue() : head_(new Node()), tail_(head_.load(std::memory_order_relaxed)) {}
+
+  ~MPSCQueue() {
+    while (tail_ != nullptr) {
+      Node* next = tail_->next.load(std::memory_order_relaxed);
+      delete tail_;
+      tail_ = next;
+    }
+  }
+
+  MPSCQueue(const MPSCQueue&) = delete;
+  MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+  /*! \brief Push an element into the queue. It can be called from any thread. */
+  void Push(T value) {
+    Node* node = new Node(std::move(value));
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  /*!
+   * \brief Pop the earliest element from the queue. It can only be called from the consumer.
+   * \return Whether an element is popped.
+   */
+  bool Pop(T* value) {
+    Node* next = tail_->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+    // The popped node becomes the new dummy node at the tail.
+    *value = std::move(next->value);
+    delete tail_;
+    tail_ = next;
+    return true;
+  }
+
+  /*!
+   * \brief Pop all the visible elements and append them to the given container.
+   * It can only be called from the consumer.
+   * \return The number of popped elements.
+   */
+  template <typename TContainer>
+  int PopAll(TContainer* values) {
+    int num_popped = 0;
+    T value;
+    while (Pop(&value)) {
+      values->push_back(std::move(value));
+      ++num_popped;
+    }
+    return num_popped;
+  }
+
+ private:
+  struct Node {
+    Node() = default;
+    explicit Node(T value) : value(std::move(value)) {}
+
+    std::atomic<Node*> next{nullptr};
+    T value;
+  };
+
+  /*! \brief The most recently pushed node, which producers append to. */
+  std::atomic<Node*> head_;
+  /*! \brief The dummy node before the earliest element, owned by the consumer. */
+  Node* tail_;
+};
+
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SUPPORT_MPSC_QUEUE_H_
@@ -0,0 +1,46 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file parallel_for.h
+ * \brief Header of the parallel for loop on the threading backend.
+ */
+
+#ifndef MLC_LLM_PARALLEL_FOR_H_
+#define MLC_LLM_PARALLEL_FOR_H_
+
+#include <tvm/runtime/threading_backend.h>
+
+#include <algorithm>
+#include <atomic>
+
+namespace mlc {
+namespace llm {
+
+/*!
+ * \brief Run the tasks on the threading backend with dynamic load balancing. Instead of
+ * splitting the range evenly, each worker keeps taking the next unprocessed task, so that
+ * the tasks with uneven costs (e.g., different draft lengths) are balanced across workers.
+ * The workers are the persistent thread pool of the threading backend.
+ */
+template <typename FTask>
+void ParallelForDynamic(int64_t num_tasks, const FTask& f_task) {
+  int64_t num_workers = std::min<int64_t>(num_tasks, tvm::runtime::threading::MaxConcurrency());
+  if (num_workers <= 1) {
+    for (int64_t i = 0; i < num_tasks; ++i) {
+      f_task(i);
+    }
+    return;
+  }
+  std::atomic<int64_t> next_task{0};
+  tvm::runtime::parallel_for_with_threading_backend(
+      [&](int) {
+        for (int64_t i = next_task.fetch_add(1); i < num_tasks; i = next_task.fetch_add(1)) {
+          f_task(i);
+        }
+      },
+      0, num_workers);
+}
+
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_PARALLEL_FOR_H_
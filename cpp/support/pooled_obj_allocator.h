@@ -0,0 +1,105 @@
+/*!
+ * Copyright (c) 2024 by Contributors
+ * \file pooled_obj_allocator.h
+ * \brief The header of the TVM object allocator that recycles the storage of freed objects.
+ */
+#ifndef MLC_LLM_SUPPORT_POOLED_OBJ_ALLOCATOR_H_
+#define MLC_LLM_SUPPORT_POOLED_OBJ_ALLOCATOR_H_
+
+#include <tvm/runtime/memory.h>
+#include <tvm/runtime/object.h>
+
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+
+/*!
+ * \brief The TVM object allocator that keeps the storage of the freed objects of each type in
+ * a free list, and reuses it for the next objects of the type. It is for the objects that are
+ * created and freed at a high rate, like the request states of the engine, so that they do not
+ * go through the heap allocator each time. It is used in the place of `make_object`:
+ *
+ *   ObjectPtr<T> n = PooledObjAllocator().make_object<T>(args...);
+ *
+ * \note The objects can be freed on any thread. The free list of each type keeps at most
+ * `kMaxNumFreeObjects` objects, and the storage beyond it is returned to the heap.
+ */
+class PooledObjAllocator : public tvm::runtime::ObjAllocatorBase<PooledObjAllocator> {
+ public:
+  /*! \brief The max number of freed objects kept for reuse, for each type. */
+  static constexpr size_t kMaxNumFreeObjects = 4096;
+
+ private:
+  /*! \brief The free list of the storage of a type. */
+  template <typename StorageType>
+  class FreeList {
+   public:
+    StorageType* Acquire() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!storages_.empty()) {
+          StorageType* storage = storages_.back();
+          storages_.pop_back();
+          return storage;
+        }
+      }
+      return new StorageType();
+    }
+
+    void Release(StorageType* storage) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (storages_.size() < kMaxNumFreeObjects) {
+          storages_.push_back(storage);
+          return;
+        }
+      }
+      delete storage;
+    }
+
+   private:
+    std::mutex mutex_;
+    std::vector<StorageType*> storages_;
+  };
+
+ public:
+  template <typename T>
+  class Handler {
+   public:
+    using StorageType = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+    template <typename... Args>
+    static T* New(PooledObjAllocator*, Args&&... args) {
+      StorageType* data = GetFreeList().Acquire();
+      new (data) T(std::forward<Args>(args)...);
+      return reinterpret_cast<T*>(data);
+    }
+
+    static tvm::runtime::Object::FDeleter Deleter() { return Deleter_; }
+
+   private:
+    static void Deleter_(tvm::runtime::Object* objptr) {
+      T* tptr = static_cast<T*>(objptr);
+      tptr->T::~T();
+      GetFreeList().Release(reinterpret_cast<StorageType*>(tptr));
+    }
+
+    /*!
+     * \brief Get the free list of the type. It is never destructed, so that the objects freed
+     * during the static destruction still have it.
+     */
+    static FreeList<StorageType>& GetFreeList() {
+      static FreeList<StorageType>* free_list = new FreeList<StorageType>();
+      return *free_list;
+    }
+  };
+};
+
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_SUPPORT_POOLED_OBJ_ALLOCATOR_H_
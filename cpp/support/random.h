@@ -7,28 +7,88 @@
 #ifndef MLC_LLM_RANDOM_H_
 #define MLC_LLM_RANDOM_H_
 
+#include <array>
+#include <cstdint>
 #include <random>
 
 namespace mlc {
 namespace llm {
 
-// Random number generator
+/*!
+ * \brief The Philox4x32-10 counter-based random function (Salmon et al., "Parallel random
+ * numbers: as easy as 1, 2, 3"). It maps a 128-bit counter and a 64-bit key to four random
+ * 32-bit integers, without any state. So the random numbers of a position can be computed
+ * directly from the (key, position), in any order and on any device, which makes the
+ * results independent of the order and the batches they are drawn in.
+ * \param counter The 128-bit counter, as four 32-bit words.
+ * \param key The 64-bit key, as two 32-bit words.
+ * \return The four random 32-bit integers.
+ */
+inline std::array<uint32_t, 4> Philox4x32(std::array<uint32_t, 4> counter,
+                                          std::array<uint32_t, 2> key) {
+  constexpr uint32_t kMultiplier0 = 0xD2511F53;
+  constexpr uint32_t kMultiplier1 = 0xCD9E8D57;
+  constexpr uint32_t kWeyl0 = 0x9E3779B9;
+  constexpr uint32_t kWeyl1 = 0xBB67AE85;
+  for (int round = 0; round < 10; ++round) {
+    uint64_t product0 = static_cast<uint64_t>(kMultiplier0) * counter[0];
+    uint64_t product1 = static_cast<uint64_t>(kMultiplier1) * counter[2];
+    counter = {static_cast<uint32_t>(product1 >> 32) ^ counter[1] ^ key[0],
+               static_cast<uint32_t>(product1),
+               static_cast<uint32_t>(product0 >> 32) ^ counter[3] ^ key[1],
+               static_cast<uint32_t>(product0)};
+    key[0] += kWeyl0;
+    key[1] += kWeyl1;
+  }
+  return counter;
+}
+
+/*!
+ * \brief Random number generator. It is counter-based on Philox4x32-10, keyed by the seed, so
+ * that the state is only the seed and the number of drawn values, and the i-th number of a
+ * seed is the same wherever it is drawn.
+ */
 class RandomGenerator {
  private:
-  std::mt19937 gen;
-  std::uniform_real_distribution<> dis;
+  /*! \brief The Philox key derived from the seed. */
+  std::array<uint32_t, 2> key_;
+  /*! \brief The index of the next Philox block. */
+  uint64_t counter_ = 0;
+  /*! \brief The random integers of the current block. */
+  std::array<uint32_t, 4> block_;
+  /*! \brief The number of integers of the current block that are used. */
+  int num_used_ = 4;
 
  public:
-  RandomGenerator(int seed = std::random_device{}()) : gen(seed), dis(0.0, 1.0) {}
+  RandomGenerator(int seed = std::random_device{}()) { SetSeed(seed); }
 
   static RandomGenerator& GetInstance(int seed = std::random_device{}()) {
     static RandomGenerator instance(seed);
     return instance;
   }
 
-  double GetRandomNumber() { return dis(gen); }
+  /*! \brief Get a random number in [0, 1) with 53 random bits, from two 32-bit integers. */
+  double GetRandomNumber() {
+    if (num_used_ == 4) {
+      block_ = Philox4x32({static_cast<uint32_t>(counter_), static_cast<uint32_t>(counter_ >> 32),
+                           0, 0},
+                          key_);
+      ++counter_;
+      num_used_ = 0;
+    }
+    uint64_t high = block_[num_used_] >> 5;
+    uint64_t low = block_[num_used_ + 1] >> 6;
+    num_used_ += 2;
+    return static_cast<double>((high << 26) | low) * (1.0 / 9007199254740992.0);
+  }
 
-  void SetSeed(int seed) { gen.seed(seed); }
+  void SetSeed(int seed) {
+    // The seed is the low word of the key, and the high word is a constant, so that small seeds
+    // still give a key with mixed bits.
+    key_ = {static_cast<uint32_t>(seed), 0x6A09E667};
+    counter_ = 0;
+    num_used_ = 4;
+  }
 };
 
 }  // namespace llm
@@ -0,0 +1,289 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file token_table.cc
+ */
+#include "token_table.h"
+
+#include <tvm/runtime/logging.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+#include <unordered_map>
+
+#include "./support/hash.h"
+
+namespace mlc {
+namespace llm {
+
+/*! \brief The magic number at the beginning of token table files. */
+constexpr uint64_t kTokenTableMagic = 0x4D4C43544B544231;  // "MLCTKTB1"
+/*! \brief The version of the token table file format. */
+constexpr uint32_t kTokenTableVersion = 1;
+
+/*!
+ * \brief The header of the serialized token table, which is followed by the offsets of the
+ * tokens (uint32 * (num_tokens + 1)), the sorted token ids (int32 * num_tokens) and the blob of
+ * the token strings. The same layout is used for the tables in memory and in cache files.
+ */
+struct TokenTableHeader {
+  uint64_t magic;
+  uint32_t version;
+  int32_t num_tokens;
+  /*! \brief The fingerprint of the tokenizer files, or 0 for the tables created in memory. */
+  uint64_t source_fingerprint;
+  uint64_t blob_size;
+};
+static_assert(sizeof(TokenTableHeader) == 32, "The token table header must be packed.");
+
+/*!
+ * \brief Serialize the token strings into the token table layout.
+ * \param num_bytes The size of the serialized table in bytes, as the output.
+ * \return The serialized table, padded to a multiple of 8 bytes.
+ */
+inline std::vector<uint64_t> SerializeTokenTable(const std::vector<std::string>& tokens,
+                                                 uint64_t source_fingerprint, size_t* num_bytes) {
+  CHECK_LE(tokens.size(), static_cast<size_t>(std::numeric_limits<int32_t>::max()));
+  int32_t num_tokens = tokens.size();
+  uint64_t blob_size = 0;
+  for (const std::string& token : tokens) {
+    blob_size += token.size();
+  }
+  CHECK_LE(blob_size, std::numeric_limits<uint32_t>::max()) << "The token table is too large.";
+  // std::string compares the characters as unsigned bytes.
+  std::vector<int32_t> sorted_token_ids(num_tokens);
+  std::iota(sorted_token_ids.begin(), sorted_token_ids.end(), 0);
+  std::sort(sorted_token_ids.begin(), sorted_token_ids.end(), [&](int32_t a, int32_t b) {
+    int cmp = tokens[a].compare(tokens[b]);
+    return cmp < 0 || (cmp == 0 && a < b);
+  });
+
+  TokenTableHeader header{kTokenTableMagic, kTokenTableVersion, num_tokens, source_fingerprint,
+                          blob_size};
+  size_t offsets_bytes = (static_cast<size_t>(num_tokens) + 1) * sizeof(uint32_t);
+  size_t sorted_bytes = static_cast<size_t>(num_tokens) * sizeof(int32_t);
+  *num_bytes = sizeof(header) + offsets_bytes + sorted_bytes + blob_size;
+  std::vector<uint64_t> data((*num_bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+  char* ptr = reinterpret_cast<char*>(data.data());
+  std::memcpy(ptr, &header, sizeof(header));
+  ptr += sizeof(header);
+  uint32_t* offsets = reinterpret_cast<uint32_t*>(ptr);
+  offsets[0] = 0;
+  for (int32_t i = 0; i < num_tokens; ++i) {
+    offsets[i + 1] = offsets[i] + tokens[i].size();
+  }
+  ptr += offsets_bytes;
+  std::memcpy(ptr, sorted_token_ids.data(), sorted_bytes);
+  ptr += sorted_bytes;
+  for (const std::string& token : tokens) {
+    std::memcpy(ptr, token.data(), token.size());
+    ptr += token.size();
+  }
+  return data;
+}
+
+/*!
+ * \brief Get the fingerprint of the tokenizer files in the model directory, which identifies the
+ * token table in the cache file without loading the tokenizer.
+ */
+inline uint64_t GetTokenizerFingerprint(const std::string& model_path,
+                                        const std::string& postproc_method) {
+  uint64_t hash = kFNV1aHashOffsetBasis;
+  UpdateFNV1aHash(&hash, std::to_string(kTokenTableVersion));
+  UpdateFNV1aHash(&hash, postproc_method);
+  // The files read by Tokenizer::FromPath.
+  for (const char* name : {"tokenizer.json", "tokenizer.model", "tokenizer_model", "vocab.json",
+                           "merges.txt", "added_tokens.json"}) {
+    std::filesystem::path path = std::filesystem::path(model_path) / name;
+    std::error_code error;
+    uintmax_t file_size = std::filesystem::file_size(path, error);
+    if (error) {
+      continue;
+    }
+    auto write_time = std::filesystem::last_write_time(path, error);
+    UpdateFNV1aHash(&hash, name);
+    UpdateFNV1aHash(&hash, std::to_string(file_size));
+    UpdateFNV1aHash(&hash, std::to_string(error ? 0 : write_time.time_since_epoch().count()));
+  }
+  return hash;
+}
+
+/*!
+ * \brief Write the serialized table to the cache file. The table is written to a temporary path
+ * first and then renamed, so that readers in other processes never see a partial file.
+ * \return Whether the file is written.
+ */
+inline bool WriteTokenTableFile(const std::string& path, const std::vector<uint64_t>& data,
+                                size_t num_bytes) {
+  std::ostringstream tmp_path;
+  tmp_path << path << ".tmp" << std::hex
+           << std::chrono::steady_clock::now().time_since_epoch().count()
+           << reinterpret_cast<uintptr_t>(data.data());
+  std::error_code error;
+  {
+    std::ofstream fout(tmp_path.str(), std::ios::binary);
+    fout.write(reinterpret_cast<const char*>(data.data()), num_bytes);
+    if (!fout.good()) {
+      fout.close();
+      std::filesystem::remove(tmp_path.str(), error);
+      return false;
+    }
+  }
+  std::filesystem::rename(tmp_path.str(), path, error);
+  if (error) {
+    std::filesystem::remove(tmp_path.str(), error);
+    return false;
+  }
+  return true;
+}
+
+TokenTable::~TokenTable() {
+#ifndef _WIN32
+  if (mapped_data_ != nullptr) {
+    munmap(mapped_data_, mapped_size_);
+  }
+#endif
+}
+
+bool TokenTable::Bind(const char* data, size_t size) {
+  TokenTableHeader header;
+  if (size < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (header.magic != kTokenTableMagic || header.version != kTokenTableVersion ||
+      header.num_tokens < 0) {
+    return false;
+  }
+  uint64_t num_tokens = header.num_tokens;
+  if (size != sizeof(header) + (num_tokens + 1) * sizeof(uint32_t) +
+                  num_tokens * sizeof(int32_t) + header.blob_size) {
+    return false;
+  }
+  const uint32_t* offsets = reinterpret_cast<const uint32_t*>(data + sizeof(header));
+  const int32_t* sorted_token_ids = reinterpret_cast<const int32_t*>(offsets + num_tokens + 1);
+  if (offsets[0] != 0 || offsets[num_tokens] != header.blob_size) {
+    return false;
+  }
+  for (uint64_t i = 0; i < num_tokens; ++i) {
+    if (offsets[i] > offsets[i + 1] || sorted_token_ids[i] < 0 ||
+        sorted_token_ids[i] >= header.num_tokens) {
+      return false;
+    }
+  }
+  source_fingerprint_ = header.source_fingerprint;
+  size_ = header.num_tokens;
+  offsets_ = offsets;
+  sorted_token_ids_ = sorted_token_ids;
+  blob_ = reinterpret_cast<const char*>(sorted_token_ids + num_tokens);
+  return true;
+}
+
+std::shared_ptr<const TokenTable> TokenTable::FromData(std::vector<uint64_t> data,
+                                                       size_t num_bytes) {
+  std::shared_ptr<TokenTable> table(new TokenTable());
+  table->owned_data_ = std::move(data);
+  if (!table->Bind(reinterpret_cast<const char*>(table->owned_data_.data()), num_bytes)) {
+    return nullptr;
+  }
+  return table;
+}
+
+std::shared_ptr<const TokenTable> TokenTable::MapFile(const std::string& path,
+                                                      uint64_t source_fingerprint) {
+  std::shared_ptr<TokenTable> table;
+#ifndef _WIN32
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  void* data = MAP_FAILED;
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+    data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  table.reset(new TokenTable());
+  table->mapped_data_ = data;
+  table->mapped_size_ = file_stat.st_size;
+  if (!table->Bind(static_cast<const char*>(data), file_stat.st_size)) {
+    return nullptr;
+  }
+#else
+  std::ifstream fin(path, std::ios::binary);
+  if (!fin.good()) {
+    return nullptr;
+  }
+  std::string bytes((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+  std::vector<uint64_t> data((bytes.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+  std::memcpy(data.data(), bytes.data(), bytes.size());
+  table.reset(new TokenTable());
+  table->owned_data_ = std::move(data);
+  if (!table->Bind(reinterpret_cast<const char*>(table->owned_data_.data()), bytes.size())) {
+    return nullptr;
+  }
+#endif
+  if (table->source_fingerprint_ != source_fingerprint) {
+    return nullptr;
+  }
+  return table;
+}
+
+std::shared_ptr<const TokenTable> TokenTable::FromTokens(const std::vector<std::string>& tokens) {
+  size_t num_bytes = 0;
+  std::vector<uint64_t> data = SerializeTokenTable(tokens, 0, &num_bytes);
+  std::shared_ptr<const TokenTable> table = FromData(std::move(data), num_bytes);
+  ICHECK(table != nullptr);
+  return table;
+}
+
+std::shared_ptr<const TokenTable> TokenTable::LoadOrCreate(
+    const std::string& model_path, const std::string& postproc_method,
+    const std::function<std::vector<std::string>()>& f_create_tokens) {
+  static std::mutex mutex;
+  static std::unordered_map<std::string, std::weak_ptr<const TokenTable>> tables;
+  std::string path =
+      (std::filesystem::path(model_path) / ("token_table." + postproc_method + ".bin")).string();
+  uint64_t source_fingerprint = GetTokenizerFingerprint(model_path, postproc_method);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  std::shared_ptr<const TokenTable> table = tables[path].lock();
+  if (table != nullptr && table->source_fingerprint_ == source_fingerprint) {
+    return table;
+  }
+  table = MapFile(path, source_fingerprint);
+  if (table == nullptr) {
+    size_t num_bytes = 0;
+    std::vector<uint64_t> data =
+        SerializeTokenTable(f_create_tokens(), source_fingerprint, &num_bytes);
+    if (WriteTokenTableFile(path, data, num_bytes)) {
+      table = MapFile(path, source_fingerprint);
+    }
+    if (table == nullptr) {
+      table = FromData(std::move(data), num_bytes);
+      ICHECK(table != nullptr);
+    }
+  }
+  tables[path] = table;
+  return table;
+}
+
+}  // namespace llm
+}  // namespace mlc
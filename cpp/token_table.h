@@ -0,0 +1,107 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file token_table.h
+ * \brief The immutable post-processed token table shared by the consumers of the tokenizer.
+ */
+#ifndef MLC_LLM_TOKEN_TABLE_H_
+#define MLC_LLM_TOKEN_TABLE_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mlc {
+namespace llm {
+
+/*!
+ * \brief The post-processed token table (see Tokenizer::PostProcessTokenTable) in a flat layout:
+ * the token strings concatenated in a byte blob, the offset of each token in the blob, and the
+ * token ids sorted by their strings. The table is immutable, so the engine, the grammar init
+ * contexts and the stop string handlers share one table instead of each holding a copy of the
+ * token strings.
+ *
+ * The table of a model is cached as a file in the model directory, which is memory-mapped by
+ * every engine in every process serving the model, so that the post-processing and the sorting
+ * of the vocabulary run once per model rather than once per engine and per consumer.
+ */
+class TokenTable {
+ public:
+  /*! \brief Create the table in memory from the post-processed token strings. */
+  static std::shared_ptr<const TokenTable> FromTokens(const std::vector<std::string>& tokens);
+
+  /*!
+   * \brief Get the table of a model. The table is mapped from the cache file in the model
+   * directory, or is created and saved to the cache file when the file is missing or outdated.
+   * The cache file is outdated when the tokenizer files of the model change. The tables of the
+   * same cache file are shared within the process. When the cache file cannot be written, e.g.
+   * the model directory is read-only, the table is kept in memory.
+   * \param model_path The model directory, which holds the tokenizer files.
+   * \param postproc_method The post-processing method of the token table.
+   * \param f_create_tokens The function creating the post-processed token strings. It is only
+   * called when the cache file cannot be used.
+   */
+  static std::shared_ptr<const TokenTable> LoadOrCreate(
+      const std::string& model_path, const std::string& postproc_method,
+      const std::function<std::vector<std::string>()>& f_create_tokens);
+
+  ~TokenTable();
+  TokenTable(const TokenTable&) = delete;
+  TokenTable& operator=(const TokenTable&) = delete;
+
+  /*! \brief The number of tokens. Special tokens are included. */
+  int32_t size() const { return size_; }
+
+  /*! \brief The post-processed string of a token. */
+  std::string_view operator[](int32_t token_id) const {
+    return std::string_view(blob_ + offsets_[token_id],
+                            offsets_[token_id + 1] - offsets_[token_id]);
+  }
+
+  /*!
+   * \brief The ids of all the tokens, sorted by their strings in byte order, and by the ids for
+   * equal strings. The array has size() elements.
+   */
+  const int32_t* SortedTokenIds() const { return sorted_token_ids_; }
+
+ private:
+  TokenTable() = default;
+
+  /*! \brief Create the table in memory from the serialized data, or nullptr if invalid. */
+  static std::shared_ptr<const TokenTable> FromData(std::vector<uint64_t> data, size_t num_bytes);
+
+  /*! \brief Map the cache file, or nullptr if it is missing, invalid or outdated. */
+  static std::shared_ptr<const TokenTable> MapFile(const std::string& path,
+                                                   uint64_t source_fingerprint);
+
+  /*!
+   * \brief Point the table into the serialized data, which outlives the table.
+   * \return Whether the data is a valid serialized table.
+   */
+  bool Bind(const char* data, size_t size);
+
+  /*! \brief The serialized data when the table is in memory, aligned for the offsets. */
+  std::vector<uint64_t> owned_data_;
+  /*! \brief The mapped cache file, or nullptr when the table is in memory. */
+  void* mapped_data_ = nullptr;
+  /*! \brief The size of the mapped cache file. */
+  size_t mapped_size_ = 0;
+  /*! \brief The fingerprint of the tokenizer files the table is created from. */
+  uint64_t source_fingerprint_ = 0;
+
+  /*! \brief The number of tokens. */
+  int32_t size_ = 0;
+  /*! \brief The offsets of the tokens in the blob, with size_ + 1 elements. */
+  const uint32_t* offsets_ = nullptr;
+  /*! \brief The token ids sorted by their strings. */
+  const int32_t* sorted_token_ids_ = nullptr;
+  /*! \brief The concatenated token strings. */
+  const char* blob_ = nullptr;
+};
+
+}  // namespace llm
+}  // namespace mlc
+
+#endif  // MLC_LLM_TOKEN_TABLE_H_
@@ -8,14 +8,19 @@
 #include <tokenizers_cpp.h>
 #include <tvm/runtime/logging.h>
 #include <tvm/runtime/registry.h>
+#include <tvm/runtime/threading_backend.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <filesystem>
 #include <fstream>
 #include <string>
 
 #include "./support/encoding.h"
+#include "./support/json_parser.h"
 #include "./support/load_bytes_from_file.h"
+#include "./support/parallel_for.h"
 
 namespace mlc {
 namespace llm {
@@ -32,6 +37,102 @@ std::vector<int32_t> TokenizerObj::Encode(const std::string& text) const {
   return tokenizer->Encode(text);
 }
 
+/*! \brief The shortest text whose ids are cached in EncodeBatch, below which encoding is cheap. */
+constexpr size_t kMinEncodeCacheTextLength = 256;
+/*! \brief The capacity of the encode cache in bytes. */
+constexpr int64_t kEncodeCacheCapacityBytes = 64LL * 1024 * 1024;
+/*! \brief The maximum number of tokenizers encoding in parallel in EncodeBatch. */
+constexpr int kMaxNumEncodeWorkers = 8;
+/*! \brief The shortest total length of texts to encode in parallel. */
+constexpr size_t kMinParallelEncodeLength = 16 * 1024;
+
+std::vector<std::vector<int32_t>> TokenizerObj::EncodeBatch(const std::vector<std::string>& texts) {
+  int num_texts = texts.size();
+  std::vector<std::vector<int32_t>> results(num_texts);
+  // - Look up the cache, and collect the texts to encode.
+  std::vector<int> uncached_text_indices;
+  std::unordered_map<std::string_view, int> first_uncached_index;
+  size_t uncached_length = 0;
+  for (int i = 0; i < num_texts; ++i) {
+    if (texts[i].length() >= kMinEncodeCacheTextLength) {
+      if (const std::vector<int32_t>* token_ids = LookupEncodeCache(texts[i])) {
+        results[i] = *token_ids;
+        continue;
+      }
+      // Encode the duplicate texts in the batch only once.
+      if (!first_uncached_index.emplace(texts[i], i).second) {
+        continue;
+      }
+    }
+    uncached_text_indices.push_back(i);
+    uncached_length += texts[i].length();
+  }
+
+  // - Encode the texts, in parallel with the replicas when the texts are long.
+  int num_workers = std::min<int>({static_cast<int>(uncached_text_indices.size()),
+                                   tvm::runtime::threading::MaxConcurrency(),
+                                   kMaxNumEncodeWorkers});
+  if (path_.empty() || uncached_length < kMinParallelEncodeLength) {
+    num_workers = 1;
+  }
+  while (static_cast<int>(encode_replicas_.size()) < num_workers - 1) {
+    encode_replicas_.push_back(
+        std::move(Tokenizer::FromPathWithoutModelConfig(path_)->tokenizer));
+  }
+  // Assign the longest texts first, for better load balance.
+  std::sort(uncached_text_indices.begin(), uncached_text_indices.end(),
+            [&](int lhs, int rhs) { return texts[lhs].length() > texts[rhs].length(); });
+  std::atomic<int> next_text{0};
+  ParallelForDynamic(num_workers, [&](int64_t worker_id) {
+    tokenizers::Tokenizer* worker_tokenizer =
+        worker_id == 0 ? tokenizer.get() : encode_replicas_[worker_id - 1].get();
+    for (int i = next_text.fetch_add(1); i < static_cast<int>(uncached_text_indices.size());
+         i = next_text.fetch_add(1)) {
+      int text_index = uncached_text_indices[i];
+      results[text_index] = worker_tokenizer->Encode(texts[text_index]);
+    }
+  });
+
+  // - Update the cache, and fill in the duplicate texts.
+  for (int i : uncached_text_indices) {
+    if (texts[i].length() >= kMinEncodeCacheTextLength) {
+      InsertEncodeCache(texts[i], results[i]);
+    }
+  }
+  for (int i = 0; i < num_texts; ++i) {
+    auto it = first_uncached_index.find(texts[i]);
+    if (it != first_uncached_index.end() && it->second != i && results[i].empty()) {
+      results[i] = results[it->second];
+    }
+  }
+  return results;
+}
+
+const std::vector<int32_t>* TokenizerObj::LookupEncodeCache(const std::string& text) {
+  auto it = encode_cache_index_.find(text);
+  if (it == encode_cache_index_.end()) {
+    return nullptr;
+  }
+  encode_cache_.splice(encode_cache_.begin(), encode_cache_, it->second);
+  return &it->second->second;
+}
+
+void TokenizerObj::InsertEncodeCache(const std::string& text, std::vector<int32_t> token_ids) {
+  int64_t num_bytes = text.length() + token_ids.size() * sizeof(int32_t);
+  if (num_bytes > kEncodeCacheCapacityBytes || encode_cache_index_.count(text)) {
+    return;
+  }
+  encode_cache_.emplace_front(text, std::move(token_ids));
+  encode_cache_index_.emplace(encode_cache_.front().first, encode_cache_.begin());
+  encode_cache_bytes_ += num_bytes;
+  while (encode_cache_bytes_ > kEncodeCacheCapacityBytes) {
+    const auto& [evicted_text, evicted_token_ids] = encode_cache_.back();
+    encode_cache_bytes_ -= evicted_text.length() + evicted_token_ids.size() * sizeof(int32_t);
+    encode_cache_index_.erase(evicted_text);
+    encode_cache_.pop_back();
+  }
+}
+
 std::string TokenizerObj::Decode(const std::vector<int32_t>& token_ids) const {
   return tokenizer->Decode(token_ids);
 }
@@ -46,7 +147,31 @@ int32_t TokenizerObj::TokenToId(const std::string& token) const {
   return tokenizer->TokenToId(token);
 }
 
-Tokenizer Tokenizer::FromPath(const String& _path) {
+/*!
+ * \brief Read the post-processing method of the token table from the model config in the given
+ * directory. Return empty when there is no model config.
+ */
+inline std::string ReadTokenPostProcMethod(const std::filesystem::path& model_dir) {
+  std::filesystem::path config_path = model_dir / "mlc-chat-config.json";
+  if (!std::filesystem::exists(config_path)) {
+    return "";
+  }
+  picojson::object config = json::ParseToJSONObject(LoadBytesFromFile(config_path.string()));
+  // Backward compatibility: use "byte_fallback" by default, the same as the engine.
+  return json::LookupOrDefault<std::string>(config, "token_table_postproc_method",
+                                            "byte_fallback");
+}
+
+Tokenizer Tokenizer::FromPath(const String& path) {
+  Tokenizer tokenizer = FromPathWithoutModelConfig(path);
+  tokenizer->path_ = path;
+  std::filesystem::path model_dir(path.operator std::string());
+  tokenizer->token_postproc_method = ReadTokenPostProcMethod(
+      std::filesystem::is_directory(model_dir) ? model_dir : model_dir.parent_path());
+  return tokenizer;
+}
+
+Tokenizer Tokenizer::FromPathWithoutModelConfig(const String& _path) {
   std::filesystem::path path(_path.operator std::string());
   std::filesystem::path sentencepiece;
   std::filesystem::path huggingface;
@@ -152,7 +277,8 @@ inline std::string ByteLevelDecoder(const std::string& token) {
   };
   // clang-format on
 
-  auto unicode_codepoints = ParseUTF8(token.c_str(), UTF8ErrorPolicy::kReturnInvalid);
+  auto unicode_codepoints =
+      ParseUTF8(token.data(), token.size(), UTF8ErrorPolicy::kReturnInvalid);
   ICHECK(unicode_codepoints.size() != 1 || unicode_codepoints[0] != kInvalidUTF8);
   std::string decoded;
 
@@ -197,6 +323,82 @@ const std::vector<std::string>& TokenizerObj::TokenTable() {
   return token_table_;
 }
 
+/*! \brief Check if the token string is likely a special token, e.g. "<s>" and "<|eot_id|>". */
+inline bool IsSpecialTokenLike(const std::string& token) {
+  return token.size() >= 3 && token[0] == '<' && token.back() == '>';
+}
+
+const std::vector<std::string>* TokenizerObj::GetIncrementalDecodeTable(
+    bool* strip_leading_space) {
+  if (!incremental_decode_checked_) {
+    incremental_decode_checked_ = true;
+    if (token_postproc_method.empty()) {
+      return nullptr;
+    }
+    incremental_decode_table_ =
+        Tokenizer::PostProcessTokenTable(TokenTable(), token_postproc_method);
+    // Special tokens are decoded as a whole by the decoder, which may differ from the token
+    // strings (e.g., when special tokens are skipped in decoding).
+    std::vector<int32_t> space_prefixed_ids;
+    std::vector<int32_t> plain_ids;
+    for (int32_t id = 0; id < static_cast<int32_t>(incremental_decode_table_.size()); ++id) {
+      std::string& token = incremental_decode_table_[id];
+      if (IsSpecialTokenLike(token)) {
+        token = Decode({id});
+        continue;
+      }
+      bool is_printable_ascii = !token.empty() && token.size() <= 16 &&
+                                std::all_of(token.begin(), token.end(),
+                                            [](char ch) { return ch >= 32 && ch <= 126; });
+      if (is_printable_ascii) {
+        (token[0] == ' ' ? space_prefixed_ids : plain_ids).push_back(id);
+      }
+    }
+    if (space_prefixed_ids.empty() || plain_ids.empty()) {
+      return nullptr;
+    }
+    // Find whether the decoder strips the leading space, from a token starting with space.
+    const std::string& space_prefixed = incremental_decode_table_[space_prefixed_ids[0]];
+    std::string decoded = Decode({space_prefixed_ids[0]});
+    if (decoded != space_prefixed && decoded != space_prefixed.substr(1)) {
+      return nullptr;
+    }
+    decode_strips_leading_space_ = decoded != space_prefixed;
+    // Check that the decoded text of a few probe token sequences is the concatenation of the
+    // token strings.
+    constexpr int kNumProbes = 8;
+    support_incremental_decode_ = true;
+    for (int i = 0; i < kNumProbes && support_incremental_decode_; ++i) {
+      std::vector<int32_t> probe_ids = {
+          space_prefixed_ids[i * space_prefixed_ids.size() / kNumProbes],
+          plain_ids[i * plain_ids.size() / kNumProbes],
+          space_prefixed_ids[(2 * i + 1) * space_prefixed_ids.size() / (2 * kNumProbes)],
+          plain_ids[(2 * i + 1) * plain_ids.size() / (2 * kNumProbes)]};
+      for (bool starts_with_space : {true, false}) {
+        std::string expected;
+        for (int32_t id : probe_ids) {
+          expected += incremental_decode_table_[id];
+        }
+        if (decode_strips_leading_space_ && starts_with_space) {
+          expected.erase(0, 1);
+        }
+        support_incremental_decode_ &= Decode(probe_ids) == expected;
+        std::rotate(probe_ids.begin(), probe_ids.begin() + 1, probe_ids.end());
+      }
+    }
+    if (!support_incremental_decode_) {
+      LOG(WARNING) << "The decoder of the tokenizer cannot be reproduced by the token table. "
+                      "Fall back to decoding token windows in text streaming.";
+      incremental_decode_table_.clear();
+    }
+  }
+  if (!support_incremental_decode_) {
+    return nullptr;
+  }
+  *strip_leading_space = decode_strips_leading_space_;
+  return &incremental_decode_table_;
+}
+
 std::vector<std::string> Tokenizer::PostProcessTokenTable(
     const std::vector<std::string>& token_table, const std::string& postproc_method) {
   std::vector<std::string> postprocessed_token_table;
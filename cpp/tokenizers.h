@@ -11,7 +11,12 @@
 #include <tvm/runtime/container/string.h>
 #include <tvm/runtime/object.h>
 
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #include "base.h"
 
@@ -28,11 +33,38 @@ class TokenizerObj : public Object {
 
   /*! \brief Encode text into ids. */
   std::vector<int32_t> Encode(const std::string& text) const;
+  /*!
+   * \brief Encode a batch of texts into ids. The texts are encoded in parallel by a pool of
+   * tokenizer replicas when the tokenizer is created from a path. The ids of long texts are
+   * cached by content, so that repeated segments such as system prompts and retrieved
+   * documents are encoded only once.
+   * \note It is safe to call the function from one thread at a time, besides which Encode must
+   * not be called concurrently.
+   */
+  std::vector<std::vector<int32_t>> EncodeBatch(const std::vector<std::string>& texts);
   /*! \brief Decode token ids into text. */
   std::string Decode(const std::vector<int32_t>& token_ids) const;
   /*! \brief Return the token table of the tokenizer. Special tokens are included. */
   const std::vector<std::string>& TokenTable();
 
+  /*!
+   * \brief The post-processing method of the token table, i.e. the type of the decoder of the
+   * tokenizer. See Tokenizer::PostProcessTokenTable. It is read from the model config next to
+   * the tokenizer files, and is empty when unknown.
+   */
+  std::string token_postproc_method;
+
+  /*!
+   * \brief Return the table of decoded token strings for incremental detokenization, with which
+   * the decoded text of tokens is the concatenation of their strings. It is the post-processed
+   * token table, where special tokens are replaced with their decoded text. The table is
+   * checked against the decoder on a few probe tokens when first requested.
+   * \param strip_leading_space Set to whether the decoder strips the leading space of the text.
+   * \return The table, or nullptr when the post-processing method is unknown or the decoder
+   * cannot be reproduced by concatenating the token strings.
+   */
+  const std::vector<std::string>* GetIncrementalDecodeTable(bool* strip_leading_space);
+
   /*!
    * \brief Returns the vocabulary size. Special tokens are considered.
    */
@@ -57,11 +89,45 @@ class TokenizerObj : public Object {
  private:
   /*! \brief The cached token table. */
   std::vector<std::string> token_table_;
+  /*! \brief The cached table for incremental detokenization. */
+  std::vector<std::string> incremental_decode_table_;
+  /*! \brief Whether the incremental detokenization table has been checked. */
+  bool incremental_decode_checked_ = false;
+  /*! \brief Whether the incremental detokenization table reproduces the decoder. */
+  bool support_incremental_decode_ = false;
+  /*! \brief Whether the decoder strips the leading space of the text. */
+  bool decode_strips_leading_space_ = false;
+
+  /*!
+   * \brief Look up the ids of the text in the encode cache, marking them as recently used.
+   * \return The cached ids, or nullptr if the text is not cached.
+   */
+  const std::vector<int32_t>* LookupEncodeCache(const std::string& text);
+  /*! \brief Add the ids of the text to the encode cache, evicting the least recently used. */
+  void InsertEncodeCache(const std::string& text, std::vector<int32_t> token_ids);
+
+  friend class Tokenizer;
+
+  /*! \brief The path that the tokenizer is created from, used to create replicas. */
+  std::string path_;
+  /*! \brief The tokenizer replicas for parallel encoding, created on demand. */
+  std::vector<std::unique_ptr<tokenizers::Tokenizer>> encode_replicas_;
+  /*! \brief The cached texts and ids, from the most recently used to the least. */
+  std::list<std::pair<std::string, std::vector<int32_t>>> encode_cache_;
+  /*! \brief The position of each cached text in the encode cache. */
+  std::unordered_map<std::string_view,
+                     std::list<std::pair<std::string, std::vector<int32_t>>>::iterator>
+      encode_cache_index_;
+  /*! \brief The total bytes of the texts and ids in the encode cache. */
+  int64_t encode_cache_bytes_ = 0;
 };
 
 class Tokenizer : public ObjectRef {
  public:
-  /*! \brief Create a tokenizer from a directory path on disk. */
+  /*!
+   * \brief Create a tokenizer from a directory path on disk. The post-processing method of the
+   * token table is read from the model config in the directory if there is one.
+   */
   MLC_LLM_DLL static Tokenizer FromPath(const String& path);
 
   /*!
@@ -87,6 +153,11 @@ class Tokenizer : public ObjectRef {
 
  private:
   explicit Tokenizer(std::unique_ptr<tokenizers::Tokenizer> tokenizer);
+
+  /*! \brief Create a tokenizer from a path on disk, without reading the model config. */
+  static Tokenizer FromPathWithoutModelConfig(const String& path);
+
+  friend class TokenizerObj;
 };
 
 }  // namespace llm
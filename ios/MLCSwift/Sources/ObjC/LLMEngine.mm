@@ -25,6 +25,7 @@ using namespace tvm::runtime;
   PackedFunc unload_func_;
   PackedFunc reload_func_;
   PackedFunc reset_func_;
+  PackedFunc set_device_power_state_func_;
   PackedFunc chat_completion_func_;
   PackedFunc abort_func_;
   PackedFunc run_background_loop_func_;
@@ -42,6 +43,7 @@ using namespace tvm::runtime;
     reload_func_ = json_ffi_engine_->GetFunction("reload");
     unload_func_ = json_ffi_engine_->GetFunction("unload");
     reset_func_ = json_ffi_engine_->GetFunction("reset");
+    set_device_power_state_func_ = json_ffi_engine_->GetFunction("set_device_power_state");
     chat_completion_func_ = json_ffi_engine_->GetFunction("chat_completion");
     abort_func_ = json_ffi_engine_->GetFunction("abort");
     run_background_loop_func_ = json_ffi_engine_->GetFunction("run_background_loop");
@@ -53,6 +55,7 @@ using namespace tvm::runtime;
     ICHECK(reload_func_ != nullptr);
     ICHECK(unload_func_ != nullptr);
     ICHECK(reset_func_ != nullptr);
+    ICHECK(set_device_power_state_func_ != nullptr);
     ICHECK(chat_completion_func_ != nullptr);
     ICHECK(abort_func_ != nullptr);
     ICHECK(run_background_loop_func_ != nullptr);
@@ -84,6 +87,11 @@ using namespace tvm::runtime;
   reset_func_();
 }
 
+- (void)setDevicePowerState:(NSString*)devicePowerState {
+  std::string device_power_state = devicePowerState.UTF8String;
+  set_device_power_state_func_(device_power_state);
+}
+
 - (void)chatCompletion:(NSString*)requestJSON requestID:(NSString*)requestID {
   std::string request_json = requestJSON.UTF8String;
   std::string request_id = requestID.UTF8String;
@@ -19,6 +19,8 @@
 
 - (void)reset;
 
+- (void)setDevicePowerState:(NSString*)devicePowerState;
+
 - (void)chatCompletion:(NSString*)requestJSON requestID:(NSString*)requestID;
 
 - (void)abort:(NSString*)requestID;
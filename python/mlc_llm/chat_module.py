@@ -186,6 +186,11 @@ class ChatConfig(ConfigBase):  # pylint: disable=too-many-instance-attributes
         This optional field overrides the `sliding_window_size` in config.json for
         those models that use SWA. Currently only useful when compiling Mistral.
         This flag subjects to future refactoring.
+    reuse_kv_cache : Optional[bool]
+        If True, the KV cache is kept when the chat is reset or the context window is shifted,
+        and the next prefill reuses the common prefix of the cached tokens and the new prompt
+        (e.g., the system prompt) instead of recomputing it. Only effective for models with
+        paged KV cache and without sliding window.
     opt : Optional[str]
         Optimization flags. MLC LLM maintains a predefined set of optimization flags,
         denoted as O0, O1, O2, O3, where O0 means no optimization, O2 means majority of them,
@@ -216,6 +221,7 @@ class ChatConfig(ConfigBase):  # pylint: disable=too-many-instance-attributes
     prefill_chunk_size: Optional[int] = None
     attention_sink_size: Optional[int] = None
     max_batch_size: Optional[int] = None
+    reuse_kv_cache: Optional[bool] = None
     opt: Optional[str] = None
     kwargs: Dict[str, Any] = dataclasses.field(default_factory=dict)
 
@@ -30,6 +30,13 @@ class AttachLogitProcessFunc:  # pylint: disable=too-few-public-methods
         mod["apply_logit_bias_inplace"] = _get_apply_logit_bias_inplace(self.target)
         mod["apply_penalty_inplace"] = _get_apply_penalty_inplace(self.target)
         mod["apply_bitmask_inplace"] = _get_apply_bitmask_inplace(self.target)
+        mod["apply_logit_bias_and_penalty_inplace"] = _get_apply_logit_bias_and_penalty_inplace(
+            self.target
+        )
+        mod["update_token_cnt_table_inplace"] = _get_update_token_cnt_table_inplace(self.target)
+        mod["apply_penalty_from_table_inplace"] = _get_apply_penalty_from_table_inplace(
+            self.target
+        )
         return mod
 
 
@@ -170,3 +177,169 @@ def _get_apply_bitmask_inplace(target: tvm.target.Target):
                     )
 
     return _apply_bitmask_inplace
+
+
+def _get_apply_logit_bias_and_penalty_inplace(target: tvm.target.Target):
+    tx = 1024  # default
+    max_num_threads_per_block = get_max_num_threads_per_block(target)
+    if max_num_threads_per_block < tx:
+        tx = max_num_threads_per_block
+    check_thread_limits(target, bdx=tx, bdy=1, bdz=1, gdz=1)
+
+    @T.prim_func
+    def _apply_logit_bias_and_penalty_inplace(  # pylint: disable=too-many-arguments,too-many-locals
+        var_logits: T.handle,
+        var_pos2seq_id: T.handle,
+        var_token_ids: T.handle,
+        var_token_cnt: T.handle,
+        var_logit_bias: T.handle,
+        var_penalties: T.handle,
+    ) -> None:
+        """Function that applies logit bias and then penalties in place in a single pass.
+        Each entry is a (sequence, token) pair that has logit bias, or has appeared in the
+        sequence when the token count is positive."""
+        T.func_attr(
+            {
+                "global_symbol": "apply_logit_bias_and_penalty_inplace",
+                "tir.noalias": True,
+                "tir.is_scheduled": True,
+            }
+        )
+        batch_size = T.int32(is_size_var=True)
+        vocab_size = T.int32(is_size_var=True)
+        num_token = T.int32(is_size_var=True)
+        logits = T.match_buffer(var_logits, (batch_size, vocab_size), "float32")
+        pos2seq_id = T.match_buffer(var_pos2seq_id, (num_token,), "int32")
+        token_ids = T.match_buffer(var_token_ids, (num_token,), "int32")
+        token_cnt = T.match_buffer(var_token_cnt, (num_token,), "int32")
+        logit_bias = T.match_buffer(var_logit_bias, (num_token,), "float32")
+        penalties = T.match_buffer(var_penalties, (batch_size, 3), "float32")
+
+        for p0 in T.thread_binding(0, (num_token + tx - 1) // tx, "blockIdx.x"):
+            for p1 in T.thread_binding(0, tx, "threadIdx.x"):
+                with T.block("block"):
+                    vp = T.axis.spatial(num_token, p0 * tx + p1)
+                    T.where(p0 * tx + p1 < num_token)
+                    logits[pos2seq_id[vp], token_ids[vp]] += logit_bias[vp]
+                    # Penalties: (presence_penalty, frequency_penalty, repetition_penalty)
+                    logits[pos2seq_id[vp], token_ids[vp]] = T.if_then_else(
+                        token_cnt[vp] > 0,
+                        logits[pos2seq_id[vp], token_ids[vp]]
+                        - (
+                            penalties[pos2seq_id[vp], 0]
+                            + token_cnt[vp] * penalties[pos2seq_id[vp], 1]
+                        ),
+                        logits[pos2seq_id[vp], token_ids[vp]],
+                    )
+                    logits[pos2seq_id[vp], token_ids[vp]] = T.if_then_else(
+                        token_cnt[vp] > 0,
+                        T.if_then_else(
+                            logits[pos2seq_id[vp], token_ids[vp]] > 0,
+                            logits[pos2seq_id[vp], token_ids[vp]] * penalties[pos2seq_id[vp], 2],
+                            logits[pos2seq_id[vp], token_ids[vp]] / penalties[pos2seq_id[vp], 2],
+                        ),
+                        logits[pos2seq_id[vp], token_ids[vp]],
+                    )
+
+    return _apply_logit_bias_and_penalty_inplace
+
+
+def _get_update_token_cnt_table_inplace(target: tvm.target.Target):
+    tx = 1024  # default
+    max_num_threads_per_block = get_max_num_threads_per_block(target)
+    if max_num_threads_per_block < tx:
+        tx = max_num_threads_per_block
+    check_thread_limits(target, bdx=tx, bdy=1, bdz=1, gdz=1)
+
+    @T.prim_func
+    def _update_token_cnt_table_inplace(
+        var_token_cnt_table: T.handle,
+        var_slot_ids: T.handle,
+        var_token_ids: T.handle,
+        var_token_cnt_delta: T.handle,
+    ) -> None:
+        """Function that adds the deltas to the token count table in place.
+        The (slot, token) pairs of the entries are distinct."""
+        T.func_attr(
+            {
+                "global_symbol": "update_token_cnt_table_inplace",
+                "tir.noalias": True,
+                "tir.is_scheduled": True,
+            }
+        )
+        num_slot = T.int32(is_size_var=True)
+        vocab_size = T.int32(is_size_var=True)
+        num_token = T.int32(is_size_var=True)
+        token_cnt_table = T.match_buffer(var_token_cnt_table, (num_slot, vocab_size), "int32")
+        slot_ids = T.match_buffer(var_slot_ids, (num_token,), "int32")
+        token_ids = T.match_buffer(var_token_ids, (num_token,), "int32")
+        token_cnt_delta = T.match_buffer(var_token_cnt_delta, (num_token,), "int32")
+
+        for p0 in T.thread_binding(0, (num_token + tx - 1) // tx, "blockIdx.x"):
+            for p1 in T.thread_binding(0, tx, "threadIdx.x"):
+                with T.block("block"):
+                    vp = T.axis.spatial(num_token, p0 * tx + p1)
+                    T.where(p0 * tx + p1 < num_token)
+                    token_cnt_table[slot_ids[vp], token_ids[vp]] += token_cnt_delta[vp]
+
+    return _update_token_cnt_table_inplace
+
+
+def _get_apply_penalty_from_table_inplace(target: tvm.target.Target):
+    tx = 1024  # default
+    max_num_threads_per_block = get_max_num_threads_per_block(target)
+    if max_num_threads_per_block < tx:
+        tx = max_num_threads_per_block
+    check_thread_limits(target, bdx=tx, bdy=1, bdz=1, gdz=1)
+
+    @T.prim_func
+    def _apply_penalty_from_table_inplace(  # pylint: disable=too-many-arguments,too-many-locals
+        var_logits: T.handle,
+        var_seq_ids: T.handle,
+        var_slot_ids: T.handle,
+        var_token_cnt_table: T.handle,
+        var_penalties: T.handle,
+    ) -> None:
+        """Function that applies penalties in place, with the token counts of each sequence
+        read from its slot of the token count table."""
+        T.func_attr(
+            {
+                "global_symbol": "apply_penalty_from_table_inplace",
+                "tir.noalias": True,
+                "tir.is_scheduled": True,
+            }
+        )
+        batch_size = T.int32(is_size_var=True)
+        vocab_size = T.int32(is_size_var=True)
+        num_seq = T.int32(is_size_var=True)
+        num_slot = T.int32(is_size_var=True)
+        logits = T.match_buffer(var_logits, (batch_size, vocab_size), "float32")
+        seq_ids = T.match_buffer(var_seq_ids, (num_seq,), "int32")
+        slot_ids = T.match_buffer(var_slot_ids, (num_seq,), "int32")
+        token_cnt_table = T.match_buffer(var_token_cnt_table, (num_slot, vocab_size), "int32")
+        penalties = T.match_buffer(var_penalties, (num_seq, 3), "float32")
+
+        for fused_s_v_0 in T.thread_binding(0, (num_seq * vocab_size + tx - 1) // tx, "blockIdx.x"):
+            for fused_s_v_1 in T.thread_binding(0, tx, "threadIdx.x"):
+                with T.block("block"):
+                    vs = T.axis.spatial(num_seq, (fused_s_v_0 * tx + fused_s_v_1) // vocab_size)
+                    vv = T.axis.spatial(vocab_size, (fused_s_v_0 * tx + fused_s_v_1) % vocab_size)
+                    T.where(fused_s_v_0 * tx + fused_s_v_1 < num_seq * vocab_size)
+                    # Penalties: (presence_penalty, frequency_penalty, repetition_penalty)
+                    logits[seq_ids[vs], vv] = T.if_then_else(
+                        token_cnt_table[slot_ids[vs], vv] > 0,
+                        logits[seq_ids[vs], vv]
+                        - (penalties[vs, 0] + token_cnt_table[slot_ids[vs], vv] * penalties[vs, 1]),
+                        logits[seq_ids[vs], vv],
+                    )
+                    logits[seq_ids[vs], vv] = T.if_then_else(
+                        token_cnt_table[slot_ids[vs], vv] > 0,
+                        T.if_then_else(
+                            logits[seq_ids[vs], vv] > 0,
+                            logits[seq_ids[vs], vv] * penalties[vs, 2],
+                            logits[seq_ids[vs], vv] / penalties[vs, 2],
+                        ),
+                        logits[seq_ids[vs], vv],
+                    )
+
+    return _apply_penalty_from_table_inplace
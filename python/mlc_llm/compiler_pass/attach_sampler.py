@@ -8,7 +8,10 @@ from tvm.relax.frontend import nn
 from tvm.script import tir as T
 
 from mlc_llm.op.batch_spec_verify import batch_spec_verify
-from mlc_llm.op.top_p_pivot import top_p_pivot, top_p_renorm
+from mlc_llm.op.top_p_pivot import top_k_min_p_pivot, top_p_pivot, top_p_renorm
+
+# The maximum number of top probs of each sampled position, i.e. the bound of "top_logprobs".
+_MAX_NUM_TOP_PROBS = 5
 
 
 @tvm.transform.module_pass(opt_level=0, name="AttachGPUSamplingFunc")
@@ -40,8 +43,10 @@ class AttachGPUSamplingFunc:  # pylint: disable=too-few-public-methods
                 _attach_argsort_func(bb),
                 _attach_sample_with_top_p(bb),
                 _attach_take_probs_func(bb),
+                _attach_take_top_probs_func(bb),
                 _attach_batch_verifier(bb),
                 _attach_renormalize_by_top_p(bb, self.target),
+                _attach_renormalize_by_top_k_min_p(bb, self.target),
             ]
         ]
 
@@ -249,6 +254,34 @@ def _attach_renormalize_by_top_p(bb: relax.BlockBuilder, target: tvm.target.Targ
     return gv
 
 
+def _attach_renormalize_by_top_k_min_p(bb: relax.BlockBuilder, target: tvm.target.Target):
+    batch_size = tir.Var("batch_size", "int64")
+    vocab_size = tir.Var("vocab_size", "int64")
+    probs = relax.Var("probs", relax.TensorStructInfo((batch_size, vocab_size), "float32"))
+    top_k = relax.Var("top_k", relax.TensorStructInfo((batch_size,), "int32"))
+    min_p = relax.Var("min_p", relax.TensorStructInfo((batch_size,), "float32"))
+    with bb.function("renormalize_by_top_k_min_p", [probs, top_k, min_p]):
+        with bb.dataflow():
+            cutoff_output = bb.emit(
+                relax.call_tir(
+                    bb.add_func(top_k_min_p_pivot(target), "top_k_min_p_pivot_cutoff"),
+                    args=[probs, top_k, min_p],
+                    out_sinfo=[min_p.struct_info, min_p.struct_info],  # pylint: disable=no-member
+                )
+            )
+            final_pivot = cutoff_output[0]
+            renorm_sum = cutoff_output[1]
+            renormalized_probs = bb.emit_output(
+                relax.call_tir(
+                    bb.add_func(top_p_renorm(target), "top_k_min_p_renorm_after_cutoff"),
+                    args=[probs, final_pivot, renorm_sum],
+                    out_sinfo=probs.struct_info,  # pylint: disable=no-member
+                )
+            )
+        gv = bb.emit_func_output(renormalized_probs)
+    return gv
+
+
 def _attach_take_probs_func(bb: relax.BlockBuilder):
     batch_size = tir.Var("batch_size", "int64")
     num_samples = tir.Var("num_samples", "int64")
@@ -319,6 +352,104 @@ def _attach_take_probs_func(bb: relax.BlockBuilder):
     return gv
 
 
+def _attach_take_top_probs_func(bb: relax.BlockBuilder):  # pylint: disable=too-many-locals
+    """Take the sampled probs and the top probs without sorting the probs. The top probs are
+    selected by `_MAX_NUM_TOP_PROBS` rounds of argmax over the vocabulary, each below the
+    previous one. The top prob offsets index the (batch_size, _MAX_NUM_TOP_PROBS) top probs."""
+    batch_size = tir.Var("batch_size", "int64")
+    num_samples = tir.Var("num_samples", "int64")
+    num_positions = tir.Var("num_positions", "int64")
+    vocab_size = tir.Var("vocab_size", "int64")
+    probs = relax.Var("probs", relax.TensorStructInfo((batch_size, vocab_size), "float32"))
+    sample_indices = relax.Var("sample_indices", relax.TensorStructInfo((num_samples,), "int32"))
+    sampling_results = relax.Var("sampling_result", relax.TensorStructInfo((num_samples,), "int32"))
+    top_prob_offsets = relax.Var(
+        "top_prob_offsets", relax.TensorStructInfo((num_positions,), "int32")
+    )
+
+    def fcombine(lhs, rhs):
+        # The larger prob goes first, and the smaller token id breaks the tie.
+        take_lhs = tir.Or(lhs[1] > rhs[1], tir.And(lhs[1] == rhs[1], lhs[0] < rhs[0]))
+        return tir.Select(take_lhs, lhs[0], rhs[0]), tir.Select(take_lhs, lhs[1], rhs[1])
+
+    def fidentity(index_dtype, value_dtype):
+        return tir.const(-1, index_dtype), tir.min_value(value_dtype)
+
+    argmax = te.comm_reducer(fcombine, fidentity, name="argmax")
+
+    def take_top_probs_te(probs, sample_indices, sampling_results, top_prob_offsets):
+        top_indices = []
+        top_values = []
+        for rank in range(_MAX_NUM_TOP_PROBS):
+            k = te.reduce_axis((0, vocab_size), name="k")
+
+            def below_previous(i, j, rank=rank):
+                if rank == 0:
+                    return tir.const(True)
+                prev_index, prev_value = top_indices[rank - 1], top_values[rank - 1]
+                return tir.Or(
+                    probs[i, j] < prev_value[i],
+                    tir.And(probs[i, j] == prev_value[i], j.astype("int32") > prev_index[i]),
+                )
+
+            index, value = te.compute(
+                (batch_size,),
+                lambda i, k=k, below_previous=below_previous: argmax(
+                    (
+                        k.var.astype("int32"),
+                        tir.Select(
+                            below_previous(i, k.var), probs[i, k], tir.min_value("float32")
+                        ),
+                    ),
+                    axis=k,
+                ),
+                name=f"top_prob_{rank}",
+            )
+            top_indices.append(index)
+            top_values.append(value)
+
+        def take_rank(tensors, row, rank):
+            result = tensors[-1][row]
+            for r in reversed(range(_MAX_NUM_TOP_PROBS - 1)):
+                result = tir.Select(rank == r, tensors[r][row], result)
+            return result
+
+        sampled_values = te.compute(
+            (num_samples,),
+            lambda i: probs[sample_indices[i], sampling_results[i]],
+            name="sampled_values",
+        )
+        top_prob_probs = te.compute(
+            (num_positions,),
+            lambda i: take_rank(
+                top_values,
+                tir.floordiv(top_prob_offsets[i], _MAX_NUM_TOP_PROBS),
+                tir.floormod(top_prob_offsets[i], _MAX_NUM_TOP_PROBS),
+            ),
+            name="top_prob_probs",
+        )
+        top_prob_indices = te.compute(
+            (num_positions,),
+            lambda i: take_rank(
+                top_indices,
+                tir.floordiv(top_prob_offsets[i], _MAX_NUM_TOP_PROBS),
+                tir.floormod(top_prob_offsets[i], _MAX_NUM_TOP_PROBS),
+            ),
+            name="top_prob_indices",
+        )
+        return [sampled_values, top_prob_probs, top_prob_indices]
+
+    args = [probs, sample_indices, sampling_results, top_prob_offsets]
+    with bb.function("sampler_take_top_probs", args):
+        with bb.dataflow():
+            taken_probs_indices = bb.emit_te(
+                take_top_probs_te, *args, primfunc_name_hint="sampler_take_top_probs_te"
+            )
+            output = bb.emit_output(taken_probs_indices)
+        gv = bb.emit_func_output(output)
+    return gv
+
+
 def _attach_batch_verifier(bb: relax.BlockBuilder):
     num_nodes = tir.Var("num_nodes", "int64")
     nbatch = tir.Var("nbatch", "int64")
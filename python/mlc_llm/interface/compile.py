@@ -187,6 +187,7 @@ def _compile(args: CompileArgs, model_config: ConfigBase):
             "tensor_parallel_shards": model_config.tensor_parallel_shards,  # type: ignore
             "kv_cache_bytes": kv_cache_bytes,
             "kv_state_kind": _infer_kv_state_kind(args.model.name),
+            "batched_image_embed": hasattr(model, "image_embed"),
         }
         logger.info("Registering metadata: %s", metadata)
         metadata["params"] = [_get_param_metadata(name, param) for name, param in named_params]
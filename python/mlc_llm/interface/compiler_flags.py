@@ -140,6 +140,7 @@ class ModelConfigOverride(ConfigOverrideBase):
     attention_sink_size: Optional[int] = None
     max_batch_size: Optional[int] = None
     tensor_parallel_shards: Optional[int] = None
+    self_spec_num_layers: Optional[int] = None
 
     def __repr__(self) -> str:
         out = StringIO()
@@ -149,6 +150,7 @@ class ModelConfigOverride(ConfigOverrideBase):
         print(f";attention_sink_size={self.attention_sink_size}", file=out, end="")
         print(f";max_batch_size={self.max_batch_size}", file=out, end="")
         print(f";tensor_parallel_shards={self.tensor_parallel_shards}", file=out, end="")
+        print(f";self_spec_num_layers={self.self_spec_num_layers}", file=out, end="")
         return out.getvalue().rstrip()
 
     @staticmethod
@@ -161,6 +163,7 @@ class ModelConfigOverride(ConfigOverrideBase):
         parser.add_argument("--attention_sink_size", type=int, default=None)
         parser.add_argument("--max_batch_size", type=int, default=None)
         parser.add_argument("--tensor_parallel_shards", type=int, default=None)
+        parser.add_argument("--self_spec_num_layers", type=int, default=None)
         results = parser.parse_args([f"--{i}" for i in source.split(";") if i])
         return ModelConfigOverride(
             context_window_size=results.context_window_size,
@@ -169,6 +172,7 @@ class ModelConfigOverride(ConfigOverrideBase):
             attention_sink_size=results.attention_sink_size,
             max_batch_size=results.max_batch_size,
             tensor_parallel_shards=results.tensor_parallel_shards,
+            self_spec_num_layers=results.self_spec_num_layers,
         )
 
 
@@ -122,7 +122,8 @@ Number of shards to split the model into in tensor parallelism multi-gpu inferen
     "overrides": """
 Model configuration override. Configurations to override `mlc-chat-config.json`. Supports
 `context_window_size`, `prefill_chunk_size`, `sliding_window_size`, `attention_sink_size`,
-`max_batch_size` and `tensor_parallel_shards`. Meanwhile, model config could be explicitly
+`max_batch_size`, `tensor_parallel_shards` and `self_spec_num_layers`, the number of the
+early-exit layers compiled for the "layer_skip" speculative mode. Meanwhile, model config could be explicitly
 specified via details knobs, e.g. --overrides "context_window_size=1024;prefill_chunk_size=128".
 """.strip(),
     "chatconfig_overrides": """
@@ -198,10 +199,15 @@ Under mode "local" or "interactive", the actual memory usage may be significantl
 this number. Under mode "server", the actual memory usage may be slightly larger than this number.
 """.strip(),
     "speculative_mode_serve": """
-The speculative decoding mode. Right now three options are supported:
+The speculative decoding mode. Right now six options are supported:
  - "disable", where speculative decoding is not enabled,
  - "small_draft", denoting the normal speculative decoding (small draft) style,
- - "eagle", denoting the eagle-style speculative decoding.
+ - "eagle", denoting the eagle-style speculative decoding,
+ - "medusa", denoting the medusa-style speculative decoding,
+ - "ngram", denoting the draft-free speculative decoding with n-gram matching, which needs
+   no additional models,
+ - "layer_skip", denoting the self-speculative decoding, which drafts with the early-exit
+   layers of the model itself, and needs a model compiled with "self_spec_num_layers".
 The default mode is "disable".
 """.strip(),
     "spec_draft_length_serve": """
@@ -23,7 +23,7 @@ def serve(
     prefill_chunk_size: Optional[int],
     max_history_size: Optional[int],
     gpu_memory_utilization: Optional[float],
-    speculative_mode: Literal["disable", "small_draft", "eagle", "medusa"],
+    speculative_mode: Literal["disable", "small_draft", "eagle", "medusa", "ngram", "layer_skip"],
     spec_draft_length: int,
     prefix_cache_mode: Literal["disable", "radix"],
     prefix_cache_max_num_recycling_seqs: Optional[int],
@@ -72,4 +72,7 @@ def serve(
         app.exception_handler(error_protocol.BadRequestError)(
             error_protocol.bad_request_error_handler
         )
+        app.exception_handler(error_protocol.OverloadedError)(
+            error_protocol.overloaded_error_handler
+        )
         uvicorn.run(app, host=host, port=port, log_level="info")
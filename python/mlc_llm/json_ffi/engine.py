@@ -195,7 +195,7 @@ class JSONFFIEngine:
         device: Union[str, tvm.runtime.Device] = "auto",
         *,
         model_lib: Optional[str] = None,
-        mode: Literal["local", "interactive", "server"] = "local",
+        mode: Literal["local", "interactive", "server", "low_memory"] = "local",
         additional_models: Optional[List[str]] = None,
         max_batch_size: Optional[int] = None,
         max_total_sequence_length: Optional[int] = None,
@@ -236,6 +236,7 @@ class JSONFFIEngine:
                 "reload",
                 "unload",
                 "reset",
+                "set_device_power_state",
                 "chat_completion",
                 "abort",
                 "run_background_loop",
@@ -276,6 +277,13 @@ class JSONFFIEngine:
         """Raw chat completion API"""
         return self._state.handle_chat_completion(self._ffi, request_json_str, n, request_id)
 
+    def set_device_power_state(
+        self, device_power_state: Literal["nominal", "fair", "serious", "critical"]
+    ) -> None:
+        """Set the thermal and battery state of the device, by which the engine scales
+        its batch size, prefill chunk size and step pacing."""
+        self._ffi["set_device_power_state"](device_power_state)
+
     def terminate(self):
         """Explicitly terminate the engine"""
         self._background_loops.terminate()
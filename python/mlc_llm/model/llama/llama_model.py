@@ -37,6 +37,7 @@ class LlamaConfig(ConfigBase):  # pylint: disable=too-many-instance-attributes
     head_dim: int = 0
     tensor_parallel_shards: int = 1
     max_batch_size: int = 1
+    self_spec_num_layers: int = 0
     kwargs: Dict[str, Any] = dataclasses.field(default_factory=dict)
 
     def __post_init__(self):
@@ -68,6 +69,7 @@ class LlamaConfig(ConfigBase):  # pylint: disable=too-many-instance-attributes
             self.head_dim = self.hidden_size // self.num_attention_heads
         assert self.head_dim * self.num_attention_heads == self.hidden_size
         assert self.num_attention_heads % self.num_key_value_heads == 0
+        assert 0 <= self.self_spec_num_layers < self.num_hidden_layers
         if self.prefill_chunk_size == 0:
             logger.info(
                 "%s defaults to %d",
@@ -191,12 +193,22 @@ class LlamaModel(nn.Module):
         hidden_states = self.norm(hidden_states)
         return hidden_states
 
+    def forward_early_exit(
+        self, input_embed: Tensor, paged_kv_cache: PagedKVCache, num_layers: int
+    ):
+        hidden_states = input_embed
+        for layer_id in range(num_layers):
+            hidden_states = self.layers[layer_id](hidden_states, paged_kv_cache, layer_id)
+        hidden_states = self.norm(hidden_states)
+        return hidden_states
+
 
 class LlamaForCasualLM(nn.Module):  # pylint: disable=too-many-instance-attributes
     def __init__(self, config: LlamaConfig):
         self.model = LlamaModel(config)
         self.lm_head = nn.Linear(config.hidden_size, "vocab_size", bias=False)
         self.num_hidden_layers = config.num_hidden_layers
+        self.self_spec_num_layers = config.self_spec_num_layers
         self.num_attention_heads = config.num_attention_heads
         self.num_key_value_heads = config.num_key_value_heads
         self.head_dim = config.head_dim
@@ -246,6 +258,34 @@ class LlamaForCasualLM(nn.Module):  # pylint: disable=too-many-instance-attribut
             logits = logits.astype("float32")
         return logits
 
+    def get_logits_for_tokens(self, hidden_states: Tensor, token_ids: Tensor):
+        # Only the lm_head rows of the given tokens are computed, and the logits of the
+        # other tokens are the minimum float.
+        op_ext.configure()
+        if self.tensor_parallel_shards > 1:
+            token_ids = op.ccl_broadcast_from_worker0(token_ids)
+        if isinstance(self.lm_head, nn.Linear):
+            weight = op.take(self.lm_head.weight, token_ids, axis=0)
+        else:
+            weight = self.lm_head.take_rows(token_ids)
+        logits = op.matmul(hidden_states, op.permute_dims(weight))
+        if logits.dtype != "float32":
+            logits = logits.astype("float32")
+
+        def _scatter(x: te.Tensor, ids: te.Tensor):
+            n, k = x.shape
+            r = te.reduce_axis((0, k), name="r")
+            return te.compute(
+                (n, self.vocab_size),
+                lambda i, j: te.max(
+                    tir.Select(ids[r].astype(j.dtype) == j, x[i, r], tir.min_value("float32")),
+                    axis=r,
+                ),
+                name="scatter_logits",
+            )
+
+        return op.tensor_expr_op(_scatter, name_hint="scatter_logits", args=[logits, token_ids])
+
     def batch_select_last_hidden_states(self, hidden_states: Tensor, logit_positions: Tensor):
         op_ext.configure()
         if self.tensor_parallel_shards > 1:
@@ -296,6 +336,14 @@ class LlamaForCasualLM(nn.Module):  # pylint: disable=too-many-instance-attribut
         logits = self.batch_forward(input_embeds, paged_kv_cache)
         return logits, paged_kv_cache
 
+    def batch_decode_early_exit(self, input_embeds: Tensor, paged_kv_cache: PagedKVCache):
+        op_ext.configure()
+
+        hidden_states = self.model.forward_early_exit(
+            input_embeds, paged_kv_cache, self.self_spec_num_layers
+        )
+        return self.get_logits(hidden_states), paged_kv_cache
+
     def batch_verify(self, input_embeds: Tensor, paged_kv_cache: PagedKVCache):
         logits = self.batch_forward(input_embeds, paged_kv_cache)
         return logits, paged_kv_cache
@@ -358,6 +406,14 @@ class LlamaForCasualLM(nn.Module):  # pylint: disable=too-many-instance-attribut
                     "effect_mode": "none",
                 },
             },
+            "get_logits_for_tokens": {
+                "hidden_states": nn.spec.Tensor(["seq_len", self.hidden_size], self.dtype),
+                "token_ids": nn.spec.Tensor(["num_tokens"], "int32"),
+                "$": {
+                    "param_mode": "packed",
+                    "effect_mode": "none",
+                },
+            },
             "batch_select_last_hidden_states": {
                 "hidden_states": nn.spec.Tensor(["seq_len", self.hidden_size], self.dtype),
                 "logit_positions": nn.spec.Tensor(["batch_size"], "int32"),
@@ -415,6 +471,14 @@ class LlamaForCasualLM(nn.Module):  # pylint: disable=too-many-instance-attribut
                     "effect_mode": "none",
                 },
             },
+            "batch_decode_early_exit": {
+                "input_embeds": nn.spec.Tensor(["batch_size", 1, self.hidden_size], self.dtype),
+                "paged_kv_cache": nn.spec.Object(object_type=PagedKVCache),
+                "$": {
+                    "param_mode": "packed",
+                    "effect_mode": "none",
+                },
+            },
             "batch_verify": {
                 "input_embeds": nn.spec.Tensor([1, "seq_len", self.hidden_size], self.dtype),
                 "paged_kv_cache": nn.spec.Object(object_type=PagedKVCache),
@@ -459,4 +523,10 @@ class LlamaForCasualLM(nn.Module):  # pylint: disable=too-many-instance-attribut
                 },
             },
         }
+        if not isinstance(self.lm_head, nn.Linear) and not hasattr(self.lm_head, "take_rows"):
+            # The quantized lm_head cannot dequantize a subset of its rows.
+            del mod_spec["get_logits_for_tokens"]
+        if self.self_spec_num_layers == 0:
+            # The early-exit decode for self-speculation is only compiled on request.
+            del mod_spec["batch_decode_early_exit"]
         return nn.spec.ModuleSpec.from_raw(mod_spec, self)
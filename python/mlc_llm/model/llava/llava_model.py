@@ -463,7 +463,7 @@ class LlavaForCasualLM(Module):
             "image_embed": {
                 "pixel_values": nn.spec.Tensor(
                     [
-                        1,
+                        "image_batch_size",
                         3,
                         self.config.vision_config.image_size,
                         self.config.vision_config.image_size,
@@ -1,4 +1,4 @@
-"""Operators for choosing the pivot to cut-off top-p percentile """
+"""Operators for choosing the pivot to cut-off top-p percentile, top-k and min-p """
 
 import tvm
 from tvm.script import tir as T
@@ -268,6 +268,160 @@ def top_p_pivot(pN, target: tvm.target.Target):
     return _func
 
 
+def top_k_min_p_pivot(target: tvm.target.Target):
+    """Top-k and min-p pivot function. This function finds the pivot to cut-off the
+    probabilities that are not among the top-k, or are less than min-p times the maximum
+    probability, without sorting the probability vector.
+
+    The k-th largest probability is selected by a binary radix select on the bits of the
+    float values, which have the same order as the values since probabilities are
+    non-negative. Each round decides one bit by counting the elements that are larger or
+    equal to the candidate prefix. The elements equal to the pivot are all kept.
+
+    Parameters
+    ----------
+    prob:
+        The probability vector
+
+    top_k_arr:
+        The top-k threshold. Non-positive values mean no top-k cut-off.
+
+    min_p_arr:
+        The min-p threshold
+
+    final_pivot:
+        The final pivot to cut-off the probabilities
+
+    final_lsum:
+        The final sum of the values after filtering.
+    """
+    TX = 1024
+
+    max_num_threads_per_block = get_max_num_threads_per_block(target)
+    if max_num_threads_per_block < TX:
+        TX = max_num_threads_per_block
+
+    def _var(dtype="int32"):
+        return T.alloc_buffer((1,), dtype, scope="local")
+
+    # fmt: off
+    @T.prim_func(private=True)
+    def _func(
+        var_prob: T.handle,
+        var_top_k_arr: T.handle,
+        var_min_p_arr: T.handle,
+        var_final_pivot: T.handle,
+        var_final_lsum: T.handle,
+    ):
+        T.func_attr({"tir.is_scheduled": 1, "tir.noalias": True})
+        B = T.int32()
+        N = T.int32()
+        prob = T.match_buffer(var_prob, (B, N,), "float32")
+        top_k_arr = T.match_buffer(var_top_k_arr, (B,), dtype="int32")
+        min_p_arr = T.match_buffer(var_min_p_arr, (B,), dtype="float32")
+        final_pivot = T.match_buffer(var_final_pivot, (B,), "float32")
+        final_lsum = T.match_buffer(var_final_lsum, (B,), "float32")
+
+        with T.block("kernel"):
+            top_k = _var("int32")
+            pivot = _var("float32")
+            prefix = _var("uint32")
+            candidate = _var("uint32")
+
+            lmax = _var("float32")
+            cnt = _var("int32")
+            lsum = _var("float32")
+            lmax_reduce = _var("float32")
+            cnt_reduce = _var("int32")
+            lsum_reduce = _var("float32")
+            broadcast = T.alloc_buffer((1,), "int32", scope="shared")
+            lmax_broadcast = T.alloc_buffer((1,), "float32", scope="shared")
+
+            for _bx in T.thread_binding(0, B, thread="blockIdx.x"):
+                for _tx in T.thread_binding(0, TX, thread="threadIdx.x"):
+                    with T.block("CTA"):
+                        b, tx = T.axis.remap("SS", [_bx, _tx])
+
+                        top_k[0] = top_k_arr[b]
+
+                        ### the min-p cut-off, which is relative to the maximum probability
+                        lmax[0] = 0.0
+                        for i in T.serial(T.ceildiv(N, TX)):
+                            idx = T.meta_var(i * TX + tx)
+                            if idx < N:
+                                lmax[0] = T.max(lmax[0], prob[b, idx])
+                        with T.block("block_cross_thread"):
+                            T.reads(lmax[0])
+                            T.writes(lmax_reduce[0])
+                            T.attr(
+                                T.comm_reducer(lambda x0, y0: T.max(x0, y0), [T.float32(0)]),
+                                "reduce_scope",
+                                T.reinterpret("handle", T.uint64(0)),
+                            )
+                            T.tvm_thread_allreduce(T.uint32(1), lmax[0], True, lmax_reduce[0], tx, dtype="handle")
+                        if tx == 0:
+                            # broadcast lmax to all threads
+                            lmax_broadcast[0] = lmax_reduce[0]
+                        T.tvm_storage_sync("shared")
+                        pivot[0] = min_p_arr[b] * lmax_broadcast[0]
+
+                        ### the top-k cut-off, decided from the highest bit to the lowest bit
+                        if T.tvm_thread_invariant(top_k[0] > 0 and top_k[0] < N):
+                            prefix[0] = T.uint32(0)
+                            # the sign bit is always zero
+                            for j in T.serial(0, 31):
+                                candidate[0] = T.bitwise_or(prefix[0], T.shift_left(T.uint32(1), T.Cast("uint32", 30 - j)))
+                                cnt[0] = 0
+                                for i in T.serial(T.ceildiv(N, TX)):
+                                    idx = T.meta_var(i * TX + tx)
+                                    if idx < N:
+                                        if T.reinterpret("uint32", prob[b, idx]) >= candidate[0]:
+                                            cnt[0] += 1
+                                with T.block("block_cross_thread"):
+                                    T.reads(cnt[0])
+                                    T.writes(cnt_reduce[0])
+                                    T.attr(
+                                        T.comm_reducer(lambda x0, y0: x0 + y0, [T.int32(0)]),
+                                        "reduce_scope",
+                                        T.reinterpret("handle", T.uint64(0)),
+                                    )
+                                    T.tvm_thread_allreduce(T.uint32(1), cnt[0], True, cnt_reduce[0], tx, dtype="handle")
+                                T.tvm_storage_sync("shared")
+                                if tx == 0:
+                                    # broadcast the count to all threads
+                                    broadcast[0] = cnt_reduce[0]
+                                T.tvm_storage_sync("shared")
+                                if broadcast[0] >= top_k[0]:
+                                    prefix[0] = candidate[0]
+                            # the prefix is now the k-th largest probability
+                            pivot[0] = T.max(pivot[0], T.reinterpret("float32", prefix[0]))
+
+                        ### the sum of the kept probabilities
+                        lsum[0] = 0.0
+                        for i in T.serial(T.ceildiv(N, TX)):
+                            idx = T.meta_var(i * TX + tx)
+                            if idx < N:
+                                if prob[b, idx] >= pivot[0]:
+                                    lsum[0] += prob[b, idx]
+                        with T.block("block_cross_thread"):
+                            T.reads(lsum[0])
+                            T.writes(lsum_reduce[0])
+                            T.attr(
+                                T.comm_reducer(lambda x0, y0: x0 + y0, [T.float32(0)]),
+                                "reduce_scope",
+                                T.reinterpret("handle", T.uint64(0)),
+                            )
+                            T.tvm_thread_allreduce(T.uint32(1), lsum[0], True, lsum_reduce[0], tx, dtype="handle")
+
+                        if tx == 0:
+                            # leader thread writes back the pivot and lsum
+                            final_pivot[b] = pivot[0]
+                            final_lsum[b] = lsum_reduce[0]
+    # fmt: on
+
+    return _func
+
+
 def top_p_renorm(target: tvm.target.Target = None):
     """Top-p renormalization function. This function renormalizes the probability vector.
 
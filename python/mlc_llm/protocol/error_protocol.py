@@ -13,6 +13,13 @@ class BadRequestError(ValueError):
         super().__init__(*args)
 
 
+class OverloadedError(RuntimeError):
+    """The exception for requests that engines reject under overload."""
+
+    def __init__(self, *args: object) -> None:
+        super().__init__(*args)
+
+
 class ErrorResponse(BaseModel):
     """The class of error response."""
 
@@ -32,3 +39,8 @@ def create_error_response(status_code: HTTPStatus, message: str) -> fastapi.resp
 async def bad_request_error_handler(_request: fastapi.Request, e: BadRequestError):
     """The handler of BadRequestError that converts an exception into error response."""
     return create_error_response(status_code=HTTPStatus.BAD_REQUEST, message=e.args[0])
+
+
+async def overloaded_error_handler(_request: fastapi.Request, e: OverloadedError):
+    """The handler of OverloadedError that converts an exception into error response."""
+    return create_error_response(status_code=HTTPStatus.SERVICE_UNAVAILABLE, message=e.args[0])
@@ -102,6 +102,8 @@ class CompletionRequest(BaseModel):
     suffix: Optional[str] = None
     temperature: Optional[float] = None
     top_p: Optional[float] = None
+    top_k: Optional[int] = None
+    min_p: Optional[float] = None
     user: Optional[str] = None
     ignore_eos: bool = False
     response_format: Optional[RequestResponseFormat] = None
@@ -215,6 +217,8 @@ class ChatCompletionRequest(BaseModel):
     stream: bool = False
     temperature: Optional[float] = None
     top_p: Optional[float] = None
+    top_k: Optional[int] = None
+    min_p: Optional[float] = None
     tools: Optional[List[ChatTool]] = None
     tool_choice: Optional[Union[Literal["none", "auto"], Dict]] = None
     user: Optional[str] = None
@@ -399,6 +403,8 @@ def openai_api_get_generation_config(
         "n",
         "temperature",
         "top_p",
+        "top_k",
+        "min_p",
         "max_tokens",
         "frequency_penalty",
         "presence_penalty",
@@ -421,4 +427,7 @@ def openai_api_get_generation_config(
         kwargs["response_format"] = ResponseFormat(
             **request.response_format.model_dump(by_alias=True)
         )
+    if request.user is not None:
+        # The end user is the tenant of the request under fair-share scheduling.
+        kwargs["tenant_id"] = request.user
     return kwargs
@@ -405,6 +405,42 @@ class GroupQuantizeLinear(nn.Module):  # pylint: disable=too-many-instance-attri
             x = x + self.bias
         return x
 
+    def take_rows(self, indices: nn.Tensor) -> nn.Tensor:
+        """
+        Dequantize the weight rows of the given output features only, with which the layer
+        computes a subset of its outputs.
+
+        Parameters
+        ----------
+        indices : nn.Tensor
+            The indices of the output features.
+
+        Returns
+        -------
+        ret : nn.Tensor
+            The dequantized weight rows in shape (num_indices, in_features).
+        """
+        axis = 0 if self.config.linear_weight_layout == "NK" else 1
+        q_weight = nn.op.take(self.q_weight, indices, axis=axis)
+        q_scale = nn.op.take(self.q_scale, indices, axis=axis)
+        w = nn.op.tensor_expr_op(  # pylint: disable=invalid-name
+            lambda weight, scale: self.config._dequantize(  # pylint: disable=protected-access
+                weight,
+                scale,
+                axis=self.config.linear_quant_axis,
+                out_shape=(
+                    [weight.shape[0], tir.IntImm("int64", self.in_features)]
+                    if self.config.linear_weight_layout == "NK"
+                    else [tir.IntImm("int64", self.in_features), weight.shape[1]]
+                ),
+            ),
+            name_hint="dequantize",
+            args=[q_weight, q_scale],
+        )
+        if self.config.linear_weight_layout == "KN":
+            w = nn.op.permute_dims(w)  # pylint: disable=invalid-name
+        return w
+
     def to(self, dtype: Optional[str] = None) -> None:
         """
         Override to() such that we do not convert bias if there is an out_dtype.
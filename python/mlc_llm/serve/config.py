@@ -59,6 +59,14 @@ class GenerationConfig:  # pylint: disable=too-many-instance-attributes
         In sampling, only the most probable tokens with probabilities summed up to
         `top_p` are kept for sampling.
 
+    top_k : Optional[int]
+        In sampling, only the `top_k` most probable tokens are kept for sampling.
+        None or a non-positive value means no limit.
+
+    min_p : Optional[float]
+        In sampling, only the tokens whose probabilities are at least `min_p` times
+        the probability of the most probable token are kept for sampling.
+
     frequency_penalty : Optional[float]
         Positive values penalize new tokens based on their existing frequency
         in the text so far, decreasing the model's likelihood to repeat the same
@@ -83,6 +91,14 @@ class GenerationConfig:  # pylint: disable=too-many-instance-attributes
         log probability.
         `logprobs` must be set to True if this parameter is used.
 
+    logprob_format : Literal["json", "array"]
+        The format of the streamed log probabilities. "json" streams a JSON string
+        of each output token. "array" streams, for each output, an int32 array of
+        token ids and a float32 array of log probabilities in shape
+        (num_delta_tokens, 1 + top_logprobs), whose first column is the sampled token.
+        The arrays skip the per-token JSON formatting in the engine, and are left to
+        the caller to format. Default is "json".
+
     logit_bias : Optional[Dict[int, float]]
         The bias logit value added to selected tokens prior to sampling.
 
@@ -110,16 +126,62 @@ class GenerationConfig:  # pylint: disable=too-many-instance-attributes
 
     debug_config : Optional[DebugConfig]
         The optional debug configuration.
+
+    priority : int
+        The scheduling priority of the request. Requests with higher priority
+        are prefilled earlier and preempted later when the engine runs with
+        the "slo_aware" scheduler mode. Default is 0.
+
+    ttft_slo_ms : Optional[float]
+        The time-to-first-token deadline of the request in milliseconds,
+        used by the "slo_aware" scheduler mode. None means no deadline.
+
+    tpot_slo_ms : Optional[float]
+        The time-per-output-token deadline of the request in milliseconds,
+        used by the "slo_aware" scheduler mode. None means no deadline.
+
+    tenant_id : Optional[str]
+        The tenant that the request is accounted to under the "fair_share"
+        scheduler mode. The OpenAI API field "user" is used when not specified.
+        None means the default tenant.
+
+    lora_adapter : Optional[str]
+        The path to the LoRA adapter applied to the request. It requires the
+        engine to be created with positive "max_num_lora_adapters".
+        None means the request runs with the base model only.
+
+    num_beams : int
+        The number of beams of beam search. 1 means the request is generated by
+        sampling. Under beam search, the `n` best finished beams are returned when
+        the search finishes, and temperature, top_p, top_k and min_p are ignored.
+        At most 8 beams are supported. Default is 1.
+
+    length_penalty : float
+        The exponent of the generated length that beam search divides the log
+        probability of a finished beam by. Values larger than 0 favor longer outputs.
+        Default is 1.0.
+
+    prefill_only_output : Optional[Literal["last_hidden_state", "prompt_logprobs"]]
+        The output of a prefill-only request, which only prefills its prompt, generates
+        no token and frees its KV cache right after the prefill. "last_hidden_state"
+        returns the hidden states of the last prompt token, and "prompt_logprobs" returns
+        the logprob of each prompt token after the first. The output is returned as
+        `prefill_only_output` of the final stream output. The prompt should be token ids
+        that fit in one prefill chunk, and `n` should be 1. None means the request
+        generates tokens as usual.
     """
 
     n: int = 1
     temperature: Optional[float] = None
     top_p: Optional[float] = None
+    top_k: Optional[int] = None
+    min_p: Optional[float] = None
     frequency_penalty: Optional[float] = None
     presence_penalty: Optional[float] = None
     repetition_penalty: float = 1.0
     logprobs: bool = False
     top_logprobs: int = 0
+    logprob_format: Literal["json", "array"] = "json"
     logit_bias: Optional[Dict[int, float]] = field(default_factory=dict)
 
     max_tokens: Optional[int] = 128
@@ -132,6 +194,16 @@ class GenerationConfig:  # pylint: disable=too-many-instance-attributes
 
     debug_config: Optional[DebugConfig] = field(default_factory=DebugConfig)
 
+    priority: int = 0
+    ttft_slo_ms: Optional[float] = None
+    tpot_slo_ms: Optional[float] = None
+    tenant_id: Optional[str] = None
+    lora_adapter: Optional[str] = None
+
+    num_beams: int = 1
+    length_penalty: float = 1.0
+    prefill_only_output: Optional[Literal["last_hidden_state", "prompt_logprobs"]] = None
+
     def asjson(self) -> str:
         """Return the config in string of JSON format."""
         return json.dumps(asdict(self))
@@ -160,9 +232,38 @@ class EngineConfig:  # pylint: disable=too-many-instance-attributes
     additional_model_libs : List[str]
         The path to the additional models' libraries.
 
-    mode : Literal["local", "interactive", "server"]
+    lazy_load_params : bool
+        Whether to load the model weights in the background, so that the engine
+        startup (e.g., KV cache creation and tokenizer loading) overlaps with weight
+        loading. The weights are waited for when the models first run.
+        It does not take effect under tensor parallelism.
+
+    param_offload_mb : int
+        The size (in MB) of the model weights kept in page-locked host memory instead
+        of the device memory, which the device kernels read in place over the host
+        interconnect. It lets models larger than the device memory load, at the cost of
+        the host reads in every forward pass, which larger batches amortize. The embedding
+        table goes first when it is not shared with the LM head, since only the rows of
+        the input tokens are read, and then the decoder layers from the last one, in whole
+        layers. It only takes effect on CUDA and ROCm without tensor parallelism.
+        0 keeps all the weights on device.
+
+    weight_shard_cache_dir : str
+        The directory of the cache of the preprocessed weight shards under tensor
+        parallelism. When the weights are sharded at loading time, the first start saves
+        the shards of every worker to the local directory, keyed by the model weights and
+        the number of shards, and the later starts load the saved shards directly, which
+        skips the preprocessing and sharding on worker 0. Empty disables the cache.
+
+    max_num_lora_adapters : int
+        The maximum number of LoRA adapters resident on device at the same time.
+        The requests in a batch can apply different adapters. When all adapters are
+        in use, the requests applying a new adapter are aborted. 0 disables LoRA adapters.
+
+    mode : Literal["local", "interactive", "server", "batch", "low_memory"]
         The engine mode in MLC LLM.
-        We provide three preset modes: "local", "interactive" and "server".
+        We provide five preset modes: "local", "interactive", "server", "batch"
+        and "low_memory".
         The default mode is "local".
         The choice of mode decides the values of "max_batch_size", "max_total_sequence_length"
         and "prefill_chunk_size" when they are not explicitly specified.
@@ -178,6 +279,14 @@ class EngineConfig:  # pylint: disable=too-many-instance-attributes
         many concurrent request and want to use GPU memory as much as possible.
         In this mode, we will automatically infer the largest possible max batch
         size and max total sequence length.
+        4. Mode "batch" refers to the offline batch inference, which has no latency
+        targets and only cares about the throughput. The capacities are inferred in the
+        same way as mode "server", and the requests are scheduled first come first served.
+        See `SyncMLCEngine.generate_to_file` for running a file of requests in this mode.
+        5. Mode "low_memory" refers to the on-device deployment under tight memory
+        budgets. The max batch size is set to 1, the max total sequence length is capped
+        at 4096 and the prefill chunk size at 512, the model workspace tensors share one
+        buffer, and the cached transient buffers are released whenever the engine is idle.
 
         You can manually specify arguments "max_batch_size", "max_total_sequence_length" and
         "prefill_chunk_size" to override the automatic inferred values.
@@ -193,6 +302,23 @@ class EngineConfig:  # pylint: disable=too-many-instance-attributes
     kv_cache_page_size : int
         The number of consecutive tokens handled in each page in paged KV cache.
 
+    kv_cache_dtype : Literal["auto", "e4m3_float8", "int8", "int4"]
+        The storage data type of the paged KV cache. "auto" stores the KV cache in
+        the activation data type of the model. The quantized data types keep a scale
+        per page, and require the model library to be compiled with the KV cache of
+        that data type. The KV cache capacity is inferred with the smaller footprint.
+
+    kv_eviction_window_size : int
+        The number of the most recent tokens that each sequence keeps in KV cache when KV
+        tokens are evicted, in addition to the `kv_eviction_sink_size` attention sink tokens
+        at the start of the sequence (StreamingLLM). The other tokens are evicted as the
+        sequence grows, so that long conversations continue beyond the context window on a
+        fixed KV cache budget. It applies to the models without native sliding window.
+        -1 means no eviction.
+
+    kv_eviction_sink_size : int
+        The number of attention sink tokens kept in KV cache under KV token eviction.
+
     max_num_sequence : Optional[int]
         The maximum number of sequences that are allowed to be
         processed by the KV cache at any time.
@@ -210,19 +336,63 @@ class EngineConfig:  # pylint: disable=too-many-instance-attributes
     max_history_size: Optional[int]
         The maximum history size for RNN state to rool back.
 
+    startup_autotune : bool
+        A boolean indicating whether to autotune the batch size and the prefill chunk size
+        at startup. The engine runs synthetic prefill and decode steps over the candidates
+        up to "max_num_sequence" and "prefill_chunk_size", and picks the smallest ones
+        reaching nearly the best measured throughput. The steps also warm up the kernels
+        and allocators before the first request.
+
+    autotune_cache_dir : str
+        The directory where the autotuned capacities are saved, keyed by the models, the
+        device and the capacity upper bounds, so that restarts skip the measurement and
+        only warm up. Set empty to measure at every startup.
+
     kv_state_kind: Optional[Literal["kv_cache", "rnn_state"]]
         The kind of cache.
 
-    speculative_mode : Literal["disable", "small_draft", "eagle", "medusa"]
+    speculative_mode : Literal["disable", "small_draft", "eagle", "medusa", "ngram", "layer_skip"]
         The speculative mode.
         "disable" means speculative decoding is disabled.
         "small_draft" means the normal speculative decoding (small draft) mode.
         "eagle" means the eagle-style speculative decoding.
         "medusa" means the medusa-style speculative decoding.
+        "ngram" means the draft-free speculative decoding, which proposes the
+        tokens following the n-gram matches in the prompt and the generated tokens.
+        "layer_skip" means the self-speculative decoding, which proposes the tokens
+        by greedily decoding through the early-exit layers of the model itself.
 
     spec_draft_length : int
         The number of tokens to generate in speculative proposal (draft).
 
+    spec_tree_width : int
+        The maximum number of draft tokens at each level of the draft token tree
+        in the "small_draft" and "medusa" modes. The candidate tokens of the tree
+        are verified together in one step. 1 means the draft tokens form a chain.
+
+    adaptive_spec_draft_length : bool
+        A boolean indicating if the draft length of each request adapts to
+        its running acceptance rate, with `spec_draft_length` as the upper bound.
+
+    spec_max_batch_size : int
+        The largest number of running requests to draft for. Beyond it, the
+        requests are decoded without speculation. -1 means no limit.
+
+    spec_ngram_max_size : int
+        The largest n-gram to match in the "ngram" mode. The proposals match
+        the largest n-gram first, down to single tokens.
+
+    concurrent_draft_prefill : bool
+        A boolean indicating whether to run the prefill of the small draft model
+        on a side stream, concurrently with the prefill of the target model.
+        It only takes effect on single-GPU CUDA/ROCm in the "small_draft" mode.
+
+    draft_device : str
+        The device to run the draft models on in the "small_draft" mode, such as
+        "cuda:1" or "cpu". The draft models then take no memory or compute of
+        the engine device. The draft models run on the engine device when it is
+        empty.
+
     prefix_cache_mode : Literal["disable", "radix"]
         The prefix cache mode.
         "disable" means no prefix cache is disabled.
@@ -232,28 +402,323 @@ class EngineConfig:  # pylint: disable=too-many-instance-attributes
         The maximum number of recycling sequences in prefix cache, default as max_num_sequence.
         And set 0 to disable prefix cache, set -1 to have infinite capacity prefix cache.
 
+    prefix_cache_eviction_policy : Literal["lru", "lfu", "cost_aware"]
+        The policy to select the recycling sequence to evict from prefix cache.
+        "lru" evicts the least recently used sequence.
+        "lfu" evicts the least frequently used sequence.
+        "cost_aware" evicts the sequence with the lowest
+        (sequence length x hit count / exclusively held tokens).
+
+    prefix_cache_host_memory_mb : int
+        The capacity of the host memory tier (in MB) of prefix cache. The recycling sequences
+        evicted from the KV cache are offloaded to the host tier, and are restored back to
+        the KV cache when a new request matches them. Set 0 to disable the host tier.
+
+    response_cache_memory_mb : int
+        The capacity (in MB) of the exact-match response cache. The responses of greedy
+        requests and of requests with a fixed seed are cached, keyed by the prompt tokens,
+        the generation config and the model, and the same requests later are answered from
+        the cache without running the model. Requests with logprobs or image inputs are not
+        cached. Set 0 to disable the response cache.
+
+    rnn_state_checkpoint_interval : int
+        The interval in tokens of the RNN state checkpoints taken in prefill. The checkpoints
+        are kept as recycling sequences of prefix cache, so that a new request resumes from
+        the nearest checkpoint at or below its matched prefix. RNN state can only be forked
+        at the end of sequences, which without checkpoints matches only the sequences ending
+        where the match ends. Set 0 to disable the checkpoints. Only applies to RNN models.
+
+    prefix_cache_snapshot_path : str
+        The path of the on-disk prefix cache snapshot. The cached sequences and their KV data
+        are saved to it when the engine is unloaded, and loaded back when an engine with the
+        same model and tokenizer is created, so that the engine restarts with a warm
+        prefix cache. Set empty to disable the snapshot.
+
+    kv_cache_idle_compaction : bool
+        A boolean indicating whether to compact the KV cache when the engine becomes idle.
+        The recycling sequences of prefix cache drop the trailing tokens that partially
+        fill their last pages, so that the pages are freed for new sequences.
+
+    image_embedding_cache_size : int
+        The maximum number of image embeddings cached on device, keyed by the image content
+        hash, so that the images repeated across turns and requests are not encoded again.
+        The image positions are also matched in prefix cache. Set 0 to disable the cache.
+
+    prefix_share_min_length : int
+        The minimum length of an uncached prefix shared with an earlier waiting request, at
+        which a new request waits for the earlier request to prefill the prefix, and then
+        forks it from prefix cache instead of prefilling it again. Set 0 to disable it.
+
+    preemption_mode : Literal["recompute", "swap"]
+        The preemption mode.
+        "recompute" means the KV cache of a preempted request is dropped, and the request
+        is prefilled again when it resumes.
+        "swap" means the KV cache of a preempted request is copied to host memory,
+        and copied back when the request resumes. It falls back to "recompute" when the
+        model or engine config does not support it (e.g., with speculative decoding).
+
+    swap_space_mb : int
+        The capacity of the host memory (in MB) holding the swapped-out KV cache
+        under the "swap" preemption mode.
+
+    engine_role : Literal["mixed", "prefill", "decode"]
+        The role of the engine under prefill/decode disaggregation.
+        "mixed" means the engine both prefills and decodes requests.
+        "prefill" means the engine only prefills requests, which are then exported together
+        with their KV cache and imported into a decode engine.
+        "decode" means the engine accepts the imported requests and continues decoding them.
+        The imported KV data is held in host memory of `swap_space_mb` MB until the request
+        is scheduled. Disaggregation requires speculative decoding to be disabled.
+
+    scheduler_mode : Literal["fcfs", "slo_aware", "fair_share"]
+        The request scheduler mode.
+        "fcfs" means requests are prefilled in arrival order and the most recently
+        started request is preempted first.
+        "slo_aware" means requests are ordered by their priority and then by the slack
+        towards their TTFT/TPOT deadlines specified in generation config.
+        "fair_share" means the requests of different tenants (the "tenant_id" in
+        generation config) are prefilled in the weighted fair-share order of the prefill
+        and decode tokens served to each tenant, and the requests of the most served
+        tenant are preempted first.
+
+    tenant_weights : Dict[str, float]
+        The share weight of each tenant under the "fair_share" scheduler mode.
+        Tenants not listed have weight 1.
+
+    tenant_max_kv_tokens : int
+        The maximum number of KV cache tokens that the running requests of a tenant
+        can hold. A new request is not admitted into prefill while it would take its
+        tenant over the cap. -1 means no cap.
+
+    prefill_mode : Literal["chunked", "hybrid"]
+        The prefill mode.
+        "chunked" means prefill runs in its own engine steps with chunking,
+        and the decode of running requests waits until the prefill step finishes.
+        "hybrid" means the decode tokens of running requests are packed together with
+        a prefill chunk into one forward pass, so that both make progress in every step.
+        It only takes effect when speculative decoding is disabled.
+
+    adaptive_prefill_target_itl_ms : float
+        The target decode inter-token latency (in milliseconds). When positive, the engine
+        measures the prefill and decode latency of every step, and resizes the prefill chunk
+        to hold the target inter-token latency of running requests, with "prefill_chunk_size"
+        as the upper bound. Set 0 to keep the prefill chunk size static.
+
+    step_token_budget : int
+        The number of tokens each engine step processes across prefill, decode and the
+        draft tokens under verification, further bounded by the adaptive prefill chunk size.
+        Decode takes one token per running request, the draft tokens take the rest evenly,
+        and the prefill chunk takes the budget left by the decode tokens packed into the
+        same step. Set 0 to bound each kind of step by its own limits.
+
+    admission_kv_headroom : float
+        The fraction of the KV cache pages kept free when admitting new requests into
+        prefill, as the headroom for the decode of running requests.
+
+    admission_preemption_target : float
+        The target probability that an admitted request outgrows the KV pages forecast
+        for it, which bounds the expected preemptions. When below 1, the engine forecasts
+        the pages each request will decode from its "max_tokens" and the output lengths of
+        the finished requests, and admits new requests only while the forecast demand fits
+        the KV cache. Set 1 to admit by the input pages only.
+
+    load_shedding : bool
+        A boolean indicating whether to reject new requests whose predicted queue time
+        exceeds their deadline, i.e. their "ttft_slo_ms" or "load_shedding_max_queue_time_ms",
+        whichever is tighter. The queue time is predicted from the uncached input tokens of
+        the waiting requests scheduled before the request and the rate at which the engine
+        drains its waiting queue. Rejected requests finish with the "rejected" finish reason
+        without prefill. MLCEngine and AsyncMLCEngine raise OverloadedError for them, which
+        the server returns as HTTP 503.
+
+    load_shedding_max_queue_time_ms : float
+        The queue time deadline in milliseconds of all the requests under load shedding.
+        Set 0 to bound the requests by their "ttft_slo_ms" only.
+
+    decode_batch_size_buckets : List[int]
+        The bucketed batch sizes of decode. When not empty, each decode batch is padded to
+        the next bucket size, so that the device graphs captured by models compiled with
+        CUDA graph are replayed for a small set of batch sizes, and the graphs of all the
+        buckets are captured when the engine starts. Batches larger than the largest bucket
+        are not padded. Empty by default, which disables the padding.
+
+    overlap_scheduling : bool
+        A boolean indicating whether to overlap the post-processing of a decode step
+        (detokenization, stream callback and finished request handling) with the device
+        execution of the next decode step. Requests that finish in a step run one extra
+        decode whose tokens are discarded. It only takes effect when speculative decoding
+        is disabled.
+
+    num_decode_steps_per_step : int
+        The number of decode iterations that a decode step runs back-to-back before the
+        host post-processing, for throughput serving. The stop conditions are checked after
+        the iterations, and the tokens beyond a stop are discarded. The iterations never
+        exceed the max tokens of a request. Requests with beam search or grammar decode one
+        token a step.
+
+    restricted_vocab_max_tokens : int
+        The maximum number of tokens in the restricted vocabulary of a decode step.
+        When every request in a decode batch is constrained by a grammar (e.g., a JSON
+        schema of enum labels), and the tokens their grammars allow next are no more than
+        this many, only the lm_head rows of these tokens are computed. It requires the
+        model to be compiled with the "get_logits_for_tokens" function. 0 means the full
+        vocabulary is always computed.
+
+    device_power_state : Literal["nominal", "fair", "serious", "critical"]
+        The thermal and battery state of the device, hinted by mobile apps following the
+        platform thermal states (low battery maps to "serious"). Above "nominal", the engine
+        admits fewer running requests, prefills smaller chunks, idles between steps for a
+        fraction of the step time, and releases the transient device buffers when it has
+        no request. It can be changed at runtime through engine reconfiguration.
+
+    grammar_cache_dir : str
+        The directory of the on-disk cache of grammar init contexts. The preprocessing
+        result of each JSON schema is saved to the directory, keyed by the hash of the
+        schema and the token table, so that engine restarts and other engines sharing the
+        directory skip the preprocessing. Set empty to disable the on-disk cache.
+
+    grammar_cache_max_num_schemas : int
+        The maximum number of JSON schemas whose init contexts are kept in memory.
+        The least recently used one is evicted beyond it.
+
+    grammar_precompiled_path : str
+        A compiled grammar file, or a directory of .json or .bin compiled grammar files,
+        loaded at startup. The JSON schemas of the compiled grammars have no conversion or
+        preprocessing latency at their first requests, which suits tool-calling APIs with
+        fixed schemas. A compiled grammar of the empty schema replaces the preprocessing of
+        the built-in JSON grammar at startup. Compiled grammars of another tokenizer are
+        skipped. See mlc_llm.serve.grammar.compile_json_schema for producing them. Set empty
+        to load none.
+
+    grammar_jump_forward_max_tokens : int
+        The maximum number of tokens to jump forward in one step. When the grammar forces
+        a unique continuation string (e.g., JSON keys and punctuation), the tokens of the
+        string are appended to the request in one prefill-style forward pass instead of
+        being decoded one by one. It only takes effect when speculative decoding is
+        disabled. Set 0 to disable jump-forward decoding.
+
+    stream_back_max_pending_outputs : int
+        The maximum number of request delta outputs pending to be passed to the stream
+        callback of the threaded engine. When the callback falls behind and the number is
+        reached, the engine loop waits for the callback to catch up, which bounds the memory
+        of pending outputs. "-1" means no limit.
+
+    stream_back_max_batch_size : int
+        The maximum number of request outputs passed to one invocation of the stream
+        callback of the threaded engine. "-1" means no limit.
+
+    stream_back_flush_interval_ms : float
+        The time in milliseconds that the threaded engine waits for more outputs to batch
+        before invoking the stream callback. The delta outputs of the same request pending
+        in the meantime are merged. Set 0 to invoke the callback as soon as there are outputs.
+
+    stream_back_shm_path : str
+        The path of the shared-memory output ring file (e.g., under "/dev/shm"). When set,
+        the threaded engine writes the delta tokens and finish reasons of requests to the
+        ring, which a frontend process polls with mlc_llm.serve.shm_output.ShmOutputReader,
+        instead of invoking the stream callback. The outputs with logprobs or prefill-only
+        outputs are still passed through the callback. Set empty to pass all outputs
+        through the callback.
+
+    stream_back_shm_capacity : int
+        The number of records in the shared-memory output ring.
+
+    host_numa_node : int
+        The NUMA node whose cores the host threads are pinned to, which should be the node
+        of the GPU. It pins the engine loop, the stream-back loop and the threading backend
+        pool that tokenizes and samples. "-1" means the threads are not pinned.
+
     verbose : bool
         A boolean indicating whether to print logging info in engine.
+
+    device_phase_timing : bool
+        Whether to time the embedding, forward, logits, logit processing and sampling
+        phases of each engine step on the device with device events, so that the statistics
+        tell the device time apart from the host time. It adds a synchronization at the end
+        of steps.
+
+    traffic_capture_path : str
+        The path of the file to capture the served traffic to, which records the arrival
+        time, the input length and prefix hashes, the generation config and the output
+        length of each request, for the traffic to be replayed with
+        "AsyncMLCEngine.replay_traffic_capture". The file of each engine replica is
+        suffixed by ".replica" and the replica index. Empty by default, which disables
+        the capture.
     """
 
     model: str
     model_lib: str
     additional_models: List[str] = field(default_factory=list)
     additional_model_libs: List[str] = field(default_factory=list)
-    mode: Literal["local", "interactive", "server"] = "local"
+    lazy_load_params: bool = False
+    param_offload_mb: int = 0
+    weight_shard_cache_dir: str = ""
+    max_num_lora_adapters: int = 0
+    mode: Literal["local", "interactive", "server", "batch", "low_memory"] = "local"
     gpu_memory_utilization: Optional[float] = None
     kv_cache_page_size: int = 16
+    kv_cache_dtype: Literal["auto", "e4m3_float8", "int8", "int4"] = "auto"
+    kv_eviction_window_size: int = -1
+    kv_eviction_sink_size: int = 4
     max_num_sequence: Optional[int] = None
     max_total_sequence_length: Optional[int] = None
     max_single_sequence_length: Optional[int] = None
     prefill_chunk_size: Optional[int] = None
     max_history_size: Optional[int] = None
+    startup_autotune: bool = False
+    autotune_cache_dir: str = ""
     kv_state_kind: Optional[Literal["kv_cache", "rnn_state"]] = None
-    speculative_mode: Literal["disable", "small_draft", "eagle", "medusa"] = "disable"
+    speculative_mode: Literal[
+        "disable", "small_draft", "eagle", "medusa", "ngram", "layer_skip"
+    ] = "disable"
     spec_draft_length: int = 4
+    spec_tree_width: int = 1
+    adaptive_spec_draft_length: bool = False
+    spec_max_batch_size: int = -1
+    spec_ngram_max_size: int = 3
+    concurrent_draft_prefill: bool = False
+    draft_device: str = ""
     prefix_cache_mode: Literal["disable", "radix"] = "radix"
     prefix_cache_max_num_recycling_seqs: Optional[int] = None
+    prefix_cache_eviction_policy: Literal["lru", "lfu", "cost_aware"] = "lru"
+    prefix_cache_host_memory_mb: int = 0
+    response_cache_memory_mb: int = 0
+    rnn_state_checkpoint_interval: int = 0
+    prefix_cache_snapshot_path: str = ""
+    kv_cache_idle_compaction: bool = False
+    image_embedding_cache_size: int = 8
+    prefix_share_min_length: int = 256
+    preemption_mode: Literal["recompute", "swap"] = "recompute"
+    swap_space_mb: int = 4096
+    engine_role: Literal["mixed", "prefill", "decode"] = "mixed"
+    scheduler_mode: Literal["fcfs", "slo_aware", "fair_share"] = "fcfs"
+    tenant_weights: Dict[str, float] = field(default_factory=dict)
+    tenant_max_kv_tokens: int = -1
+    prefill_mode: Literal["chunked", "hybrid"] = "chunked"
+    adaptive_prefill_target_itl_ms: float = 0
+    step_token_budget: int = 0
+    admission_kv_headroom: float = 0
+    admission_preemption_target: float = 1
+    load_shedding: bool = False
+    load_shedding_max_queue_time_ms: float = 0
+    decode_batch_size_buckets: List[int] = field(default_factory=list)
+    overlap_scheduling: bool = False
+    num_decode_steps_per_step: int = 1
+    restricted_vocab_max_tokens: int = 0
+    device_power_state: Literal["nominal", "fair", "serious", "critical"] = "nominal"
+    grammar_cache_dir: str = ""
+    grammar_cache_max_num_schemas: int = 64
+    grammar_precompiled_path: str = ""
+    grammar_jump_forward_max_tokens: int = 0
+    stream_back_max_pending_outputs: int = -1
+    stream_back_max_batch_size: int = -1
+    stream_back_flush_interval_ms: float = 0
+    stream_back_shm_path: str = ""
+    stream_back_shm_capacity: int = 65536
+    host_numa_node: int = -1
     verbose: bool = True
+    device_phase_timing: bool = False
+    traffic_capture_path: str = ""
 
     def asjson(self) -> str:
         """Return the config in string of JSON format."""
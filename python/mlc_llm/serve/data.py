@@ -1,8 +1,10 @@
 """Classes denoting multi-modality data used in MLC LLM serving"""
 
+import json
 from dataclasses import dataclass
-from typing import Dict, List, Optional, Tuple
+from typing import Any, Dict, List, Optional, Tuple, Union
 
+import numpy as np
 import tvm
 import tvm._ffi
 from tvm.runtime import Object
@@ -47,12 +49,22 @@ class TokenData(Data):
 
     Parameters
     ----------
-    token_ids : List[int]
-        The list of token ids.
+    token_ids : Union[List[int], np.ndarray, NDArray]
+        The list of token ids, or a 1-D int32/int64 array of token ids on CPU.
+        The token data views into a contiguous int64 array without copying,
+        e.g. a numpy array over a shared memory buffer. The array must not be
+        modified until the request finishes.
     """
 
-    def __init__(self, token_ids: List[int]):
-        self.__init_handle_by_constructor__(_ffi_api.TokenData, *token_ids)  # type: ignore  # pylint: disable=no-member
+    def __init__(self, token_ids: Union[List[int], np.ndarray, NDArray]):
+        if isinstance(token_ids, np.ndarray):
+            if token_ids.dtype not in (np.int32, np.int64):
+                token_ids = token_ids.astype(np.int64)
+            token_ids = tvm.nd.from_dlpack(np.ascontiguousarray(token_ids))
+        if isinstance(token_ids, NDArray):
+            self.__init_handle_by_constructor__(_ffi_api.TokenDataFromNDArray, token_ids)  # type: ignore  # pylint: disable=no-member
+        else:
+            self.__init_handle_by_constructor__(_ffi_api.TokenData, *token_ids)  # type: ignore  # pylint: disable=no-member
 
     @property
     def token_ids(self) -> List[int]:
@@ -152,11 +164,26 @@ class SingleRequestStreamOutput:
     finish_reason : Optional[str]
         The finish reason of the request when it is finished,
         of None if the request has not finished yet.
+
+    delta_logprob_token_ids : Optional[np.ndarray]
+        The int32 token ids of the new generated tokens and their top logprob tokens
+        in shape (num_delta_tokens, 1 + top_logprobs), when the logprob format of the
+        request is "array". The first column is the sampled token.
+
+    delta_logprobs : Optional[np.ndarray]
+        The float32 log probabilities of `delta_logprob_token_ids`, in the same shape.
+
+    prefill_only_output : Optional[np.ndarray]
+        The output of the prefill-only request (see `prefill_only_output` in
+        GenerationConfig), which is only defined in the final output of the request.
     """
 
     delta_token_ids: List[int]
     delta_logprob_json_strs: Optional[List[str]]
     finish_reason: Optional[str]
+    delta_logprob_token_ids: Optional[np.ndarray] = None
+    delta_logprobs: Optional[np.ndarray] = None
+    prefill_only_output: Optional[np.ndarray] = None
 
 
 @tvm._ffi.register_object("mlc.serve.RequestStreamOutput")  # pylint: disable=protected-access
@@ -202,6 +229,20 @@ class RequestStreamOutput(Object):
                     delta_token_ids=list(delta_token_ids),
                     delta_logprob_json_strs=delta_logprob_json_strs,
                     finish_reason=str(finish_reason) if finish_reason is not None else None,
+                    delta_logprob_token_ids=(
+                        fields[4][i].numpy() if fields[4] is not None else None
+                    ),
+                    delta_logprobs=fields[5][i].numpy() if fields[5] is not None else None,
+                    prefill_only_output=fields[6].numpy() if fields[6] is not None else None,
                 )
             )
         return request_id, stream_outputs
+
+    def metrics(self) -> Optional[Dict[str, Any]]:
+        """Return the timing metrics of the request, which are only available in the final
+        output of a finished request. The times are in seconds, measured from the arrival
+        of the request at the engine. They include "queue_time", "ttft", "tpot",
+        "e2e_latency", "num_output_tokens", "num_preemptions" and "preemption_times".
+        """
+        metrics_json_str = _ffi_api.RequestStreamOutputGetMetrics(self)  # type: ignore  # pylint: disable=no-member
+        return json.loads(str(metrics_json_str)) if metrics_json_str is not None else None
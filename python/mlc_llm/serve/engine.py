@@ -772,9 +772,10 @@ class AsyncMLCEngine(engine_base.MLCEngineBase):
         If unspecified, we will use the provided ``model`` to search over possible paths.
         It the model lib is not found, it will be compiled in a JIT manner.
 
-    mode : Literal["local", "interactive", "server"]
+    mode : Literal["local", "interactive", "server", "batch", "low_memory"]
         The engine mode in MLC LLM.
-        We provide three preset modes: "local", "interactive" and "server".
+        We provide five preset modes: "local", "interactive", "server", "batch"
+        and "low_memory".
         The default mode is "local".
         The choice of mode decides the values of "max_batch_size", "max_total_sequence_length"
         and "prefill_chunk_size" when they are not explicitly specified.
@@ -790,6 +791,14 @@ class AsyncMLCEngine(engine_base.MLCEngineBase):
         many concurrent request and want to use GPU memory as much as possible.
         In this mode, we will automatically infer the largest possible max batch
         size and max total sequence length.
+        4. Mode "batch" refers to the offline batch inference, which has no latency
+        targets and only cares about the throughput. The capacities are inferred in the
+        same way as mode "server", and the requests are scheduled first come first served.
+        See `SyncMLCEngine.generate_to_file` for running a file of requests in this mode.
+        5. Mode "low_memory" refers to the on-device deployment under tight memory
+        budgets. The max batch size is set to 1, the max total sequence length is capped
+        at 4096 and the prefill chunk size at 512, the model workspace tensors share one
+        buffer, and the cached transient buffers are released whenever the engine is idle.
 
         You can manually specify arguments "max_batch_size", "max_total_sequence_length" and
         "prefill_chunk_size" to override the automatic inferred values.
@@ -827,12 +836,16 @@ class AsyncMLCEngine(engine_base.MLCEngineBase):
         significantly smaller than this number. Under mode "server", the actual
         memory usage may be slightly larger than this number.
 
-    speculative_mode : Literal["disable", "small_draft", "eagle", "medusa"]
+    speculative_mode : Literal["disable", "small_draft", "eagle", "medusa", "ngram", "layer_skip"]
         The speculative mode.
         "disable" means speculative decoding is disabled.
         "small_draft" means the normal speculative decoding (small draft) mode.
         "eagle" means the eagle-style speculative decoding.
         "medusa" means the medusa-style speculative decoding.
+        "ngram" means the draft-free speculative decoding, which proposes the
+        tokens following the n-gram matches in the prompt and the generated tokens.
+        "layer_skip" means the self-speculative decoding, which proposes the tokens
+        by greedily decoding through the early-exit layers of the model itself.
 
     spec_draft_length : int
         The number of tokens to generate in speculative proposal (draft).
@@ -851,6 +864,10 @@ class AsyncMLCEngine(engine_base.MLCEngineBase):
 
     verbose : bool
         A boolean indicating whether to print logging info in engine.
+
+    engine_config_overrides : Optional[Dict[str, Any]]
+        The engine config fields to set on top of the ones derived from the
+        arguments above, e.g. `{"load_shedding": True}`.
     """
 
     def __init__(  # pylint: disable=too-many-arguments,too-many-locals
@@ -859,19 +876,22 @@ class AsyncMLCEngine(engine_base.MLCEngineBase):
         device: Union[str, Device] = "auto",
         *,
         model_lib: Optional[str] = None,
-        mode: Literal["local", "interactive", "server"] = "local",
+        mode: Literal["local", "interactive", "server", "batch", "low_memory"] = "local",
         additional_models: Optional[List[str]] = None,
         max_batch_size: Optional[int] = None,
         max_total_sequence_length: Optional[int] = None,
         prefill_chunk_size: Optional[int] = None,
         max_history_size: Optional[int] = None,
         gpu_memory_utilization: Optional[float] = None,
-        speculative_mode: Literal["disable", "small_draft", "eagle", "medusa"] = "disable",
+        speculative_mode: Literal[
+            "disable", "small_draft", "eagle", "medusa", "ngram", "layer_skip"
+        ] = "disable",
         spec_draft_length: int = 4,
         prefix_cache_mode: Literal["disable", "radix"] = "radix",
         prefix_cache_max_num_recycling_seqs: Optional[int] = None,
         enable_tracing: bool = False,
         verbose: bool = True,
+        engine_config_overrides: Optional[Dict[str, Any]] = None,
     ) -> None:
         super().__init__(
             "async",
@@ -891,6 +911,7 @@ class AsyncMLCEngine(engine_base.MLCEngineBase):
             prefix_cache_max_num_recycling_seqs=prefix_cache_max_num_recycling_seqs,
             enable_tracing=enable_tracing,
             verbose=verbose,
+            engine_config_overrides=engine_config_overrides,
         )
         self.chat = Chat(weakref.ref(self))
         self.completions = AsyncCompletion(weakref.ref(self))
@@ -905,6 +926,32 @@ class AsyncMLCEngine(engine_base.MLCEngineBase):
         """
         self._abort(request_id)
 
+    async def replay_traffic_capture(self, path: str, time_scale: float = 1.0) -> int:
+        """Replay the traffic captured with "traffic_capture_path" of the engine config.
+        The requests are added with the captured arrival times, and their inputs are
+        synthesized to the captured lengths and shared prefixes. The requests that finished
+        in the capture output the same number of tokens. The outputs of the replayed
+        requests are not streamed back, and their timings are reported by the engine stats
+        and metrics.
+
+        Parameters
+        ----------
+        path : str
+            The path of the capture file.
+
+        time_scale : float
+            The scale of the arrival intervals, e.g. 0.5 for twice the arrival rate.
+
+        Returns
+        -------
+        num_requests : int
+            The number of replayed requests, which are all added when this returns.
+        """
+        loop = asyncio.get_event_loop()
+        return await loop.run_in_executor(
+            None, self._ffi["replay_traffic_capture"], path, time_scale
+        )
+
     async def _chat_completion(  # pylint: disable=too-many-arguments,too-many-locals
         self,
         *,
@@ -1367,9 +1414,10 @@ class MLCEngine(engine_base.MLCEngineBase):
         If unspecified, we will use the provided ``model`` to search over possible paths.
         It the model lib is not found, it will be compiled in a JIT manner.
 
-    mode : Literal["local", "interactive", "server"]
+    mode : Literal["local", "interactive", "server", "batch", "low_memory"]
         The engine mode in MLC LLM.
-        We provide three preset modes: "local", "interactive" and "server".
+        We provide five preset modes: "local", "interactive", "server", "batch"
+        and "low_memory".
         The default mode is "local".
         The choice of mode decides the values of "max_batch_size", "max_total_sequence_length"
         and "prefill_chunk_size" when they are not explicitly specified.
@@ -1385,6 +1433,14 @@ class MLCEngine(engine_base.MLCEngineBase):
         many concurrent request and want to use GPU memory as much as possible.
         In this mode, we will automatically infer the largest possible max batch
         size and max total sequence length.
+        4. Mode "batch" refers to the offline batch inference, which has no latency
+        targets and only cares about the throughput. The capacities are inferred in the
+        same way as mode "server", and the requests are scheduled first come first served.
+        See `SyncMLCEngine.generate_to_file` for running a file of requests in this mode.
+        5. Mode "low_memory" refers to the on-device deployment under tight memory
+        budgets. The max batch size is set to 1, the max total sequence length is capped
+        at 4096 and the prefill chunk size at 512, the model workspace tensors share one
+        buffer, and the cached transient buffers are released whenever the engine is idle.
 
         You can manually specify arguments "max_batch_size", "max_total_sequence_length" and
         "prefill_chunk_size" to override the automatic inferred values.
@@ -1442,6 +1498,10 @@ class MLCEngine(engine_base.MLCEngineBase):
 
     verbose : bool
         A boolean indicating whether to print logging info in engine.
+
+    engine_config_overrides : Optional[Dict[str, Any]]
+        The engine config fields to set on top of the ones derived from the
+        arguments above, e.g. `{"load_shedding": True}`.
     """
 
     def __init__(  # pylint: disable=too-many-arguments,too-many-locals
@@ -1450,7 +1510,7 @@ class MLCEngine(engine_base.MLCEngineBase):
         device: Union[str, Device] = "auto",
         *,
         model_lib: Optional[str] = None,
-        mode: Literal["local", "interactive", "server"] = "local",
+        mode: Literal["local", "interactive", "server", "batch", "low_memory"] = "local",
         additional_models: Optional[List[str]] = None,
         max_batch_size: Optional[int] = None,
         max_total_sequence_length: Optional[int] = None,
@@ -1463,6 +1523,7 @@ class MLCEngine(engine_base.MLCEngineBase):
         prefix_cache_max_num_recycling_seqs: Optional[int] = None,
         enable_tracing: bool = False,
         verbose: bool = True,
+        engine_config_overrides: Optional[Dict[str, Any]] = None,
     ) -> None:
         super().__init__(
             "sync",
@@ -1482,6 +1543,7 @@ class MLCEngine(engine_base.MLCEngineBase):
             prefix_cache_max_num_recycling_seqs=prefix_cache_max_num_recycling_seqs,
             enable_tracing=enable_tracing,
             verbose=verbose,
+            engine_config_overrides=engine_config_overrides,
         )
         self.chat = Chat(weakref.ref(self))
         self.completions = Completion(weakref.ref(self))
@@ -1898,6 +1960,9 @@ class MLCEngine(engine_base.MLCEngineBase):
         for delta_output in delta_outputs:
             request_id, stream_outputs = delta_output.unpack()
             self.state.record_event(request_id, event="start callback")
+            if any(stream_output.finish_reason == "rejected" for stream_output in stream_outputs):
+                # The request is shed by the engine before generating any token.
+                raise engine_base.create_request_rejected_error(request_id)
             outputs: List[engine_base.CallbackStreamOutput] = []
             for stream_output, text_streamer in zip(stream_outputs, self.state.sync_text_streamers):
                 self.state.record_event(request_id, event="start detokenization")
@@ -16,7 +16,7 @@ import tvm
 from tvm.runtime import Device
 
 from mlc_llm.chat_module import _get_chat_config, _get_lib_module_path, _get_model_path
-from mlc_llm.protocol import openai_api_protocol, protocol_utils
+from mlc_llm.protocol import error_protocol, openai_api_protocol, protocol_utils
 from mlc_llm.protocol.conversation_protocol import Conversation
 from mlc_llm.serve import data, engine_utils
 from mlc_llm.serve.config import EngineConfig, GenerationConfig
@@ -118,7 +118,9 @@ def _process_model_args(
     return model_args, config_file_paths, conversation
 
 
-def _print_engine_mode_logging_msg(mode: Literal["local", "interactive", "server"]) -> None:
+def _print_engine_mode_logging_msg(
+    mode: Literal["local", "interactive", "server", "batch", "low_memory"]
+) -> None:
     """Print the logging info for engine mode selection."""
     if mode == "local":
         logger.info(
@@ -132,6 +134,20 @@ def _print_engine_mode_logging_msg(mode: Literal["local", "interactive", "server
             "We fix max batch size to 1 for interactive single sequence use.",
             green(mode),
         )
+    elif mode == "low_memory":
+        logger.info(
+            "The selected engine mode is %s. "
+            "We fix max batch size to 1 and keep the workspace small for memory-constrained "
+            "devices.",
+            green(mode),
+        )
+    elif mode == "batch":
+        logger.info(
+            "The selected engine mode is %s. "
+            "We use as much GPU memory as possible (within the limit "
+            "of gpu_memory_utilization) and schedule for throughput only.",
+            green(mode),
+        )
     else:
         logger.info(
             "The selected engine mode is %s. "
@@ -150,7 +166,7 @@ def _print_engine_mode_logging_msg(mode: Literal["local", "interactive", "server
             "If you don't have concurrent requests and only use the engine interactively, "
             'please select mode "interactive".'
         )
-    if mode != "server":
+    if mode not in ["server", "batch"]:
         logger.info(
             "If you have high concurrent requests and want to maximize the GPU memory utilization, "
             'please select mode "server".'
@@ -240,6 +256,16 @@ class AsyncRequestStream:
         return result
 
 
+def create_request_rejected_error(request_id: str) -> error_protocol.OverloadedError:
+    """Create the error of the request that the engine rejects with the "rejected" finish
+    reason, i.e., sheds since it cannot be served before its deadline under the current load.
+    """
+    return error_protocol.OverloadedError(
+        f'The request "{request_id}" is rejected since the engine is overloaded. '
+        "Please retry later."
+    )
+
+
 class EngineState:
     """The engine states that the request stream callback function may use.
 
@@ -356,6 +382,14 @@ class EngineState:
 
             self.record_event(request_id, event="start callback")
             stream, text_streamers = streamers
+            if any(stream_output.finish_reason == "rejected" for stream_output in stream_outputs):
+                # The request is shed by the engine before generating any token.
+                stream.push(create_request_rejected_error(request_id))
+                stream.finish()
+                self.async_streamers.pop(request_id, None)
+                self.async_num_unfinished_generations.pop(request_id, None)
+                self.record_event(request_id, event="finish callback")
+                continue
             outputs = []
             for stream_output, text_streamer in zip(stream_outputs, text_streamers):
                 self.record_event(request_id, event="start detokenization")
@@ -418,19 +452,22 @@ class MLCEngineBase:  # pylint: disable=too-many-instance-attributes,too-few-pub
         model: str,
         device: Union[str, tvm.runtime.Device],
         model_lib: Optional[str],
-        mode: Literal["local", "interactive", "server"],
+        mode: Literal["local", "interactive", "server", "batch", "low_memory"],
         additional_models: Optional[List[str]],
         max_batch_size: Optional[int],
         max_total_sequence_length: Optional[int],
         prefill_chunk_size: Optional[int],
         max_history_size: Optional[int],
         gpu_memory_utilization: Optional[float],
-        speculative_mode: Literal["disable", "small_draft", "eagle", "medusa"],
+        speculative_mode: Literal[
+            "disable", "small_draft", "eagle", "medusa", "ngram", "layer_skip"
+        ],
         spec_draft_length: int,
         prefix_cache_mode: Literal["disable", "radix"],
         prefix_cache_max_num_recycling_seqs: Optional[int],
         enable_tracing: bool,
         verbose: bool,
+        engine_config_overrides: Optional[Dict[str, Any]],
     ) -> None:
         # - Initialize model loading info.
         models = _parse_models(model, model_lib, additional_models)
@@ -465,12 +502,15 @@ class MLCEngineBase:  # pylint: disable=too-many-instance-attributes,too-few-pub
                 "run_background_loop",
                 "run_background_stream_back_loop",
                 "reload",
+                "reconfigure",
                 "init_threaded_engine",
                 "exit_background_loop",
                 "get_default_generation_config",
                 "get_complete_engine_config",
                 "stats",
+                "get_metrics",
                 "reset",
+                "replay_traffic_capture",
                 "debug_call_func_on_all_worker",
             ]
         }
@@ -493,26 +533,28 @@ class MLCEngineBase:  # pylint: disable=too-many-instance-attributes,too-few-pub
         self._background_stream_back_loop_thread.start()
         self._terminated = False
 
-        self._ffi["reload"](
-            EngineConfig(
-                model=model_args[0][0],
-                model_lib=model_args[0][1],
-                additional_models=[model_arg[0] for model_arg in model_args[1:]],
-                additional_model_libs=[model_arg[1] for model_arg in model_args[1:]],
-                mode=mode,
-                gpu_memory_utilization=gpu_memory_utilization,
-                kv_cache_page_size=16,
-                max_num_sequence=max_batch_size,
-                max_total_sequence_length=max_total_sequence_length,
-                prefill_chunk_size=prefill_chunk_size,
-                max_history_size=max_history_size,
-                speculative_mode=speculative_mode,
-                spec_draft_length=spec_draft_length,
-                prefix_cache_mode=prefix_cache_mode,
-                prefix_cache_max_num_recycling_seqs=prefix_cache_max_num_recycling_seqs,
-                verbose=verbose,
-            ).asjson()
+        engine_config = EngineConfig(
+            model=model_args[0][0],
+            model_lib=model_args[0][1],
+            additional_models=[model_arg[0] for model_arg in model_args[1:]],
+            additional_model_libs=[model_arg[1] for model_arg in model_args[1:]],
+            mode=mode,
+            gpu_memory_utilization=gpu_memory_utilization,
+            kv_cache_page_size=16,
+            max_num_sequence=max_batch_size,
+            max_total_sequence_length=max_total_sequence_length,
+            prefill_chunk_size=prefill_chunk_size,
+            max_history_size=max_history_size,
+            speculative_mode=speculative_mode,
+            spec_draft_length=spec_draft_length,
+            prefix_cache_mode=prefix_cache_mode,
+            prefix_cache_max_num_recycling_seqs=prefix_cache_max_num_recycling_seqs,
+            verbose=verbose,
         )
+        for key, value in (engine_config_overrides or {}).items():
+            assert hasattr(engine_config, key), f'Unknown engine config field "{key}"'
+            setattr(engine_config, key, value)
+        self._ffi["reload"](engine_config.asjson())
         self.default_generation_cfg_json_str: str = self._ffi["get_default_generation_config"]()
         self.engine_config = EngineConfig.from_json(self._ffi["get_complete_engine_config"]())
         self.max_input_sequence_length = min(
@@ -541,10 +583,41 @@ class MLCEngineBase:  # pylint: disable=too-many-instance-attributes,too-few-pub
         """Get the engine stats."""
         return self._ffi["stats"]()
 
+    def metrics(self) -> str:
+        """Get the engine metrics in OpenMetrics text format.
+        It does not wait for the engine step, so it is cheap to scrape periodically."""
+        return self._ffi["get_metrics"]()
+
     def reset(self):
         """Reset the engine, clear the running data and statistics."""
         return self._ffi["reset"]()
 
+    def reconfigure(
+        self,
+        *,
+        max_batch_size: Optional[int] = None,
+        max_total_sequence_length: Optional[int] = None,
+        prefill_chunk_size: Optional[int] = None,
+    ) -> None:
+        """Change the KV cache capacities of the engine without reloading the model.
+        The running requests are preempted and resume afterwards. The arguments left
+        as None keep their current values.
+
+        Raises an error and leaves the engine unchanged when the new capacities do not
+        fit the GPU memory budget.
+        """
+        reconfig = {
+            "max_num_sequence": max_batch_size,
+            "max_total_sequence_length": max_total_sequence_length,
+            "prefill_chunk_size": prefill_chunk_size,
+        }
+        reconfig = {key: value for key, value in reconfig.items() if value is not None}
+        self.engine_config = EngineConfig.from_json(self._ffi["reconfigure"](json.dumps(reconfig)))
+        self.max_input_sequence_length = min(
+            self.engine_config.max_single_sequence_length,
+            self.engine_config.max_total_sequence_length,
+        )
+
 
 def process_chat_completion_request(  # pylint: disable=too-many-arguments
     request: openai_api_protocol.ChatCompletionRequest,
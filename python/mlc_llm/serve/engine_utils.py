@@ -3,6 +3,9 @@
 import uuid
 from typing import Callable, List, Union
 
+import numpy as np
+from tvm.runtime import NDArray
+
 from mlc_llm.serve import data
 
 from ..protocol import RequestProtocol, error_protocol, protocol_utils
@@ -89,6 +92,8 @@ def convert_prompts_to_data(
     and/or data to all data."""
     if isinstance(prompts, data.Data):
         return [prompts]
+    if isinstance(prompts, (np.ndarray, NDArray)):
+        return [data.TokenData(prompts)]
     if isinstance(prompts, str):
         return [data.TextData(prompts)]
     if isinstance(prompts[0], int):
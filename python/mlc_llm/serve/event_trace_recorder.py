@@ -10,10 +10,22 @@ from . import _ffi_api
 class EventTraceRecorder(Object):
     """The event trace recorder for requests."""
 
-    def __init__(self) -> None:
-        """Initialize a trace recorder."""
+    def __init__(self, sampling_ratio: float = 1.0, buffer_capacity: int = 1 << 16) -> None:
+        """Initialize a trace recorder.
+
+        Parameters
+        ----------
+        sampling_ratio : float
+            The ratio of requests whose events are recorded. The requests are sampled
+            by the hash of their ids, so that all the events of a sampled request are kept.
+
+        buffer_capacity : int
+            The number of the latest events each thread keeps.
+        """
         self.__init_handle_by_constructor__(
-            _ffi_api.EventTraceRecorder  # type: ignore  # pylint: disable=no-member
+            _ffi_api.EventTraceRecorder,  # type: ignore  # pylint: disable=no-member
+            sampling_ratio,
+            buffer_capacity,
         )
 
     def add_event(self, request_id: str, event: str) -> None:
@@ -37,5 +49,6 @@ class EventTraceRecorder(Object):
         )
 
     def dump_json(self) -> str:
-        """Dump the logged events in Chrome Trace Event Format in JSON string."""
+        """Dump the logged events in Chrome Trace Event Format in JSON string,
+        which is loadable by both chrome://tracing and Perfetto."""
         return _ffi_api.EventTraceRecorderDumpJSON(self)  # type: ignore  # pylint: disable=no-member
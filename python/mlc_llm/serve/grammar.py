@@ -276,6 +276,35 @@ class GrammarStateMatcher(Object):
                 token_table_postproc_method,
             )
 
+    @staticmethod
+    def from_compiled_grammar(
+        compiled_grammar: Union[str, bytes],
+        token_table: List[str],
+        max_rollback_steps: int = 0,
+    ) -> "GrammarStateMatcher":
+        """Create the matcher from a compiled grammar produced by compile_json_schema, which
+        skips the preprocessing of the grammar.
+
+        Parameters
+        ----------
+        compiled_grammar : Union[str, bytes]
+            The compiled grammar in the JSON format or the binary format.
+
+        token_table : List[str]
+            The postprocessed token table of the tokenizer the grammar is compiled with.
+
+        max_rollback_steps : int
+            The maximum number of steps to rollback when backtracking. Default: 0.
+
+        Returns
+        -------
+        matcher : GrammarStateMatcher
+            The created matcher.
+        """
+        return _ffi_api.GrammarStateMatcherFromCompiledGrammar(  # type: ignore  # pylint: disable=no-member
+            compiled_grammar, token_table, max_rollback_steps
+        )
+
     def accept_token(self, token_id: int) -> bool:
         """Accept one token and update the state of the matcher.
 
@@ -300,6 +329,21 @@ class GrammarStateMatcher(Object):
         """
         return _ffi_api.GrammarStateMatcherAcceptToken(self, token_id)  # type: ignore  # pylint: disable=no-member
 
+    def accept_tokens(self, token_ids: List[int]) -> int:
+        """Accept the tokens in order, until a token is not accepted or the matcher terminates.
+
+        Parameters
+        ----------
+        token_ids : List[int]
+            The ids of the tokens to accept.
+
+        Returns
+        -------
+        num_accepted : int
+            The number of accepted tokens. The state is the one after the last accepted token.
+        """
+        return _ffi_api.GrammarStateMatcherAcceptTokens(self, token_ids)  # type: ignore  # pylint: disable=no-member
+
     def find_next_rejected_tokens(self, verbose: bool = False) -> List[int]:
         """Find the ids of the rejected tokens for the next step.
 
@@ -328,6 +372,34 @@ class GrammarStateMatcher(Object):
 
         return _ffi_api.GrammarStateMatcherFindNextTokenBitmaskAsNDArray(self)  # type: ignore  # pylint: disable=no-member
 
+    def find_jump_forward_string(self) -> str:
+        """Find the string that the grammar forces to be matched next. Does not change the
+        state of the matcher.
+
+        Returns
+        -------
+        jump_forward_string : str
+            The forced string, which is empty when the next byte is not unique.
+        """
+        return _ffi_api.GrammarStateMatcherFindJumpForwardString(self)  # type: ignore  # pylint: disable=no-member
+
+    def find_jump_forward_tokens(self, max_num_tokens: int) -> List[int]:
+        """Find the tokens of the forced string that can be accepted without sampling. The
+        last token of the forced string is excluded since it may merge with the text that
+        follows. Does not change the state of the matcher.
+
+        Parameters
+        ----------
+        max_num_tokens : int
+            The maximum number of tokens to return.
+
+        Returns
+        -------
+        jump_forward_tokens : List[int]
+            The forced token ids.
+        """
+        return list(_ffi_api.GrammarStateMatcherFindJumpForwardTokens(self, max_num_tokens))  # type: ignore  # pylint: disable=no-member
+
     def rollback(self, num_tokens: int) -> None:
         """Rollback the matcher to a previous state.
 
@@ -349,6 +421,30 @@ class GrammarStateMatcher(Object):
         """
         return _ffi_api.GrammarStateMatcherMaxRollbackSteps(self)  # type: ignore  # pylint: disable=no-member
 
+    def save_snapshot(self) -> Tuple[int, int]:
+        """Save a snapshot of the current state, which is restored by restore_snapshot. The
+        history after the snapshot is kept regardless of the maximum number of rollback steps
+        until the snapshot is restored. Snapshots can be nested, and are restored in the reverse
+        order of saving.
+
+        Returns
+        -------
+        snapshot : Tuple[int, int]
+            The snapshot, i.e. the number of tokens and the number of stack tops records in the
+            history.
+        """
+        return tuple(_ffi_api.GrammarStateMatcherSaveSnapshot(self))  # type: ignore  # pylint: disable=no-member
+
+    def restore_snapshot(self, snapshot: Tuple[int, int]) -> None:
+        """Restore the state of a snapshot, which is the latest one not restored yet.
+
+        Parameters
+        ----------
+        snapshot : Tuple[int, int]
+            The snapshot returned by save_snapshot.
+        """
+        _ffi_api.GrammarStateMatcherRestoreSnapshot(self, snapshot)  # type: ignore  # pylint: disable=no-member
+
     def reset_state(self) -> None:
         """Reset the matcher to the initial state."""
         _ffi_api.GrammarStateMatcherResetState(self)  # type: ignore  # pylint: disable=no-member
@@ -386,3 +482,150 @@ class GrammarStateMatcher(Object):
             The string to be matched.
         """
         return _ffi_api.GrammarStateMatcherDebugMatchCompleteString(self, string, verbose)  # type: ignore  # pylint: disable=no-member
+
+    @staticmethod
+    def debug_serialize_init_context(grammar: BNFGrammar, token_table: List[str]) -> bytes:
+        """Preprocess the grammar with the token table, and serialize the result in the format
+        of the on-disk grammar cache. For test purposes.
+
+        Parameters
+        ----------
+        grammar : BNFGrammar
+            The BNF grammar to preprocess.
+
+        token_table : List[str]
+            The list of tokens.
+
+        Returns
+        -------
+        data : bytes
+            The serialized bytes.
+        """
+        return bytes(
+            _ffi_api.GrammarDebugSerializeInitContext(grammar, token_table)  # type: ignore  # pylint: disable=no-member
+        )
+
+    @staticmethod
+    def debug_from_serialized_init_context(
+        data: bytes,
+        grammar: BNFGrammar,
+        token_table: List[str],
+        max_rollback_steps: int = 0,
+    ) -> Optional["GrammarStateMatcher"]:
+        """Create the matcher from the bytes of debug_serialize_init_context. For test purposes.
+
+        Parameters
+        ----------
+        data : bytes
+            The serialized bytes.
+
+        grammar : BNFGrammar
+            The BNF grammar, which must be the one the bytes are serialized with.
+
+        token_table : List[str]
+            The list of tokens.
+
+        max_rollback_steps : int
+            The maximum number of steps to rollback when backtracking. Default: 0.
+
+        Returns
+        -------
+        matcher : Optional[GrammarStateMatcher]
+            The created matcher, or None if the bytes are invalid or do not match.
+        """
+        return _ffi_api.GrammarStateMatcherDebugFromSerializedInitContext(  # type: ignore  # pylint: disable=no-member
+            data, grammar, token_table, max_rollback_steps
+        )
+
+
+def debug_compact_intset_encode(sorted_values: List[int]) -> Tuple[bool, List[int]]:
+    """Encode the sorted and deduplicated integers in the compact intset of the grammar
+    preprocessing. For test purposes.
+
+    Parameters
+    ----------
+    sorted_values : List[int]
+        The sorted and deduplicated integers.
+
+    Returns
+    -------
+    is_runs : bool
+        Whether the data holds the [begin, end) runs of consecutive integers instead of the
+        integers.
+
+    data : List[int]
+        The integers, or the begin and end of each run.
+    """
+    result = _ffi_api.GrammarDebugCompactIntsetEncode(sorted_values)  # type: ignore  # pylint: disable=no-member
+    return bool(result[0]), [int(value) for value in result[1:]]
+
+
+def debug_compact_intset_decode(
+    is_runs: bool, data: List[int], upper_bound: int
+) -> Optional[List[int]]:
+    """Decode the data of a compact intset into the sorted integers. For test purposes.
+
+    Parameters
+    ----------
+    is_runs : bool
+        Whether the data holds the runs of consecutive integers.
+
+    data : List[int]
+        The integers, or the begin and end of each run.
+
+    upper_bound : int
+        The exclusive upper bound of the integers.
+
+    Returns
+    -------
+    values : Optional[List[int]]
+        The integers, or None if the data is not sorted, overlaps or is out of range.
+    """
+    result = _ffi_api.GrammarDebugCompactIntsetDecode(is_runs, data, upper_bound)  # type: ignore  # pylint: disable=no-member
+    return None if result is None else [int(value) for value in result]
+
+
+def compile_json_schema(
+    schema: str,
+    tokenizer: Union[Tokenizer, List[str]],
+    token_table_postproc_method: Literal["byte_fallback", "byte_level"] = "byte_fallback",
+    prettify: bool = False,
+    binary: bool = False,
+) -> Union[str, bytes]:
+    """Compile a JSON schema offline into a compiled grammar. The compiled grammar holds the
+    normalized BNF grammar of the schema in the format of BNFGrammar.to_json, extended with the
+    preprocessed token sets of the tokenizer. Engines load the compiled grammars in
+    EngineConfig.grammar_precompiled_path at startup, so that requests with the schema have
+    no grammar compilation latency. The web runtime loads a compiled grammar shipped with the
+    model through GrammarStateMatcher.from_compiled_grammar.
+
+    Parameters
+    ----------
+    schema : str
+        The JSON schema string. It must be the same string as the schema in the requests.
+        The empty string compiles the built-in JSON grammar used by the JSON mode.
+
+    tokenizer : Union[Tokenizer, List[str]]
+        The tokenizer of the model that serves the requests, or its postprocessed token table.
+
+    token_table_postproc_method : Literal["byte_fallback", "byte_level"]
+        The method to postprocess the token table. It must match the
+        "token_table_postproc_method" in the mlc-chat-config.json of the model. Only useful when
+        the tokenizer is specified. Default: "byte_fallback".
+
+    prettify : bool
+        Whether to format the JSON string. Default: False.
+
+    binary : bool
+        Whether to output the compact binary format, which is several times smaller than the
+        JSON format and is loaded without JSON parsing. Default: False.
+
+    Returns
+    -------
+    compiled_grammar : Union[str, bytes]
+        The compiled grammar in JSON format, or in the binary format when binary is True.
+    """
+    compiled_grammar = _ffi_api.GrammarCompileJSONSchema(  # type: ignore  # pylint: disable=no-member
+        schema, tokenizer, token_table_postproc_method, prettify, binary
+    )
+    return bytes(compiled_grammar) if binary else str(compiled_grammar)
@@ -142,6 +142,41 @@ class PagedRadixTree(Object):
         """
         return _ffi_api.PagedRadixTreeGetSequenceLength(self, seq_id)  # type: ignore  # pylint: disable=no-member
 
+    def get_exclusive_length(self, seq_id: int) -> int:
+        """
+        Get the number of trailing tokens exclusively held by a sequence,
+        which are not shared with any other sequence.
+
+        Parameters
+        ----------
+        seq_id : int
+            The sequence ID for index.
+
+        Returns
+        ------
+        length : int
+            The exclusive length of the sequence.
+        """
+        return _ffi_api.PagedRadixTreeGetSequenceExclusiveLength(self, seq_id)  # type: ignore  # pylint: disable=no-member
+
+    def get_exclusive_length_neighbors(self, seq_id: int) -> List[int]:
+        """
+        Get the other sequences whose exclusive lengths may change when a sequence is changed.
+        Call it before removing or rolling back the sequence, and after adding, extending or
+        forking it.
+
+        Parameters
+        ----------
+        seq_id : int
+            The sequence ID for index.
+
+        Returns
+        ------
+        neighbors : List[int]
+            The IDs of the sequences.
+        """
+        return list(_ffi_api.PagedRadixTreeGetExclusiveLengthNeighbors(self, seq_id))  # type: ignore  # pylint: disable=no-member
+
     def free_capacity(self) -> int:
         """
         Get the remaining token capacity of the paged radix tree.
@@ -0,0 +1,88 @@
+"""The reader of the shared-memory output ring written by the threaded engine."""
+
+import mmap
+import struct
+from typing import Dict, List, Optional, Tuple
+
+_MAGIC = 0x4D4C43534F524731  # "MLCSORG1"
+_HEADER_SIZE = 256
+_RECORD_SIZE = 128
+_RECORD_CAPACITY = 28
+_CAPACITY_OFFSET = 16
+_WRITE_INDEX_OFFSET = 64
+_READ_INDEX_OFFSET = 128
+
+_RECORD_KIND_REQUEST_ID = 0
+_RECORD_KIND_TOKENS = 1
+_RECORD_FLAG_MORE_FOLLOWS = 1
+_FINISH_REASONS = {1: "stop", 2: "length", 3: "abort", 4: "other", 5: "rejected"}
+
+_RECORD_HEADER = struct.Struct("<IHHHHHH")
+_RECORD_TOKENS = struct.Struct(f"<{_RECORD_CAPACITY}i")
+
+
+class ShmOutputReader:  # pylint: disable=too-few-public-methods
+    """The single consumer of the shared-memory output ring, which is created by the
+    threaded engine at the "stream_back_shm_path" of the engine config.
+
+    Parameters
+    ----------
+    path : str
+        The path of the ring file.
+    """
+
+    def __init__(self, path: str) -> None:
+        with open(path, "r+b") as file:
+            self._mmap = mmap.mmap(file.fileno(), 0)
+        magic, record_size = struct.unpack_from("<QI", self._mmap, 0)
+        if magic != _MAGIC or record_size != _RECORD_SIZE:
+            self._mmap.close()
+            raise ValueError(f'"{path}" is not a valid output ring file.')
+        (self._capacity,) = struct.unpack_from("<Q", self._mmap, _CAPACITY_OFFSET)
+        self._request_ids: Dict[int, str] = {}
+        self._pending_id_bytes: Dict[int, bytes] = {}
+
+    def poll(self) -> List[Tuple[str, int, List[int], Optional[str]]]:
+        """Read the records published since the last poll.
+
+        Returns
+        -------
+        outputs : List[Tuple[str, int, List[int], Optional[str]]]
+            The (request id, generation index, delta token ids, finish reason) of each token
+            record, in the order they are written. The finish reason is None for unfinished
+            generations.
+        """
+        (read_index,) = struct.unpack_from("<Q", self._mmap, _READ_INDEX_OFFSET)
+        (write_index,) = struct.unpack_from("<Q", self._mmap, _WRITE_INDEX_OFFSET)
+        outputs = []
+        while read_index < write_index:
+            offset = _HEADER_SIZE + (read_index % self._capacity) * _RECORD_SIZE
+            request_index, kind, flags, group_index, length, finish_reason, _ = (
+                _RECORD_HEADER.unpack_from(self._mmap, offset)
+            )
+            payload_offset = offset + _RECORD_HEADER.size
+            if kind == _RECORD_KIND_REQUEST_ID:
+                id_bytes = self._pending_id_bytes.pop(request_index, b"") + bytes(
+                    self._mmap[payload_offset : payload_offset + length]
+                )
+                if flags & _RECORD_FLAG_MORE_FOLLOWS:
+                    self._pending_id_bytes[request_index] = id_bytes
+                else:
+                    self._request_ids[request_index] = id_bytes.decode("utf-8")
+            elif kind == _RECORD_KIND_TOKENS:
+                token_ids = list(_RECORD_TOKENS.unpack_from(self._mmap, payload_offset)[:length])
+                outputs.append(
+                    (
+                        self._request_ids[request_index],
+                        group_index,
+                        token_ids,
+                        _FINISH_REASONS.get(finish_reason),
+                    )
+                )
+            read_index += 1
+        struct.pack_into("<Q", self._mmap, _READ_INDEX_OFFSET, read_index)
+        return outputs
+
+    def close(self) -> None:
+        """Unmap the ring file."""
+        self._mmap.close()
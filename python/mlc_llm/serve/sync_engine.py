@@ -31,6 +31,17 @@ logging.enable_logging()
 logger = logging.getLogger(__name__)
 
 
+# The number of leading tokens the requests of offline batch inference are bucketed by.
+_BATCH_PREFIX_BUCKET_LENGTH = 64
+
+
+def _batch_request_sort_key(token_ids: List[int]) -> Tuple[Tuple[int, ...], int]:
+    """The sort key of the requests of offline batch inference. The requests sharing the
+    leading tokens are placed next to each other, so that the later ones hit the prefix
+    cache, and the requests of each shared prefix are then ordered by length."""
+    return tuple(token_ids[:_BATCH_PREFIX_BUCKET_LENGTH]), len(token_ids)
+
+
 def _create_tvm_module(
     creator: str, ffi_funcs: Sequence[str], creator_args: Optional[List[Any]] = None
 ) -> Dict[str, Callable]:
@@ -78,6 +89,10 @@ class SyncMLCEngine:
 
     verbose : bool
         A boolean indicating whether to print logging info in engine.
+
+    engine_config_overrides : Optional[Dict[str, Any]]
+        The engine config fields to set on top of the ones derived from the
+        arguments above, e.g. `{"overlap_scheduling": True}`.
     """
 
     def __init__(  # pylint: disable=too-many-arguments,too-many-locals
@@ -86,7 +101,7 @@ class SyncMLCEngine:
         device: Union[str, tvm.runtime.Device] = "auto",
         *,
         model_lib: Optional[str] = None,
-        mode: Literal["local", "interactive", "server"] = "local",
+        mode: Literal["local", "interactive", "server", "batch", "low_memory"] = "local",
         additional_models: Optional[List[str]] = None,
         max_batch_size: Optional[int] = None,
         max_total_sequence_length: Optional[int] = None,
@@ -100,6 +115,7 @@ class SyncMLCEngine:
         prefix_cache_max_num_recycling_seqs: Optional[int] = None,
         verbose: bool = True,
         request_stream_callback: Optional[Callable[[List[data.RequestStreamOutput]], None]] = None,
+        engine_config_overrides: Optional[Dict[str, Any]] = None,
     ):
         # - Initialize model loading info.
         models = _parse_models(model, model_lib, additional_models)
@@ -139,25 +155,29 @@ class SyncMLCEngine:
         )
         self.trace_recorder = EventTraceRecorder() if enable_tracing else None
 
+        engine_config = EngineConfig(
+            model=model_args[0][0],
+            model_lib=model_args[0][1],
+            additional_models=[model_arg[0] for model_arg in model_args[1:]],
+            additional_model_libs=[model_arg[1] for model_arg in model_args[1:]],
+            mode=mode,
+            gpu_memory_utilization=gpu_memory_utilization,
+            kv_cache_page_size=16,
+            max_num_sequence=max_batch_size,
+            max_total_sequence_length=max_total_sequence_length,
+            prefill_chunk_size=prefill_chunk_size,
+            max_history_size=max_history_size,
+            speculative_mode=speculative_mode,
+            spec_draft_length=spec_draft_length,
+            prefix_cache_mode=prefix_cache_mode,
+            prefix_cache_max_num_recycling_seqs=prefix_cache_max_num_recycling_seqs,
+            verbose=verbose,
+        )
+        for key, value in (engine_config_overrides or {}).items():
+            assert hasattr(engine_config, key), f'Unknown engine config field "{key}"'
+            setattr(engine_config, key, value)
         self._ffi["init"](
-            EngineConfig(
-                model=model_args[0][0],
-                model_lib=model_args[0][1],
-                additional_models=[model_arg[0] for model_arg in model_args[1:]],
-                additional_model_libs=[model_arg[1] for model_arg in model_args[1:]],
-                mode=mode,
-                gpu_memory_utilization=gpu_memory_utilization,
-                kv_cache_page_size=16,
-                max_num_sequence=max_batch_size,
-                max_total_sequence_length=max_total_sequence_length,
-                prefill_chunk_size=prefill_chunk_size,
-                max_history_size=max_history_size,
-                speculative_mode=speculative_mode,
-                spec_draft_length=spec_draft_length,
-                prefix_cache_mode=prefix_cache_mode,
-                prefix_cache_max_num_recycling_seqs=prefix_cache_max_num_recycling_seqs,
-                verbose=verbose,
-            ).asjson(),
+            engine_config.asjson(),
             device,
             request_stream_callback,
             self.trace_recorder,
@@ -298,6 +318,102 @@ class SyncMLCEngine:
         self._ffi["set_request_stream_callback"](original_callback)
         return output_texts, output_logprobs_str
 
+    def generate_to_file(  # pylint: disable=too-many-locals
+        self,
+        input_path: str,
+        output_path: str,
+        max_num_pending_requests: int = 1024,
+    ) -> None:
+        """Run the offline batch inference of a JSONL file of requests, preferably under
+        engine mode "batch", and write the outputs to a JSONL file.
+
+        Each input line is a JSON object with field "prompt" (a string or a list of token
+        ids), and optional fields "id" (which defaults to the line number) and
+        "generation_config" (the fields of GenerationConfig). The requests are sorted by
+        shared prefix and length before they are added to the engine. Each output line is a
+        JSON object with fields "id", "outputs" and "finish_reasons", and is written once
+        the request finishes, so that the output lines are in the order of finishing.
+
+        Parameters
+        ----------
+        input_path : str
+            The path of the input JSONL file.
+
+        output_path : str
+            The path of the output JSONL file.
+
+        max_num_pending_requests : int
+            The maximum number of the requests added to the engine and not finished yet.
+            The requests are added as the earlier ones finish.
+        """
+        requests: List[Tuple[str, List[int], GenerationConfig]] = []
+        with open(input_path, "r", encoding="utf-8") as file:
+            for line_index, line in enumerate(file):
+                if line.strip() == "":
+                    continue
+                request_json = json.loads(line)
+                prompt = request_json["prompt"]
+                token_ids = self.tokenizer.encode(prompt) if isinstance(prompt, str) else prompt
+                requests.append(
+                    (
+                        str(request_json.get("id", line_index)),
+                        token_ids,
+                        GenerationConfig(**request_json.get("generation_config", {})),
+                    )
+                )
+        requests.sort(key=lambda request: _batch_request_sort_key(request[1]))
+
+        # The outputs are decoded only when the requests finish, instead of streaming texts.
+        pending: Dict[str, Tuple[List[List[int]], List[Optional[str]]]] = {}
+        original_callback = self._ffi["get_request_stream_callback"]()
+        with open(output_path, "w", encoding="utf-8") as output_file:
+
+            def request_stream_callback(delta_outputs: List[data.RequestStreamOutput]):
+                for delta_output in delta_outputs:
+                    request_id, stream_outputs = delta_output.unpack()
+                    output_token_ids, finish_reasons = pending[request_id]
+                    for i, stream_output in enumerate(stream_outputs):
+                        output_token_ids[i] += stream_output.delta_token_ids
+                        if stream_output.finish_reason is not None:
+                            finish_reasons[i] = stream_output.finish_reason
+                    if all(finish_reason is not None for finish_reason in finish_reasons):
+                        del pending[request_id]
+                        output_json = {
+                            "id": request_id,
+                            "outputs": [
+                                self.tokenizer.decode(token_ids) for token_ids in output_token_ids
+                            ],
+                            "finish_reasons": finish_reasons,
+                        }
+                        output_file.write(json.dumps(output_json) + "\n")
+
+            self._ffi["set_request_stream_callback"](request_stream_callback)
+            num_added_requests = 0
+            while num_added_requests < len(requests) or len(pending) > 0:
+                while (
+                    num_added_requests < len(requests)
+                    and len(pending) < max_num_pending_requests
+                ):
+                    request_id, token_ids, generation_cfg = requests[num_added_requests]
+                    assert request_id not in pending, f'Duplicate request id "{request_id}"'
+                    pending[request_id] = (
+                        [[] for _ in range(generation_cfg.n)],
+                        [None] * generation_cfg.n,
+                    )
+                    self.add_request(
+                        Request(
+                            request_id=request_id,
+                            inputs=[data.TokenData(token_ids)],
+                            generation_config=generation_cfg,
+                            default_generation_config_json_str=self.default_generation_cfg_json_str,
+                        )
+                    )
+                    num_added_requests += 1
+                self.step()
+
+        # Restore the callback function in engine.
+        self._ffi["set_request_stream_callback"](original_callback)
+
     def add_request(self, request: Request) -> None:
         """Add a new request to the engine.
 
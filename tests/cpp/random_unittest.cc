@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include <support/random.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+void _TestPhilox4x32KnownAnswer(std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key,
+                                std::array<uint32_t, 4> expected) {
+  std::array<uint32_t, 4> result = mlc::llm::Philox4x32(counter, key);
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_EQ(result[i], expected[i]) << "word " << i;
+  }
+}
+
+std::vector<double> _DrawRandomNumbers(mlc::llm::RandomGenerator* rng, int num) {
+  std::vector<double> numbers;
+  for (int i = 0; i < num; ++i) {
+    numbers.push_back(rng->GetRandomNumber());
+  }
+  return numbers;
+}
+
+TEST(RandomTest, Philox4x32KnownAnswerTest) {
+  // The known-answer vectors of philox4x32_10 in Random123.
+  _TestPhilox4x32KnownAnswer({0x00000000, 0x00000000, 0x00000000, 0x00000000},
+                             {0x00000000, 0x00000000},
+                             {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8});
+  _TestPhilox4x32KnownAnswer({0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+                             {0xffffffff, 0xffffffff},
+                             {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd});
+  _TestPhilox4x32KnownAnswer({0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344},
+                             {0xa4093822, 0x299f31d0},
+                             {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1});
+}
+
+TEST(RandomTest, RandomGeneratorSameSeedTest) {
+  mlc::llm::RandomGenerator rng0(42);
+  mlc::llm::RandomGenerator rng1(42);
+  std::vector<double> numbers = _DrawRandomNumbers(&rng0, 100);
+  ASSERT_EQ(numbers, _DrawRandomNumbers(&rng1, 100));
+  for (double number : numbers) {
+    ASSERT_GE(number, 0.0);
+    ASSERT_LT(number, 1.0);
+  }
+  // Setting the seed again restarts the sequence.
+  rng0.SetSeed(42);
+  ASSERT_EQ(numbers, _DrawRandomNumbers(&rng0, 100));
+  // Another seed gives another sequence.
+  mlc::llm::RandomGenerator rng2(43);
+  ASSERT_NE(numbers, _DrawRandomNumbers(&rng2, 100));
+}
+
+TEST(RandomTest, RandomGeneratorCounterBasedTest) {
+  // The numbers of a seed are computed from the Philox blocks of the seed, two 32-bit
+  // integers per number.
+  mlc::llm::RandomGenerator rng(7);
+  for (uint32_t block = 0; block < 3; ++block) {
+    std::array<uint32_t, 4> words = mlc::llm::Philox4x32({block, 0, 0, 0}, {7, 0x6A09E667});
+    for (int i = 0; i < 4; i += 2) {
+      uint64_t bits = (static_cast<uint64_t>(words[i] >> 5) << 26) | (words[i + 1] >> 6);
+      ASSERT_EQ(rng.GetRandomNumber(), static_cast<double>(bits) / 9007199254740992.0);
+    }
+  }
+}
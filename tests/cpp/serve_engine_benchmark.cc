@@ -0,0 +1,496 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve_engine_benchmark.cc
+ * \brief The serving benchmark that drives the threaded engine with synthetic or replayed
+ * request traces, without the Python server stack in the way of the numbers.
+ *
+ * Usage:
+ *   mlc_llm_serve_benchmark --engine-config <engine config JSON> [--device cuda:0]
+ *       [--trace <trace JSONL>] [--num-requests 256] [--request-rate 4]
+ *       [--input-len-mean 512] [--input-len-std 128] [--output-len-mean 128]
+ *       [--output-len-std 32] [--shared-prefix-ratio 0] [--shared-prefix-len 256]
+ *       [--num-shared-prefixes 4] [--grammar-ratio 0] [--sample-interval-ms 200] [--seed 0]
+ *
+ * The engine config is the JSON string taken by the "reload" function of the threaded engine,
+ * which must contain "model" and "model_lib". Without a trace, the requests arrive by a
+ * Poisson process of the given rate (all at once when the rate is not positive), with normally
+ * distributed prompt and output lengths. Each line of a trace is a JSON object of a request:
+ *   {"timestamp": 0.5, "input_len": 512, "output_len": 128, "prefix_id": 0, "grammar": false}
+ * where "timestamp" is the arrival time in seconds, and the optional "prefix_id" selects the
+ * shared prefix of the prompt and "grammar" constrains the output to JSON.
+ * It prints the throughput, the TTFT/TPOT/latency percentiles and the KV cache utilization
+ * over time as a JSON object.
+ */
+#include <dlpack/dlpack.h>
+#include <tvm/runtime/container/array.h>
+#include <tvm/runtime/container/shape_tuple.h>
+#include <tvm/runtime/container/string.h>
+#include <tvm/runtime/logging.h>
+#include <tvm/runtime/module.h>
+#include <tvm/runtime/packed_func.h>
+#include <tvm/runtime/registry.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "support/json_parser.h"
+#include "support/load_bytes_from_file.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+namespace benchmark {
+
+using namespace tvm::runtime;
+using Clock = std::chrono::steady_clock;
+
+/*! \brief The specification of a benchmark request. */
+struct RequestSpec {
+  /*! \brief The arrival time in seconds since the benchmark start. */
+  double arrival_time;
+  std::vector<int32_t> input_token_ids;
+  int output_len;
+  /*! \brief Whether the output is constrained to JSON by grammar. */
+  bool grammar;
+};
+
+/*! \brief The client-side timings of a benchmark request. */
+struct RequestRecord {
+  Clock::time_point tarrival;
+  std::optional<Clock::time_point> tfirst_token;
+  std::optional<Clock::time_point> tfinish;
+  int64_t num_output_tokens = 0;
+};
+
+/*! \brief A sample of the engine metrics over time. */
+struct EngineSample {
+  double time;
+  double kv_cache_utilization;
+  int64_t num_running_requests;
+  int64_t num_waiting_requests;
+};
+
+/*! \brief The benchmark options from the command line. */
+class Options {
+ public:
+  Options(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+      std::string key = argv[i];
+      CHECK(key.rfind("--", 0) == 0 && i + 1 < argc)
+          << "Invalid command line argument \"" << key << "\". Expect \"--<key> <value>\".";
+      values_[key.substr(2)] = argv[++i];
+    }
+  }
+
+  std::string GetString(const std::string& key, const std::string& default_value) const {
+    auto it = values_.find(key);
+    return it == values_.end() ? default_value : it->second;
+  }
+
+  double GetDouble(const std::string& key, double default_value) const {
+    auto it = values_.find(key);
+    return it == values_.end() ? default_value : std::stod(it->second);
+  }
+
+  int64_t GetInt(const std::string& key, int64_t default_value) const {
+    auto it = values_.find(key);
+    return it == values_.end() ? default_value : std::stoll(it->second);
+  }
+
+ private:
+  std::unordered_map<std::string, std::string> values_;
+};
+
+/*! \brief Parse the device string such as "cuda:0". */
+Device ParseDevice(const std::string& device_str) {
+  static const std::unordered_map<std::string, DLDeviceType> kDeviceTypes = {
+      {"cpu", kDLCPU},       {"cuda", kDLCUDA},     {"rocm", kDLROCM},
+      {"metal", kDLMetal},   {"vulkan", kDLVulkan}, {"opencl", kDLOpenCL},
+  };
+  size_t pos = device_str.find(':');
+  std::string device_type = device_str.substr(0, pos);
+  int device_id = pos == std::string::npos ? 0 : std::stoi(device_str.substr(pos + 1));
+  auto it = kDeviceTypes.find(device_type);
+  CHECK(it != kDeviceTypes.end()) << "Unsupported device \"" << device_str << "\".";
+  return Device{it->second, device_id};
+}
+
+/*! \brief The generator of prompt token ids with shared prefixes. */
+class PromptGenerator {
+ public:
+  PromptGenerator(int vocab_size, int num_shared_prefixes, int shared_prefix_len,
+                  std::mt19937* rng)
+      : token_id_dist_(0, vocab_size - 1), rng_(rng) {
+    for (int i = 0; i < num_shared_prefixes; ++i) {
+      shared_prefixes_.push_back(RandomTokenIds(shared_prefix_len));
+    }
+  }
+
+  /*!
+   * \brief Generate the prompt of the given length, which starts with the given shared prefix
+   * when the prefix id is not negative.
+   */
+  std::vector<int32_t> Generate(int input_len, int prefix_id) {
+    std::vector<int32_t> token_ids;
+    if (prefix_id >= 0) {
+      CHECK_LT(prefix_id, static_cast<int>(shared_prefixes_.size()))
+          << "The prefix id " << prefix_id << " exceeds the number of shared prefixes.";
+      const std::vector<int32_t>& prefix = shared_prefixes_[prefix_id];
+      token_ids.assign(prefix.begin(),
+                       prefix.begin() + std::min<int>(input_len, prefix.size()));
+    }
+    std::vector<int32_t> suffix = RandomTokenIds(input_len - token_ids.size());
+    token_ids.insert(token_ids.end(), suffix.begin(), suffix.end());
+    return token_ids;
+  }
+
+  int NumSharedPrefixes() const { return shared_prefixes_.size(); }
+
+ private:
+  std::vector<int32_t> RandomTokenIds(int length) {
+    std::vector<int32_t> token_ids(length);
+    for (int32_t& token_id : token_ids) {
+      token_id = token_id_dist_(*rng_);
+    }
+    return token_ids;
+  }
+
+  std::uniform_int_distribution<int32_t> token_id_dist_;
+  std::mt19937* rng_;
+  std::vector<std::vector<int32_t>> shared_prefixes_;
+};
+
+/*! \brief Generate the requests with Poisson arrivals and normal length distributions. */
+std::vector<RequestSpec> GenerateSyntheticRequests(const Options& options,
+                                                   PromptGenerator* prompt_generator,
+                                                   std::mt19937* rng) {
+  int num_requests = options.GetInt("num-requests", 256);
+  double request_rate = options.GetDouble("request-rate", 4);
+  std::normal_distribution<double> input_len_dist(options.GetDouble("input-len-mean", 512),
+                                                  options.GetDouble("input-len-std", 128));
+  std::normal_distribution<double> output_len_dist(options.GetDouble("output-len-mean", 128),
+                                                   options.GetDouble("output-len-std", 32));
+  std::bernoulli_distribution shared_prefix_dist(options.GetDouble("shared-prefix-ratio", 0));
+  std::bernoulli_distribution grammar_dist(options.GetDouble("grammar-ratio", 0));
+  std::uniform_int_distribution<int> prefix_id_dist(
+      0, std::max(prompt_generator->NumSharedPrefixes() - 1, 0));
+
+  std::vector<RequestSpec> requests;
+  requests.reserve(num_requests);
+  double arrival_time = 0;
+  for (int i = 0; i < num_requests; ++i) {
+    if (request_rate > 0 && i > 0) {
+      arrival_time += std::exponential_distribution<double>(request_rate)(*rng);
+    }
+    int input_len = std::max(static_cast<int>(input_len_dist(*rng)), 1);
+    int output_len = std::max(static_cast<int>(output_len_dist(*rng)), 1);
+    int prefix_id = prompt_generator->NumSharedPrefixes() > 0 && shared_prefix_dist(*rng)
+                        ? prefix_id_dist(*rng)
+                        : -1;
+    requests.push_back(RequestSpec{arrival_time, prompt_generator->Generate(input_len, prefix_id),
+                                   output_len, grammar_dist(*rng)});
+  }
+  return requests;
+}
+
+/*! \brief Load the requests from the trace file. */
+std::vector<RequestSpec> LoadTraceRequests(const std::string& trace_path,
+                                           PromptGenerator* prompt_generator) {
+  std::istringstream is(LoadBytesFromFile(trace_path));
+  std::vector<RequestSpec> requests;
+  std::string line;
+  while (std::getline(is, line)) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+    picojson::object request = json::ParseToJSONObject(line);
+    int input_len = json::Lookup<int64_t>(request, "input_len");
+    int prefix_id = json::LookupOrDefault<int64_t>(request, "prefix_id", -1);
+    CHECK_GE(input_len, 1) << "The input length of a request should be positive.";
+    requests.push_back(RequestSpec{json::Lookup<double>(request, "timestamp"),
+                                   prompt_generator->Generate(input_len, prefix_id),
+                                   static_cast<int>(json::Lookup<int64_t>(request, "output_len")),
+                                   json::LookupOrDefault<bool>(request, "grammar", false)});
+  }
+  CHECK(!requests.empty()) << "The trace \"" << trace_path << "\" has no request.";
+  std::stable_sort(requests.begin(), requests.end(),
+                   [](const RequestSpec& lhs, const RequestSpec& rhs) {
+                     return lhs.arrival_time < rhs.arrival_time;
+                   });
+  double start_time = requests[0].arrival_time;
+  for (RequestSpec& request : requests) {
+    request.arrival_time -= start_time;
+  }
+  return requests;
+}
+
+/*! \brief Get the global function registered by the MLC LLM library. */
+const PackedFunc& GetGlobalFunc(const std::string& name) {
+  const PackedFunc* func = Registry::Get(name);
+  CHECK(func != nullptr) << "Cannot find the global function \"" << name
+                         << "\". Please make sure the MLC LLM library is linked.";
+  return *func;
+}
+
+/*! \brief Create the engine request of the given specification. */
+ObjectRef CreateRequest(const std::string& request_id, const RequestSpec& spec,
+                        const std::string& default_generation_cfg_json_str) {
+  // "mlc.serve.TokenData" takes the token ids as variadic arguments.
+  int num_tokens = spec.input_token_ids.size();
+  std::vector<TVMValue> values(num_tokens);
+  std::vector<int> type_codes(num_tokens);
+  TVMArgsSetter setter(values.data(), type_codes.data());
+  for (int i = 0; i < num_tokens; ++i) {
+    setter(i, spec.input_token_ids[i]);
+  }
+  TVMRetValue token_data_rv;
+  GetGlobalFunc("mlc.serve.TokenData")
+      .CallPacked(TVMArgs(values.data(), type_codes.data(), num_tokens), &token_data_rv);
+  ObjectRef token_data = token_data_rv;
+
+  picojson::object generation_cfg;
+  generation_cfg["max_tokens"] = picojson::value(static_cast<int64_t>(spec.output_len));
+  generation_cfg["ignore_eos"] = picojson::value(true);
+  if (spec.grammar) {
+    picojson::object response_format;
+    response_format["type"] = picojson::value("json_object");
+    generation_cfg["response_format"] = picojson::value(response_format);
+  }
+  return GetGlobalFunc("mlc.serve.Request")(
+      String(request_id), Array<ObjectRef>{token_data},
+      String(picojson::value(generation_cfg).serialize()),
+      String(default_generation_cfg_json_str));
+}
+
+/*! \brief Sum the samples of the metric over all label sets in the OpenMetrics text. */
+double SumMetric(const std::string& metrics_text, const std::string& name) {
+  std::istringstream is(metrics_text);
+  std::string line;
+  double sum = 0;
+  while (std::getline(is, line)) {
+    if (line.rfind(name, 0) == 0 && line.size() > name.size() &&
+        (line[name.size()] == ' ' || line[name.size()] == '{')) {
+      sum += std::stod(line.substr(line.rfind(' ') + 1));
+    }
+  }
+  return sum;
+}
+
+/*! \brief Compute the percentile of the samples, or 0 if there is no sample. */
+double Percentile(std::vector<double> samples, double percentile) {
+  if (samples.empty()) {
+    return 0;
+  }
+  int index = std::min(static_cast<int>(samples.size() * percentile / 100),
+                       static_cast<int>(samples.size()) - 1);
+  std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+  return samples[index];
+}
+
+picojson::value PercentilesToJSON(const std::vector<double>& samples) {
+  picojson::object percentiles;
+  for (double percentile : {50.0, 90.0, 99.0}) {
+    percentiles["p" + std::to_string(static_cast<int>(percentile))] =
+        picojson::value(Percentile(samples, percentile));
+  }
+  double sum = 0;
+  for (double sample : samples) {
+    sum += sample;
+  }
+  percentiles["mean"] = picojson::value(samples.empty() ? 0.0 : sum / samples.size());
+  return picojson::value(percentiles);
+}
+
+/*! \brief Run the benchmark and return the report. */
+picojson::object RunBenchmark(const Options& options) {
+  std::string engine_config_json_str = options.GetString("engine-config", "");
+  CHECK(!engine_config_json_str.empty()) << "The engine config must be given by --engine-config.";
+  picojson::object engine_config = json::ParseToJSONObject(engine_config_json_str);
+  Device device = ParseDevice(options.GetString("device", "cuda:0"));
+
+  // - Generate the workload before creating the engine.
+  // The prompts are random token ids in the vocabulary of the model.
+  std::string model_path = json::Lookup<std::string>(engine_config, "model");
+  picojson::object model_config =
+      json::ParseToJSONObject(LoadBytesFromFile(model_path + "/mlc-chat-config.json"));
+  int vocab_size = json::Lookup<int64_t>(model_config, "vocab_size");
+  std::mt19937 rng(options.GetInt("seed", 0));
+  PromptGenerator prompt_generator(vocab_size, options.GetInt("num-shared-prefixes", 4),
+                                   options.GetInt("shared-prefix-len", 256), &rng);
+  std::string trace_path = options.GetString("trace", "");
+  std::vector<RequestSpec> specs = trace_path.empty()
+                                       ? GenerateSyntheticRequests(options, &prompt_generator, &rng)
+                                       : LoadTraceRequests(trace_path, &prompt_generator);
+  int num_requests = specs.size();
+
+  // - Create the engine and start its background loops.
+  std::vector<RequestRecord> records(num_requests);
+  std::mutex records_mutex;
+  std::condition_variable finish_cv;
+  int num_finished = 0;
+  auto frequest_stream_callback = [&](TVMArgs args, TVMRetValue* ret) {
+    Array<ObjectRef> delta_outputs = args[0];
+    Clock::time_point now = Clock::now();
+    const PackedFunc& funpack = GetGlobalFunc("mlc.serve.RequestStreamOutputUnpack");
+    std::lock_guard<std::mutex> lock(records_mutex);
+    for (const ObjectRef& delta_output : delta_outputs) {
+      Array<ObjectRef> unpacked = funpack(delta_output);
+      int request_index = std::stoi(Downcast<String>(unpacked[0]));
+      Array<IntTuple> group_delta_token_ids = Downcast<Array<IntTuple>>(unpacked[1]);
+      Array<Optional<String>> group_finish_reason =
+          Downcast<Array<Optional<String>>>(unpacked[3]);
+      RequestRecord& record = records[request_index];
+      if (!group_delta_token_ids.empty() && !group_delta_token_ids[0].empty()) {
+        if (!record.tfirst_token.has_value()) {
+          record.tfirst_token = now;
+        }
+        record.num_output_tokens += group_delta_token_ids[0].size();
+      }
+      if (group_finish_reason[0].defined() && !record.tfinish.has_value()) {
+        record.tfinish = now;
+        ++num_finished;
+      }
+    }
+    finish_cv.notify_one();
+  };
+  Module engine = GetGlobalFunc("mlc.serve.create_threaded_engine")();
+  engine.GetFunction("init_threaded_engine")(device, PackedFunc(frequest_stream_callback),
+                                             ObjectRef(nullptr));
+  std::thread background_loop_thread(
+      [&engine]() { engine.GetFunction("run_background_loop")(); });
+  std::thread stream_back_loop_thread(
+      [&engine]() { engine.GetFunction("run_background_stream_back_loop")(); });
+  engine.GetFunction("reload")(String(engine_config_json_str));
+  std::string default_generation_cfg_json_str =
+      engine.GetFunction("get_default_generation_config")();
+
+  std::vector<ObjectRef> requests;
+  requests.reserve(num_requests);
+  for (int i = 0; i < num_requests; ++i) {
+    requests.push_back(CreateRequest(std::to_string(i), specs[i], default_generation_cfg_json_str));
+  }
+
+  // - Sample the engine metrics periodically, which does not wait for the engine steps.
+  Clock::time_point tstart = Clock::now();
+  auto f_seconds_since = [](Clock::time_point tbegin, Clock::time_point tend) {
+    return std::chrono::duration<double>(tend - tbegin).count();
+  };
+  std::vector<EngineSample> engine_samples;
+  bool sampling_done = false;
+  std::mutex sampling_mutex;
+  std::condition_variable sampling_cv;
+  std::thread sampling_thread([&]() {
+    PackedFunc fget_metrics = engine.GetFunction("get_metrics");
+    auto interval = std::chrono::milliseconds(options.GetInt("sample-interval-ms", 200));
+    std::unique_lock<std::mutex> lock(sampling_mutex);
+    while (!sampling_done) {
+      std::string metrics_text = fget_metrics();
+      double used_pages = SumMetric(metrics_text, "mlc_kv_cache_used_pages");
+      double free_pages = SumMetric(metrics_text, "mlc_kv_cache_free_pages");
+      engine_samples.push_back(EngineSample{
+          f_seconds_since(tstart, Clock::now()),
+          used_pages + free_pages > 0 ? used_pages / (used_pages + free_pages) : 0.0,
+          static_cast<int64_t>(SumMetric(metrics_text, "mlc_running_requests")),
+          static_cast<int64_t>(SumMetric(metrics_text, "mlc_waiting_requests"))});
+      sampling_cv.wait_for(lock, interval, [&sampling_done]() { return sampling_done; });
+    }
+  });
+
+  // - Send the requests at their arrival times and wait for them to finish.
+  PackedFunc fadd_request = engine.GetFunction("add_request");
+  for (int i = 0; i < num_requests; ++i) {
+    Clock::time_point tarrival =
+        tstart + std::chrono::duration_cast<Clock::duration>(
+                     std::chrono::duration<double>(specs[i].arrival_time));
+    std::this_thread::sleep_until(tarrival);
+    {
+      std::lock_guard<std::mutex> lock(records_mutex);
+      records[i].tarrival = tarrival;
+    }
+    fadd_request(requests[i]);
+  }
+  {
+    std::unique_lock<std::mutex> lock(records_mutex);
+    finish_cv.wait(lock, [&]() { return num_finished == num_requests; });
+  }
+  Clock::time_point tend = Clock::now();
+  {
+    std::lock_guard<std::mutex> lock(sampling_mutex);
+    sampling_done = true;
+  }
+  sampling_cv.notify_one();
+  sampling_thread.join();
+
+  // - Collect the report before shutting down the engine.
+  std::string engine_stats = engine.GetFunction("stats")();
+  picojson::object report;
+  report["engine_stats"] = picojson::value(json::ParseToJSONObject(engine_stats));
+  engine.GetFunction("exit_background_loop")();
+  background_loop_thread.join();
+  stream_back_loop_thread.join();
+
+  double duration = f_seconds_since(tstart, tend);
+  int64_t num_input_tokens = 0;
+  int64_t num_output_tokens = 0;
+  std::vector<double> ttfts;
+  std::vector<double> tpots;
+  std::vector<double> latencies;
+  for (int i = 0; i < num_requests; ++i) {
+    const RequestRecord& record = records[i];
+    num_input_tokens += specs[i].input_token_ids.size();
+    num_output_tokens += record.num_output_tokens;
+    latencies.push_back(f_seconds_since(record.tarrival, record.tfinish.value()));
+    if (record.tfirst_token.has_value()) {
+      ttfts.push_back(f_seconds_since(record.tarrival, record.tfirst_token.value()));
+      if (record.num_output_tokens > 1) {
+        tpots.push_back(f_seconds_since(record.tfirst_token.value(), record.tfinish.value()) /
+                        (record.num_output_tokens - 1));
+      }
+    }
+  }
+  report["num_requests"] = picojson::value(static_cast<int64_t>(num_requests));
+  report["duration_s"] = picojson::value(duration);
+  report["request_throughput"] = picojson::value(num_requests / duration);
+  report["input_token_throughput"] = picojson::value(num_input_tokens / duration);
+  report["output_token_throughput"] = picojson::value(num_output_tokens / duration);
+  report["ttft_s"] = PercentilesToJSON(ttfts);
+  report["tpot_s"] = PercentilesToJSON(tpots);
+  report["latency_s"] = PercentilesToJSON(latencies);
+
+  picojson::array timeline;
+  std::vector<double> kv_cache_utilizations;
+  for (const EngineSample& sample : engine_samples) {
+    picojson::object sample_json;
+    sample_json["time_s"] = picojson::value(sample.time);
+    sample_json["kv_cache_utilization"] = picojson::value(sample.kv_cache_utilization);
+    sample_json["running"] = picojson::value(sample.num_running_requests);
+    sample_json["waiting"] = picojson::value(sample.num_waiting_requests);
+    timeline.push_back(picojson::value(sample_json));
+    kv_cache_utilizations.push_back(sample.kv_cache_utilization);
+  }
+  report["kv_cache_utilization"] = PercentilesToJSON(kv_cache_utilizations);
+  report["timeline"] = picojson::value(timeline);
+  return report;
+}
+
+}  // namespace benchmark
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+int main(int argc, char** argv) {
+  mlc::llm::serve::benchmark::Options options(argc, argv);
+  picojson::object report = mlc::llm::serve::benchmark::RunBenchmark(options);
+  std::cout << picojson::value(report).serialize(true) << std::endl;
+  return 0;
+}
@@ -0,0 +1,367 @@
+/*!
+ *  Copyright (c) 2024 by Contributors
+ * \file serve_microbenchmark.cc
+ * \brief The microbenchmarks of the hot serving components: the samplers, the logit processor,
+ * the paged radix tree and the grammar state matcher.
+ *
+ * The suite uses Google Benchmark, so the results are exported for regression tracking with
+ *   mlc_llm_serve_microbenchmark --benchmark_format=json --benchmark_out=<path>
+ * The CPU sampler, radix tree and grammar benchmarks run without a model. The logit processor
+ * and GPU sampler benchmarks need the compiled model functions, and they are registered only
+ * when the environment variables MLC_BENCHMARK_MODEL and MLC_BENCHMARK_MODEL_LIB give the model
+ * weight directory and the model library. MLC_BENCHMARK_DEVICE selects the device,
+ * e.g., "cuda:0" (default).
+ */
+#include <benchmark/benchmark.h>
+#include <dlpack/dlpack.h>
+#include <tvm/runtime/device_api.h>
+#include <tvm/runtime/ndarray.h>
+
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "serve/config.h"
+#include "serve/grammar/grammar.h"
+#include "serve/grammar/grammar_state_matcher.h"
+#include "serve/logit_processor.h"
+#include "serve/model.h"
+#include "serve/radix_tree.h"
+#include "serve/sampler/sampler.h"
+#include "support/json_parser.h"
+#include "support/random.h"
+
+namespace mlc {
+namespace llm {
+namespace serve {
+namespace benchmark_utils {
+
+using namespace tvm::runtime;
+
+/*! \brief Create the generation configs and request ids of a batch. */
+void CreateBatchConfigs(int batch_size, double temperature, double top_p,
+                        Array<GenerationConfig>* generation_cfg, Array<String>* request_ids) {
+  std::string config_json_str = "{\"temperature\": " + std::to_string(temperature) +
+                                ", \"top_p\": " + std::to_string(top_p) + "}";
+  for (int i = 0; i < batch_size; ++i) {
+    generation_cfg->push_back(GenerationConfig(config_json_str, NullOpt));
+    request_ids->push_back(std::to_string(i));
+  }
+}
+
+/*! \brief Create a batch of random normalized probability distributions on CPU. */
+NDArray CreateRandomProbs(int batch_size, int vocab_size, std::mt19937* rng) {
+  NDArray probs = NDArray::Empty({batch_size, vocab_size}, DataType::Float(32), Device{kDLCPU, 0});
+  float* data = static_cast<float*>(probs->data);
+  std::exponential_distribution<float> dist(1.0);
+  for (int i = 0; i < batch_size; ++i) {
+    float sum = 0;
+    for (int j = 0; j < vocab_size; ++j) {
+      // Cubing the samples makes the distributions peaked like the real ones.
+      float value = dist(*rng);
+      data[i * vocab_size + j] = value * value * value;
+      sum += data[i * vocab_size + j];
+    }
+    for (int j = 0; j < vocab_size; ++j) {
+      data[i * vocab_size + j] /= sum;
+    }
+  }
+  return probs;
+}
+
+/*!
+ * \brief Create a token table of the given size, which contains all printable ASCII characters
+ * as single-byte tokens, random multi-byte tokens and the stop token "</s>" at the end.
+ */
+std::vector<std::string> CreateTokenTable(int vocab_size, std::mt19937* rng) {
+  static const std::string kCharset =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 \"{}[]:,.-_";
+  std::vector<std::string> token_table;
+  for (char c = 0x20; c < 0x7f; ++c) {
+    token_table.push_back(std::string(1, c));
+  }
+  std::uniform_int_distribution<int> length_dist(2, 8);
+  std::uniform_int_distribution<int> char_dist(0, kCharset.size() - 1);
+  while (static_cast<int>(token_table.size()) < vocab_size - 1) {
+    std::string token(length_dist(*rng), ' ');
+    for (char& c : token) {
+      c = kCharset[char_dist(*rng)];
+    }
+    token_table.push_back(std::move(token));
+  }
+  token_table.push_back("</s>");
+  return token_table;
+}
+
+/*!
+ * \brief Create a JSON schema of an object with the given number of properties, which cycle
+ * through strings, integers, number arrays and nested objects.
+ */
+std::string CreateJSONSchema(int num_properties) {
+  std::string properties;
+  std::string required;
+  for (int i = 0; i < num_properties; ++i) {
+    std::string name = "\"field_" + std::to_string(i) + "\"";
+    std::string type;
+    switch (i % 4) {
+      case 0:
+        type = "{\"type\": \"string\"}";
+        break;
+      case 1:
+        type = "{\"type\": \"integer\"}";
+        break;
+      case 2:
+        type = "{\"type\": \"array\", \"items\": {\"type\": \"number\"}}";
+        break;
+      default:
+        type =
+            "{\"type\": \"object\", \"properties\": {\"name\": {\"type\": \"string\"}, "
+            "\"value\": {\"type\": \"boolean\"}}, \"required\": [\"name\", \"value\"]}";
+    }
+    properties += (i > 0 ? ", " : "") + name + ": " + type;
+    required += (i > 0 ? ", " : "") + name;
+  }
+  return "{\"type\": \"object\", \"properties\": {" + properties + "}, \"required\": [" +
+         required + "]}";
+}
+
+/*! \brief The model whose function table drives the logit processor and GPU sampler. */
+struct BenchmarkModel {
+  Model model;
+  Device device;
+  int vocab_size;
+};
+
+/*! \brief Load the model given by the environment variables, or return nullptr if not given. */
+std::unique_ptr<BenchmarkModel> LoadBenchmarkModel() {
+  const char* model_path = std::getenv("MLC_BENCHMARK_MODEL");
+  const char* model_lib = std::getenv("MLC_BENCHMARK_MODEL_LIB");
+  if (model_path == nullptr || model_lib == nullptr) {
+    return nullptr;
+  }
+  static const std::unordered_map<std::string, DLDeviceType> kDeviceTypes = {
+      {"cuda", kDLCUDA}, {"rocm", kDLROCM}, {"metal", kDLMetal}, {"vulkan", kDLVulkan}};
+  const char* device_env = std::getenv("MLC_BENCHMARK_DEVICE");
+  std::string device_str = device_env == nullptr ? "cuda:0" : device_env;
+  size_t pos = device_str.find(':');
+  auto it = kDeviceTypes.find(device_str.substr(0, pos));
+  CHECK(it != kDeviceTypes.end()) << "Unsupported device \"" << device_str << "\".";
+  Device device{it->second, pos == std::string::npos ? 0 : std::stoi(device_str.substr(pos + 1))};
+
+  Result<picojson::object> model_config_res = Model::LoadModelConfig(model_path);
+  CHECK(model_config_res.IsOk()) << model_config_res.UnwrapErr();
+  picojson::object model_config = model_config_res.Unwrap();
+  Model model =
+      Model::Create(model_lib, model_path, model_config, device, NullOpt, /*trace_enabled=*/false);
+  int vocab_size = json::Lookup<int64_t>(model_config, "vocab_size");
+  return std::make_unique<BenchmarkModel>(BenchmarkModel{model, device, vocab_size});
+}
+
+}  // namespace benchmark_utils
+
+/****************** CPU Sampler ******************/
+
+/*!
+ * \brief Benchmark the CPU sampler, which applies top-p and samples from the probabilities.
+ * Args: batch size, vocab size, top-p in percent.
+ */
+void BM_CPUSamplerBatchSampleTokens(benchmark::State& state) {
+  int batch_size = state.range(0);
+  int vocab_size = state.range(1);
+  double top_p = state.range(2) / 100.0;
+  std::mt19937 rng(0);
+  NDArray probs = benchmark_utils::CreateRandomProbs(batch_size, vocab_size, &rng);
+  Array<GenerationConfig> generation_cfg;
+  Array<String> request_ids;
+  benchmark_utils::CreateBatchConfigs(batch_size, 1.0, top_p, &generation_cfg, &request_ids);
+  std::vector<int> sample_indices(batch_size);
+  std::vector<RandomGenerator> rng_storage(batch_size);
+  std::vector<RandomGenerator*> rngs;
+  for (int i = 0; i < batch_size; ++i) {
+    sample_indices[i] = i;
+    rngs.push_back(&rng_storage[i]);
+  }
+
+  Sampler sampler = Sampler::CreateCPUSampler(NullOpt);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sampler->BatchSampleTokensWithProbBeforeTopP(
+        probs, sample_indices, request_ids, generation_cfg, rngs));
+  }
+  state.SetItemsProcessed(state.iterations() * batch_size);
+}
+BENCHMARK(BM_CPUSamplerBatchSampleTokens)
+    ->ArgNames({"batch", "vocab", "top_p"})
+    ->ArgsProduct({{1, 8, 32}, {32000, 128256}, {100, 90}})
+    ->Unit(benchmark::kMicrosecond);
+
+/****************** Paged Radix Tree ******************/
+
+/*!
+ * \brief Benchmark matching a prompt in the radix tree that holds sequences sharing a prefix.
+ * Args: shared prefix depth in tokens, number of sequences in the tree.
+ */
+void BM_PagedRadixTreeMatchPrefix(benchmark::State& state) {
+  int prefix_depth = state.range(0);
+  int num_sequences = state.range(1);
+  constexpr int kSuffixLength = 64;
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int64_t> token_dist(0, 31999);
+  auto f_random_tokens = [&](int length) {
+    std::vector<int64_t> tokens(length);
+    for (int64_t& token : tokens) {
+      token = token_dist(rng);
+    }
+    return tokens;
+  };
+
+  PagedRadixTree tree = PagedRadixTree::Create();
+  std::vector<int64_t> prefix = f_random_tokens(prefix_depth);
+  for (int seq_id = 0; seq_id < num_sequences; ++seq_id) {
+    std::vector<int64_t> tokens = prefix;
+    std::vector<int64_t> suffix = f_random_tokens(kSuffixLength);
+    tokens.insert(tokens.end(), suffix.begin(), suffix.end());
+    tree->AddSequence(seq_id);
+    tree->ExtendSequence(seq_id, IntTuple(tokens));
+  }
+  std::vector<int64_t> query = prefix;
+  std::vector<int64_t> query_suffix = f_random_tokens(kSuffixLength);
+  query.insert(query.end(), query_suffix.begin(), query_suffix.end());
+  IntTuple query_tuple(query);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(tree->MatchPrefix(query_tuple));
+  }
+  state.SetItemsProcessed(state.iterations() * query.size());
+}
+BENCHMARK(BM_PagedRadixTreeMatchPrefix)
+    ->ArgNames({"prefix_depth", "num_seqs"})
+    ->ArgsProduct({{64, 1024, 8192}, {16, 256}})
+    ->Unit(benchmark::kMicrosecond);
+
+/****************** Grammar State Matcher ******************/
+
+/*!
+ * \brief Benchmark finding the next token bitmask right after the opening brace of a JSON
+ * object. Args: vocab size, number of schema properties (0 for the builtin JSON grammar).
+ */
+void BM_GrammarStateMatcherFindNextTokenBitmask(benchmark::State& state) {
+  int vocab_size = state.range(0);
+  int num_properties = state.range(1);
+  std::mt19937 rng(0);
+  std::vector<std::string> token_table = benchmark_utils::CreateTokenTable(vocab_size, &rng);
+  BNFGrammar grammar = num_properties == 0
+                           ? BNFGrammar::GetGrammarOfJSON()
+                           : BNFGrammar::FromSchema(benchmark_utils::CreateJSONSchema(
+                                 num_properties));
+  GrammarStateMatcher matcher(GrammarStateMatcher::CreateInitContext(grammar, token_table));
+  // The single-byte tokens start from the space character.
+  CHECK(matcher->AcceptToken('{' - 0x20));
+
+  std::vector<uint32_t> bitmask((vocab_size + 31) / 32);
+  int64_t bitmask_shape = bitmask.size();
+  DLTensor bitmask_dltensor{bitmask.data(),
+                            Device{kDLCPU, 0},
+                            /*ndim=*/1,
+                            DLDataType{kDLUInt, 32, 1},
+                            &bitmask_shape,
+                            /*strides=*/nullptr,
+                            /*byte_offset=*/0};
+  for (auto _ : state) {
+    matcher->FindNextTokenBitmask(&bitmask_dltensor);
+    benchmark::DoNotOptimize(bitmask.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GrammarStateMatcherFindNextTokenBitmask)
+    ->ArgNames({"vocab", "num_props"})
+    ->ArgsProduct({{32000, 128256}, {0, 4, 32}})
+    ->Unit(benchmark::kMicrosecond);
+
+/****************** Logit Processor and GPU Sampler ******************/
+
+/*!
+ * \brief Benchmark computing the probabilities from the logits on the model device.
+ * Args: batch size.
+ */
+void BM_LogitProcessorComputeProbs(benchmark::State& state,
+                                   const benchmark_utils::BenchmarkModel* bench_model) {
+  int batch_size = state.range(0);
+  LogitProcessor logit_processor = bench_model->model->CreateLogitProcessor(batch_size, NullOpt);
+  NDArray logits = NDArray::Empty({batch_size, bench_model->vocab_size}, DataType::Float(32),
+                                  bench_model->device);
+  Array<GenerationConfig> generation_cfg;
+  Array<String> request_ids;
+  benchmark_utils::CreateBatchConfigs(batch_size, 0.7, 0.9, &generation_cfg, &request_ids);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        logit_processor->ComputeProbsFromLogits(logits, generation_cfg, request_ids));
+    DeviceAPI::Get(bench_model->device)->StreamSync(bench_model->device, nullptr);
+  }
+  state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+/*!
+ * \brief Benchmark the sampler of the model device, which is the GPU sampler on CUDA, on the
+ * probabilities of the logit processor. Args: batch size, top-p in percent.
+ */
+void BM_GPUSamplerBatchSampleTokens(benchmark::State& state,
+                                    const benchmark_utils::BenchmarkModel* bench_model) {
+  int batch_size = state.range(0);
+  double top_p = state.range(1) / 100.0;
+  LogitProcessor logit_processor = bench_model->model->CreateLogitProcessor(batch_size, NullOpt);
+  Sampler sampler = bench_model->model->CreateSampler(batch_size, /*num_models=*/1, NullOpt);
+  NDArray logits = NDArray::Empty({batch_size, bench_model->vocab_size}, DataType::Float(32),
+                                  bench_model->device);
+  Array<GenerationConfig> generation_cfg;
+  Array<String> request_ids;
+  benchmark_utils::CreateBatchConfigs(batch_size, 0.7, top_p, &generation_cfg, &request_ids);
+  NDArray probs = logit_processor->ComputeProbsFromLogits(logits, generation_cfg, request_ids);
+  std::vector<int> sample_indices(batch_size);
+  std::vector<RandomGenerator> rng_storage(batch_size);
+  std::vector<RandomGenerator*> rngs;
+  for (int i = 0; i < batch_size; ++i) {
+    sample_indices[i] = i;
+    rngs.push_back(&rng_storage[i]);
+  }
+  for (auto _ : state) {
+    // The sampling results are copied to host, which synchronizes the device.
+    benchmark::DoNotOptimize(sampler->BatchSampleTokensWithProbBeforeTopP(
+        probs, sample_indices, request_ids, generation_cfg, rngs));
+  }
+  state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+}  // namespace serve
+}  // namespace llm
+}  // namespace mlc
+
+int main(int argc, char** argv) {
+  using namespace mlc::llm::serve;
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  std::unique_ptr<benchmark_utils::BenchmarkModel> bench_model =
+      benchmark_utils::LoadBenchmarkModel();
+  if (bench_model != nullptr) {
+    benchmark::RegisterBenchmark("BM_LogitProcessorComputeProbs", BM_LogitProcessorComputeProbs,
+                                 bench_model.get())
+        ->ArgNames({"batch"})
+        ->Args({1})
+        ->Args({8})
+        ->Args({32})
+        ->Args({128})
+        ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark("BM_GPUSamplerBatchSampleTokens", BM_GPUSamplerBatchSampleTokens,
+                                 bench_model.get())
+        ->ArgNames({"batch", "top_p"})
+        ->ArgsProduct({{1, 8, 32, 128}, {100, 90}})
+        ->Unit(benchmark::kMicrosecond);
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
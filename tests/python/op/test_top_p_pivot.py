@@ -3,7 +3,7 @@ import pytest
 import tvm
 import tvm.testing
 
-from mlc_llm.op.top_p_pivot import top_p_pivot, top_p_renorm
+from mlc_llm.op.top_p_pivot import top_k_min_p_pivot, top_p_pivot, top_p_renorm
 
 # mypy: disable-error-code="var-annotated"
 
@@ -79,5 +79,58 @@ def test_top_p_renorm(batch_size, vocab):
         verify_pivot(p_np[i], final_pivot[i], final_lsum[i], renorm[i])
 
 
+@pytest.mark.parametrize("batch_size", [1, 32])
+@pytest.mark.parametrize("vocab", [3, 32, 128, 2000])
+@pytest.mark.parametrize("top_k", [0, 1, 5, "vocab", "vocab+10"])
+@pytest.mark.parametrize("min_p", [0.0, 0.1])
+def test_top_k_min_p_renorm(batch_size, vocab, top_k, min_p):
+    if top_k == "vocab":
+        top_k = vocab
+    elif top_k == "vocab+10":
+        top_k = vocab + 10
+
+    p_np = np.random.exponential(3, size=(batch_size, vocab)).astype(np.float32)
+    p_np /= np.sum(p_np, axis=-1, keepdims=True)
+    top_k_np = np.full((batch_size,), top_k, dtype=np.int32)
+    min_p_np = np.full((batch_size,), min_p, dtype=np.float32)
+
+    target = tvm.target.Target("cuda")
+    dev = tvm.cuda(0)
+    var_prob = tvm.nd.array(p_np, dev)
+    var_top_k = tvm.nd.array(top_k_np, dev)
+    var_min_p = tvm.nd.array(min_p_np, dev)
+    var_final_pivot = tvm.nd.array(np.zeros(batch_size, dtype=np.float32), dev)
+    var_final_lsum = tvm.nd.array(np.zeros(batch_size, dtype=np.float32), dev)
+    var_renorm = tvm.nd.array(np.zeros_like(p_np), dev)
+
+    mod = tvm.build(top_k_min_p_pivot(target), target=target)
+    mod(var_prob, var_top_k, var_min_p, var_final_pivot, var_final_lsum)
+    mod_renorm = tvm.build(top_p_renorm(target), target=target)
+    mod_renorm(var_prob, var_final_pivot, var_final_lsum, var_renorm)
+    final_pivot = var_final_pivot.numpy()
+    final_lsum = var_final_lsum.numpy()
+    renorm = var_renorm.numpy()
+
+    for i in range(batch_size):
+        # The reference cut-off is the larger of the k-th largest probability in the sorted
+        # probabilities and min_p times the maximum probability.
+        probs = p_np[i]
+        sorted_probs = np.sort(probs)[::-1]
+        pivot_ref = np.float32(min_p) * sorted_probs[0]
+        if 0 < top_k < vocab:
+            pivot_ref = max(pivot_ref, sorted_probs[top_k - 1])
+        kept = probs >= pivot_ref
+        renorm_ref = np.where(kept, probs, 0) / np.sum(probs[kept])
+
+        assert final_pivot[i] == pivot_ref
+        assert np.isclose(final_lsum[i], np.sum(probs[kept]), atol=1e-6, rtol=1e-5)
+        assert np.allclose(renorm[i], renorm_ref, atol=1e-6, rtol=1e-5)
+        if min_p == 0.0:
+            # The ties with the pivot are all kept, which random probabilities do not have.
+            assert np.sum(renorm[i] > 0) == (top_k if 0 < top_k < vocab else vocab)
+        if top_k == 1:
+            assert renorm[i][np.argmax(probs)] == 1.0
+
+
 if __name__ == "__main__":
     tvm.testing.main()
@@ -280,9 +280,9 @@ c ::= [a-z]
 """
     expected_obj = {
         "rules": [
-            {"body_expr_id": 6, "name": "main"},
-            {"body_expr_id": 9, "name": "b"},
-            {"body_expr_id": 12, "name": "c"},
+            {"body_expr_id": 6, "name": "main", "lookahead_assertion_id": -1},
+            {"body_expr_id": 9, "name": "b", "lookahead_assertion_id": -1},
+            {"body_expr_id": 12, "name": "c", "lookahead_assertion_id": -1},
         ],
         "rule_expr_indptr": [0, 3, 6, 10, 13, 16, 20, 24, 29, 32, 35, 40, 43],
         "rule_expr_data": [
@@ -291,6 +291,7 @@ c ::= [a-z]
             100,5,1,7,6,1,8,1,3,0,97,122,5,1,10,6,1,11
             # fmt: on
         ],
+        "main_rule_id": 0,
     }
     bnf_grammar = BNFGrammar.from_ebnf_string(before, "main")
     print(bnf_grammar)
@@ -318,5 +319,14 @@ d_1 ::= ("" | ("d"))
     assert output_str == before
 
 
+def test_to_json_roundtrip_lookahead_assertion():
+    before = """main ::= a [b]
+a ::= "c" (=[b])
+"""
+    bnf_grammar_1 = BNFGrammar.from_ebnf_string(before, "main")
+    bnf_grammar_2 = BNFGrammar.from_json(bnf_grammar_1.to_json(False))
+    assert bnf_grammar_2.to_string() == bnf_grammar_1.to_string()
+
+
 if __name__ == "__main__":
     tvm.testing.main()
@@ -10,6 +10,11 @@ import tvm.testing
 from tvm import TVMError
 
 from mlc_llm.serve import BNFGrammar, GrammarStateMatcher
+from mlc_llm.serve.grammar import (
+    compile_json_schema,
+    debug_compact_intset_decode,
+    debug_compact_intset_encode,
+)
 from mlc_llm.tokenizer import Tokenizer
 
 
@@ -437,6 +442,222 @@ def test_termination(json_grammar: BNFGrammar):
     assert grammar_state_matcher.accept_token(input_ids[-2])
 
 
+def test_accept_tokens(json_grammar: BNFGrammar):
+    token_table = [
+        # fmt: off
+        "<s>", "</s>", "a", "abc", 'b"', '"', ':"', "{", "}", ", ", "6", ":", "\n", " ", '"a":true',
+        # fmt: on
+    ]
+    input_splitted = ["{", '"', "abc", 'b"', ":", "6", ", ", " ", '"a":true', "}", "</s>"]
+    input_ids = [token_table.index(t) for t in input_splitted]
+
+    grammar_state_matcher = GrammarStateMatcher(json_grammar, token_table, 5)
+    reference_matcher = GrammarStateMatcher(json_grammar, token_table, 5)
+    init_result = grammar_state_matcher.find_next_rejected_tokens()
+
+    # "}" is rejected after the key, so only the tokens before it are accepted.
+    assert grammar_state_matcher.accept_tokens(input_ids[:4] + [token_table.index("}")]) == 4
+    for i in input_ids[:4]:
+        assert reference_matcher.accept_token(i)
+    assert (
+        grammar_state_matcher.find_next_rejected_tokens()
+        == reference_matcher.find_next_rejected_tokens()
+    )
+
+    # The accepted tokens are rolled back one by one.
+    grammar_state_matcher.rollback(4)
+    assert grammar_state_matcher.find_next_rejected_tokens() == init_result
+
+    # No token is accepted after the matcher terminates.
+    assert grammar_state_matcher.accept_tokens(input_ids + [token_table.index("a")]) == len(
+        input_ids
+    )
+    assert grammar_state_matcher.is_terminated()
+    assert grammar_state_matcher.accept_tokens([token_table.index("a")]) == 0
+
+    # Only the latest history within the maximum number of rollback steps is kept.
+    with pytest.raises(TVMError):
+        grammar_state_matcher.rollback(6)
+    grammar_state_matcher.rollback(5)
+    reference_matcher.reset_state()
+    for i in input_ids[:6]:
+        assert reference_matcher.accept_token(i)
+    assert (
+        grammar_state_matcher.find_next_rejected_tokens()
+        == reference_matcher.find_next_rejected_tokens()
+    )
+
+
+def test_snapshot_after_rollback(json_grammar: BNFGrammar):
+    token_table = [
+        # fmt: off
+        "<s>", "</s>", "a", "abc", 'b"', '"', ':"', "{", "}", ", ", "6", ":", "\n", " ", '"a":true',
+        # fmt: on
+    ]
+    input_splitted = ["{", '"', "abc", 'b"', ":", "6", ", ", " ", '"a":true', "}", "</s>"]
+    input_ids = [token_table.index(t) for t in input_splitted]
+
+    grammar_state_matcher = GrammarStateMatcher(json_grammar, token_table, 2)
+    reference_matcher = GrammarStateMatcher(json_grammar, token_table, 2)
+    for i in input_ids[:3]:
+        assert reference_matcher.accept_token(i)
+    expected_result = reference_matcher.find_next_rejected_tokens()
+
+    assert grammar_state_matcher.accept_tokens(input_ids[:4]) == 4
+    grammar_state_matcher.rollback(1)
+    assert grammar_state_matcher.find_next_rejected_tokens() == expected_result
+
+    # The history after the snapshot is kept beyond the maximum number of rollback steps, so the
+    # tokens after the snapshot can be rolled back in part before the snapshot is restored.
+    snapshot = grammar_state_matcher.save_snapshot()
+    assert grammar_state_matcher.accept_tokens(input_ids[3:9]) == 6
+    grammar_state_matcher.rollback(4)
+    nested_snapshot = grammar_state_matcher.save_snapshot()
+    assert grammar_state_matcher.accept_tokens(input_ids[5:]) == len(input_ids) - 5
+    assert grammar_state_matcher.is_terminated()
+    grammar_state_matcher.restore_snapshot(nested_snapshot)
+    grammar_state_matcher.restore_snapshot(snapshot)
+    assert grammar_state_matcher.find_next_rejected_tokens() == expected_result
+
+    # The matcher continues from the restored state.
+    for i in input_ids[3:]:
+        assert grammar_state_matcher.accept_token(i)
+        assert reference_matcher.accept_token(i)
+        if not grammar_state_matcher.is_terminated():
+            assert (
+                grammar_state_matcher.find_next_rejected_tokens()
+                == reference_matcher.find_next_rejected_tokens()
+            )
+    assert grammar_state_matcher.is_terminated()
+
+
+def test_compact_intset_round_trip():
+    # Long runs of consecutive integers are kept as runs.
+    values = list(range(0, 50)) + list(range(100, 150)) + [200]
+    is_runs, data = debug_compact_intset_encode(values)
+    assert is_runs
+    assert data == [0, 50, 100, 150, 200, 201]
+    assert debug_compact_intset_decode(is_runs, data, 201) == values
+
+    # Scattered integers are kept as they are.
+    values = [1, 3, 5, 7, 8]
+    is_runs, data = debug_compact_intset_encode(values)
+    assert not is_runs
+    assert data == values
+    assert debug_compact_intset_decode(is_runs, data, 9) == values
+
+    assert debug_compact_intset_encode([]) == (False, [])
+    assert debug_compact_intset_decode(False, [], 0) == []
+    assert debug_compact_intset_decode(True, [], 0) == []
+
+
+def test_compact_intset_reject_invalid_data():
+    # The runs exceed the upper bound.
+    assert debug_compact_intset_decode(True, [0, 5], 4) is None
+    assert debug_compact_intset_decode(True, [-1, 2], 4) is None
+    # The runs are empty, unsorted or overlapping, or a run misses its end.
+    assert debug_compact_intset_decode(True, [3, 3], 10) is None
+    assert debug_compact_intset_decode(True, [5, 7, 1, 3], 10) is None
+    assert debug_compact_intset_decode(True, [0, 4, 3, 6], 10) is None
+    assert debug_compact_intset_decode(True, [0, 4, 6], 10) is None
+    # The integers exceed the upper bound, or are unsorted or duplicated.
+    assert debug_compact_intset_decode(False, [0, 3, 10], 10) is None
+    assert debug_compact_intset_decode(False, [3, 1], 10) is None
+    assert debug_compact_intset_decode(False, [1, 1], 10) is None
+
+
+def test_init_context_serialization(json_grammar: BNFGrammar):
+    # The printable characters are adjacent in the sorted token table, so that the rejected
+    # tokens of most positions are kept as runs.
+    token_table = ["<s>", "</s>"] + [chr(c) for c in range(32, 127)]
+    token_table += ['"a"', '{"', '":', "true", "false", "null", ", ", ": ", "123", '"a":true']
+    input_splitted = ["{", '"a"', ": ", "123", ", ", '"a":true', ", ", '"', "b", '":', "null", "}"]
+    input_ids = [token_table.index(t) for t in input_splitted]
+    input_ids.append(token_table.index("</s>"))
+
+    data = GrammarStateMatcher.debug_serialize_init_context(json_grammar, token_table)
+    assert data[:8] == b"2XCIGCLM"  # "MLCGICX2" in little endian
+    matcher_loaded = GrammarStateMatcher.debug_from_serialized_init_context(
+        data, json_grammar, token_table
+    )
+    assert matcher_loaded is not None
+    matcher = GrammarStateMatcher(json_grammar, token_table)
+
+    # The loaded token sets give the same bitmasks as the ones preprocessed from scratch.
+    for token_id in input_ids:
+        bitmask = matcher.find_next_token_bitmask_as_ndarray().numpy()
+        bitmask_loaded = matcher_loaded.find_next_token_bitmask_as_ndarray().numpy()
+        assert (bitmask == bitmask_loaded).all()
+        assert matcher.accept_token(token_id)
+        assert matcher_loaded.accept_token(token_id)
+    assert matcher_loaded.is_terminated()
+
+    # The cache files of the old format, truncated files, and the files of another grammar or
+    # token table are rejected and rebuilt.
+    assert (
+        GrammarStateMatcher.debug_from_serialized_init_context(
+            b"1" + data[1:], json_grammar, token_table
+        )
+        is None
+    )
+    assert (
+        GrammarStateMatcher.debug_from_serialized_init_context(
+            data[: len(data) // 2], json_grammar, token_table
+        )
+        is None
+    )
+    assert (
+        GrammarStateMatcher.debug_from_serialized_init_context(
+            data, BNFGrammar.from_ebnf_string('main ::= "a"'), token_table
+        )
+        is None
+    )
+    assert (
+        GrammarStateMatcher.debug_from_serialized_init_context(
+            data, json_grammar, token_table + ["extra"]
+        )
+        is None
+    )
+
+
+compiled_grammar_schema_input = [
+    # The empty schema stands for the built-in JSON grammar.
+    ("", ["{", '"a"', ": ", "123", ", ", '"', "b", '":', "null", "}"]),
+    (
+        '{"type": "object", "properties": {"a": {"type": "boolean"}}, "required": ["a"]}',
+        ["{", '"a"', ": ", "true", "}"],
+    ),
+]
+
+
+@pytest.mark.parametrize("schema, input_splitted", compiled_grammar_schema_input)
+@pytest.mark.parametrize("binary", [False, True])
+def test_compiled_grammar_round_trip(schema: str, input_splitted: List[str], binary: bool):
+    token_table = ["<s>", "</s>"] + [chr(c) for c in range(32, 127)]
+    token_table += ['"a"', '{"', '":', "true", "false", "null", ", ", ": ", "123", '"a":true']
+    input_ids = [token_table.index(t) for t in input_splitted]
+    input_ids.append(token_table.index("</s>"))
+
+    compiled_grammar = compile_json_schema(schema, token_table, binary=binary)
+    assert isinstance(compiled_grammar, bytes if binary else str)
+    matcher_loaded = GrammarStateMatcher.from_compiled_grammar(compiled_grammar, token_table)
+    grammar = BNFGrammar.from_schema(schema) if schema else BNFGrammar.get_grammar_of_json()
+    matcher = GrammarStateMatcher(grammar, token_table)
+
+    # The loaded grammar gives the same bitmasks as the one compiled from scratch.
+    for token_id in input_ids:
+        bitmask = matcher.find_next_token_bitmask_as_ndarray().numpy()
+        bitmask_loaded = matcher_loaded.find_next_token_bitmask_as_ndarray().numpy()
+        assert (bitmask == bitmask_loaded).all()
+        assert matcher.accept_token(token_id)
+        assert matcher_loaded.accept_token(token_id)
+    assert matcher_loaded.is_terminated()
+
+    # The compiled grammar cannot be loaded with another token table.
+    with pytest.raises(TVMError):
+        GrammarStateMatcher.from_compiled_grammar(compiled_grammar, token_table + ["extra"])
+
+
 if __name__ == "__main__":
     # Run a benchmark to show the performance before running tests
     test_find_next_rejected_tokens(
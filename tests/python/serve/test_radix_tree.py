@@ -1,3 +1,5 @@
+import random
+
 from mlc_llm.serve import PagedRadixTree
 
 
@@ -112,9 +114,68 @@ def test_rollback():
             seq_id += 2
 
 
+def test_exclusive_length():
+    prt = PagedRadixTree()
+    prt.add(0)
+    prt.extend(0, list(range(200)))
+    assert prt.get_exclusive_length(0) == 200
+    prt.fork(1, 0, 100)
+    assert prt.get_exclusive_length(0) == 100
+    assert prt.get_exclusive_length(1) == 0
+    prt.extend(1, [1000 + i for i in range(50)])
+    assert prt.get_exclusive_length(1) == 50
+    prt.remove(0)
+    assert prt.get_exclusive_length(1) == 150
+
+
+
+def test_exclusive_length_neighbors():
+    # The exclusive lengths of the sequences other than the neighbors never change.
+    rng = random.Random(0)
+    prt = PagedRadixTree()
+    seq_lengths = {}
+
+    def f_change(seq_id, f_apply, neighbors_before_change):
+        exclusive_lengths = {i: prt.get_exclusive_length(i) for i in seq_lengths if i != seq_id}
+        if neighbors_before_change:
+            neighbors = prt.get_exclusive_length_neighbors(seq_id)
+            f_apply()
+        else:
+            f_apply()
+            neighbors = prt.get_exclusive_length_neighbors(seq_id)
+        for i, exclusive_length in exclusive_lengths.items():
+            if i in seq_lengths and i not in neighbors:
+                assert prt.get_exclusive_length(i) == exclusive_length
+
+    for seq_id in range(300):
+        # The tokens of a small vocabulary share prefixes often.
+        tokens = [rng.randrange(3) for _ in range(rng.randrange(1, 300))]
+        nonempty_seqs = [i for i, length in seq_lengths.items() if length > 0]
+        if nonempty_seqs and rng.random() < 0.5:
+            parent_seq_id = rng.choice(nonempty_seqs)
+            offset = rng.randrange(1, seq_lengths[parent_seq_id] + 1)
+            f_change(seq_id, lambda: prt.fork(seq_id, parent_seq_id, offset), False)
+            seq_lengths[seq_id] = offset
+        else:
+            f_change(seq_id, lambda: prt.add(seq_id), False)
+            seq_lengths[seq_id] = 0
+        f_change(seq_id, lambda: prt.extend(seq_id, tokens), False)
+        seq_lengths[seq_id] += len(tokens)
+
+        changed_seq_id = rng.choice(list(seq_lengths))
+        if len(seq_lengths) > 16:
+            f_change(changed_seq_id, lambda: prt.remove(changed_seq_id), True)
+            del seq_lengths[changed_seq_id]
+        elif seq_lengths[changed_seq_id] > 0:
+            num_tokens = rng.randrange(1, seq_lengths[changed_seq_id] + 1)
+            f_change(changed_seq_id, lambda: prt.rollback(changed_seq_id, num_tokens), True)
+            seq_lengths[changed_seq_id] -= num_tokens
+
 if __name__ == "__main__":
     test_add()
     test_remove()
     test_extend()
     test_fork()
     test_rollback()
+    test_exclusive_length()
+    test_exclusive_length_neighbors()
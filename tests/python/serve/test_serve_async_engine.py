@@ -1,8 +1,13 @@
 # pylint: disable=chained-comparison,line-too-long,missing-docstring,
 # pylint: disable=too-many-arguments,too-many-locals,unused-argument,unused-variable
 import asyncio
-from typing import List
+import json
+from http import HTTPStatus
+from typing import List, Optional
 
+import pytest
+
+from mlc_llm.protocol import error_protocol
 from mlc_llm.serve import AsyncMLCEngine, GenerationConfig
 
 prompts = [
@@ -272,9 +277,124 @@ async def test_completion_non_stream():
     del async_engine
 
 
+async def test_engine_abort_mid_step():
+    # Create engine
+    model = "HF://mlc-ai/Llama-2-7b-chat-hf-q0f16-MLC"
+    async_engine = AsyncMLCEngine(
+        model=model,
+        mode="server",
+        max_total_sequence_length=4096,
+    )
+
+    num_requests = 4
+    max_tokens = 256
+    generation_cfg = GenerationConfig(max_tokens=max_tokens, temperature=0)
+    num_tokens: List[int] = [0 for _ in range(num_requests)]
+    finish_reasons: List[Optional[str]] = [None for _ in range(num_requests)]
+    first_tokens_received = asyncio.Event()
+
+    async def generate_task(prompt: str, request_id: str):
+        rid = int(request_id)
+        async for delta_outputs in async_engine._generate(
+            prompt, generation_cfg, request_id=request_id
+        ):
+            num_tokens[rid] += delta_outputs[0].num_delta_tokens
+            if delta_outputs[0].finish_reason is not None:
+                finish_reasons[rid] = delta_outputs[0].finish_reason
+            if rid == 0 and num_tokens[rid] >= 4:
+                first_tokens_received.set()
+
+    tasks = [
+        asyncio.create_task(generate_task(prompts[i], request_id=str(i)))
+        for i in range(num_requests)
+    ]
+    # Cancel request 0 while the engine is decoding the batch. The engine thread marks it as
+    # cancelled right away, and the actions of the running step leave it out.
+    await first_tokens_received.wait()
+    tasks[0].cancel()
+    results = await asyncio.gather(*tasks, return_exceptions=True)
+    assert isinstance(results[0], asyncio.CancelledError)
+    assert finish_reasons[0] is None
+    assert num_tokens[0] < max_tokens
+    for rid in range(1, num_requests):
+        assert results[rid] is None
+        assert finish_reasons[rid] is not None
+        assert num_tokens[rid] > 0
+
+    # The engine keeps serving after the abort, with the same outputs under greedy decoding.
+    output_texts: List[str] = ["" for _ in range(2)]
+
+    async def generate_text_task(prompt: str, request_id: str):
+        async for delta_outputs in async_engine._generate(
+            prompt, generation_cfg, request_id=request_id
+        ):
+            output_texts[int(request_id)] += delta_outputs[0].delta_text
+
+    await asyncio.gather(
+        *[asyncio.create_task(generate_text_task(prompts[1], str(i))) for i in range(2)]
+    )
+    assert output_texts[0] == output_texts[1]
+
+    async_engine.terminate()
+    del async_engine
+
+
+async def test_load_shedding():
+    # Create engine, which runs one request at a time so that the other requests wait.
+    model = "HF://mlc-ai/Llama-2-7b-chat-hf-q0f16-MLC"
+    async_engine = AsyncMLCEngine(
+        model=model,
+        mode="server",
+        max_batch_size=1,
+        max_total_sequence_length=4096,
+        engine_config_overrides={
+            "load_shedding": True,
+            "load_shedding_max_queue_time_ms": 1e-6,
+        },
+    )
+
+    # Nothing is shed before the engine measures its queue drain rate, which needs
+    # a few thousands of tokens prefilled while requests wait.
+    num_requests = 10
+    generation_cfg = GenerationConfig(max_tokens=4, temperature=0)
+
+    async def generate_task(prompt: str, request_id: str):
+        async for _ in async_engine._generate(prompt, generation_cfg, request_id=request_id):
+            pass
+
+    await asyncio.gather(
+        *[
+            asyncio.create_task(generate_task(prompts[i] * 30, request_id=str(i)))
+            for i in range(num_requests)
+        ]
+    )
+
+    # Every request is then predicted to miss the deadline, and fails with OverloadedError
+    # rather than finishing with a finish reason outside the OpenAI protocol.
+    with pytest.raises(error_protocol.OverloadedError) as exc_info:
+        await async_engine.chat.completions.create(
+            messages=[{"role": "user", "content": prompts[0]}], model=model, max_tokens=4
+        )
+    with pytest.raises(error_protocol.OverloadedError):
+        async for _ in await async_engine.completions.create(
+            prompt=prompts[0], model=model, max_tokens=4, stream=True
+        ):
+            pass
+    assert json.loads(async_engine.stats())["num_rejected_requests"] == 2
+
+    # The server returns the error as "503 Service Unavailable".
+    response = await error_protocol.overloaded_error_handler(None, exc_info.value)
+    assert response.status_code == HTTPStatus.SERVICE_UNAVAILABLE
+
+    async_engine.terminate()
+    del async_engine
+
+
 if __name__ == "__main__":
     asyncio.run(test_engine_generate())
     asyncio.run(test_chat_completion())
     asyncio.run(test_chat_completion_non_stream())
     asyncio.run(test_completion())
     asyncio.run(test_completion_non_stream())
+    asyncio.run(test_engine_abort_mid_step())
+    asyncio.run(test_load_shedding())
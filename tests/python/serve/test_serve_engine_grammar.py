@@ -121,6 +121,49 @@ def test_batch_generation_with_schema():
                 print(f"Output {req_id}({i}): {output}\n")
 
 
+def test_batch_generation_jump_forward():
+    prompt = (
+        "Generate a json containing three fields: an integer field named size, a "
+        "boolean field named is_accepted, and a float field named num:"
+    )
+    prompts = [prompt] * 3
+
+    class Schema(BaseModel):
+        size: int
+        is_accepted: bool
+        num: float
+
+    # The keys and the separators of the schema are forced literals, which are jumped forward.
+    schema_str = json.dumps(Schema.model_json_schema())
+    generation_config = GenerationConfig(
+        temperature=0,
+        max_tokens=128,
+        stop_token_ids=[2],
+        response_format=ResponseFormat(type="json_object", schema=schema_str),
+    )
+
+    outputs = []
+    for jump_forward_max_tokens in [0, 16]:
+        engine = SyncMLCEngine(
+            model=model_path,
+            mode="server",
+            engine_config_overrides={"grammar_jump_forward_max_tokens": jump_forward_max_tokens},
+        )
+        output_texts, _ = engine.generate(prompts, generation_config)
+        num_jump_forward_tokens = engine.stats()["total_jump_forward_tokens"]
+        if jump_forward_max_tokens == 0:
+            assert num_jump_forward_tokens == 0
+        else:
+            assert num_jump_forward_tokens > 0
+        for output in output_texts:
+            Schema.model_validate_json(output[0])
+        outputs.append(output_texts)
+        del engine
+
+    # Jump-forward decoding gives the same outputs as decoding the forced tokens one by one.
+    assert outputs[0] == outputs[1]
+
+
 async def run_async_engine():
     # Create engine
     async_engine = AsyncMLCEngine(model=model_path, mode="server")
@@ -197,5 +240,6 @@ def test_generation_config_error():
 
 if __name__ == "__main__":
     test_batch_generation_with_grammar()
+    test_batch_generation_jump_forward()
     test_async_engine()
     test_generation_config_error()
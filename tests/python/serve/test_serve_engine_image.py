@@ -51,5 +51,44 @@ def test_engine_generate():
                 print(f"Output {req_id}({i}):{output}\n")
 
 
+def test_engine_image_prefix_cache():
+    # Create engine
+    model = "dist/llava-1.5-7b-hf-q4f16_1-MLC/params"
+    model_lib = "dist/llava-1.5-7b-hf-q4f16_1-MLC/llava-1.5-7b-hf-q4f16_1-MLC.so"
+    engine = SyncMLCEngine(
+        model=model,
+        model_lib=model_lib,
+        mode="server",
+        max_total_sequence_length=4096,
+    )
+
+    with open(Path(model) / "mlc-chat-config.json", "r", encoding="utf-8") as file:
+        model_config = json.load(file)
+    embed_size = data.ImageData.get_embed_size(model_config)
+
+    def get_prompt():
+        return [
+            data.TextData("USER: "),
+            get_test_image(model_config),
+            data.TextData("\nWhat does this image represent? ASSISTANT:"),
+        ]
+
+    generation_config = GenerationConfig(temperature=0, max_tokens=8, stop_token_ids=[2])
+    output_texts, _ = engine.generate([get_prompt()], generation_config)
+    stats = engine.stats()
+    print(stats)
+    total_prefill_tokens = stats["total_prefill_tokens"]
+    assert total_prefill_tokens > embed_size
+
+    # The identical image prompt, with the image loaded again, hits the prefix cache,
+    # so that neither the image positions nor the text are prefilled again.
+    output_texts_hit, _ = engine.generate([get_prompt()], generation_config)
+    stats = engine.stats()
+    print(stats)
+    assert stats["total_prefill_tokens"] - total_prefill_tokens < embed_size
+    assert output_texts_hit == output_texts
+
+
 if __name__ == "__main__":
     test_engine_generate()
+    test_engine_image_prefix_cache()
@@ -135,8 +135,41 @@ def test_engine_eagle_multi_round():
     test_engine_multi_round(engine)
 
 
+def test_engine_overlap_scheduling_reuse():
+    # Create engine
+    model = "HF://mlc-ai/Llama-2-7b-chat-hf-q0f16-MLC"
+    engine = SyncMLCEngine(
+        model=model,
+        mode="server",
+        max_total_sequence_length=4096,
+        engine_config_overrides={"overlap_scheduling": True},
+    )
+    num_requests = 4
+    generation_config = GenerationConfig(temperature=0, max_tokens=8)
+    # The requests finish in the post-processing that overlaps with the next decode,
+    # which has already appended their last committed tokens to the KV cache.
+    output_texts, _ = engine.generate(prompts[:num_requests], generation_config)
+    stats = engine.stats()
+    print(stats)
+    total_prefill_tokens = stats["total_prefill_tokens"]
+
+    # The follow-up prompts reuse the finished sequences, and must generate the same outputs
+    # as when they are prefilled from scratch.
+    follow_up_prompts = [prompts[i] + " " + output_texts[i][0] + " ?" for i in range(num_requests)]
+    follow_up_lens = [len(engine.tokenizer.encode(prompt)) for prompt in follow_up_prompts]
+    output_texts_reused, _ = engine.generate(follow_up_prompts, generation_config)
+    stats = engine.stats()
+    print(stats)
+    assert stats["total_prefill_tokens"] - total_prefill_tokens < sum(follow_up_lens)
+
+    engine.reset()
+    output_texts_from_scratch, _ = engine.generate(follow_up_prompts, generation_config)
+    assert output_texts_reused == output_texts_from_scratch
+
+
 if __name__ == "__main__":
     test_basic_engine_system_prompt()
     test_basic_engine_multi_round()
     test_engine_spec_multi_round()
     test_engine_eagle_multi_round()
+    test_engine_overlap_scheduling_reuse()
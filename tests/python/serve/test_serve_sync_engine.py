@@ -378,9 +378,101 @@ def test_engine_generate():
                 print(f"Output {req_id}({i}):{output}\n")
 
 
+def test_engine_multi_step_decode_stop():
+    model = "HF://mlc-ai/Llama-2-7b-chat-hf-q0f16-MLC"
+    num_requests = 4
+    # The stop token appears within the multi-step decode of some requests.
+    generation_config = GenerationConfig(temperature=0, max_tokens=64, stop_token_ids=[2])
+
+    # The tokens decoded past the stop are neither returned nor counted as decoded.
+    results = []
+    for num_decode_steps_per_step in [1, 4]:
+        engine = SyncMLCEngine(
+            model=model,
+            mode="server",
+            max_total_sequence_length=4096,
+            engine_config_overrides={"num_decode_steps_per_step": num_decode_steps_per_step},
+        )
+        output_texts, _ = engine.generate(prompts[:num_requests], generation_config)
+        stats = engine.stats()
+        print(stats)
+        results.append((output_texts, stats["total_decode_tokens"]))
+        del engine
+    assert results[0] == results[1]
+
+
+def test_engine_slo_aware_scheduling():
+    # Record the order in which the requests get their first tokens.
+    first_token_order: List[str] = []
+    num_finished_requests = 0
+
+    def fcallback(delta_outputs: List[RequestStreamOutput]):
+        nonlocal num_finished_requests
+        for delta_output in delta_outputs:
+            request_id, stream_outputs = delta_output.unpack()
+            if request_id not in first_token_order and stream_outputs[0].delta_token_ids:
+                first_token_order.append(request_id)
+            if stream_outputs[0].finish_reason is not None:
+                num_finished_requests += 1
+
+    # Create engine, which runs one request at a time.
+    model = "HF://mlc-ai/Llama-2-7b-chat-hf-q0f16-MLC"
+    engine = SyncMLCEngine(
+        model=model,
+        mode="server",
+        max_batch_size=1,
+        max_total_sequence_length=4096,
+        prefill_chunk_size=16,
+        request_stream_callback=fcallback,
+        engine_config_overrides={"scheduler_mode": "slo_aware"},
+    )
+
+    def add_request(request_id: str, prompt: str, **kwargs):
+        engine.add_request(
+            Request(
+                request_id=request_id,
+                inputs=data.TextData(prompt),
+                generation_config=GenerationConfig(temperature=0, max_tokens=4, **kwargs),
+            )
+        )
+
+    def run_to_finish(num_requests: int):
+        while num_finished_requests < num_requests:
+            engine.step()
+
+    # - The request with higher priority goes first, then the one with less deadline slack.
+    # Requests with the same priority and no deadline keep the arrival order.
+    add_request("nodeadline0", prompts[0])
+    add_request("nodeadline1", prompts[1])
+    add_request("deadline", prompts[2], ttft_slo_ms=1e6)
+    add_request("priority", prompts[3], priority=1)
+    add_request("nodeadline2", prompts[4])
+    run_to_finish(5)
+    assert first_token_order == [
+        "priority",
+        "deadline",
+        "nodeadline0",
+        "nodeadline1",
+        "nodeadline2",
+    ]
+
+    # - The request that has started chunked prefill is not overtaken by a more urgent one.
+    first_token_order.clear()
+    add_request("started", prompts[9])
+    engine.step()
+    assert not first_token_order
+    add_request("urgent", prompts[0], priority=1)
+    run_to_finish(7)
+    assert first_token_order == ["started", "urgent"]
+
+    del engine
+
+
 if __name__ == "__main__":
     test_engine_basic()
     test_engine_continuous_batching_1()
     test_engine_continuous_batching_2()
     test_engine_continuous_batching_3()
     test_engine_generate()
+    test_engine_multi_step_decode_stop()
+    test_engine_slo_aware_scheduling()
@@ -134,6 +134,87 @@ def test_stop_str_handler_return_cached_tokens(
     assert total_text == expected_text
 
 
+overlapping_stop_strs_expected_text = [
+    # The stop string that completes first wins.
+    (["paragraph about", "short paragraph"], "Sure, here's a"),
+    # When several stop strings complete at the same position, the longest one wins.
+    (["a short", "here's a short"], "Sure,"),
+    (["a short"], "Sure, here's"),
+]
+
+
+@pytest.mark.parametrize("stop_strs_and_expected_text", overlapping_stop_strs_expected_text)
+def test_stop_str_handler_overlapping_stops(
+    llama_tokenizer_path: str,  # pylint: disable=redefined-outer-name
+    stop_strs_and_expected_text: Tuple[List[str], str],
+):
+    stop_strs, expected_text = stop_strs_and_expected_text
+    tokenizer = Tokenizer(llama_tokenizer_path)
+    stop_handler = StopStrHandler(stop_strs, tokenizer)
+
+    total_text = stop_handler_process_tokens(stop_handler, para_input_tokens, tokenizer)
+    assert stop_handler.stop_triggered
+    assert total_text == expected_text
+
+
+def test_stop_str_handler_stop_across_tokens(
+    llama_tokenizer_path: str,  # pylint: disable=redefined-outer-name
+):
+    # The stop string spans " em", "o", "ji", ":", "\n", "\n", "H", "ey", and its first
+    # five characters already appear earlier in "emoji,".
+    stop_strs = ["emoji:\n\nHey"]
+    tokenizer = Tokenizer(llama_tokenizer_path)
+    stop_handler = StopStrHandler(stop_strs, tokenizer)
+
+    total_text = stop_handler_process_tokens(stop_handler, para_input_tokens, tokenizer)
+    assert stop_handler.stop_triggered
+    assert total_text == DECODED_PARAGRAPH[: DECODED_PARAGRAPH.index(" emoji:")]
+
+
+def test_stop_str_handler_partial_match_holdback(
+    llama_tokenizer_path: str,  # pylint: disable=redefined-outer-name
+):
+    stop_strs = ["emoji games"]
+    tokenizer = Tokenizer(llama_tokenizer_path)
+
+    # A token is held back while its tail may start the stop string, and released together
+    # with the tokens after it once the match fails.
+    stop_handler = StopStrHandler(stop_strs, tokenizer)
+    expected_returns = [
+        [],  # "Sure"
+        [18585, 29892],  # ","
+        [],  # " here"
+        [1244, 29915],  # "'"
+        [29879],  # "s"
+        [263],  # " a"
+        [3273],  # " short"
+        [14880],  # " paragraph"
+        [1048],  # " about"
+        [],  # " em"
+        [],  # "o"
+        [],  # "ji"
+        [953, 29877, 2397, 29892],  # ","
+    ]
+    for token, expected_return in zip(para_input_tokens, expected_returns):
+        assert stop_handler.put(token) == expected_return
+        assert not stop_handler.stop_triggered
+
+    # The held-back tokens are returned on finish.
+    stop_handler = StopStrHandler(stop_strs, tokenizer)
+    returned_tokens = []
+    for token in para_input_tokens[:12]:
+        returned_tokens += stop_handler.put(token)
+    assert returned_tokens == para_input_tokens[:9]
+    assert stop_handler.finish() == [953, 29877, 2397]
+    assert not stop_handler.stop_triggered
+
+    # The full paragraph stops at the only complete occurrence.
+    stop_handler = StopStrHandler(stop_strs, tokenizer)
+    total_text = stop_handler_process_tokens(stop_handler, para_input_tokens, tokenizer)
+    assert stop_handler.stop_triggered
+    assert total_text == DECODED_PARAGRAPH[: DECODED_PARAGRAPH.index(" emoji games")]
+
+
 def test_stop_str_handler_throughput(
     llama_tokenizer_path: str,  # pylint: disable=redefined-outer-name
 ):
@@ -186,13 +267,70 @@ def test_text_streamer_emojis(
     assert total_text in expected_results
 
 
+# The llama tokenizer falls back to the byte tokens "<0x00>" to "<0xFF>" at ids 3 to 258.
+utf8_split_tokens_expected_outputs = [
+    # "👀" is split into four byte tokens.
+    ([[243], [162], [148], [131]], ["", "", "", "👀"]),
+    # "é" and "哈" are split into two and three byte tokens.
+    ([[198], [172], [232], [150], [139]], ["", "é", "", "", "哈"]),
+    # The character is completed in the middle of a put, followed by a regular token.
+    ([[243, 162], [148, 131, 505]], ["", "👀 have"]),
+]
+
+
+@pytest.mark.parametrize("tokens_and_outputs", utf8_split_tokens_expected_outputs)
+def test_text_streamer_utf8_split_across_tokens(
+    llama_tokenizer_path: str,  # pylint: disable=redefined-outer-name
+    tokens_and_outputs: Tuple[List[List[int]], List[str]],
+):
+    # Each multi-byte character is returned once all its bytes arrive, and never before.
+    text_streamer = TextStreamer(Tokenizer(llama_tokenizer_path))
+    delta_tokens_list, expected_outputs = tokens_and_outputs
+    outputs = [text_streamer.put(delta_tokens) for delta_tokens in delta_tokens_list]
+    assert outputs == expected_outputs
+    assert text_streamer.finish() == ""
+
+
+byte_fallback_tokens_expected_outputs = [
+    # The byte token of an ASCII character.
+    ([[13], [505]], ["\n", " have"], ""),
+    # A character that a regular token interrupts is replaced as a whole.
+    ([[243], [162], [505]], ["", "", "\ufffd have"], ""),
+    # A continuation byte without a leading byte is replaced right away.
+    ([[162], [505]], ["\ufffd", " have"], ""),
+    # An incomplete character is held back until the finish, which replaces it.
+    ([[243], [162], [148]], ["", "", ""], "\ufffd"),
+]
+
+
+@pytest.mark.parametrize("tokens_and_outputs", byte_fallback_tokens_expected_outputs)
+def test_text_streamer_byte_fallback(
+    llama_tokenizer_path: str,  # pylint: disable=redefined-outer-name
+    tokens_and_outputs: Tuple[List[List[int]], List[str], str],
+):
+    text_streamer = TextStreamer(Tokenizer(llama_tokenizer_path))
+    delta_tokens_list, expected_outputs, expected_finish_output = tokens_and_outputs
+    outputs = [text_streamer.put(delta_tokens) for delta_tokens in delta_tokens_list]
+    assert outputs == expected_outputs
+    assert text_streamer.finish() == expected_finish_output
+
+
 if __name__ == "__main__":
     tokenizer_path = _get_tokenizer_path()
     test_text_streamer(tokenizer_path)
     test_stop_str_handler_stop(tokenizer_path)
     test_stop_str_handler_not_stop(tokenizer_path)
     test_stop_str_handler_return_cached_tokens(tokenizer_path)
+    for stop_strs_and_text in overlapping_stop_strs_expected_text:
+        test_stop_str_handler_overlapping_stops(tokenizer_path, stop_strs_and_text)
+    test_stop_str_handler_stop_across_tokens(tokenizer_path)
+    test_stop_str_handler_partial_match_holdback(tokenizer_path)
     test_stop_str_handler_throughput(tokenizer_path)
 
     for tokens_and_res in emoji_tokens_expected_result:
         test_text_streamer_emojis(tokenizer_path, tokens_and_res)
+
+    for tokens_and_outputs in utf8_split_tokens_expected_outputs:
+        test_text_streamer_utf8_split_across_tokens(tokenizer_path, tokens_and_outputs)
+    for tokens_and_outputs in byte_fallback_tokens_expected_outputs:
+        test_text_streamer_byte_fallback(tokenizer_path, tokens_and_outputs)
@@ -42,3 +42,4 @@
 #include "serve/grammar/grammar_state_matcher.cc"
 #include "serve/grammar/json_schema_converter.cc"
 #include "support/encoding.cc"
+#include "token_table.cc"